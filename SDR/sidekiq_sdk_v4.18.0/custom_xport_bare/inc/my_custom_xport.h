@@ -0,0 +1,313 @@
+/** @file   my_custom_xport.h
+ *
+ * @brief This header describes the link between the reference custom transport
+ * (my_custom_xport.c) and the peer at the far end of it, typically a process
+ * that emulates a Sidekiq card or bridges to one.  The peer answers FPGA
+ * register accesses, produces receive blocks and consumes transmit blocks.
+ *
+ * Three links are supported, selected with the SKIQ_XPORT_MODE environment
+ * variable:
+ *
+ * - "shm" (default): the peer creates one POSIX shared memory object per card,
+ *   named "<SKIQ_XPORT_SHM>.<card>" (default "/skiq_xport.0", ...).  The object
+ *   starts with a struct my_xport_shm, followed by the receive and transmit
+ *   rings.  Each ring is single producer / single consumer; the receive ring
+ *   is produced by the peer and the transport hands its slots to
+ *   skiq_receive() without copying, the transmit ring is produced by the
+ *   transport.  Register accesses and streaming commands go through a
+ *   mailbox.
+ *
+ * - "udp": SKIQ_XPORT_UDP lists one "host:port" per card.  Requests are sent to
+ *   the control port and answered with the same sequence number; sample
+ *   blocks are exchanged with the data port (port + 1), one block per
+ *   datagram preceded by a struct my_xport_udp_hdr.  Receive blocks are sent
+ *   to the local port announced in the data field of MY_XPORT_OP_RX_START.
+ *
+ * - "replay": there is no peer, the transport itself serves a previously
+ *   captured rx_samples output file per card (SKIQ_XPORT_REPLAY lists them,
+ *   separated by commas) as if its blocks were coming off the FPGA, for
+ *   reproducible benchmarks without hardware.  Registers only read back what
+ *   was written to them and transmit blocks are discarded.
+ *   SKIQ_XPORT_REPLAY_OPTS is a comma separated list of "key=value":
+ *     - meta=0|1      the file was captured with --meta, so it holds whole
+ *                     blocks (header included) of "block" bytes; otherwise it
+ *                     holds samples only and headers are generated (default 0)
+ *     - block=N       block size of a --meta capture in bytes (default 4096)
+ *     - packed=0|1    a samples only file holds packed samples (captured with
+ *                     --packed), 4 samples per 3 words, so the generated RF
+ *                     timestamps advance by samples rather than words; a
+ *                     --meta capture carries its own timestamps (default 0)
+ *     - rate=N        pace the blocks at N samples per second, 0 serves them
+ *                     as fast as possible (default 0)
+ *     - loop=0|1      start over at the end of the file (default 1)
+ *     - gap=N         drop one block after every N blocks, leaving a hole in
+ *                     the RF timestamps (default 0, never)
+ *     - overrun=N     drop MY_XPORT_REPLAY_OVERRUN_BLOCKS blocks after every N
+ *                     blocks and report skiq_rx_status_error_overrun
+ *                     (default 0, never)
+ *   RF timestamps continue across loops and dropped blocks, they start at the
+ *   first timestamp of a --meta capture or at 0.
+ *
+ * Besides the skiq_xport_fpga_functions_t operations, the transport exports
+ * my_xport_fpga_reg_write_burst() for applications linked with it.  It writes
+ * a run of words to one register, e.g. the data register of a FIFO, in a
+ * single MY_XPORT_OP_REG_WRITE_BURST request per MY_XPORT_UDP_BURST_WORDS
+ * words over UDP instead of one request per word.
+ *
+ * It also exports my_xport_rx_ready_fd(), a file descriptor per card that
+ * becomes readable when skiq_receive() has a block to return, so that an
+ * application can sleep in poll() or epoll_wait() on several cards instead of
+ * spinning on skiq_rx_status_no_data.  From version 2 on, the producer of the
+ * shared memory receive ring rings a doorbell after publishing blocks:
+ *
+ *     __atomic_store_n( &rx.head, head, __ATOMIC_SEQ_CST );
+ *     __atomic_add_fetch( &rx.doorbell, 1, __ATOMIC_SEQ_CST );
+ *     if ( __atomic_load_n( &rx.waiters, __ATOMIC_SEQ_CST ) != 0 )
+ *         futex( &rx.doorbell, FUTEX_WAKE, INT_MAX );
+ *
+ * The transport still accepts version 1 peers, it then checks the ring every
+ * MY_XPORT_READY_NAP_NS instead of sleeping on the doorbell.
+ */
+
+#ifndef __MY_CUSTOM_XPORT_H__
+#define __MY_CUSTOM_XPORT_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/***** DEFINES *****/
+
+#define MY_XPORT_MAGIC                  (0x534b5850)    /* "SKXP" */
+#define MY_XPORT_VERSION                (2)
+
+/* environment variables that configure the transport */
+#define MY_XPORT_ENV_MODE               "SKIQ_XPORT_MODE"
+#define MY_XPORT_ENV_SHM                "SKIQ_XPORT_SHM"
+#define MY_XPORT_ENV_UDP                "SKIQ_XPORT_UDP"
+#define MY_XPORT_ENV_REPLAY             "SKIQ_XPORT_REPLAY"
+#define MY_XPORT_ENV_REPLAY_OPTS        "SKIQ_XPORT_REPLAY_OPTS"
+
+#define MY_XPORT_DEFAULT_SHM            "/skiq_xport"
+
+/* largest receive block, matches SKIQ_MAX_RX_BLOCK_SIZE_IN_BYTES */
+#define MY_XPORT_RX_SLOT_SIZE           (4096)
+
+/* slots start on a page so they can be handed out as DMA-like buffers */
+#define MY_XPORT_SLOT_ALIGN             (4096)
+
+#define MY_XPORT_CACHE_LINE             (64)
+
+/* number of blocks an injected overrun drops */
+#define MY_XPORT_REPLAY_OVERRUN_BLOCKS  (32)
+
+/* largest number of words carried by one MY_XPORT_OP_REG_WRITE_BURST datagram */
+#define MY_XPORT_UDP_BURST_WORDS        (1024)
+
+/***** TYPEDEFS *****/
+
+/* requests answered by the peer; shared memory uses the mailbox, UDP uses the
+   control port */
+enum my_xport_op
+{
+    MY_XPORT_OP_HELLO = 1,              /* probe, no arguments */
+    MY_XPORT_OP_REG_READ,               /* addr, returns data */
+    MY_XPORT_OP_REG_WRITE,              /* addr, data */
+    MY_XPORT_OP_REG_READ64,             /* addr, returns data */
+    MY_XPORT_OP_REG_WRITE64,            /* addr, data */
+    MY_XPORT_OP_FPGA_DOWN,
+    MY_XPORT_OP_FPGA_UP,
+    MY_XPORT_OP_RX_CONFIGURE,           /* data is the aggregate rate in bytes per second */
+    MY_XPORT_OP_RX_BLOCK_SIZE,          /* data is the block size in bytes */
+    MY_XPORT_OP_RX_START,               /* addr is the handle, data the UDP port to stream to */
+    MY_XPORT_OP_RX_STOP,                /* addr is the handle */
+    MY_XPORT_OP_RX_PAUSE,
+    MY_XPORT_OP_RX_RESUME,
+    MY_XPORT_OP_RX_FLUSH,               /* drop the blocks produced so far */
+    MY_XPORT_OP_TX_INIT,                /* data is the block size in bytes */
+    MY_XPORT_OP_TX_START,
+    MY_XPORT_OP_TX_STOP,
+    MY_XPORT_OP_REG_WRITE_BURST,        /* addr, data is the number of words, UDP only: the
+                                           words follow the header, written in order; a
+                                           retry repeats seq and must not write again */
+
+    /* UDP data port only */
+    MY_XPORT_OP_RX_DATA = 0x100,
+    MY_XPORT_OP_TX_DATA,
+    MY_XPORT_OP_RESPONSE = 0x200,       /* or'ed into the op of a control response */
+};
+
+struct my_xport_mailbox
+{
+    uint32_t seq;                       /* written by the transport after the request */
+    uint32_t op;                        /* enum my_xport_op */
+    uint32_t addr;
+    int32_t status;                     /* written by the peer, 0 or a negative errno */
+    uint64_t data;                      /* argument, or result of a read */
+    uint32_t ack;                       /* written by the peer (= seq) once answered */
+} __attribute__((aligned(MY_XPORT_CACHE_LINE)));
+
+struct my_xport_ring
+{
+    /* the indices run freely, the slot is the index modulo nr_slots */
+    uint64_t head __attribute__((aligned(MY_XPORT_CACHE_LINE)));    /* producer */
+    uint32_t doorbell;                  /* version 2: bumped by the producer after head */
+    uint64_t tail __attribute__((aligned(MY_XPORT_CACHE_LINE)));    /* consumer */
+    uint64_t nr_dropped;                /* blocks the producer dropped on a full ring */
+    uint32_t nr_slots;
+    uint32_t slot_size;
+    uint64_t lens_offset;               /* uint32_t length of each slot */
+    uint64_t slots_offset;
+    uint32_t waiters;                   /* version 2: non-zero while the consumer sleeps on
+                                           the doorbell */
+} __attribute__((aligned(MY_XPORT_CACHE_LINE)));
+
+/* start of the shared memory object */
+struct my_xport_shm
+{
+    uint32_t magic;                     /* written last by the peer, once the rest is valid */
+    uint32_t version;
+    uint64_t size;                      /* size of the object */
+    struct my_xport_mailbox mailbox;
+    struct my_xport_ring rx;            /* produced by the peer */
+    struct my_xport_ring tx;            /* produced by the transport */
+};
+
+/* precedes every UDP datagram */
+struct my_xport_udp_hdr
+{
+    uint32_t magic;
+    uint32_t op;                        /* enum my_xport_op */
+    uint32_t seq;                       /* matches requests and responses, counts blocks */
+    int32_t status;
+    uint32_t addr;
+    uint32_t len;                       /* bytes following the header */
+    uint64_t data;
+};
+
+/***** FUNCTIONS *****/
+
+/*****************************************************************************/
+/** Write a run of words to one FPGA register, in order, with as few requests
+    to the peer as the link allows.  Exported by my_custom_xport.c.
+
+    @param[in] xport_uid    unique ID used to identify the card at the transport layer
+    @param[in] addr         address of the destination FPGA register
+    @param[in] p_data       words to write
+    @param[in] nr_words     number of words
+
+    @return status where 0=success, else a negative errno
+*/
+int32_t my_xport_fpga_reg_write_burst( uint64_t xport_uid,
+                                       uint32_t addr,
+                                       const uint32_t *p_data,
+                                       uint32_t nr_words );
+
+/*****************************************************************************/
+/** Get a file descriptor that signals when a card has receive blocks, for
+    poll(), select() or epoll.  Exported by my_custom_xport.c.
+
+    The descriptor becomes readable once skiq_receive() would return a block
+    (or an overrun).  The caller then reads the descriptor if it is an eventfd
+    (@a p_is_eventfd), and calls skiq_receive() until it returns
+    skiq_rx_status_no_data before waiting on it again; returning no data is
+    what re-arms the notification.  Over UDP this is the data socket itself,
+    which must not be read.  The descriptor stays owned by the transport and is
+    closed by skiq_exit().
+
+    @param[in] xport_uid    unique ID used to identify the card at the transport layer
+    @param[out] p_is_eventfd set to true if the descriptor is an eventfd to read after waking
+
+    @return the file descriptor, else a negative errno
+*/
+int my_xport_rx_ready_fd( uint64_t xport_uid,
+                          bool *p_is_eventfd );
+
+/***** INLINE FUNCTIONS  *****/
+
+static inline uint64_t _my_xport_align( uint64_t value, uint64_t align )
+{
+    return ( value + align - 1 ) & ~( align - 1 );
+}
+
+/*****************************************************************************/
+/** Lay out the shared memory object of a card.  Used by the peer to create it.
+
+    @param[in] p_shm        start of the object, may be NULL to only compute the size
+    @param[in] nr_rx_slots  number of receive slots of MY_XPORT_RX_SLOT_SIZE bytes
+    @param[in] nr_tx_slots  number of transmit slots
+    @param[in] tx_slot_size largest transmit block in bytes (header included)
+
+    @return the size of the object in bytes
+*/
+static inline uint64_t my_xport_shm_layout( struct my_xport_shm *p_shm,
+                                            uint32_t nr_rx_slots,
+                                            uint32_t nr_tx_slots,
+                                            uint32_t tx_slot_size )
+{
+    uint64_t rx_lens = _my_xport_align( sizeof(struct my_xport_shm), MY_XPORT_CACHE_LINE );
+    uint64_t tx_lens = _my_xport_align( rx_lens + ( nr_rx_slots * sizeof(uint32_t) ),
+                                        MY_XPORT_CACHE_LINE );
+    uint64_t rx_slots = _my_xport_align( tx_lens + ( nr_tx_slots * sizeof(uint32_t) ),
+                                         MY_XPORT_SLOT_ALIGN );
+    uint64_t tx_slots;
+    uint64_t size;
+
+    tx_slot_size = (uint32_t)_my_xport_align( tx_slot_size, MY_XPORT_CACHE_LINE );
+    tx_slots = _my_xport_align( rx_slots + ( (uint64_t)nr_rx_slots * MY_XPORT_RX_SLOT_SIZE ),
+                                MY_XPORT_SLOT_ALIGN );
+    size = tx_slots + ( (uint64_t)nr_tx_slots * tx_slot_size );
+
+    if ( p_shm != NULL )
+    {
+        p_shm->version = MY_XPORT_VERSION;
+        p_shm->size = size;
+        p_shm->rx.nr_slots = nr_rx_slots;
+        p_shm->rx.slot_size = MY_XPORT_RX_SLOT_SIZE;
+        p_shm->rx.lens_offset = rx_lens;
+        p_shm->rx.slots_offset = rx_slots;
+        p_shm->tx.nr_slots = nr_tx_slots;
+        p_shm->tx.slot_size = tx_slot_size;
+        p_shm->tx.lens_offset = tx_lens;
+        p_shm->tx.slots_offset = tx_slots;
+    }
+
+    return size;
+}
+
+/*****************************************************************************/
+/** Locate a slot of a ring.
+
+    @param[in] p_shm        start of the object
+    @param[in] p_ring       &p_shm->rx or &p_shm->tx
+    @param[in] index        free running ring index
+
+    @return the slot
+*/
+static inline uint8_t *my_xport_slot( struct my_xport_shm *p_shm,
+                                      const struct my_xport_ring *p_ring,
+                                      uint64_t index )
+{
+    return (uint8_t *)p_shm + p_ring->slots_offset +
+        ( ( index % p_ring->nr_slots ) * p_ring->slot_size );
+}
+
+/*****************************************************************************/
+/** Locate the length of a slot of a ring.
+
+    @param[in] p_shm        start of the object
+    @param[in] p_ring       &p_shm->rx or &p_shm->tx
+    @param[in] index        free running ring index
+
+    @return the length of the slot in bytes
+*/
+static inline uint32_t *my_xport_slot_len( struct my_xport_shm *p_shm,
+                                           const struct my_xport_ring *p_ring,
+                                           uint64_t index )
+{
+    return (uint32_t *)( (uint8_t *)p_shm + p_ring->lens_offset ) + ( index % p_ring->nr_slots );
+}
+
+#endif  /* __MY_CUSTOM_XPORT_H__ */
@@ -1,15 +1,25 @@
 /** @file   my_custom_xport.c
  * @date   Thu Jun  2 16:32:12 2016
  * 
- * @brief This source file contains a skeleton of a full custom transport.  It
- * is designed as a starting point for custom transport implementations.  The
- * primary focus of a custom transport is the card_probe, card_init, and
- * card_exit.  These functions are called from sidekiq_core when a user wishes
- * to discover, initialize, or shutdown available Sidekiq cards respectively.
- * In the custom card_init() implementation, the custom transport developer
- * registers the FPGA, RX, or TX subsystems of the transport interface based on
- * init level and any hardware specifics (i.e. different RX functions may be
- * registered depending on card identifier).
+ * @brief This source file contains a reference implementation of a full custom
+ * transport.  It is designed as a starting point for custom transport
+ * implementations.  The primary focus of a custom transport is the card_probe,
+ * card_init, and card_exit.  These functions are called from sidekiq_core when
+ * a user wishes to discover, initialize, or shutdown available Sidekiq cards
+ * respectively.  In the custom card_init() implementation, the custom transport
+ * developer registers the FPGA, RX, or TX subsystems of the transport interface
+ * based on init level and any hardware specifics (i.e. different RX functions
+ * may be registered depending on card identifier).
+ *
+ * This implementation streams with a peer process over either a POSIX shared
+ * memory ring (for a loopback or a simulator) or UDP, as described in
+ * my_custom_xport.h.  Register accesses and streaming commands are forwarded
+ * to the peer.  Receive blocks are handed out of the shared memory ring
+ * without copying, or received in batches with recvmmsg(); asynchronous
+ * transmit blocks are sent in batches with sendmmsg().  Without a peer, it
+ * can also replay rx_samples captures with paced timestamps and injected
+ * gaps and overruns.  my_xport_rx_ready_fd() lets applications sleep until a
+ * card has blocks instead of polling skiq_receive().
  *
  * Each function below describes the potential input(s) and the expected
  * output(s).
@@ -19,35 +29,1562 @@
  * </pre>
  */
 
-/***** INCLUDES *****/ 
+#if (!defined _GNU_SOURCE)
+#define _GNU_SOURCE         /* for recvmmsg and sendmmsg, see feature_test_macros(7) */
+#endif
+
+/***** INCLUDES *****/ 
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sidekiq_api.h"
+#include "sidekiq_xport_api.h"
+
+#include "my_custom_xport.h"
+
+/***** DEFINES *****/
+
+#define MAX(a,b)                        ( ( (a) > (b) ) ? (a) : (b) )
+#define MIN(a,b)                        ( ( (a) < (b) ) ? (a) : (b) )
+
+/* how long to wait for the peer to answer a request */
+#define MY_XPORT_REQUEST_TIMEOUT_NS     (1000000000ULL)
+
+/* UDP requests are retried since datagrams may be lost */
+#define MY_XPORT_UDP_TIMEOUT_MS         (100)
+#define MY_XPORT_UDP_RETRIES            (3)
+
+/* number of datagrams per recvmmsg() / sendmmsg() call */
+#define MY_XPORT_UDP_BATCH              (32)
+
+#define MY_XPORT_UDP_RCVBUF             (8 * 1024 * 1024)
+
+/* registers a replayed card can hold */
+#define MY_XPORT_REPLAY_NR_REGS         (256)
+
+/* number of async transmit blocks that may be in flight */
+#define MY_XPORT_TX_QUEUE               (256)
+
+/* waiting on the peer spins this many times before sleeping MY_XPORT_NAP_NS */
+#define MY_XPORT_SPIN_COUNT             (1000)
+#define MY_XPORT_NAP_NS                 (20000)
+
+/* the readiness thread checks the ring of a version 1 peer this often */
+#define MY_XPORT_READY_NAP_NS           (50000)
+
+/* longest sleep of the readiness thread, bounds how long stopping it takes */
+#define MY_XPORT_READY_WAIT_NS          (10000000)
+
+#if (defined __x86_64__) || (defined __i386__)
+#define MY_XPORT_CPU_RELAX()            __asm__ __volatile__("pause" ::: "memory")
+#elif (defined __aarch64__) || (defined __arm__)
+#define MY_XPORT_CPU_RELAX()            __asm__ __volatile__("yield" ::: "memory")
+#else
+#define MY_XPORT_CPU_RELAX()            __asm__ __volatile__("" ::: "memory")
+#endif
+
+/***** TYPEDEFS *****/
+
+enum my_link
+{
+    my_link_shm = 0,
+    my_link_udp,
+    my_link_replay,
+};
+
+/***** STRUCTS *****/
+
+/* an async transmit block that hasn't been completed yet */
+struct my_tx_pending
+{
+    int32_t *p_samples;
+    void *p_private;
+    uint64_t index;                     /* shared memory: ring index after the block */
+};
+
+struct my_replay_reg
+{
+    bool used;
+    uint32_t addr;
+    uint64_t value;
+};
+
+/* state of a card served from a capture file */
+struct my_replay
+{
+    int fd;
+    const uint8_t *p_file;
+    size_t file_size;
+
+    /* SKIQ_XPORT_REPLAY_OPTS */
+    bool meta;
+    bool packed;
+    bool loop;
+    uint32_t meta_block_size;
+    uint64_t rate;
+    uint64_t gap_every;
+    uint64_t overrun_every;
+
+    uint32_t stride;                    /* bytes of each block in the file */
+    uint64_t nr_file_blocks;
+    uint64_t next_block;                /* next block of the file to serve */
+    uint64_t first_ts;
+    uint64_t ts_step;                   /* RF timestamp increment per block */
+    uint64_t rf_ts;                     /* RF timestamp of the next block */
+
+    bool streaming;
+    skiq_rx_hdl_t hdl;
+    uint64_t start_ns;                  /* pacing starts at start_ts at this time */
+    uint64_t start_ts;
+    uint64_t nr_delivered;
+    uint64_t last_injected;             /* nr_delivered at the last injected fault */
+    uint64_t ready_ns;                  /* published replay_due_ns(), UINT64_MAX for none */
+    uint8_t *p_block;
+
+    struct my_replay_reg regs[MY_XPORT_REPLAY_NR_REGS];
+};
+
+struct my_card
+{
+    bool active;
+    enum my_link link;
+    pthread_mutex_t ctrl_lock;          /* serializes requests to the peer */
+
+    /* shared memory link */
+    int shm_fd;
+    struct my_xport_shm *p_shm;
+    size_t shm_size;
+
+    /* UDP link, both sockets are connected to the peer */
+    int ctrl_fd;
+    int data_fd;
+    uint32_t ctrl_seq;
+    uint32_t tx_seq;
+    struct mmsghdr rx_msgs[MY_XPORT_UDP_BATCH];
+    struct iovec rx_iov[MY_XPORT_UDP_BATCH][2];
+    struct my_xport_udp_hdr rx_hdrs[MY_XPORT_UDP_BATCH];
+    uint8_t *p_rx_bufs;
+    uint32_t rx_nr_msgs;                /* datagrams of the last batch */
+    uint32_t rx_next;                   /* next datagram to hand out */
+    uint32_t rx_seq;
+
+    /* replay link */
+    struct my_replay replay;
+
+    /* receive */
+    int32_t rx_timeout_us;
+    bool rx_held;                       /* shared memory: a slot is handed out */
+
+    /* readiness notification, see my_xport_rx_ready_fd(); not used over UDP */
+    int ready_fd;                       /* eventfd, -1 until requested */
+    uint32_t ready_armed;               /* futex word, set when rx_receive() found no block */
+    bool ready_running;
+    pthread_t ready_thread;
+
+    /* transmit */
+    skiq_tx_transfer_mode_t tx_mode;
+    uint32_t tx_bytes;
+    skiq_tx_callback_t tx_cb;
+    uint64_t tx_head;                   /* shared memory: next ring index to produce */
+    pthread_mutex_t tx_lock;
+    pthread_cond_t tx_work;
+    pthread_cond_t tx_space;
+    struct my_tx_pending tx_queue[MY_XPORT_TX_QUEUE];
+    uint64_t tx_q_head;
+    uint64_t tx_q_tail;
+    pthread_t tx_thread;
+    bool tx_thread_started;
+    bool tx_running;
+
+    /* statistics, reported by card_exit() */
+    uint64_t nr_rx_blocks;
+    uint64_t nr_rx_gaps;
+    uint64_t nr_rx_overruns;
+    uint64_t nr_rx_batches;
+    uint64_t nr_rx_wakeups;
+    uint64_t nr_tx_blocks;
+    uint64_t nr_tx_batches;
+};
+
+/***** LOCAL VARIABLES *****/
+
+/* assigned at the bottom of this file */
+static skiq_xport_fpga_functions_t fpga_reg_ops;
+static skiq_xport_rx_functions_t rx_ops;
+static skiq_xport_tx_functions_t tx_ops;
+
+/* indexed by transport UID */
+static struct my_card cards[SKIQ_MAX_NUM_CARDS];
+
+/***** LOCAL FUNCTIONS *****/
+
+/*****************************************************************************/
+/** Look up the state of an active card.
+
+    @param[in] xport_uid unique ID used to identifer the card at the transport layer
+
+    @return the card, or NULL if it isn't active
+*/
+static struct my_card *get_card( uint64_t xport_uid )
+{
+    if ( ( xport_uid >= SKIQ_MAX_NUM_CARDS ) || !cards[xport_uid].active )
+    {
+        return NULL;
+    }
+
+    return &(cards[xport_uid]);
+}
+
+static uint64_t now_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ( (uint64_t)ts.tv_sec * 1000000000ULL ) + (uint64_t)ts.tv_nsec;
+}
+
+/* spin for a while, then back off with short sleeps; returns false once the
+   deadline (0 for none) has passed */
+static bool backoff( uint32_t *p_spins,
+                     uint64_t deadline_ns )
+{
+    if ( *p_spins < MY_XPORT_SPIN_COUNT )
+    {
+        (*p_spins)++;
+        MY_XPORT_CPU_RELAX();
+    }
+    else
+    {
+        struct timespec nap = { .tv_sec = 0, .tv_nsec = MY_XPORT_NAP_NS };
+
+        nanosleep( &nap, NULL );
+    }
+
+    return ( deadline_ns == 0 ) || ( now_ns() < deadline_ns );
+}
+
+/* sleep while *p_word holds val, for at most timeout_ns; p_word may be shared
+   with another process */
+static void futex_wait( uint32_t *p_word,
+                        uint32_t val,
+                        uint64_t timeout_ns,
+                        bool shared )
+{
+    struct timespec timeout = { .tv_sec = timeout_ns / 1000000000ULL,
+                                .tv_nsec = timeout_ns % 1000000000ULL };
+
+    syscall( SYS_futex, p_word, shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, val, &timeout,
+             NULL, 0 );
+}
+
+static void futex_wake( uint32_t *p_word,
+                        bool shared )
+{
+    syscall( SYS_futex, p_word, shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, INT_MAX, NULL,
+             NULL, 0 );
+}
+
+static enum my_link link_from_env( void )
+{
+    const char *p_mode = getenv( MY_XPORT_ENV_MODE );
+
+    if ( ( p_mode != NULL ) && ( strcasecmp( p_mode, "udp" ) == 0 ) )
+    {
+        return my_link_udp;
+    }
+    if ( ( p_mode != NULL ) && ( strcasecmp( p_mode, "replay" ) == 0 ) )
+    {
+        return my_link_replay;
+    }
+
+    return my_link_shm;
+}
+
+static void shm_name( uint64_t xport_uid,
+                      char *p_name,
+                      size_t size )
+{
+    const char *p_prefix = getenv( MY_XPORT_ENV_SHM );
+
+    if ( p_prefix == NULL )
+    {
+        p_prefix = MY_XPORT_DEFAULT_SHM;
+    }
+    snprintf( p_name, size, "%s.%" PRIu64, p_prefix, xport_uid );
+}
+
+/*****************************************************************************/
+/** Map the shared memory object of a card and check that the peer finished
+    creating it.
+
+    @param[in] xport_uid unique ID used to identifer the card at the transport layer
+    @param[out] p_fd file descriptor of the object
+    @param[out] pp_shm mapping of the object
+    @param[out] p_size size of the mapping
+
+    @return status where 0=success, else a negative errno
+*/
+static int32_t shm_map( uint64_t xport_uid,
+                        int *p_fd,
+                        struct my_xport_shm **pp_shm,
+                        size_t *p_size )
+{
+    char p_name[NAME_MAX];
+    struct stat st;
+    struct my_xport_shm *p_shm;
+    int fd;
+
+    shm_name( xport_uid, p_name, sizeof(p_name) );
+    fd = shm_open( p_name, O_RDWR, 0 );
+    if ( fd < 0 )
+    {
+        return -errno;
+    }
+    if ( ( fstat( fd, &st ) != 0 ) || ( (size_t)st.st_size < sizeof(struct my_xport_shm) ) )
+    {
+        close( fd );
+        return -ENODEV;
+    }
+
+    p_shm = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if ( p_shm == MAP_FAILED )
+    {
+        int32_t status = -errno;
+
+        close( fd );
+        return status;
+    }
+    if ( ( __atomic_load_n( &(p_shm->magic), __ATOMIC_ACQUIRE ) != MY_XPORT_MAGIC ) ||
+         ( p_shm->version < 1 ) || ( p_shm->version > MY_XPORT_VERSION ) ||
+         ( p_shm->size > (uint64_t)st.st_size ) ||
+         ( p_shm->rx.nr_slots == 0 ) || ( p_shm->tx.nr_slots == 0 ) )
+    {
+        munmap( p_shm, st.st_size );
+        close( fd );
+        return -ENODEV;
+    }
+
+    *p_fd = fd;
+    *pp_shm = p_shm;
+    *p_size = st.st_size;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Copy an entry of a comma separated list held by an environment variable.
+
+    @param[in] p_env name of the environment variable
+    @param[in] index entry to look up
+    @param[out] p_entry the entry
+    @param[in] size size of p_entry
+
+    @return status where 0=success, -ENODEV if there is no such entry
+*/
+static int32_t env_list_entry( const char *p_env,
+                               uint64_t index,
+                               char *p_entry,
+                               size_t size )
+{
+    const char *p_list = getenv( p_env );
+    const char *p_end;
+    size_t len;
+    uint64_t i;
+
+    if ( p_list == NULL )
+    {
+        return -ENODEV;
+    }
+    for ( i = 0; i < index; i++ )
+    {
+        p_list = strchr( p_list, ',' );
+        if ( p_list == NULL )
+        {
+            return -ENODEV;
+        }
+        p_list++;
+    }
+    p_end = strchr( p_list, ',' );
+    len = ( p_end != NULL ) ? (size_t)( p_end - p_list ) : strlen( p_list );
+    if ( ( len == 0 ) || ( len >= size ) )
+    {
+        return -ENODEV;
+    }
+    memcpy( p_entry, p_list, len );
+    p_entry[len] = '\0';
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Look up the control endpoint of a card in the list of SKIQ_XPORT_UDP, the
+    data endpoint is at the next port.
+
+    @param[in] xport_uid unique ID used to identifer the card at the transport layer
+    @param[out] p_addr control endpoint
+
+    @return status where 0=success, -ENODEV if there is no such entry
+*/
+static int32_t udp_endpoint( uint64_t xport_uid,
+                             struct sockaddr_in *p_addr )
+{
+    char p_entry[128];
+    struct addrinfo hints, *p_res = NULL;
+    char *p_port;
+
+    if ( env_list_entry( MY_XPORT_ENV_UDP, xport_uid, p_entry, sizeof(p_entry) ) != 0 )
+    {
+        return -ENODEV;
+    }
+
+    p_port = strrchr( p_entry, ':' );
+    if ( p_port == NULL )
+    {
+        return -ENODEV;
+    }
+    *p_port++ = '\0';
+
+    memset( &hints, 0, sizeof(hints) );
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if ( ( getaddrinfo( p_entry, p_port, &hints, &p_res ) != 0 ) || ( p_res == NULL ) )
+    {
+        return -ENODEV;
+    }
+    memcpy( p_addr, p_res->ai_addr, sizeof(*p_addr) );
+    freeaddrinfo( p_res );
+
+    return 0;
+}
+
+static int udp_connect( const struct sockaddr_in *p_addr )
+{
+    int fd = socket( AF_INET, SOCK_DGRAM, 0 );
+
+    if ( fd < 0 )
+    {
+        return -1;
+    }
+    if ( connect( fd, (const struct sockaddr *)p_addr, sizeof(*p_addr) ) != 0 )
+    {
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+
+/*****************************************************************************/
+/** Send a request to the control port and wait for the matching response,
+    retrying a few times since the datagrams may be lost.
+
+    @param[in] fd connected control socket
+    @param[in] seq sequence number of the request
+    @param[in] op request, one of enum my_xport_op
+    @param[in] addr address or handle argument
+    @param[in] data data argument
+    @param[in] timeout_ms time to wait for each attempt
+    @param[in] p_words words following the header, may be NULL
+    @param[in] nr_words number of words
+    @param[out] p_result data of the response, may be NULL
+
+    @return status of the response where 0=success, -ETIMEDOUT without response
+*/
+static int32_t udp_request( int fd,
+                            uint32_t seq,
+                            uint32_t op,
+                            uint32_t addr,
+                            uint64_t data,
+                            int timeout_ms,
+                            const uint32_t *p_words,
+                            uint32_t nr_words,
+                            uint64_t *p_result )
+{
+    struct my_xport_udp_hdr req = {
+        .magic = MY_XPORT_MAGIC,
+        .op = op,
+        .seq = seq,
+        .status = 0,
+        .addr = addr,
+        .len = nr_words * (uint32_t)sizeof(uint32_t),
+        .data = data,
+    };
+    struct iovec iov[2] = {
+        { .iov_base = &req, .iov_len = sizeof(req) },
+        { .iov_base = (void *)p_words, .iov_len = req.len },
+    };
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = ( nr_words > 0 ) ? 2 : 1 };
+    uint32_t attempt;
+
+    for ( attempt = 0; attempt < MY_XPORT_UDP_RETRIES; attempt++ )
+    {
+        uint64_t deadline_ns = now_ns() + ( (uint64_t)timeout_ms * 1000000ULL );
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+        if ( sendmsg( fd, &msg, 0 ) != (ssize_t)( sizeof(req) + req.len ) )
+        {
+            return -errno;
+        }
+
+        /* skip stale responses to earlier attempts */
+        while ( now_ns() < deadline_ns )
+        {
+            struct my_xport_udp_hdr resp;
+            int wait_ms = (int)( ( deadline_ns - now_ns() + 999999 ) / 1000000 );
+
+            if ( poll( &pfd, 1, wait_ms ) <= 0 )
+            {
+                continue;
+            }
+            if ( ( recv( fd, &resp, sizeof(resp), 0 ) == (ssize_t)sizeof(resp) ) &&
+                 ( resp.magic == MY_XPORT_MAGIC ) && ( resp.seq == seq ) &&
+                 ( resp.op == ( op | MY_XPORT_OP_RESPONSE ) ) )
+            {
+                if ( p_result != NULL )
+                {
+                    *p_result = resp.data;
+                }
+                return resp.status;
+            }
+        }
+    }
+
+    return -ETIMEDOUT;
+}
+
+/*****************************************************************************/
+/** Parse SKIQ_XPORT_REPLAY_OPTS, see my_custom_xport.h.
+
+    @param[out] p_replay replay state to configure
+
+    @return status where 0=success, -EINVAL on an unknown option
+*/
+static int32_t replay_parse_opts( struct my_replay *p_replay )
+{
+    const char *p_env = getenv( MY_XPORT_ENV_REPLAY_OPTS );
+    char *p_opts, *p_save = NULL, *p_opt;
+    int32_t status = 0;
+
+    p_replay->meta = false;
+    p_replay->packed = false;
+    p_replay->loop = true;
+    p_replay->meta_block_size = SKIQ_MAX_RX_BLOCK_SIZE_IN_BYTES;
+    p_replay->rate = 0;
+    p_replay->gap_every = 0;
+    p_replay->overrun_every = 0;
+
+    if ( p_env == NULL )
+    {
+        return 0;
+    }
+    p_opts = strdup( p_env );
+    if ( p_opts == NULL )
+    {
+        return -ENOMEM;
+    }
+
+    for ( p_opt = strtok_r( p_opts, ",", &p_save ); ( p_opt != NULL ) && ( status == 0 );
+          p_opt = strtok_r( NULL, ",", &p_save ) )
+    {
+        char *p_value = strchr( p_opt, '=' );
+        uint64_t value;
+
+        if ( p_value == NULL )
+        {
+            status = -EINVAL;
+            break;
+        }
+        *p_value++ = '\0';
+        value = strtoull( p_value, NULL, 0 );
+
+        if ( strcmp( p_opt, "meta" ) == 0 )
+        {
+            p_replay->meta = ( value != 0 );
+        }
+        else if ( strcmp( p_opt, "packed" ) == 0 )
+        {
+            p_replay->packed = ( value != 0 );
+        }
+        else if ( strcmp( p_opt, "loop" ) == 0 )
+        {
+            p_replay->loop = ( value != 0 );
+        }
+        else if ( strcmp( p_opt, "block" ) == 0 )
+        {
+            if ( ( value <= SKIQ_RX_HEADER_SIZE_IN_BYTES ) || ( value > MY_XPORT_RX_SLOT_SIZE ) )
+            {
+                status = -EINVAL;
+            }
+            p_replay->meta_block_size = (uint32_t)value;
+        }
+        else if ( strcmp( p_opt, "rate" ) == 0 )
+        {
+            p_replay->rate = value;
+        }
+        else if ( strcmp( p_opt, "gap" ) == 0 )
+        {
+            p_replay->gap_every = value;
+        }
+        else if ( strcmp( p_opt, "overrun" ) == 0 )
+        {
+            p_replay->overrun_every = value;
+        }
+        else
+        {
+            status = -EINVAL;
+        }
+        if ( status != 0 )
+        {
+            fprintf( stderr, "Error: invalid option '%s' in %s\n", p_opt, MY_XPORT_ENV_REPLAY_OPTS );
+        }
+    }
+    free( p_opts );
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Compute when the next block of a paced replay is due.
+
+    @param[in] p_replay replay state
+
+    @return the CLOCK_MONOTONIC time of the next block, 0 when not paced
+*/
+static uint64_t replay_due_ns( const struct my_replay *p_replay )
+{
+    if ( p_replay->rate == 0 )
+    {
+        return 0;
+    }
+
+    return p_replay->start_ns + (uint64_t)
+        ( (double)( p_replay->rf_ts - p_replay->start_ts ) * 1e9 / (double)p_replay->rate );
+}
+
+/*****************************************************************************/
+/** Publish when the next block is due for rx_ready_wait(), which runs on the
+    readiness thread while the replay state is changed by skiq_receive() and
+    by requests.  Called after every change to the replay position or
+    streaming state.
+
+    @param[in] p_replay replay state
+
+    @return void
+*/
+static void replay_publish( struct my_replay *p_replay )
+{
+    uint64_t due_ns = UINT64_MAX;
+
+    if ( p_replay->streaming && ( p_replay->next_block < p_replay->nr_file_blocks ) )
+    {
+        due_ns = replay_due_ns( p_replay );
+    }
+    __atomic_store_n( &(p_replay->ready_ns), due_ns, __ATOMIC_RELEASE );
+}
+
+/*****************************************************************************/
+/** Update the layout of the file for a receive block size.  A --meta capture
+    keeps the block size it was captured with, samples only captures are
+    served in blocks of block_size bytes, header included.
+
+    @param[in] p_replay replay state
+    @param[in] block_size receive block size in bytes
+
+    @return status where 0=success, -EINVAL if the file doesn't hold a block
+*/
+static int32_t replay_set_block_size( struct my_replay *p_replay,
+                                      uint32_t block_size )
+{
+    uint32_t stride = p_replay->meta ? p_replay->meta_block_size :
+        block_size - SKIQ_RX_HEADER_SIZE_IN_BYTES;
+
+    if ( ( block_size <= SKIQ_RX_HEADER_SIZE_IN_BYTES ) || ( block_size > MY_XPORT_RX_SLOT_SIZE ) ||
+         ( p_replay->file_size < stride ) )
+    {
+        return -EINVAL;
+    }
+
+    p_replay->stride = stride;
+    p_replay->nr_file_blocks = p_replay->file_size / stride;
+    p_replay->ts_step = ( stride - ( p_replay->meta ? SKIQ_RX_HEADER_SIZE_IN_BYTES : 0 ) ) /
+        sizeof(uint32_t);
+    if ( p_replay->packed && !p_replay->meta )
+    {
+        /* the timestamp counts samples, packed blocks hold 4 of them per 3 words */
+        p_replay->ts_step = SKIQ_NUM_PACKED_SAMPLES_IN_BLOCK( p_replay->ts_step );
+    }
+    p_replay->first_ts = 0;
+
+    if ( p_replay->meta )
+    {
+        const skiq_rx_block_t *p_first = (const skiq_rx_block_t *)p_replay->p_file;
+
+        /* the capture knows its own increment, which also covers packed samples */
+        p_replay->first_ts = p_first->rf_timestamp;
+        if ( p_replay->nr_file_blocks > 1 )
+        {
+            const skiq_rx_block_t *p_second =
+                (const skiq_rx_block_t *)( p_replay->p_file + stride );
+
+            if ( p_second->rf_timestamp > p_first->rf_timestamp )
+            {
+                p_replay->ts_step = p_second->rf_timestamp - p_first->rf_timestamp;
+            }
+        }
+    }
+    p_replay->next_block = 0;
+    p_replay->rf_ts = p_replay->first_ts;
+    replay_publish( p_replay );
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Map the capture file of a card.
+
+    @param[in] xport_uid unique ID used to identifer the card at the transport layer
+    @param[out] p_replay replay state
+
+    @return status where 0=success, else a negative errno
+*/
+static int32_t replay_open( uint64_t xport_uid,
+                            struct my_replay *p_replay )
+{
+    char p_path[PATH_MAX];
+    struct stat st;
+    void *p_file;
+    int32_t status;
+
+    status = env_list_entry( MY_XPORT_ENV_REPLAY, xport_uid, p_path, sizeof(p_path) );
+    if ( status == 0 )
+    {
+        status = replay_parse_opts( p_replay );
+    }
+    if ( status != 0 )
+    {
+        return status;
+    }
+
+    p_replay->fd = open( p_path, O_RDONLY );
+    if ( ( p_replay->fd < 0 ) || ( fstat( p_replay->fd, &st ) != 0 ) )
+    {
+        fprintf( stderr, "Error: unable to open replay file %s (%s)\n", p_path, strerror( errno ) );
+        return -ENODEV;
+    }
+    if ( st.st_size == 0 )
+    {
+        return -EINVAL;
+    }
+
+    /* fault the file in now so page faults don't show up in the measurements */
+    p_file = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, p_replay->fd, 0 );
+    if ( p_file == MAP_FAILED )
+    {
+        return -errno;
+    }
+    p_replay->p_file = (const uint8_t *)p_file;
+    p_replay->file_size = st.st_size;
+
+    if ( posix_memalign( (void **)&(p_replay->p_block), MY_XPORT_SLOT_ALIGN,
+                         MY_XPORT_RX_SLOT_SIZE ) != 0 )
+    {
+        p_replay->p_block = NULL;
+        return -ENOMEM;
+    }
+
+    status = replay_set_block_size( p_replay, SKIQ_MAX_RX_BLOCK_SIZE_IN_BYTES );
+    if ( status != 0 )
+    {
+        fprintf( stderr, "Error: replay file %s is shorter than a block\n", p_path );
+    }
+
+    return status;
+}
+
+static void replay_close( struct my_replay *p_replay )
+{
+    if ( p_replay->p_file != NULL )
+    {
+        munmap( (void *)p_replay->p_file, p_replay->file_size );
+        p_replay->p_file = NULL;
+    }
+    if ( p_replay->fd >= 0 )
+    {
+        close( p_replay->fd );
+        p_replay->fd = -1;
+    }
+    free( p_replay->p_block );
+    p_replay->p_block = NULL;
+}
+
+/* move on to the next block of the file, the RF timestamp keeps counting */
+static void replay_advance( struct my_replay *p_replay,
+                            uint64_t nr_blocks )
+{
+    p_replay->rf_ts += nr_blocks * p_replay->ts_step;
+    p_replay->next_block += nr_blocks;
+    if ( p_replay->loop )
+    {
+        p_replay->next_block %= p_replay->nr_file_blocks;
+    }
+    replay_publish( p_replay );
+}
+
+/*****************************************************************************/
+/** Look up a register of a replayed card.
+
+    @param[in] p_replay replay state
+    @param[in] addr register address
+    @param[in] create allocate the register if it doesn't exist yet
+
+    @return the register, or NULL
+*/
+static struct my_replay_reg *replay_reg( struct my_replay *p_replay,
+                                         uint32_t addr,
+                                         bool create )
+{
+    uint32_t i, slot = ( addr >> 2 ) % MY_XPORT_REPLAY_NR_REGS;
+
+    for ( i = 0; i < MY_XPORT_REPLAY_NR_REGS; i++ )
+    {
+        struct my_replay_reg *p_reg = &(p_replay->regs[( slot + i ) % MY_XPORT_REPLAY_NR_REGS]);
+
+        if ( p_reg->used && ( p_reg->addr == addr ) )
+        {
+            return p_reg;
+        }
+        if ( !p_reg->used )
+        {
+            if ( create )
+            {
+                p_reg->used = true;
+                p_reg->addr = addr;
+                p_reg->value = 0;
+                return p_reg;
+            }
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/*****************************************************************************/
+/** Answer a request locally for a replayed card, this takes the place of the
+    peer.
+
+    @param[in] p_card card
+    @param[in] op request, one of enum my_xport_op
+    @param[in] addr address or handle argument
+    @param[in] data data argument
+    @param[out] p_result data of the answer, may be NULL
+
+    @return status where 0=success, else a negative errno
+*/
+static int32_t replay_request( struct my_card *p_card,
+                               uint32_t op,
+                               uint32_t addr,
+                               uint64_t data,
+                               uint64_t *p_result )
+{
+    struct my_replay *p_replay = &(p_card->replay);
+    struct my_replay_reg *p_reg;
+    int32_t status = 0;
+
+    switch ( op )
+    {
+        case MY_XPORT_OP_REG_READ:
+        case MY_XPORT_OP_REG_READ64:
+            p_reg = replay_reg( p_replay, addr, false );
+            if ( p_result != NULL )
+            {
+                *p_result = ( p_reg != NULL ) ? p_reg->value : 0;
+            }
+            break;
+
+        case MY_XPORT_OP_REG_WRITE:
+        case MY_XPORT_OP_REG_WRITE64:
+            p_reg = replay_reg( p_replay, addr, true );
+            if ( p_reg == NULL )
+            {
+                status = -ENOSPC;
+            }
+            else
+            {
+                p_reg->value = ( op == MY_XPORT_OP_REG_WRITE ) ? (uint32_t)data : data;
+            }
+            break;
+
+        case MY_XPORT_OP_RX_BLOCK_SIZE:
+            status = replay_set_block_size( p_replay, (uint32_t)data );
+            break;
+
+        case MY_XPORT_OP_RX_START:
+            /* every run replays the file from the start, so runs compare */
+            if ( !p_replay->streaming )
+            {
+                p_replay->next_block = 0;
+                p_replay->rf_ts = p_replay->first_ts;
+                p_replay->nr_delivered = 0;
+                p_replay->last_injected = 0;
+                p_replay->start_ts = p_replay->rf_ts;
+                p_replay->start_ns = now_ns();
+            }
+            p_replay->hdl = (skiq_rx_hdl_t)addr;
+            p_replay->streaming = true;
+            replay_publish( p_replay );
+            break;
+
+        case MY_XPORT_OP_RX_STOP:
+            p_replay->streaming = false;
+            replay_publish( p_replay );
+            break;
+
+        default:
+            /* nothing to emulate */
+            break;
+    }
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Serve the next block of the capture file, after injecting any gap or
+    overrun that is due and waiting for the block's time when paced.
+
+    @param[in] p_card card
+    @param[out] pp_data reference to IQ data memory pointer
+    @param[out] p_data_len reference to the length of the block
+    @param[in] deadline_ns time at which to give up, 0 for none
+
+    @return status where 0=success, skiq_rx_status_no_data or skiq_rx_status_error_overrun
+*/
+static int32_t replay_receive( struct my_card *p_card,
+                               uint8_t **pp_data,
+                               uint32_t *p_data_len,
+                               uint64_t deadline_ns )
+{
+    struct my_replay *p_replay = &(p_card->replay);
+    skiq_rx_block_t *p_block = (skiq_rx_block_t *)p_replay->p_block;
+    const uint8_t *p_src;
+
+    if ( !p_replay->streaming )
+    {
+        return skiq_rx_status_no_data;
+    }
+
+    if ( ( p_replay->nr_delivered > 0 ) && ( p_replay->nr_delivered != p_replay->last_injected ) )
+    {
+        if ( ( p_replay->overrun_every != 0 ) &&
+             ( ( p_replay->nr_delivered % p_replay->overrun_every ) == 0 ) )
+        {
+            p_replay->last_injected = p_replay->nr_delivered;
+            replay_advance( p_replay, MY_XPORT_REPLAY_OVERRUN_BLOCKS );
+            p_card->nr_rx_overruns++;
+            return skiq_rx_status_error_overrun;
+        }
+        if ( ( p_replay->gap_every != 0 ) &&
+             ( ( p_replay->nr_delivered % p_replay->gap_every ) == 0 ) )
+        {
+            p_replay->last_injected = p_replay->nr_delivered;
+            replay_advance( p_replay, 1 );
+            p_card->nr_rx_gaps++;
+        }
+    }
+
+    if ( p_replay->next_block >= p_replay->nr_file_blocks )
+    {
+        /* the end of a file that doesn't loop */
+        return skiq_rx_status_no_data;
+    }
+
+    if ( p_replay->rate != 0 )
+    {
+        uint64_t due_ns = replay_due_ns( p_replay );
+        uint64_t now;
+
+        while ( ( now = now_ns() ) < due_ns )
+        {
+            uint64_t until_ns = due_ns;
+            struct timespec until;
+
+            if ( p_card->rx_timeout_us == RX_TRANSFER_NO_WAIT )
+            {
+                return skiq_rx_status_no_data;
+            }
+            if ( deadline_ns != 0 )
+            {
+                if ( now >= deadline_ns )
+                {
+                    return skiq_rx_status_no_data;
+                }
+                until_ns = MIN( due_ns, deadline_ns );
+            }
+            until.tv_sec = until_ns / 1000000000ULL;
+            until.tv_nsec = until_ns % 1000000000ULL;
+            clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL );
+        }
+    }
+
+    p_src = p_replay->p_file + ( p_replay->next_block * p_replay->stride );
+    if ( p_replay->meta )
+    {
+        memcpy( p_replay->p_block, p_src, p_replay->stride );
+        *p_data_len = p_replay->stride;
+    }
+    else
+    {
+        memset( p_replay->p_block, 0, SKIQ_RX_HEADER_SIZE_IN_BYTES );
+        memcpy( p_replay->p_block + SKIQ_RX_HEADER_SIZE_IN_BYTES, p_src, p_replay->stride );
+        *p_data_len = p_replay->stride + SKIQ_RX_HEADER_SIZE_IN_BYTES;
+    }
+    p_block->rf_timestamp = p_replay->rf_ts;
+    p_block->hdl = p_replay->hdl;
+    *pp_data = p_replay->p_block;
+
+    p_replay->nr_delivered++;
+    p_card->nr_rx_blocks++;
+    replay_advance( p_replay, 1 );
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Pass a request to the peer of a card and wait for the answer.
+
+    @param[in] p_card card
+    @param[in] op request, one of enum my_xport_op
+    @param[in] addr address or handle argument
+    @param[in] data data argument
+    @param[out] p_result data of the answer, may be NULL
+
+    @return status where 0=success, else a negative errno
+*/
+static int32_t peer_request( struct my_card *p_card,
+                             uint32_t op,
+                             uint32_t addr,
+                             uint64_t data,
+                             uint64_t *p_result )
+{
+    int32_t status = 0;
+
+    pthread_mutex_lock( &(p_card->ctrl_lock) );
+    if ( p_card->link == my_link_replay )
+    {
+        status = replay_request( p_card, op, addr, data, p_result );
+    }
+    else if ( p_card->link == my_link_udp )
+    {
+        status = udp_request( p_card->ctrl_fd, ++(p_card->ctrl_seq), op, addr, data,
+                              MY_XPORT_UDP_TIMEOUT_MS, NULL, 0, p_result );
+    }
+    else
+    {
+        struct my_xport_mailbox *p_mb = &(p_card->p_shm->mailbox);
+        uint64_t deadline_ns = now_ns() + MY_XPORT_REQUEST_TIMEOUT_NS;
+        uint32_t seq = p_mb->seq + 1;
+        uint32_t spins = 0;
+
+        p_mb->op = op;
+        p_mb->addr = addr;
+        p_mb->data = data;
+        p_mb->status = 0;
+        __atomic_store_n( &(p_mb->seq), seq, __ATOMIC_RELEASE );
+
+        while ( __atomic_load_n( &(p_mb->ack), __ATOMIC_ACQUIRE ) != seq )
+        {
+            if ( !backoff( &spins, deadline_ns ) )
+            {
+                status = -ETIMEDOUT;
+                break;
+            }
+        }
+        if ( status == 0 )
+        {
+            status = p_mb->status;
+            if ( p_result != NULL )
+            {
+                *p_result = p_mb->data;
+            }
+        }
+    }
+    pthread_mutex_unlock( &(p_card->ctrl_lock) );
+
+    if ( status == -ETIMEDOUT )
+    {
+        fprintf( stderr, "Error: custom transport peer of card UID %" PRIu64 " did not answer"
+                 " request %" PRIu32 "\n", (uint64_t)( p_card - cards ), op );
+    }
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Release the resources of a card's link, safe to call on a partially
+    initialized card.
+
+    @param[in] p_card card
+
+    @return void
+*/
+static void close_link( struct my_card *p_card )
+{
+    if ( p_card->p_shm != NULL )
+    {
+        munmap( p_card->p_shm, p_card->shm_size );
+        p_card->p_shm = NULL;
+    }
+    if ( p_card->shm_fd >= 0 )
+    {
+        close( p_card->shm_fd );
+        p_card->shm_fd = -1;
+    }
+    if ( p_card->ctrl_fd >= 0 )
+    {
+        close( p_card->ctrl_fd );
+        p_card->ctrl_fd = -1;
+    }
+    if ( p_card->data_fd >= 0 )
+    {
+        close( p_card->data_fd );
+        p_card->data_fd = -1;
+    }
+    free( p_card->p_rx_bufs );
+    p_card->p_rx_bufs = NULL;
+    replay_close( &(p_card->replay) );
+}
+
+/*****************************************************************************/
+/** Open the UDP sockets of a card and prepare the receive batch.
+
+    @param[in] p_card card
+    @param[in] xport_uid unique ID used to identifer the card at the transport layer
+
+    @return status where 0=success, else a negative errno
+*/
+static int32_t open_udp( struct my_card *p_card,
+                         uint64_t xport_uid )
+{
+    struct sockaddr_in ctrl_addr, data_addr;
+    int rcvbuf = MY_XPORT_UDP_RCVBUF;
+    uint32_t i;
+    int32_t status;
+
+    status = udp_endpoint( xport_uid, &ctrl_addr );
+    if ( status != 0 )
+    {
+        return status;
+    }
+    data_addr = ctrl_addr;
+    data_addr.sin_port = htons( ntohs( ctrl_addr.sin_port ) + 1 );
+
+    p_card->ctrl_fd = udp_connect( &ctrl_addr );
+    p_card->data_fd = udp_connect( &data_addr );
+    if ( ( p_card->ctrl_fd < 0 ) || ( p_card->data_fd < 0 ) )
+    {
+        return -errno;
+    }
+    /* a deep socket buffer absorbs scheduling hiccups of the receiving thread */
+    (void)setsockopt( p_card->data_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf) );
+
+    if ( posix_memalign( (void **)&(p_card->p_rx_bufs), MY_XPORT_SLOT_ALIGN,
+                         MY_XPORT_UDP_BATCH * MY_XPORT_RX_SLOT_SIZE ) != 0 )
+    {
+        p_card->p_rx_bufs = NULL;
+        return -ENOMEM;
+    }
+    memset( p_card->rx_msgs, 0, sizeof(p_card->rx_msgs) );
+    for ( i = 0; i < MY_XPORT_UDP_BATCH; i++ )
+    {
+        /* the header and the block are scattered so the block lands aligned */
+        p_card->rx_iov[i][0].iov_base = &(p_card->rx_hdrs[i]);
+        p_card->rx_iov[i][0].iov_len = sizeof(struct my_xport_udp_hdr);
+        p_card->rx_iov[i][1].iov_base = p_card->p_rx_bufs + ( i * MY_XPORT_RX_SLOT_SIZE );
+        p_card->rx_iov[i][1].iov_len = MY_XPORT_RX_SLOT_SIZE;
+        p_card->rx_msgs[i].msg_hdr.msg_iov = p_card->rx_iov[i];
+        p_card->rx_msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Wait for the peer to consume the transmit ring up to an index.
+
+    @param[in] p_card card
+    @param[in] index free running index of the transmit ring
+    @param[in] deadline_ns time at which to give up, 0 for none
+
+    @return true if the ring was consumed up to index in time
+*/
+static bool wait_tx_consumed( struct my_card *p_card,
+                              uint64_t index,
+                              uint64_t deadline_ns )
+{
+    struct my_xport_ring *p_ring = &(p_card->p_shm->tx);
+    uint32_t spins = 0;
+
+    while ( __atomic_load_n( &(p_ring->tail), __ATOMIC_ACQUIRE ) < index )
+    {
+        if ( !backoff( &spins, deadline_ns ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*****************************************************************************/
+/** Copy a transmit block into the next slot of the shared memory ring.  The
+    caller makes sure there is room.
+
+    @param[in] p_card card
+    @param[in] p_samples block to transmit
+
+    @return the free running index after the slot
+*/
+static uint64_t shm_tx_push( struct my_card *p_card,
+                             const int32_t *p_samples )
+{
+    struct my_xport_ring *p_ring = &(p_card->p_shm->tx);
+    uint64_t head = p_card->tx_head;
+
+    memcpy( my_xport_slot( p_card->p_shm, p_ring, head ), p_samples, p_card->tx_bytes );
+    *my_xport_slot_len( p_card->p_shm, p_ring, head ) = p_card->tx_bytes;
+    p_card->tx_head = head + 1;
+    __atomic_store_n( &(p_ring->head), head + 1, __ATOMIC_RELEASE );
+
+    return head + 1;
+}
+
+/*****************************************************************************/
+/** Async transmit thread.  With shared memory, it waits for the peer to
+    consume the queued blocks; with UDP, it sends the queued blocks in batches
+    with sendmmsg().  Either way it then completes the blocks in order.  When
+    stopped, it finishes the blocks that are already queued.
+
+    @param[in] p_arg card
+
+    @return NULL
+*/
+static void *tx_complete_thread( void *p_arg )
+{
+    struct my_card *p_card = (struct my_card *)p_arg;
+    struct my_xport_udp_hdr hdrs[MY_XPORT_UDP_BATCH];
+    struct iovec iov[MY_XPORT_UDP_BATCH][2];
+    struct mmsghdr msgs[MY_XPORT_UDP_BATCH];
+    struct my_tx_pending batch[MY_XPORT_UDP_BATCH];
+    uint64_t stop_deadline_ns = 0;
+
+    for (;;)
+    {
+        uint32_t nr, i, done = 0;
+        int32_t status = 0;
+
+        pthread_mutex_lock( &(p_card->tx_lock) );
+        while ( ( p_card->tx_q_head == p_card->tx_q_tail ) && p_card->tx_running )
+        {
+            pthread_cond_wait( &(p_card->tx_work), &(p_card->tx_lock) );
+        }
+        nr = (uint32_t)( p_card->tx_q_head - p_card->tx_q_tail );
+        if ( nr == 0 )
+        {
+            pthread_mutex_unlock( &(p_card->tx_lock) );
+            break;
+        }
+        if ( !p_card->tx_running && ( stop_deadline_ns == 0 ) )
+        {
+            stop_deadline_ns = now_ns() + MY_XPORT_REQUEST_TIMEOUT_NS;
+        }
+        nr = MIN( nr, MY_XPORT_UDP_BATCH );
+        for ( i = 0; i < nr; i++ )
+        {
+            batch[i] = p_card->tx_queue[( p_card->tx_q_tail + i ) % MY_XPORT_TX_QUEUE];
+        }
+        pthread_mutex_unlock( &(p_card->tx_lock) );
+
+        if ( p_card->link == my_link_shm )
+        {
+            struct my_xport_ring *p_ring = &(p_card->p_shm->tx);
+            uint64_t tail;
+
+            /* wait for the oldest block, then complete everything consumed since */
+            if ( !wait_tx_consumed( p_card, batch[0].index,
+                                    ( stop_deadline_ns != 0 ) ? stop_deadline_ns :
+                                    now_ns() + MY_XPORT_NAP_NS ) )
+            {
+                if ( stop_deadline_ns == 0 )
+                {
+                    continue;
+                }
+                /* stopped and the peer isn't consuming, give the blocks back */
+                status = -ETIMEDOUT;
+                done = nr;
+            }
+            else
+            {
+                tail = __atomic_load_n( &(p_ring->tail), __ATOMIC_ACQUIRE );
+                while ( ( done < nr ) && ( batch[done].index <= tail ) )
+                {
+                    done++;
+                }
+            }
+        }
+        else if ( p_card->link == my_link_udp )
+        {
+            uint32_t sent = 0;
+
+            for ( i = 0; i < nr; i++ )
+            {
+                hdrs[i] = (struct my_xport_udp_hdr){
+                    .magic = MY_XPORT_MAGIC,
+                    .op = MY_XPORT_OP_TX_DATA,
+                    .seq = p_card->tx_seq++,
+                    .status = 0,
+                    .addr = 0,
+                    .len = p_card->tx_bytes,
+                    .data = 0,
+                };
+                iov[i][0].iov_base = &(hdrs[i]);
+                iov[i][0].iov_len = sizeof(hdrs[i]);
+                iov[i][1].iov_base = batch[i].p_samples;
+                iov[i][1].iov_len = p_card->tx_bytes;
+                memset( &(msgs[i]), 0, sizeof(msgs[i]) );
+                msgs[i].msg_hdr.msg_iov = iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 2;
+            }
+            while ( sent < nr )
+            {
+                int result = sendmmsg( p_card->data_fd, &(msgs[sent]), nr - sent, 0 );
+
+                if ( result > 0 )
+                {
+                    sent += (uint32_t)result;
+                }
+                else if ( ( errno == EINTR ) || ( errno == EAGAIN ) || ( errno == ENOBUFS ) )
+                {
+                    uint32_t spins = MY_XPORT_SPIN_COUNT;
+
+                    (void)backoff( &spins, 0 );
+                }
+                else
+                {
+                    status = -errno;
+                    break;
+                }
+            }
+            p_card->nr_tx_batches++;
+            done = nr;
+        }
+        else
+        {
+            /* replayed cards discard what they transmit */
+            done = nr;
+        }
+
+        /* the blocks now belong to the caller again */
+        for ( i = 0; i < done; i++ )
+        {
+            if ( p_card->tx_cb != NULL )
+            {
+                p_card->tx_cb( status, (skiq_tx_block_t *)batch[i].p_samples,
+                               batch[i].p_private );
+            }
+        }
+        pthread_mutex_lock( &(p_card->tx_lock) );
+        p_card->tx_q_tail += done;
+        p_card->nr_tx_blocks += done;
+        pthread_cond_signal( &(p_card->tx_space) );
+        pthread_mutex_unlock( &(p_card->tx_lock) );
+    }
+
+    return NULL;
+}
+
+/*****************************************************************************/
+/** Stop the async transmit thread once it has completed the queued blocks.
+
+    @param[in] p_card card
+
+    @return void
+*/
+static void stop_tx_thread( struct my_card *p_card )
+{
+    if ( p_card->tx_thread_started )
+    {
+        pthread_mutex_lock( &(p_card->tx_lock) );
+        p_card->tx_running = false;
+        pthread_cond_signal( &(p_card->tx_work) );
+        pthread_mutex_unlock( &(p_card->tx_lock) );
+        pthread_join( p_card->tx_thread, NULL );
+        p_card->tx_thread_started = false;
+    }
+}
+
+/*****************************************************************************/
+/** Wait, for at most MY_XPORT_READY_WAIT_NS, until rx_receive() has a block to
+    return.  The shared memory ring is waited on through its doorbell when the
+    peer rings it, a paced replay sleeps until its next block is due.
+
+    @param[in] p_card card, not on the UDP link
+
+    @return true if a block is available
+*/
+static bool rx_ready_wait( struct my_card *p_card )
+{
+    uint64_t wait_ns = MY_XPORT_READY_WAIT_NS;
 
-#include <stdio.h>
-#include <stdint.h>
-#include <errno.h>
-#include <inttypes.h>
+    if ( p_card->link == my_link_shm )
+    {
+        struct my_xport_ring *p_ring = &(p_card->p_shm->rx);
+        uint32_t bell;
+
+        if ( p_card->p_shm->version < 2 )
+        {
+            struct timespec nap = { .tv_sec = 0, .tv_nsec = MY_XPORT_READY_NAP_NS };
+
+            if ( __atomic_load_n( &(p_ring->head), __ATOMIC_ACQUIRE ) ==
+                 __atomic_load_n( &(p_ring->tail), __ATOMIC_ACQUIRE ) )
+            {
+                nanosleep( &nap, NULL );
+            }
+        }
+        else
+        {
+            /* announce the waiter before looking at head, the producer bumps the
+               doorbell after head and then looks at waiters */
+            bell = __atomic_load_n( &(p_ring->doorbell), __ATOMIC_SEQ_CST );
+            __atomic_store_n( &(p_ring->waiters), 1, __ATOMIC_SEQ_CST );
+            if ( __atomic_load_n( &(p_ring->head), __ATOMIC_SEQ_CST ) ==
+                 __atomic_load_n( &(p_ring->tail), __ATOMIC_ACQUIRE ) )
+            {
+                futex_wait( &(p_ring->doorbell), bell, wait_ns, true );
+            }
+            __atomic_store_n( &(p_ring->waiters), 0, __ATOMIC_RELAXED );
+        }
+
+        return __atomic_load_n( &(p_ring->head), __ATOMIC_ACQUIRE ) !=
+            __atomic_load_n( &(p_ring->tail), __ATOMIC_ACQUIRE );
+    }
+    else
+    {
+        uint64_t due_ns, now;
+        struct timespec until;
+
+        /* the replay state belongs to skiq_receive() and the requests, only the time of the
+           next block is published for this thread; UINT64_MAX when not streaming or at the
+           end of a file that doesn't loop */
+        due_ns = __atomic_load_n( &(p_card->replay.ready_ns), __ATOMIC_ACQUIRE );
+
+        now = now_ns();
+        if ( now >= due_ns )
+        {
+            return true;
+        }
+        if ( ( due_ns - now ) > wait_ns )
+        {
+            due_ns = now + wait_ns;
+        }
+        until.tv_sec = due_ns / 1000000000ULL;
+        until.tv_nsec = due_ns % 1000000000ULL;
+        clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL );
+
+        return false;
+    }
+}
 
-#include "sidekiq_api.h"
-#include "sidekiq_xport_api.h"
+/*****************************************************************************/
+/** The readiness thread of a card signals its eventfd once per arming, when a
+    block is available after rx_receive() found none.
 
-/***** DEFINES *****/
+    @param[in] p_arg card
 
-#define MAX(a,b)                        ( ( (a) > (b) ) ? (a) : (b) )
-#define MIN(a,b)                        ( ( (a) < (b) ) ? (a) : (b) )
+    @return NULL
+*/
+static void *rx_ready_thread( void *p_arg )
+{
+    struct my_card *p_card = (struct my_card *)p_arg;
 
-/***** TYPEDEFS *****/
+    while ( __atomic_load_n( &(p_card->ready_running), __ATOMIC_ACQUIRE ) )
+    {
+        if ( __atomic_load_n( &(p_card->ready_armed), __ATOMIC_ACQUIRE ) == 0 )
+        {
+            futex_wait( &(p_card->ready_armed), 0, MY_XPORT_READY_WAIT_NS, false );
+        }
+        else if ( rx_ready_wait( p_card ) )
+        {
+            __atomic_store_n( &(p_card->ready_armed), 0, __ATOMIC_RELEASE );
+            if ( eventfd_write( p_card->ready_fd, 1 ) == 0 )
+            {
+                p_card->nr_rx_wakeups++;
+            }
+        }
+    }
 
+    return NULL;
+}
 
-/***** STRUCTS *****/
+/*****************************************************************************/
+/** Re-arm the readiness notification after rx_receive() found no block.
 
+    @param[in] p_card card
 
-/***** LOCAL VARIABLES *****/
+    @return void
+*/
+static void rx_ready_arm( struct my_card *p_card )
+{
+    if ( ( p_card->ready_fd >= 0 ) &&
+         ( __atomic_exchange_n( &(p_card->ready_armed), 1, __ATOMIC_ACQ_REL ) == 0 ) )
+    {
+        futex_wake( &(p_card->ready_armed), false );
+    }
+}
 
-/* assigned at the bottom of this file */
-static skiq_xport_fpga_functions_t fpga_reg_ops;
-static skiq_xport_rx_functions_t rx_ops;
-static skiq_xport_tx_functions_t tx_ops;
+/*****************************************************************************/
+/** Stop the readiness thread and close its eventfd, if there is one.
+
+    @param[in] p_card card
+
+    @return void
+*/
+static void stop_ready_thread( struct my_card *p_card )
+{
+    if ( p_card->ready_fd >= 0 )
+    {
+        __atomic_store_n( &(p_card->ready_running), false, __ATOMIC_RELEASE );
+        __atomic_store_n( &(p_card->ready_armed), 1, __ATOMIC_RELEASE );
+        futex_wake( &(p_card->ready_armed), false );
+        pthread_join( p_card->ready_thread, NULL );
+        close( p_card->ready_fd );
+        p_card->ready_fd = -1;
+    }
+}
 
-/***** LOCAL FUNCTIONS *****/
 
 
 /*****************************************************************************/
@@ -82,17 +1619,66 @@ static skiq_xport_tx_functions_t tx_ops;
 static int32_t my_card_probe( uint64_t *p_uid_list,
                               uint8_t *p_num_cards )
 {
-    printf(" --> %s called with %p %p\n", __FUNCTION__, p_uid_list, p_num_cards);
-
-    printf(" *** THIS IMPLEMENTATION IS A CUSTOM TRANSPORT ***\n");
+    enum my_link link = link_from_env();
+    uint8_t nr_cards = 0;
+    uint64_t uid;
 
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
-
-    /* pretend there's a card with UID of 2 */
-    p_uid_list[0] = 2;
-    *p_num_cards = 1;
+    for ( uid = 0; uid < SKIQ_MAX_NUM_CARDS; uid++ )
+    {
+        if ( cards[uid].active )
+        {
+            /* already initialized, it is still present */
+            p_uid_list[nr_cards++] = uid;
+        }
+        else if ( link == my_link_replay )
+        {
+            char p_path[PATH_MAX];
+
+            if ( env_list_entry( MY_XPORT_ENV_REPLAY, uid, p_path, sizeof(p_path) ) != 0 )
+            {
+                break;
+            }
+            if ( access( p_path, R_OK ) == 0 )
+            {
+                p_uid_list[nr_cards++] = uid;
+            }
+        }
+        else if ( link == my_link_shm )
+        {
+            struct my_xport_shm *p_shm;
+            size_t size;
+            int fd;
+
+            if ( shm_map( uid, &fd, &p_shm, &size ) == 0 )
+            {
+                munmap( p_shm, size );
+                close( fd );
+                p_uid_list[nr_cards++] = uid;
+            }
+        }
+        else
+        {
+            struct sockaddr_in addr;
+            int fd;
+
+            if ( udp_endpoint( uid, &addr ) != 0 )
+            {
+                /* the list has no more entries */
+                break;
+            }
+            fd = udp_connect( &addr );
+            if ( fd >= 0 )
+            {
+                if ( udp_request( fd, 0, MY_XPORT_OP_HELLO, 0, 0, MY_XPORT_UDP_TIMEOUT_MS,
+                                  NULL, 0, NULL ) == 0 )
+                {
+                    p_uid_list[nr_cards++] = uid;
+                }
+                close( fd );
+            }
+        }
+    }
+    *p_num_cards = nr_cards;
 
     return 0;
 }
@@ -114,20 +1700,65 @@ static int32_t my_card_init( skiq_xport_init_level_t level,
 {
     int32_t status = 0;
     skiq_xport_id_t xport_id = SKIQ_XPORT_ID_INITIALIZER;
+    struct my_card *p_card;
 
     xport_id.type = skiq_xport_type_custom;
     xport_id.xport_uid = xport_uid;
 
-    printf(" --> %s called with %" PRIu64 "\n", __FUNCTION__, xport_uid);
-
-    printf(" *** THIS IMPLEMENTATION IS A CUSTOM TRANSPORT ***\n");
+    if ( xport_uid >= SKIQ_MAX_NUM_CARDS )
+    {
+        return -ENODEV;
+    }
+    p_card = &(cards[xport_uid]);
 
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
-    
     /* VERIFY CARD EXISTENCE AND INITIALIZE */
 
+    if ( !p_card->active )
+    {
+        memset( p_card, 0, sizeof(*p_card) );
+        p_card->link = link_from_env();
+        p_card->shm_fd = -1;
+        p_card->ctrl_fd = -1;
+        p_card->data_fd = -1;
+        p_card->replay.fd = -1;
+        p_card->ready_fd = -1;
+        p_card->rx_timeout_us = RX_TRANSFER_NO_WAIT;
+        pthread_mutex_init( &(p_card->ctrl_lock), NULL );
+        pthread_mutex_init( &(p_card->tx_lock), NULL );
+        pthread_cond_init( &(p_card->tx_work), NULL );
+        pthread_cond_init( &(p_card->tx_space), NULL );
+
+        if ( p_card->link == my_link_shm )
+        {
+            status = shm_map( xport_uid, &(p_card->shm_fd), &(p_card->p_shm),
+                              &(p_card->shm_size) );
+            if ( status == 0 )
+            {
+                p_card->tx_head = __atomic_load_n( &(p_card->p_shm->tx.head), __ATOMIC_ACQUIRE );
+            }
+        }
+        else if ( p_card->link == my_link_udp )
+        {
+            status = open_udp( p_card, xport_uid );
+        }
+        else
+        {
+            status = replay_open( xport_uid, &(p_card->replay) );
+        }
+        if ( status == 0 )
+        {
+            status = peer_request( p_card, MY_XPORT_OP_HELLO, 0, 0, NULL );
+        }
+        if ( status != 0 )
+        {
+            fprintf( stderr, "Error: unable to reach custom transport peer of card UID %"
+                     PRIu64 " (status %" PRIi32 ")\n", xport_uid, status );
+            close_link( p_card );
+            return status;
+        }
+        p_card->active = true;
+    }
+
     if ( level == skiq_xport_init_level_basic )
     {
         /* if the caller wants basic, register functions for control and
@@ -165,15 +1796,12 @@ static int32_t my_card_exit( skiq_xport_init_level_t level,
 {
     int32_t status = 0;
     skiq_xport_id_t xport_id = SKIQ_XPORT_ID_INITIALIZER;
-    
+    struct my_card *p_card = get_card( xport_uid );
+
     xport_id.type = skiq_xport_type_custom;
     xport_id.xport_uid = xport_uid;
 
-    printf(" --> %s called with %u %" PRIu64 "\n", __FUNCTION__, level, xport_uid);
-
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
+    (void)level;
 
     /* VERIFY CARD EXISTANCE AND SHUTDOWN */
 
@@ -181,6 +1809,24 @@ static int32_t my_card_exit( skiq_xport_init_level_t level,
     xport_unregister_rx_functions( &xport_id );
     xport_unregister_tx_functions( &xport_id );
 
+    if ( p_card != NULL )
+    {
+        stop_tx_thread( p_card );
+        stop_ready_thread( p_card );
+        printf("Info: custom transport card UID %" PRIu64 " received %" PRIu64 " blocks (%"
+               PRIu64 " gaps, %" PRIu64 " overruns, %" PRIu64 " batches, %" PRIu64 " wakeups),"
+               " transmitted %" PRIu64 " blocks (%" PRIu64 " batches)\n", xport_uid,
+               p_card->nr_rx_blocks, p_card->nr_rx_gaps, p_card->nr_rx_overruns,
+               p_card->nr_rx_batches, p_card->nr_rx_wakeups, p_card->nr_tx_blocks,
+               p_card->nr_tx_batches);
+        close_link( p_card );
+        pthread_cond_destroy( &(p_card->tx_space) );
+        pthread_cond_destroy( &(p_card->tx_work) );
+        pthread_mutex_destroy( &(p_card->tx_lock) );
+        pthread_mutex_destroy( &(p_card->ctrl_lock) );
+        p_card->active = false;
+    }
+
     return status;
 }
 
@@ -203,13 +1849,22 @@ static int32_t my_fpga_reg_read( uint64_t xport_uid,
                                  uint32_t addr,
                                  uint32_t* p_data )
 {
-    printf(" --> %s called with %" PRIu64 " 0x%08x %p\n", __FUNCTION__, xport_uid, addr, p_data);
+    struct my_card *p_card = get_card( xport_uid );
+    uint64_t data = 0;
+    int32_t status;
 
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
+
+    status = peer_request( p_card, MY_XPORT_OP_REG_READ, addr, 0, &data );
+    if ( status == 0 )
+    {
+        *p_data = (uint32_t)data;
+    }
 
-    return -1;
+    return status;
 }
 
 
@@ -231,13 +1886,14 @@ static int32_t my_fpga_reg_write( uint64_t xport_uid,
                                   uint32_t addr,
                                   uint32_t data )
 {
-    printf(" --> %s called with %" PRIu64 " 0x%08X 0x%08X\n", __FUNCTION__, xport_uid, addr, data);
+    struct my_card *p_card = get_card( xport_uid );
 
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
 
-    return -1;
+    return peer_request( p_card, MY_XPORT_OP_REG_WRITE, addr, data, NULL );
 }
 
 
@@ -256,15 +1912,14 @@ static int32_t my_fpga_reg_write( uint64_t xport_uid,
  */
 static int32_t my_fpga_down( uint64_t xport_uid )
 {
-    printf(" --> %s called with %" PRIu64 "\n", __FUNCTION__, xport_uid);
+    struct my_card *p_card = get_card( xport_uid );
 
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
-
-    /* prepare transport / hardware for the FPGA to go away for re-programming */
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
 
-    return -1;
+    return peer_request( p_card, MY_XPORT_OP_FPGA_DOWN, 0, 0, NULL );
 }
 
 
@@ -283,15 +1938,63 @@ static int32_t my_fpga_down( uint64_t xport_uid )
  */
 static int32_t my_fpga_up( uint64_t xport_uid )
 {
-    printf(" --> %s called with %" PRIu64 "\n", __FUNCTION__, xport_uid);
+    struct my_card *p_card = get_card( xport_uid );
+
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
+
+    return peer_request( p_card, MY_XPORT_OP_FPGA_UP, 0, 0, NULL );
+}
+
+
+/*****************************************************************************/
+/** fpga_reg_read_64() is the 64-bit flavor of fpga_reg_read(), used by
+ * libsidekiq to read timestamps atomically when it is registered.
+ *
+ * @param[in] xport_uid unique ID used to identifer the card at the transport layer
+ * @param[in] addr address of the requested FPGA register
+ * @param[out] p_data reference to a uint64_t in which to store the register's contents
+ * 
+ * @return status where 0=success, anything else is an error.
+ */
+static int32_t my_fpga_reg_read_64( uint64_t xport_uid,
+                                    uint32_t addr,
+                                    uint64_t *p_data )
+{
+    struct my_card *p_card = get_card( xport_uid );
+
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
+
+    return peer_request( p_card, MY_XPORT_OP_REG_READ64, addr, 0, p_data );
+}
+
 
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
+/*****************************************************************************/
+/** fpga_reg_write_64() is the 64-bit flavor of fpga_reg_write().
+ *
+ * @param[in] xport_uid unique ID used to identifer the card at the transport layer
+ * @param[in] addr address of the destination FPGA register
+ * @param[in] data value to store in the register
+ * 
+ * @return status where 0=success, anything else is an error.
+ */
+static int32_t my_fpga_reg_write_64( uint64_t xport_uid,
+                                     uint32_t addr,
+                                     uint64_t data )
+{
+    struct my_card *p_card = get_card( xport_uid );
 
-    /* prepare transport / hardware for FPGA's return from re-programming */
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
 
-    return -1;
+    return peer_request( p_card, MY_XPORT_OP_REG_WRITE64, addr, data, NULL );
 }
 
 
@@ -323,13 +2026,29 @@ static int32_t my_fpga_up( uint64_t xport_uid )
 static int32_t my_rx_start_streaming( uint64_t xport_uid,
                                       skiq_rx_hdl_t hdl )
 {
-    printf(" --> %s called with %" PRIu64 " %u\n", __FUNCTION__, xport_uid, hdl);
+    struct my_card *p_card = get_card( xport_uid );
+    uint16_t port = 0;
+
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
 
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
+    if ( p_card->link == my_link_udp )
+    {
+        struct sockaddr_in local;
+        socklen_t len = sizeof(local);
+
+        /* the data socket is connected, so the peer streams to its local port */
+        if ( getsockname( p_card->data_fd, (struct sockaddr *)&local, &len ) != 0 )
+        {
+            return -errno;
+        }
+        port = ntohs( local.sin_port );
+        p_card->rx_next = p_card->rx_nr_msgs = 0;
+    }
 
-    return -1;
+    return peer_request( p_card, MY_XPORT_OP_RX_START, hdl, port, NULL );
 }
 
 
@@ -354,13 +2073,14 @@ static int32_t my_rx_start_streaming( uint64_t xport_uid,
 static int32_t my_rx_stop_streaming( uint64_t xport_uid,
                                      skiq_rx_hdl_t hdl )
 {
-    printf(" --> %s called with %" PRIu64 " %u\n", __FUNCTION__, xport_uid, hdl);
+    struct my_card *p_card = get_card( xport_uid );
 
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
 
-    return -1;
+    return peer_request( p_card, MY_XPORT_OP_RX_STOP, hdl, 0, NULL );
 }
 
 
@@ -388,13 +2108,14 @@ static int32_t my_rx_stop_streaming( uint64_t xport_uid,
  */
 static int32_t my_rx_pause_streaming( uint64_t xport_uid )
 {
-    printf(" --> %s called with %" PRIu64 "\n", __FUNCTION__, xport_uid);
+    struct my_card *p_card = get_card( xport_uid );
 
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
 
-    return -1;
+    return peer_request( p_card, MY_XPORT_OP_RX_PAUSE, 0, 0, NULL );
 }
 
 
@@ -418,13 +2139,14 @@ static int32_t my_rx_pause_streaming( uint64_t xport_uid )
  */
 static int32_t my_rx_resume_streaming( uint64_t xport_uid )
 {
-    printf(" --> %s called with %" PRIu64 "\n", __FUNCTION__, xport_uid);
+    struct my_card *p_card = get_card( xport_uid );
 
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
 
-    return -1;
+    return peer_request( p_card, MY_XPORT_OP_RX_RESUME, 0, 0, NULL );
 }
 
 
@@ -449,13 +2171,112 @@ static int32_t my_rx_resume_streaming( uint64_t xport_uid )
  */
 static int32_t my_rx_flush( uint64_t xport_uid )
 {
-    printf(" --> %s called with %" PRIu64 "\n", __FUNCTION__, xport_uid);
+    struct my_card *p_card = get_card( xport_uid );
+    int32_t status;
+
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
+
+    status = peer_request( p_card, MY_XPORT_OP_RX_FLUSH, 0, 0, NULL );
+    if ( p_card->link == my_link_shm )
+    {
+        struct my_xport_ring *p_ring = &(p_card->p_shm->rx);
+
+        /* drop everything the peer produced so far, including a held slot */
+        __atomic_store_n( &(p_ring->tail), __atomic_load_n( &(p_ring->head), __ATOMIC_ACQUIRE ),
+                          __ATOMIC_RELEASE );
+        p_card->rx_held = false;
+    }
+    else if ( p_card->link == my_link_udp )
+    {
+        struct my_xport_udp_hdr hdr;
+
+        while ( recv( p_card->data_fd, &hdr, sizeof(hdr), MSG_DONTWAIT ) >= 0 )
+        {
+            /* discard */
+        }
+        p_card->rx_next = p_card->rx_nr_msgs = 0;
+    }
+
+    return status;
+}
+
+
+/*****************************************************************************/
+/** rx_configure() is called whenever the receive sample rate changes and
+ * passes the aggregate data rate on to the peer, which may use it to pace the
+ * blocks it produces.
+ *
+ * @param[in] xport_uid unique ID used to identifer the card at the transport layer
+ * @param[in] aggregate_data_rate raw date rate in bytes per second for the receive IQ stream
+ *
+ * @return status where 0=success, anything else is an error.
+ */
+static int32_t my_rx_configure( uint64_t xport_uid,
+                                uint32_t aggregate_data_rate )
+{
+    struct my_card *p_card = get_card( xport_uid );
+
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
+
+    return peer_request( p_card, MY_XPORT_OP_RX_CONFIGURE, 0, aggregate_data_rate, NULL );
+}
+
+
+/*****************************************************************************/
+/** rx_set_block_size() informs the peer of the receive block size, it has to
+ * fit in a slot of MY_XPORT_RX_SLOT_SIZE bytes.
+ *
+ * @param[in] xport_uid unique ID used to identifer the card at the transport layer
+ * @param[in] block_size desired block size in bytes, applies to all receive handles
+ *
+ * @return status where 0=success, anything else is an error.
+ */
+static int32_t my_rx_set_block_size( uint64_t xport_uid,
+                                     uint32_t block_size )
+{
+    struct my_card *p_card = get_card( xport_uid );
+
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
+    if ( block_size > MY_XPORT_RX_SLOT_SIZE )
+    {
+        return -EINVAL;
+    }
+
+    return peer_request( p_card, MY_XPORT_OP_RX_BLOCK_SIZE, 0, block_size, NULL );
+}
+
+
+/*****************************************************************************/
+/** rx_set_transfer_timeout() is called from skiq_set_rx_transfer_timeout() and
+ * sets how long rx_receive() waits for a block: RX_TRANSFER_NO_WAIT,
+ * RX_TRANSFER_WAIT_FOREVER or a number of microseconds.
+ *
+ * @param[in] xport_uid unique ID used to identifer the card at the transport layer
+ * @param[in] timeout_us minimum timeout in microseconds
+ *
+ * @return status where 0=success, anything else is an error.
+ */
+static int32_t my_rx_set_transfer_timeout( uint64_t xport_uid,
+                                           const int32_t timeout_us )
+{
+    struct my_card *p_card = get_card( xport_uid );
 
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
+    p_card->rx_timeout_us = timeout_us;
 
-    return -1;
+    return 0;
 }
 
 
@@ -477,13 +2298,135 @@ static int32_t my_rx_receive( uint64_t xport_uid,
                               uint8_t **pp_data,
                               uint32_t *p_data_len )
 {
-    printf(" --> %s called with %" PRIu64 " %p %p\n", __FUNCTION__, xport_uid, pp_data, p_data_len);
+    struct my_card *p_card = get_card( xport_uid );
+    uint64_t deadline_ns = 0;
+
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
 
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
+    if ( p_card->rx_timeout_us > 0 )
+    {
+        deadline_ns = now_ns() + ( (uint64_t)p_card->rx_timeout_us * 1000ULL );
+    }
+
+    if ( p_card->link == my_link_replay )
+    {
+        int32_t status = replay_receive( p_card, pp_data, p_data_len, deadline_ns );
+
+        if ( status == skiq_rx_status_no_data )
+        {
+            rx_ready_arm( p_card );
+        }
+        return status;
+    }
+    else if ( p_card->link == my_link_shm )
+    {
+        struct my_xport_ring *p_ring = &(p_card->p_shm->rx);
+        uint64_t tail = p_ring->tail;
+        uint32_t spins = 0;
+
+        /* the block handed out by the previous call is done with; libsidekiq
+           only ever holds one block per card */
+        if ( p_card->rx_held )
+        {
+            tail++;
+            __atomic_store_n( &(p_ring->tail), tail, __ATOMIC_RELEASE );
+            p_card->rx_held = false;
+        }
+
+        while ( __atomic_load_n( &(p_ring->head), __ATOMIC_ACQUIRE ) == tail )
+        {
+            if ( ( p_card->rx_timeout_us == RX_TRANSFER_NO_WAIT ) ||
+                 !backoff( &spins, deadline_ns ) )
+            {
+                rx_ready_arm( p_card );
+                return skiq_rx_status_no_data;
+            }
+        }
+
+        *pp_data = my_xport_slot( p_card->p_shm, p_ring, tail );
+        *p_data_len = *my_xport_slot_len( p_card->p_shm, p_ring, tail );
+        p_card->rx_held = true;
+        p_card->nr_rx_blocks++;
+
+        return 0;
+    }
 
-    return -1;
+    for (;;)
+    {
+        while ( p_card->rx_next < p_card->rx_nr_msgs )
+        {
+            uint32_t i = p_card->rx_next++;
+            const struct my_xport_udp_hdr *p_hdr = &(p_card->rx_hdrs[i]);
+            uint32_t len = p_card->rx_msgs[i].msg_len;
+
+            if ( ( len < sizeof(*p_hdr) ) || ( p_hdr->magic != MY_XPORT_MAGIC ) ||
+                 ( p_hdr->op != MY_XPORT_OP_RX_DATA ) ||
+                 ( p_hdr->len != ( len - sizeof(*p_hdr) ) ) )
+            {
+                continue;
+            }
+            if ( ( p_card->nr_rx_blocks > 0 ) && ( p_hdr->seq != p_card->rx_seq ) )
+            {
+                p_card->nr_rx_gaps++;
+            }
+            p_card->rx_seq = p_hdr->seq + 1;
+
+            *pp_data = (uint8_t *)p_card->rx_iov[i][1].iov_base;
+            *p_data_len = p_hdr->len;
+            p_card->nr_rx_blocks++;
+
+            return 0;
+        }
+
+        /* the previous batch is used up, so its buffers can be reused */
+        {
+            struct timespec no_wait = { 0, 0 };
+            int result;
+
+            p_card->rx_next = p_card->rx_nr_msgs = 0;
+            result = recvmmsg( p_card->data_fd, p_card->rx_msgs, MY_XPORT_UDP_BATCH,
+                               MSG_DONTWAIT, &no_wait );
+            if ( result > 0 )
+            {
+                p_card->rx_nr_msgs = (uint32_t)result;
+                p_card->nr_rx_batches++;
+                continue;
+            }
+            if ( ( result < 0 ) && ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) &&
+                 ( errno != EINTR ) )
+            {
+                return -errno;
+            }
+        }
+
+        if ( p_card->rx_timeout_us == RX_TRANSFER_NO_WAIT )
+        {
+            return skiq_rx_status_no_data;
+        }
+        else
+        {
+            struct pollfd pfd = { .fd = p_card->data_fd, .events = POLLIN };
+            int wait_ms = -1;
+
+            if ( deadline_ns != 0 )
+            {
+                uint64_t now = now_ns();
+
+                if ( now >= deadline_ns )
+                {
+                    return skiq_rx_status_no_data;
+                }
+                wait_ms = (int)( ( deadline_ns - now + 999999 ) / 1000000 );
+            }
+            if ( poll( &pfd, 1, wait_ms ) == 0 )
+            {
+                return skiq_rx_status_no_data;
+            }
+        }
+    }
 }
 
 
@@ -520,14 +2463,48 @@ static int32_t my_tx_initialize( uint64_t xport_uid,
                                  int32_t priority,
                                  skiq_tx_callback_t tx_complete_cb )
 {
-    printf(" --> %s called with %" PRIu64 " %u %u %u %d %p\n", __FUNCTION__,
-           xport_uid, tx_transfer_mode, num_bytes_to_send, num_send_threads, priority, tx_complete_cb);
+    struct my_card *p_card = get_card( xport_uid );
+    int32_t status;
+
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
+
+    /* all blocks go through one link, so a single thread completes them in
+       order regardless of num_send_threads; its priority is left to the
+       caller's scheduling policy */
+    (void)num_send_threads;
+    (void)priority;
+
+    if ( ( p_card->link == my_link_shm ) && ( num_bytes_to_send > p_card->p_shm->tx.slot_size ) )
+    {
+        fprintf( stderr, "Error: transmit block of %" PRIu32 " bytes exceeds the custom"
+                 " transport's slot size of %" PRIu32 " bytes\n", num_bytes_to_send,
+                 p_card->p_shm->tx.slot_size );
+        return -EINVAL;
+    }
+    if ( ( p_card->link == my_link_udp ) &&
+         ( ( num_bytes_to_send + sizeof(struct my_xport_udp_hdr) ) > 65507 ) )
+    {
+        return -EINVAL;
+    }
+
+    stop_tx_thread( p_card );
+    p_card->tx_mode = tx_transfer_mode;
+    p_card->tx_bytes = num_bytes_to_send;
+    p_card->tx_cb = tx_complete_cb;
+    p_card->tx_q_head = p_card->tx_q_tail = 0;
 
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
+    status = peer_request( p_card, MY_XPORT_OP_TX_INIT, 0, num_bytes_to_send, NULL );
+    if ( ( status == 0 ) && ( tx_transfer_mode == skiq_tx_transfer_mode_async ) )
+    {
+        p_card->tx_running = true;
+        status = -pthread_create( &(p_card->tx_thread), NULL, tx_complete_thread, p_card );
+        p_card->tx_thread_started = ( status == 0 );
+    }
 
-    return -1;
+    return status;
 }
 
 
@@ -550,13 +2527,14 @@ static int32_t my_tx_initialize( uint64_t xport_uid,
 static int32_t my_tx_start_streaming( uint64_t xport_uid,
                                       skiq_tx_hdl_t hdl )
 {
-    printf(" --> %s called with %" PRIu64 " %u\n", __FUNCTION__, xport_uid, hdl);
+    struct my_card *p_card = get_card( xport_uid );
 
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
 
-    return -1;
+    return peer_request( p_card, MY_XPORT_OP_TX_START, hdl, 0, NULL );
 }
 
 
@@ -581,13 +2559,17 @@ static int32_t my_tx_start_streaming( uint64_t xport_uid,
 static int32_t my_tx_stop_streaming( uint64_t xport_uid,
                                      skiq_tx_hdl_t hdl )
 {
-    printf(" --> %s called with %" PRIu64 " %u\n", __FUNCTION__, xport_uid, hdl);
+    struct my_card *p_card = get_card( xport_uid );
+
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
 
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
+    /* complete the blocks still in flight before telling the peer */
+    stop_tx_thread( p_card );
 
-    return -1;
+    return peer_request( p_card, MY_XPORT_OP_TX_STOP, hdl, 0, NULL );
 }
 
 
@@ -613,11 +2595,92 @@ static int32_t my_tx_transmit( uint64_t xport_uid,
                                int32_t *p_samples,
                                void *p_private )
 {
-    printf(" --> %s called with %" PRIu64 " %u %p %p\n", __FUNCTION__, xport_uid, hdl, p_samples, p_private);
+    struct my_card *p_card = get_card( xport_uid );
+    uint32_t depth;
+
+    (void)hdl;
+
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
 
-    /*****************************************************************************/
-    /********************** CUSTOM IMPLEMENTATION GOES HERE **********************/
-    /*****************************************************************************/
+    if ( p_card->tx_mode == skiq_tx_transfer_mode_sync )
+    {
+        if ( p_card->link == my_link_shm )
+        {
+            struct my_xport_ring *p_ring = &(p_card->p_shm->tx);
+            uint64_t deadline_ns = now_ns() + MY_XPORT_REQUEST_TIMEOUT_NS;
+            uint64_t index;
+
+            /* wait for a free slot, then for the peer to consume the block */
+            if ( !wait_tx_consumed( p_card, ( p_card->tx_head + 1 > p_ring->nr_slots ) ?
+                                    p_card->tx_head + 1 - p_ring->nr_slots : 0, deadline_ns ) )
+            {
+                return -ETIMEDOUT;
+            }
+            index = shm_tx_push( p_card, p_samples );
+            if ( !wait_tx_consumed( p_card, index, deadline_ns ) )
+            {
+                return -ETIMEDOUT;
+            }
+        }
+        else if ( p_card->link == my_link_udp )
+        {
+            struct my_xport_udp_hdr hdr = {
+                .magic = MY_XPORT_MAGIC,
+                .op = MY_XPORT_OP_TX_DATA,
+                .seq = p_card->tx_seq++,
+                .status = 0,
+                .addr = 0,
+                .len = p_card->tx_bytes,
+                .data = 0,
+            };
+            struct iovec iov[2] = {
+                { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+                { .iov_base = p_samples, .iov_len = p_card->tx_bytes },
+            };
+            struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+
+            if ( sendmsg( p_card->data_fd, &msg, 0 ) < 0 )
+            {
+                return -errno;
+            }
+        }
+        p_card->nr_tx_blocks++;
+
+        return 0;
+    }
+
+    /* async: the queue is bounded by the ring with shared memory */
+    depth = MY_XPORT_TX_QUEUE;
+    if ( p_card->link == my_link_shm )
+    {
+        depth = MIN( depth, p_card->p_shm->tx.nr_slots );
+    }
+
+    pthread_mutex_lock( &(p_card->tx_lock) );
+    if ( ( p_card->tx_q_head - p_card->tx_q_tail ) >= depth )
+    {
+        pthread_mutex_unlock( &(p_card->tx_lock) );
+        return SKIQ_TX_ASYNC_SEND_QUEUE_FULL;
+    }
+    else
+    {
+        struct my_tx_pending *p_entry = &(p_card->tx_queue[p_card->tx_q_head % MY_XPORT_TX_QUEUE]);
+
+        p_entry->p_samples = p_samples;
+        p_entry->p_private = p_private;
+        p_entry->index = 0;
+        if ( p_card->link == my_link_shm )
+        {
+            /* every queued block owns a slot, so there is room */
+            p_entry->index = shm_tx_push( p_card, p_samples );
+        }
+        p_card->tx_q_head++;
+        pthread_cond_signal( &(p_card->tx_work) );
+    }
+    pthread_mutex_unlock( &(p_card->tx_lock) );
 
     return 0;
 }
@@ -632,18 +2695,20 @@ static skiq_xport_fpga_functions_t fpga_reg_ops = {
     .fpga_reg_write = my_fpga_reg_write,
     .fpga_down      = my_fpga_down,
     .fpga_up        = my_fpga_up,
+    .fpga_reg_read_64  = my_fpga_reg_read_64,
+    .fpga_reg_write_64 = my_fpga_reg_write_64,
 };
 
 static skiq_xport_rx_functions_t rx_ops = {
-    .rx_configure            = NULL,
-    .rx_set_block_size       = NULL,
+    .rx_configure            = my_rx_configure,
+    .rx_set_block_size       = my_rx_set_block_size,
     .rx_set_buffered         = NULL,
     .rx_start_streaming      = my_rx_start_streaming,
     .rx_stop_streaming       = my_rx_stop_streaming,
     .rx_pause_streaming      = my_rx_pause_streaming,
     .rx_resume_streaming     = my_rx_resume_streaming,
     .rx_flush                = my_rx_flush,
-    .rx_set_transfer_timeout = NULL,
+    .rx_set_transfer_timeout = my_rx_set_transfer_timeout,
     .rx_receive              = my_rx_receive,
 };
 
@@ -663,3 +2728,120 @@ skiq_xport_card_functions_t card_ops = {
     .card_init      = my_card_init,
     .card_exit      = my_card_exit,
 };
+
+/***** GLOBAL FUNCTIONS *****/
+
+/*****************************************************************************/
+/** Write a run of words to one FPGA register, see my_custom_xport.h.  Over
+ * UDP the words go out MY_XPORT_UDP_BURST_WORDS at a time, each run answered
+ * with a single response; the shared memory mailbox and the replay register
+ * store are cheap enough to take the words one by one.
+ *
+ * @param[in] xport_uid unique ID used to identifer the card at the transport layer
+ * @param[in] addr address of the destination FPGA register
+ * @param[in] p_data words to write
+ * @param[in] nr_words number of words
+ *
+ * @return status where 0=success, anything else is an error.
+ */
+int32_t my_xport_fpga_reg_write_burst( uint64_t xport_uid,
+                                       uint32_t addr,
+                                       const uint32_t *p_data,
+                                       uint32_t nr_words )
+{
+    struct my_card *p_card = get_card( xport_uid );
+    int32_t status = 0;
+    uint32_t i;
+
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
+
+    if ( p_card->link != my_link_udp )
+    {
+        for ( i = 0; ( i < nr_words ) && ( status == 0 ); i++ )
+        {
+            status = peer_request( p_card, MY_XPORT_OP_REG_WRITE, addr, p_data[i], NULL );
+        }
+        return status;
+    }
+
+    pthread_mutex_lock( &(p_card->ctrl_lock) );
+    for ( i = 0; ( i < nr_words ) && ( status == 0 ); i += MY_XPORT_UDP_BURST_WORDS )
+    {
+        uint32_t nr = ( ( nr_words - i ) < MY_XPORT_UDP_BURST_WORDS ) ?
+            ( nr_words - i ) : MY_XPORT_UDP_BURST_WORDS;
+
+        status = udp_request( p_card->ctrl_fd, ++(p_card->ctrl_seq),
+                              MY_XPORT_OP_REG_WRITE_BURST, addr, nr,
+                              MY_XPORT_UDP_TIMEOUT_MS, &(p_data[i]), nr, NULL );
+    }
+    pthread_mutex_unlock( &(p_card->ctrl_lock) );
+
+    if ( status == -ETIMEDOUT )
+    {
+        fprintf( stderr, "Error: custom transport peer of card UID %" PRIu64 " did not answer"
+                 " request %" PRIu32 "\n", xport_uid, (uint32_t)MY_XPORT_OP_REG_WRITE_BURST );
+    }
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Get the readiness file descriptor of a card, see my_custom_xport.h.  Over
+ * UDP it is the data socket.  Otherwise an eventfd is created on the first
+ * call, together with a thread that sleeps on the ring's doorbell (or until
+ * the next replayed block is due) and signals the eventfd when a block shows
+ * up after rx_receive() returned no data.
+ *
+ * @param[in] xport_uid unique ID used to identifer the card at the transport layer
+ * @param[out] p_is_eventfd set to true if the descriptor has to be read after waking
+ *
+ * @return the file descriptor, else a negative errno
+ */
+int my_xport_rx_ready_fd( uint64_t xport_uid,
+                          bool *p_is_eventfd )
+{
+    struct my_card *p_card = get_card( xport_uid );
+    int fd;
+
+    if ( p_card == NULL )
+    {
+        return -ENODEV;
+    }
+
+    if ( p_card->link == my_link_udp )
+    {
+        *p_is_eventfd = false;
+        return p_card->data_fd;
+    }
+
+    pthread_mutex_lock( &(p_card->ctrl_lock) );
+    if ( p_card->ready_fd < 0 )
+    {
+        fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+        if ( fd >= 0 )
+        {
+            int result;
+
+            /* armed from the start, the first block is signalled */
+            p_card->ready_armed = 1;
+            p_card->ready_running = true;
+            p_card->ready_fd = fd;
+            result = pthread_create( &(p_card->ready_thread), NULL, rx_ready_thread, p_card );
+            if ( result != 0 )
+            {
+                close( fd );
+                p_card->ready_fd = -1;
+                errno = result;
+            }
+        }
+    }
+    fd = ( p_card->ready_fd >= 0 ) ? p_card->ready_fd : -errno;
+    pthread_mutex_unlock( &(p_card->ctrl_lock) );
+
+    *p_is_eventfd = true;
+
+    return fd;
+}
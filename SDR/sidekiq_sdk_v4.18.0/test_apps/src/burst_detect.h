@@ -0,0 +1,384 @@
+/**
+ * @file   burst_detect.h
+ *
+ * @brief  Streaming energy detector that finds bursts in received I/Q samples and reports where
+ *         they start and stop by RF timestamp.
+ *
+ * The samples of every block are summed as |x|^2 = I^2 + Q^2 over segments of segment_len
+ * samples, with an AVX2 or NEON kernel where available.  The mean power over the last
+ * nr_segments segments (a moving average over segment_len * nr_segments samples) is then
+ * compared with two thresholds: a burst starts when the average reaches the on threshold and
+ * stops when it falls below the lower off threshold, so noise around a single threshold does not
+ * chop one burst into many.  Events therefore have the resolution of a segment and the average
+ * lags the signal by up to one window.
+ *
+ * Powers are in dB relative to full scale, i.e. to a complex sample of magnitude full_scale on
+ * both I and Q (a full scale tone on both rails reads 0 dBFS).  Samples are unpacked int16 I/Q in
+ * either order; unpack packed blocks first (iq_unpack.h).  A detector keeps samples carried across
+ * blocks, so each handle needs its own.
+ */
+
+#ifndef __BURST_DETECT_H__
+#define __BURST_DETECT_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#if (defined __x86_64__ || defined __i386__) && (defined __GNUC__) && \
+    ( (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)) || (defined __clang__) )
+#   define BURST_DETECT_HAVE_AVX2
+#   include <immintrin.h>
+#elif (defined __aarch64__) && (defined __ARM_NEON)
+#   define BURST_DETECT_HAVE_NEON
+#   include <arm_neon.h>
+#endif
+
+/***** DEFINES *****/
+
+#define BURST_DETECT_DEFAULT_SEGMENT    (256)
+#define BURST_DETECT_DEFAULT_SEGMENTS   (8)
+#define BURST_DETECT_DEFAULT_HYSTERESIS (3.0)
+
+/***** TYPEDEFS *****/
+
+struct burst_event
+{
+    uint64_t rf_timestamp;              /* first sample of the segment that crossed the threshold */
+    double power_dbfs;                  /* moving average at the crossing */
+    bool start;                         /* the burst starts, else it stops */
+};
+
+/* sums |x|^2 over nr_samples int16 I/Q pairs */
+typedef uint64_t (*burst_detect_energy_fn)( const int16_t *p_iq,
+                                            uint32_t nr_samples );
+
+struct burst_detector
+{
+    uint32_t segment_len;
+    uint32_t nr_segments;
+    uint64_t *p_history;                /* energy of the last nr_segments segments */
+    uint32_t next;                      /* oldest entry of p_history */
+    uint64_t window_energy;             /* sum of p_history */
+    uint32_t nr_filled;                 /* segments seen so far, up to nr_segments */
+    double on_energy;                   /* window energy thresholds */
+    double off_energy;
+    double full_scale;
+
+    /* segment being accumulated */
+    uint64_t segment_energy;
+    uint32_t segment_fill;
+    uint64_t segment_ts;
+
+    bool active;                        /* inside a burst */
+    uint64_t burst_start_ts;
+
+    /* statistics */
+    uint64_t nr_bursts;
+    uint64_t nr_active_samples;
+    uint64_t nr_samples;
+};
+
+#define BURST_DETECTOR_INITIALIZER                      \
+    (struct burst_detector){                            \
+        .segment_len = 0,                               \
+        .nr_segments = 0,                               \
+        .p_history = NULL,                              \
+        .next = 0,                                      \
+        .window_energy = 0,                             \
+        .nr_filled = 0,                                 \
+        .segment_energy = 0,                            \
+        .segment_fill = 0,                              \
+        .segment_ts = 0,                                \
+        .active = false,                                \
+        .burst_start_ts = 0,                            \
+        .nr_bursts = 0,                                 \
+        .nr_active_samples = 0,                         \
+        .nr_samples = 0,                                \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+static inline uint64_t _burst_detect_energy_scalar( const int16_t *p_iq,
+                                                    uint32_t nr_samples )
+{
+    uint64_t sum = 0;
+    uint32_t i;
+
+    for ( i = 0; i < 2 * nr_samples; i++ )
+    {
+        sum += (uint32_t)( (int32_t)p_iq[i] * p_iq[i] );
+    }
+
+    return sum;
+}
+
+/*
+  _mm256_madd_epi16() squares 16 int16 values and adds adjacent pairs, giving I^2 + Q^2 for 8
+  samples.  A pair can reach 2^31 (both -32768) which is only representable unsigned, so the 32-bit
+  sums are zero extended before they are accumulated in 64-bit lanes.
+*/
+#if (defined BURST_DETECT_HAVE_AVX2)
+__attribute__((target("avx2")))
+static inline uint64_t _burst_detect_energy_avx2( const int16_t *p_iq,
+                                                  uint32_t nr_samples )
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = _mm256_setzero_si256();
+    uint64_t lanes[4];
+    uint32_t i = 0;
+
+    for ( ; i + 8 <= nr_samples; i += 8 )
+    {
+        __m256i v = _mm256_loadu_si256( (const __m256i *)(p_iq + 2 * i) );
+        __m256i p = _mm256_madd_epi16( v, v );
+
+        acc = _mm256_add_epi64( acc, _mm256_unpacklo_epi32( p, zero ) );
+        acc = _mm256_add_epi64( acc, _mm256_unpackhi_epi32( p, zero ) );
+    }
+    _mm256_storeu_si256( (__m256i *)lanes, acc );
+
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+        _burst_detect_energy_scalar( p_iq + 2 * i, nr_samples - i );
+}
+#endif  /* BURST_DETECT_HAVE_AVX2 */
+
+#if (defined BURST_DETECT_HAVE_NEON)
+static inline uint64_t _burst_detect_energy_neon( const int16_t *p_iq,
+                                                  uint32_t nr_samples )
+{
+    uint64x2_t acc = vdupq_n_u64( 0 );
+    uint32_t i = 0;
+
+    for ( ; i + 4 <= nr_samples; i += 4 )
+    {
+        int16x8_t v = vld1q_s16( p_iq + 2 * i );
+        uint32x4_t lo = vreinterpretq_u32_s32( vmull_s16( vget_low_s16( v ), vget_low_s16( v ) ) );
+        uint32x4_t hi = vreinterpretq_u32_s32( vmull_s16( vget_high_s16( v ), vget_high_s16( v ) ) );
+
+        acc = vpadalq_u32( acc, lo );
+        acc = vpadalq_u32( acc, hi );
+    }
+
+    return vgetq_lane_u64( acc, 0 ) + vgetq_lane_u64( acc, 1 ) +
+        _burst_detect_energy_scalar( p_iq + 2 * i, nr_samples - i );
+}
+#endif  /* BURST_DETECT_HAVE_NEON */
+
+/*****************************************************************************/
+/** Select (on first call) and return the fastest energy kernel available on this host.
+
+    @param[out] pp_name     optional, set to a string naming the selected kernel
+
+    @return the selected kernel
+*/
+static inline burst_detect_energy_fn burst_detect_select( const char **pp_name )
+{
+    static burst_detect_energy_fn p_fn = NULL;
+    static const char *p_name = NULL;
+
+    if ( p_fn == NULL )
+    {
+        p_fn = _burst_detect_energy_scalar;
+        p_name = "scalar";
+#if (defined BURST_DETECT_HAVE_AVX2)
+        __builtin_cpu_init();
+        if ( __builtin_cpu_supports("avx2") )
+        {
+            p_fn = _burst_detect_energy_avx2;
+            p_name = "avx2";
+        }
+#elif (defined BURST_DETECT_HAVE_NEON)
+        p_fn = _burst_detect_energy_neon;
+        p_name = "neon";
+#endif
+    }
+
+    if ( pp_name != NULL )
+    {
+        *pp_name = p_name;
+    }
+
+    return p_fn;
+}
+
+/*****************************************************************************/
+/** Release the memory of a detector.  Safe to call on a detector that failed to initialize.
+
+    @param[in] d            detector
+
+    @return void
+*/
+static inline void burst_detect_free( struct burst_detector *d )
+{
+    free( d->p_history );
+    *d = BURST_DETECTOR_INITIALIZER;
+}
+
+/*****************************************************************************/
+/** Initialize a detector.
+
+    @param[out] d           detector
+    @param[in]  segment_len number of samples per segment
+    @param[in]  nr_segments number of segments averaged
+    @param[in]  on_dbfs     mean power at which a burst starts
+    @param[in]  off_dbfs    mean power below which it stops, at most on_dbfs
+    @param[in]  full_scale  largest sample magnitude (e.g. 2048 for 12-bit samples)
+
+    @return 0 on success, else -EINVAL or -ENOMEM
+*/
+static inline int32_t burst_detect_init( struct burst_detector *d,
+                                         uint32_t segment_len,
+                                         uint32_t nr_segments,
+                                         double on_dbfs,
+                                         double off_dbfs,
+                                         double full_scale )
+{
+    const double window_len = (double)segment_len * nr_segments;
+    /* energy of a window of full scale samples, I^2 + Q^2 = 2 * full_scale^2 */
+    const double full_scale_energy = window_len * 2.0 * full_scale * full_scale;
+
+    *d = BURST_DETECTOR_INITIALIZER;
+    if ( ( segment_len == 0 ) || ( nr_segments == 0 ) || ( off_dbfs > on_dbfs ) ||
+         ( full_scale <= 0.0 ) )
+    {
+        return -EINVAL;
+    }
+
+    d->p_history = calloc( nr_segments, sizeof(uint64_t) );
+    if ( d->p_history == NULL )
+    {
+        return -ENOMEM;
+    }
+    d->segment_len = segment_len;
+    d->nr_segments = nr_segments;
+    d->full_scale = full_scale;
+    d->on_energy = full_scale_energy * pow( 10.0, on_dbfs / 10.0 );
+    d->off_energy = full_scale_energy * pow( 10.0, off_dbfs / 10.0 );
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Mean power of the current window.
+
+    @param[in] d            detector
+
+    @return mean power in dBFS
+*/
+static inline double burst_detect_power_dbfs( const struct burst_detector *d )
+{
+    const double window_len = (double)d->segment_len * d->nr_segments;
+
+    return 10.0 * log10( (double)d->window_energy /
+                         ( window_len * 2.0 * d->full_scale * d->full_scale ) + 1e-30 );
+}
+
+/* close the current segment and compare the window with the thresholds */
+static inline bool _burst_detect_segment( struct burst_detector *d,
+                                          struct burst_event *p_event )
+{
+    d->window_energy -= d->p_history[d->next];
+    d->p_history[d->next] = d->segment_energy;
+    d->window_energy += d->segment_energy;
+    d->next = ( d->next + 1 ) % d->nr_segments;
+    if ( d->nr_filled < d->nr_segments )
+    {
+        d->nr_filled++;
+    }
+    d->segment_energy = 0;
+    d->segment_fill = 0;
+
+    if ( d->active )
+    {
+        d->nr_active_samples += d->segment_len;
+    }
+
+    /* no decision until the window is full */
+    if ( d->nr_filled < d->nr_segments )
+    {
+        return false;
+    }
+
+    if ( !d->active && ( (double)d->window_energy >= d->on_energy ) )
+    {
+        d->active = true;
+        d->burst_start_ts = d->segment_ts;
+        d->nr_bursts++;
+    }
+    else if ( d->active && ( (double)d->window_energy < d->off_energy ) )
+    {
+        d->active = false;
+    }
+    else
+    {
+        return false;
+    }
+
+    p_event->rf_timestamp = d->segment_ts;
+    p_event->power_dbfs = burst_detect_power_dbfs( d );
+    p_event->start = d->active;
+
+    return true;
+}
+
+/*****************************************************************************/
+/** Feed a run of consecutive samples to a detector.
+
+    @param[in]  d           detector
+    @param[in]  p_iq        2 * nr_samples int16 values
+    @param[in]  nr_samples  number of I/Q samples
+    @param[in]  rf_timestamp RF timestamp of the first sample
+    @param[out] p_events    burst start and stop events, in order
+    @param[in]  max_events  size of p_events; later events are lost if it runs out, which can't
+                            happen with max_events >= 1 + nr_samples / segment_len
+
+    @return number of events written to p_events
+*/
+static inline uint32_t burst_detect_process( struct burst_detector *d,
+                                             const int16_t *p_iq,
+                                             uint32_t nr_samples,
+                                             uint64_t rf_timestamp,
+                                             struct burst_event *p_events,
+                                             uint32_t max_events )
+{
+    const burst_detect_energy_fn p_energy = burst_detect_select( NULL );
+    uint32_t nr_events = 0;
+
+    d->nr_samples += nr_samples;
+    while ( nr_samples > 0 )
+    {
+        uint32_t nr = d->segment_len - d->segment_fill;
+        struct burst_event event;
+
+        if ( nr > nr_samples )
+        {
+            nr = nr_samples;
+        }
+        if ( d->segment_fill == 0 )
+        {
+            d->segment_ts = rf_timestamp;
+        }
+        d->segment_energy += p_energy( p_iq, nr );
+        d->segment_fill += nr;
+
+        p_iq += 2 * nr;
+        rf_timestamp += nr;
+        nr_samples -= nr;
+
+        if ( ( d->segment_fill == d->segment_len ) && _burst_detect_segment( d, &event ) &&
+             ( nr_events < max_events ) )
+        {
+            p_events[nr_events++] = event;
+        }
+    }
+
+    return nr_events;
+}
+
+#endif  /* __BURST_DETECT_H__ */
@@ -0,0 +1,213 @@
+/*! \file capture_extract.c
+ * \brief This file contains an application that extracts a run of samples
+ * from a receive capture as 16-bit I/Q, unpacking packed captures.
+ *
+ * <pre>
+ * Copyright 2014-2021 Epiq Solutions, All Rights Reserved
+ * </pre>
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <sidekiq_api.h>
+#include <arg_parser.h>
+
+#include "capture_reader.h"
+
+/* number of samples converted per write */
+#define EXTRACT_CHUNK_SAMPLES   (1024 * 1024)
+
+/* these are used to provide help strings for the application when running it
+   with either the "-h" or "--help" flags */
+static const char* p_help_short = "- extract samples from a receive capture";
+static const char* p_help_long = "\
+Reads '--samples' samples of the capture '--source' starting at sample\n\
+'--start', or at the RF timestamp '--timestamp', and writes them to\n\
+'--destination' as 16-bit I/Q pairs in the order in which they were captured\n\
+(Q first unless the capture was made with I first), or I first with '--iq'.\n\
+\n\
+Captures written by rx_samples with '--index' are described by their\n\
+<file>.idx index: packed captures stay packed on disk and are unpacked here,\n\
+block headers of '--meta' captures are dropped, and '--timestamp' can be\n\
+used.  A capture without an index is read as plain 16-bit I/Q samples.\n\
+Captures written with rx_samples '--compress' are decompressed on the fly,\n\
+several chunks at a time in parallel.\n\
+\n\
+With '--samples=0' everything from the start position to the end of the\n\
+capture is extracted.\n\
+\n\
+Defaults:\n\
+  --start=0\n\
+  --samples=0";
+
+/* command line argument variables */
+static char* p_source = NULL;
+static char* p_destination = NULL;
+static uint64_t start = 0;
+static uint64_t timestamp = 0;
+static bool timestamp_present = false;
+static uint64_t nr_samples = 0;
+static bool iq_first = false;
+
+/* the command line arguments available to this application */
+static struct application_argument p_args[] =
+{
+    APP_ARG_REQ("source",
+                's',
+                "Capture to read",
+                "PATH",
+                &p_source,
+                STRING_VAR_TYPE),
+    APP_ARG_REQ("destination",
+                'd',
+                "Output file",
+                "PATH",
+                &p_destination,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("start",
+                0,
+                "Index of the first sample to extract",
+                "N",
+                &start,
+                UINT64_VAR_TYPE),
+    APP_ARG_OPT_PRESENT("timestamp",
+                        't',
+                        "RF timestamp of the first sample to extract (indexed captures only)",
+                        "TS",
+                        &timestamp,
+                        UINT64_VAR_TYPE,
+                        &timestamp_present),
+    APP_ARG_OPT("samples",
+                'n',
+                "Number of samples to extract, 0 for all",
+                "N",
+                &nr_samples,
+                UINT64_VAR_TYPE),
+    APP_ARG_OPT("iq",
+                0,
+                "Write I before Q",
+                NULL,
+                &iq_first,
+                BOOL_VAR_TYPE),
+    APP_ARG_TERMINATOR,
+};
+
+int main( int argc, char *argv[] )
+{
+    struct capture_reader reader;
+    int16_t *p_samples = NULL;
+    uint64_t nr_written = 0;
+    uint64_t pos;
+    FILE *p_out = NULL;
+    int32_t status;
+
+    if( arg_parser(argc, argv, p_help_short, p_help_long, p_args) != 0 )
+    {
+        arg_parser_print_help(argv[0], p_help_short, p_help_long, p_args);
+        return (-1);
+    }
+
+    status = capture_reader_open( &reader, p_source );
+    if( status != 0 )
+    {
+        fprintf(stderr, "Error: unable to open capture %s (%s)\n", p_source,
+                strerror(abs(status)));
+        return (-1);
+    }
+    printf("Info: %s holds %" PRIu64 " samples (%s%s%s)\n", p_source, reader.nr_samples,
+           reader.indexed ? "indexed" : "not indexed", reader.packed ? ", packed" : "",
+           reader.include_meta ? ", with metadata" : "");
+
+    pos = start;
+    if( timestamp_present )
+    {
+        status = capture_reader_seek_rf( &reader, timestamp, &pos );
+        if( status != 0 )
+        {
+            fprintf(stderr, "Error: RF timestamp 0x%016" PRIx64 " is not in the capture%s\n",
+                    timestamp, reader.indexed ? "" : " (no index)");
+            capture_reader_close( &reader );
+            return (-1);
+        }
+        printf("Info: RF timestamp 0x%016" PRIx64 " is sample %" PRIu64 "\n", timestamp, pos);
+    }
+    if( pos >= reader.nr_samples )
+    {
+        fprintf(stderr, "Error: start sample %" PRIu64 " is past the end of the capture\n", pos);
+        capture_reader_close( &reader );
+        return (-1);
+    }
+    if( ( nr_samples == 0 ) || ( nr_samples > reader.nr_samples - pos ) )
+    {
+        nr_samples = reader.nr_samples - pos;
+    }
+
+    p_samples = malloc( EXTRACT_CHUNK_SAMPLES * 2 * sizeof(int16_t) );
+    p_out = fopen( p_destination, "wb" );
+    if( ( p_samples == NULL ) || ( p_out == NULL ) )
+    {
+        fprintf(stderr, "Error: unable to %s\n", ( p_samples == NULL ) ?
+                "allocate the sample buffer" : "open the output file");
+        status = -1;
+    }
+
+    while( ( status == 0 ) && ( nr_written < nr_samples ) )
+    {
+        uint64_t nr = nr_samples - nr_written;
+        int64_t nr_read;
+        uint64_t i;
+
+        if( nr > EXTRACT_CHUNK_SAMPLES )
+        {
+            nr = EXTRACT_CHUNK_SAMPLES;
+        }
+        nr_read = capture_reader_read( &reader, pos + nr_written, p_samples, nr );
+        if( nr_read <= 0 )
+        {
+            fprintf(stderr, "Error: the capture is shorter than its index\n");
+            status = -1;
+            break;
+        }
+
+        if( iq_first != reader.iq_order )
+        {
+            for( i = 0; i < (uint64_t)nr_read; i++ )
+            {
+                int16_t tmp = p_samples[2 * i];
+
+                p_samples[2 * i] = p_samples[2 * i + 1];
+                p_samples[2 * i + 1] = tmp;
+            }
+        }
+
+        if( fwrite( p_samples, 2 * sizeof(int16_t), nr_read, p_out ) != (size_t)nr_read )
+        {
+            fprintf(stderr, "Error: failed to write to %s\n", p_destination);
+            status = -1;
+            break;
+        }
+        nr_written += nr_read;
+    }
+
+    if( ( p_out != NULL ) && ( fclose( p_out ) != 0 ) && ( status == 0 ) )
+    {
+        fprintf(stderr, "Error: failed to write to %s\n", p_destination);
+        status = -1;
+    }
+    free( p_samples );
+    capture_reader_close( &reader );
+
+    if( status == 0 )
+    {
+        printf("Info: wrote %" PRIu64 " samples starting at sample %" PRIu64 " to %s\n",
+               nr_written, pos, p_destination);
+    }
+
+    return ( status == 0 ) ? 0 : (-1);
+}
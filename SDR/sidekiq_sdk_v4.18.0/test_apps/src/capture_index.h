@@ -0,0 +1,797 @@
+/**
+ * @file   capture_index.h
+ *
+ * @brief  Block index and SigMF metadata written next to a receive capture, and a reader that
+ *         maps both back for random access.
+ *
+ * The capture itself stays the raw file that the receive applications have always written
+ * (samples only, or whole blocks with --meta).  For a capture "PATH" two sidecar files are
+ * added:
+ *
+ * - "PATH.idx": a struct capture_index_header followed by one struct capture_index_record per
+ *   received block, in the order the blocks were written.  A record maps the block's RF and
+ *   system timestamps to the byte offset of the block in PATH and flags timestamp gaps and RF
+ *   overload.  Both timestamps increase with the records, so a block can be found by either with
+ *   a binary search.
+ *
+ * - "PATH.sigmf-meta": SigMF 1.0 metadata with PATH as a non-conforming dataset
+ *   ("core:dataset").  The samples are described as ci16_le; "sidekiq:iq_order" tells whether
+ *   they are stored I first or, as by default, Q first, and "sidekiq:packed",
+ *   "sidekiq:include_meta" and "sidekiq:compressed" (iq_compress.h) flag layouts that a generic
+ *   SigMF reader can't interpret.  Record offsets are always offsets into the uncompressed
+ *   capture.  Gaps and runs of overloaded blocks are listed as annotations.
+ *
+ * - "PATH.telem", only when sensor telemetry is recorded (see telemetry.h): a struct
+ *   capture_telemetry_header followed by one struct capture_telemetry_record per telemetry sample
+ *   published during the capture.  The index record of the first block written after a sample
+ *   carries CAPTURE_INDEX_FLAG_TELEMETRY, and the telemetry record names that index record, so
+ *   each block is tagged by the last telemetry record at or before it.
+ *
+ * The records are appended through stdio as blocks arrive, so the index costs one small buffered
+ * write per block and no memory that grows with the length of the recording; only the
+ * annotations are kept until the capture is closed (at most CAPTURE_INDEX_MAX_ANNOTATIONS).
+ * Paths under /dev/ (e.g. /dev/null) are not indexed.
+ */
+
+#ifndef __CAPTURE_INDEX_H__
+#define __CAPTURE_INDEX_H__
+
+/***** INCLUDES *****/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if (!defined __MINGW32__)
+#   include <sys/mman.h>
+#endif
+
+/***** DEFINES *****/
+
+#define CAPTURE_INDEX_MAGIC             (0x58494b53)    /* "SKIX" */
+#define CAPTURE_INDEX_VERSION           (1)
+
+#define CAPTURE_INDEX_SUFFIX            ".idx"
+#define CAPTURE_INDEX_META_SUFFIX       ".sigmf-meta"
+#define CAPTURE_INDEX_TELEMETRY_SUFFIX  ".telem"
+
+#define CAPTURE_TELEMETRY_MAGIC         (0x4d544b53)    /* "SKTM" */
+#define CAPTURE_TELEMETRY_VERSION       (1)
+
+/* struct capture_index_record flags */
+#define CAPTURE_INDEX_FLAG_GAP          (1 << 0)    /* RF timestamp doesn't follow the previous block */
+#define CAPTURE_INDEX_FLAG_OVERLOAD     (1 << 1)    /* the RF input was overloaded */
+#define CAPTURE_INDEX_FLAG_TELEMETRY    (1 << 2)    /* a telemetry record applies from the block */
+
+/* struct capture_index_header flags */
+#define CAPTURE_INDEX_INCLUDE_META      (1 << 0)    /* blocks are stored with their header */
+#define CAPTURE_INDEX_PACKED            (1 << 1)    /* samples are packed 12-bit */
+#define CAPTURE_INDEX_IQ_ORDER          (1 << 2)    /* I before Q, else Q before I */
+#define CAPTURE_INDEX_COMPRESSED        (1 << 3)    /* capture is an iq_compress.h container */
+
+/* largest number of gap and overload annotations kept for the metadata */
+#define CAPTURE_INDEX_MAX_ANNOTATIONS   (4096)
+
+#define CAPTURE_INDEX_MAX_PATH          (4096)
+
+/***** TYPEDEFS *****/
+
+struct capture_index_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;               /* sizeof(struct capture_index_record) */
+    uint32_t flags;                     /* CAPTURE_INDEX_INCLUDE_META, ... */
+    uint32_t reserved;
+    double sample_rate;
+    uint64_t frequency;
+    uint64_t nr_records;                /* written when the capture is closed, 0 while open */
+    uint64_t nr_samples;
+};
+
+struct capture_index_record
+{
+    uint64_t rf_timestamp;
+    uint64_t sys_timestamp;
+    uint64_t offset;                    /* of the block in the capture in bytes */
+    uint64_t sample_start;              /* number of samples in the capture before the block */
+    uint32_t nr_samples;
+    uint32_t flags;                     /* CAPTURE_INDEX_FLAG_GAP, ... */
+};
+
+struct capture_telemetry_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;               /* sizeof(struct capture_telemetry_record) */
+};
+
+struct capture_telemetry_record
+{
+    uint64_t record;                    /* first index record the telemetry applies to */
+    uint64_t sample_start;              /* number of samples in the capture before that record */
+    uint64_t sys_timestamp;             /* system timestamp of the card when sampled */
+    uint64_t pps_rf_timestamp;          /* RF and system timestamps of the last 1PPS edge */
+    uint64_t pps_sys_timestamp;
+    double gpsdo_ppm;
+    uint32_t valid;                     /* TELEMETRY_VALID_TEMP, ... of telemetry.h */
+    int16_t accel[3];                   /* X, Y and Z in thousandths of g */
+    int8_t temp_c;
+    uint8_t gpsdo_locked;
+    uint32_t reserved;
+};
+
+/* describes the capture in the metadata, fill in before capture_index_close() */
+struct capture_meta
+{
+    const char *p_recorder;             /* application name */
+    const char *p_hw;                   /* e.g. part and serial number, may be NULL */
+    double sample_rate;
+    uint64_t frequency;
+    bool include_meta;
+    bool packed;
+    bool iq_order;                      /* true for I before Q */
+    bool compressed;                    /* written through iq_compress.h */
+};
+
+struct capture_annotation
+{
+    uint64_t sample_start;
+    uint64_t sample_count;
+    uint64_t gap_samples;               /* samples missing before sample_start, 0 for overload */
+    bool overload;
+};
+
+struct capture_index
+{
+    FILE *p_idx;                        /* NULL when the capture isn't indexed */
+    char data_path[CAPTURE_INDEX_MAX_PATH];
+    struct capture_meta meta;
+    struct timespec start_time;
+
+    uint64_t nr_records;
+    uint64_t nr_samples;
+    uint64_t next_ts;
+    bool first_block;
+
+    struct capture_annotation *p_annotations;
+    uint32_t nr_annotations;
+    bool overload_open;                 /* the last annotation is an overload run still growing */
+
+    FILE *p_telem;                      /* opened with the first telemetry record */
+    bool telemetry_pending;             /* tag the next index record */
+    uint64_t nr_telemetry;
+
+    /* statistics */
+    uint64_t nr_gaps;
+    uint64_t nr_overloaded_blocks;
+};
+
+#define CAPTURE_INDEX_INITIALIZER                       \
+    (struct capture_index){                             \
+        .p_idx = NULL,                                  \
+        .data_path = { 0 },                             \
+        .nr_records = 0,                                \
+        .nr_samples = 0,                                \
+        .next_ts = 0,                                   \
+        .first_block = true,                            \
+        .p_annotations = NULL,                          \
+        .nr_annotations = 0,                            \
+        .overload_open = false,                         \
+        .p_telem = NULL,                                \
+        .telemetry_pending = false,                     \
+        .nr_telemetry = 0,                              \
+        .nr_gaps = 0,                                   \
+        .nr_overloaded_blocks = 0,                      \
+    }
+
+/* a capture and its index mapped for reading */
+struct capture_index_map
+{
+    int idx_fd;
+    int data_fd;
+    const struct capture_index_header *p_hdr;
+    const struct capture_index_record *p_records;
+    uint64_t nr_records;
+    size_t idx_size;
+    const uint8_t *p_data;
+    size_t data_size;
+};
+
+/***** INLINE FUNCTIONS  *****/
+
+static inline void _capture_index_header( const struct capture_index *ci,
+                                          struct capture_index_header *p_hdr )
+{
+    memset( p_hdr, 0, sizeof(*p_hdr) );
+    p_hdr->magic = CAPTURE_INDEX_MAGIC;
+    p_hdr->version = CAPTURE_INDEX_VERSION;
+    p_hdr->record_size = sizeof(struct capture_index_record);
+    p_hdr->flags = ( ci->meta.include_meta ? CAPTURE_INDEX_INCLUDE_META : 0 ) |
+        ( ci->meta.packed ? CAPTURE_INDEX_PACKED : 0 ) |
+        ( ci->meta.iq_order ? CAPTURE_INDEX_IQ_ORDER : 0 ) |
+        ( ci->meta.compressed ? CAPTURE_INDEX_COMPRESSED : 0 );
+    p_hdr->sample_rate = ci->meta.sample_rate;
+    p_hdr->frequency = ci->meta.frequency;
+}
+
+/*****************************************************************************/
+/** Start indexing a capture.  Does nothing (and succeeds) for paths under /dev/.
+
+    @param[out] ci          index to initialize
+    @param[in]  p_data_path path of the capture
+    @param[in]  p_meta      description of the capture, copied; can be updated in ci->meta
+                            until the index is closed
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t capture_index_open( struct capture_index *ci,
+                                          const char *p_data_path,
+                                          const struct capture_meta *p_meta )
+{
+    struct capture_index_header hdr;
+    char path[CAPTURE_INDEX_MAX_PATH + sizeof(CAPTURE_INDEX_SUFFIX)];
+
+    *ci = CAPTURE_INDEX_INITIALIZER;
+    ci->meta = *p_meta;
+    if ( strncmp( p_data_path, "/dev/", 5 ) == 0 )
+    {
+        return 0;
+    }
+    if ( strlen( p_data_path ) >= sizeof(ci->data_path) )
+    {
+        return -ENAMETOOLONG;
+    }
+    strcpy( ci->data_path, p_data_path );
+    clock_gettime( CLOCK_REALTIME, &(ci->start_time) );
+
+    ci->p_annotations = calloc( CAPTURE_INDEX_MAX_ANNOTATIONS, sizeof(struct capture_annotation) );
+    if ( ci->p_annotations == NULL )
+    {
+        return -ENOMEM;
+    }
+
+    snprintf( path, sizeof(path), "%s%s", p_data_path, CAPTURE_INDEX_SUFFIX );
+    ci->p_idx = fopen( path, "w+b" );
+    if ( ci->p_idx == NULL )
+    {
+        int32_t status = -errno;
+
+        free( ci->p_annotations );
+        ci->p_annotations = NULL;
+        return status;
+    }
+
+    _capture_index_header( ci, &hdr );
+    if ( fwrite( &hdr, sizeof(hdr), 1, ci->p_idx ) != 1 )
+    {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Index the next block written to the capture.
+
+    @param[in] ci           index
+    @param[in] rf_timestamp RF timestamp of the block
+    @param[in] sys_timestamp system timestamp of the block
+    @param[in] offset       byte offset in the capture at which the block was written
+    @param[in] nr_samples   number of samples of the block written to the capture
+    @param[in] overload     the block was received with the RF input overloaded
+
+    @return 0 on success, else -EIO
+*/
+static inline int32_t capture_index_add( struct capture_index *ci,
+                                         uint64_t rf_timestamp,
+                                         uint64_t sys_timestamp,
+                                         uint64_t offset,
+                                         uint32_t nr_samples,
+                                         bool overload )
+{
+    struct capture_index_record rec;
+
+    if ( ci->p_idx == NULL )
+    {
+        return 0;
+    }
+
+    rec.rf_timestamp = rf_timestamp;
+    rec.sys_timestamp = sys_timestamp;
+    rec.offset = offset;
+    rec.sample_start = ci->nr_samples;
+    rec.nr_samples = nr_samples;
+    rec.flags = overload ? CAPTURE_INDEX_FLAG_OVERLOAD : 0;
+    if ( ci->telemetry_pending )
+    {
+        rec.flags |= CAPTURE_INDEX_FLAG_TELEMETRY;
+        ci->telemetry_pending = false;
+    }
+
+    if ( !ci->first_block && ( rf_timestamp != ci->next_ts ) )
+    {
+        rec.flags |= CAPTURE_INDEX_FLAG_GAP;
+        ci->nr_gaps++;
+        ci->overload_open = false;
+        if ( ci->nr_annotations < CAPTURE_INDEX_MAX_ANNOTATIONS )
+        {
+            struct capture_annotation *a = &(ci->p_annotations[ci->nr_annotations++]);
+
+            a->sample_start = ci->nr_samples;
+            a->sample_count = 0;
+            a->gap_samples = rf_timestamp - ci->next_ts;
+            a->overload = false;
+        }
+    }
+    ci->first_block = false;
+    ci->next_ts = rf_timestamp + nr_samples;
+
+    if ( overload )
+    {
+        ci->nr_overloaded_blocks++;
+        if ( ci->overload_open )
+        {
+            ci->p_annotations[ci->nr_annotations - 1].sample_count += nr_samples;
+        }
+        else if ( ci->nr_annotations < CAPTURE_INDEX_MAX_ANNOTATIONS )
+        {
+            struct capture_annotation *a = &(ci->p_annotations[ci->nr_annotations++]);
+
+            a->sample_start = ci->nr_samples;
+            a->sample_count = nr_samples;
+            a->gap_samples = 0;
+            a->overload = true;
+            ci->overload_open = true;
+        }
+    }
+    else
+    {
+        ci->overload_open = false;
+    }
+
+    ci->nr_samples += nr_samples;
+    ci->nr_records++;
+
+    return ( fwrite( &rec, sizeof(rec), 1, ci->p_idx ) == 1 ) ? 0 : -EIO;
+}
+
+/*****************************************************************************/
+/** Record a telemetry sample that applies from the next block indexed.  The record and
+    sample_start fields are filled in here.  Does nothing (and succeeds) when the capture isn't
+    indexed.
+
+    @param[in] ci           index
+    @param[in] p_rec        telemetry
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t capture_index_add_telemetry( struct capture_index *ci,
+                                                   const struct capture_telemetry_record *p_rec )
+{
+    struct capture_telemetry_record rec = *p_rec;
+
+    if ( ci->p_idx == NULL )
+    {
+        return 0;
+    }
+
+    if ( ci->p_telem == NULL )
+    {
+        struct capture_telemetry_header hdr;
+        char path[CAPTURE_INDEX_MAX_PATH + sizeof(CAPTURE_INDEX_TELEMETRY_SUFFIX)];
+
+        snprintf( path, sizeof(path), "%s%s", ci->data_path, CAPTURE_INDEX_TELEMETRY_SUFFIX );
+        ci->p_telem = fopen( path, "w+b" );
+        if ( ci->p_telem == NULL )
+        {
+            return -errno;
+        }
+
+        memset( &hdr, 0, sizeof(hdr) );
+        hdr.magic = CAPTURE_TELEMETRY_MAGIC;
+        hdr.version = CAPTURE_TELEMETRY_VERSION;
+        hdr.record_size = sizeof(struct capture_telemetry_record);
+        if ( fwrite( &hdr, sizeof(hdr), 1, ci->p_telem ) != 1 )
+        {
+            return -EIO;
+        }
+    }
+
+    rec.record = ci->nr_records;
+    rec.sample_start = ci->nr_samples;
+    rec.reserved = 0;
+    ci->telemetry_pending = true;
+    ci->nr_telemetry++;
+
+    return ( fwrite( &rec, sizeof(rec), 1, ci->p_telem ) == 1 ) ? 0 : -EIO;
+}
+
+/*****************************************************************************/
+/** Forget every block indexed so far, for a capture that starts over.
+
+    @param[in] ci           index
+
+    @return void
+*/
+static inline void capture_index_reset( struct capture_index *ci )
+{
+    if ( ci->p_idx == NULL )
+    {
+        return;
+    }
+
+    fflush( ci->p_idx );
+    if ( ftruncate( fileno( ci->p_idx ), sizeof(struct capture_index_header) ) == 0 )
+    {
+        fseek( ci->p_idx, sizeof(struct capture_index_header), SEEK_SET );
+    }
+    if ( ci->p_telem != NULL )
+    {
+        fflush( ci->p_telem );
+        if ( ftruncate( fileno( ci->p_telem ), sizeof(struct capture_telemetry_header) ) == 0 )
+        {
+            fseek( ci->p_telem, sizeof(struct capture_telemetry_header), SEEK_SET );
+        }
+    }
+    ci->telemetry_pending = false;
+    ci->nr_telemetry = 0;
+    ci->nr_records = 0;
+    ci->nr_samples = 0;
+    ci->first_block = true;
+    ci->nr_annotations = 0;
+    ci->overload_open = false;
+    ci->nr_gaps = 0;
+    ci->nr_overloaded_blocks = 0;
+}
+
+/* write a JSON string, escaping what needs to be */
+static inline void _capture_index_json_string( FILE *fp,
+                                               const char *p_str )
+{
+    fputc( '"', fp );
+    for ( ; *p_str != '\0'; p_str++ )
+    {
+        if ( ( *p_str == '"' ) || ( *p_str == '\\' ) )
+        {
+            fputc( '\\', fp );
+            fputc( *p_str, fp );
+        }
+        else if ( (unsigned char)*p_str < 0x20 )
+        {
+            fprintf( fp, "\\u%04x", (unsigned char)*p_str );
+        }
+        else
+        {
+            fputc( *p_str, fp );
+        }
+    }
+    fputc( '"', fp );
+}
+
+static inline int32_t _capture_index_write_meta( const struct capture_index *ci )
+{
+    char path[CAPTURE_INDEX_MAX_PATH + sizeof(CAPTURE_INDEX_META_SUFFIX)];
+    char index_name[CAPTURE_INDEX_MAX_PATH + sizeof(CAPTURE_INDEX_TELEMETRY_SUFFIX)];
+    const char *p_name = strrchr( ci->data_path, '/' );
+    char datetime[32];
+    struct tm tm;
+    uint32_t i;
+    FILE *fp;
+
+    p_name = ( p_name != NULL ) ? p_name + 1 : ci->data_path;
+    gmtime_r( &(ci->start_time.tv_sec), &tm );
+    strftime( datetime, sizeof(datetime), "%Y-%m-%dT%H:%M:%S", &tm );
+
+    snprintf( path, sizeof(path), "%s%s", ci->data_path, CAPTURE_INDEX_META_SUFFIX );
+    fp = fopen( path, "w" );
+    if ( fp == NULL )
+    {
+        return -errno;
+    }
+
+    fprintf( fp, "{\n  \"global\": {\n" );
+    fprintf( fp, "    \"core:datatype\": \"ci16_le\",\n" );
+    fprintf( fp, "    \"core:sample_rate\": %.3f,\n", ci->meta.sample_rate );
+    fprintf( fp, "    \"core:version\": \"1.0.0\",\n" );
+    fprintf( fp, "    \"core:num_channels\": 1,\n" );
+    fprintf( fp, "    \"core:dataset\": " );
+    _capture_index_json_string( fp, p_name );
+    fprintf( fp, ",\n    \"core:recorder\": " );
+    _capture_index_json_string( fp, ( ci->meta.p_recorder != NULL ) ? ci->meta.p_recorder : "" );
+    if ( ci->meta.p_hw != NULL )
+    {
+        fprintf( fp, ",\n    \"core:hw\": " );
+        _capture_index_json_string( fp, ci->meta.p_hw );
+    }
+    fprintf( fp, ",\n    \"sidekiq:iq_order\": \"%s\",\n", ci->meta.iq_order ? "iq" : "qi" );
+    fprintf( fp, "    \"sidekiq:packed\": %s,\n", ci->meta.packed ? "true" : "false" );
+    fprintf( fp, "    \"sidekiq:include_meta\": %s,\n", ci->meta.include_meta ? "true" : "false" );
+    fprintf( fp, "    \"sidekiq:compressed\": %s,\n", ci->meta.compressed ? "true" : "false" );
+    fprintf( fp, "    \"sidekiq:index\": " );
+    snprintf( index_name, sizeof(index_name), "%s%s", p_name, CAPTURE_INDEX_SUFFIX );
+    _capture_index_json_string( fp, index_name );
+    fprintf( fp, ",\n" );
+    fprintf( fp, "    \"sidekiq:nr_blocks\": %" PRIu64 ",\n", ci->nr_records );
+    if ( ci->nr_telemetry > 0 )
+    {
+        fprintf( fp, "    \"sidekiq:telemetry\": " );
+        snprintf( index_name, sizeof(index_name), "%s%s", p_name, CAPTURE_INDEX_TELEMETRY_SUFFIX );
+        _capture_index_json_string( fp, index_name );
+        fprintf( fp, ",\n" );
+        fprintf( fp, "    \"sidekiq:nr_telemetry\": %" PRIu64 ",\n", ci->nr_telemetry );
+    }
+    fprintf( fp, "    \"sidekiq:nr_gaps\": %" PRIu64 ",\n", ci->nr_gaps );
+    fprintf( fp, "    \"sidekiq:nr_overloaded_blocks\": %" PRIu64 "\n  },\n",
+             ci->nr_overloaded_blocks );
+
+    fprintf( fp, "  \"captures\": [\n    {\n" );
+    fprintf( fp, "      \"core:sample_start\": 0,\n" );
+    fprintf( fp, "      \"core:frequency\": %" PRIu64 ",\n", ci->meta.frequency );
+    fprintf( fp, "      \"core:datetime\": \"%s.%06ldZ\"\n    }\n  ],\n", datetime,
+             ci->start_time.tv_nsec / 1000 );
+
+    fprintf( fp, "  \"annotations\": [" );
+    for ( i = 0; i < ci->nr_annotations; i++ )
+    {
+        const struct capture_annotation *a = &(ci->p_annotations[i]);
+
+        fprintf( fp, "%s\n    {\n      \"core:sample_start\": %" PRIu64 ",\n",
+                 ( i > 0 ) ? "," : "", a->sample_start );
+        if ( a->overload )
+        {
+            fprintf( fp, "      \"core:sample_count\": %" PRIu64 ",\n", a->sample_count );
+            fprintf( fp, "      \"core:comment\": \"RF overload\"\n    }" );
+        }
+        else
+        {
+            fprintf( fp, "      \"core:sample_count\": 0,\n" );
+            fprintf( fp, "      \"core:comment\": \"timestamp gap of %" PRIu64 " samples\",\n",
+                     a->gap_samples );
+            fprintf( fp, "      \"sidekiq:gap_samples\": %" PRIu64 "\n    }", a->gap_samples );
+        }
+    }
+    fprintf( fp, "%s]\n}\n", ( ci->nr_annotations > 0 ) ? "\n  " : "" );
+
+    if ( fclose( fp ) != 0 )
+    {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Finish the index of a capture and write its metadata.  Safe to call on an index that is not
+    open.
+
+    @param[in] ci           index
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t capture_index_close( struct capture_index *ci )
+{
+    struct capture_index_header hdr;
+    int32_t status = 0;
+
+    if ( ci->p_idx == NULL )
+    {
+        return 0;
+    }
+
+    /* the header is final now that the sample rate and the number of records are known */
+    _capture_index_header( ci, &hdr );
+    hdr.nr_records = ci->nr_records;
+    hdr.nr_samples = ci->nr_samples;
+    if ( ( fseek( ci->p_idx, 0, SEEK_SET ) != 0 ) ||
+         ( fwrite( &hdr, sizeof(hdr), 1, ci->p_idx ) != 1 ) )
+    {
+        status = -EIO;
+    }
+    if ( ( fclose( ci->p_idx ) != 0 ) && ( status == 0 ) )
+    {
+        status = -EIO;
+    }
+    ci->p_idx = NULL;
+    if ( ci->p_telem != NULL )
+    {
+        if ( ( fclose( ci->p_telem ) != 0 ) && ( status == 0 ) )
+        {
+            status = -EIO;
+        }
+        ci->p_telem = NULL;
+    }
+
+    if ( status == 0 )
+    {
+        status = _capture_index_write_meta( ci );
+    }
+    free( ci->p_annotations );
+    ci->p_annotations = NULL;
+
+    return status;
+}
+
+#if (!defined __MINGW32__)
+
+/*****************************************************************************/
+/** Release a mapped capture.  Safe to call on a map that failed to open.
+
+    @param[in] m            map
+
+    @return void
+*/
+static inline void capture_index_map_close( struct capture_index_map *m )
+{
+    if ( m->p_hdr != NULL )
+    {
+        munmap( (void *)m->p_hdr, m->idx_size );
+    }
+    if ( m->p_data != NULL )
+    {
+        munmap( (void *)m->p_data, m->data_size );
+    }
+    if ( m->idx_fd >= 0 )
+    {
+        close( m->idx_fd );
+    }
+    if ( m->data_fd >= 0 )
+    {
+        close( m->data_fd );
+    }
+    memset( m, 0, sizeof(*m) );
+    m->idx_fd = -1;
+    m->data_fd = -1;
+}
+
+/*****************************************************************************/
+/** Map a capture and its index read-only.  An index that was never closed (e.g. the recorder
+    was killed) is still usable up to its last complete record.
+
+    @param[out] m           map
+    @param[in]  p_data_path path of the capture
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t capture_index_map_open( struct capture_index_map *m,
+                                              const char *p_data_path )
+{
+    char path[CAPTURE_INDEX_MAX_PATH + sizeof(CAPTURE_INDEX_SUFFIX)];
+    struct stat st;
+    void *p;
+
+    memset( m, 0, sizeof(*m) );
+    m->idx_fd = -1;
+    m->data_fd = -1;
+
+    snprintf( path, sizeof(path), "%s%s", p_data_path, CAPTURE_INDEX_SUFFIX );
+    m->idx_fd = open( path, O_RDONLY );
+    if ( ( m->idx_fd < 0 ) || ( fstat( m->idx_fd, &st ) != 0 ) )
+    {
+        int32_t status = -errno;
+
+        capture_index_map_close( m );
+        return status;
+    }
+    if ( (size_t)st.st_size < sizeof(struct capture_index_header) )
+    {
+        capture_index_map_close( m );
+        return -EINVAL;
+    }
+    m->idx_size = st.st_size;
+    p = mmap( NULL, m->idx_size, PROT_READ, MAP_SHARED, m->idx_fd, 0 );
+    if ( p == MAP_FAILED )
+    {
+        int32_t status = -errno;
+
+        capture_index_map_close( m );
+        return status;
+    }
+    m->p_hdr = p;
+    if ( ( m->p_hdr->magic != CAPTURE_INDEX_MAGIC ) ||
+         ( m->p_hdr->record_size != sizeof(struct capture_index_record) ) )
+    {
+        capture_index_map_close( m );
+        return -EINVAL;
+    }
+    m->p_records = (const struct capture_index_record *)( m->p_hdr + 1 );
+    m->nr_records = ( m->idx_size - sizeof(struct capture_index_header) ) /
+        sizeof(struct capture_index_record);
+
+    m->data_fd = open( p_data_path, O_RDONLY );
+    if ( ( m->data_fd < 0 ) || ( fstat( m->data_fd, &st ) != 0 ) )
+    {
+        int32_t status = -errno;
+
+        capture_index_map_close( m );
+        return status;
+    }
+    m->data_size = st.st_size;
+    if ( m->data_size > 0 )
+    {
+        p = mmap( NULL, m->data_size, PROT_READ, MAP_SHARED, m->data_fd, 0 );
+        if ( p == MAP_FAILED )
+        {
+            int32_t status = -errno;
+
+            capture_index_map_close( m );
+            return status;
+        }
+        m->p_data = p;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Find the block holding an RF timestamp, or the last block before it.
+
+    @param[in] m            map
+    @param[in] rf_timestamp RF timestamp to look for
+
+    @return index of the record, 0 if the timestamp precedes the capture
+*/
+static inline uint64_t capture_index_find_rf( const struct capture_index_map *m,
+                                              uint64_t rf_timestamp )
+{
+    uint64_t lo = 0, hi = m->nr_records;
+
+    /* the first record whose timestamp is past rf_timestamp */
+    while ( lo < hi )
+    {
+        uint64_t mid = lo + ( ( hi - lo ) / 2 );
+
+        if ( m->p_records[mid].rf_timestamp <= rf_timestamp )
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return ( lo > 0 ) ? lo - 1 : 0;
+}
+
+/*****************************************************************************/
+/** Find the block received at a system timestamp, or the last block before it.
+
+    @param[in] m            map
+    @param[in] sys_timestamp system timestamp to look for
+
+    @return index of the record, 0 if the timestamp precedes the capture
+*/
+static inline uint64_t capture_index_find_sys( const struct capture_index_map *m,
+                                               uint64_t sys_timestamp )
+{
+    uint64_t lo = 0, hi = m->nr_records;
+
+    while ( lo < hi )
+    {
+        uint64_t mid = lo + ( ( hi - lo ) / 2 );
+
+        if ( m->p_records[mid].sys_timestamp <= sys_timestamp )
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return ( lo > 0 ) ? lo - 1 : 0;
+}
+
+#endif  /* __MINGW32__ */
+
+#endif  /* __CAPTURE_INDEX_H__ */
@@ -0,0 +1,383 @@
+/**
+ * @file   capture_reader.h
+ *
+ * @brief  Random access to the samples of a receive capture, unpacking packed captures on
+ *         demand.
+ *
+ * Packed captures are kept on disk exactly as received, 12-bit samples packed 4 to 3 words
+ * (see iq_unpack.h), so recording costs only the packed data rate.  The reader maps the capture
+ * and its index (capture_index.h) and returns any run of samples as 16-bit I/Q, unpacking just
+ * the blocks that are read with the iq_unpack kernel.  Block headers of --meta captures are
+ * skipped the same way, so the samples appear contiguous whatever the layout on disk.
+ *
+ * A capture without an index is read as plain 16-bit I/Q samples; its layout and timestamps
+ * are unknown, so packed or --meta captures need their index.
+ *
+ * Samples are returned in the order in which they were captured, I first if r->iq_order is set
+ * and Q first otherwise.
+ *
+ * Compressed captures (iq_compress.h) are recognized by their header and read through a window
+ * of decompressed chunks; when a read leaves the window the following chunks are decompressed
+ * in parallel on a pool of one worker per CPU, so sequential reads rarely wait on the codec.
+ */
+
+#ifndef __CAPTURE_READER_H__
+#define __CAPTURE_READER_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sidekiq_api.h>
+
+#include "capture_index.h"
+#include "iq_compress.h"
+#include "iq_unpack.h"
+#include "work_pool.h"
+
+#if (!defined __MINGW32__)
+
+/***** TYPEDEFS *****/
+
+struct capture_reader
+{
+    struct capture_index_map map;
+    bool indexed;
+    bool packed;
+    bool include_meta;
+    bool iq_order;                      /* true for I before Q */
+    uint64_t nr_samples;
+    uint64_t record;                    /* record of the last read, sequential reads skip the search */
+
+    bool compressed;
+    struct iq_compress_reader z;
+    struct work_pool pool;              /* only started for compressed captures */
+    uint64_t data_size;                 /* uncompressed size of the capture */
+};
+
+/***** INLINE FUNCTIONS  *****/
+
+/*****************************************************************************/
+/** Release a capture opened with capture_reader_open().
+
+    @param[in] r            reader
+
+    @return void
+*/
+static inline void capture_reader_close( struct capture_reader *r )
+{
+    iq_compress_reader_close( &(r->z) );
+    work_pool_destroy( &(r->pool) );
+    capture_index_map_close( &(r->map) );
+    memset( r, 0, sizeof(*r) );
+    r->map.idx_fd = -1;
+    r->map.data_fd = -1;
+}
+
+/* set up decompression if the mapped capture is compressed */
+static inline int32_t _capture_reader_map_data( struct capture_reader *r )
+{
+    int32_t status;
+
+    r->data_size = r->map.data_size;
+    if ( !iq_compress_detect( r->map.p_data, r->map.data_size ) )
+    {
+        return 0;
+    }
+
+    status = work_pool_init( &(r->pool), 0 );
+    if ( status == 0 )
+    {
+        status = iq_compress_reader_open( &(r->z), r->map.p_data, r->map.data_size,
+                                          &(r->pool), r->pool.nr_workers );
+    }
+    if ( status == 0 )
+    {
+        r->compressed = true;
+        r->data_size = r->z.p_hdr->data_size;
+    }
+
+    return status;
+}
+
+/* nr_bytes of the uncompressed capture at offset, NULL if they are past its end */
+static inline const uint8_t *_capture_reader_data( struct capture_reader *r,
+                                                   uint64_t offset,
+                                                   uint64_t nr_bytes )
+{
+    if ( ( offset > r->data_size ) || ( nr_bytes > r->data_size - offset ) )
+    {
+        return NULL;
+    }
+    else if ( r->compressed )
+    {
+        return iq_compress_reader_get( &(r->z), offset, nr_bytes );
+    }
+
+    return r->map.p_data + offset;
+}
+
+/*****************************************************************************/
+/** Open a capture for reading, with its index if there is one.
+
+    @param[out] r           reader
+    @param[in]  p_path      path of the capture
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t capture_reader_open( struct capture_reader *r,
+                                           const char *p_path )
+{
+    struct stat st;
+    int32_t status;
+
+    memset( r, 0, sizeof(*r) );
+    status = capture_index_map_open( &(r->map), p_path );
+    if ( status == 0 )
+    {
+        const struct capture_index_record *p_last;
+
+        r->indexed = true;
+        r->packed = ( r->map.p_hdr->flags & CAPTURE_INDEX_PACKED ) != 0;
+        r->include_meta = ( r->map.p_hdr->flags & CAPTURE_INDEX_INCLUDE_META ) != 0;
+        r->iq_order = ( r->map.p_hdr->flags & CAPTURE_INDEX_IQ_ORDER ) != 0;
+        status = _capture_reader_map_data( r );
+        if ( status != 0 )
+        {
+            capture_reader_close( r );
+            return status;
+        }
+        if ( r->map.nr_records > 0 )
+        {
+            p_last = &(r->map.p_records[r->map.nr_records - 1]);
+            r->nr_samples = p_last->sample_start + p_last->nr_samples;
+        }
+        return 0;
+    }
+    else if ( status != -ENOENT )
+    {
+        return status;
+    }
+
+    /* no index, map the capture as plain samples */
+    r->map.idx_fd = -1;
+    r->map.data_fd = open( p_path, O_RDONLY );
+    if ( ( r->map.data_fd < 0 ) || ( fstat( r->map.data_fd, &st ) != 0 ) )
+    {
+        status = -errno;
+        capture_reader_close( r );
+        return status;
+    }
+    r->map.data_size = st.st_size;
+    if ( r->map.data_size > 0 )
+    {
+        void *p = mmap( NULL, r->map.data_size, PROT_READ, MAP_SHARED, r->map.data_fd, 0 );
+
+        if ( p == MAP_FAILED )
+        {
+            status = -errno;
+            capture_reader_close( r );
+            return status;
+        }
+        r->map.p_data = p;
+    }
+    status = _capture_reader_map_data( r );
+    if ( status != 0 )
+    {
+        capture_reader_close( r );
+        return status;
+    }
+    r->nr_samples = r->data_size / sizeof(uint32_t);
+
+    return 0;
+}
+
+/* find the record holding sample pos, starting from the record of the previous read */
+static inline uint64_t _capture_reader_record( struct capture_reader *r,
+                                               uint64_t pos )
+{
+    const struct capture_index_record *p_rec = r->map.p_records;
+    uint64_t lo = 0, hi = r->map.nr_records;
+
+    if ( ( r->record < r->map.nr_records ) && ( p_rec[r->record].sample_start <= pos ) )
+    {
+        if ( pos < p_rec[r->record].sample_start + p_rec[r->record].nr_samples )
+        {
+            return r->record;
+        }
+        if ( ( r->record + 1 < r->map.nr_records ) &&
+             ( pos < p_rec[r->record + 1].sample_start + p_rec[r->record + 1].nr_samples ) )
+        {
+            return r->record + 1;
+        }
+    }
+
+    /* the last record starting at or before pos */
+    while ( lo < hi )
+    {
+        uint64_t mid = lo + ( ( hi - lo ) / 2 );
+
+        if ( p_rec[mid].sample_start <= pos )
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return ( lo > 0 ) ? lo - 1 : 0;
+}
+
+/*****************************************************************************/
+/** Read a run of samples, unpacking them if the capture is packed.
+
+    @param[in]  r           reader
+    @param[in]  pos         index of the first sample to read
+    @param[out] p_samples   2 * nr_samples int16 values
+    @param[in]  nr_samples  number of I/Q samples to read
+
+    @return number of samples read, less than nr_samples at the end of the capture, or -EINVAL
+    if a record points past the end of the capture or a compressed chunk is corrupt
+*/
+static inline int64_t capture_reader_read( struct capture_reader *r,
+                                           uint64_t pos,
+                                           int16_t *p_samples,
+                                           uint64_t nr_samples )
+{
+    const uint32_t header_bytes = r->include_meta ? SKIQ_RX_HEADER_SIZE_IN_BYTES : 0;
+    uint64_t nr_read = 0;
+
+    if ( pos >= r->nr_samples )
+    {
+        return 0;
+    }
+    if ( nr_samples > r->nr_samples - pos )
+    {
+        nr_samples = r->nr_samples - pos;
+    }
+
+    if ( !r->indexed )
+    {
+        const uint8_t *p_data = _capture_reader_data( r, pos * sizeof(uint32_t),
+                                                      nr_samples * sizeof(uint32_t) );
+
+        if ( p_data == NULL )
+        {
+            return -EINVAL;
+        }
+        memcpy( p_samples, p_data, nr_samples * sizeof(uint32_t) );
+        return (int64_t)nr_samples;
+    }
+
+    while ( nr_read < nr_samples )
+    {
+        const struct capture_index_record *p_rec;
+        const uint32_t *p_payload;
+        uint64_t in_block, nr, nr_words;
+
+        r->record = _capture_reader_record( r, pos );
+        p_rec = &(r->map.p_records[r->record]);
+        in_block = pos - p_rec->sample_start;
+        nr = p_rec->nr_samples - in_block;
+        if ( nr > nr_samples - nr_read )
+        {
+            nr = nr_samples - nr_read;
+        }
+
+        nr_words = r->packed ? SKIQ_NUM_WORDS_IN_PACKED_BLOCK( p_rec->nr_samples ) :
+            p_rec->nr_samples;
+        p_payload = (const uint32_t *)_capture_reader_data( r, p_rec->offset + header_bytes,
+                                                            nr_words * sizeof(uint32_t) );
+        if ( p_payload == NULL )
+        {
+            return -EINVAL;
+        }
+
+        if ( !r->packed )
+        {
+            memcpy( p_samples, p_payload + in_block, nr * sizeof(uint32_t) );
+        }
+        else
+        {
+            uint64_t group = in_block / IQ_UNPACK_SAMPLES_PER_GROUP;
+            uint32_t skip = in_block % IQ_UNPACK_SAMPLES_PER_GROUP;
+            uint64_t done = 0;
+
+            p_payload += group * IQ_UNPACK_WORDS_PER_GROUP;
+            if ( skip > 0 )
+            {
+                /* a read starting inside a group unpacks the whole group on the stack */
+                int16_t samples[2 * IQ_UNPACK_SAMPLES_PER_GROUP];
+                uint64_t left = p_rec->nr_samples - ( group * IQ_UNPACK_SAMPLES_PER_GROUP );
+                uint32_t valid = ( left < IQ_UNPACK_SAMPLES_PER_GROUP ) ? (uint32_t)left :
+                    IQ_UNPACK_SAMPLES_PER_GROUP;
+
+                iq_unpack( p_payload, samples, valid );
+                done = valid - skip;
+                if ( done > nr )
+                {
+                    done = nr;
+                }
+                memcpy( p_samples, &(samples[2 * skip]), done * 2 * sizeof(int16_t) );
+                p_payload += IQ_UNPACK_WORDS_PER_GROUP;
+            }
+            if ( done < nr )
+            {
+                iq_unpack( p_payload, p_samples + ( 2 * done ), (uint32_t)( nr - done ) );
+            }
+        }
+
+        p_samples += 2 * nr;
+        pos += nr;
+        nr_read += nr;
+    }
+
+    return (int64_t)nr_read;
+}
+
+/*****************************************************************************/
+/** Find the sample captured at an RF timestamp.  Timestamps that fall in a gap resolve to the
+    first sample after the gap.
+
+    @param[in]  r           reader
+    @param[in]  rf_timestamp RF timestamp
+    @param[out] p_pos       index of the sample
+
+    @return 0 on success, -ENOENT if the timestamp precedes the capture or the capture has no
+    index
+*/
+static inline int32_t capture_reader_seek_rf( struct capture_reader *r,
+                                              uint64_t rf_timestamp,
+                                              uint64_t *p_pos )
+{
+    const struct capture_index_record *p_rec;
+    uint64_t i;
+
+    if ( !r->indexed || ( r->map.nr_records == 0 ) ||
+         ( rf_timestamp < r->map.p_records[0].rf_timestamp ) )
+    {
+        return -ENOENT;
+    }
+
+    i = capture_index_find_rf( &(r->map), rf_timestamp );
+    p_rec = &(r->map.p_records[i]);
+    if ( rf_timestamp - p_rec->rf_timestamp < p_rec->nr_samples )
+    {
+        *p_pos = p_rec->sample_start + ( rf_timestamp - p_rec->rf_timestamp );
+    }
+    else
+    {
+        *p_pos = p_rec->sample_start + p_rec->nr_samples;
+    }
+
+    return 0;
+}
+
+#endif  /* __MINGW32__ */
+
+#endif  /* __CAPTURE_READER_H__ */
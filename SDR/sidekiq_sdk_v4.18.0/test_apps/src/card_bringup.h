@@ -0,0 +1,354 @@
+/**
+ * @file   card_bringup.h
+ *
+ * @brief  Concurrent bring-up of several Sidekiq cards, and a warm start path that skips the
+ *         work a card does not need when it is enabled again with the same receive
+ *         configuration.
+ *
+ * skiq_init() and skiq_enable_cards() bring the listed cards up one after another, so with
+ * full initialization the start up time grows with the number of cards.  Here libsidekiq is
+ * initialized without cards (skiq_init_without_cards()) and every card is enabled from its own
+ * thread with skiq_enable_cards(), so the FPGA and RFIC bring-up of the cards overlap.
+ *
+ * The probe results are kept for the lifetime of the struct card_bringup: the card list from
+ * skiq_get_cards(), and the serial number and skiq_read_parameters() of every card the first
+ * time it is enabled.  The state of each card is tracked too, the level it was enabled at and
+ * the receive configuration last written, so that:
+ *
+ * - enabling a card that is still enabled at the requested level does nothing;
+ * - card_bringup_park() stops using a card without disabling it, so enabling it again is free
+ *   (the card remains locked by this process while parked);
+ * - card_bringup_configure_rx() only writes the receive settings that differ from the ones
+ *   already applied, and none when the configuration is unchanged.
+ *
+ * card_bringup_disable() really disables cards; they then go through skiq_enable_cards() again
+ * when next enabled, but keep their cached probe results.
+ */
+
+#ifndef __CARD_BRINGUP_H__
+#define __CARD_BRINGUP_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sidekiq_api.h>
+
+#include "elapsed.h"
+
+/***** TYPEDEFS *****/
+
+/* receive settings tracked by the warm start path */
+struct card_rx_config
+{
+    skiq_rx_hdl_t hdl;
+    skiq_data_src_t data_src;
+    uint32_t sample_rate;
+    uint32_t bandwidth;
+    uint64_t lo_freq;
+};
+
+struct card_state
+{
+    uint8_t card;
+    bool probed;                        /* params and serial are valid */
+    char serial[SKIQ_SERIAL_NUM_STRLEN];
+    skiq_param_t params;
+
+    bool enabled;                       /* enabled in libsidekiq, parked or in use */
+    bool parked;                        /* enabled but not in use */
+    skiq_xport_init_level_t level;
+    bool configured;                    /* config has been written to the card */
+    struct card_rx_config config;
+
+    /* result of the last bring-up */
+    int32_t status;
+    uint64_t enable_ns;                 /* time spent in skiq_enable_cards(), 0 when skipped */
+    pthread_t thread;
+    uint32_t nr_warm_enables;           /* enables that found the card already up */
+};
+
+struct card_bringup
+{
+    bool initialized;                   /* skiq_init_without_cards() succeeded */
+    bool listed;
+    uint8_t cards[SKIQ_MAX_NUM_CARDS];  /* from skiq_get_cards() */
+    uint8_t nr_cards;
+    struct card_state state[SKIQ_MAX_NUM_CARDS];    /* indexed by card number */
+};
+
+/***** INLINE FUNCTIONS  *****/
+
+/*****************************************************************************/
+/** Initialize libsidekiq without any cards and list the cards available.  The list is only
+    read once.
+
+    @param[out] b           bring-up state
+    @param[in]  xport       transport to list cards on
+
+    @return 0 on success, else the status of skiq_init_without_cards() or skiq_get_cards()
+*/
+static inline int32_t card_bringup_init( struct card_bringup *b,
+                                         skiq_xport_type_t xport )
+{
+    uint8_t i;
+    int32_t status;
+
+    memset( b, 0, sizeof(*b) );
+    for ( i = 0; i < SKIQ_MAX_NUM_CARDS; i++ )
+    {
+        b->state[i].card = i;
+    }
+
+    status = skiq_get_cards( xport, &(b->nr_cards), b->cards );
+    if ( status != 0 )
+    {
+        return status;
+    }
+    b->listed = true;
+
+    status = skiq_init_without_cards();
+    if ( status == 0 )
+    {
+        b->initialized = true;
+    }
+
+    return status;
+}
+
+/* enable one card, from its own thread when bringing up in parallel */
+static inline void *_card_bringup_enable_one( void *p_arg )
+{
+    struct card_state *s = (struct card_state *)p_arg;
+    const uint64_t start = elapsed_now_ns();
+
+    s->status = skiq_enable_cards( &(s->card), 1, s->level );
+    s->enable_ns = elapsed_now_ns() - start;
+    if ( s->status == 0 )
+    {
+        s->enabled = true;
+        s->parked = false;
+        s->configured = false;
+        if ( !s->probed )
+        {
+            char *p_serial = NULL;
+
+            if ( ( skiq_read_parameters( s->card, &(s->params) ) == 0 ) &&
+                 ( skiq_read_serial_string( s->card, &p_serial ) == 0 ) )
+            {
+                strncpy( s->serial, p_serial, sizeof(s->serial) - 1 );
+                s->probed = true;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*****************************************************************************/
+/** Enable cards, concurrently or one after another.  Cards that are already enabled (in use or
+    parked) at the requested level are only taken out of the parked state.
+
+    @param[in] b            bring-up state
+    @param[in] p_cards      cards to enable
+    @param[in] nr_cards     number of entries in p_cards
+    @param[in] level        initialization level
+    @param[in] parallel     enable each card from its own thread
+
+    @return 0 if every card is enabled, else the status of the first card that failed (see
+    card_state.status for each card)
+*/
+static inline int32_t card_bringup_enable( struct card_bringup *b,
+                                           const uint8_t *p_cards,
+                                           uint8_t nr_cards,
+                                           skiq_xport_init_level_t level,
+                                           bool parallel )
+{
+    bool started[SKIQ_MAX_NUM_CARDS] = { false };
+    int32_t status = 0;
+    uint8_t i;
+
+    if ( !b->initialized )
+    {
+        return -EPERM;
+    }
+    if ( nr_cards > SKIQ_MAX_NUM_CARDS )
+    {
+        return -E2BIG;
+    }
+
+    for ( i = 0; i < nr_cards; i++ )
+    {
+        struct card_state *s;
+
+        if ( p_cards[i] >= SKIQ_MAX_NUM_CARDS )
+        {
+            return -EINVAL;
+        }
+        s = &(b->state[p_cards[i]]);
+        s->status = 0;
+        s->enable_ns = 0;
+        if ( s->enabled && ( s->level >= level ) )
+        {
+            /* warm start, the card never went down */
+            s->parked = false;
+            s->nr_warm_enables++;
+            continue;
+        }
+        if ( s->enabled )
+        {
+            /* a higher level than the card was enabled at needs a fresh start */
+            (void)skiq_disable_cards( &(s->card), 1 );
+            s->enabled = false;
+        }
+
+        s->level = level;
+        if ( parallel && ( pthread_create( &(s->thread), NULL, _card_bringup_enable_one,
+                                           s ) == 0 ) )
+        {
+            started[i] = true;
+        }
+        else
+        {
+            (void)_card_bringup_enable_one( s );
+        }
+    }
+
+    for ( i = 0; i < nr_cards; i++ )
+    {
+        struct card_state *s = &(b->state[p_cards[i]]);
+
+        if ( started[i] )
+        {
+            pthread_join( s->thread, NULL );
+        }
+        if ( ( s->status != 0 ) && ( status == 0 ) )
+        {
+            status = s->status;
+        }
+    }
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Stop using cards without disabling them, so that enabling them again is free.
+
+    @param[in] b            bring-up state
+    @param[in] p_cards      cards to park
+    @param[in] nr_cards     number of entries in p_cards
+
+    @return void
+*/
+static inline void card_bringup_park( struct card_bringup *b,
+                                      const uint8_t *p_cards,
+                                      uint8_t nr_cards )
+{
+    uint8_t i;
+
+    for ( i = 0; i < nr_cards; i++ )
+    {
+        if ( ( p_cards[i] < SKIQ_MAX_NUM_CARDS ) && b->state[p_cards[i]].enabled )
+        {
+            b->state[p_cards[i]].parked = true;
+        }
+    }
+}
+
+/*****************************************************************************/
+/** Disable cards.  Their probe results are kept, their configuration is forgotten.
+
+    @param[in] b            bring-up state
+    @param[in] p_cards      cards to disable
+    @param[in] nr_cards     number of entries in p_cards
+
+    @return the status of skiq_disable_cards()
+*/
+static inline int32_t card_bringup_disable( struct card_bringup *b,
+                                            const uint8_t *p_cards,
+                                            uint8_t nr_cards )
+{
+    uint8_t i;
+    int32_t status;
+
+    status = skiq_disable_cards( p_cards, nr_cards );
+    for ( i = 0; ( status == 0 ) && ( i < nr_cards ); i++ )
+    {
+        struct card_state *s = &(b->state[p_cards[i]]);
+
+        s->enabled = false;
+        s->parked = false;
+        s->configured = false;
+    }
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Write the receive settings of an enabled card that differ from the ones last written.
+
+    @param[in]  b           bring-up state
+    @param[in]  card        card
+    @param[in]  p_config    settings to apply
+    @param[out] p_nr_writes optional, number of settings written (0 when unchanged)
+
+    @return 0 on success, -ENODEV if the card is not enabled, else the status of the failed
+    write
+*/
+static inline int32_t card_bringup_configure_rx( struct card_bringup *b,
+                                                 uint8_t card,
+                                                 const struct card_rx_config *p_config,
+                                                 uint32_t *p_nr_writes )
+{
+    struct card_state *s;
+    struct card_rx_config *c;
+    bool all;
+    uint32_t nr_writes = 0;
+    int32_t status = 0;
+
+    if ( ( card >= SKIQ_MAX_NUM_CARDS ) || !b->state[card].enabled )
+    {
+        return -ENODEV;
+    }
+    s = &(b->state[card]);
+    c = &(s->config);
+    all = !s->configured || ( c->hdl != p_config->hdl );
+
+    if ( all || ( c->data_src != p_config->data_src ) )
+    {
+        status = skiq_write_rx_data_src( card, p_config->hdl, p_config->data_src );
+        nr_writes++;
+    }
+    if ( ( status == 0 ) && ( all || ( c->sample_rate != p_config->sample_rate ) ||
+                              ( c->bandwidth != p_config->bandwidth ) ) )
+    {
+        status = skiq_write_rx_sample_rate_and_bandwidth( card, p_config->hdl,
+                                                          p_config->sample_rate,
+                                                          p_config->bandwidth );
+        nr_writes++;
+    }
+    if ( ( status == 0 ) && ( all || ( c->lo_freq != p_config->lo_freq ) ) )
+    {
+        status = skiq_write_rx_LO_freq( card, p_config->hdl, p_config->lo_freq );
+        nr_writes++;
+    }
+
+    /* a failed write leaves the card in an unknown state, write everything next time */
+    s->configured = ( status == 0 );
+    if ( status == 0 )
+    {
+        *c = *p_config;
+    }
+    if ( p_nr_writes != NULL )
+    {
+        *p_nr_writes = nr_writes;
+    }
+
+    return status;
+}
+
+#endif  /* __CARD_BRINGUP_H__ */
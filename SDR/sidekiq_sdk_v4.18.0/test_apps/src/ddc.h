@@ -0,0 +1,537 @@
+/**
+ * @file   ddc.h
+ *
+ * @brief  Digital down-converter that extracts narrowband channels from a received I/Q stream
+ *         and decimates each of them to a lower sample rate.
+ *
+ * A ddc holds up to DDC_MAX_CHANNELS channels, each with its own offset from the receive LO,
+ * decimation factor and bandwidth.  Samples are fed in as they are received, a block at a time,
+ * and converted to float once for all the channels.  Each channel then mixes the samples down by
+ * its offset with an NCO and low-pass filters and decimates them with a polyphase FIR: the filter
+ * is only evaluated for the samples that are kept, one output every decimation input samples, so
+ * a channel costs nr_taps / decimation multiply-adds per input sample plus the mix.  The dot
+ * products are computed with an AVX2/FMA or NEON kernel where available.
+ *
+ * The NCO phase is derived from the RF timestamp of each sample (a 32-bit phase accumulator,
+ * so the offset is exact to sample_rate / 2^32), which keeps the mix phase continuous across
+ * blocks and across gaps in the samples.  The filter history is cleared on a gap so that
+ * outputs never mix samples from either side of it.
+ *
+ * Outputs are complex float32, I before Q, scaled so that a full scale tone reads 1.0.  The
+ * filter is a linear phase windowed sinc, so each output lags the input sample whose RF
+ * timestamp it carries by (nr_taps - 1) / 2 input samples.  Samples are unpacked int16 I/Q in
+ * either order; unpack packed blocks first (iq_unpack.h).
+ */
+
+#ifndef __DDC_H__
+#define __DDC_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#if (defined __x86_64__ || defined __i386__) && (defined __GNUC__) && \
+    ( (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)) || (defined __clang__) )
+#   define DDC_HAVE_AVX2
+#   include <immintrin.h>
+#elif (defined __aarch64__) && (defined __ARM_NEON)
+#   define DDC_HAVE_NEON
+#   include <arm_neon.h>
+#endif
+
+/***** DEFINES *****/
+
+#define DDC_MAX_CHANNELS                (8)
+#define DDC_MAX_DECIMATION              (4096)
+
+/* input samples converted and filtered per pass */
+#define DDC_CHUNK                       (4096)
+
+/* filter length per unit of decimation, and the multiple the length is rounded up to */
+#define DDC_TAPS_PER_PHASE              (16)
+#define DDC_TAP_ALIGN                   (8)
+
+#define DDC_DEFAULT_DECIMATION          (32)
+
+/* passband of a channel as a fraction of its output rate when no bandwidth is given */
+#define DDC_DEFAULT_BANDWIDTH_FRACTION  (0.8)
+
+/* alignment of the sample buffers */
+#define DDC_ALIGN                       (64)
+
+/***** TYPEDEFS *****/
+
+/* dot product of nr_taps taps with the I and Q histories, nr_taps a multiple of DDC_TAP_ALIGN */
+typedef void (*ddc_dot_fn)( const float *p_i,
+                            const float *p_q,
+                            const float *p_taps,
+                            uint32_t nr_taps,
+                            float *p_out );
+
+struct ddc_channel
+{
+    double offset;                      /* Hertz relative to the LO */
+    uint32_t phase_step;                /* NCO phase per sample, 2^32 is one cycle */
+    uint32_t decimation;
+    double bandwidth;                   /* Hertz */
+
+    uint32_t nr_taps;
+    float *p_taps;                      /* symmetric low-pass, unity gain at DC */
+    float *p_hist_i;                    /* nr_taps - 1 samples of history, then a mixed chunk */
+    float *p_hist_q;
+    uint32_t skip;                      /* input samples until the next output */
+    float *p_out;                       /* interleaved I/Q outputs of a chunk */
+
+    /* statistics */
+    uint64_t nr_outputs;
+};
+
+struct ddc;
+
+/* called with the outputs of a channel for each chunk, return 0 to continue */
+typedef int32_t (*ddc_output_fn)( const struct ddc *d,
+                                  uint32_t channel,
+                                  const float *p_iq,
+                                  uint32_t nr_outputs,
+                                  uint64_t rf_timestamp,
+                                  void *p_arg );
+
+struct ddc
+{
+    struct ddc_channel channels[DDC_MAX_CHANNELS];
+    uint32_t nr_channels;
+    uint32_t sample_rate;
+    float scale;                        /* converts a sample to a fraction of full scale */
+    bool iq_swap;                       /* samples are I then Q rather than Q then I */
+
+    float *p_in_i;                      /* a chunk of input samples as float */
+    float *p_in_q;
+    uint64_t next_ts;                   /* RF timestamp of the next sample expected */
+    bool started;
+
+    ddc_output_fn fn;
+    void *p_arg;
+
+    /* statistics */
+    uint64_t nr_samples;
+    uint64_t nr_discontinuities;        /* filter histories cleared because of a timestamp gap */
+};
+
+/***** INLINE FUNCTIONS  *****/
+
+static inline void _ddc_dot_scalar( const float *p_i,
+                                    const float *p_q,
+                                    const float *p_taps,
+                                    uint32_t nr_taps,
+                                    float *p_out )
+{
+    float acc_i = 0.0f, acc_q = 0.0f;
+    uint32_t k;
+
+    for ( k = 0; k < nr_taps; k++ )
+    {
+        acc_i += p_taps[k] * p_i[k];
+        acc_q += p_taps[k] * p_q[k];
+    }
+    p_out[0] = acc_i;
+    p_out[1] = acc_q;
+}
+
+#if (defined DDC_HAVE_AVX2)
+/* horizontal sum of the 8 lanes of a vector */
+__attribute__((target("avx2,fma")))
+static inline float _ddc_hsum_avx2( __m256 v )
+{
+    __m128 s = _mm_add_ps( _mm256_castps256_ps128( v ), _mm256_extractf128_ps( v, 1 ) );
+
+    s = _mm_add_ps( s, _mm_movehl_ps( s, s ) );
+    s = _mm_add_ss( s, _mm_shuffle_ps( s, s, 1 ) );
+
+    return _mm_cvtss_f32( s );
+}
+
+__attribute__((target("avx2,fma")))
+static inline void _ddc_dot_avx2( const float *p_i,
+                                  const float *p_q,
+                                  const float *p_taps,
+                                  uint32_t nr_taps,
+                                  float *p_out )
+{
+    __m256 acc_i = _mm256_setzero_ps();
+    __m256 acc_q = _mm256_setzero_ps();
+    uint32_t k;
+
+    for ( k = 0; k < nr_taps; k += 8 )
+    {
+        const __m256 h = _mm256_loadu_ps( p_taps + k );
+
+        acc_i = _mm256_fmadd_ps( h, _mm256_loadu_ps( p_i + k ), acc_i );
+        acc_q = _mm256_fmadd_ps( h, _mm256_loadu_ps( p_q + k ), acc_q );
+    }
+    p_out[0] = _ddc_hsum_avx2( acc_i );
+    p_out[1] = _ddc_hsum_avx2( acc_q );
+}
+#endif  /* DDC_HAVE_AVX2 */
+
+#if (defined DDC_HAVE_NEON)
+static inline void _ddc_dot_neon( const float *p_i,
+                                  const float *p_q,
+                                  const float *p_taps,
+                                  uint32_t nr_taps,
+                                  float *p_out )
+{
+    float32x4_t acc_i = vdupq_n_f32( 0.0f );
+    float32x4_t acc_q = vdupq_n_f32( 0.0f );
+    uint32_t k;
+
+    for ( k = 0; k < nr_taps; k += 4 )
+    {
+        const float32x4_t h = vld1q_f32( p_taps + k );
+
+        acc_i = vfmaq_f32( acc_i, h, vld1q_f32( p_i + k ) );
+        acc_q = vfmaq_f32( acc_q, h, vld1q_f32( p_q + k ) );
+    }
+    p_out[0] = vaddvq_f32( acc_i );
+    p_out[1] = vaddvq_f32( acc_q );
+}
+#endif  /* DDC_HAVE_NEON */
+
+/*****************************************************************************/
+/** Select (on first call) and return the fastest filter kernel available on this host.
+
+    @param[out] pp_name     optional, set to a string naming the selected kernel
+
+    @return the selected kernel
+*/
+static inline ddc_dot_fn ddc_select( const char **pp_name )
+{
+    static ddc_dot_fn p_fn = NULL;
+    static const char *p_name = NULL;
+
+    if ( p_fn == NULL )
+    {
+        p_fn = _ddc_dot_scalar;
+        p_name = "scalar";
+#if (defined DDC_HAVE_AVX2)
+        __builtin_cpu_init();
+        if ( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") )
+        {
+            p_fn = _ddc_dot_avx2;
+            p_name = "avx2";
+        }
+#elif (defined DDC_HAVE_NEON)
+        p_fn = _ddc_dot_neon;
+        p_name = "neon";
+#endif
+    }
+
+    if ( pp_name != NULL )
+    {
+        *pp_name = p_name;
+    }
+
+    return p_fn;
+}
+
+/* allocate a zeroed aligned buffer of nr floats */
+static inline float *_ddc_alloc( size_t nr )
+{
+    void *p = NULL;
+
+    if ( posix_memalign( &p, DDC_ALIGN, nr * sizeof(float) ) != 0 )
+    {
+        return NULL;
+    }
+    memset( p, 0, nr * sizeof(float) );
+
+    return (float *)p;
+}
+
+/*****************************************************************************/
+/** Release a down-converter and all of its channels.  Safe to call on a down-converter that
+    failed to initialize.
+
+    @param[in] d            down-converter
+
+    @return void
+*/
+static inline void ddc_free( struct ddc *d )
+{
+    uint32_t c;
+
+    for ( c = 0; c < d->nr_channels; c++ )
+    {
+        struct ddc_channel *ch = &(d->channels[c]);
+
+        free( ch->p_taps );
+        free( ch->p_hist_i );
+        free( ch->p_hist_q );
+        free( ch->p_out );
+    }
+    free( d->p_in_i );
+    free( d->p_in_q );
+    memset( d, 0, sizeof(*d) );
+}
+
+/*****************************************************************************/
+/** Create a down-converter without any channels.
+
+    @param[out] d           down-converter to initialize
+    @param[in]  sample_rate input sample rate in Hertz
+    @param[in]  resolution  RX IQ resolution in bits, which sets full scale
+    @param[in]  iq_swap     samples are ordered I then Q
+    @param[in]  fn          output callback
+    @param[in]  p_arg       opaque argument passed to the callback
+
+    @return 0 on success, -EINVAL or -ENOMEM
+*/
+static inline int32_t ddc_init( struct ddc *d,
+                                uint32_t sample_rate,
+                                uint8_t resolution,
+                                bool iq_swap,
+                                ddc_output_fn fn,
+                                void *p_arg )
+{
+    memset( d, 0, sizeof(*d) );
+    if ( ( sample_rate == 0 ) || ( resolution == 0 ) || ( resolution > 16 ) )
+    {
+        return -EINVAL;
+    }
+
+    d->p_in_i = _ddc_alloc( DDC_CHUNK );
+    d->p_in_q = _ddc_alloc( DDC_CHUNK );
+    if ( ( d->p_in_i == NULL ) || ( d->p_in_q == NULL ) )
+    {
+        ddc_free( d );
+        return -ENOMEM;
+    }
+
+    d->sample_rate = sample_rate;
+    d->scale = 1.0f / (float)( 1u << ( resolution - 1 ) );
+    d->iq_swap = iq_swap;
+    d->fn = fn;
+    d->p_arg = p_arg;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Add a channel.
+
+    @param[in] d            down-converter
+    @param[in] offset       centre of the channel relative to the LO in Hertz, within
+                            +/- sample_rate / 2
+    @param[in] decimation   decimation factor, between 1 and DDC_MAX_DECIMATION
+    @param[in] bandwidth    two-sided passband in Hertz, at most the output rate, or 0 for
+                            DDC_DEFAULT_BANDWIDTH_FRACTION of the output rate
+
+    @return the index of the channel, -EINVAL for invalid parameters, -ENOSPC when the
+    down-converter has DDC_MAX_CHANNELS channels, -ENOMEM
+*/
+static inline int32_t ddc_add_channel( struct ddc *d,
+                                       double offset,
+                                       uint32_t decimation,
+                                       double bandwidth )
+{
+    const double out_rate = (double)d->sample_rate / ( decimation > 0 ? decimation : 1 );
+    struct ddc_channel *ch;
+    double fc, centre, sum = 0.0;
+    uint32_t k;
+
+    if ( d->nr_channels >= DDC_MAX_CHANNELS )
+    {
+        return -ENOSPC;
+    }
+    if ( ( decimation == 0 ) || ( decimation > DDC_MAX_DECIMATION ) ||
+         ( fabs( offset ) > d->sample_rate / 2.0 ) || ( bandwidth < 0.0 ) ||
+         ( bandwidth > out_rate ) )
+    {
+        return -EINVAL;
+    }
+    if ( bandwidth == 0.0 )
+    {
+        bandwidth = DDC_DEFAULT_BANDWIDTH_FRACTION * out_rate;
+    }
+
+    ch = &(d->channels[d->nr_channels]);
+    memset( ch, 0, sizeof(*ch) );
+    ch->offset = offset;
+    ch->decimation = decimation;
+    ch->bandwidth = bandwidth;
+    /* mixing down by the offset, negative offsets wrap */
+    ch->phase_step = (uint32_t)(int64_t)llround( offset / d->sample_rate * 4294967296.0 );
+    ch->nr_taps = ( ( DDC_TAPS_PER_PHASE * decimation ) + DDC_TAP_ALIGN - 1 ) &
+        ~( DDC_TAP_ALIGN - 1 );
+
+    ch->p_taps = _ddc_alloc( ch->nr_taps );
+    ch->p_hist_i = _ddc_alloc( ch->nr_taps - 1 + DDC_CHUNK );
+    ch->p_hist_q = _ddc_alloc( ch->nr_taps - 1 + DDC_CHUNK );
+    ch->p_out = _ddc_alloc( 2 * ( ( DDC_CHUNK / decimation ) + 1 ) );
+    if ( ( ch->p_taps == NULL ) || ( ch->p_hist_i == NULL ) || ( ch->p_hist_q == NULL ) ||
+         ( ch->p_out == NULL ) )
+    {
+        free( ch->p_taps );
+        free( ch->p_hist_i );
+        free( ch->p_hist_q );
+        free( ch->p_out );
+        memset( ch, 0, sizeof(*ch) );
+        return -ENOMEM;
+    }
+
+    /* Blackman windowed sinc with its cutoff at half the passband */
+    fc = bandwidth / 2.0 / d->sample_rate;
+    centre = ( ch->nr_taps - 1 ) / 2.0;
+    for ( k = 0; k < ch->nr_taps; k++ )
+    {
+        const double t = k - centre;
+        const double w = 0.42 - 0.5 * cos( 2.0 * M_PI * k / ( ch->nr_taps - 1 ) ) +
+            0.08 * cos( 4.0 * M_PI * k / ( ch->nr_taps - 1 ) );
+        const double h = ( t == 0.0 ) ? 2.0 * fc : sin( 2.0 * M_PI * fc * t ) / ( M_PI * t );
+
+        ch->p_taps[k] = (float)( h * w );
+        sum += h * w;
+    }
+    for ( k = 0; k < ch->nr_taps; k++ )
+    {
+        ch->p_taps[k] = (float)( ch->p_taps[k] / sum );
+    }
+
+    return (int32_t)d->nr_channels++;
+}
+
+/*****************************************************************************/
+/** Clear the filter history of every channel, e.g. after a retune.
+
+    @param[in] d            down-converter
+
+    @return void
+*/
+static inline void ddc_reset( struct ddc *d )
+{
+    uint32_t c;
+
+    for ( c = 0; c < d->nr_channels; c++ )
+    {
+        struct ddc_channel *ch = &(d->channels[c]);
+
+        memset( ch->p_hist_i, 0, ( ch->nr_taps - 1 ) * sizeof(float) );
+        memset( ch->p_hist_q, 0, ( ch->nr_taps - 1 ) * sizeof(float) );
+        ch->skip = 0;
+    }
+    d->started = false;
+}
+
+/* mix, filter and decimate one converted chunk of nr samples starting at rf_timestamp */
+static inline int32_t _ddc_chunk( struct ddc *d,
+                                  uint32_t nr,
+                                  uint64_t rf_timestamp )
+{
+    const ddc_dot_fn p_dot = ddc_select( NULL );
+    int32_t status = 0;
+    uint32_t c;
+
+    for ( c = 0; ( c < d->nr_channels ) && ( status == 0 ); c++ )
+    {
+        struct ddc_channel *ch = &(d->channels[c]);
+        const uint32_t hist = ch->nr_taps - 1;
+        float *p_mi = ch->p_hist_i + hist;
+        float *p_mq = ch->p_hist_q + hist;
+        /* the exact phase of the first sample, then rotate in double precision */
+        const uint32_t phase = (uint32_t)( rf_timestamp * (uint64_t)ch->phase_step );
+        const double angle = -2.0 * M_PI * ( phase / 4294967296.0 );
+        const double step = -2.0 * M_PI * ( ch->phase_step / 4294967296.0 );
+        const double step_re = cos( step ), step_im = sin( step );
+        double lo_re = cos( angle ), lo_im = sin( angle );
+        uint32_t i, pos, nr_out = 0;
+
+        for ( i = 0; i < nr; i++ )
+        {
+            const double x_re = d->p_in_i[i], x_im = d->p_in_q[i];
+            const double tmp = lo_re * step_re - lo_im * step_im;
+
+            p_mi[i] = (float)( x_re * lo_re - x_im * lo_im );
+            p_mq[i] = (float)( x_re * lo_im + x_im * lo_re );
+            lo_im = lo_re * step_im + lo_im * step_re;
+            lo_re = tmp;
+        }
+
+        /* the window of the output for sample pos starts at pos in the history */
+        for ( pos = ch->skip; pos < nr; pos += ch->decimation )
+        {
+            p_dot( ch->p_hist_i + pos, ch->p_hist_q + pos, ch->p_taps, ch->nr_taps,
+                   &(ch->p_out[2 * nr_out]) );
+            nr_out++;
+        }
+        if ( nr_out > 0 )
+        {
+            ch->nr_outputs += nr_out;
+            if ( d->fn != NULL )
+            {
+                status = d->fn( d, c, ch->p_out, nr_out, rf_timestamp + ch->skip, d->p_arg );
+            }
+        }
+        ch->skip = pos - nr;
+
+        memmove( ch->p_hist_i, ch->p_hist_i + nr, hist * sizeof(float) );
+        memmove( ch->p_hist_q, ch->p_hist_q + nr, hist * sizeof(float) );
+    }
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Add received samples to every channel.  The callback is invoked from here with the outputs
+    of each channel as they are produced.
+
+    @param[in] d            down-converter
+    @param[in] p_iq         16-bit samples, two per complex sample
+    @param[in] nr_samples   number of complex samples
+    @param[in] rf_timestamp RF timestamp of the first sample
+
+    @return 0 on success, else the status of the first failing callback
+*/
+static inline int32_t ddc_process( struct ddc *d,
+                                   const int16_t *p_iq,
+                                   uint32_t nr_samples,
+                                   uint64_t rf_timestamp )
+{
+    const uint32_t i_offset = d->iq_swap ? 0 : 1;
+    const float scale = d->scale;
+    int32_t status = 0;
+
+    if ( d->started && ( rf_timestamp != d->next_ts ) )
+    {
+        /* an output may not span a gap in the samples */
+        d->nr_discontinuities++;
+        ddc_reset( d );
+    }
+    d->started = true;
+    d->next_ts = rf_timestamp + nr_samples;
+    d->nr_samples += nr_samples;
+
+    while ( ( nr_samples > 0 ) && ( status == 0 ) )
+    {
+        const uint32_t nr = ( nr_samples > DDC_CHUNK ) ? DDC_CHUNK : nr_samples;
+        uint32_t i;
+
+        for ( i = 0; i < nr; i++ )
+        {
+            d->p_in_i[i] = (float)p_iq[2 * i + i_offset] * scale;
+            d->p_in_q[i] = (float)p_iq[2 * i + ( 1 - i_offset )] * scale;
+        }
+        status = _ddc_chunk( d, nr, rf_timestamp );
+
+        p_iq += 2 * nr;
+        nr_samples -= nr;
+        rf_timestamp += nr;
+    }
+
+    return status;
+}
+
+#endif  /* __DDC_H__ */
@@ -0,0 +1,692 @@
+/**
+ * @file   doppler.h
+ *
+ * @brief  Doppler compensation on the host: a phase continuous NCO that follows a predicted
+ *         frequency versus RF timestamp profile, with LO retunes only when the offset leaves the
+ *         usable bandwidth.
+ *
+ * Retuning the LO costs milliseconds and disturbs the stream (see the tune statistics of
+ * sweep_receive), far too often to follow the Doppler shift of a pass directly.  Instead the LO
+ * stays put and the samples are mixed by the difference between the predicted shift and the LO
+ * offset; the LO only moves (to the predicted shift) once that difference exceeds max_offset,
+ * which should leave the signal within the analog and filter bandwidth.
+ *
+ * The profile is a list of (RF timestamp, shift in Hertz) points from an orbit prediction,
+ * linearly interpolated and held constant beyond its ends.  The NCO phase of a sample is the
+ * integral of the profile up to its timestamp, less the LO offset times the time since the LO
+ * moved, so it is continuous across blocks and across gaps in the samples, and only jumps where
+ * the LO itself was retuned.
+ *
+ * The same mix compensates both directions, for a profile of the shift seen by the far end:
+ * received samples are mixed down by the residual shift with the receive LO at nominal + offset,
+ * and transmitted samples are pre-compensated by the same mix with the transmit LO at
+ * nominal - offset.
+ *
+ * The NCO switches to the new LO offset at the RF timestamp given to doppler_set_lo(), so the LO
+ * has to be at its new frequency from that sample on.  On receive the timestamp is read after
+ * the retune, so samples taken while the LO was settling are mixed for the old offset.  On
+ * transmit the samples are mixed ahead of time, so the retune has to land on the timestamp: a
+ * timestamped frequency hop does (doppler_set_lo_step() puts the LO offsets on the grid of a hop
+ * list), while an ordinary LO write started at the timestamp leaves the far end seeing the
+ * signal shifted by up to the whole LO step for the milliseconds the tune takes.
+ *
+ * Samples are unpacked int16 I/Q in either order and are mixed in place or into a copy.  The
+ * phase is recomputed exactly every DOPPLER_CHUNK samples and rotated in between with an AVX2
+ * kernel where available, holding the frequency of the middle of the chunk; chunks are shortened
+ * where the profile changes fast enough for that to cost more than DOPPLER_MAX_PHASE_ERROR.
+ */
+
+#ifndef __DOPPLER_H__
+#define __DOPPLER_H__
+
+/***** INCLUDES *****/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#if (defined __x86_64__ || defined __i386__) && (defined __GNUC__) && \
+    ( (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)) || (defined __clang__) )
+#   define DOPPLER_HAVE_AVX2
+#   include <immintrin.h>
+#endif
+
+/***** DEFINES *****/
+
+/* samples rotated between exact phase computations, and the least a steep chirp cuts it to */
+#define DOPPLER_CHUNK                       (1024)
+#define DOPPLER_MIN_CHUNK                   (64)
+
+/* phase error in cycles allowed from holding the frequency over a chunk */
+#define DOPPLER_MAX_PHASE_ERROR             (1e-3)
+
+/* samples per pass of the vector kernel */
+#define DOPPLER_KERNEL_SAMPLES              (8)
+
+/* residual offset allowed before retuning, as a fraction of the sample rate, by default */
+#define DOPPLER_DEFAULT_OFFSET_FRACTION     (0.25)
+
+/***** TYPEDEFS *****/
+
+struct doppler_point
+{
+    uint64_t rf_ts;
+    double hz;
+    double cycles;                      /* integral of the profile from the first point */
+};
+
+struct doppler_profile
+{
+    struct doppler_point *p_points;
+    uint32_t nr_points;
+    uint32_t nr_alloc;
+    uint32_t sample_rate;
+};
+
+#define DOPPLER_PROFILE_INITIALIZER                     \
+    (struct doppler_profile){                           \
+        .p_points = NULL,                               \
+        .nr_points = 0,                                 \
+        .nr_alloc = 0,                                  \
+        .sample_rate = 0,                               \
+    }
+
+/* rotate nr int16 I/Q samples by a phasor, advancing it by a step per sample; p_lo and p_step
+   are { re, im } */
+typedef void (*doppler_mix_fn)( const int16_t *p_src,
+                                int16_t *p_dst,
+                                uint32_t nr,
+                                const double *p_lo,
+                                const double *p_step );
+
+struct doppler
+{
+    struct doppler_profile profile;
+    double max_offset;                  /* Hertz of residual shift before the LO moves */
+    double lo_step;                     /* LO offsets are multiples of this, 0 for any */
+    bool iq_order;                      /* samples are I then Q rather than Q then I */
+
+    double lo_offset;                   /* LO offset from nominal for samples from lo_ts on */
+    uint64_t lo_ts;
+    double prev_lo_offset;              /* LO offset for samples before lo_ts */
+    uint64_t prev_lo_ts;
+    uint32_t cursor;                    /* profile segment of the last lookup */
+
+    /* statistics */
+    uint64_t nr_samples;
+    uint64_t nr_retunes;
+    double max_residual;                /* largest residual shift the NCO compensated */
+    double min_hz;                      /* range of the predicted shift seen */
+    double max_hz;
+};
+
+/***** INLINE FUNCTIONS  *****/
+
+/*****************************************************************************/
+/** Release the points of a profile.
+
+    @param[in] p            profile
+
+    @return void
+*/
+static inline void doppler_profile_free( struct doppler_profile *p )
+{
+    free( p->p_points );
+    *p = DOPPLER_PROFILE_INITIALIZER;
+}
+
+/*****************************************************************************/
+/** Append a point to a profile.
+
+    @param[in] p            profile, sample_rate set
+    @param[in] rf_ts        RF timestamp of the point, after that of the previous point
+    @param[in] hz           predicted shift in Hertz
+
+    @return 0 on success, -EINVAL if the timestamps don't increase, -ENOMEM
+*/
+static inline int32_t doppler_profile_add( struct doppler_profile *p,
+                                           uint64_t rf_ts,
+                                           double hz )
+{
+    struct doppler_point *p_pt;
+
+    if ( ( p->sample_rate == 0 ) ||
+         ( ( p->nr_points > 0 ) && ( rf_ts <= p->p_points[p->nr_points - 1].rf_ts ) ) )
+    {
+        return -EINVAL;
+    }
+    if ( p->nr_points == p->nr_alloc )
+    {
+        uint32_t nr_alloc = ( p->nr_alloc > 0 ) ? 2 * p->nr_alloc : 256;
+        struct doppler_point *p_new = realloc( p->p_points, nr_alloc * sizeof(*p_new) );
+
+        if ( p_new == NULL )
+        {
+            return -ENOMEM;
+        }
+        p->p_points = p_new;
+        p->nr_alloc = nr_alloc;
+    }
+
+    p_pt = &(p->p_points[p->nr_points]);
+    p_pt->rf_ts = rf_ts;
+    p_pt->hz = hz;
+    p_pt->cycles = 0.0;
+    if ( p->nr_points > 0 )
+    {
+        const struct doppler_point *p_prev = p_pt - 1;
+
+        /* trapezoid, exact for the linear interpolation */
+        p_pt->cycles = p_prev->cycles + ( ( p_prev->hz + hz ) / 2.0 ) *
+            ( (double)( rf_ts - p_prev->rf_ts ) / p->sample_rate );
+    }
+    p->nr_points++;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Load a profile from a text file of "SECONDS HZ" lines, with seconds counted from start_ts
+    and increasing.  Blank lines and lines starting with '#' are skipped.
+
+    @param[out] p               profile
+    @param[in]  p_path          path of the file
+    @param[in]  sample_rate     rate of the RF timestamp
+    @param[in]  start_ts        RF timestamp of second 0
+
+    @return 0 on success, -EINVAL for a malformed or empty file, else a negative errno
+*/
+static inline int32_t doppler_profile_load( struct doppler_profile *p,
+                                            const char *p_path,
+                                            uint32_t sample_rate,
+                                            uint64_t start_ts )
+{
+    char line[256];
+    FILE *p_fp;
+    int32_t status = 0;
+
+    *p = DOPPLER_PROFILE_INITIALIZER;
+    p->sample_rate = sample_rate;
+    p_fp = fopen( p_path, "r" );
+    if ( p_fp == NULL )
+    {
+        return -errno;
+    }
+
+    while ( ( status == 0 ) && ( fgets( line, sizeof(line), p_fp ) != NULL ) )
+    {
+        const char *p_c = line + strspn( line, " \t" );
+        double seconds, hz;
+
+        if ( ( *p_c == '#' ) || ( *p_c == '\n' ) || ( *p_c == '\r' ) || ( *p_c == '\0' ) )
+        {
+            continue;
+        }
+        if ( ( sscanf( p_c, "%lf %lf", &seconds, &hz ) != 2 ) || ( seconds < 0.0 ) )
+        {
+            status = -EINVAL;
+            break;
+        }
+        status = doppler_profile_add( p, start_ts + (uint64_t)llround( seconds * sample_rate ),
+                                      hz );
+    }
+    if ( ( status == 0 ) && ferror( p_fp ) )
+    {
+        status = -EIO;
+    }
+    if ( ( status == 0 ) && ( p->nr_points == 0 ) )
+    {
+        status = -EINVAL;
+    }
+    fclose( p_fp );
+
+    if ( status != 0 )
+    {
+        doppler_profile_free( p );
+    }
+
+    return status;
+}
+
+/* segment holding rf_ts, the last point at or before it, searching from the previous one */
+static inline uint32_t _doppler_segment( const struct doppler_profile *p,
+                                         uint32_t cursor,
+                                         uint64_t rf_ts )
+{
+    const struct doppler_point *p_pts = p->p_points;
+    uint32_t lo = 0, hi = p->nr_points;
+
+    if ( cursor >= p->nr_points )
+    {
+        cursor = 0;
+    }
+    if ( p_pts[cursor].rf_ts <= rf_ts )
+    {
+        if ( ( cursor + 1 == p->nr_points ) || ( rf_ts < p_pts[cursor + 1].rf_ts ) )
+        {
+            return cursor;
+        }
+        if ( ( cursor + 2 == p->nr_points ) || ( rf_ts < p_pts[cursor + 2].rf_ts ) )
+        {
+            return cursor + 1;
+        }
+    }
+
+    while ( lo < hi )
+    {
+        uint32_t mid = lo + ( ( hi - lo ) / 2 );
+
+        if ( p_pts[mid].rf_ts <= rf_ts )
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return ( lo > 0 ) ? lo - 1 : 0;
+}
+
+/* predicted shift at rf_ts and, if p_cycles is given, its integral */
+static inline double _doppler_eval( struct doppler *d,
+                                    uint64_t rf_ts,
+                                    double *p_cycles )
+{
+    const struct doppler_profile *p = &(d->profile);
+    const struct doppler_point *p_pt;
+    double dt, slope = 0.0;
+
+    d->cursor = _doppler_segment( p, d->cursor, rf_ts );
+    p_pt = &(p->p_points[d->cursor]);
+
+    /* signed, timestamps before the first point extend it backwards */
+    dt = ( rf_ts >= p_pt->rf_ts ) ? (double)( rf_ts - p_pt->rf_ts ) / p->sample_rate :
+        -(double)( p_pt->rf_ts - rf_ts ) / p->sample_rate;
+    if ( ( d->cursor + 1 < p->nr_points ) && ( rf_ts >= p_pt->rf_ts ) )
+    {
+        slope = ( p_pt[1].hz - p_pt->hz ) /
+            ( (double)( p_pt[1].rf_ts - p_pt->rf_ts ) / p->sample_rate );
+    }
+    if ( p_cycles != NULL )
+    {
+        *p_cycles = p_pt->cycles + ( p_pt->hz * dt ) + ( 0.5 * slope * dt * dt );
+    }
+
+    return p_pt->hz + ( slope * dt );
+}
+
+/*****************************************************************************/
+/** Predicted Doppler shift at an RF timestamp.
+
+    @param[in] d            tracker
+    @param[in] rf_ts        RF timestamp
+
+    @return the shift in Hertz
+*/
+static inline double doppler_hz( struct doppler *d,
+                                 uint64_t rf_ts )
+{
+    return _doppler_eval( d, rf_ts, NULL );
+}
+
+static inline int16_t _doppler_sat( float x )
+{
+    long v = lrintf( x );
+
+    return ( v > INT16_MAX ) ? INT16_MAX : ( v < INT16_MIN ) ? INT16_MIN : (int16_t)v;
+}
+
+static inline void _doppler_mix_scalar( const int16_t *p_src,
+                                        int16_t *p_dst,
+                                        uint32_t nr,
+                                        const double *p_lo,
+                                        const double *p_step )
+{
+    const float step_re = (float)p_step[0], step_im = (float)p_step[1];
+    float lo_re = (float)p_lo[0], lo_im = (float)p_lo[1];
+    uint32_t i;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        const float x_re = p_src[2 * i], x_im = p_src[( 2 * i ) + 1];
+        const float tmp = ( lo_re * step_re ) - ( lo_im * step_im );
+
+        p_dst[2 * i] = _doppler_sat( ( x_re * lo_re ) - ( x_im * lo_im ) );
+        p_dst[( 2 * i ) + 1] = _doppler_sat( ( x_re * lo_im ) + ( x_im * lo_re ) );
+        lo_im = ( lo_re * step_im ) + ( lo_im * step_re );
+        lo_re = tmp;
+    }
+}
+
+#if (defined DOPPLER_HAVE_AVX2)
+/* multiply interleaved complex x by interleaved complex y */
+__attribute__((target("avx2,fma")))
+static inline __m256 _doppler_cmul_avx2( __m256 x,
+                                         __m256 y )
+{
+    return _mm256_fmaddsub_ps( x, _mm256_moveldup_ps( y ),
+                               _mm256_mul_ps( _mm256_permute_ps( x, 0xB1 ),
+                                              _mm256_movehdup_ps( y ) ) );
+}
+
+__attribute__((target("avx2,fma")))
+static inline void _doppler_mix_avx2( const int16_t *p_src,
+                                      int16_t *p_dst,
+                                      uint32_t nr,
+                                      const double *p_lo,
+                                      const double *p_step )
+{
+    const uint32_t nr_vec = nr - ( nr % DOPPLER_KERNEL_SAMPLES );
+    float lanes[2 * DOPPLER_KERNEL_SAMPLES];
+    double re = p_lo[0], im = p_lo[1], step8_re = 1.0, step8_im = 0.0;
+    __m256 lo_a, lo_b, step8;
+    uint32_t i;
+
+    /* phasors of the 8 samples of a pass, and the rotation from one pass to the next */
+    for ( i = 0; i < DOPPLER_KERNEL_SAMPLES; i++ )
+    {
+        double tmp;
+
+        lanes[2 * i] = (float)re;
+        lanes[( 2 * i ) + 1] = (float)im;
+        tmp = ( re * p_step[0] ) - ( im * p_step[1] );
+        im = ( re * p_step[1] ) + ( im * p_step[0] );
+        re = tmp;
+
+        tmp = ( step8_re * p_step[0] ) - ( step8_im * p_step[1] );
+        step8_im = ( step8_re * p_step[1] ) + ( step8_im * p_step[0] );
+        step8_re = tmp;
+    }
+    lo_a = _mm256_loadu_ps( lanes );
+    lo_b = _mm256_loadu_ps( lanes + 8 );
+    step8 = _mm256_setr_ps( (float)step8_re, (float)step8_im, (float)step8_re, (float)step8_im,
+                            (float)step8_re, (float)step8_im, (float)step8_re, (float)step8_im );
+
+    for ( i = 0; i < nr_vec; i += DOPPLER_KERNEL_SAMPLES )
+    {
+        const __m128i raw_a = _mm_loadu_si128( (const __m128i *)( p_src + ( 2 * i ) ) );
+        const __m128i raw_b = _mm_loadu_si128( (const __m128i *)( p_src + ( 2 * i ) + 8 ) );
+        const __m256 x_a = _mm256_cvtepi32_ps( _mm256_cvtepi16_epi32( raw_a ) );
+        const __m256 x_b = _mm256_cvtepi32_ps( _mm256_cvtepi16_epi32( raw_b ) );
+        const __m256i y_a = _mm256_cvtps_epi32( _doppler_cmul_avx2( x_a, lo_a ) );
+        const __m256i y_b = _mm256_cvtps_epi32( _doppler_cmul_avx2( x_b, lo_b ) );
+
+        /* packs interleaves the 128-bit lanes of its operands, put them back in order */
+        _mm256_storeu_si256( (__m256i *)( p_dst + ( 2 * i ) ),
+                             _mm256_permute4x64_epi64( _mm256_packs_epi32( y_a, y_b ),
+                                                       _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+        lo_a = _doppler_cmul_avx2( lo_a, step8 );
+        lo_b = _doppler_cmul_avx2( lo_b, step8 );
+    }
+
+    if ( nr_vec < nr )
+    {
+        double lo[2];
+
+        _mm256_storeu_ps( lanes, lo_a );
+        lo[0] = lanes[0];
+        lo[1] = lanes[1];
+        _doppler_mix_scalar( p_src + ( 2 * nr_vec ), p_dst + ( 2 * nr_vec ), nr - nr_vec, lo,
+                             p_step );
+    }
+}
+#endif  /* DOPPLER_HAVE_AVX2 */
+
+/*****************************************************************************/
+/** Select (on first call) and return the fastest mixing kernel available on this host.
+
+    @param[out] pp_name     optional, set to a string naming the selected kernel
+
+    @return the selected kernel
+*/
+static inline doppler_mix_fn doppler_select( const char **pp_name )
+{
+    static doppler_mix_fn p_fn = NULL;
+    static const char *p_name = NULL;
+
+    if ( p_fn == NULL )
+    {
+        p_fn = _doppler_mix_scalar;
+        p_name = "scalar";
+#if (defined DOPPLER_HAVE_AVX2)
+        __builtin_cpu_init();
+        if ( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") )
+        {
+            p_fn = _doppler_mix_avx2;
+            p_name = "avx2";
+        }
+#endif
+    }
+
+    if ( pp_name != NULL )
+    {
+        *pp_name = p_name;
+    }
+
+    return p_fn;
+}
+
+/*****************************************************************************/
+/** Release a tracker and its profile.
+
+    @param[in] d            tracker
+
+    @return void
+*/
+static inline void doppler_free( struct doppler *d )
+{
+    doppler_profile_free( &(d->profile) );
+    memset( d, 0, sizeof(*d) );
+}
+
+/*****************************************************************************/
+/** Initialize a tracker with the LO at its nominal frequency.
+
+    @param[out] d           tracker
+    @param[in]  p_profile   loaded profile, owned by the tracker from now on
+    @param[in]  max_offset  residual shift in Hertz the NCO may compensate before the LO has to
+                            move, 0 for DOPPLER_DEFAULT_OFFSET_FRACTION of the sample rate
+    @param[in]  iq_order    samples are ordered I then Q
+
+    @return 0 on success, -EINVAL for an empty profile or an offset beyond the Nyquist rate
+*/
+static inline int32_t doppler_init( struct doppler *d,
+                                    struct doppler_profile *p_profile,
+                                    double max_offset,
+                                    bool iq_order )
+{
+    memset( d, 0, sizeof(*d) );
+    if ( ( p_profile->nr_points == 0 ) || ( max_offset < 0.0 ) ||
+         ( max_offset >= p_profile->sample_rate / 2.0 ) )
+    {
+        return -EINVAL;
+    }
+
+    d->profile = *p_profile;
+    *p_profile = DOPPLER_PROFILE_INITIALIZER;
+    d->max_offset = ( max_offset > 0.0 ) ? max_offset :
+        DOPPLER_DEFAULT_OFFSET_FRACTION * d->profile.sample_rate;
+    d->iq_order = iq_order;
+    d->min_hz = INFINITY;
+    d->max_hz = -INFINITY;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Restrict the LO offsets to multiples of a step, e.g. to tune from a frequency hop list, and
+    find the range of multiples that covers every shift of the profile (and the nominal LO).
+    The step should not exceed max_offset, so that a retune leaves at most half a step to the
+    NCO.
+
+    @param[in]  d           tracker
+    @param[in]  step        step in Hertz, greater than 0
+    @param[out] p_first     lowest LO offset, in steps
+    @param[out] p_last      highest LO offset, in steps
+
+    @return void
+*/
+static inline void doppler_set_lo_step( struct doppler *d,
+                                        double step,
+                                        int64_t *p_first,
+                                        int64_t *p_last )
+{
+    int64_t k;
+    uint32_t i;
+
+    d->lo_step = step;
+    *p_first = *p_last = 0;
+    for ( i = 0; i < d->profile.nr_points; i++ )
+    {
+        k = (int64_t)round( d->profile.p_points[i].hz / step );
+        *p_first = ( k < *p_first ) ? k : *p_first;
+        *p_last = ( k > *p_last ) ? k : *p_last;
+    }
+}
+
+/*****************************************************************************/
+/** Check whether the residual shift at an RF timestamp has left the usable bandwidth.
+
+    @param[in]  d               tracker
+    @param[in]  rf_ts           RF timestamp of the next samples
+    @param[out] p_lo_offset     if the LO has to move, the LO offset to tune to in whole Hertz
+                                (the nearest multiple of the LO step if one is set)
+
+    @return true if the LO should be retuned
+*/
+static inline bool doppler_retune_needed( struct doppler *d,
+                                          uint64_t rf_ts,
+                                          double *p_lo_offset )
+{
+    const double hz = doppler_hz( d, rf_ts );
+
+    if ( fabs( hz - d->lo_offset ) <= d->max_offset )
+    {
+        return false;
+    }
+    *p_lo_offset = ( d->lo_step > 0.0 ) ? ( round( hz / d->lo_step ) * d->lo_step ) :
+        round( hz );
+
+    return true;
+}
+
+/*****************************************************************************/
+/** Record an LO retune.  Samples from rf_ts on are mixed for the new offset, earlier ones still
+    for the previous offset.
+
+    @param[in] d            tracker
+    @param[in] lo_offset    new LO offset from nominal in Hertz
+    @param[in] rf_ts        first RF timestamp with the LO at the new frequency
+
+    @return void
+*/
+static inline void doppler_set_lo( struct doppler *d,
+                                   double lo_offset,
+                                   uint64_t rf_ts )
+{
+    d->prev_lo_offset = d->lo_offset;
+    d->prev_lo_ts = d->lo_ts;
+    d->lo_offset = lo_offset;
+    d->lo_ts = rf_ts;
+    d->nr_retunes++;
+}
+
+/*****************************************************************************/
+/** Mix a run of samples by the residual Doppler shift.
+
+    @param[in]  d           tracker
+    @param[in]  p_src       int16 I/Q samples
+    @param[out] p_dst       mixed samples, may be p_src
+    @param[in]  nr_samples  number of complex samples
+    @param[in]  rf_ts       RF timestamp of the first sample
+
+    @return void
+*/
+static inline void doppler_mix( struct doppler *d,
+                                const int16_t *p_src,
+                                int16_t *p_dst,
+                                uint32_t nr_samples,
+                                uint64_t rf_ts )
+{
+    const doppler_mix_fn p_mix = doppler_select( NULL );
+    /* mixing down, Q first samples are conjugated */
+    const double sign = d->iq_order ? -2.0 * M_PI : 2.0 * M_PI;
+    const bool prev = ( rf_ts < d->lo_ts );
+    const double lo_offset = prev ? d->prev_lo_offset : d->lo_offset;
+    const uint64_t lo_ts = prev ? d->prev_lo_ts : d->lo_ts;
+
+    d->nr_samples += nr_samples;
+    while ( nr_samples > 0 )
+    {
+        uint32_t nr = ( nr_samples > DOPPLER_CHUNK ) ? DOPPLER_CHUNK : nr_samples;
+        double cycles, hz, residual, phase, lo[2], step[2];
+
+        /* exact phase of the first sample, frequency from the middle of the chunk; holding it
+           is off by a quarter of the change over the chunk times half its length at the ends */
+        hz = _doppler_eval( d, rf_ts, &cycles );
+        while ( ( nr > DOPPLER_MIN_CHUNK ) &&
+                ( fabs( doppler_hz( d, rf_ts + nr ) - hz ) * nr / ( 8.0 * d->profile.sample_rate ) >
+                  DOPPLER_MAX_PHASE_ERROR ) )
+        {
+            nr /= 2;
+        }
+        hz = doppler_hz( d, rf_ts + ( nr / 2 ) );
+        residual = hz - lo_offset;
+        phase = cycles - ( lo_offset * ( (double)(int64_t)( rf_ts - lo_ts ) /
+                                         d->profile.sample_rate ) );
+        phase -= floor( phase );
+        lo[0] = cos( sign * phase );
+        lo[1] = sin( sign * phase );
+        step[0] = cos( sign * residual / d->profile.sample_rate );
+        step[1] = sin( sign * residual / d->profile.sample_rate );
+
+        p_mix( p_src, p_dst, nr, lo, step );
+
+        if ( fabs( residual ) > d->max_residual )
+        {
+            d->max_residual = fabs( residual );
+        }
+        d->min_hz = ( hz < d->min_hz ) ? hz : d->min_hz;
+        d->max_hz = ( hz > d->max_hz ) ? hz : d->max_hz;
+
+        p_src += 2 * nr;
+        p_dst += 2 * nr;
+        rf_ts += nr;
+        nr_samples -= nr;
+    }
+}
+
+/*****************************************************************************/
+/** Print the tracker statistics.
+
+    @param[in] d            tracker
+    @param[in] p_name       name of the direction, e.g. "Rx"
+    @param[in] p_fp         destination, e.g. stdout
+
+    @return void
+*/
+static inline void doppler_print_stats( const struct doppler *d,
+                                        const char *p_name,
+                                        FILE *p_fp )
+{
+    const char *p_kernel = NULL;
+
+    (void)doppler_select( &p_kernel );
+    fprintf( p_fp, "Info: %s Doppler: %" PRIu64 " samples mixed (%s), %" PRIu64 " LO retunes,"
+             " LO offset %.0f Hz, largest residual %.1f Hz", p_name, d->nr_samples, p_kernel,
+             d->nr_retunes, d->lo_offset, d->max_residual );
+    if ( d->nr_samples > 0 )
+    {
+        fprintf( p_fp, ", shift %.1f to %.1f Hz", d->min_hz, d->max_hz );
+    }
+    fprintf( p_fp, "\n" );
+}
+
+#endif  /* __DOPPLER_H__ */
@@ -3,7 +3,10 @@
  * @author  <jeremy@epiq-solutions.com>
  * @date   Mon Jun  5 16:09:36 2017
  *
- * @brief
+ * @brief Timing helpers.  A struct elapsed accumulates the total, minimum,
+ * maximum, mean and deviation of a timed section.  Attaching a struct
+ * elapsed_hist adds a log-bucketed latency histogram from which percentiles
+ * are reported and exported as CSV or JSON lines while the application runs.
  *
  * <pre>
  * Copyright 2017-2020 Epiq Solutions, All Rights Reserved
@@ -31,6 +34,8 @@
 #include <time.h>
 #include <stdio.h>
 #include <limits.h>
+#include <stdint.h>
+#include <string.h>
 #include <inttypes.h>
 
 /***** DEFINES *****/
@@ -43,9 +48,21 @@
         .min = { LONG_MAX, LONG_MAX },                                  \
         .num_samples = 0,                                               \
         .mean = 0.0,                                                    \
-        .std = 0.0                                                      \
+        .std = 0.0,                                                     \
+        .p_hist = NULL                                                  \
     }
 
+/* An elapsed_hist has ELAPSED_HIST_SUB_BUCKETS linear sub-buckets per power of
+   two, so each value is placed within 1/64 (1.6%) of itself.  Values from 0 to
+   ELAPSED_HIST_MAX_NS are tracked, larger ones are counted at the maximum. */
+#define ELAPSED_HIST_SUB_BITS           7
+#define ELAPSED_HIST_SUB_BUCKETS        (1 << ELAPSED_HIST_SUB_BITS)
+#define ELAPSED_HIST_MAX_BITS           40
+#define ELAPSED_HIST_MAX_NS             ((UINT64_C(1) << ELAPSED_HIST_MAX_BITS) - 1)
+#define ELAPSED_HIST_NR_BUCKETS                                         \
+    (((ELAPSED_HIST_MAX_BITS - ELAPSED_HIST_SUB_BITS + 1) * (ELAPSED_HIST_SUB_BUCKETS / 2)) + \
+     ELAPSED_HIST_SUB_BUCKETS)
+
 /***** TYPEDEFS *****/
 
 struct elapsed
@@ -54,6 +71,26 @@ struct elapsed
     struct timespec max, min;
     double mean, std;
     uint64_t num_samples;
+    struct elapsed_hist *p_hist;    /* optional, also records each sample */
+};
+
+/* Each thread records into its own elapsed_hist, the only writer of it.  The
+   counters are updated with relaxed atomic stores rather than read-modify-write
+   operations, so recording costs about as much as a plain increment while
+   another thread reads a consistent enough view to merge and report. */
+struct elapsed_hist
+{
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t counts[ELAPSED_HIST_NR_BUCKETS];
+};
+
+enum elapsed_export_format
+{
+    elapsed_export_csv = 0,
+    elapsed_export_json,
 };
 
 /***** INLINE FUNCTIONS  *****/
@@ -110,6 +147,8 @@ static int timespec_gt( struct timespec *a,
     }
 }
 
+static inline void elapsed_hist_record( struct elapsed_hist *h, uint64_t value_ns );
+
 static inline void elapsed_start(struct elapsed *e)
 {
     clock_gettime(CLOCK_MONOTONIC, &(e->start));
@@ -140,7 +179,205 @@ static inline void elapsed_end(struct elapsed *e)
 
         e->mean = e->mean + (value_ns - temp_mean) / e->num_samples;
         e->std = e->std + (value_ns - temp_mean) * ( value_ns - e->mean );
+
+        if ( e->p_hist != NULL )
+        {
+            elapsed_hist_record( e->p_hist, (uint64_t)value_ns );
+        }
+    }
+}
+
+/* current CLOCK_MONOTONIC time in nanoseconds, for timing without a struct elapsed */
+static inline uint64_t elapsed_now_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * (uint64_t)1e9 + (uint64_t)ts.tv_nsec;
+}
+
+static inline void elapsed_hist_init( struct elapsed_hist *h )
+{
+    memset( h, 0, sizeof(*h) );
+    h->min_ns = UINT64_MAX;
+}
+
+/* record the samples of e in h as well from now on */
+static inline void elapsed_hist_attach( struct elapsed *e, struct elapsed_hist *h )
+{
+    e->p_hist = h;
+}
+
+static inline uint32_t _elapsed_hist_index( uint64_t value_ns )
+{
+    uint32_t shift;
+
+    if ( value_ns > ELAPSED_HIST_MAX_NS )
+    {
+        value_ns = ELAPSED_HIST_MAX_NS;
     }
+    if ( value_ns < ELAPSED_HIST_SUB_BUCKETS )
+    {
+        return (uint32_t)value_ns;
+    }
+
+    /* keep the top ELAPSED_HIST_SUB_BITS bits of the value */
+    shift = (uint32_t)(63 - __builtin_clzll( value_ns )) - (ELAPSED_HIST_SUB_BITS - 1);
+
+    return shift * (ELAPSED_HIST_SUB_BUCKETS / 2) + (uint32_t)(value_ns >> shift);
+}
+
+/* middle of the values that fall into a bucket */
+static inline uint64_t _elapsed_hist_value( uint32_t index )
+{
+    uint32_t shift;
+
+    if ( index < ELAPSED_HIST_SUB_BUCKETS )
+    {
+        return index;
+    }
+    shift = index / (ELAPSED_HIST_SUB_BUCKETS / 2) - 1;
+
+    return ((uint64_t)(index - shift * (ELAPSED_HIST_SUB_BUCKETS / 2)) << shift) +
+        ((UINT64_C(1) << shift) >> 1);
+}
+
+static inline void _elapsed_hist_add( uint64_t *p, uint64_t value )
+{
+    __atomic_store_n( p, __atomic_load_n( p, __ATOMIC_RELAXED ) + value, __ATOMIC_RELAXED );
+}
+
+/* only the thread that owns h may record into it */
+static inline void elapsed_hist_record( struct elapsed_hist *h, uint64_t value_ns )
+{
+    _elapsed_hist_add( &(h->counts[_elapsed_hist_index( value_ns )]), 1 );
+    _elapsed_hist_add( &(h->sum_ns), value_ns );
+    if ( value_ns < __atomic_load_n( &(h->min_ns), __ATOMIC_RELAXED ) )
+    {
+        __atomic_store_n( &(h->min_ns), value_ns, __ATOMIC_RELAXED );
+    }
+    if ( value_ns > __atomic_load_n( &(h->max_ns), __ATOMIC_RELAXED ) )
+    {
+        __atomic_store_n( &(h->max_ns), value_ns, __ATOMIC_RELAXED );
+    }
+    /* published last, so a reader never sees more samples than bucket counts */
+    __atomic_store_n( &(h->count), h->count + 1, __ATOMIC_RELEASE );
+}
+
+/* add the samples of src to dst, src may be recorded into meanwhile */
+static inline void elapsed_hist_merge( struct elapsed_hist *dst, const struct elapsed_hist *src )
+{
+    uint64_t min_ns, max_ns;
+    uint32_t i;
+
+    /* count can trail the buckets by the sample being recorded, recount them */
+    (void)__atomic_load_n( &(src->count), __ATOMIC_ACQUIRE );
+    for ( i = 0; i < ELAPSED_HIST_NR_BUCKETS; i++ )
+    {
+        uint64_t n = __atomic_load_n( &(src->counts[i]), __ATOMIC_RELAXED );
+
+        dst->counts[i] += n;
+        dst->count += n;
+    }
+    dst->sum_ns += __atomic_load_n( &(src->sum_ns), __ATOMIC_RELAXED );
+
+    min_ns = __atomic_load_n( &(src->min_ns), __ATOMIC_RELAXED );
+    max_ns = __atomic_load_n( &(src->max_ns), __ATOMIC_RELAXED );
+    dst->min_ns = ( min_ns < dst->min_ns ) ? min_ns : dst->min_ns;
+    dst->max_ns = ( max_ns > dst->max_ns ) ? max_ns : dst->max_ns;
+}
+
+/* value below which a fraction q (0.0 - 1.0) of the samples in h fall, h
+   must not be recorded into (merge into a private copy first) */
+static inline uint64_t elapsed_hist_percentile( const struct elapsed_hist *h, double q )
+{
+    uint64_t target, seen = 0;
+    uint32_t i;
+
+    if ( h->count == 0 )
+    {
+        return 0;
+    }
+    target = (uint64_t)(q * (double)h->count + 0.5);
+    target = ( target < 1 ) ? 1 : target;
+
+    for ( i = 0; i < ELAPSED_HIST_NR_BUCKETS; i++ )
+    {
+        seen += h->counts[i];
+        if ( seen >= target )
+        {
+            uint64_t value_ns = _elapsed_hist_value( i );
+
+            /* the extremes are known exactly */
+            value_ns = ( value_ns < h->min_ns ) ? h->min_ns : value_ns;
+            return ( value_ns > h->max_ns ) ? h->max_ns : value_ns;
+        }
+    }
+
+    return h->max_ns;
+}
+
+static inline
+void elapsed_hist_print( const struct elapsed_hist *h )
+{
+    printf("p50 %.3f uS, p99 %.3f uS, p99.9 %.3f uS, max %.3f uS (%" PRIu64 " samples)\n",
+           elapsed_hist_percentile( h, 0.50 ) / 1000.0,
+           elapsed_hist_percentile( h, 0.99 ) / 1000.0,
+           elapsed_hist_percentile( h, 0.999 ) / 1000.0,
+           ( h->count > 0 ) ? h->max_ns / 1000.0 : 0.0, h->count);
+}
+
+/* column names of elapsed_hist_export() in CSV, nothing for JSON */
+static inline
+void elapsed_hist_export_header( FILE *fp, enum elapsed_export_format format )
+{
+    if ( format == elapsed_export_csv )
+    {
+        fprintf(fp, "time_ns,name,interval,count,min_ns,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,"
+                "max_ns\n");
+    }
+}
+
+/* write one line summarizing h, tagged with name and interval (e.g. a pass) */
+static inline
+void elapsed_hist_export( FILE *fp, enum elapsed_export_format format, const char *name,
+                          uint64_t interval, const struct elapsed_hist *h )
+{
+    uint64_t min_ns = ( h->count > 0 ) ? h->min_ns : 0;
+    uint64_t mean_ns = ( h->count > 0 ) ? h->sum_ns / h->count : 0;
+    const char *p_fmt = ( format == elapsed_export_csv ) ?
+        "%" PRIu64 ",%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+        ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n" :
+        "{\"time_ns\":%" PRIu64 ",\"name\":\"%s\",\"interval\":%" PRIu64 ",\"count\":%" PRIu64
+        ",\"min_ns\":%" PRIu64 ",\"mean_ns\":%" PRIu64 ",\"p50_ns\":%" PRIu64 ",\"p90_ns\":%"
+        PRIu64 ",\"p99_ns\":%" PRIu64 ",\"p999_ns\":%" PRIu64 ",\"max_ns\":%" PRIu64 "}\n";
+
+    fprintf(fp, p_fmt, elapsed_now_ns(), name, interval, h->count, min_ns, mean_ns,
+            elapsed_hist_percentile( h, 0.50 ), elapsed_hist_percentile( h, 0.90 ),
+            elapsed_hist_percentile( h, 0.99 ), elapsed_hist_percentile( h, 0.999 ),
+            h->max_ns);
+    fflush(fp);
+}
+
+/* parse "csv" or "json", returns -1 for anything else */
+static inline
+int elapsed_export_parse_format( const char *p_name, enum elapsed_export_format *p_format )
+{
+    if ( ( p_name == NULL ) || ( strcmp( p_name, "csv" ) == 0 ) )
+    {
+        *p_format = elapsed_export_csv;
+    }
+    else if ( strcmp( p_name, "json" ) == 0 )
+    {
+        *p_format = elapsed_export_json;
+    }
+    else
+    {
+        return -1;
+    }
+
+    return 0;
 }
 
 #define elapsed_print(_x)                                               \
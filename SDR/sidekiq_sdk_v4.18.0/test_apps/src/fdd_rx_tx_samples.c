@@ -3,10 +3,18 @@
  * a Sidekiq to do the following:
  *   -Configure the Rx interface
  *   -Configure the Tx interface
- *   -Start the Rx interface in the main thread, storing samples to a file
- *   -Start a separate Tx thread and loop:
- *       -sleep for a short duration (~1 second)
- *       -transmit samples from a file
+ *   -Start the Rx interface in the main thread, handing the samples to a
+ *    writer thread that stores them to a file
+ *   -Start a separate Tx thread that transmits the blocks a prefetch
+ *    thread reads from a file, looping through the file N times
+ *
+ * The receive and transmit threads never touch the disk: received blocks
+ * go through a bounded single-producer / single-consumer ring to the
+ * writer thread, and transmit blocks come from the prefetch thread through
+ * a second ring.  Each thread can be pinned to a CPU and the occupancy of
+ * both rings is reported at the end, so a slow disk shows up as a full
+ * receive ring (or an empty transmit ring) rather than as a mystery
+ * overrun.
  *
  * Many of the RF configuration parameters are defaulted to sane
  * values for this application to minimize the command line args
@@ -18,6 +26,10 @@
  * </pre>
  */
 
+#if (!defined _GNU_SOURCE)
+#define _GNU_SOURCE         /* for pthread_setaffinity_np, see feature_test_macros(7) */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
@@ -26,10 +38,19 @@
 #include <unistd.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <sched.h>
+#include <math.h>
 
 #include <arg_parser.h>
 #include <sidekiq_api.h>
 
+#include "spsc_ring.h"
+#include "tx_file_source.h"
+#include "rt_thread.h"
+#include "doppler.h"
+#include "rf_scheduler.h"
+#include "trace.h"
+
 /* https://gcc.gnu.org/onlinedocs/gcc-4.8.5/cpp/Stringification.html */
 #define xstr(s)                         str(s)
 #define str(s)                          #s
@@ -73,6 +94,14 @@
 #   define DEFAULT_TX_HDL "A1"
 #endif
 
+#ifndef DEFAULT_RX_RING_BLOCKS
+#   define DEFAULT_RX_RING_BLOCKS 1024
+#endif
+
+#ifndef DEFAULT_TX_RING_BLOCKS
+#   define DEFAULT_TX_RING_BLOCKS 64
+#endif
+
 #define NUM_RX_PAYLOAD_WORDS_IN_BLOCK (SKIQ_MAX_RX_BLOCK_SIZE_IN_WORDS-SKIQ_RX_HEADER_SIZE_IN_WORDS)
 
 /* local functions */
@@ -80,9 +109,15 @@ static int32_t process_cmd_line_args(int argc, char *argv[]);
 static int32_t configure_sample_rate(void);
 static int32_t prepare_rx(void);
 static int32_t prepare_tx(void);
+static void prepare_tx_hops(void);
 static void recv_samples(void);
+static void* write_samples(void*);
 static void* send_samples(void*);
+static void* prefetch_samples(void*);
 static int32_t init_tx_buffer(void);
+static void copy_rx_samples(void *p_dst, const skiq_rx_block_t *p_block, uint32_t num_bytes);
+static void precompensate_tx(skiq_tx_block_t *p_block, uint64_t tx_timestamp);
+static void retune_tx_action(uint64_t rf_ts, void *p_arg);
 
 static char* app_name;
 
@@ -108,6 +143,36 @@ Defaults:\n\
   --block-size=" xstr(DEFAULT_BLOCK_SIZE) "\n\
   --rx-hdl=" DEFAULT_RX_HDL "\n\
   --tx-hdl=" DEFAULT_TX_HDL "\n\
+  --rx-ring=" xstr(DEFAULT_RX_RING_BLOCKS) "\n\
+  --tx-ring=" xstr(DEFAULT_TX_RING_BLOCKS) "\n\
+  --rx-cpu, --writer-cpu, --tx-cpu, --prefetch-cpu=unpinned\n\
+  --doppler-max-offset=a quarter of --rate\n\
+" TRACE_HELP_DEFAULTS "\
+\n\
+With --rx-doppler and/or --tx-doppler, the Doppler shift predicted for a\n\
+pass is followed on the host instead of by retuning.  Each file holds lines\n\
+of \"SECONDS HZ\", seconds counted from the start of streaming and the shift\n\
+seen by the far end, interpolated in between.  Received samples are mixed\n\
+down by the shift and transmitted samples pre-compensated for it with a\n\
+phase continuous NCO; the LO is only retuned (the Rx LO up by the shift, the\n\
+Tx LO down, at the timestamp of the first block mixed for it) when the\n\
+shift left to the NCO exceeds --doppler-max-offset.  The Tx LO moves in\n\
+steps of --doppler-max-offset with timestamped frequency hops where the radio\n\
+supports them and --rx-doppler is not given; otherwise the Tx retune starts\n\
+at the timestamp and, for the milliseconds it takes, the far end sees the\n\
+signal shifted by up to the whole LO step.  See doppler.h.\n\
+\n\
+A capture recorded with a block index (rx_samples --index) can be transmitted\n\
+from the sample received at an RF timestamp with --tx-start-at; a timestamp in\n\
+a gap of the capture starts after the gap.  Only captures of plain 16-bit\n\
+samples (without --meta, --packed or --compress) can be transmitted.\n\
+\n\
+With --trace=PATH, each thread records a span for every skiq_receive(),\n\
+skiq_transmit(), file write, block fill and wait for a free slot in the\n\
+receive ring, plus an instant event for every receive timestamp gap.  The last\n\
+--trace-events of each thread are written to PATH in the Chrome trace\n\
+format once streaming stops, to see which thread held the others up when a\n\
+gap appeared.  See trace.h for --trace-counters and --trace-marker.\n\
 ";
 
 // parameters read from command line
@@ -124,7 +189,9 @@ static uint32_t num_tx_loops=DEFAULT_TX_LOOPS;
 static uint8_t rx_gain = UINT8_MAX;
 static bool rx_gain_is_present = false;
 static bool timestamp_is_present = false;
-static skiq_tx_block_t **p_tx_blocks = NULL; /* reference to an array of transmit block references */
+static uint64_t tx_start_rf_ts = 0;
+static bool tx_start_rf_ts_present = false;
+static skiq_tx_block_t **p_tx_blocks = NULL; /* transmit blocks, one per slot of the tx ring */
 static uint32_t num_blocks = 0;
 static uint32_t block_size_in_words = DEFAULT_BLOCK_SIZE;
 static uint64_t timestamp = DEFAULT_INIT_TIMESTAMP;
@@ -133,15 +200,41 @@ static char* p_tx_hdl = DEFAULT_TX_HDL;
 static skiq_rx_hdl_t rx_hdl =  skiq_rx_hdl_end;
 static skiq_tx_hdl_t tx_hdl =  skiq_tx_hdl_end;
 
-static FILE* input_fp=NULL;
+static uint32_t rx_ring_blocks = DEFAULT_RX_RING_BLOCKS;
+static uint32_t tx_ring_blocks = DEFAULT_TX_RING_BLOCKS;
+static int32_t rx_cpu = -1;
+static int32_t writer_cpu = -1;
+static int32_t tx_cpu = -1;
+static int32_t prefetch_cpu = -1;
+
+static struct tx_file_source tx_source = TX_FILE_SOURCE_INITIALIZER;
 static FILE* output_fp=NULL;
 
 uint32_t num_complete_rx_blocks;  // # full blocks to receive
 uint32_t last_block_num_bytes;    // extra # bytes to receive on last block
 
-uint32_t* p_rx_iq;  // pointer to the Rx data
+/* received blocks on their way to the writer thread, and transmit blocks on their way from the
+   prefetch thread */
+static struct spsc_ring rx_ring = SPSC_RING_INITIALIZER;
+static struct spsc_ring tx_ring = SPSC_RING_INITIALIZER;
+static int32_t writer_status = 0;
+
+/* Doppler compensation, Tx LO retunes are timestamped hops from a list of LO offsets when the
+   radio supports them, else scheduled on the RF timestamp of their first block */
+static char* p_rx_doppler = NULL;
+static char* p_tx_doppler = NULL;
+static double doppler_max_offset = 0.0;
+static struct doppler rx_doppler;
+static struct doppler tx_doppler;
+static bool tx_doppler_hops = false;
+static int64_t tx_hop_first = 0;        // LO offset of hop index 0, in LO steps
+static struct rf_sched tx_sched = RF_SCHED_INITIALIZER;
+
+static struct trace trace = TRACE_INITIALIZER;
 
 pthread_t tx_thread; // transmit thread
+pthread_t writer_thread; // writes received samples to the file
+pthread_t prefetch_thread; // reads transmit samples from the file
 
 /* the command line arguments available to this application */
 static struct application_argument p_args[] =
@@ -188,6 +281,13 @@ static struct application_argument p_args[] =
                 NULL,
                 &input_filepath,
                 STRING_VAR_TYPE),
+    APP_ARG_OPT_PRESENT("tx-start-at",
+                        0,
+                        "Transmit an indexed --tx-input from the sample at an RF timestamp",
+                        "TS",
+                        &tx_start_rf_ts,
+                        UINT64_VAR_TYPE,
+                        &tx_start_rf_ts_present),
     APP_ARG_OPT("tx-freq",
                 0,
                 "TX LO Frequency in Hertz",
@@ -232,6 +332,61 @@ static struct application_argument p_args[] =
                 &timestamp,
                 UINT64_VAR_TYPE,
                 &timestamp_is_present),
+    APP_ARG_OPT("rx-ring",
+                0,
+                "Number of receive blocks buffered for the writer thread",
+                "N",
+                &rx_ring_blocks,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("tx-ring",
+                0,
+                "Number of transmit blocks buffered ahead by the prefetch thread",
+                "N",
+                &tx_ring_blocks,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("rx-cpu",
+                0,
+                "Pin the receive thread to this CPU",
+                "CPU",
+                &rx_cpu,
+                INT32_VAR_TYPE),
+    APP_ARG_OPT("writer-cpu",
+                0,
+                "Pin the file writer thread to this CPU",
+                "CPU",
+                &writer_cpu,
+                INT32_VAR_TYPE),
+    APP_ARG_OPT("tx-cpu",
+                0,
+                "Pin the transmit thread to this CPU",
+                "CPU",
+                &tx_cpu,
+                INT32_VAR_TYPE),
+    APP_ARG_OPT("prefetch-cpu",
+                0,
+                "Pin the transmit prefetch thread to this CPU",
+                "CPU",
+                &prefetch_cpu,
+                INT32_VAR_TYPE),
+    APP_ARG_OPT("rx-doppler",
+                0,
+                "Compensate received samples for the Doppler profile in this file",
+                "PATH",
+                &p_rx_doppler,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("tx-doppler",
+                0,
+                "Pre-compensate transmitted samples for the Doppler profile in this file",
+                "PATH",
+                &p_tx_doppler,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("doppler-max-offset",
+                0,
+                "Doppler shift left to the NCO before the LO is retuned",
+                "Hz",
+                &doppler_max_offset,
+                DOUBLE_VAR_TYPE),
+    TRACE_APP_ARGS(&trace),
     APP_ARG_TERMINATOR
 };
 
@@ -328,51 +483,116 @@ int main( int argc, char *argv[] )
         goto finished;
     }
 
-    /* fire off a thread to handle transmit tasks */
-    pthread_create(&tx_thread, NULL, send_samples, NULL);
+    if ( (p_tx_doppler != NULL) && !tx_doppler_hops )
+    {
+        status = rf_sched_init_tx(&tx_sched, card, tx_hdl, sample_rate);
+        if ( status != 0 )
+        {
+            fprintf(stderr, "Error: unable to start the Tx retune scheduler (result code %"
+                    PRIi32 ")\n", status);
+            goto finished;
+        }
+    }
+
+    /* fire off the threads that feed the transmitter and drain the receiver, then the thread
+       that handles transmit tasks */
+    if ( (status=pthread_create(&writer_thread, NULL, write_samples, NULL)) != 0 )
+    {
+        fprintf(stderr, "Error: unable to create writer thread (result code %" PRIi32 ")\n",
+                status);
+        status = -status;
+        goto finished;
+    }
+    (void)rt_thread_pin(writer_thread, writer_cpu, "writer");
+    if ( (status=pthread_create(&prefetch_thread, NULL, prefetch_samples, NULL)) != 0 )
+    {
+        fprintf(stderr, "Error: unable to create prefetch thread (result code %" PRIi32 ")\n",
+                status);
+        running = false;
+        spsc_ring_close(&rx_ring);
+        pthread_join(writer_thread, NULL);
+        status = -status;
+        goto finished;
+    }
+    (void)rt_thread_pin(prefetch_thread, prefetch_cpu, "prefetch");
+    if ( (status=pthread_create(&tx_thread, NULL, send_samples, NULL)) != 0 )
+    {
+        fprintf(stderr, "Error: unable to create Tx thread (result code %" PRIi32 ")\n",
+                status);
+        running = false;
+        spsc_ring_close(&rx_ring);
+        pthread_join(writer_thread, NULL);
+        pthread_join(prefetch_thread, NULL);
+        status = -status;
+        goto finished;
+    }
+    (void)rt_thread_pin(tx_thread, tx_cpu, "Tx");
+    (void)rt_thread_pin(pthread_self(), rx_cpu, "Rx");
 
     printf("Info: start Recv samples\n");
     recv_samples();
     printf("Info: done receiving samples\n");
 
-    if (pthread_join(tx_thread,NULL))
+    if (pthread_join(tx_thread,NULL) || pthread_join(prefetch_thread,NULL) ||
+        pthread_join(writer_thread,NULL))
     {
-        fprintf(stderr, "Error: failed to join Tx thread\n");
+        fprintf(stderr, "Error: failed to join Tx, prefetch or writer thread\n");
         status = -1;
         goto finished;
     }
     else
     {
-        status = 0;
+        status = writer_status;
+    }
+
+    /* a ring that is mostly full points at its consumer as the bottleneck, a ring that is
+       mostly empty at its producer */
+    spsc_ring_print_stats(&rx_ring, "Rx -> writer", stdout);
+    spsc_ring_print_stats(&tx_ring, "prefetch -> Tx", stdout);
+    if (p_rx_doppler != NULL)
+    {
+        doppler_print_stats(&rx_doppler, "Rx", stdout);
+    }
+    if (p_tx_doppler != NULL)
+    {
+        doppler_print_stats(&tx_doppler, "Tx", stdout);
+    }
+    if (trace.enabled)
+    {
+        int32_t trace_status = trace_export(&trace);
+
+        trace_print_stats(&trace, stdout);
+        if (trace_status != 0)
+        {
+            fprintf(stderr, "Error: unable to write the trace to %s (result code %" PRIi32
+                    ")\n", trace.p_path, trace_status);
+        }
     }
 
-    printf("Info: Success\n");
+    if (status == 0)
+    {
+        printf("Info: Success\n");
+    }
 
 finished:
     /* close files and cleanup */
+    rf_sched_exit(&tx_sched);
+    trace_free(&trace);
+    doppler_free(&rx_doppler);
+    doppler_free(&tx_doppler);
     if (NULL != output_fp)
     {
         fclose(output_fp);
         output_fp = NULL;
     }
-    if (NULL != input_fp)
-    {
-        fclose(input_fp);
-        input_fp = NULL;
-    }
-
-    if (NULL != p_rx_iq)
-    {
-        free(p_rx_iq);
-        p_rx_iq = NULL;
-    }
+    tx_file_source_close(&tx_source);
 
     if (skiq_initialized)
     {
         if (NULL != p_tx_blocks)
         {
             uint32_t curr_block = 0;
-            for( curr_block=0; curr_block<num_blocks; curr_block++ )
+            for( curr_block=0; curr_block<tx_ring.nr_slots; curr_block++ )
             {
                 if (p_tx_blocks[curr_block] != NULL) 
                 {
@@ -387,6 +607,8 @@ finished:
         skiq_exit();
         skiq_initialized = false;
     }
+    spsc_ring_free(&rx_ring);
+    spsc_ring_free(&tx_ring);
 
     return status;
 }
@@ -468,15 +690,13 @@ static int32_t prepare_rx(void)
     num_complete_rx_blocks = num_samples_to_rx / NUM_RX_PAYLOAD_WORDS_IN_BLOCK;
     last_block_num_bytes = ((num_samples_to_rx % NUM_RX_PAYLOAD_WORDS_IN_BLOCK)*4);
 
-    // allocate memory to save all the receive data
-    num_bytes_to_alloc =
-        (num_complete_rx_blocks*NUM_RX_PAYLOAD_WORDS_IN_BLOCK*sizeof(uint32_t)) + last_block_num_bytes;
-    p_rx_iq = malloc( num_bytes_to_alloc );
-    if( p_rx_iq == NULL )
+    // allocate the ring that holds received blocks until the writer thread stores them
+    num_bytes_to_alloc = NUM_RX_PAYLOAD_WORDS_IN_BLOCK*sizeof(uint32_t);
+    status = spsc_ring_init( &rx_ring, rx_ring_blocks, num_bytes_to_alloc, SPSC_RING_DEFAULT_SPIN );
+    if( status != 0 )
     {
-        fprintf(stderr, "Error: didn't successfully allocate %d bytes to hold unpacked iq\n",
-               num_bytes_to_alloc);
-        status = -1;
+        fprintf(stderr, "Error: didn't successfully allocate %" PRIu32 " blocks of %" PRIu32
+                " bytes to hold received samples\n", rx_ring_blocks, num_bytes_to_alloc);
     }
 
     return (status);
@@ -526,11 +746,88 @@ static int32_t prepare_tx(void)
         fprintf(stderr, "Error: unable to configure Tx block size\n");
         return (status);
     }
-
+    if( p_tx_doppler != NULL )
+    {
+        prepare_tx_hops();
+    }
 
     return (status);
 }
 
+/*****************************************************************************/
+/** The prepare_tx_hops function sets up timestamped Tx frequency hops for the
+    Doppler LO retunes: the LO offsets are restricted to multiples of
+    --doppler-max-offset and loaded as a hop list, so that each retune is
+    programmed ahead of time and takes effect on the timestamp of the first
+    block mixed for it.  The retunes fall back to LO writes from the scheduler
+    if the radio can't hop on timestamps, the profile needs more offsets than
+    the hop list holds, or the Rx LO moves with --rx-doppler (a timestamped hop
+    retunes the Rx LO as well on some radios).
+
+    @param void
+    @return void
+*/
+static void prepare_tx_hops(void)
+{
+    static uint64_t tx_freqs[SKIQ_MAX_NUM_FREQ_HOPS];
+    static uint64_t rx_freqs[SKIQ_MAX_NUM_FREQ_HOPS];
+    const double step = floor(tx_doppler.max_offset);
+    int64_t first = 0, last = 0, k;
+    uint16_t num_freqs;
+    int32_t status = 0;
+
+    if( (p_rx_doppler != NULL) || (step < 1.0) )
+    {
+        printf("Info: retuning the Tx LO from the scheduler, the far end sees up to the whole"
+               " LO step while it tunes\n");
+        return;
+    }
+
+    doppler_set_lo_step(&tx_doppler, step, &first, &last);
+    if( (last - first + 1) > SKIQ_MAX_NUM_FREQ_HOPS )
+    {
+        status = -E2BIG;
+    }
+    else
+    {
+        // the Tx LO moves against the shift; the Rx LO stays put whichever index is hopped to
+        num_freqs = (uint16_t)(last - first + 1);
+        for( k = first; k <= last; k++ )
+        {
+            tx_freqs[k - first] = (uint64_t)( (int64_t)tx_lo_freq - (k * (int64_t)step) );
+            rx_freqs[k - first] = rx_lo_freq;
+        }
+        status = skiq_write_tx_freq_tune_mode(card, tx_hdl, skiq_freq_tune_mode_hop_on_timestamp);
+        if( status == 0 )
+        {
+            status = skiq_write_tx_freq_hop_list(card, tx_hdl, num_freqs, tx_freqs,
+                                                 (uint16_t)(-first));
+        }
+        if( status == 0 )
+        {
+            status = skiq_write_rx_freq_hop_list(card, rx_hdl, num_freqs, rx_freqs,
+                                                 (uint16_t)(-first));
+        }
+    }
+
+    if( status != 0 )
+    {
+        // undo the LO grid and the tune mode, retune with ordinary LO writes instead
+        tx_doppler.lo_step = 0.0;
+        (void)skiq_write_tx_freq_tune_mode(card, tx_hdl, skiq_freq_tune_mode_standard);
+        (void)skiq_write_tx_LO_freq(card, tx_hdl, tx_lo_freq);
+        printf("Info: unable to hop the Tx LO on timestamps (result code %" PRIi32 "), retuning"
+               " from the scheduler; the far end sees up to the whole LO step while it"
+               " tunes\n", status);
+        return;
+    }
+
+    tx_doppler_hops = true;
+    tx_hop_first = first;
+    printf("Info: Tx LO retunes are timestamped hops in steps of %.0f Hz (%" PRIu16
+           " frequencies)\n", step, num_freqs);
+}
+
 /*****************************************************************************/
 /** The recv_samples function is responsible for receiving the requested
     # of I/Q samples and storing them in a file.
@@ -548,10 +845,11 @@ static void recv_samples(void)
     skiq_rx_status_t status=0;
     bool done=false;
     bool first_timestamp = true;
-    uint32_t* p_next_rx_write;
     uint64_t next_timestamp = 0;
-
-    p_next_rx_write = p_rx_iq;
+    uint32_t slot = 0;
+    struct trace_buffer *p_trace = trace_thread(&trace, "Rx");
+    struct trace_span span;
+    int32_t reserve_status;
 
     printf("Info: receiving samples\n");
     skiq_start_rx_streaming(card, rx_hdl);
@@ -559,7 +857,9 @@ static void recv_samples(void)
     // call receive until all of the bytes are received
     while( (done==false) && (running==true) )
     {
+        trace_begin(p_trace, &span);
         status = skiq_receive(card, &hdl, &p_rx_block, &len);
+        trace_end(p_trace, &span, "receive", len);
         if( skiq_rx_status_success == status )
         {
             if( hdl != rx_hdl )
@@ -577,26 +877,43 @@ static void recv_samples(void)
             {
                 if( curr_timestamp != next_timestamp )
                 {
+                    trace_instant(p_trace, "gap", (int64_t)(curr_timestamp - next_timestamp));
                     fprintf(stderr, "Error: timestamp error...expected 0x%016" PRIx64 " but got 0x%016" PRIx64 "\n",
                            next_timestamp, curr_timestamp);
                 }
             }
 
-            // copy either a complete block of data or a partial block at the end
-            if( tot_blocks_acquired < num_complete_rx_blocks )
+            // hand either a complete block of data or a partial block at the end to the writer
+            if( (last_block_num_bytes > 0) || (tot_blocks_acquired < num_complete_rx_blocks) )
             {
-                memcpy( p_next_rx_write,
-                        (void *)p_rx_block->data,
-                        NUM_RX_PAYLOAD_WORDS_IN_BLOCK*4 );
-                p_next_rx_write += NUM_RX_PAYLOAD_WORDS_IN_BLOCK;
-                tot_blocks_acquired++;
+                trace_begin(p_trace, &span);
+                reserve_status = spsc_ring_reserve( &rx_ring, &slot, &running );
+                trace_end(p_trace, &span, "wait writer", reserve_status);
+                if( reserve_status != 0 )
+                {
+                    break;
+                }
+                trace_begin(p_trace, &span);
+                if( tot_blocks_acquired < num_complete_rx_blocks )
+                {
+                    copy_rx_samples( spsc_ring_slot( &rx_ring, slot ), p_rx_block,
+                                     NUM_RX_PAYLOAD_WORDS_IN_BLOCK*4 );
+                    trace_end(p_trace, &span, "copy", NUM_RX_PAYLOAD_WORDS_IN_BLOCK*4);
+                    spsc_ring_commit( &rx_ring, NUM_RX_PAYLOAD_WORDS_IN_BLOCK*4, curr_timestamp );
+                    tot_blocks_acquired++;
+                }
+                else
+                {
+                    // we're at the end, just copy a partial block
+                    copy_rx_samples( spsc_ring_slot( &rx_ring, slot ), p_rx_block,
+                                     last_block_num_bytes );
+                    trace_end(p_trace, &span, "copy", last_block_num_bytes);
+                    spsc_ring_commit( &rx_ring, last_block_num_bytes, curr_timestamp );
+                    done = true;
+                }
             }
-            else
+            if( (last_block_num_bytes == 0) && (tot_blocks_acquired == num_complete_rx_blocks) )
             {
-                // we're at the end, just copy a partial block
-                memcpy( p_next_rx_write,
-                        (void *)p_rx_block->data,
-                        last_block_num_bytes );
                 done = true;
             }
             next_timestamp += (len - SKIQ_RX_HEADER_SIZE_IN_BYTES)/4;
@@ -605,21 +922,47 @@ static void recv_samples(void)
 
     skiq_stop_rx_streaming(card, rx_hdl);
 
-    // write the file
-    if( running==true )
+    // let the writer thread finish what is still in the ring
+    spsc_ring_close( &rx_ring );
+}
+
+/*****************************************************************************/
+/** The write_samples function is the writer thread, storing the blocks from
+    the receive ring to the output file.
+
+    @param data     unused
+    @return Always NULL.
+*/
+static void* write_samples(void* data)
+{
+    uint32_t slot = 0;
+    uint32_t len = 0;
+    struct trace_buffer *p_trace = trace_thread(&trace, "writer");
+    struct trace_span span;
+    size_t nr_written = 1;
+
+    (void)data;
+
+    // the ring is drained even when interrupted so the file holds everything received
+    while( spsc_ring_peek( &rx_ring, &slot, &len, NULL, NULL ) == 0 )
     {
-        printf("Info: saving samples to the file\n");
-        p_next_rx_write = p_rx_iq;
-        for( len=0; len<num_complete_rx_blocks; len++ )
+        if( writer_status == 0 )
         {
-            fwrite(p_next_rx_write, NUM_RX_PAYLOAD_WORDS_IN_BLOCK*4, 1, output_fp);
-            p_next_rx_write += NUM_RX_PAYLOAD_WORDS_IN_BLOCK;
+            trace_begin(p_trace, &span);
+            nr_written = fwrite( spsc_ring_slot( &rx_ring, slot ), len, 1, output_fp );
+            trace_end(p_trace, &span, "write", len);
         }
-        if( last_block_num_bytes > 0 )
+        if( (writer_status == 0) && (nr_written != 1) )
         {
-            fwrite(p_next_rx_write, last_block_num_bytes, 1, output_fp);
+            fprintf(stderr, "Error: unable to write received samples to the file (errno %d)\n",
+                    errno);
+            writer_status = -EIO;
+            running = false;
         }
+        spsc_ring_release( &rx_ring );
     }
+
+    return NULL;
 }
 
 /*****************************************************************************/
@@ -633,63 +976,230 @@ static void* send_samples(void* data)
 {
     int32_t status = 0;
     uint32_t curr_block=0;
-    uint32_t timestamp_increment = block_size_in_words;
-    uint32_t i,num_lates = 0;
+    uint32_t slot=0;
+    uint32_t num_lates = 0;
+    struct trace_buffer *p_trace = trace_thread(&trace, "Tx");
+    struct trace_span span;
+
+    (void)data;
 
     if( skiq_start_tx_streaming(card, tx_hdl) != 0 )
     {
         fprintf(stderr, "Error: unable to start Tx streaming\n");
+        running = false;
         return NULL;
     }
 
-    for( i=0; (i<num_tx_loops) && (running==true); i++ )
-    {
-        printf("Info: sending samples: (num_blocks=%d)\n", num_blocks);
+    printf("Info: sending samples: (num_blocks=%d, loops=%d)\n", num_blocks, num_tx_loops);
 
-        // transmit a block at a time
-        while( (curr_block < num_blocks) && (running==true) )
+    // transmit a block at a time, as the prefetch thread makes them available
+    while( spsc_ring_peek( &tx_ring, &slot, NULL, NULL, &running ) == 0 )
+    {
+        // transmit the data
+        trace_begin(p_trace, &span);
+        status = skiq_transmit(card, tx_hdl, p_tx_blocks[slot], NULL );
+        trace_end(p_trace, &span, "transmit", curr_block);
+        spsc_ring_release( &tx_ring );
+        if (0 != status)
         {
-            skiq_tx_set_block_timestamp( p_tx_blocks[curr_block], timestamp);
+            fprintf(stderr, "Error: failed to transmit data on block %d (result code %"
+                    PRIi32 ")\n", curr_block, status);
+            running = false;
+            break;
+        }
 
-            // transmit the data
-            if (running)
+        curr_block++;
+        if( (curr_block % num_blocks) == 0 )
+        {
+            status = skiq_read_tx_num_late_timestamps(card, tx_hdl, &num_lates);
+            if (status != 0)
             {
-                status = skiq_transmit(card, tx_hdl, p_tx_blocks[curr_block], NULL );
-                if (0 != status)
-                {
-                    fprintf(stderr, "Error: failed to transmit data on block %d (result code %"
-                            PRIi32 ")\n", curr_block, status);
-                    running = false;
-                }
-                curr_block++;
-                // update the timestamp
-                timestamp += timestamp_increment;
+                fprintf(stderr, "Error: failed to read num late timestamps (result code %"
+                        PRIi32 ")\n", status);
+                running = false;
+            }
+            else if (num_lates > 0)
+            {
+                printf("Number of late timestamps: %d !\n", num_lates );
             }
         }
-        curr_block=0;
+    }
 
-        status = skiq_read_tx_num_late_timestamps(card, tx_hdl, &num_lates);
-        if (status != 0)
+    status = skiq_stop_tx_streaming(card, tx_hdl);
+    if ( status != 0 )
+    {
+        fprintf(stderr, "Error: failed to stop TX streaming (result code %" PRIi32
+                ")\n", status);
+    }
+
+    return NULL;
+}
+
+/*****************************************************************************/
+/** The copy_rx_samples function copies the samples of a received block to
+    the receive ring, mixing them down by the residual Doppler shift with
+    --rx-doppler.  The Rx LO is retuned first if the shift has left the
+    usable bandwidth.
+
+    @param p_dst        destination slot
+    @param p_block      received block
+    @param num_bytes    number of bytes of samples to copy
+    @return void
+*/
+static void copy_rx_samples(void *p_dst, const skiq_rx_block_t *p_block, uint32_t num_bytes)
+{
+    const uint64_t rf_ts = p_block->rf_timestamp;
+    double lo_offset = 0.0;
+    uint64_t retune_ts = 0;
+    int32_t status = 0;
+
+    if( p_rx_doppler == NULL )
+    {
+        memcpy( p_dst, (void *)p_block->data, num_bytes );
+        return;
+    }
+
+    if( doppler_retune_needed( &rx_doppler, rf_ts, &lo_offset ) )
+    {
+        status = skiq_write_rx_LO_freq( card, rx_hdl,
+                                        (uint64_t)( (int64_t)rx_lo_freq + (int64_t)lo_offset ) );
+        if( status != 0 )
         {
-            fprintf(stderr, "Error: failed to read num late timestamps (result code %"
-                    PRIi32 ")\n", status);
+            fprintf(stderr, "Error: unable to retune the Rx LO by %.0f Hz (result code %"
+                    PRIi32 ")\n", lo_offset, status);
             running = false;
         }
-        else if (num_lates > 0)
+        else
         {
-            printf("Number of late timestamps: %d !\n", num_lates );
+            // samples from the timestamp read after the retune on are at the new frequency
+            if( skiq_read_curr_rx_timestamp( card, rx_hdl, &retune_ts ) != 0 )
+            {
+                retune_ts = rf_ts + ( num_bytes / 4 );
+            }
+            doppler_set_lo( &rx_doppler, lo_offset, retune_ts );
         }
+    }
+    doppler_mix( &rx_doppler, (const int16_t *)p_block->data, (int16_t *)p_dst, num_bytes / 4,
+                 rf_ts );
+}
+
+/*****************************************************************************/
+/** The precompensate_tx function mixes a transmit block by the residual
+    Doppler shift with --tx-doppler, retuning the Tx LO at its timestamp if the
+    shift has left the usable bandwidth: with a timestamped hop when they are
+    set up, else with an LO write scheduled for that timestamp.
 
-        
-        
+    @param p_block          transmit block, filled with samples
+    @param tx_timestamp     timestamp the block is transmitted at
+    @return void
+*/
+static void precompensate_tx(skiq_tx_block_t *p_block, uint64_t tx_timestamp)
+{
+    double lo_offset = 0.0;
+    int32_t status = 0;
+
+    if( doppler_retune_needed( &tx_doppler, tx_timestamp, &lo_offset ) )
+    {
+        // this block is the first one mixed for the new LO frequency, retune when it goes out
+        doppler_set_lo( &tx_doppler, lo_offset, tx_timestamp );
+        if( tx_doppler_hops )
+        {
+            // the hop is programmed now and taken by the radio on the block's timestamp
+            const int64_t index = (int64_t)round( lo_offset / tx_doppler.lo_step ) - tx_hop_first;
+
+            status = skiq_write_next_tx_freq_hop( card, tx_hdl, (uint16_t)index );
+            if( status == 0 )
+            {
+                status = skiq_perform_tx_freq_hop( card, tx_hdl, tx_timestamp );
+            }
+            if( status != 0 )
+            {
+                fprintf(stderr, "Error: unable to hop the Tx LO by %.0f Hz (result code %"
+                        PRIi32 ")\n", -lo_offset, status);
+                running = false;
+            }
+        }
+        else if( (status = rf_sched_at( &tx_sched, tx_timestamp, retune_tx_action,
+                                        (void *)(intptr_t)(int64_t)lo_offset )) != 0 )
+        {
+            fprintf(stderr, "Warning: unable to schedule the Tx LO retune (result code %"
+                    PRIi32 "), retuning now\n", status);
+            retune_tx_action( tx_timestamp, (void *)(intptr_t)(int64_t)lo_offset );
+        }
     }
+    doppler_mix( &tx_doppler, (const int16_t *)p_block->data, (int16_t *)p_block->data,
+                 block_size_in_words, tx_timestamp );
+}
 
-    status = skiq_stop_tx_streaming(card, tx_hdl);
-    if ( status != 0 )
+/*****************************************************************************/
+/** The retune_tx_action function runs from the Tx retune scheduler when the
+    first block pre-compensated for a new Tx LO offset is due to go out.
+
+    @param rf_ts        RF timestamp of the block
+    @param p_arg        the LO offset from --tx-freq in Hertz, cast to a pointer
+    @return void
+*/
+static void retune_tx_action(uint64_t rf_ts, void *p_arg)
+{
+    const int64_t lo_offset = (int64_t)(intptr_t)p_arg;
+    int32_t status;
+
+    (void)rf_ts;
+
+    // the Tx LO moves against the shift so that the far end sees the nominal frequency
+    status = skiq_write_tx_LO_freq( card, tx_hdl, (uint64_t)( (int64_t)tx_lo_freq - lo_offset ) );
+    if( status != 0 )
     {
-        fprintf(stderr, "Error: failed to stop TX streaming (result code %" PRIi32
-                ")\n", status);
+        fprintf(stderr, "Error: unable to retune the Tx LO by %" PRIi64 " Hz (result code %"
+                PRIi32 ")\n", -lo_offset, status);
+        running = false;
+    }
+}
+
+/*****************************************************************************/
+/** The prefetch_samples function is the prefetch thread, filling transmit
+    blocks from the input file and handing them to the Tx thread through the
+    transmit ring.
+
+    @param data     unused
+    @return Always NULL.
+*/
+static void* prefetch_samples(void* data)
+{
+    struct tx_file_reader reader;
+    uint32_t timestamp_increment = block_size_in_words;
+    uint32_t curr_block=0;
+    uint32_t slot=0;
+    uint32_t i;
+    struct trace_buffer *p_trace = trace_thread(&trace, "prefetch");
+    struct trace_span span;
+
+    (void)data;
+
+    tx_file_reader_init( &reader, &tx_source );
+    for( i=0; (i<num_tx_loops) && (running==true); i++ )
+    {
+        for( curr_block=0; (curr_block < num_blocks) && (running==true); curr_block++ )
+        {
+            if( spsc_ring_reserve( &tx_ring, &slot, &running ) != 0 )
+            {
+                break;
+            }
+            trace_begin(p_trace, &span);
+            (void)tx_file_reader_fill( &reader, curr_block, p_tx_blocks[slot]->data );
+            if( p_tx_doppler != NULL )
+            {
+                precompensate_tx( p_tx_blocks[slot], timestamp );
+            }
+            trace_end(p_trace, &span, "fill", curr_block);
+            skiq_tx_set_block_timestamp( p_tx_blocks[slot], timestamp );
+            spsc_ring_commit( &tx_ring, block_size_in_words*4, timestamp );
+
+            // update the timestamp
+            timestamp += timestamp_increment;
+        }
     }
+    spsc_ring_close( &tx_ring );
 
     return NULL;
 }
@@ -814,14 +1324,28 @@ static int32_t process_cmd_line_args(int argc, char* argv[])
     printf("Info: Requested # of I/Q sample pairs to acquire is %d\n",num_samples_to_rx);
 
     /* ----------------and now for tx args---------------- */
-    input_fp=fopen(input_filepath,"rb");
-    if (input_fp == (FILE*)NULL)
+    status = tx_file_source_open(&tx_source, input_filepath, block_size_in_words*4, 0);
+    if (status != 0)
     {
         fprintf(stderr, "Error: unable to open input file %s with status %" PRIi32 "\n",input_filepath, status);
-        status = -errno;
         goto finished;
     }
     printf("Info: opened file %s for reading transmit IQ data\n",input_filepath);
+    if (tx_start_rf_ts_present)
+    {
+#if (!defined __MINGW32__)
+        status = tx_file_source_seek_rf(&tx_source, input_filepath, tx_start_rf_ts);
+#else
+        status = -ENOTSUP;
+#endif
+        if (status != 0)
+        {
+            fprintf(stderr, "Error: unable to start input file %s at RF timestamp %" PRIu64
+                    " with status %" PRIi32 "\n", input_filepath, tx_start_rf_ts, status);
+            goto finished;
+        }
+        printf("Info: transmitting from byte %" PRIu64 " of the file\n", tx_source.start);
+    }
     printf("Info: Requested Tx LO freq will be %" PRIu64 " Hz\n",tx_lo_freq);
     printf("Info: Requested # of Tx loop iterations to be %d\n",num_tx_loops);
 
@@ -836,7 +1360,55 @@ static int32_t process_cmd_line_args(int argc, char* argv[])
         }
 
     } 
-    
+
+    /* the profiles count seconds from the timestamp reset */
+    if( p_rx_doppler != NULL )
+    {
+        struct doppler_profile profile;
+
+        status = doppler_profile_load(&profile, p_rx_doppler, sample_rate, 0);
+        if( status == 0 )
+        {
+            status = doppler_init(&rx_doppler, &profile, doppler_max_offset, false);
+            doppler_profile_free(&profile);
+        }
+        if( status != 0 )
+        {
+            fprintf(stderr, "Error: unable to load the Rx Doppler profile %s (result code %"
+                    PRIi32 ")\n", p_rx_doppler, status);
+            goto finished;
+        }
+        printf("Info: following the Rx Doppler profile %s, retuning beyond %.0f Hz\n",
+               p_rx_doppler, rx_doppler.max_offset);
+    }
+    if( p_tx_doppler != NULL )
+    {
+        struct doppler_profile profile;
+
+        status = doppler_profile_load(&profile, p_tx_doppler, sample_rate, 0);
+        if( status == 0 )
+        {
+            status = doppler_init(&tx_doppler, &profile, doppler_max_offset, false);
+            doppler_profile_free(&profile);
+        }
+        if( status != 0 )
+        {
+            fprintf(stderr, "Error: unable to load the Tx Doppler profile %s (result code %"
+                    PRIi32 ")\n", p_tx_doppler, status);
+            goto finished;
+        }
+        printf("Info: pre-compensating the Tx Doppler profile %s, retuning beyond %.0f Hz\n",
+               p_tx_doppler, tx_doppler.max_offset);
+    }
+
+    status = trace_init(&trace);
+    if( status != 0 )
+    {
+        fprintf(stderr, "Error: unable to trace to %s (result code %" PRIi32 ")\n",
+                trace.p_path, status);
+        goto finished;
+    }
+
 finished:
     if (0 != status)
     {
@@ -845,83 +1417,54 @@ finished:
             fclose(output_fp);
             output_fp = NULL;
         }
-        if (NULL != input_fp)
-        {
-            fclose(input_fp);
-            input_fp = NULL;
-        }
+        tx_file_source_close(&tx_source);
     }
 
     return status;
 }
 
 /*****************************************************************************/
-/** This function allocates and populates a skiq_tx_block
+/** This function allocates the transmit blocks, one for each slot of the
+    transmit ring; the prefetch thread fills them from the input file.
     @return: int32_t-indicating status
 */
 
 static int32_t init_tx_buffer(void)
 {
     int32_t status = 0;
-    uint32_t num_bytes_in_file=0;
-    int32_t bytes_read=1;
     uint32_t i = 0;
-    uint32_t j = 0;
-    int result = 0;
 
-    // determine how large the file is and how many blocks we'll need to send
-    fseek(input_fp, 0, SEEK_END);
-    num_bytes_in_file = ftell(input_fp);
-    rewind(input_fp);
-    num_blocks = (num_bytes_in_file / (block_size_in_words*4));
+    num_blocks = tx_source.nr_blocks;
+    printf("Info: %u blocks contained in the file\n", num_blocks);
 
-    // if we don't end on an even block boundary, we need an extra block
-    if ( (num_bytes_in_file % (block_size_in_words * 4)) != 0 )
+    status = spsc_ring_init( &tx_ring, tx_ring_blocks, 0, SPSC_RING_DEFAULT_SPIN );
+    if( status != 0 )
     {
-        num_blocks++;
+        fprintf(stderr, "Error: unable to allocate the transmit ring\n");
+        goto finished;
     }
-    printf("Info: %u blocks contained in the file\n", num_blocks);
 
     // allocate the buffer
-    p_tx_blocks = calloc( num_blocks, sizeof( skiq_tx_block_t* ) );
+    p_tx_blocks = calloc( tx_ring.nr_slots, sizeof( skiq_tx_block_t* ) );
     if( p_tx_blocks == NULL )
     {
         fprintf(stderr, "Error: unable to allocate %u bytes to hold transmit"
                 " block descriptors\n",
-                (uint32_t)(num_blocks * sizeof( skiq_tx_block_t* )));
+                (uint32_t)(tx_ring.nr_slots * sizeof( skiq_tx_block_t* )));
         status = -1;
         goto finished;
     }
 
-    // read in the contents of the file, one block at a time
-    for (i = 0; i < num_blocks; i++)
+    for (i = 0; i < tx_ring.nr_slots; i++)
     {
-        if ( !feof(input_fp) && (bytes_read > 0) )
+        /* allocate a transmit block by number of words */
+        p_tx_blocks[i] = skiq_tx_block_allocate( block_size_in_words );
+        if ( p_tx_blocks[i] == NULL )
         {
-
-            /* allocate a transmit block by number of words */
-            p_tx_blocks[i] = skiq_tx_block_allocate( block_size_in_words );
-            
-            if ( p_tx_blocks[i] == NULL )
-            {
-                fprintf(stderr,
-                    "Error: unable to allocate transmit block data\n");
-                status = -2;
-                goto finished;
-            }
-
-            // read a block of samples
-            bytes_read = fread( p_tx_blocks[i]->data, sizeof(int32_t),
-                                block_size_in_words, input_fp );
-            result = ferror(input_fp);
-            if ( 0 != result )
-            {
-                fprintf(stderr,
-                    "Error: unable to read from file (result code %d)\n",
-                    result);
-                status = -3;
-                goto finished;
-            }
+            fprintf(stderr,
+                "Error: unable to allocate transmit block data\n");
+            status = -2;
+            goto finished;
         }
     }
 
@@ -930,20 +1473,19 @@ finished:
     {
         if (NULL != p_tx_blocks)
         {
-            for (j = 0; j < i; j++)
+            for (i = 0; i < tx_ring.nr_slots; i++)
             {
-                skiq_tx_block_free(p_tx_blocks[j]);
+                if (p_tx_blocks[i] != NULL)
+                {
+                    skiq_tx_block_free(p_tx_blocks[i]);
+                }
             }
 
             free(p_tx_blocks);
             p_tx_blocks = NULL;
         }
-
-        if (NULL != input_fp)
-        {
-            fclose(input_fp);
-            input_fp = NULL;
-        }
+        spsc_ring_free(&tx_ring);
+        tx_file_source_close(&tx_source);
     }
 
     return status;
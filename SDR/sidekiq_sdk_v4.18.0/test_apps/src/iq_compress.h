@@ -0,0 +1,489 @@
+/**
+ * @file   iq_compress.h
+ *
+ * @brief  Lossless compression of I/Q captures in independently decodable chunks.
+ *
+ * A capture is cut into fixed-size chunks that are compressed on their own, so chunks can be
+ * compressed and decompressed in parallel and any byte of the capture can be reached by
+ * decoding a single chunk.  The codec treats a chunk as a sequence of 16-bit values split into
+ * two lanes (I and Q, or Q and I), replaces every value by the zigzag encoded difference to the
+ * previous value of its lane, and bit-packs groups of IQ_COMPRESS_GROUP_VALUES differences with
+ * the smallest width that holds all of them:
+ *
+ * <pre>
+ *   group:  | width (1 byte) | IQ_COMPRESS_GROUP_VALUES * width bits, LSB first |
+ * </pre>
+ *
+ * The last group of a chunk may be shorter and an odd trailing byte is stored as is.  A chunk
+ * that doesn't get smaller (e.g. packed 12-bit samples or full scale noise) is stored raw.
+ *
+ * A compressed capture is laid out as:
+ *
+ * <pre>
+ *   | struct iq_compress_header | chunk 0 | chunk 1 | ... | struct iq_compress_chunk[nr_chunks] |
+ * </pre>
+ *
+ * The header is rewritten with the size of the capture and the offset of the chunk table when
+ * the capture is closed.  Offsets in the capture index (capture_index.h) remain offsets into
+ * the uncompressed capture, the chunk holding a byte is simply offset / chunk_size.
+ */
+
+#ifndef __IQ_COMPRESS_H__
+#define __IQ_COMPRESS_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "work_pool.h"
+
+/***** DEFINES *****/
+
+#define IQ_COMPRESS_MAGIC               (0x5a494b53)    /* "SKIZ" */
+#define IQ_COMPRESS_VERSION             (1)
+
+/* struct iq_compress_header codec */
+#define IQ_COMPRESS_CODEC_DELTA_PACK    (1)
+
+/* struct iq_compress_chunk flags */
+#define IQ_COMPRESS_CHUNK_RAW           (1 << 0)    /* the chunk is stored uncompressed */
+
+/* number of 16-bit values sharing a bit width */
+#define IQ_COMPRESS_GROUP_VALUES        (128)
+
+/* largest bit width of a zigzag encoded 16-bit difference */
+#define IQ_COMPRESS_MAX_WIDTH           (16)
+
+/* default number of chunks a reader decodes at a time */
+#define IQ_COMPRESS_DEFAULT_READ_AHEAD  (8)
+
+/***** TYPEDEFS *****/
+
+struct iq_compress_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t codec;                     /* IQ_COMPRESS_CODEC_DELTA_PACK */
+    uint32_t chunk_size;                /* uncompressed size of every chunk but the last */
+    uint32_t reserved;
+    uint64_t nr_chunks;                 /* written when the capture is closed, 0 while open */
+    uint64_t data_size;                 /* uncompressed size of the capture */
+    uint64_t table_offset;              /* of the chunk table in the file */
+};
+
+struct iq_compress_chunk
+{
+    uint64_t offset;                    /* of the chunk in the file */
+    uint32_t size;                      /* compressed size of the chunk */
+    uint32_t flags;                     /* IQ_COMPRESS_CHUNK_RAW */
+};
+
+struct iq_compress_reader;
+
+struct _iq_decompress_job
+{
+    struct iq_compress_reader *r;
+    uint64_t chunk;
+    uint8_t *p_dst;
+    int32_t status;
+};
+
+/* decodes a compressed capture held in memory (e.g. mapped) through a window of chunks */
+struct iq_compress_reader
+{
+    const uint8_t *p_file;
+    size_t file_size;
+    const struct iq_compress_header *p_hdr;
+    const struct iq_compress_chunk *p_table;
+
+    struct work_pool *p_pool;           /* decodes the chunks of a window in parallel, or NULL */
+    uint32_t read_ahead;                /* number of chunks decoded when the window moves */
+
+    uint8_t *p_window;
+    struct _iq_decompress_job *p_jobs;
+    uint32_t window_capacity;           /* in chunks */
+    uint64_t first_chunk;               /* chunks held in the window */
+    uint32_t nr_window_chunks;
+
+    /* statistics */
+    uint64_t nr_decoded;
+};
+
+/***** INLINE FUNCTIONS  *****/
+
+/*****************************************************************************/
+/** Compress a chunk.
+
+    @param[in]  p_src       data to compress
+    @param[in]  nr_bytes    number of bytes to compress
+    @param[out] p_dst       compressed data, at least nr_bytes long
+
+    @return size of the compressed data, or 0 if it isn't smaller than nr_bytes (the chunk
+    should then be stored raw)
+*/
+static inline uint32_t iq_compress_chunk( const uint8_t *p_src,
+                                          uint32_t nr_bytes,
+                                          uint8_t *p_dst )
+{
+    const uint32_t nr_values = nr_bytes / sizeof(uint16_t);
+    uint16_t prev[2] = { 0, 0 };
+    uint16_t zz[IQ_COMPRESS_GROUP_VALUES];
+    uint32_t out = 0, g;
+
+    for ( g = 0; g < nr_values; g += IQ_COMPRESS_GROUP_VALUES )
+    {
+        uint32_t n = nr_values - g, i, width, nr_packed, nr_bits = 0;
+        uint32_t all = 0;
+        uint64_t acc = 0;
+
+        if ( n > IQ_COMPRESS_GROUP_VALUES )
+        {
+            n = IQ_COMPRESS_GROUP_VALUES;
+        }
+        for ( i = 0; i < n; i++ )
+        {
+            uint16_t v, d;
+
+            memcpy( &v, p_src + ( (size_t)( g + i ) * sizeof(uint16_t) ), sizeof(v) );
+            d = (uint16_t)( v - prev[i & 1] );
+            prev[i & 1] = v;
+            zz[i] = (uint16_t)( ( d << 1 ) ^ (uint16_t)( (int16_t)d >> 15 ) );
+            all |= zz[i];
+        }
+        width = ( all == 0 ) ? 0 : 32 - (uint32_t)__builtin_clz( all );
+        nr_packed = ( ( n * width ) + 7 ) / 8;
+        if ( out + 1 + nr_packed >= nr_bytes )
+        {
+            return 0;
+        }
+
+        p_dst[out++] = (uint8_t)width;
+        for ( i = 0; i < n; i++ )
+        {
+            acc |= (uint64_t)zz[i] << nr_bits;
+            nr_bits += width;
+            if ( nr_bits >= 32 )
+            {
+                p_dst[out] = (uint8_t)acc;
+                p_dst[out + 1] = (uint8_t)( acc >> 8 );
+                p_dst[out + 2] = (uint8_t)( acc >> 16 );
+                p_dst[out + 3] = (uint8_t)( acc >> 24 );
+                out += 4;
+                acc >>= 32;
+                nr_bits -= 32;
+            }
+        }
+        while ( nr_bits > 0 )
+        {
+            p_dst[out++] = (uint8_t)acc;
+            acc >>= 8;
+            nr_bits = ( nr_bits > 8 ) ? nr_bits - 8 : 0;
+        }
+    }
+
+    if ( ( nr_bytes & 1 ) != 0 )
+    {
+        if ( out + 1 >= nr_bytes )
+        {
+            return 0;
+        }
+        p_dst[out++] = p_src[nr_bytes - 1];
+    }
+
+    return out;
+}
+
+/*****************************************************************************/
+/** Decompress a chunk compressed with iq_compress_chunk().
+
+    @param[in]  p_src       compressed data
+    @param[in]  src_size    size of the compressed data
+    @param[out] p_dst       decompressed data
+    @param[in]  nr_bytes    uncompressed size of the chunk
+
+    @return 0 on success, -EINVAL if the compressed data is corrupt
+*/
+static inline int32_t iq_decompress_chunk( const uint8_t *p_src,
+                                           uint32_t src_size,
+                                           uint8_t *p_dst,
+                                           uint32_t nr_bytes )
+{
+    const uint32_t nr_values = nr_bytes / sizeof(uint16_t);
+    uint16_t prev[2] = { 0, 0 };
+    uint32_t in = 0, g;
+
+    for ( g = 0; g < nr_values; g += IQ_COMPRESS_GROUP_VALUES )
+    {
+        uint32_t n = nr_values - g, i, width, mask, nr_bits = 0;
+        uint64_t acc = 0;
+
+        if ( n > IQ_COMPRESS_GROUP_VALUES )
+        {
+            n = IQ_COMPRESS_GROUP_VALUES;
+        }
+        if ( in >= src_size )
+        {
+            return -EINVAL;
+        }
+        width = p_src[in++];
+        if ( ( width > IQ_COMPRESS_MAX_WIDTH ) ||
+             ( ( ( n * width ) + 7 ) / 8 > src_size - in ) )
+        {
+            return -EINVAL;
+        }
+        mask = ( 1u << width ) - 1;
+
+        for ( i = 0; i < n; i++ )
+        {
+            uint16_t z, v;
+
+            while ( nr_bits < width )
+            {
+                acc |= (uint64_t)p_src[in++] << nr_bits;
+                nr_bits += 8;
+            }
+            z = (uint16_t)( acc & mask );
+            acc >>= width;
+            nr_bits -= width;
+
+            v = (uint16_t)( prev[i & 1] + (uint16_t)( ( z >> 1 ) ^ (uint16_t)-( z & 1 ) ) );
+            prev[i & 1] = v;
+            memcpy( p_dst + ( (size_t)( g + i ) * sizeof(uint16_t) ), &v, sizeof(v) );
+        }
+    }
+
+    if ( ( nr_bytes & 1 ) != 0 )
+    {
+        if ( in >= src_size )
+        {
+            return -EINVAL;
+        }
+        p_dst[nr_bytes - 1] = p_src[in++];
+    }
+
+    return ( in == src_size ) ? 0 : -EINVAL;
+}
+
+/*****************************************************************************/
+/** Tell whether a file starts like a compressed capture.
+
+    @param[in]  p_file      contents of the file
+    @param[in]  file_size   size of the file
+
+    @return true if the file is a compressed capture
+*/
+static inline bool iq_compress_detect( const uint8_t *p_file,
+                                       size_t file_size )
+{
+    uint32_t magic;
+
+    if ( ( p_file == NULL ) || ( file_size < sizeof(struct iq_compress_header) ) )
+    {
+        return false;
+    }
+    memcpy( &magic, p_file, sizeof(magic) );
+
+    return ( magic == IQ_COMPRESS_MAGIC );
+}
+
+/* uncompressed size of a chunk, only the last one can be short */
+static inline uint32_t _iq_compress_chunk_size( const struct iq_compress_header *p_hdr,
+                                                uint64_t chunk )
+{
+    uint64_t start = chunk * p_hdr->chunk_size;
+
+    return ( p_hdr->data_size - start < p_hdr->chunk_size ) ?
+        (uint32_t)( p_hdr->data_size - start ) : p_hdr->chunk_size;
+}
+
+static inline void _iq_decompress_job( void *p_arg )
+{
+    struct _iq_decompress_job *j = (struct _iq_decompress_job *)p_arg;
+    const struct iq_compress_reader *r = j->r;
+    const struct iq_compress_chunk *p_chunk = &(r->p_table[j->chunk]);
+    uint32_t nr_bytes = _iq_compress_chunk_size( r->p_hdr, j->chunk );
+
+    if ( ( p_chunk->offset > r->p_hdr->table_offset ) ||
+         ( p_chunk->size > r->p_hdr->table_offset - p_chunk->offset ) )
+    {
+        j->status = -EINVAL;
+    }
+    else if ( ( p_chunk->flags & IQ_COMPRESS_CHUNK_RAW ) != 0 )
+    {
+        if ( p_chunk->size != nr_bytes )
+        {
+            j->status = -EINVAL;
+        }
+        else
+        {
+            memcpy( j->p_dst, r->p_file + p_chunk->offset, nr_bytes );
+            j->status = 0;
+        }
+    }
+    else
+    {
+        j->status = iq_decompress_chunk( r->p_file + p_chunk->offset, p_chunk->size, j->p_dst,
+                                         nr_bytes );
+    }
+}
+
+/*****************************************************************************/
+/** Release a reader opened with iq_compress_reader_open().
+
+    @param[in] r            reader
+*/
+static inline void iq_compress_reader_close( struct iq_compress_reader *r )
+{
+    free( r->p_window );
+    free( r->p_jobs );
+    memset( r, 0, sizeof(*r) );
+}
+
+/*****************************************************************************/
+/** Prepare to read a compressed capture held in memory.
+
+    @param[out] r           reader
+    @param[in]  p_file      contents of the file, must remain valid until the reader is closed
+    @param[in]  file_size   size of the file
+    @param[in]  p_pool      pool to decode chunks on in parallel, or NULL to decode them on the
+                            calling thread
+    @param[in]  read_ahead  number of chunks decoded each time the reader moves past the chunks
+                            it holds, 0 for IQ_COMPRESS_DEFAULT_READ_AHEAD
+
+    @return 0 on success, -EINVAL if the file isn't a complete compressed capture, or -ENOMEM
+*/
+static inline int32_t iq_compress_reader_open( struct iq_compress_reader *r,
+                                               const uint8_t *p_file,
+                                               size_t file_size,
+                                               struct work_pool *p_pool,
+                                               uint32_t read_ahead )
+{
+    const struct iq_compress_header *p_hdr = (const struct iq_compress_header *)p_file;
+
+    memset( r, 0, sizeof(*r) );
+    if ( !iq_compress_detect( p_file, file_size ) ||
+         ( p_hdr->version != IQ_COMPRESS_VERSION ) ||
+         ( p_hdr->codec != IQ_COMPRESS_CODEC_DELTA_PACK ) ||
+         ( p_hdr->chunk_size == 0 ) ||
+         ( p_hdr->nr_chunks != ( p_hdr->data_size + p_hdr->chunk_size - 1 ) / p_hdr->chunk_size ) ||
+         ( p_hdr->table_offset < sizeof(*p_hdr) ) || ( p_hdr->table_offset > file_size ) ||
+         ( p_hdr->nr_chunks > ( file_size - p_hdr->table_offset ) /
+           sizeof(struct iq_compress_chunk) ) )
+    {
+        /* also the case of a capture that wasn't closed */
+        return -EINVAL;
+    }
+
+    r->p_file = p_file;
+    r->file_size = file_size;
+    r->p_hdr = p_hdr;
+    r->p_table = (const struct iq_compress_chunk *)( p_file + p_hdr->table_offset );
+    r->p_pool = p_pool;
+    r->read_ahead = ( read_ahead > 0 ) ? read_ahead : IQ_COMPRESS_DEFAULT_READ_AHEAD;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Get a run of bytes of the uncompressed capture, decoding the chunks it spans (and the
+    following chunks up to the read ahead) if they aren't already held.
+
+    @param[in]  r           reader
+    @param[in]  offset      offset in the uncompressed capture
+    @param[in]  nr_bytes    number of bytes
+
+    @return pointer to the bytes, valid until the next call, or NULL if the range is past the
+    end of the capture, the capture is corrupt or memory ran out
+*/
+static inline const uint8_t *iq_compress_reader_get( struct iq_compress_reader *r,
+                                                     uint64_t offset,
+                                                     uint64_t nr_bytes )
+{
+    const uint32_t chunk_size = r->p_hdr->chunk_size;
+    struct work_group group;
+    uint64_t first, last, nr_chunks, i;
+    bool failed = false;
+
+    if ( ( nr_bytes == 0 ) || ( offset > r->p_hdr->data_size ) ||
+         ( nr_bytes > r->p_hdr->data_size - offset ) )
+    {
+        return NULL;
+    }
+    first = offset / chunk_size;
+    last = ( offset + nr_bytes - 1 ) / chunk_size;
+
+    if ( ( r->nr_window_chunks > 0 ) && ( first >= r->first_chunk ) &&
+         ( last < r->first_chunk + r->nr_window_chunks ) )
+    {
+        return r->p_window + ( offset - ( r->first_chunk * chunk_size ) );
+    }
+
+    nr_chunks = last - first + 1;
+    if ( nr_chunks < r->read_ahead )
+    {
+        nr_chunks = r->read_ahead;
+    }
+    if ( nr_chunks > r->p_hdr->nr_chunks - first )
+    {
+        nr_chunks = r->p_hdr->nr_chunks - first;
+    }
+    if ( nr_chunks > r->window_capacity )
+    {
+        uint8_t *p_window = realloc( r->p_window, nr_chunks * chunk_size );
+        struct _iq_decompress_job *p_jobs;
+
+        if ( p_window == NULL )
+        {
+            return NULL;
+        }
+        r->p_window = p_window;
+        p_jobs = realloc( r->p_jobs, nr_chunks * sizeof(struct _iq_decompress_job) );
+        if ( p_jobs == NULL )
+        {
+            return NULL;
+        }
+        r->p_jobs = p_jobs;
+        r->window_capacity = (uint32_t)nr_chunks;
+    }
+
+    /* the pool may be shared, so only the chunks decoded here are waited on */
+    r->nr_window_chunks = 0;
+    work_group_init( &group );
+    for ( i = 0; i < nr_chunks; i++ )
+    {
+        struct _iq_decompress_job *j = &(r->p_jobs[i]);
+
+        j->r = r;
+        j->chunk = first + i;
+        j->p_dst = r->p_window + ( i * chunk_size );
+        j->status = -EINPROGRESS;
+        if ( ( r->p_pool == NULL ) || ( nr_chunks == 1 ) ||
+             ( work_group_submit( &group, r->p_pool, _iq_decompress_job, j,
+                                  WORK_POOL_ANY_WORKER ) != 0 ) )
+        {
+            _iq_decompress_job( j );
+        }
+    }
+    work_group_wait( &group );
+    work_group_destroy( &group );
+    for ( i = 0; i < nr_chunks; i++ )
+    {
+        failed = failed || ( r->p_jobs[i].status != 0 );
+    }
+    if ( failed )
+    {
+        return NULL;
+    }
+
+    r->first_chunk = first;
+    r->nr_window_chunks = (uint32_t)nr_chunks;
+    r->nr_decoded += nr_chunks;
+
+    return r->p_window + ( offset - ( first * chunk_size ) );
+}
+
+#endif  /* __IQ_COMPRESS_H__ */
@@ -0,0 +1,417 @@
+/**
+ * @file   iq_convert.h
+ *
+ * @brief  Conversion of received int16 I/Q samples to calibrated complex float32 or bfloat16.
+ *
+ * Samples are converted to interleaved complex values, I before Q whatever order the FPGA
+ * delivered them in (see skiq_iq_order_t), and multiplied by a per block scale factor.  The
+ * conversion runs eight samples at a time with AVX2, or four with NEON, where available.
+ *
+ * The scale factor combines full scale and the receive calibration offset of the block's gain
+ * index: a sample of magnitude full_scale converts to 10^(-offset / 20), so that
+ * 10 * log10(I^2 + Q^2) of a converted sample reads dBm (dBFS minus the calibration offset).
+ * Looking up a calibration offset goes through libsidekiq, so iq_cal_cache_fill() reads the
+ * offset of every gain index of a handle once, at the current LO frequency, and the receive path
+ * only indexes the table with the gain index from each block's rfic_control metadata.  A gain
+ * index without calibration data converts to plain fractions of full scale.  Refill the cache
+ * after a retune.
+ */
+
+#ifndef __IQ_CONVERT_H__
+#define __IQ_CONVERT_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <sidekiq_api.h>
+
+#if (defined __x86_64__ || defined __i386__) && (defined __GNUC__) && \
+    ( (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)) || (defined __clang__) )
+#   define IQ_CONVERT_HAVE_AVX2
+#   include <immintrin.h>
+#elif (defined __aarch64__) && (defined __ARM_NEON)
+#   define IQ_CONVERT_HAVE_NEON
+#   include <arm_neon.h>
+#endif
+
+/***** DEFINES *****/
+
+/* gain indexes are the 8-bit rfic_control metadata of a block */
+#define IQ_CAL_NR_GAIN_INDEXES          (256)
+
+/***** TYPEDEFS *****/
+
+/* converts nr_samples int16 I/Q pairs to 2 * nr_samples floats, I first */
+typedef void (*iq_convert_fn)( const int16_t *p_iq,
+                               uint32_t nr_samples,
+                               bool q_first,
+                               float scale,
+                               float *p_out );
+
+/* rounds nr_values floats to bfloat16 */
+typedef void (*iq_convert_bf16_fn)( const float *p_in,
+                                    uint32_t nr_values,
+                                    uint16_t *p_out );
+
+struct iq_cal_cache
+{
+    float scale[IQ_CAL_NR_GAIN_INDEXES];        /* conversion factor of each gain index */
+    double offset_db[IQ_CAL_NR_GAIN_INDEXES];   /* calibration offset, valid entries only */
+    bool valid[IQ_CAL_NR_GAIN_INDEXES];         /* calibration data was found */
+    uint32_t nr_valid;
+    float full_scale_scale;                     /* 1 / full scale */
+};
+
+/***** INLINE FUNCTIONS  *****/
+
+/*****************************************************************************/
+/** Initialize a cache without calibration data, every gain index converts to fractions of
+    full scale.
+
+    @param[out] c           cache
+    @param[in]  resolution  RX IQ resolution in bits, which sets full scale
+
+    @return 0 on success, -EINVAL for an unsupported resolution
+*/
+static inline int32_t iq_cal_cache_init( struct iq_cal_cache *c,
+                                         uint8_t resolution )
+{
+    uint32_t i;
+
+    memset( c, 0, sizeof(*c) );
+    if ( ( resolution == 0 ) || ( resolution > 16 ) )
+    {
+        return -EINVAL;
+    }
+    c->full_scale_scale = 1.0f / (float)( 1u << ( resolution - 1 ) );
+    for ( i = 0; i < IQ_CAL_NR_GAIN_INDEXES; i++ )
+    {
+        c->scale[i] = c->full_scale_scale;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Read the calibration offset of every gain index of a handle at its current LO frequency.
+    Gain indexes without calibration data keep their previous scale.
+
+    @param[in] c            cache initialized with iq_cal_cache_init()
+    @param[in] card         card of the handle
+    @param[in] hdl          receive handle
+
+    @return number of gain indexes with calibration data, or the status of
+    skiq_read_rx_gain_index_range()
+*/
+static inline int32_t iq_cal_cache_fill( struct iq_cal_cache *c,
+                                         uint8_t card,
+                                         skiq_rx_hdl_t hdl )
+{
+    uint8_t min_index = 0, max_index = 0;
+    uint32_t i;
+    int32_t status;
+
+    status = skiq_read_rx_gain_index_range( card, hdl, &min_index, &max_index );
+    if ( status != 0 )
+    {
+        return status;
+    }
+
+    c->nr_valid = 0;
+    for ( i = min_index; i <= max_index; i++ )
+    {
+        double offset;
+
+        c->valid[i] = ( skiq_read_rx_cal_offset_by_gain_index( card, hdl, (uint8_t)i,
+                                                               &offset ) == 0 );
+        if ( c->valid[i] )
+        {
+            c->offset_db[i] = offset;
+            c->scale[i] = (float)( c->full_scale_scale * pow( 10.0, -offset / 20.0 ) );
+            c->nr_valid++;
+        }
+        else
+        {
+            c->scale[i] = c->full_scale_scale;
+        }
+    }
+
+    return (int32_t)c->nr_valid;
+}
+
+/*****************************************************************************/
+/** Conversion factor of a gain index.
+
+    @param[in] c            cache
+    @param[in] gain_index   gain index, e.g. the rfic_control of a block
+
+    @return the factor applied to the int16 samples
+*/
+static inline float iq_cal_cache_scale( const struct iq_cal_cache *c,
+                                        uint8_t gain_index )
+{
+    return c->scale[gain_index];
+}
+
+/*****************************************************************************/
+/** Calibration offset of a gain index.
+
+    @param[in]  c           cache
+    @param[in]  gain_index  gain index
+    @param[out] p_offset_db calibration offset in dB, only set when there is calibration data
+
+    @return true if the gain index has calibration data
+*/
+static inline bool iq_cal_cache_offset( const struct iq_cal_cache *c,
+                                        uint8_t gain_index,
+                                        double *p_offset_db )
+{
+    if ( c->valid[gain_index] )
+    {
+        *p_offset_db = c->offset_db[gain_index];
+    }
+
+    return c->valid[gain_index];
+}
+
+static inline void _iq_convert_scalar( const int16_t *p_iq,
+                                       uint32_t nr_samples,
+                                       bool q_first,
+                                       float scale,
+                                       float *p_out )
+{
+    const uint32_t i_offset = q_first ? 1 : 0;
+    uint32_t i;
+
+    for ( i = 0; i < nr_samples; i++ )
+    {
+        p_out[2 * i] = (float)p_iq[2 * i + i_offset] * scale;
+        p_out[2 * i + 1] = (float)p_iq[2 * i + ( 1 - i_offset )] * scale;
+    }
+}
+
+/* round to nearest even by adding half an ulp of bfloat16 (plus the lsb) before truncating */
+static inline void _iq_convert_bf16_scalar( const float *p_in,
+                                            uint32_t nr_values,
+                                            uint16_t *p_out )
+{
+    uint32_t i;
+
+    for ( i = 0; i < nr_values; i++ )
+    {
+        uint32_t bits;
+
+        memcpy( &bits, &(p_in[i]), sizeof(bits) );
+        p_out[i] = (uint16_t)( ( bits + 0x7FFF + ( ( bits >> 16 ) & 1 ) ) >> 16 );
+    }
+}
+
+/*
+  Each 32-bit lane holds one sample, so rotating the lane by 16 bits swaps Q and I.  The 16
+  values are then sign extended to two vectors of 8 int32 and converted.
+*/
+#if (defined IQ_CONVERT_HAVE_AVX2)
+__attribute__((target("avx2")))
+static inline void _iq_convert_avx2( const int16_t *p_iq,
+                                     uint32_t nr_samples,
+                                     bool q_first,
+                                     float scale,
+                                     float *p_out )
+{
+    const __m256 s = _mm256_set1_ps( scale );
+    uint32_t i = 0;
+
+    for ( ; i + 8 <= nr_samples; i += 8 )
+    {
+        __m256i v = _mm256_loadu_si256( (const __m256i *)(p_iq + 2 * i) );
+        __m256 lo, hi;
+
+        if ( q_first )
+        {
+            v = _mm256_or_si256( _mm256_slli_epi32( v, 16 ), _mm256_srli_epi32( v, 16 ) );
+        }
+        lo = _mm256_cvtepi32_ps( _mm256_cvtepi16_epi32( _mm256_castsi256_si128( v ) ) );
+        hi = _mm256_cvtepi32_ps( _mm256_cvtepi16_epi32( _mm256_extracti128_si256( v, 1 ) ) );
+        _mm256_storeu_ps( p_out + 2 * i, _mm256_mul_ps( lo, s ) );
+        _mm256_storeu_ps( p_out + 2 * i + 8, _mm256_mul_ps( hi, s ) );
+    }
+
+    _iq_convert_scalar( p_iq + 2 * i, nr_samples - i, q_first, scale, p_out + 2 * i );
+}
+
+/* packus works within 128-bit lanes, the permute puts the two halves back in order */
+__attribute__((target("avx2")))
+static inline void _iq_convert_bf16_avx2( const float *p_in,
+                                          uint32_t nr_values,
+                                          uint16_t *p_out )
+{
+    const __m256i half = _mm256_set1_epi32( 0x7FFF );
+    const __m256i one = _mm256_set1_epi32( 1 );
+    uint32_t i = 0;
+
+    for ( ; i + 16 <= nr_values; i += 16 )
+    {
+        __m256i a = _mm256_castps_si256( _mm256_loadu_ps( p_in + i ) );
+        __m256i b = _mm256_castps_si256( _mm256_loadu_ps( p_in + i + 8 ) );
+
+        a = _mm256_add_epi32( a, _mm256_add_epi32( half, _mm256_and_si256(
+                                                       _mm256_srli_epi32( a, 16 ), one ) ) );
+        b = _mm256_add_epi32( b, _mm256_add_epi32( half, _mm256_and_si256(
+                                                       _mm256_srli_epi32( b, 16 ), one ) ) );
+        a = _mm256_packus_epi32( _mm256_srli_epi32( a, 16 ), _mm256_srli_epi32( b, 16 ) );
+        _mm256_storeu_si256( (__m256i *)(p_out + i), _mm256_permute4x64_epi64( a, 0xD8 ) );
+    }
+
+    _iq_convert_bf16_scalar( p_in + i, nr_values - i, p_out + i );
+}
+#endif  /* IQ_CONVERT_HAVE_AVX2 */
+
+#if (defined IQ_CONVERT_HAVE_NEON)
+static inline void _iq_convert_neon( const int16_t *p_iq,
+                                     uint32_t nr_samples,
+                                     bool q_first,
+                                     float scale,
+                                     float *p_out )
+{
+    uint32_t i = 0;
+
+    for ( ; i + 4 <= nr_samples; i += 4 )
+    {
+        int16x8_t v = vld1q_s16( p_iq + 2 * i );
+
+        if ( q_first )
+        {
+            v = vrev32q_s16( v );
+        }
+        vst1q_f32( p_out + 2 * i,
+                   vmulq_n_f32( vcvtq_f32_s32( vmovl_s16( vget_low_s16( v ) ) ), scale ) );
+        vst1q_f32( p_out + 2 * i + 4,
+                   vmulq_n_f32( vcvtq_f32_s32( vmovl_s16( vget_high_s16( v ) ) ), scale ) );
+    }
+
+    _iq_convert_scalar( p_iq + 2 * i, nr_samples - i, q_first, scale, p_out + 2 * i );
+}
+
+static inline void _iq_convert_bf16_neon( const float *p_in,
+                                          uint32_t nr_values,
+                                          uint16_t *p_out )
+{
+    const uint32x4_t half = vdupq_n_u32( 0x7FFF );
+    const uint32x4_t one = vdupq_n_u32( 1 );
+    uint32_t i = 0;
+
+    for ( ; i + 4 <= nr_values; i += 4 )
+    {
+        uint32x4_t v = vreinterpretq_u32_f32( vld1q_f32( p_in + i ) );
+
+        v = vaddq_u32( v, vaddq_u32( half, vandq_u32( vshrq_n_u32( v, 16 ), one ) ) );
+        vst1_u16( p_out + i, vshrn_n_u32( v, 16 ) );
+    }
+
+    _iq_convert_bf16_scalar( p_in + i, nr_values - i, p_out + i );
+}
+#endif  /* IQ_CONVERT_HAVE_NEON */
+
+/*****************************************************************************/
+/** Select (on first call) and return the fastest conversion kernels available on this host.
+
+    @param[out] p_bf16      optional, set to the matching bfloat16 rounding kernel
+    @param[out] pp_name     optional, set to a string naming the selected kernels
+
+    @return the selected float32 conversion kernel
+*/
+static inline iq_convert_fn iq_convert_select( iq_convert_bf16_fn *p_bf16,
+                                               const char **pp_name )
+{
+    static iq_convert_fn p_fn = NULL;
+    static iq_convert_bf16_fn p_bf16_fn = NULL;
+    static const char *p_name = NULL;
+
+    if ( p_fn == NULL )
+    {
+        p_bf16_fn = _iq_convert_bf16_scalar;
+        p_name = "scalar";
+#if (defined IQ_CONVERT_HAVE_AVX2)
+        __builtin_cpu_init();
+        if ( __builtin_cpu_supports("avx2") )
+        {
+            p_bf16_fn = _iq_convert_bf16_avx2;
+            p_name = "avx2";
+            p_fn = _iq_convert_avx2;
+        }
+        else
+        {
+            p_fn = _iq_convert_scalar;
+        }
+#elif (defined IQ_CONVERT_HAVE_NEON)
+        p_bf16_fn = _iq_convert_bf16_neon;
+        p_name = "neon";
+        p_fn = _iq_convert_neon;
+#else
+        p_fn = _iq_convert_scalar;
+#endif
+    }
+
+    if ( p_bf16 != NULL )
+    {
+        *p_bf16 = p_bf16_fn;
+    }
+    if ( pp_name != NULL )
+    {
+        *pp_name = p_name;
+    }
+
+    return p_fn;
+}
+
+/*****************************************************************************/
+/** Convert samples to calibrated complex float32.
+
+    @param[in]  p_iq        16-bit samples, two per complex sample
+    @param[in]  nr_samples  number of complex samples
+    @param[in]  q_first     the samples are ordered Q then I (skiq_iq_order_qi)
+    @param[in]  scale       factor from iq_cal_cache_scale()
+    @param[out] p_out       2 * nr_samples floats, I first
+
+    @return void
+*/
+static inline void iq_convert_cf32( const int16_t *p_iq,
+                                    uint32_t nr_samples,
+                                    bool q_first,
+                                    float scale,
+                                    float *p_out )
+{
+    iq_convert_select( NULL, NULL )( p_iq, nr_samples, q_first, scale, p_out );
+}
+
+/*****************************************************************************/
+/** Convert samples to calibrated complex bfloat16, through float32.
+
+    @param[in]  p_iq        16-bit samples, two per complex sample
+    @param[in]  nr_samples  number of complex samples
+    @param[in]  q_first     the samples are ordered Q then I (skiq_iq_order_qi)
+    @param[in]  scale       factor from iq_cal_cache_scale()
+    @param[out] p_work      2 * nr_samples floats of scratch
+    @param[out] p_out       2 * nr_samples bfloat16 values, I first
+
+    @return void
+*/
+static inline void iq_convert_bf16( const int16_t *p_iq,
+                                    uint32_t nr_samples,
+                                    bool q_first,
+                                    float scale,
+                                    float *p_work,
+                                    uint16_t *p_out )
+{
+    iq_convert_bf16_fn p_bf16 = NULL;
+
+    iq_convert_select( &p_bf16, NULL )( p_iq, nr_samples, q_first, scale, p_work );
+    p_bf16( p_work, 2 * nr_samples, p_out );
+}
+
+#endif  /* __IQ_CONVERT_H__ */
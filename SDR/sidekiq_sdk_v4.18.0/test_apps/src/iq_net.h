@@ -0,0 +1,686 @@
+/**
+ * @file   iq_net.h
+ *
+ * @brief  Streaming of received blocks over UDP, as VITA-49 IF data packets or in a simple
+ *         framing, and parsing of those datagrams on the receiving side.
+ *
+ * Each block is cut into datagrams that fit the MTU, and each datagram carries the RF timestamp
+ * of its first sample, so a receiver can place every datagram on its own and detect loss from
+ * the timestamps.  Two formats are supported:
+ *
+ * - iq_net_format_vita49: VITA-49.0 IF data packets with a stream identifier (the receive
+ *   handle), no integer timestamp and a sample count fractional timestamp (the RF timestamp).
+ *   The header and the samples are big-endian and the samples are 16-bit I then Q, as the
+ *   standard expects; packed blocks must be unpacked first.
+ *
+ * - iq_net_format_raw: a little-endian struct iq_net_header followed by the payload exactly as
+ *   received (Q first unless the FPGA was set to I first, packed or not), so the sender does
+ *   no per-sample work.  Packed payloads are split on 3 word (4 sample) boundaries.
+ *
+ * Datagrams are staged in a buffer and sent in batches with sendmmsg(), one system call per
+ * IQ_NET_BATCH datagrams.  With generic segmentation offload (UDP_SEGMENT, Linux 4.18 and
+ * later) the datagrams of a block are instead handed to the kernel as a single message that is
+ * split into datagrams by the kernel or the NIC; if the socket doesn't support it the sink falls
+ * back to one message per datagram.  The destination may be a multicast group, so that several
+ * machines receive the same stream.
+ *
+ * sendmmsg() and recvmmsg() are GNU extensions: define _GNU_SOURCE before including any
+ * system header.
+ */
+
+#ifndef __IQ_NET_H__
+#define __IQ_NET_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+
+#if (!defined __MINGW32__)
+#   include <sys/types.h>
+#   include <sys/socket.h>
+#   include <netinet/in.h>
+#   include <arpa/inet.h>
+#   include <netdb.h>
+#endif
+
+#include <sidekiq_api.h>
+
+#include "iq_unpack.h"
+
+#if (!defined __MINGW32__)
+
+/***** DEFINES *****/
+
+/* from linux/udp.h, not exported by every libc */
+#ifndef SOL_UDP
+#   define SOL_UDP                      (17)
+#endif
+#ifndef UDP_SEGMENT
+#   define UDP_SEGMENT                  (103)
+#endif
+
+/* "IQN1", the first word of each iq_net_format_raw datagram */
+#define IQ_NET_MAGIC                    (0x314e5149)
+
+/* struct iq_net_header flags */
+#define IQ_NET_FLAG_PACKED              (1 << 0)
+#define IQ_NET_FLAG_IQ_ORDER            (1 << 1)    /* samples are I then Q */
+#define IQ_NET_FLAG_OVERLOAD            (1 << 2)
+
+/* VITA-49 header: IF data packet with stream id, TSI none, TSF sample count */
+#define IQ_NET_VITA49_PACKET_TYPE       (0x1)
+#define IQ_NET_VITA49_TSF_SAMPLE_COUNT  (0x1)
+#define IQ_NET_VITA49_HEADER_WORDS      (4)
+
+/* IPv4 and UDP headers */
+#define IQ_NET_IP_UDP_OVERHEAD          (28)
+
+#define IQ_NET_DEFAULT_MTU              (1500)
+#define IQ_NET_MAX_DATAGRAM             (65507)
+
+/* datagrams per sendmmsg()/recvmmsg() call, and the limits of one segmentation offload send */
+#define IQ_NET_BATCH                    (64)
+#define IQ_NET_GSO_MAX_SEGMENTS         (64)
+#define IQ_NET_GSO_MAX_BYTES            (65000)
+
+/* datagrams and bytes staged before a flush */
+#define IQ_NET_STAGING_DATAGRAMS        (512)
+#define IQ_NET_STAGING_BYTES            (1024 * 1024)
+
+/***** TYPEDEFS *****/
+
+enum iq_net_format
+{
+    iq_net_format_vita49 = 0,
+    iq_net_format_raw,
+};
+
+/* header of an iq_net_format_raw datagram, little-endian */
+struct iq_net_header
+{
+    uint32_t magic;
+    uint32_t seq;                       /* datagrams sent on the stream before this one */
+    uint64_t rf_timestamp;              /* first sample of the datagram */
+    uint64_t sys_timestamp;             /* of the block the datagram was cut from */
+    uint32_t nr_samples;
+    uint8_t stream_id;
+    uint8_t flags;
+    uint16_t reserved;
+};
+
+/* one received datagram, as parsed by iq_net_parse() */
+struct iq_net_frame
+{
+    uint32_t stream_id;
+    uint32_t seq;                       /* 4 bit packet count for VITA-49 */
+    uint64_t rf_timestamp;
+    uint64_t sys_timestamp;             /* 0 for VITA-49 */
+    uint32_t nr_samples;
+    uint8_t flags;
+    const uint8_t *p_payload;           /* samples, big-endian I/Q for VITA-49 */
+    uint32_t nr_payload_bytes;
+};
+
+struct iq_net_sink
+{
+    int fd;
+    enum iq_net_format format;
+    bool gso;                           /* segmentation offload in use */
+    uint32_t max_datagram;              /* bytes of UDP payload per datagram */
+
+    uint8_t *p_staging;
+    uint32_t staged_bytes;
+    uint32_t dgram_offset[IQ_NET_STAGING_DATAGRAMS];
+    uint32_t dgram_len[IQ_NET_STAGING_DATAGRAMS];
+    uint32_t nr_staged;
+
+    uint32_t seq[256];                  /* per stream id */
+
+    /* statistics */
+    uint64_t nr_datagrams;
+    uint64_t nr_bytes;
+    uint64_t nr_send_calls;
+    uint64_t nr_send_errors;            /* datagrams the kernel refused (e.g. ENOBUFS) */
+};
+
+/***** INLINE FUNCTIONS  *****/
+
+/*****************************************************************************/
+/** Resolve "HOST:PORT" to a UDP address.
+
+    @param[in]  p_dest      destination, an IPv4 or IPv6 address or a host name followed by
+                            ":PORT", IPv6 addresses in brackets
+    @param[in]  passive     resolve for bind() rather than connect() (HOST may be empty)
+    @param[out] p_addr      address
+    @param[out] p_addr_len  length of the address
+
+    @return 0 on success, -EINVAL for a malformed destination, -ENOENT if HOST doesn't resolve
+*/
+static inline int32_t iq_net_resolve( const char *p_dest,
+                                      bool passive,
+                                      struct sockaddr_storage *p_addr,
+                                      socklen_t *p_addr_len )
+{
+    char host[256];
+    const char *p_colon = strrchr( p_dest, ':' );
+    struct addrinfo hints, *p_res = NULL;
+    size_t host_len;
+
+    if ( ( p_colon == NULL ) || ( p_colon[1] == '\0' ) )
+    {
+        return -EINVAL;
+    }
+    host_len = p_colon - p_dest;
+    if ( ( host_len >= 2 ) && ( p_dest[0] == '[' ) && ( p_colon[-1] == ']' ) )
+    {
+        p_dest++;
+        host_len -= 2;
+    }
+    if ( host_len >= sizeof(host) )
+    {
+        return -EINVAL;
+    }
+    memcpy( host, p_dest, host_len );
+    host[host_len] = '\0';
+
+    memset( &hints, 0, sizeof(hints) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    if ( ( getaddrinfo( ( host_len > 0 ) ? host : NULL, p_colon + 1, &hints, &p_res ) != 0 ) ||
+         ( p_res == NULL ) )
+    {
+        return -ENOENT;
+    }
+    memcpy( p_addr, p_res->ai_addr, p_res->ai_addrlen );
+    *p_addr_len = p_res->ai_addrlen;
+    freeaddrinfo( p_res );
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Number of samples carried by a full datagram.
+
+    @param[in] format       datagram format
+    @param[in] max_datagram bytes of UDP payload per datagram
+    @param[in] packed       the payload is packed (iq_net_format_raw only)
+
+    @return samples per datagram, a multiple of IQ_UNPACK_SAMPLES_PER_GROUP
+*/
+static inline uint32_t iq_net_samples_per_datagram( enum iq_net_format format,
+                                                    uint32_t max_datagram,
+                                                    bool packed )
+{
+    const uint32_t header = ( format == iq_net_format_vita49 ) ?
+        IQ_NET_VITA49_HEADER_WORDS * sizeof(uint32_t) : sizeof(struct iq_net_header);
+    const uint32_t group_bytes = packed ? IQ_UNPACK_WORDS_PER_GROUP * sizeof(uint32_t) :
+        IQ_UNPACK_SAMPLES_PER_GROUP * sizeof(uint32_t);
+
+    if ( max_datagram <= header + group_bytes )
+    {
+        return IQ_UNPACK_SAMPLES_PER_GROUP;
+    }
+
+    return ( ( max_datagram - header ) / group_bytes ) * IQ_UNPACK_SAMPLES_PER_GROUP;
+}
+
+/*****************************************************************************/
+/** Close a sink opened with iq_net_sink_open(), without flushing it.
+
+    @param[in] s            sink
+
+    @return void
+*/
+static inline void iq_net_sink_close( struct iq_net_sink *s )
+{
+    if ( s->fd >= 0 )
+    {
+        close( s->fd );
+    }
+    free( s->p_staging );
+    memset( s, 0, sizeof(*s) );
+    s->fd = -1;
+}
+
+/*****************************************************************************/
+/** Open a UDP sink.
+
+    @param[out] s           sink
+    @param[in]  p_dest      "HOST:PORT", HOST may be a multicast group
+    @param[in]  format      datagram format
+    @param[in]  mtu         link MTU, the datagrams are sized to fit without IP fragmentation
+    @param[in]  gso         try to use UDP segmentation offload
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t iq_net_sink_open( struct iq_net_sink *s,
+                                        const char *p_dest,
+                                        enum iq_net_format format,
+                                        uint32_t mtu,
+                                        bool gso )
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len = 0;
+    int sndbuf = 8 * 1024 * 1024;
+    int32_t status;
+
+    memset( s, 0, sizeof(*s) );
+    s->fd = -1;
+    if ( ( mtu <= IQ_NET_IP_UDP_OVERHEAD + sizeof(struct iq_net_header) ) ||
+         ( mtu - IQ_NET_IP_UDP_OVERHEAD > IQ_NET_MAX_DATAGRAM ) )
+    {
+        return -EINVAL;
+    }
+    status = iq_net_resolve( p_dest, false, &addr, &addr_len );
+    if ( status != 0 )
+    {
+        return status;
+    }
+
+    s->format = format;
+    s->max_datagram = mtu - IQ_NET_IP_UDP_OVERHEAD;
+    s->p_staging = malloc( IQ_NET_STAGING_BYTES );
+    if ( s->p_staging == NULL )
+    {
+        return -ENOMEM;
+    }
+    s->fd = socket( addr.ss_family, SOCK_DGRAM, 0 );
+    if ( ( s->fd < 0 ) || ( connect( s->fd, (struct sockaddr *)&addr, addr_len ) != 0 ) )
+    {
+        status = -errno;
+        iq_net_sink_close( s );
+        return status;
+    }
+    (void)setsockopt( s->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf) );
+    if ( addr.ss_family == AF_INET )
+    {
+        const struct sockaddr_in *p_in = (const struct sockaddr_in *)&addr;
+        unsigned char ttl = 8;
+
+        if ( IN_MULTICAST( ntohl( p_in->sin_addr.s_addr ) ) )
+        {
+            (void)setsockopt( s->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl) );
+        }
+    }
+
+    if ( gso )
+    {
+        /* probe, segments are requested per message */
+        int seg = (int)s->max_datagram;
+
+        s->gso = ( setsockopt( s->fd, SOL_UDP, UDP_SEGMENT, &seg, sizeof(seg) ) == 0 );
+        seg = 0;
+        (void)setsockopt( s->fd, SOL_UDP, UDP_SEGMENT, &seg, sizeof(seg) );
+    }
+
+    return 0;
+}
+
+/* queue the staged datagrams as messages: one per datagram, or with segmentation offload one
+   per run of equally sized datagrams (the last of a run may be shorter) */
+static inline uint32_t _iq_net_sink_messages( const struct iq_net_sink *s,
+                                              uint32_t first,
+                                              struct mmsghdr *p_msgs,
+                                              struct iovec *p_iov,
+                                              char (*p_ctrl)[CMSG_SPACE(sizeof(uint16_t))],
+                                              uint32_t *p_nr_dgrams )
+{
+    uint32_t nr_msgs = 0, d = first;
+
+    while ( ( d < s->nr_staged ) && ( nr_msgs < IQ_NET_BATCH ) )
+    {
+        struct msghdr *p_hdr = &(p_msgs[nr_msgs].msg_hdr);
+        const uint32_t seg = s->dgram_len[d];
+        uint32_t nr = 1, bytes = seg;
+
+        if ( s->gso )
+        {
+            /* datagrams are staged back to back, so a run is contiguous */
+            while ( ( d + nr < s->nr_staged ) && ( nr < IQ_NET_GSO_MAX_SEGMENTS ) &&
+                    ( bytes + s->dgram_len[d + nr] <= IQ_NET_GSO_MAX_BYTES ) &&
+                    ( s->dgram_len[d + nr] <= seg ) )
+            {
+                bytes += s->dgram_len[d + nr];
+                nr++;
+                if ( s->dgram_len[d + nr - 1] < seg )
+                {
+                    break;
+                }
+            }
+        }
+
+        memset( p_hdr, 0, sizeof(*p_hdr) );
+        p_iov[nr_msgs].iov_base = s->p_staging + s->dgram_offset[d];
+        p_iov[nr_msgs].iov_len = bytes;
+        p_hdr->msg_iov = &(p_iov[nr_msgs]);
+        p_hdr->msg_iovlen = 1;
+        if ( nr > 1 )
+        {
+            struct cmsghdr *p_cmsg;
+            uint16_t seg16 = (uint16_t)seg;
+
+            p_hdr->msg_control = p_ctrl[nr_msgs];
+            p_hdr->msg_controllen = sizeof(p_ctrl[nr_msgs]);
+            p_cmsg = CMSG_FIRSTHDR( p_hdr );
+            p_cmsg->cmsg_level = SOL_UDP;
+            p_cmsg->cmsg_type = UDP_SEGMENT;
+            p_cmsg->cmsg_len = CMSG_LEN( sizeof(uint16_t) );
+            memcpy( CMSG_DATA( p_cmsg ), &seg16, sizeof(seg16) );
+        }
+        p_nr_dgrams[nr_msgs] = nr;
+        nr_msgs++;
+        d += nr;
+    }
+
+    return nr_msgs;
+}
+
+/*****************************************************************************/
+/** Send every staged datagram.
+
+    @param[in] s            sink
+
+    @return 0 on success, else a negative errno from sendmmsg() other than a full socket buffer
+    (datagrams dropped because of a full buffer are counted in nr_send_errors)
+*/
+static inline int32_t iq_net_sink_flush( struct iq_net_sink *s )
+{
+    struct mmsghdr msgs[IQ_NET_BATCH];
+    struct iovec iov[IQ_NET_BATCH];
+    char ctrl[IQ_NET_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+    uint32_t nr_dgrams[IQ_NET_BATCH];
+    uint32_t first = 0;
+    int32_t status = 0;
+
+    while ( first < s->nr_staged )
+    {
+        uint32_t nr_msgs = _iq_net_sink_messages( s, first, msgs, iov, ctrl, nr_dgrams );
+        uint32_t m = 0;
+
+        while ( m < nr_msgs )
+        {
+            int nr_sent = sendmmsg( s->fd, &(msgs[m]), nr_msgs - m, 0 );
+
+            s->nr_send_calls++;
+            if ( nr_sent < 0 )
+            {
+                if ( errno == EINTR )
+                {
+                    continue;
+                }
+                if ( ( errno == EIO || errno == EINVAL ) && s->gso )
+                {
+                    /* the route doesn't support segmentation offload, resend one by one */
+                    s->gso = false;
+                    nr_msgs = m;
+                    break;
+                }
+                if ( ( errno != ENOBUFS ) && ( errno != EAGAIN ) && ( errno != ECONNREFUSED ) )
+                {
+                    status = -errno;
+                }
+                /* drop the message rather than stall the receive path */
+                s->nr_send_errors += nr_dgrams[m];
+                first += nr_dgrams[m];
+                m++;
+                if ( status != 0 )
+                {
+                    break;
+                }
+                continue;
+            }
+            for ( ; nr_sent > 0; nr_sent--, m++ )
+            {
+                s->nr_datagrams += nr_dgrams[m];
+                s->nr_bytes += iov[m].iov_len;
+                first += nr_dgrams[m];
+            }
+        }
+        if ( status != 0 )
+        {
+            break;
+        }
+    }
+
+    s->nr_staged = 0;
+    s->staged_bytes = 0;
+
+    return status;
+}
+
+/* byte swap samples to big-endian I then Q, q_first for the default Q then I order */
+static inline void _iq_net_vita49_samples( uint32_t *p_dst,
+                                           const uint32_t *p_src,
+                                           uint32_t nr_samples,
+                                           bool q_first )
+{
+    uint32_t i;
+
+    for ( i = 0; i < nr_samples; i++ )
+    {
+        /* a Q first sample is (I << 16) | Q in a little-endian word */
+        uint32_t w = q_first ? p_src[i] : ( ( p_src[i] << 16 ) | ( p_src[i] >> 16 ) );
+
+        p_dst[i] = __builtin_bswap32( w );
+    }
+}
+
+/*****************************************************************************/
+/** Cut a block into datagrams and stage them, flushing first when the staging buffer is full.
+
+    @param[in] s            sink
+    @param[in] stream_id    stream identifier, e.g. the receive handle
+    @param[in] p_payload    payload of the block, unpacked for iq_net_format_vita49
+    @param[in] nr_samples   number of samples in the payload
+    @param[in] packed       the payload is packed
+    @param[in] iq_order     the samples are I then Q
+    @param[in] overload     the RF input was overloaded during the block
+    @param[in] rf_timestamp RF timestamp of the first sample
+    @param[in] sys_timestamp system timestamp of the block
+
+    @return 0 on success, -EINVAL for a packed VITA-49 payload, else the status of a flush
+*/
+static inline int32_t iq_net_sink_block( struct iq_net_sink *s,
+                                         uint8_t stream_id,
+                                         const uint32_t *p_payload,
+                                         uint32_t nr_samples,
+                                         bool packed,
+                                         bool iq_order,
+                                         bool overload,
+                                         uint64_t rf_timestamp,
+                                         uint64_t sys_timestamp )
+{
+    const uint32_t per_dgram = iq_net_samples_per_datagram( s->format, s->max_datagram, packed );
+    uint32_t done = 0;
+    int32_t status = 0;
+
+    if ( packed && ( s->format == iq_net_format_vita49 ) )
+    {
+        return -EINVAL;
+    }
+
+    while ( done < nr_samples )
+    {
+        const uint32_t nr = ( nr_samples - done < per_dgram ) ? nr_samples - done : per_dgram;
+        const uint32_t payload_bytes = packed ?
+            SKIQ_NUM_WORDS_IN_PACKED_BLOCK( nr ) * (uint32_t)sizeof(uint32_t) :
+            nr * (uint32_t)sizeof(uint32_t);
+        const uint32_t *p_src = packed ?
+            p_payload + ( done / IQ_UNPACK_SAMPLES_PER_GROUP ) * IQ_UNPACK_WORDS_PER_GROUP :
+            p_payload + done;
+        uint32_t header_bytes, len;
+        uint8_t *p_dgram;
+
+        header_bytes = ( s->format == iq_net_format_vita49 ) ?
+            IQ_NET_VITA49_HEADER_WORDS * sizeof(uint32_t) : sizeof(struct iq_net_header);
+        len = header_bytes + payload_bytes;
+        if ( ( s->nr_staged == IQ_NET_STAGING_DATAGRAMS ) ||
+             ( s->staged_bytes + len > IQ_NET_STAGING_BYTES ) )
+        {
+            status = iq_net_sink_flush( s );
+            if ( status != 0 )
+            {
+                return status;
+            }
+        }
+        p_dgram = s->p_staging + s->staged_bytes;
+
+        if ( s->format == iq_net_format_vita49 )
+        {
+            uint32_t hdr[IQ_NET_VITA49_HEADER_WORDS];
+            const uint32_t nr_words = len / sizeof(uint32_t);
+
+            hdr[0] = __builtin_bswap32( ( IQ_NET_VITA49_PACKET_TYPE << 28 ) |
+                                        ( IQ_NET_VITA49_TSF_SAMPLE_COUNT << 20 ) |
+                                        ( ( s->seq[stream_id] & 0xF ) << 16 ) |
+                                        ( nr_words & 0xFFFF ) );
+            hdr[1] = __builtin_bswap32( stream_id );
+            hdr[2] = __builtin_bswap32( (uint32_t)( rf_timestamp >> 32 ) );
+            hdr[3] = __builtin_bswap32( (uint32_t)rf_timestamp );
+            memcpy( p_dgram, hdr, sizeof(hdr) );
+            _iq_net_vita49_samples( (uint32_t *)( p_dgram + header_bytes ), p_src, nr,
+                                    !iq_order );
+        }
+        else
+        {
+            struct iq_net_header hdr = {
+                .magic = IQ_NET_MAGIC,
+                .seq = s->seq[stream_id],
+                .rf_timestamp = rf_timestamp,
+                .sys_timestamp = sys_timestamp,
+                .nr_samples = nr,
+                .stream_id = stream_id,
+                .flags = ( packed ? IQ_NET_FLAG_PACKED : 0 ) |
+                         ( iq_order ? IQ_NET_FLAG_IQ_ORDER : 0 ) |
+                         ( overload ? IQ_NET_FLAG_OVERLOAD : 0 ),
+                .reserved = 0,
+            };
+
+            memcpy( p_dgram, &hdr, sizeof(hdr) );
+            memcpy( p_dgram + header_bytes, p_src, payload_bytes );
+        }
+
+        s->dgram_offset[s->nr_staged] = s->staged_bytes;
+        s->dgram_len[s->nr_staged] = len;
+        s->nr_staged++;
+        s->staged_bytes += len;
+        s->seq[stream_id]++;
+        rf_timestamp += nr;
+        done += nr;
+    }
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Parse a received datagram.
+
+    @param[in]  format      datagram format
+    @param[in]  p_dgram     datagram
+    @param[in]  len         length of the datagram in bytes
+    @param[out] p_frame     parsed datagram, the payload points into p_dgram
+
+    @return 0 on success, -EBADMSG if the datagram isn't in the format or is truncated
+*/
+static inline int32_t iq_net_parse( enum iq_net_format format,
+                                    const uint8_t *p_dgram,
+                                    uint32_t len,
+                                    struct iq_net_frame *p_frame )
+{
+    memset( p_frame, 0, sizeof(*p_frame) );
+
+    if ( format == iq_net_format_vita49 )
+    {
+        uint32_t hdr[IQ_NET_VITA49_HEADER_WORDS], i;
+
+        if ( len < sizeof(hdr) )
+        {
+            return -EBADMSG;
+        }
+        memcpy( hdr, p_dgram, sizeof(hdr) );
+        for ( i = 0; i < IQ_NET_VITA49_HEADER_WORDS; i++ )
+        {
+            hdr[i] = __builtin_bswap32( hdr[i] );
+        }
+        if ( ( ( hdr[0] >> 28 ) != IQ_NET_VITA49_PACKET_TYPE ) ||
+             ( ( ( hdr[0] >> 20 ) & 0x3 ) != IQ_NET_VITA49_TSF_SAMPLE_COUNT ) ||
+             ( ( hdr[0] & 0xFFFF ) * sizeof(uint32_t) > len ) ||
+             ( ( hdr[0] & 0xFFFF ) < IQ_NET_VITA49_HEADER_WORDS ) )
+        {
+            return -EBADMSG;
+        }
+        p_frame->seq = ( hdr[0] >> 16 ) & 0xF;
+        p_frame->stream_id = hdr[1];
+        p_frame->rf_timestamp = ( (uint64_t)hdr[2] << 32 ) | hdr[3];
+        p_frame->nr_samples = ( hdr[0] & 0xFFFF ) - IQ_NET_VITA49_HEADER_WORDS;
+        p_frame->flags = IQ_NET_FLAG_IQ_ORDER;
+        p_frame->p_payload = p_dgram + sizeof(hdr);
+        p_frame->nr_payload_bytes = p_frame->nr_samples * sizeof(uint32_t);
+    }
+    else
+    {
+        struct iq_net_header hdr;
+
+        if ( len < sizeof(hdr) )
+        {
+            return -EBADMSG;
+        }
+        memcpy( &hdr, p_dgram, sizeof(hdr) );
+        p_frame->nr_payload_bytes = len - sizeof(hdr);
+        if ( ( hdr.magic != IQ_NET_MAGIC ) ||
+             ( p_frame->nr_payload_bytes != ( ( hdr.flags & IQ_NET_FLAG_PACKED ) ?
+                                              SKIQ_NUM_WORDS_IN_PACKED_BLOCK( hdr.nr_samples ) :
+                                              hdr.nr_samples ) * sizeof(uint32_t) ) )
+        {
+            return -EBADMSG;
+        }
+        p_frame->seq = hdr.seq;
+        p_frame->stream_id = hdr.stream_id;
+        p_frame->rf_timestamp = hdr.rf_timestamp;
+        p_frame->sys_timestamp = hdr.sys_timestamp;
+        p_frame->nr_samples = hdr.nr_samples;
+        p_frame->flags = hdr.flags;
+        p_frame->p_payload = p_dgram + sizeof(hdr);
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Convert the big-endian I then Q samples of a VITA-49 datagram to 16-bit samples in the
+    order the receive applications write them.
+
+    @param[out] p_dst       nr_samples words
+    @param[in]  p_src       payload from iq_net_parse()
+    @param[in]  nr_samples  number of samples
+    @param[in]  iq_order    write I then Q rather than Q then I
+
+    @return void
+*/
+static inline void iq_net_vita49_to_host( uint32_t *p_dst,
+                                          const uint8_t *p_src,
+                                          uint32_t nr_samples,
+                                          bool iq_order )
+{
+    uint32_t i;
+
+    for ( i = 0; i < nr_samples; i++ )
+    {
+        uint32_t w;
+
+        memcpy( &w, p_src + ( i * sizeof(uint32_t) ), sizeof(w) );
+        w = __builtin_bswap32( w );
+        p_dst[i] = iq_order ? ( ( w << 16 ) | ( w >> 16 ) ) : w;
+    }
+}
+
+#endif  /* __MINGW32__ */
+
+#endif  /* __IQ_NET_H__ */
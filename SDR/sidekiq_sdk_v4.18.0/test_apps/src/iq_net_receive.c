@@ -0,0 +1,429 @@
+/*! \file iq_net_receive.c
+ * \brief This file contains an application that receives the UDP sample
+ * stream sent by rx_samples --net and writes it to a file.
+ *
+ * <pre>
+ * Copyright 2014-2021 Epiq Solutions, All Rights Reserved
+ * </pre>
+ */
+
+#if (!defined _GNU_SOURCE)
+#define _GNU_SOURCE         /* for recvmmsg, see feature_test_macros(7) */
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <sidekiq_api.h>
+#include <arg_parser.h>
+
+#include "iq_net.h"
+#include "iq_unpack.h"
+#include "elapsed.h"
+
+/* receive timeout, how often the run time and Ctrl-C are checked */
+#define RECEIVE_TIMEOUT_US      (100000)
+
+/* receive buffer of each datagram, a multiple of 64 bytes so that every payload is word
+   aligned */
+#define RECEIVE_SLOT_BYTES      ((IQ_NET_MAX_DATAGRAM + 63) & ~63)
+
+/* number of stream identifiers tracked */
+#define MAX_STREAMS             (256)
+
+/* https://gcc.gnu.org/onlinedocs/gcc-4.8.5/cpp/Stringification.html */
+#define xstr(s)                         str(s)
+#define str(s)                          #s
+
+/* these are used to provide help strings for the application when running it
+   with either the "-h" or "--help" flags */
+static const char* p_help_short = "- receive samples streamed by rx_samples --net";
+static const char* p_help_long = "\
+Listens on UDP port '--port' for the datagrams sent by rx_samples --net and\n\
+writes the samples of stream '--stream' (the receive handle, 0 for A1) to\n\
+'--destination' as 16-bit I/Q pairs, Q first, or I first with '--iq'.\n\
+Packed datagrams are unpacked.  With '--group', the multicast group is\n\
+joined first.\n\
+\n\
+The RF timestamp of every datagram is checked against the one expected from\n\
+the previous datagram of the same stream; every mismatch is reported as a\n\
+gap (lost or reordered datagrams) and counted.  The samples of a gap are not\n\
+filled in.  Statistics are printed every second.\n\
+\n\
+Datagrams are read in batches of " xstr(IQ_NET_BATCH) " with recvmmsg().\n\
+\n\
+Defaults:\n\
+  --format=vita49\n\
+  --stream=0\n\
+  --time=0 (until Ctrl-C)";
+
+/* command line argument variables */
+static uint32_t port = 0;
+static char* p_group = NULL;
+static char* p_format = "vita49";
+static char* p_destination = NULL;
+static uint32_t stream_id = 0;
+static uint32_t run_time = 0;
+static bool iq_first = false;
+
+/* variable used to signal force quit of application */
+static volatile bool running = true;
+
+/* the command line arguments available to this application */
+static struct application_argument p_args[] =
+{
+    APP_ARG_REQ("port",
+                'p',
+                "UDP port to listen on",
+                "PORT",
+                &port,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("group",
+                'g',
+                "Multicast group to join",
+                "ADDR",
+                &p_group,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("format",
+                0,
+                "Datagram format (vita49 or raw)",
+                "FORMAT",
+                &p_format,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("destination",
+                'd',
+                "Output file, the datagrams are only checked without one",
+                "PATH",
+                &p_destination,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("stream",
+                0,
+                "Stream identifier to write",
+                "N",
+                &stream_id,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("time",
+                't',
+                "Number of seconds to receive for, 0 until Ctrl-C",
+                "SECONDS",
+                &run_time,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("iq",
+                0,
+                "Write I before Q",
+                NULL,
+                &iq_first,
+                BOOL_VAR_TYPE),
+    APP_ARG_TERMINATOR,
+};
+
+/* per stream continuity */
+struct stream_stats
+{
+    bool seen;
+    uint64_t next_ts;
+    uint64_t nr_datagrams;
+    uint64_t nr_samples;
+    uint64_t nr_gaps;
+    uint64_t nr_overloads;
+};
+
+/*****************************************************************************/
+/** This is the cleanup handler to ensure that the app properly exits and
+    does the needed cleanup if it ends unexpectedly.
+
+    @param signum: the signal number that occurred
+    @return: void
+*/
+static void app_cleanup( int signum )
+{
+    (void)signum;
+    running = false;
+}
+
+/*****************************************************************************/
+/** This function opens the receiving socket, joining the multicast group if
+    one is given.
+
+    @return: the socket, else a negative errno
+*/
+static int open_socket( void )
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len = 0;
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = RECEIVE_TIMEOUT_US };
+    int rcvbuf = 32 * 1024 * 1024;
+    int one = 1;
+    char p_port[16];
+    int fd;
+    int32_t status;
+
+    /* bind to the wildcard address, a multicast group is joined below */
+    snprintf( p_port, sizeof(p_port), ":%u", port );
+    status = iq_net_resolve( p_port, true, &addr, &addr_len );
+    if( status != 0 )
+    {
+        return status;
+    }
+    fd = socket( addr.ss_family, SOCK_DGRAM, 0 );
+    if( fd < 0 )
+    {
+        return -errno;
+    }
+    (void)setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one) );
+    (void)setsockopt( fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf) );
+    (void)setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout) );
+    if( bind( fd, (struct sockaddr *)&addr, addr_len ) != 0 )
+    {
+        status = -errno;
+        close( fd );
+        return status;
+    }
+
+    if( p_group != NULL )
+    {
+        struct ip_mreq mreq;
+
+        memset( &mreq, 0, sizeof(mreq) );
+        if( ( inet_pton( AF_INET, p_group, &(mreq.imr_multiaddr) ) != 1 ) ||
+            ( setsockopt( fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq) ) != 0 ) )
+        {
+            status = ( errno != 0 ) ? -errno : -EINVAL;
+            close( fd );
+            return status;
+        }
+    }
+
+    return fd;
+}
+
+/*****************************************************************************/
+/** This function converts the payload of a datagram to 16-bit samples in the
+    requested order.
+
+    @param format: datagram format
+    @param p_frame: the parsed datagram
+    @param p_out: nr_samples words of output
+    @return: void
+*/
+static void frame_samples( enum iq_net_format format,
+                           const struct iq_net_frame *p_frame,
+                           uint32_t *p_out )
+{
+    uint32_t i;
+
+    if( format == iq_net_format_vita49 )
+    {
+        iq_net_vita49_to_host( p_out, p_frame->p_payload, p_frame->nr_samples, iq_first );
+        return;
+    }
+
+    if( p_frame->flags & IQ_NET_FLAG_PACKED )
+    {
+        iq_unpack( (const uint32_t *)p_frame->p_payload, (int16_t *)p_out,
+                   p_frame->nr_samples );
+    }
+    else
+    {
+        memcpy( p_out, p_frame->p_payload, p_frame->nr_samples * sizeof(uint32_t) );
+    }
+    if( ( ( p_frame->flags & IQ_NET_FLAG_IQ_ORDER ) != 0 ) != iq_first )
+    {
+        for( i = 0; i < p_frame->nr_samples; i++ )
+        {
+            p_out[i] = ( p_out[i] << 16 ) | ( p_out[i] >> 16 );
+        }
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    static struct stream_stats stats[MAX_STREAMS];
+    enum iq_net_format format = iq_net_format_vita49;
+    struct mmsghdr msgs[IQ_NET_BATCH];
+    struct iovec iov[IQ_NET_BATCH];
+    uint8_t *p_buffers = NULL;
+    uint32_t *p_samples = NULL;
+    FILE *p_out = NULL;
+    uint64_t start_ns, last_report_ns;
+    uint64_t nr_datagrams = 0, nr_bad = 0, nr_calls = 0, nr_written = 0;
+    uint64_t last_datagrams = 0;
+    int fd;
+    int32_t status = 0;
+    uint32_t i;
+
+    if( arg_parser(argc, argv, p_help_short, p_help_long, p_args) != 0 )
+    {
+        arg_parser_print_help(argv[0], p_help_short, p_help_long, p_args);
+        return (-1);
+    }
+
+    if( strcasecmp( p_format, "raw" ) == 0 )
+    {
+        format = iq_net_format_raw;
+    }
+    else if( strcasecmp( p_format, "vita49" ) != 0 )
+    {
+        fprintf(stderr, "Error: --format takes vita49 or raw, got '%s'\n", p_format);
+        return (-1);
+    }
+    if( ( port == 0 ) || ( port > UINT16_MAX ) || ( stream_id >= MAX_STREAMS ) )
+    {
+        fprintf(stderr, "Error: --port must be between 1 and 65535 and --stream below %u\n",
+                MAX_STREAMS);
+        return (-1);
+    }
+
+    signal(SIGINT, app_cleanup);
+
+    fd = open_socket();
+    if( fd < 0 )
+    {
+        fprintf(stderr, "Error: unable to listen on port %u%s%s (%s)\n", port,
+                ( p_group != NULL ) ? " of " : "", ( p_group != NULL ) ? p_group : "",
+                strerror(abs(fd)));
+        return (-1);
+    }
+
+    p_buffers = malloc( IQ_NET_BATCH * RECEIVE_SLOT_BYTES );
+    p_samples = malloc( IQ_NET_MAX_DATAGRAM * 2 );
+    if( ( p_buffers == NULL ) || ( p_samples == NULL ) )
+    {
+        fprintf(stderr, "Error: unable to allocate receive buffers\n");
+        status = -ENOMEM;
+        goto finished;
+    }
+    if( p_destination != NULL )
+    {
+        p_out = fopen( p_destination, "wb" );
+        if( p_out == NULL )
+        {
+            fprintf(stderr, "Error: unable to open %s (%s)\n", p_destination, strerror(errno));
+            status = -errno;
+            goto finished;
+        }
+    }
+
+    printf("Info: listening for %s datagrams on port %u%s%s\n",
+           ( format == iq_net_format_raw ) ? "raw" : "VITA-49", port,
+           ( p_group != NULL ) ? " of " : "", ( p_group != NULL ) ? p_group : "");
+
+    start_ns = last_report_ns = elapsed_now_ns();
+    while( running )
+    {
+        uint64_t now_ns;
+        int nr;
+
+        memset( msgs, 0, sizeof(msgs) );
+        for( i = 0; i < IQ_NET_BATCH; i++ )
+        {
+            iov[i].iov_base = p_buffers + ( i * RECEIVE_SLOT_BYTES );
+            iov[i].iov_len = IQ_NET_MAX_DATAGRAM;
+            msgs[i].msg_hdr.msg_iov = &(iov[i]);
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        nr = recvmmsg( fd, msgs, IQ_NET_BATCH, MSG_WAITFORONE, NULL );
+        nr_calls++;
+        if( ( nr < 0 ) && ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) &&
+            ( errno != EINTR ) )
+        {
+            fprintf(stderr, "Error: receive failed (%s)\n", strerror(errno));
+            status = -errno;
+            break;
+        }
+
+        for( i = 0; ( nr > 0 ) && ( i < (uint32_t)nr ); i++ )
+        {
+            struct iq_net_frame frame;
+            struct stream_stats *p_stats;
+
+            nr_datagrams++;
+            if( ( iq_net_parse( format, iov[i].iov_base, msgs[i].msg_len, &frame ) != 0 ) ||
+                ( frame.stream_id >= MAX_STREAMS ) )
+            {
+                nr_bad++;
+                continue;
+            }
+
+            p_stats = &(stats[frame.stream_id]);
+            if( p_stats->seen && ( frame.rf_timestamp != p_stats->next_ts ) )
+            {
+                p_stats->nr_gaps++;
+                printf("Info: stream %u gap, expected RF timestamp 0x%016" PRIx64 " got 0x%016"
+                       PRIx64 "\n", frame.stream_id, p_stats->next_ts, frame.rf_timestamp);
+            }
+            p_stats->seen = true;
+            p_stats->next_ts = frame.rf_timestamp + frame.nr_samples;
+            p_stats->nr_datagrams++;
+            p_stats->nr_samples += frame.nr_samples;
+            if( frame.flags & IQ_NET_FLAG_OVERLOAD )
+            {
+                p_stats->nr_overloads++;
+            }
+
+            if( ( p_out != NULL ) && ( frame.stream_id == stream_id ) )
+            {
+                frame_samples( format, &frame, p_samples );
+                if( fwrite( p_samples, sizeof(uint32_t), frame.nr_samples, p_out ) !=
+                    frame.nr_samples )
+                {
+                    fprintf(stderr, "Error: unable to write to %s\n", p_destination);
+                    status = -EIO;
+                    running = false;
+                    break;
+                }
+                nr_written += frame.nr_samples;
+            }
+        }
+
+        now_ns = elapsed_now_ns();
+        if( now_ns - last_report_ns >= 1000000000ULL )
+        {
+            printf("Info: %" PRIu64 " datagrams/s, %" PRIu64 " samples written, %" PRIu64
+                   " gaps on stream %u\n",
+                   (uint64_t)( ( ( nr_datagrams - last_datagrams ) * 1000000000ULL ) /
+                               ( now_ns - last_report_ns ) ), nr_written, stats[stream_id].nr_gaps,
+                   stream_id);
+            last_datagrams = nr_datagrams;
+            last_report_ns = now_ns;
+        }
+        if( ( run_time != 0 ) && ( now_ns - start_ns >= run_time * 1000000000ULL ) )
+        {
+            running = false;
+        }
+    }
+
+    printf("Info: received %" PRIu64 " datagrams in %" PRIu64 " system calls, %" PRIu64
+           " malformed\n", nr_datagrams, nr_calls, nr_bad);
+    for( i = 0; i < MAX_STREAMS; i++ )
+    {
+        if( stats[i].seen )
+        {
+            printf("Info: stream %u: %" PRIu64 " datagrams, %" PRIu64 " samples, %" PRIu64
+                   " gaps, %" PRIu64 " overloaded\n", i, stats[i].nr_datagrams,
+                   stats[i].nr_samples, stats[i].nr_gaps, stats[i].nr_overloads);
+        }
+    }
+    if( p_out != NULL )
+    {
+        printf("Info: wrote %" PRIu64 " samples to %s\n", nr_written, p_destination);
+    }
+
+finished:
+    if( ( p_out != NULL ) && ( fclose( p_out ) != 0 ) && ( status == 0 ) )
+    {
+        status = -EIO;
+    }
+    free( p_samples );
+    free( p_buffers );
+    close( fd );
+
+    return ( status == 0 ) ? 0 : -1;
+}
@@ -0,0 +1,287 @@
+/**
+ * @file   iq_unpack.h
+ *
+ * @brief  Unpacking of 12-bit packed I/Q samples into sign-extended 16-bit I/Q samples.
+ *
+ * When packed mode is enabled (skiq_write_iq_pack_mode()), every 3 words of sample data carry 4
+ * I/Q samples as follows:
+ *
+ * <pre>
+ *          -31-------------------------------------------------------0-
+ *   word 0 |I0b11|...|I0b0|Q0b11|.................|Q0b0|I1b11|...|I1b4|
+ *          ------------------------------------------------------------
+ *   word 1 |I1b3|...|I1b0|Q1b11|...|Q1b0|I2b11|...|I2b0|Q2b11|...|Q2b8|
+ *          ------------------------------------------------------------
+ *   word 2 |Q2b7|...|Q2b0|I3b11|.................|I3b0|Q3b11|....|Q3b0|
+ *          ------------------------------------------------------------
+ * </pre>
+ *
+ * Samples are unpacked in the same order as unpacked receive blocks: Q0, I0, Q1, I1, ...
+ *
+ * The group kernel is selected once at first use: AVX2 on x86 hosts that support it, NEON on
+ * aarch64, and a branch-free scalar implementation everywhere else.
+ */
+
+#ifndef __IQ_UNPACK_H__
+#define __IQ_UNPACK_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <string.h>
+
+#if (defined __x86_64__ || defined __i386__) && (defined __GNUC__) && \
+    ( (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)) || (defined __clang__) )
+#   define IQ_UNPACK_HAVE_AVX2
+#   include <immintrin.h>
+#elif (defined __aarch64__) && (defined __ARM_NEON)
+#   define IQ_UNPACK_HAVE_NEON
+#   include <arm_neon.h>
+#endif
+
+/***** DEFINES *****/
+
+/* number of words and samples in a packed group */
+#define IQ_UNPACK_WORDS_PER_GROUP       (3)
+#define IQ_UNPACK_SAMPLES_PER_GROUP     (4)
+
+/* sign extend the 12-bit value held in the lower bits of _x */
+#define IQ_UNPACK_SIGN_EXTEND(_x)       ((int16_t)((uint16_t)((_x) << 4)) >> 4)
+
+/***** TYPEDEFS *****/
+
+/* unpacks nr_groups complete groups (3 words in, 8 int16 values out) */
+typedef void (*iq_unpack_groups_fn)( const uint32_t *p_packed,
+                                     int16_t *p_unpacked,
+                                     uint32_t nr_groups );
+
+/***** INLINE FUNCTIONS  *****/
+
+static inline void _iq_unpack_groups_scalar( const uint32_t *p_packed,
+                                             int16_t *p_unpacked,
+                                             uint32_t nr_groups )
+{
+    uint32_t g;
+
+    for ( g = 0; g < nr_groups; g++ )
+    {
+        const uint32_t w0 = p_packed[0];
+        const uint32_t w1 = p_packed[1];
+        const uint32_t w2 = p_packed[2];
+
+        p_unpacked[0] = IQ_UNPACK_SIGN_EXTEND( w0 >> 8 );                      /* Q0 */
+        p_unpacked[1] = IQ_UNPACK_SIGN_EXTEND( w0 >> 20 );                     /* I0 */
+        p_unpacked[2] = IQ_UNPACK_SIGN_EXTEND( w1 >> 16 );                     /* Q1 */
+        p_unpacked[3] = IQ_UNPACK_SIGN_EXTEND( ( w0 << 4 ) | ( w1 >> 28 ) );   /* I1 */
+        p_unpacked[4] = IQ_UNPACK_SIGN_EXTEND( ( w1 << 8 ) | ( w2 >> 24 ) );   /* Q2 */
+        p_unpacked[5] = IQ_UNPACK_SIGN_EXTEND( w1 >> 4 );                      /* I2 */
+        p_unpacked[6] = IQ_UNPACK_SIGN_EXTEND( w2 );                           /* Q3 */
+        p_unpacked[7] = IQ_UNPACK_SIGN_EXTEND( w2 >> 12 );                     /* I3 */
+
+        p_packed += IQ_UNPACK_WORDS_PER_GROUP;
+        p_unpacked += 2 * IQ_UNPACK_SAMPLES_PER_GROUP;
+    }
+}
+
+/*
+  The SIMD kernels below treat each group as 12 little-endian bytes b0..b11.  Every 16-bit output
+  lane is assembled from two of those bytes so that its 12-bit value sits either in the upper 12
+  bits (I samples) or the lower 12 bits (Q samples).  Q lanes are then shifted up by 4 and all
+  lanes are arithmetically shifted down by 4, which sign extends every sample at once.
+*/
+#define IQ_UNPACK_SHUFFLE_BYTES     1, 2, 2, 3, 6, 7, 7, 0, 11, 4, 4, 5, 8, 9, 9, 10
+
+#if (defined IQ_UNPACK_HAVE_AVX2)
+__attribute__((target("avx2")))
+static inline void _iq_unpack_groups_avx2( const uint32_t *p_packed,
+                                           int16_t *p_unpacked,
+                                           uint32_t nr_groups )
+{
+    const __m256i shuffle = _mm256_setr_epi8( IQ_UNPACK_SHUFFLE_BYTES, IQ_UNPACK_SHUFFLE_BYTES );
+    const __m256i q_shift = _mm256_setr_epi16( 16, 1, 16, 1, 16, 1, 16, 1,
+                                               16, 1, 16, 1, 16, 1, 16, 1 );
+    const uint8_t *p_src = (const uint8_t *)p_packed;
+
+    /* each 16 byte load reads 4 bytes past its group, so keep at least one group in reserve */
+    while ( nr_groups >= 5 )
+    {
+        __m256i v0, v1;
+
+        v0 = _mm256_inserti128_si256( _mm256_castsi128_si256(
+                                          _mm_loadu_si128( (const __m128i *)(p_src + 0) ) ),
+                                      _mm_loadu_si128( (const __m128i *)(p_src + 12) ), 1 );
+        v1 = _mm256_inserti128_si256( _mm256_castsi128_si256(
+                                          _mm_loadu_si128( (const __m128i *)(p_src + 24) ) ),
+                                      _mm_loadu_si128( (const __m128i *)(p_src + 36) ), 1 );
+
+        v0 = _mm256_srai_epi16( _mm256_mullo_epi16( _mm256_shuffle_epi8( v0, shuffle ), q_shift ), 4 );
+        v1 = _mm256_srai_epi16( _mm256_mullo_epi16( _mm256_shuffle_epi8( v1, shuffle ), q_shift ), 4 );
+
+        _mm256_storeu_si256( (__m256i *)(p_unpacked + 0), v0 );
+        _mm256_storeu_si256( (__m256i *)(p_unpacked + 16), v1 );
+
+        p_src += 4 * IQ_UNPACK_WORDS_PER_GROUP * sizeof(uint32_t);
+        p_unpacked += 4 * 2 * IQ_UNPACK_SAMPLES_PER_GROUP;
+        nr_groups -= 4;
+    }
+
+    _iq_unpack_groups_scalar( (const uint32_t *)p_src, p_unpacked, nr_groups );
+}
+#endif  /* IQ_UNPACK_HAVE_AVX2 */
+
+#if (defined IQ_UNPACK_HAVE_NEON)
+static inline int16x8_t _iq_unpack_neon_lanes( uint8x16_t bytes )
+{
+    const int16x8_t q_shift = { 4, 0, 4, 0, 4, 0, 4, 0 };
+
+    return vshrq_n_s16( vshlq_s16( vreinterpretq_s16_u8( bytes ), q_shift ), 4 );
+}
+
+static inline void _iq_unpack_groups_neon( const uint32_t *p_packed,
+                                           int16_t *p_unpacked,
+                                           uint32_t nr_groups )
+{
+    const uint8x16_t idx = { IQ_UNPACK_SHUFFLE_BYTES };
+    const uint8_t *p_src = (const uint8_t *)p_packed;
+
+    /* four groups are exactly three 16 byte vectors, so no load reaches past the input */
+    while ( nr_groups >= 4 )
+    {
+        uint8x16x2_t ab, bc;
+        uint8x16_t a, b, c;
+
+        a = vld1q_u8( p_src + 0 );
+        b = vld1q_u8( p_src + 16 );
+        c = vld1q_u8( p_src + 32 );
+        ab.val[0] = a;
+        ab.val[1] = b;
+        bc.val[0] = b;
+        bc.val[1] = c;
+
+        vst1q_s16( p_unpacked + 0, _iq_unpack_neon_lanes( vqtbl1q_u8( a, idx ) ) );
+        vst1q_s16( p_unpacked + 8, _iq_unpack_neon_lanes( vqtbl2q_u8( ab, vaddq_u8( idx, vdupq_n_u8( 12 ) ) ) ) );
+        vst1q_s16( p_unpacked + 16, _iq_unpack_neon_lanes( vqtbl2q_u8( bc, vaddq_u8( idx, vdupq_n_u8( 8 ) ) ) ) );
+        vst1q_s16( p_unpacked + 24, _iq_unpack_neon_lanes( vqtbl1q_u8( c, vaddq_u8( idx, vdupq_n_u8( 4 ) ) ) ) );
+
+        p_src += 4 * IQ_UNPACK_WORDS_PER_GROUP * sizeof(uint32_t);
+        p_unpacked += 4 * 2 * IQ_UNPACK_SAMPLES_PER_GROUP;
+        nr_groups -= 4;
+    }
+
+    _iq_unpack_groups_scalar( (const uint32_t *)p_src, p_unpacked, nr_groups );
+}
+#endif  /* IQ_UNPACK_HAVE_NEON */
+
+/*****************************************************************************/
+/** Select (on first call) and return the fastest group kernel available on this host.
+
+    @param[out] pp_name     optional, set to a string naming the selected kernel
+
+    @return the selected kernel
+*/
+static inline iq_unpack_groups_fn iq_unpack_select( const char **pp_name )
+{
+    static iq_unpack_groups_fn p_fn = NULL;
+    static const char *p_name = NULL;
+
+    if ( p_fn == NULL )
+    {
+        p_fn = _iq_unpack_groups_scalar;
+        p_name = "scalar";
+#if (defined IQ_UNPACK_HAVE_AVX2)
+        __builtin_cpu_init();
+        if ( __builtin_cpu_supports("avx2") )
+        {
+            p_fn = _iq_unpack_groups_avx2;
+            p_name = "avx2";
+        }
+#elif (defined IQ_UNPACK_HAVE_NEON)
+        p_fn = _iq_unpack_groups_neon;
+        p_name = "neon";
+#endif
+    }
+
+    if ( pp_name != NULL )
+    {
+        *pp_name = p_name;
+    }
+
+    return p_fn;
+}
+
+/*****************************************************************************/
+/** Unpack a contiguous run of packed sample data.
+
+    @param[in]  p_packed    packed sample data, at least SKIQ_NUM_WORDS_IN_PACKED_BLOCK(nr_samples)
+                            words long
+    @param[out] p_unpacked  unpacked samples, 2 * nr_samples int16 values
+    @param[in]  nr_samples  number of I/Q samples to unpack
+
+    @return void
+*/
+static inline void iq_unpack( const uint32_t *p_packed,
+                              int16_t *p_unpacked,
+                              uint32_t nr_samples )
+{
+    const uint32_t nr_groups = nr_samples / IQ_UNPACK_SAMPLES_PER_GROUP;
+    const uint32_t nr_remaining = nr_samples % IQ_UNPACK_SAMPLES_PER_GROUP;
+
+    (iq_unpack_select( NULL ))( p_packed, p_unpacked, nr_groups );
+
+    if ( nr_remaining > 0 )
+    {
+        /* the trailing partial group may be shorter than 3 words, so stage it on the stack */
+        uint32_t group[IQ_UNPACK_WORDS_PER_GROUP] = { 0, 0, 0 };
+        int16_t samples[2 * IQ_UNPACK_SAMPLES_PER_GROUP];
+
+        memcpy( group, &(p_packed[nr_groups * IQ_UNPACK_WORDS_PER_GROUP]),
+                ( ( nr_remaining * IQ_UNPACK_WORDS_PER_GROUP + IQ_UNPACK_SAMPLES_PER_GROUP - 1 ) /
+                  IQ_UNPACK_SAMPLES_PER_GROUP ) * sizeof(uint32_t) );
+        _iq_unpack_groups_scalar( group, samples, 1 );
+        memcpy( &(p_unpacked[2 * nr_groups * IQ_UNPACK_SAMPLES_PER_GROUP]), samples,
+                2 * nr_remaining * sizeof(int16_t) );
+    }
+}
+
+/*****************************************************************************/
+/** Unpack a capture buffer made of consecutive packed receive blocks.  Each block occupies
+    block_stride_in_words words: an optional header of header_words words followed by packed
+    payload, of which only whole groups are sample data.  The final block may be truncated.
+    Headers are not copied, so the output is nr_samples contiguous unpacked samples.
+
+    @param[in]  p_packed                capture buffer
+    @param[out] p_unpacked              unpacked samples, 2 * nr_samples int16 values
+    @param[in]  nr_samples              total number of I/Q samples to unpack
+    @param[in]  block_stride_in_words   number of words per block in p_packed (including header)
+    @param[in]  header_words            number of header words at the start of each block (0 or
+                                        SKIQ_RX_HEADER_SIZE_IN_WORDS)
+
+    @return void
+*/
+static inline void iq_unpack_blocks( const uint32_t *p_packed,
+                                     int16_t *p_unpacked,
+                                     uint32_t nr_samples,
+                                     uint32_t block_stride_in_words,
+                                     uint32_t header_words )
+{
+    const uint32_t samples_per_block = ( ( block_stride_in_words - header_words ) /
+                                         IQ_UNPACK_WORDS_PER_GROUP ) * IQ_UNPACK_SAMPLES_PER_GROUP;
+
+    if ( samples_per_block == 0 )
+    {
+        return;
+    }
+
+    while ( nr_samples > 0 )
+    {
+        uint32_t nr = ( nr_samples < samples_per_block ) ? nr_samples : samples_per_block;
+
+        iq_unpack( p_packed + header_words, p_unpacked, nr );
+
+        p_packed += block_stride_in_words;
+        p_unpacked += 2 * nr;
+        nr_samples -= nr;
+    }
+}
+
+#endif  /* __IQ_UNPACK_H__ */
@@ -0,0 +1,413 @@
+/**
+ * @file   mem_arena.h
+ *
+ * @brief  Hugepage backed arena for the receive capture buffers and the transmit blocks of the
+ *         test applications.
+ *
+ * The arena is a single mapping that is sized, placed on a NUMA node, faulted in and locked when
+ * the application starts.  Buffers are then carved out of it one after another, each aligned to
+ * at least a cache line, so the streaming loops never page fault or call into the kernel
+ * allocator.  Nothing is released until mem_arena_free() unmaps the whole arena.
+ *
+ * The mapping uses the largest pages that are both requested and available: 1 GB hugepages for
+ * arenas of at least 1 GB, then 2 MB hugepages, then normal pages with transparent hugepages
+ * requested through madvise().  Hugepages have to be reserved by the administrator, e.g.
+ *
+ *     echo 512 > /sys/kernel/mm/hugepages/hugepages-2048kB/nr_hugepages
+ *
+ * for 1 GB of 2 MB pages.  Without a reservation the arena quietly falls back to normal pages.
+ *
+ * Transmit blocks taken from the arena with mem_arena_tx_block() are laid out like the blocks of
+ * skiq_tx_block_allocate() but must not be passed to skiq_tx_block_free().
+ *
+ * An arena is not thread safe; give each thread its own arena or take the buffers out of it
+ * before the threads start.
+ */
+
+#ifndef __MEM_ARENA_H__
+#define __MEM_ARENA_H__
+
+/***** INCLUDES *****/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <strings.h>
+
+#if (!defined __MINGW32__)
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include <sidekiq_api.h>
+
+#include "rt_thread.h"
+
+/***** DEFINES *****/
+
+/* minimum alignment of every buffer, one cache line */
+#define MEM_ARENA_ALIGN                 (64)
+
+#define MEM_ARENA_2M                    (2UL * 1024 * 1024)
+#define MEM_ARENA_1G                    (1024UL * 1024 * 1024)
+
+/* from <linux/mman.h>, for older C libraries */
+#if (!defined __MINGW32__)
+#if (!defined MAP_HUGETLB)
+#define MAP_HUGETLB                     (0x40000)
+#endif
+#if (!defined MAP_HUGE_SHIFT)
+#define MAP_HUGE_SHIFT                  (26)
+#endif
+#if (!defined MAP_HUGE_2MB)
+#define MAP_HUGE_2MB                    (21 << MAP_HUGE_SHIFT)
+#endif
+#if (!defined MAP_HUGE_1GB)
+#define MAP_HUGE_1GB                    (30 << MAP_HUGE_SHIFT)
+#endif
+#endif
+
+/* the shared command line option, place it before APP_ARG_TERMINATOR */
+#define MEM_ARENA_APP_ARG(pp_pages)                                                     \
+    APP_ARG_OPT("hugepages",                                                            \
+                0,                                                                      \
+                "Page size of the sample buffer arena",                                 \
+                "[\"auto\",\"2M\",\"1G\",\"off\"]",                                     \
+                (pp_pages),                                                             \
+                STRING_VAR_TYPE)
+
+/* size of a buffer in the arena, including the padding to its alignment */
+#define MEM_ARENA_SLAB(size, align)                                                     \
+    ( ( (size_t)(size) + ( (size_t)(align) - 1 ) ) & ~( (size_t)(align) - 1 ) )
+
+/* size of a transmit block of nr_words samples in the arena */
+#define MEM_ARENA_TX_BLOCK_SLAB(nr_words)                                               \
+    MEM_ARENA_SLAB(SKIQ_TX_HEADER_SIZE_IN_BYTES + ( (size_t)(nr_words) * 4 ),           \
+                   SKIQ_TX_BLOCK_MEMORY_ALIGN)
+
+/***** TYPEDEFS *****/
+
+enum mem_arena_pages
+{
+    mem_arena_pages_auto = 0,           /* the largest hugepages available */
+    mem_arena_pages_2m,                 /* 2 MB hugepages, else normal pages */
+    mem_arena_pages_1g,                 /* 1 GB hugepages, else 2 MB, else normal pages */
+    mem_arena_pages_off,                /* normal pages */
+};
+
+struct mem_arena
+{
+    uint8_t *p_base;
+    size_t size;                        /* bytes mapped */
+    size_t used;                        /* bytes handed out, including the alignment padding */
+    size_t page_size;                   /* page size of the mapping */
+    bool hugetlb;                       /* mapped from the hugepage pool */
+    bool locked;                        /* locked into RAM */
+    int32_t node;                       /* NUMA node preferred, negative for none */
+    uint32_t nr_allocs;
+    uint32_t nr_failed;                 /* requests that did not fit */
+};
+
+#define MEM_ARENA_INITIALIZER                           \
+    (struct mem_arena){                                 \
+        .p_base = NULL,                                 \
+        .size = 0,                                      \
+        .used = 0,                                      \
+        .page_size = 0,                                 \
+        .hugetlb = false,                               \
+        .locked = false,                                \
+        .node = -1,                                     \
+        .nr_allocs = 0,                                 \
+        .nr_failed = 0,                                 \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+/*****************************************************************************/
+/** Parse the page size given to --hugepages.
+
+    @param[in]  p_str       "auto", "2M", "1G" or "off", NULL for "auto"
+    @param[out] p_pages     page size
+
+    @return 0 on success, else -EINVAL
+*/
+static inline int32_t mem_arena_parse_pages( const char *p_str,
+                                             enum mem_arena_pages *p_pages )
+{
+    if ( ( p_str == NULL ) || ( 0 == strcasecmp(p_str, "auto") ) )
+    {
+        *p_pages = mem_arena_pages_auto;
+    }
+    else if ( ( 0 == strcasecmp(p_str, "2M") ) || ( 0 == strcasecmp(p_str, "2MB") ) )
+    {
+        *p_pages = mem_arena_pages_2m;
+    }
+    else if ( ( 0 == strcasecmp(p_str, "1G") ) || ( 0 == strcasecmp(p_str, "1GB") ) )
+    {
+        *p_pages = mem_arena_pages_1g;
+    }
+    else if ( ( 0 == strcasecmp(p_str, "off") ) || ( 0 == strcasecmp(p_str, "none") ) )
+    {
+        *p_pages = mem_arena_pages_off;
+    }
+    else
+    {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+#if (!defined __MINGW32__)
+/* map from the hugepage pool, NULL if no pages of this size are available */
+static inline void *_mem_arena_map_huge( size_t size,
+                                         size_t page_size )
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+    void *p_mem;
+
+    flags |= ( page_size == MEM_ARENA_1G ) ? MAP_HUGE_1GB : MAP_HUGE_2MB;
+    p_mem = mmap(NULL, MEM_ARENA_SLAB(size, page_size), PROT_READ | PROT_WRITE, flags, -1, 0);
+
+    return ( p_mem == MAP_FAILED ) ? NULL : p_mem;
+}
+#endif
+
+/*****************************************************************************/
+/** Map an arena, prefer a NUMA node for it, fault every page in and lock it into RAM.  A lock
+    that fails (see ulimit -l) is reported as a warning, the arena is still usable.
+
+    @param[out] a           arena
+    @param[in]  size        bytes needed, the sum of MEM_ARENA_SLAB() of every buffer
+    @param[in]  pages       page size to use
+    @param[in]  node        NUMA node, negative for the default policy
+    @param[in]  p_name      name of the arena for the log
+
+    @return 0 on success, else -ENOMEM
+*/
+static inline int32_t mem_arena_init( struct mem_arena *a,
+                                      size_t size,
+                                      enum mem_arena_pages pages,
+                                      int32_t node,
+                                      const char *p_name )
+{
+    *a = MEM_ARENA_INITIALIZER;
+    a->node = node;
+    if ( size == 0 )
+    {
+        size = 1;
+    }
+
+#if (defined __MINGW32__)
+    (void)pages;
+    (void)p_name;
+    a->page_size = MEM_ARENA_ALIGN;
+    a->size = MEM_ARENA_SLAB(size, MEM_ARENA_ALIGN);
+    a->p_base = (uint8_t *)_aligned_malloc(a->size, MEM_ARENA_ALIGN);
+    if ( a->p_base == NULL )
+    {
+        return -ENOMEM;
+    }
+    memset(a->p_base, 0, a->size);
+#else
+    size_t small_page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t offset;
+
+    if ( ( pages == mem_arena_pages_1g ) ||
+         ( ( pages == mem_arena_pages_auto ) && ( size >= MEM_ARENA_1G ) ) )
+    {
+        a->p_base = (uint8_t *)_mem_arena_map_huge(size, MEM_ARENA_1G);
+        a->page_size = MEM_ARENA_1G;
+    }
+    if ( ( a->p_base == NULL ) && ( pages != mem_arena_pages_off ) )
+    {
+        a->p_base = (uint8_t *)_mem_arena_map_huge(size, MEM_ARENA_2M);
+        a->page_size = MEM_ARENA_2M;
+    }
+
+    if ( a->p_base != NULL )
+    {
+        a->hugetlb = true;
+        a->size = MEM_ARENA_SLAB(size, a->page_size);
+    }
+    else
+    {
+        void *p_mem;
+
+        if ( ( pages == mem_arena_pages_2m ) || ( pages == mem_arena_pages_1g ) )
+        {
+            fprintf(stderr, "Warning: no hugepages available for the %s arena, using normal"
+                    " pages (see /sys/kernel/mm/hugepages)\n", p_name);
+        }
+
+        a->page_size = small_page;
+        a->size = MEM_ARENA_SLAB(size, small_page);
+        p_mem = mmap(NULL, a->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if ( p_mem == MAP_FAILED )
+        {
+            *a = MEM_ARENA_INITIALIZER;
+            return -ENOMEM;
+        }
+        a->p_base = (uint8_t *)p_mem;
+#if (defined MADV_HUGEPAGE)
+        if ( pages != mem_arena_pages_off )
+        {
+            /* transparent hugepages, a hint that the kernel may ignore */
+            (void)madvise(a->p_base, a->size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    /* nothing has been touched yet, so the policy applies to every page */
+    rt_thread_bind(a->p_base, a->size, node);
+
+    /* fault every page in now rather than in the streaming loop */
+    for ( offset = 0; offset < a->size; offset += small_page )
+    {
+        ((volatile uint8_t *)a->p_base)[offset] = 0;
+    }
+
+    if ( mlock(a->p_base, a->size) == 0 )
+    {
+        a->locked = true;
+    }
+    else
+    {
+        fprintf(stderr, "Warning: unable to lock the %s arena into RAM (errno %d), check the"
+                " memlock limit (ulimit -l)\n", p_name, errno);
+    }
+#endif
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Take a zeroed buffer out of an arena.
+
+    @param[in] a            arena
+    @param[in] size         size of the buffer in bytes
+    @param[in] align        alignment, a power of two, raised to MEM_ARENA_ALIGN if smaller
+
+    @return the buffer, or NULL if it does not fit in the arena
+*/
+static inline void *mem_arena_alloc( struct mem_arena *a,
+                                     size_t size,
+                                     size_t align )
+{
+    size_t offset;
+
+    if ( align < MEM_ARENA_ALIGN )
+    {
+        align = MEM_ARENA_ALIGN;
+    }
+
+    offset = MEM_ARENA_SLAB(a->used, align);
+    if ( ( a->p_base == NULL ) || ( offset > a->size ) || ( size > ( a->size - offset ) ) )
+    {
+        a->nr_failed++;
+        return NULL;
+    }
+
+    /* pad to a whole slab so the next buffer does not share a cache line with this one */
+    a->used = offset + MEM_ARENA_SLAB(size, MEM_ARENA_ALIGN);
+    if ( a->used > a->size )
+    {
+        a->used = a->size;
+    }
+    a->nr_allocs++;
+
+    return a->p_base + offset;
+}
+
+/*****************************************************************************/
+/** Take a zeroed transmit block out of an arena, laid out like skiq_tx_block_allocate().  The
+    block belongs to the arena and must not be passed to skiq_tx_block_free().
+
+    @param[in] a            arena
+    @param[in] nr_words     number of samples (words) in the block
+
+    @return the block, or NULL if it does not fit in the arena
+*/
+static inline skiq_tx_block_t *mem_arena_tx_block( struct mem_arena *a,
+                                                   uint32_t nr_words )
+{
+    return (skiq_tx_block_t *)mem_arena_alloc(a,
+                                              SKIQ_TX_HEADER_SIZE_IN_BYTES +
+                                              ( (size_t)nr_words * 4 ),
+                                              SKIQ_TX_BLOCK_MEMORY_ALIGN);
+}
+
+/*****************************************************************************/
+/** Check whether a buffer was taken out of an arena.
+
+    @param[in] a            arena
+    @param[in] p_mem        buffer
+
+    @return true if p_mem lies within the arena
+*/
+static inline bool mem_arena_owns( const struct mem_arena *a,
+                                   const void *p_mem )
+{
+    const uint8_t *p = (const uint8_t *)p_mem;
+
+    return ( a->p_base != NULL ) && ( p >= a->p_base ) && ( p < ( a->p_base + a->size ) );
+}
+
+/*****************************************************************************/
+/** Print the page size and the occupancy of an arena.
+
+    @param[in] a            arena
+    @param[in] p_name       name of the arena for the log
+
+    @return void
+*/
+static inline void mem_arena_print( const struct mem_arena *a,
+                                    const char *p_name )
+{
+    char p_pages[32];
+
+    if ( a->hugetlb )
+    {
+        snprintf(p_pages, sizeof(p_pages), "%zu MB hugepages", a->page_size >> 20);
+    }
+    else
+    {
+        snprintf(p_pages, sizeof(p_pages), "%zu kB pages", a->page_size >> 10);
+    }
+
+    printf("Info: %s arena: %zu of %zu bytes used (%.1f%%) by %" PRIu32 " buffers, %s%s%s\n",
+           p_name, a->used, a->size,
+           ( a->size > 0 ) ? ( 100.0 * (double)a->used / (double)a->size ) : 0.0,
+           a->nr_allocs, p_pages, a->locked ? ", locked" : "",
+           ( a->nr_failed > 0 ) ? ", out of space" : "");
+}
+
+/*****************************************************************************/
+/** Unmap an arena, along with every buffer taken out of it.
+
+    @param[in] a            arena, may have failed mem_arena_init()
+
+    @return void
+*/
+static inline void mem_arena_free( struct mem_arena *a )
+{
+    if ( a->p_base != NULL )
+    {
+#if (defined __MINGW32__)
+        _aligned_free(a->p_base);
+#else
+        if ( a->locked )
+        {
+            (void)munlock(a->p_base, a->size);
+        }
+        (void)munmap(a->p_base, a->size);
+#endif
+    }
+    *a = MEM_ARENA_INITIALIZER;
+}
+
+#endif  /* __MEM_ARENA_H__ */
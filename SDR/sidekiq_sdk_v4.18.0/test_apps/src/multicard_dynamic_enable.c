@@ -18,6 +18,9 @@
 #include <sidekiq_api.h>
 #include <pthread.h>
 #include <inttypes.h>
+#include <arg_parser.h>
+
+#include "card_bringup.h"
 
 /* flag indicating that we want to check timestamps for loss of data */
 #define CHECK_TIMESTAMPS (1)
@@ -30,6 +33,48 @@ static bool running=true;
 static uint64_t lo_freq = 850000000;
 static uint32_t sample_rate = 10000000;
 
+/* these are used to provide help strings for the application when running it
+   with either the "-h" or "--help" flags */
+static const char* p_help_short = "- dynamically enable / disable cards";
+static const char* p_help_long = "\
+Brings up every card, receives on all of them, then disables the odd\n\
+numbered cards, then the even numbered ones while enabling the odd ones\n\
+again, receiving for a moment at each step.\n\
+\n\
+With --parallel, each card is enabled from its own thread so that the\n\
+bring-up of the cards overlaps instead of running one after another.\n\
+\n\
+With --warm, cards are parked rather than disabled: they stay initialized\n\
+(and locked by this application), so enabling them again costs nothing, and\n\
+only the receive settings that changed are written to a card.  Probe\n\
+results (card list, serial numbers and parameters) are read once in either\n\
+mode.  See card_bringup.h.";
+
+/* command line argument variables */
+static bool parallel = false;
+static bool warm = false;
+
+/* the command line arguments available to this application */
+static struct application_argument p_args[] =
+{
+    APP_ARG_OPT("parallel",
+                0,
+                "Enable the cards concurrently",
+                NULL,
+                &parallel,
+                BOOL_VAR_TYPE),
+    APP_ARG_OPT("warm",
+                0,
+                "Park cards instead of disabling them and skip unchanged settings",
+                NULL,
+                &warm,
+                BOOL_VAR_TYPE),
+    APP_ARG_TERMINATOR,
+};
+
+/* probe results and state of every card */
+static struct card_bringup bringup;
+
 pthread_t card_thread[SKIQ_MAX_NUM_CARDS];
 int32_t thread_status[SKIQ_MAX_NUM_CARDS];
 
@@ -70,34 +115,30 @@ void* process_card( void *data )
 
     int32_t status=0;      // status of various libsidekiq calls
     skiq_rx_status_t rx_status;
+    struct card_rx_config rx_config = {
+        .hdl = curr_rx_hdl,
+        .data_src = skiq_data_src_counter,
+        .sample_rate = sample_rate,
+        .bandwidth = sample_rate,
+        .lo_freq = lo_freq,
+    };
+    uint32_t nr_writes = 0;
 
     printf("Processing card %u at sample rate %u\n", card, sample_rate);
 
     /**********************configure the Rx ************************/
 
-    /* initialize the receive parameters for each handle */
-
-    /* write the data source to counter */
-    skiq_write_rx_data_src(card,curr_rx_hdl,skiq_data_src_counter);
-
-    /* set the sample rate and bandwidth */
-    status = skiq_write_rx_sample_rate_and_bandwidth(card,
-                                                     curr_rx_hdl,
-                                                     sample_rate,
-                                                     sample_rate);
+    /* write the data source (counter), sample rate, bandwidth and LO
+       frequency, skipping the settings the card already has */
+    status = card_bringup_configure_rx( &bringup, card, &rx_config, &nr_writes );
     if (status < 0)
     {
-        printf("Error: failed to set Rx sample rate or bandwidth(using"
-               " default from last config file)...status is %d\n",
+        printf("Error: failed to configure Rx (using previous settings)...status is %d\n",
                status);
     }
-
-    /* tune the Rx chain to the requested freq */
-    status=skiq_write_rx_LO_freq(card,curr_rx_hdl,lo_freq);
-    if (status < 0)
+    else
     {
-        printf("Error: failed to set LO freq (using previous LO freq)...status is %d\n",
-               status);
+        printf("Info: card %u configured with %u write(s)\n", card, nr_writes);
     }
 
     /* initialize next_ts and total_blocks_acquired */
@@ -165,6 +206,60 @@ thread_exit:
     return (void*)((&thread_status[card]));
 }
 
+/*****************************************************************************/
+/** This function reports how long bringing up a set of cards took, and which
+    of them were already up.
+
+    @param p_cards: the cards that were enabled
+    @param nr_cards: the number of entries in p_cards
+    @param total_ns: time taken to enable all of the cards
+    @return void
+*/
+static void print_bringup( const uint8_t *p_cards, uint8_t nr_cards, uint64_t total_ns )
+{
+    uint8_t i;
+
+    for( i = 0; i < nr_cards; i++ )
+    {
+        const struct card_state *s = &(bringup.state[p_cards[i]]);
+
+        if( s->status != 0 )
+        {
+            printf("Error: card %u failed to enable with status %" PRIi32 "\n", s->card,
+                   s->status);
+        }
+        else if( s->enable_ns == 0 )
+        {
+            printf("Info: card %u (%s) was still up\n", s->card, s->serial);
+        }
+        else
+        {
+            printf("Info: card %u (%s) enabled in %.3f s\n", s->card, s->serial,
+                   s->enable_ns / 1e9);
+        }
+    }
+    printf("Info: enabled %u card(s) in %.3f s\n", nr_cards, total_ns / 1e9);
+}
+
+/*****************************************************************************/
+/** This function takes cards out of use, parking them when --warm is given
+    and disabling them otherwise.
+
+    @param p_cards: the cards to take out of use
+    @param nr_cards: the number of entries in p_cards
+    @return int32_t: status where 0=success, anything else is an error
+*/
+static int32_t disable_cards( const uint8_t *p_cards, uint8_t nr_cards )
+{
+    if( warm )
+    {
+        card_bringup_park( &bringup, p_cards, nr_cards );
+        return 0;
+    }
+
+    return card_bringup_disable( &bringup, p_cards, nr_cards );
+}
+
 /*****************************************************************************/
 /** This is the main function for executing the multicard_rx_samples app.
 
@@ -183,16 +278,34 @@ int main( int argc, char *argv[])
     uint8_t curr_num_ena_cards = 0;
     uint8_t curr_dis_cards[SKIQ_MAX_NUM_CARDS] = { [0 ... SKIQ_MAX_NUM_CARDS-1] = 0 };
     uint8_t curr_num_dis_cards = 0;
+    uint64_t start_ns;
+
+    if( arg_parser(argc, argv, p_help_short, p_help_long, p_args) != 0 )
+    {
+        arg_parser_print_help(argv[0], p_help_short, p_help_long, p_args);
+        return (-1);
+    }
 
     /* always install a handler for proper cleanup */
     signal(SIGINT, app_cleanup);
 
-    skiq_get_cards( skiq_xport_type_pcie, &num_cards, cards );
+    status = card_bringup_init( &bringup, skiq_xport_type_pcie );
+    if( status != 0 )
+    {
+        printf("Error: unable to initialize libsidekiq with status %" PRIi32 "\n", status);
+        return (-1);
+    }
+    num_cards = bringup.nr_cards;
+    memcpy( cards, bringup.cards, num_cards );
 
-    printf("Info: initializing %" PRIu8 "card(s)...\n", num_cards);
+    printf("Info: initializing %" PRIu8 " card(s)%s...\n", num_cards,
+           parallel ? " in parallel" : "");
 
     /* bring up all the cards in the system */
-    status = skiq_init(skiq_xport_type_auto, skiq_xport_init_level_full, cards, num_cards);
+    start_ns = elapsed_now_ns();
+    status = card_bringup_enable( &bringup, cards, num_cards, skiq_xport_init_level_full,
+                                  parallel );
+    print_bringup( cards, num_cards, elapsed_now_ns() - start_ns );
     if( status != 0 )
     {
         if ( EBUSY == status )
@@ -210,6 +323,7 @@ int main( int argc, char *argv[])
             printf("Error: unable to initialize libsidekiq with status %" PRIi32
                     "\n", status);
         }
+        skiq_exit();
         return (-1);
     }
 
@@ -261,9 +375,9 @@ int main( int argc, char *argv[])
             printf("Adding card %u to enable list\n", cards[i]);
         }
     }
-    if( (status=skiq_disable_cards( curr_dis_cards, curr_num_dis_cards ))== 0 )
+    if( (status=disable_cards( curr_dis_cards, curr_num_dis_cards ))== 0 )
     {
-        printf("Successfully disabled cards\n");
+        printf("Successfully %s cards\n", warm ? "parked" : "disabled");
     }
     else
     {
@@ -316,16 +430,20 @@ int main( int argc, char *argv[])
             printf("Adding card %u to enable list\n", cards[i]);
         }
     }
-    if( (status=skiq_disable_cards( curr_dis_cards, curr_num_dis_cards ))== 0 )
+    if( (status=disable_cards( curr_dis_cards, curr_num_dis_cards ))== 0 )
     {
-        printf("Successfully disabled cards\n");
+        printf("Successfully %s cards\n", warm ? "parked" : "disabled");
     }
     else
     {
         printf("Error: disabling cards failed with status %d\n", status);
     }
 
-    if( (status=skiq_enable_cards( curr_ena_cards, curr_num_ena_cards, skiq_xport_init_level_full ))== 0 )
+    start_ns = elapsed_now_ns();
+    status = card_bringup_enable( &bringup, curr_ena_cards, curr_num_ena_cards,
+                                  skiq_xport_init_level_full, parallel );
+    print_bringup( curr_ena_cards, curr_num_ena_cards, elapsed_now_ns() - start_ns );
+    if( status == 0 )
     {
         printf("Successfully enabled cards\n");
     }
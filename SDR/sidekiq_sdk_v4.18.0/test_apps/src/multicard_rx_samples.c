@@ -7,6 +7,10 @@
  * Copyright 2012-2018 Epiq Solutions, All Rights Reserved
  * </pre>
  */
+#if (!defined _GNU_SOURCE)
+#define _GNU_SOURCE         /* for the NUMA helpers of rt_thread.h, see feature_test_macros(7) */
+#endif
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -20,12 +24,20 @@
 #include <pthread.h>
 #include <inttypes.h>
 
+#include "rx_consumer.h"
+#include "rx_aggregator.h"
+#include "mem_arena.h"
+#include "capture_index.h"
+
 /* flag indicating that we want to check timestamps for loss of data */
 #define CHECK_TIMESTAMPS (1)
 
 /* number of payload words in a packet (not including the header) */
 #define NUM_PAYLOAD_WORDS_IN_BLOCK (SKIQ_MAX_RX_BLOCK_SIZE_IN_WORDS-SKIQ_RX_HEADER_SIZE_IN_WORDS)
 
+/* marks the start of every block in the aggregated output file */
+#define MERGED_BLOCK_MAGIC (0x4d524758)
+
 static const char* p_file_suffix[skiq_rx_hdl_end] = { "a1", "a2", "b1"};
 
 
@@ -52,6 +64,13 @@ static skiq_chan_mode_t chan_mode=skiq_chan_mode_single;
    location of the destination file, performance can be greatly
    impacted based on this selection */
 static uint8_t write_file_immediate;
+/* flag indicating whether the blocks of all cards and handles should be
+   merged into a single file ordered on the RF timestamp instead of being
+   stored in one file per card and handle */
+static uint8_t aggregate = 0;
+/* flag indicating whether a block index (see capture_index.h) should be
+   written next to each output file */
+static uint8_t index_capture = 0;
 
 /* storage for parameters related to how many bytes we'll be receiving */
 static uint32_t num_bytes_per_pkt;  // number of bytes for each packet received
@@ -63,10 +82,47 @@ static bool running=true;
 pthread_t card_thread[SKIQ_MAX_NUM_CARDS];
 int32_t thread_status[SKIQ_MAX_NUM_CARDS];
 
+/* merges the blocks received by all of the card threads when aggregating */
+static struct rx_aggregator aggregator = RX_AGGREGATOR_INITIALIZER;
+static uint32_t agg_stream[SKIQ_MAX_NUM_CARDS][skiq_rx_hdl_end]; // aggregator stream of each card / handle
+static uint8_t agg_card[RX_AGGREGATOR_MAX_STREAMS];   // card of each aggregator stream
+static FILE* merged_fp = NULL;       // pointer to the aggregated output file
+
+/* header preceding every block in the aggregated output file */
+struct merged_block_header
+{
+    uint32_t magic;                  // MERGED_BLOCK_MAGIC
+    uint8_t card;
+    uint8_t hdl;
+    uint16_t reserved;
+    uint32_t nr_bytes;               // # of bytes following the header
+    uint32_t stream;                 // index of the card / handle in the file
+    uint64_t rf_timestamp;           // RF timestamp of the first sample
+};
+
+/* receive state for a single card, shared by the processing stages */
+struct card_capture
+{
+    uint8_t card;
+    uint32_t total_blocks_acquired[skiq_rx_hdl_end]; // total # blocks acquired
+    uint64_t next_ts[skiq_rx_hdl_end];  // next timestamp
+    uint8_t *rcv_buf[skiq_rx_hdl_end];  // buffer to copy the received data into
+    FILE* output_fp[skiq_rx_hdl_end];   // pointer to file to save the samples
+    struct capture_index index[skiq_rx_hdl_end]; // block index of each output file
+    uint64_t nr_bytes_stored[skiq_rx_hdl_end];   // # of bytes stored for the file so far
+    bool first_block[skiq_rx_hdl_end];  // indicates if the first block has been received
+    bool last_block[skiq_rx_hdl_end];   // indicates if the last block has been received
+    uint8_t num_hdl_rcv;                // # of handles currently receiving data
+};
+
 /* local functions */
 static void print_usage(void);
 static void process_cmd_line_args(int argc, char* argv[]);
 static void verify_data( FILE *pFile );
+static int32_t timestamp_stage( const struct rx_block_view *p_view, void *p_arg );
+static int32_t capture_stage( const struct rx_block_view *p_view, void *p_arg );
+static int32_t write_merged_block( const struct rx_block_view *p_view, uint32_t nr_words,
+                                   uint32_t stream, void *p_arg );
 
 /*****************************************************************************/
 /** This is the cleanup handler to ensure that the app properly exits and
@@ -91,26 +147,24 @@ void app_cleanup(int signum)
 void* process_card( void *data )
 {
     /* variables that need to be tracked per rx handle */
-    uint32_t total_blocks_acquired[skiq_rx_hdl_end]; // total # blocks acquired
-    uint64_t curr_ts[skiq_rx_hdl_end];  // current timestamp
-    uint64_t next_ts[skiq_rx_hdl_end];  // next timestamp
+    struct card_capture cap;
     uint8_t *p_start[skiq_rx_hdl_end];  // pointer to the start of the memory allocated
-    uint8_t *rcv_buf[skiq_rx_hdl_end];  // buffer to copy the received data into
-    FILE* output_fp[skiq_rx_hdl_end];   // pointer to file to save the samples
-    bool first_block[skiq_rx_hdl_end];  // indicates if the first block has been received
-    bool last_block[skiq_rx_hdl_end];   // indicates if the last block has been received
+    struct mem_arena arena = MEM_ARENA_INITIALIZER; // holds the receive buffers of every handle
+    size_t rcv_buf_size = 0;            // size (in bytes) of each receive buffer
+    char p_arena_name[32];
 
     /* keep track of the specified handles to start streaming */
     skiq_rx_hdl_t handles[skiq_rx_hdl_end];
     uint8_t nr_handles = 0;
 
-    /* variables used to manage the currently received buffer*/
-    uint32_t num_payload_words_read[skiq_rx_hdl_end]; // # payload words received
-    skiq_rx_block_t* p_rx_block;        // reference to a receive block
-    uint32_t len;                    // length (in bytes) of received data
+    /* the processing stages consume each block in place */
+    struct rx_consumer consumer = RX_CONSUMER_INITIALIZER;
+    struct rx_block_view view;       // view of the received block
+    const char *p_stage = NULL;      // name of a failing stage
+    int32_t stage_status = 0;
+    uint32_t len;
 
     skiq_rx_hdl_t curr_rx_hdl;       // current handle
-    uint8_t num_hdl_rcv = 0;         // # of handles currently receiving data
 
     /* values read back after configuring */
     uint32_t read_sample_rate;
@@ -125,50 +179,111 @@ void* process_card( void *data )
     skiq_rx_status_t rx_status;
     char p_filename[100];
 
-    /* open a file to write to for each handle enabled */
+    cap.card = card;
+    cap.num_hdl_rcv = 0;
     for( curr_rx_hdl=skiq_rx_hdl_A1; curr_rx_hdl<skiq_rx_hdl_end; curr_rx_hdl++ )
     {
-        if( hdl[curr_rx_hdl] != skiq_rx_hdl_end )
+        cap.output_fp[curr_rx_hdl] = NULL;
+        cap.index[curr_rx_hdl] = CAPTURE_INDEX_INITIALIZER;
+        cap.nr_bytes_stored[curr_rx_hdl] = 0;
+        cap.rcv_buf[curr_rx_hdl] = NULL;
+        p_start[curr_rx_hdl] = NULL;
+    }
+
+    /* open a file to write to for each handle enabled, the aggregator writes
+       the blocks of every handle to a single file instead */
+    for( curr_rx_hdl=skiq_rx_hdl_A1; curr_rx_hdl<skiq_rx_hdl_end; curr_rx_hdl++ )
+    {
+        if( (hdl[curr_rx_hdl] != skiq_rx_hdl_end) && (aggregate == 0) )
         {
             snprintf(p_filename, 100, "%s.%s.%u",
                      filename, p_file_suffix[curr_rx_hdl], card);
             /* truncate the file if it's too long */
             p_filename[99] = '\0';
-            output_fp[curr_rx_hdl]=fopen(p_filename,"wrb");
-            if (output_fp[curr_rx_hdl] == NULL)
+            cap.output_fp[curr_rx_hdl]=fopen(p_filename,"wrb");
+            if (cap.output_fp[curr_rx_hdl] == NULL)
             {
                 printf("Error: unable to open output file %s\n",p_filename);
                 ret_status = -1;
                 goto thread_exit;
             }
             printf("Info: opened file %s for output\n",p_filename);
+
+            if( index_capture == 1 )
+            {
+                struct capture_meta meta = {
+                    .p_recorder = "sidekiq multicard_rx_samples",
+                    .p_hw = NULL,
+                    .sample_rate = sample_rate,
+                    .frequency = lo_freq,
+                    .include_meta = include_meta,
+                    .packed = false,
+                    .iq_order = false,
+                    .compressed = false,
+                };
+
+                status = capture_index_open( &(cap.index[curr_rx_hdl]), p_filename, &meta );
+                if( status != 0 )
+                {
+                    printf("Error: unable to open the index of output file %s (status %"
+                           PRIi32 ")\n", p_filename, status);
+                    ret_status = -1;
+                    goto thread_close;
+                }
+            }
         }
     }
 
     /* allocate the appropriate buffer size based on whether the whole
        amount of data needs to be buffered or if the data is going to be
        written immediately to file */
+    if( (write_file_immediate == 0) && (aggregate == 0) )
+    {
+        uint8_t nr_buffers = 0;
+
+        for( curr_rx_hdl=skiq_rx_hdl_A1; curr_rx_hdl<skiq_rx_hdl_end; curr_rx_hdl++ )
+        {
+            if( hdl[curr_rx_hdl] != skiq_rx_hdl_end )
+            {
+                nr_buffers++;
+            }
+        }
+
+        /* one arena for all of the handles, faulted in and locked before
+           streaming so receiving never waits on the kernel for memory */
+        rcv_buf_size = ((size_t)SKIQ_MAX_RX_BLOCK_SIZE_IN_BYTES*num_complete_blocks)+last_block_num_bytes;
+        snprintf(p_arena_name, sizeof(p_arena_name), "card %u receive", card);
+        if( mem_arena_init( &arena, nr_buffers * MEM_ARENA_SLAB(rcv_buf_size, MEM_ARENA_ALIGN),
+                            mem_arena_pages_auto, -1, p_arena_name ) != 0 )
+        {
+            printf("Error: unable to map %zu bytes of memory for card %u!\n",
+                   nr_buffers * rcv_buf_size, card);
+            ret_status = -2;
+            goto thread_close;
+        }
+    }
     for( curr_rx_hdl=skiq_rx_hdl_A1; curr_rx_hdl<skiq_rx_hdl_end; curr_rx_hdl++ )
     {
         if( hdl[curr_rx_hdl] != skiq_rx_hdl_end )
         {
-            if( (write_file_immediate == 1) )
+            if( (write_file_immediate == 1) || (aggregate == 1) )
             {
-                rcv_buf[curr_rx_hdl] = malloc(SKIQ_MAX_RX_BLOCK_SIZE_IN_BYTES);
+                /* blocks are written straight from the receive buffer or
+                   copied into the reorder buffers of the aggregator */
+                cap.rcv_buf[curr_rx_hdl] = NULL;
             }
             else
             {
-                rcv_buf[curr_rx_hdl] = malloc((SKIQ_MAX_RX_BLOCK_SIZE_IN_BYTES*num_complete_blocks)+last_block_num_bytes);
-            }
-
-            if( rcv_buf[curr_rx_hdl] == NULL )
-            {
-                printf("Error: unable to allocate memory for card %u, handle %u!\n",
-                       card, curr_rx_hdl);
-                ret_status = -2;
-                goto thread_close;
+                cap.rcv_buf[curr_rx_hdl] = mem_arena_alloc( &arena, rcv_buf_size, MEM_ARENA_ALIGN );
+                if( cap.rcv_buf[curr_rx_hdl] == NULL )
+                {
+                    printf("Error: unable to allocate memory for card %u, handle %u!\n",
+                           card, curr_rx_hdl);
+                    ret_status = -2;
+                    goto thread_close;
+                }
             }
-            p_start[curr_rx_hdl] = rcv_buf[curr_rx_hdl];
+            p_start[curr_rx_hdl] = cap.rcv_buf[curr_rx_hdl];
         }
     }
 
@@ -179,9 +294,9 @@ void* process_card( void *data )
     {
         if( hdl[curr_rx_hdl] != skiq_rx_hdl_end )
         {
-            first_block[curr_rx_hdl] = true;
-            last_block[curr_rx_hdl] = false;
-            num_hdl_rcv++;
+            cap.first_block[curr_rx_hdl] = true;
+            cap.last_block[curr_rx_hdl] = false;
+            cap.num_hdl_rcv++;
         }
     }
 
@@ -255,8 +370,14 @@ void* process_card( void *data )
             handles[nr_handles++] = curr_rx_hdl;
 
             /* initialize next_ts and total_blocks_acquired */
-            next_ts[curr_rx_hdl] = 0llu;
-            total_blocks_acquired[curr_rx_hdl] = 0;
+            cap.next_ts[curr_rx_hdl] = 0llu;
+            cap.total_blocks_acquired[curr_rx_hdl] = 0;
+
+            /* register the processing stages for the handle */
+#if CHECK_TIMESTAMPS
+            rx_consumer_register(&consumer, "timestamp", curr_rx_hdl, timestamp_stage, &cap);
+#endif
+            rx_consumer_register(&consumer, "capture", curr_rx_hdl, capture_stage, &cap);
         }
     }
 
@@ -273,97 +394,26 @@ void* process_card( void *data )
     /************************** receive data ***************************/
 
     /* loop through until there are no more receive handles needing data */
-    while ( (num_hdl_rcv > 0) && (running==true) )
+    while ( (cap.num_hdl_rcv > 0) && (running==true) )
     {
-        /* try to grab a packet of data */
-        rx_status = skiq_receive(card, &curr_rx_hdl, &p_rx_block, &len);
+        /* try to grab a packet of data and pass it through the stages */
+        rx_status = rx_consumer_receive(&consumer, card, &view, &stage_status, &p_stage);
         if ( skiq_rx_status_success == rx_status )
         {
             /* make sure the packet is from a handle that was enabled */
-            if( hdl[curr_rx_hdl] == skiq_rx_hdl_end )
+            if( (view.hdl >= skiq_rx_hdl_end) || (hdl[view.hdl] == skiq_rx_hdl_end) )
             {
-                printf("Error: received unexpected data from hdl %u\n", curr_rx_hdl);
+                printf("Error: received unexpected data from hdl %u\n", view.hdl);
                 ret_status = -3;
                 goto thread_free;
             }
-            /* determine the number of words read based on the number of bytes
-               returned from the receive call less the header */
-            num_payload_words_read[curr_rx_hdl] = (len/4) - SKIQ_RX_HEADER_SIZE_IN_WORDS;
-
-#if CHECK_TIMESTAMPS
-            curr_ts[curr_rx_hdl] = p_rx_block->rf_timestamp; /* peek at the timestamp */
-            /* if this is the first block received then the next timestamp to expect
-               needs to be initialized */
-            if (first_block[curr_rx_hdl] == true )
-            {
-                first_block[curr_rx_hdl] = false;
-                /* will be incremented properly below for next time through */
-                next_ts[curr_rx_hdl] = curr_ts[curr_rx_hdl];
-            }
-            /* validate the timestamp */
-            else if (curr_ts[curr_rx_hdl] != next_ts[curr_rx_hdl])
-            {
-                printf("Error: timestamp error in block %d for %u/%u...expected 0x%016" PRIx64 " but got 0x%016" PRIx64 "\n", 
-                       total_blocks_acquired[curr_rx_hdl], card, curr_rx_hdl,
-                       next_ts[curr_rx_hdl], curr_ts[curr_rx_hdl]);
-                /* update the next timestamp expected based on the current timestamp
-                   since there was just a gap in the data */
-                next_ts[curr_rx_hdl] = curr_ts[curr_rx_hdl];
-            }
-#endif
-            /* copy over the data if we haven't reached the end yet */
-            if( total_blocks_acquired[curr_rx_hdl] < num_complete_blocks )
+            if( stage_status != 0 )
             {
-                if ( include_meta )
-                {
-                    memcpy(rcv_buf[curr_rx_hdl], (uint8_t*)p_rx_block, num_bytes_per_pkt);
-                }
-                else
-                {
-                    memcpy(rcv_buf[curr_rx_hdl], (void *)p_rx_block->data, num_bytes_per_pkt);
-                }
-
-                /* increment our block count */
-                total_blocks_acquired[curr_rx_hdl]++;
-
-                /* either write to the file immediately or increment the buffer
-                   where all the sample data is stored */
-                if( (write_file_immediate == 1) )
-                {
-                    fwrite( rcv_buf[curr_rx_hdl], num_bytes_per_pkt, 1, output_fp[curr_rx_hdl] );
-                }
-                else
-                {
-                    rcv_buf[curr_rx_hdl] += num_bytes_per_pkt;
-                }
-            }
-            else
-            {
-                /* if this is the first time we've reached the end for this handle
-                   we need to decrement the number of handles we're trying to receive from */
-                if( last_block[curr_rx_hdl] == false )
-                {
-                    num_hdl_rcv--;
-                    last_block[curr_rx_hdl] = true;
-                    /* we might need to write out a partial block to complete the processing */
-                    if ( include_meta )
-                    {
-                        memcpy(rcv_buf[curr_rx_hdl], (uint8_t*)p_rx_block, last_block_num_bytes);
-                    }
-                    else
-                    {
-                        memcpy(rcv_buf[curr_rx_hdl], (void *)p_rx_block->data, last_block_num_bytes);
-                    }
-
-                    if( (write_file_immediate == 1) )
-                    {
-                        fwrite( rcv_buf[curr_rx_hdl], last_block_num_bytes, 1, output_fp[curr_rx_hdl] );
-                    }
-                }
+                printf("Error: %s stage failed for card %u, handle %u (status %" PRIi32 ")\n",
+                       p_stage, card, view.hdl, stage_status);
+                ret_status = -4;
+                goto thread_free;
             }
-
-            /* update the next expected timestamp based on the number of words received */
-            next_ts[curr_rx_hdl] += num_payload_words_read[curr_rx_hdl];
         }
     }
 
@@ -373,7 +423,7 @@ thread_free:
     skiq_stop_rx_streaming_multi_immediate(card, handles, nr_handles);
 
     /* actually save the file now if this wasn't been done while receiving */
-    if( (write_file_immediate == 0) && (running==true) )
+    if( (write_file_immediate == 0) && (aggregate == 0) && (running==true) )
     {
         for( curr_rx_hdl=skiq_rx_hdl_A1; curr_rx_hdl<skiq_rx_hdl_end; curr_rx_hdl++ )
         {
@@ -381,64 +431,263 @@ thread_free:
             {
                 printf("Info: writing file for card %u, handle %u\n", card, curr_rx_hdl);
                 /* reset the receive buffer to the beginning to process the data */
-                rcv_buf[curr_rx_hdl] = p_start[curr_rx_hdl];
+                cap.rcv_buf[curr_rx_hdl] = p_start[curr_rx_hdl];
                 for( len=0; len<num_complete_blocks; len++ )
                 {
-                    fwrite( rcv_buf[curr_rx_hdl], num_bytes_per_pkt, 1, output_fp[curr_rx_hdl] );
-                    rcv_buf[curr_rx_hdl] += num_bytes_per_pkt;
+                    fwrite( cap.rcv_buf[curr_rx_hdl], num_bytes_per_pkt, 1, cap.output_fp[curr_rx_hdl] );
+                    cap.rcv_buf[curr_rx_hdl] += num_bytes_per_pkt;
                 }
                 /* write out the last partial packet if necessary */
                 if( last_block_num_bytes > 0 )
                 {
-                    fwrite( rcv_buf[curr_rx_hdl], last_block_num_bytes, 1, output_fp[curr_rx_hdl] );
+                    fwrite( cap.rcv_buf[curr_rx_hdl], last_block_num_bytes, 1, cap.output_fp[curr_rx_hdl] );
                 }
             }
         }
     }
 
-    /* make sure to free the receive buffers */
-    for( curr_rx_hdl=skiq_rx_hdl_A1; curr_rx_hdl<skiq_rx_hdl_end; curr_rx_hdl++ )
+    if( arena.p_base != NULL )
     {
-        if( hdl[curr_rx_hdl] != skiq_rx_hdl_end )
-        {
-            free(p_start[curr_rx_hdl]);
-        }
+        mem_arena_print( &arena, p_arena_name );
     }
 
 thread_close:
-    /* close all of the files */
+    /* release the receive buffers of every handle */
+    mem_arena_free( &arena );
+
+    /* close all of the files, the buffered samples were never written if the
+       capture was interrupted so neither are their blocks indexed */
     for( curr_rx_hdl=skiq_rx_hdl_A1; curr_rx_hdl<skiq_rx_hdl_end; curr_rx_hdl++ )
     {
-        if( hdl[curr_rx_hdl] != skiq_rx_hdl_end )
+        if( cap.output_fp[curr_rx_hdl] != NULL )
+        {
+            fclose( cap.output_fp[curr_rx_hdl] );
+        }
+        if( (write_file_immediate == 0) && (running == false) )
         {
-            fclose( output_fp[curr_rx_hdl] );
+            capture_index_reset( &(cap.index[curr_rx_hdl]) );
+        }
+        status = capture_index_close( &(cap.index[curr_rx_hdl]) );
+        if( status != 0 )
+        {
+            printf("Error: failed to write the index of card %u, handle %u (status %" PRIi32
+                   ")\n", card, curr_rx_hdl, status);
+            ret_status = -1;
         }
     }
 
-    /* verify the data if a counter was used */
-    if( (data_src == skiq_data_src_counter) && (running==true) )
+    /* verify the data if a counter was used, the aggregated file interleaves
+       the handles so it can't be verified the same way */
+    if( (data_src == skiq_data_src_counter) && (aggregate == 0) && (running==true) )
     {
         for( curr_rx_hdl=skiq_rx_hdl_A1; curr_rx_hdl<skiq_rx_hdl_end; curr_rx_hdl++ )
         {
             if( hdl[curr_rx_hdl] != skiq_rx_hdl_end )
             {
-                output_fp[curr_rx_hdl]=fopen(p_filename,"rb");
-                if (output_fp[curr_rx_hdl] == NULL)
+                cap.output_fp[curr_rx_hdl]=fopen(p_filename,"rb");
+                if (cap.output_fp[curr_rx_hdl] == NULL)
                 {
                     printf("Error: unable to open output file %s\n",p_filename);
                     ret_status = -1;
                 }
                 printf("Info: opened file %s for verification\n",p_filename);
-                verify_data( output_fp[curr_rx_hdl] );
+                verify_data( cap.output_fp[curr_rx_hdl] );
             }
         }
     }
 
 thread_exit:
+    /* let the aggregator emit the remaining blocks without waiting for this card */
+    if( aggregate == 1 )
+    {
+        for( curr_rx_hdl=skiq_rx_hdl_A1; curr_rx_hdl<skiq_rx_hdl_end; curr_rx_hdl++ )
+        {
+            if( hdl[curr_rx_hdl] != skiq_rx_hdl_end )
+            {
+                rx_aggregator_stream_done( &aggregator, agg_stream[card][curr_rx_hdl] );
+            }
+        }
+    }
+
     thread_status[card] = ret_status;
     return (void*)((&thread_status[card]));
 }
 
+/*****************************************************************************/
+/** This stage validates that the timestamps of the blocks received for a
+    handle are contiguous.
+
+    @param p_view: view of the received block
+    @param p_arg: pointer to the card_capture state of the card
+    @return int32_t-always 0, timestamp errors are reported but not fatal
+*/
+static int32_t timestamp_stage( const struct rx_block_view *p_view, void *p_arg )
+{
+    struct card_capture *p_cap = (struct card_capture *)p_arg;
+    skiq_rx_hdl_t curr_rx_hdl = p_view->hdl;
+    uint64_t curr_ts = p_view->p_block->rf_timestamp; /* peek at the timestamp */
+
+    /* if this is the first block received then the next timestamp to expect
+       needs to be initialized */
+    if (p_cap->first_block[curr_rx_hdl] == true )
+    {
+        p_cap->first_block[curr_rx_hdl] = false;
+        /* will be incremented properly below for next time through */
+        p_cap->next_ts[curr_rx_hdl] = curr_ts;
+    }
+    /* validate the timestamp */
+    else if (curr_ts != p_cap->next_ts[curr_rx_hdl])
+    {
+        printf("Error: timestamp error in block %d for %u/%u...expected 0x%016" PRIx64 " but got 0x%016" PRIx64 "\n",
+               p_cap->total_blocks_acquired[curr_rx_hdl], p_cap->card, curr_rx_hdl,
+               p_cap->next_ts[curr_rx_hdl], curr_ts);
+        /* update the next timestamp expected based on the current timestamp
+           since there was just a gap in the data */
+        p_cap->next_ts[curr_rx_hdl] = curr_ts;
+    }
+
+    /* update the next expected timestamp based on the number of words received */
+    p_cap->next_ts[curr_rx_hdl] += p_view->nr_payload_words;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** This stage stores the received block.  When writing the file immediately
+    the block is written straight from the receive buffer, when aggregating
+    it is handed to the aggregator, otherwise it is copied into the capture
+    buffer since it has to outlive the block.
+
+    @param p_view: view of the received block
+    @param p_arg: pointer to the card_capture state of the card
+    @return int32_t-0 on success, else a negative errno
+*/
+static int32_t capture_stage( const struct rx_block_view *p_view, void *p_arg )
+{
+    struct card_capture *p_cap = (struct card_capture *)p_arg;
+    skiq_rx_hdl_t curr_rx_hdl = p_view->hdl;
+    const void *p_src;
+    uint32_t num_bytes;
+
+    /* nothing more to do once the last block has been stored */
+    if( p_cap->last_block[curr_rx_hdl] == true )
+    {
+        return 0;
+    }
+
+    if ( include_meta )
+    {
+        p_src = (const void *)p_view->p_block;
+    }
+    else
+    {
+        p_src = (const void *)p_view->p_payload;
+    }
+
+    /* store either a complete block or the partial block at the end */
+    if( p_cap->total_blocks_acquired[curr_rx_hdl] < num_complete_blocks )
+    {
+        num_bytes = num_bytes_per_pkt;
+        p_cap->total_blocks_acquired[curr_rx_hdl]++;
+    }
+    else
+    {
+        /* this is the first time we've reached the end for this handle so we
+           need to decrement the number of handles we're trying to receive from */
+        num_bytes = last_block_num_bytes;
+        p_cap->last_block[curr_rx_hdl] = true;
+        p_cap->num_hdl_rcv--;
+    }
+
+    if( (num_bytes > 0) && (aggregate == 1) )
+    {
+        /* the aggregator copies the block and works in payload words */
+        if( include_meta )
+        {
+            num_bytes -= SKIQ_RX_HEADER_SIZE_IN_BYTES;
+        }
+        return rx_aggregator_push( &aggregator, agg_stream[p_cap->card][curr_rx_hdl],
+                                   p_view, num_bytes / 4, &running );
+    }
+    else if( num_bytes > 0 )
+    {
+        /* the buffered blocks are written to the file in the order they're
+           stored, so either way the block lands at nr_bytes_stored */
+        uint32_t nr_samples = num_bytes / 4;
+
+        if( include_meta )
+        {
+            nr_samples = ( num_bytes > SKIQ_RX_HEADER_SIZE_IN_BYTES ) ?
+                ( num_bytes - SKIQ_RX_HEADER_SIZE_IN_BYTES ) / 4 : 0;
+        }
+
+        if( capture_index_add( &(p_cap->index[curr_rx_hdl]), p_view->p_block->rf_timestamp,
+                               p_view->p_block->sys_timestamp,
+                               p_cap->nr_bytes_stored[curr_rx_hdl], nr_samples,
+                               p_view->p_block->overload ) != 0 )
+        {
+            return -EIO;
+        }
+        p_cap->nr_bytes_stored[curr_rx_hdl] += num_bytes;
+
+        if( (write_file_immediate == 1) )
+        {
+            if( fwrite( p_src, num_bytes, 1, p_cap->output_fp[curr_rx_hdl] ) != 1 )
+            {
+                return -EIO;
+            }
+        }
+        else
+        {
+            memcpy( p_cap->rcv_buf[curr_rx_hdl], p_src, num_bytes );
+            p_cap->rcv_buf[curr_rx_hdl] += num_bytes;
+        }
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** This is called by the aggregator thread for the blocks of all cards and
+    handles in order of their RF timestamp, writing each one to the aggregated
+    output file preceded by a merged_block_header.
+
+    @param p_view: view of the block being emitted
+    @param nr_words: # of payload words of the block to store
+    @param stream: aggregator stream of the block
+    @param p_arg: unused
+    @return int32_t-0 on success, else a negative errno
+*/
+static int32_t write_merged_block( const struct rx_block_view *p_view, uint32_t nr_words,
+                                   uint32_t stream, void *p_arg )
+{
+    struct merged_block_header header;
+    const void *p_src = (const void *)p_view->p_payload;
+
+    (void)p_arg;
+
+    header.magic = MERGED_BLOCK_MAGIC;
+    header.card = agg_card[stream];
+    header.hdl = (uint8_t)p_view->hdl;
+    header.reserved = 0;
+    header.nr_bytes = nr_words * 4;
+    header.stream = stream;
+    header.rf_timestamp = p_view->p_block->rf_timestamp;
+    if ( include_meta )
+    {
+        p_src = (const void *)p_view->p_block;
+        header.nr_bytes += SKIQ_RX_HEADER_SIZE_IN_BYTES;
+    }
+
+    if( (fwrite( &header, sizeof(header), 1, merged_fp ) != 1) ||
+        (fwrite( p_src, header.nr_bytes, 1, merged_fp ) != 1) )
+    {
+        return -EIO;
+    }
+
+    return 0;
+}
+
 /*****************************************************************************/
 /** This is the main function for executing the multicard_rx_samples app.
 
@@ -454,6 +703,8 @@ int main( int argc, char *argv[])
     int32_t status = 0;
     skiq_rx_hdl_t curr_rx_hdl;
     int32_t *card_status[SKIQ_MAX_NUM_CARDS];
+    uint32_t nr_streams = 0;
+    char p_filename[100];
 
     app_name = argv[0];
 
@@ -516,6 +767,44 @@ int main( int argc, char *argv[])
         return (-1);
     }
 
+    /* give every enabled handle of every card its own stream in the aggregator
+       and start merging before any card is receiving */
+    if( aggregate == 1 )
+    {
+        for( i=0; i<num_cards; i++ )
+        {
+            for( curr_rx_hdl=skiq_rx_hdl_A1; curr_rx_hdl<skiq_rx_hdl_end; curr_rx_hdl++ )
+            {
+                if( hdl[curr_rx_hdl] != skiq_rx_hdl_end )
+                {
+                    agg_card[nr_streams] = cards[i];
+                    agg_stream[cards[i]][curr_rx_hdl] = nr_streams++;
+                }
+            }
+        }
+
+        snprintf(p_filename, 100, "%s.merged", filename);
+        p_filename[99] = '\0';
+        merged_fp = fopen(p_filename, "wb");
+        if( merged_fp == NULL )
+        {
+            printf("Error: unable to open output file %s\n", p_filename);
+            skiq_exit();
+            return (-1);
+        }
+        printf("Info: opened file %s for the aggregated output of %" PRIu32 " stream(s)\n",
+               p_filename, nr_streams);
+
+        status = rx_aggregator_init( &aggregator, nr_streams, 0, 0, write_merged_block, NULL );
+        if( status != 0 )
+        {
+            printf("Error: unable to start the aggregator (status %" PRIi32 ")\n", status);
+            fclose(merged_fp);
+            skiq_exit();
+            return (-1);
+        }
+    }
+
     /* start a new thread for each card */
     for( i=0; i<num_cards; i++ )
     {
@@ -537,6 +826,19 @@ int main( int argc, char *argv[])
         }
     }
 
+    /* every card thread marked its streams done, so this returns once the
+       remaining blocks have been written */
+    if( aggregate == 1 )
+    {
+        status = rx_aggregator_close( &aggregator );
+        if( status != 0 )
+        {
+            printf("Error: failed to write the aggregated output (status %" PRIi32 ")\n", status);
+        }
+        rx_aggregator_print_stats( &aggregator, stdout );
+        fclose(merged_fp);
+    }
+
     skiq_exit();
 
     return (0);
@@ -605,7 +907,7 @@ static void verify_data(FILE *pFile)
 */
 static void process_cmd_line_args(int argc,char* argv[])
 {
-    if (argc != 13)
+    if ((argc < 13) || (argc > 15))
     {
         printf("Error: incorrect # of cmd line args\n");
         print_usage();
@@ -712,6 +1014,37 @@ static void process_cmd_line_args(int argc,char* argv[])
     }
     printf("Info: Requested Catalina chip id %s\n",argv[10]);
 
+    /* check whether to aggregate all cards into a single output file */
+    if( argc >= 14 )
+    {
+        aggregate = atoi(argv[13]);
+        if( aggregate != 0 && aggregate != 1 )
+        {
+            printf("Error: invalid aggregate option\n");
+            print_usage();
+            exit(-1);
+        }
+    }
+
+    /* check whether to index the output files, the aggregated file interleaves
+       the cards and handles so it can't be indexed */
+    if( argc == 15 )
+    {
+        index_capture = atoi(argv[14]);
+        if( index_capture != 0 && index_capture != 1 )
+        {
+            printf("Error: invalid index option\n");
+            print_usage();
+            exit(-1);
+        }
+        if( (index_capture == 1) && (aggregate == 1) )
+        {
+            printf("Error: the aggregated output file can't be indexed\n");
+            print_usage();
+            exit(-1);
+        }
+    }
+
     filename = argv[1];
 }
 
@@ -727,7 +1060,8 @@ static void print_usage(void)
     printf("       <Rx freq in Hz> <Rx gain index> <sample rate in Hz> <channel bandwidth in Hz>\n");
     printf("       <warp voltage in raw D/A count (0-1023 corresponding to 0.75-2.25V)> <iq | counter> \n");
     printf("       <save to file while receiving, 0|1> <store metadata, 0|1>  \n");
-    printf("       <RF chip id, a> <Rx path within chip id 1|2|both>\n\n");
+    printf("       <RF chip id, a> <Rx path within chip id 1|2|both> [aggregate into one file, 0|1]\n");
+    printf("       [index the output files, 0|1]\n\n");
 
     printf("   Tune to the user-specifed Rx freq and acquire the specified # of words \n");
     printf("   at the requested sample rate at the requested Rx gain (using manual gain control\n");
@@ -760,6 +1094,18 @@ static void print_usage(void)
     printf("   represents the source of the samples, which is interpreted as follows: 0=RxA1, 1=RxA2\n");
     printf("   No additional meta-data is interleaved with the I/Q samples.\n\n");
 
+    printf("   When aggregating, the blocks of all cards and handles are merged in order of their\n");
+    printf("   RF timestamp into the single file <output file>.merged.  Every block is preceded by a\n");
+    printf("   24-byte header: a 32-bit magic (0x%08x), the 8-bit card, the 8-bit handle, 16 reserved\n", MERGED_BLOCK_MAGIC);
+    printf("   bits, the 32-bit # of bytes that follow, the 32-bit stream index and the 64-bit RF\n");
+    printf("   timestamp.  The RF timestamps of the cards are only comparable when the cards share a\n");
+    printf("   reference clock and had their timestamps reset together.\n\n");
+
+    printf("   When indexing, every output file gets a <file>.idx block index mapping the RF\n");
+    printf("   and system timestamps of each block to its offset in the file, and a\n");
+    printf("   <file>.sigmf-meta SigMF description annotating timestamp gaps and RF overload.\n");
+    printf("   See capture_index.h for the formats.  The aggregated file can't be indexed.\n\n");
+
     printf("Example: ./multicard_rx_samples /tmp/out 100000 850000000 50 10000000 10000000 512 iq 0 0 a 1\n");
 }
 
@@ -26,7 +26,12 @@
 #include <sidekiq_api.h>
 #include <pthread.h>
 
-FILE *input_fp = NULL;
+#include "tx_file_source.h"
+#include "tx_block_set.h"
+
+/* the input file is loaded once into blocks that the transmit threads of all cards share */
+static struct tx_file_source tx_source = TX_FILE_SOURCE_INITIALIZER;
+static struct tx_block_set tx_blocks = TX_BLOCK_SET_INITIALIZER;
 static char *app_name;
 static uint64_t lo_freq;
 static uint64_t freq_offset;
@@ -40,8 +45,6 @@ static uint8_t tx_mode=0;
 
 static bool running=true;
 
-static skiq_tx_block_t **p_tx_blocks = NULL; /* reference to an array of transmit block references */
-
 uint32_t num_blocks=0;
 
 pthread_t card_thread[SKIQ_MAX_NUM_CARDS];
@@ -50,7 +53,6 @@ int32_t thread_status[SKIQ_MAX_NUM_CARDS];
 /* local functions */
 static void print_usage(void);
 static int32_t process_cmd_line_args(int argc, char* argv[]);
-static int32_t init_tx_buffer(void);
 
 /*****************************************************************************/
 /** This is the cleanup handler to ensure that the app properly exits and
@@ -81,6 +83,8 @@ void* process_card( void *data )
     uint32_t read_sample_rate;
     double actual_sample_rate;
     uint32_t num_repeat=repeat;
+    uint32_t pass=0;       // repeats finished and reported to the block set
+    skiq_tx_block_t *p_tx_block = NULL; /* shared with the other cards, never written */
 
     int32_t ret_status=0;  // overall status of the thread
     uint8_t card = *((uint8_t*)(data)); // sidekiq card this thread is using
@@ -147,12 +151,32 @@ void* process_card( void *data )
         // transmit a block at a time
         while( (curr_block < num_blocks) && (running==true) )
         {
+            /* waits only if the loader hasn't reached the block yet; the
+               block already carries its timestamp for this pass */
+            p_tx_block = tx_block_set_get( &tx_blocks, pass, curr_block );
+            if( p_tx_block == NULL )
+            {
+                fprintf(stderr, "Error: unable to load block %u of the input file (result"
+                        " code %" PRIi32 ")\n", curr_block, tx_blocks.status);
+                ret_status = ( tx_blocks.status != 0 ) ? tx_blocks.status : -EIO;
+                running = false;
+                break;
+            }
+
             // transmit the data
-            skiq_transmit(card, skiq_tx_hdl_A1, p_tx_blocks[curr_block], NULL );
+            skiq_transmit(card, skiq_tx_hdl_A1, p_tx_block, NULL );
             curr_block++;
         }
         num_repeat--;
         curr_block = 0;
+
+        /* the timestamps keep counting across repeats; the next pass is
+           already stamped unless this card is a whole pass ahead */
+        if( (num_repeat > 0) && (running==true) )
+        {
+            tx_block_set_end_pass( &tx_blocks, pass );
+            pass++;
+        }
     }
 
     // see how many underruns we had if we were running in immediate mode
@@ -173,6 +197,7 @@ void* process_card( void *data )
     skiq_stop_tx_streaming(card, skiq_tx_hdl_A1);
 
 thread_exit:
+    tx_block_set_leave( &tx_blocks, pass );
     thread_status[card] = ret_status;
     return (void*)((&thread_status[card]));
 }
@@ -190,7 +215,6 @@ int main( int argc, char *argv[])
     uint8_t cards[SKIQ_MAX_NUM_CARDS]; /* all available Sidekiq card #s */
     uint8_t num_cards=0;
     uint8_t i=0;
-    uint32_t j = 0;
     int32_t* card_status[SKIQ_MAX_NUM_CARDS];
     bool skiq_initialized = false;
 
@@ -205,9 +229,6 @@ int main( int argc, char *argv[])
         goto finished;
     }
 
-    // initialize the transmit buffer
-    init_tx_buffer();
-
     printf("Info: initializing %" PRIu8 " cards...\n", num_cards);
 
     /* bring up the PCIe interface for all the cards in the system */
@@ -237,6 +258,18 @@ int main( int argc, char *argv[])
     }
     skiq_initialized = true;
 
+    /* the cards transmit from the same blocks, loaded while the cards are configured */
+    status = tx_block_set_open( &tx_blocks, &tx_source, block_size_in_words,
+                                (tx_mode != skiq_tx_immediate_data_flow_mode), timestamp,
+                                num_cards );
+    if ( status != 0 )
+    {
+        fprintf(stderr, "Error: unable to start loading the input file (result code %"
+                PRIi32 ")\n", status);
+        status = -1;
+        goto finished;
+    }
+
     /* start a new thread for each card */
     for( i=0; i<num_cards; i++ )
     {
@@ -267,106 +300,12 @@ finished:
         skiq_initialized = false;
     }
 
-    if (NULL != input_fp)
-    {
-        fclose(input_fp);
-        input_fp = NULL;
-    }
-
-    if (NULL != p_tx_blocks)
-    {
-        for (j = 0; j < num_blocks; j++)
-        {
-            skiq_tx_block_free(p_tx_blocks[j]);
-        }
-
-        free(p_tx_blocks);
-        p_tx_blocks = NULL;
-    }
+    tx_block_set_close(&tx_blocks);
+    tx_file_source_close(&tx_source);
 
     return ((int) status);
 }
 
-/*****************************************************************************/
-/** This function reads the contents of the file into p_tx_blocks.
-
-    @param none
-    @return: void
-*/
-static int32_t init_tx_buffer(void)
-{
-    int32_t status = 0;
-    uint32_t num_bytes_in_file=0;
-    int32_t num_bytes_read=1;
-    uint32_t i = 0;
-    uint32_t j = 0;
-
-    // determine how large the file is and how many blocks we'll need to send
-    fseek(input_fp, 0, SEEK_END);
-    num_bytes_in_file = ftell(input_fp);
-    rewind(input_fp);
-    num_blocks = (num_bytes_in_file / (block_size_in_words*4));
-    // if we don't end on an even block boundary, we need an extra block
-    if ( (num_bytes_in_file % (block_size_in_words * 4)) != 0 )
-    {
-        num_blocks++;
-    }
-    printf("Info: %u blocks contained in the file\n", num_blocks);
-
-    // allocate the buffer
-    p_tx_blocks = calloc( num_blocks + 1, sizeof( skiq_tx_block_t* ) );
-    if( p_tx_blocks == NULL )
-    {
-        fprintf(stderr, "Error: unable to allocate %u bytes to hold transmit block descriptors\n",
-                (uint32_t)((num_blocks + 1) * sizeof( skiq_tx_block_t* )));
-        status = -1;
-        goto finished;
-    }
-
-    // read in the contents of the file, one block at a time
-    for (i = 0; i < num_blocks; i++)
-    {
-        if ( !feof(input_fp) && (num_bytes_read>0) )
-        {
-            /* allocate a transmit block by number of samples */
-            p_tx_blocks[i] = skiq_tx_block_allocate( block_size_in_words );
-            if ( p_tx_blocks[i] == NULL )
-            {
-                fprintf(stderr, "Error: unable to allocate a transmit block\n");
-                status = -1;
-                goto finished;
-            }
-
-            // copy in the timestamp
-            skiq_tx_set_block_timestamp( p_tx_blocks[i], timestamp );
-
-            // read another block of samples
-            num_bytes_read = fread( p_tx_blocks[i]->data, sizeof(int32_t), block_size_in_words, input_fp );
-
-            // update the timestamp
-            timestamp += block_size_in_words;
-        }
-    }
-
-finished:
-    if (0 != status)
-    {
-        for (j = 0; j < i; j++)
-        {
-            skiq_tx_block_free(p_tx_blocks[j]);
-        }
-
-        if (NULL != p_tx_blocks)
-        {
-            free(p_tx_blocks);
-            p_tx_blocks = NULL;
-        }
-    }
-
-    return status;
-}
-
-
 /*****************************************************************************/
 /** This function extracts all cmd line args
 
@@ -385,14 +324,6 @@ static int32_t process_cmd_line_args(int argc, char* argv[])
         status = -1;
         goto finished;
     }
-    input_fp=fopen(argv[1],"rb");
-    if( input_fp == NULL )
-    {
-        fprintf(stderr, "Error: unable to open input file %s\n", argv[1]);
-        status = -2;
-        goto finished;
-    }
-
     sscanf(argv[2], "%" PRIu64 "", &lo_freq);
     printf("Info: Requested Tx LO freq will be %" PRIu64 " Hz\n", lo_freq);
     sscanf(argv[3], "%" PRIu64 "", &freq_offset);
@@ -406,6 +337,18 @@ static int32_t process_cmd_line_args(int argc, char* argv[])
 
     sscanf(argv[7], "%u", &block_size_in_words);
     printf("Info: Requested block size in words is %d\n", block_size_in_words);
+
+    /* map the input file, main() starts loading it into the shared blocks */
+    status = tx_file_source_open(&tx_source, argv[1], block_size_in_words * 4, 0);
+    if( status != 0 )
+    {
+        fprintf(stderr, "Error: unable to open input file %s (result code %"
+                PRIi32 ")\n", argv[1], status);
+        status = -2;
+        goto finished;
+    }
+    num_blocks = tx_source.nr_blocks;
+    printf("Info: %u blocks contained in the file\n", num_blocks);
 #ifdef __MINGW32__
     sscanf(argv[8], "%2" SCNu8, &tx_mode);
 #else
@@ -426,11 +369,7 @@ static int32_t process_cmd_line_args(int argc, char* argv[])
 finished:
     if (0 != status)
     {
-        if (NULL != input_fp)
-        {
-            fclose(input_fp);
-            input_fp = NULL;
-        }
+        tx_file_source_close(&tx_source);
     }
 
     return status;
@@ -454,6 +393,10 @@ static void print_usage(void)
     printf("   (where each 16-bit value is a signed twos-complement little-endian value).\n");
     printf("   Note: in timestamp mode, the appropriate timestamps are automatically added\n");
     printf("   to the I/Q data as it is being sent out, without any gaps in the data.\n");
+    printf("   The file is loaded once and shared by all of the cards, which start as soon\n");
+    printf("   as its first block is loaded; in timestamp mode the cards share the same\n");
+    printf("   timestamps, and a card only waits for the others once it is a whole repeat\n");
+    printf("   ahead of the slowest one.\n");
     printf("   I/Q data won't start transmitting out until the <initial timestamp>\n");
     printf("   has been reached.  In practice, a reasonable value for this\n");
     printf("   is on the order of 100000.  The same file is transmitted by each card detected,\n");
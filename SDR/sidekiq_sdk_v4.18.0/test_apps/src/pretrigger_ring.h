@@ -0,0 +1,228 @@
+/**
+ * @file   pretrigger_ring.h
+ *
+ * @brief  Fixed size ring of receive blocks that always holds the most recent history of a
+ *         handle, from which a window around a trigger is frozen and written out.
+ *
+ * The receive thread pushes every block it receives, overwriting the oldest one, so at any time
+ * the ring holds the last nr_slots blocks.  When a trigger fires, the receive thread holds the
+ * first block of the window it wants to keep (pretrigger_ring_hold()); the producer then never
+ * overwrites that block or anything after it.  A writer thread drains the window and releases
+ * the blocks one by one (pretrigger_ring_release()) as they reach the output file, so the
+ * receive thread keeps streaming into the ring while the window is written.  If the writer falls
+ * a whole ring behind, pushes fail and the blocks are counted as dropped instead of stalling the
+ * receive thread; with a ring twice the size of the window this only happens when the output
+ * can't sustain the capture rate.
+ *
+ * The producer and the writer share only the head and hold sequence numbers, so neither side
+ * takes a lock.  Sequence numbers count blocks pushed since the ring was initialized and never
+ * wrap in practice.
+ */
+
+#ifndef __PRETRIGGER_RING_H__
+#define __PRETRIGGER_RING_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/***** DEFINES *****/
+
+/* value of hold when no window is held */
+#define PRETRIGGER_RING_NO_HOLD         (UINT64_MAX)
+
+/* alignment of each slot */
+#define PRETRIGGER_RING_ALIGN           (64)
+
+/***** TYPEDEFS *****/
+
+struct pretrigger_ring
+{
+    uint8_t *p_mem;                     /* nr_slots * slot_size bytes */
+    uint32_t *p_len;                    /* number of valid bytes in each slot */
+    uint32_t slot_size;
+    uint32_t nr_slots;
+
+    uint64_t head;                      /* sequence of the next block pushed, written by the producer */
+    uint64_t hold;                      /* oldest block that must not be overwritten */
+
+    /* statistics, producer only */
+    uint64_t nr_pushed;
+    uint64_t nr_dropped;
+};
+
+#define PRETRIGGER_RING_INITIALIZER                     \
+    (struct pretrigger_ring){                           \
+        .p_mem = NULL,                                  \
+        .p_len = NULL,                                  \
+        .slot_size = 0,                                 \
+        .nr_slots = 0,                                  \
+        .head = 0,                                      \
+        .hold = PRETRIGGER_RING_NO_HOLD,                \
+        .nr_pushed = 0,                                 \
+        .nr_dropped = 0,                                \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+/*****************************************************************************/
+/** Release the memory of a ring.  Safe to call on a ring that failed to initialize.
+
+    @param[in] r            ring
+
+    @return void
+*/
+static inline void pretrigger_ring_free( struct pretrigger_ring *r )
+{
+    free( r->p_mem );
+    free( r->p_len );
+    *r = PRETRIGGER_RING_INITIALIZER;
+}
+
+/*****************************************************************************/
+/** Allocate a ring.
+
+    @param[out] r           ring to initialize
+    @param[in]  nr_slots    number of blocks held
+    @param[in]  block_size  largest block in bytes
+
+    @return 0 on success, -EINVAL or -ENOMEM
+*/
+static inline int32_t pretrigger_ring_init( struct pretrigger_ring *r,
+                                            uint32_t nr_slots,
+                                            uint32_t block_size )
+{
+    *r = PRETRIGGER_RING_INITIALIZER;
+    if ( ( nr_slots == 0 ) || ( block_size == 0 ) )
+    {
+        return -EINVAL;
+    }
+
+    r->slot_size = ( block_size + PRETRIGGER_RING_ALIGN - 1 ) & ~( PRETRIGGER_RING_ALIGN - 1 );
+    r->nr_slots = nr_slots;
+    if ( posix_memalign( (void **)&(r->p_mem), PRETRIGGER_RING_ALIGN,
+                         (size_t)r->slot_size * nr_slots ) != 0 )
+    {
+        r->p_mem = NULL;
+    }
+    r->p_len = calloc( nr_slots, sizeof(uint32_t) );
+    if ( ( r->p_mem == NULL ) || ( r->p_len == NULL ) )
+    {
+        pretrigger_ring_free( r );
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Copy a block into the ring, overwriting the oldest block unless it is held.  Producer only.
+
+    @param[in] r            ring
+    @param[in] p_block      block
+    @param[in] len          size of the block in bytes, at most the block_size of the ring
+
+    @return 0 on success, -ENOBUFS if the block was dropped because the ring is full of held
+    blocks
+*/
+static inline int32_t pretrigger_ring_push( struct pretrigger_ring *r,
+                                            const void *p_block,
+                                            uint32_t len )
+{
+    const uint64_t head = r->head;
+    const uint64_t hold = __atomic_load_n( &(r->hold), __ATOMIC_ACQUIRE );
+    uint32_t slot;
+
+    if ( ( hold != PRETRIGGER_RING_NO_HOLD ) && ( head - hold >= r->nr_slots ) )
+    {
+        r->nr_dropped++;
+        return -ENOBUFS;
+    }
+
+    slot = head % r->nr_slots;
+    memcpy( r->p_mem + ( (size_t)slot * r->slot_size ), p_block, len );
+    r->p_len[slot] = len;
+    r->nr_pushed++;
+    __atomic_store_n( &(r->head), head + 1, __ATOMIC_RELEASE );
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Oldest block still in the ring.  Producer only.
+
+    @param[in] r            ring
+
+    @return sequence of the oldest block
+*/
+static inline uint64_t pretrigger_ring_oldest( const struct pretrigger_ring *r )
+{
+    return ( r->head > r->nr_slots ) ? r->head - r->nr_slots : 0;
+}
+
+/*****************************************************************************/
+/** Stop the producer from overwriting a block and every block after it.  Producer only, and
+    only while no window is held.
+
+    @param[in] r            ring
+    @param[in] seq          first block to keep, not older than pretrigger_ring_oldest()
+
+    @return void
+*/
+static inline void pretrigger_ring_hold( struct pretrigger_ring *r,
+                                         uint64_t seq )
+{
+    __atomic_store_n( &(r->hold), seq, __ATOMIC_RELEASE );
+}
+
+/*****************************************************************************/
+/** Whether a window is (still) held.
+
+    @param[in] r            ring
+
+    @return true if a window is held
+*/
+static inline bool pretrigger_ring_is_held( const struct pretrigger_ring *r )
+{
+    return ( __atomic_load_n( &(r->hold), __ATOMIC_ACQUIRE ) != PRETRIGGER_RING_NO_HOLD );
+}
+
+/*****************************************************************************/
+/** Access a held block.  Writer only.
+
+    @param[in]  r           ring
+    @param[in]  seq         block at or after the hold, before the head
+    @param[out] p_len       size of the block in bytes
+
+    @return the block
+*/
+static inline const void *pretrigger_ring_block( const struct pretrigger_ring *r,
+                                                 uint64_t seq,
+                                                 uint32_t *p_len )
+{
+    const uint32_t slot = seq % r->nr_slots;
+
+    *p_len = r->p_len[slot];
+    return r->p_mem + ( (size_t)slot * r->slot_size );
+}
+
+/*****************************************************************************/
+/** Let the producer overwrite held blocks again.  Writer only.
+
+    @param[in] r            ring
+    @param[in] seq          first block still needed, or PRETRIGGER_RING_NO_HOLD when the
+                            window has been written
+
+    @return void
+*/
+static inline void pretrigger_ring_release( struct pretrigger_ring *r,
+                                            uint64_t seq )
+{
+    __atomic_store_n( &(r->hold), seq, __ATOMIC_RELEASE );
+}
+
+#endif  /* __PRETRIGGER_RING_H__ */
@@ -0,0 +1,530 @@
+/**
+ * @file   psd.h
+ *
+ * @brief  Streaming power spectral density estimate (Welch) for received I/Q samples.
+ *
+ * Samples are fed in as they are received, a block at a time.  They are cut into Hann windowed
+ * segments of one FFT length, overlapping by half, and the power of every segment is summed
+ * per FFT bin.  After the requested number of segments (or when the estimate is flushed, e.g.
+ * at the end of a dwell in a sweep) the averaged bins are handed to a callback in dBFS, with DC
+ * in the middle of the frame.  The bins are normalized so that a full-scale complex tone in the
+ * centre of a bin reads 0 dBFS.
+ *
+ * The FFT is an in-place radix-2 transform whose bit reversal table, twiddle factors and window
+ * are computed once, when the plan is created, so a segment costs one pass over the window and
+ * log2(N) butterfly passes.
+ */
+
+#ifndef __PSD_H__
+#define __PSD_H__
+
+/***** INCLUDES *****/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+/***** DEFINES *****/
+
+#define PSD_MIN_NR_BINS                 (16)
+#define PSD_MAX_NR_BINS                 (65536)
+
+/* default number of segments averaged into each frame */
+#define PSD_DEFAULT_NR_AVERAGE          (64)
+
+/* pass as nr_average to only produce a frame when the estimate is flushed */
+#define PSD_AVERAGE_UNTIL_FLUSH         (0)
+
+/* "PSD1", the first word of each frame written by psd_write_frame() */
+#define PSD_FRAME_MAGIC                 (0x31445350)
+
+/* floor applied to empty bins so that the log stays finite */
+#define PSD_MIN_DB                      (-200.0f)
+
+/***** TYPEDEFS *****/
+
+/* precomputed state for one FFT length */
+struct psd_plan
+{
+    uint32_t nr_bins;
+    uint32_t *p_bitrev;                 /* bit reversed index of each input sample */
+    float *p_twiddle;                   /* exp(-2 pi i k / N), interleaved re/im, N/2 entries */
+    float *p_window;                    /* Hann window */
+    float window_sum;                   /* coherent gain of the window */
+};
+
+struct psd;
+
+/* called with each averaged frame (nr_bins values in dBFS, DC centred), return 0 to continue */
+typedef int32_t (*psd_frame_fn)( const struct psd *p, const float *p_db, void *p_arg );
+
+struct psd
+{
+    struct psd_plan plan;
+    uint32_t step;                      /* samples between the starts of adjacent segments */
+    uint32_t nr_average;                /* segments per frame, or PSD_AVERAGE_UNTIL_FLUSH */
+    float scale;                        /* converts a sample to a fraction of full scale */
+    bool iq_swap;                       /* samples are I then Q rather than Q then I */
+
+    float *p_pending;                   /* interleaved I/Q of the current partial segment */
+    uint32_t nr_pending;
+    uint64_t pending_ts;                /* RF timestamp of the first pending sample */
+
+    float *p_work;                      /* FFT buffer, interleaved re/im */
+    float *p_accum;                     /* power summed over the segments of the frame */
+    float *p_db;                        /* the frame handed to the callback */
+    uint32_t nr_averaged;               /* segments in p_accum */
+    uint64_t frame_ts;                  /* RF timestamp of the first segment of the frame */
+
+    psd_frame_fn fn;
+    void *p_arg;
+
+    /* statistics */
+    uint64_t nr_segments;
+    uint64_t nr_frames;
+    uint64_t nr_discontinuities;        /* partial segments dropped because of a timestamp gap */
+};
+
+/* header ahead of each frame written by psd_write_frame(), followed by nr_bins floats */
+struct psd_frame_header
+{
+    uint32_t magic;
+    uint32_t nr_bins;
+    uint64_t rf_timestamp;              /* first sample of the first segment */
+    uint64_t freq;                      /* centre frequency in Hertz */
+    uint32_t sample_rate;
+    uint32_t nr_segments;               /* number of segments averaged */
+};
+
+/***** INLINE FUNCTIONS  *****/
+
+/*****************************************************************************/
+/** Release a plan.  Safe to call on a plan that failed to initialize.
+
+    @param[in] plan         plan
+
+    @return void
+*/
+static inline void psd_plan_free( struct psd_plan *plan )
+{
+    free( plan->p_bitrev );
+    free( plan->p_twiddle );
+    free( plan->p_window );
+    plan->p_bitrev = NULL;
+    plan->p_twiddle = NULL;
+    plan->p_window = NULL;
+    plan->nr_bins = 0;
+}
+
+/*****************************************************************************/
+/** Compute the tables for an FFT length.
+
+    @param[out] plan        plan to initialize
+    @param[in]  nr_bins     FFT length, a power of two between PSD_MIN_NR_BINS and
+                            PSD_MAX_NR_BINS
+
+    @return 0 on success, -EINVAL for an unsupported length, -ENOMEM
+*/
+static inline int32_t psd_plan_init( struct psd_plan *plan,
+                                     uint32_t nr_bins )
+{
+    uint32_t log2_n = 0, i, b;
+
+    memset( plan, 0, sizeof(*plan) );
+    if ( ( nr_bins < PSD_MIN_NR_BINS ) || ( nr_bins > PSD_MAX_NR_BINS ) ||
+         ( ( nr_bins & ( nr_bins - 1 ) ) != 0 ) )
+    {
+        return -EINVAL;
+    }
+    while ( ( 1u << log2_n ) < nr_bins )
+    {
+        log2_n++;
+    }
+
+    plan->p_bitrev = malloc( nr_bins * sizeof(uint32_t) );
+    plan->p_twiddle = malloc( nr_bins * sizeof(float) );
+    plan->p_window = malloc( nr_bins * sizeof(float) );
+    if ( ( plan->p_bitrev == NULL ) || ( plan->p_twiddle == NULL ) || ( plan->p_window == NULL ) )
+    {
+        psd_plan_free( plan );
+        return -ENOMEM;
+    }
+    plan->nr_bins = nr_bins;
+
+    for ( i = 0; i < nr_bins; i++ )
+    {
+        uint32_t r = 0;
+
+        for ( b = 0; b < log2_n; b++ )
+        {
+            r |= ( ( i >> b ) & 1 ) << ( log2_n - 1 - b );
+        }
+        plan->p_bitrev[i] = r;
+
+        plan->p_window[i] = (float)( 0.5 - 0.5 * cos( 2.0 * M_PI * i / nr_bins ) );
+        plan->window_sum += plan->p_window[i];
+    }
+    for ( i = 0; i < nr_bins / 2; i++ )
+    {
+        plan->p_twiddle[2 * i] = (float)cos( 2.0 * M_PI * i / nr_bins );
+        plan->p_twiddle[2 * i + 1] = (float)-sin( 2.0 * M_PI * i / nr_bins );
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Transform a buffer in place.  The input must already be in bit reversed order.
+
+    @param[in]    plan      plan for the length of the buffer
+    @param[inout] p_data    nr_bins complex values, interleaved re/im
+
+    @return void
+*/
+static inline void psd_fft( const struct psd_plan *plan,
+                            float *p_data )
+{
+    const uint32_t n = plan->nr_bins;
+    uint32_t size, start, k;
+
+    for ( size = 2; size <= n; size <<= 1 )
+    {
+        const uint32_t half = size / 2;
+        const uint32_t tw_step = n / size;
+
+        for ( start = 0; start < n; start += size )
+        {
+            float *p_a = &(p_data[2 * start]);
+            float *p_b = &(p_data[2 * ( start + half )]);
+
+            for ( k = 0; k < half; k++ )
+            {
+                const float wr = plan->p_twiddle[2 * k * tw_step];
+                const float wi = plan->p_twiddle[2 * k * tw_step + 1];
+                const float xr = p_b[2 * k] * wr - p_b[2 * k + 1] * wi;
+                const float xi = p_b[2 * k] * wi + p_b[2 * k + 1] * wr;
+
+                p_b[2 * k] = p_a[2 * k] - xr;
+                p_b[2 * k + 1] = p_a[2 * k + 1] - xi;
+                p_a[2 * k] += xr;
+                p_a[2 * k + 1] += xi;
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+/** Release an estimator.  Safe to call on an estimator that failed to initialize.
+
+    @param[in] p            estimator
+
+    @return void
+*/
+static inline void psd_free( struct psd *p )
+{
+    psd_plan_free( &(p->plan) );
+    free( p->p_pending );
+    free( p->p_work );
+    free( p->p_accum );
+    free( p->p_db );
+    p->p_pending = NULL;
+    p->p_work = NULL;
+    p->p_accum = NULL;
+    p->p_db = NULL;
+}
+
+/*****************************************************************************/
+/** Create an estimator.
+
+    @param[out] p           estimator to initialize
+    @param[in]  nr_bins     FFT length (see psd_plan_init())
+    @param[in]  nr_average  segments averaged into each frame, or PSD_AVERAGE_UNTIL_FLUSH
+    @param[in]  resolution  RX IQ resolution in bits, which sets full scale
+    @param[in]  iq_swap     samples are ordered I then Q
+    @param[in]  fn          frame callback
+    @param[in]  p_arg       opaque argument passed to the callback
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t psd_init( struct psd *p,
+                                uint32_t nr_bins,
+                                uint32_t nr_average,
+                                uint8_t resolution,
+                                bool iq_swap,
+                                psd_frame_fn fn,
+                                void *p_arg )
+{
+    int32_t status;
+
+    memset( p, 0, sizeof(*p) );
+    if ( ( resolution == 0 ) || ( resolution > 16 ) )
+    {
+        return -EINVAL;
+    }
+    status = psd_plan_init( &(p->plan), nr_bins );
+    if ( status != 0 )
+    {
+        return status;
+    }
+
+    p->p_pending = calloc( 2 * nr_bins, sizeof(float) );
+    p->p_work = calloc( 2 * nr_bins, sizeof(float) );
+    p->p_accum = calloc( nr_bins, sizeof(float) );
+    p->p_db = calloc( nr_bins, sizeof(float) );
+    if ( ( p->p_pending == NULL ) || ( p->p_work == NULL ) || ( p->p_accum == NULL ) ||
+         ( p->p_db == NULL ) )
+    {
+        psd_free( p );
+        return -ENOMEM;
+    }
+
+    p->step = nr_bins / 2;
+    p->nr_average = nr_average;
+    p->scale = 1.0f / (float)( 1u << ( resolution - 1 ) );
+    p->iq_swap = iq_swap;
+    p->fn = fn;
+    p->p_arg = p_arg;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Discard the pending samples and the partially averaged frame, e.g. after a retune.
+
+    @param[in] p            estimator
+
+    @return void
+*/
+static inline void psd_reset( struct psd *p )
+{
+    p->nr_pending = 0;
+    p->nr_averaged = 0;
+    memset( p->p_accum, 0, p->plan.nr_bins * sizeof(float) );
+}
+
+/*****************************************************************************/
+/** Hand the averaged frame, if any, to the callback and start a new one.
+
+    @param[in] p            estimator
+
+    @return 0 if there was nothing to flush or the callback succeeded, else its status
+*/
+static inline int32_t psd_flush( struct psd *p )
+{
+    const uint32_t n = p->plan.nr_bins;
+    const float norm = 1.0f / ( (float)p->nr_averaged * p->plan.window_sum * p->plan.window_sum );
+    int32_t status = 0;
+    uint32_t i;
+
+    if ( p->nr_averaged == 0 )
+    {
+        return 0;
+    }
+
+    /* swap the halves so that the most negative frequency comes first */
+    for ( i = 0; i < n; i++ )
+    {
+        float power = p->p_accum[i] * norm;
+        float db = ( power > 0.0f ) ? 10.0f * log10f( power ) : PSD_MIN_DB;
+
+        p->p_db[( i + n / 2 ) & ( n - 1 )] = ( db > PSD_MIN_DB ) ? db : PSD_MIN_DB;
+    }
+    p->nr_frames++;
+    if ( p->fn != NULL )
+    {
+        status = p->fn( p, p->p_db, p->p_arg );
+    }
+
+    p->nr_averaged = 0;
+    memset( p->p_accum, 0, n * sizeof(float) );
+
+    return status;
+}
+
+/* transform the pending segment and add its power to the frame */
+static inline int32_t _psd_segment( struct psd *p )
+{
+    const struct psd_plan *plan = &(p->plan);
+    const uint32_t n = plan->nr_bins;
+    float *p_work = p->p_work;
+    uint32_t i;
+
+    for ( i = 0; i < n; i++ )
+    {
+        const uint32_t j = plan->p_bitrev[i];
+
+        p_work[2 * j] = p->p_pending[2 * i] * plan->p_window[i];
+        p_work[2 * j + 1] = p->p_pending[2 * i + 1] * plan->p_window[i];
+    }
+    psd_fft( plan, p_work );
+    for ( i = 0; i < n; i++ )
+    {
+        p->p_accum[i] += p_work[2 * i] * p_work[2 * i] + p_work[2 * i + 1] * p_work[2 * i + 1];
+    }
+
+    if ( p->nr_averaged == 0 )
+    {
+        p->frame_ts = p->pending_ts;
+    }
+    p->nr_averaged++;
+    p->nr_segments++;
+
+    /* keep the second half, it is the first half of the next segment */
+    memmove( p->p_pending, &(p->p_pending[2 * p->step]), 2 * ( n - p->step ) * sizeof(float) );
+    p->nr_pending = n - p->step;
+    p->pending_ts += p->step;
+
+    if ( ( p->nr_average != PSD_AVERAGE_UNTIL_FLUSH ) && ( p->nr_averaged >= p->nr_average ) )
+    {
+        return psd_flush( p );
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Add received samples to the estimate.  The callback is invoked from here whenever a frame
+    completes.
+
+    @param[in] p            estimator
+    @param[in] p_iq         16-bit samples, two per complex sample
+    @param[in] nr_samples   number of complex samples
+    @param[in] rf_timestamp RF timestamp of the first sample
+
+    @return 0 on success, else the status of the first failing callback
+*/
+static inline int32_t psd_feed( struct psd *p,
+                                const int16_t *p_iq,
+                                uint32_t nr_samples,
+                                uint64_t rf_timestamp )
+{
+    const uint32_t n = p->plan.nr_bins;
+    const uint32_t i_offset = p->iq_swap ? 0 : 1;
+    const float scale = p->scale;
+    int32_t status = 0;
+
+    if ( ( p->nr_pending != 0 ) && ( rf_timestamp != ( p->pending_ts + p->nr_pending ) ) )
+    {
+        /* a segment may not span a gap in the samples */
+        p->nr_discontinuities++;
+        p->nr_pending = 0;
+    }
+    if ( p->nr_pending == 0 )
+    {
+        p->pending_ts = rf_timestamp;
+    }
+
+    while ( nr_samples > 0 )
+    {
+        uint32_t nr_copy = n - p->nr_pending;
+        float *p_dst = &(p->p_pending[2 * p->nr_pending]);
+        uint32_t i;
+
+        if ( nr_copy > nr_samples )
+        {
+            nr_copy = nr_samples;
+        }
+        for ( i = 0; i < nr_copy; i++ )
+        {
+            p_dst[2 * i] = (float)p_iq[2 * i + i_offset] * scale;
+            p_dst[2 * i + 1] = (float)p_iq[2 * i + ( 1 - i_offset )] * scale;
+        }
+        p->nr_pending += nr_copy;
+        p_iq += 2 * nr_copy;
+        nr_samples -= nr_copy;
+
+        if ( p->nr_pending == n )
+        {
+            status = _psd_segment( p );
+            if ( status != 0 )
+            {
+                break;
+            }
+        }
+    }
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Find the strongest bin of a frame and the share of bins above a threshold.
+
+    @param[in]  p_db            frame from the callback
+    @param[in]  nr_bins         number of bins in the frame
+    @param[in]  threshold_db    occupancy threshold in dBFS
+    @param[out] p_peak_bin      index of the strongest bin (may be NULL)
+    @param[out] p_peak_db       power of the strongest bin (may be NULL)
+
+    @return the fraction of bins above threshold_db
+*/
+static inline float psd_frame_occupancy( const float *p_db,
+                                         uint32_t nr_bins,
+                                         float threshold_db,
+                                         uint32_t *p_peak_bin,
+                                         float *p_peak_db )
+{
+    uint32_t i, peak = 0, nr_above = 0;
+
+    for ( i = 0; i < nr_bins; i++ )
+    {
+        if ( p_db[i] > p_db[peak] )
+        {
+            peak = i;
+        }
+        if ( p_db[i] > threshold_db )
+        {
+            nr_above++;
+        }
+    }
+    if ( p_peak_bin != NULL )
+    {
+        *p_peak_bin = peak;
+    }
+    if ( p_peak_db != NULL )
+    {
+        *p_peak_db = p_db[peak];
+    }
+
+    return (float)nr_above / (float)nr_bins;
+}
+
+/*****************************************************************************/
+/** Write a frame with its header.
+
+    @param[in] fp           output file
+    @param[in] p            estimator that produced the frame
+    @param[in] p_db         frame from the callback
+    @param[in] freq         centre frequency of the frame in Hertz
+    @param[in] sample_rate  sample rate in Hertz
+
+    @return 0 on success, -EIO on a write error
+*/
+static inline int32_t psd_write_frame( FILE *fp,
+                                       const struct psd *p,
+                                       const float *p_db,
+                                       uint64_t freq,
+                                       uint32_t sample_rate )
+{
+    struct psd_frame_header hdr = {
+        .magic = PSD_FRAME_MAGIC,
+        .nr_bins = p->plan.nr_bins,
+        .rf_timestamp = p->frame_ts,
+        .freq = freq,
+        .sample_rate = sample_rate,
+        .nr_segments = p->nr_averaged,
+    };
+
+    if ( ( fwrite( &hdr, sizeof(hdr), 1, fp ) != 1 ) ||
+         ( fwrite( p_db, sizeof(float), p->plan.nr_bins, fp ) != p->plan.nr_bins ) )
+    {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+#endif  /* __PSD_H__ */
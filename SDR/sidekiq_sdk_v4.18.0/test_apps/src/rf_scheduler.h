@@ -0,0 +1,1031 @@
+/**
+ * @file   rf_scheduler.h
+ *
+ * @brief  Runs actions (RF port switches, frequency hops, stopping a stream) when the RF
+ *         timestamp of a card reaches a given value, without polling the timestamp.
+ *
+ * The scheduler keeps a model of the RF timestamp as a function of the host's CLOCK_MONOTONIC.
+ * The offset of the model comes from reads of the current timestamp, taken between two reads of
+ * the host clock, and from the timestamps of received blocks (a block that has arrived bounds the
+ * RF timestamp from below).  The rate starts out as the nominal sample rate; it is refined from
+ * the span between the first and the latest timestamp read and, when a 1PPS source is present,
+ * from the RF timestamps of consecutive 1PPS edges.
+ *
+ * Actions are kept in a min-heap ordered on their RF timestamp, and a single thread sleeps on one
+ * timerfd armed with the predicted host time of the earliest action, less a guard interval.  When
+ * it wakes, the thread reads the RF timestamp once to correct the model, sleeps the short
+ * remainder with an absolute clock_nanosleep() and then runs the action.  Each action costs one
+ * timestamp read instead of a usleep(1) / read loop.
+ *
+ * On platforms without timerfd the thread waits on a condition variable instead.
+ */
+
+#ifndef __RF_SCHEDULER_H__
+#define __RF_SCHEDULER_H__
+
+/***** INCLUDES *****/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if (defined __linux__)
+#   include <sys/prctl.h>
+#   include <sys/timerfd.h>
+#   define RF_SCHED_HAVE_TIMERFD
+#endif
+
+#include <sidekiq_api.h>
+
+/***** DEFINES *****/
+
+/* maximum number of pending actions */
+#define RF_SCHED_MAX_ACTIONS            (64)
+
+/* the timer wakes this long before the predicted time of an action to confirm the model */
+#define RF_SCHED_DEFAULT_GUARD_NS       (500 * 1000)
+
+/* the last part of the approach to an action is spent polling the host clock (not the card),
+   since a sleep may overshoot by the timer slack of the thread */
+#define RF_SCHED_SPIN_NS                (80 * 1000)
+
+/* actions that run more than this long after their timestamp are counted as late */
+#define RF_SCHED_LATE_NS                (100 * 1000)
+
+/* upper bound on the time a waiter stays parked without re-checking its running flag */
+#define RF_SCHED_PARK_NS                (10 * 1000 * 1000)
+
+/* the rate is only estimated from timestamp reads once they span at least this long */
+#define RF_CLOCK_MIN_RATE_SPAN_NS       (200 * 1000 * 1000)
+
+/* timestamp reads that took longer than this are not used to correct the offset */
+#define RF_CLOCK_MAX_BRACKET_NS         (200 * 1000)
+
+/* estimated rates further than this fraction from the nominal rate are discarded */
+#define RF_CLOCK_RATE_TOLERANCE         (0.001)
+
+/* the last 1PPS timestamp is read at most this often */
+#define RF_CLOCK_PPS_INTERVAL_NS        (500 * 1000 * 1000)
+
+#define RF_SCHED_NSEC_PER_SEC           (1000000000LL)
+
+/***** TYPEDEFS *****/
+
+/* an action, called from the scheduler thread with the RF timestamp it was scheduled for */
+typedef void (*rf_sched_fn_t)( uint64_t rf_ts, void *p_arg );
+
+struct rf_clock
+{
+    uint8_t card;
+    bool use_tx;                    /* read the TX rather than the RX timestamp */
+    skiq_rx_hdl_t rx_hdl;
+    skiq_tx_hdl_t tx_hdl;
+    bool use_pps;                   /* refine the rate from the 1PPS timestamps */
+
+    double nominal_rate;
+    double rate;                    /* RF timestamp ticks per second of host time */
+    bool rate_from_pps;
+
+    bool synced;
+    uint64_t anchor_rf;             /* the model passes through (anchor_ns, anchor_rf) */
+    int64_t anchor_ns;
+    uint64_t base_rf;               /* first timestamp read, for the rate estimate */
+    int64_t base_ns;
+
+    uint64_t last_pps_rf;
+    int64_t last_pps_read_ns;
+
+    /* statistics */
+    uint64_t nr_syncs;
+    uint64_t nr_block_corrections;
+    uint64_t nr_pps_updates;
+    int64_t max_correction_ns;      /* largest offset correction made by a timestamp read */
+};
+
+struct rf_sched_action
+{
+    uint64_t rf_ts;
+    uint64_t seq;                   /* keeps actions with the same timestamp in order */
+    rf_sched_fn_t fn;
+    void *p_arg;
+};
+
+struct rf_sched
+{
+    struct rf_clock clock;
+    int64_t guard_ns;
+
+    struct rf_sched_action heap[RF_SCHED_MAX_ACTIONS];
+    uint32_t nr_actions;
+    uint64_t next_seq;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;            /* timer wait when there is no timerfd */
+    int timer_fd;
+    pthread_t thread;
+    bool thread_started;
+    bool running;
+
+    /* statistics */
+    uint64_t nr_fired;
+    uint64_t nr_late;
+    int64_t max_late_ns;
+};
+
+#define RF_SCHED_INITIALIZER                            \
+    (struct rf_sched){                                  \
+        .guard_ns = RF_SCHED_DEFAULT_GUARD_NS,          \
+        .nr_actions = 0,                                \
+        .next_seq = 0,                                  \
+        .lock = PTHREAD_MUTEX_INITIALIZER,              \
+        .wake = PTHREAD_COND_INITIALIZER,               \
+        .timer_fd = -1,                                 \
+        .thread_started = false,                        \
+        .running = false,                               \
+        .nr_fired = 0,                                  \
+        .nr_late = 0,                                   \
+        .max_late_ns = 0,                               \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+static inline int64_t _rf_sched_now_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( (int64_t)ts.tv_sec * RF_SCHED_NSEC_PER_SEC ) + ts.tv_nsec;
+}
+
+static inline void _rf_sched_sleep_until_ns( int64_t when_ns )
+{
+#if (defined __MINGW32__)
+    int64_t delta_ns = when_ns - _rf_sched_now_ns();
+
+    if ( delta_ns > 0 )
+    {
+        struct timespec ts = { .tv_sec = (time_t)( delta_ns / RF_SCHED_NSEC_PER_SEC ),
+                               .tv_nsec = (long)( delta_ns % RF_SCHED_NSEC_PER_SEC ) };
+        while ( ( nanosleep( &ts, &ts ) == -1 ) && ( errno == EINTR ) )
+        {
+        }
+    }
+#else
+    struct timespec ts = { .tv_sec = (time_t)( when_ns / RF_SCHED_NSEC_PER_SEC ),
+                           .tv_nsec = (long)( when_ns % RF_SCHED_NSEC_PER_SEC ) };
+
+    while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL ) == EINTR )
+    {
+    }
+#endif
+}
+
+/* sleep until shortly before when_ns, then poll the host clock until it is reached */
+static inline void _rf_sched_approach_ns( int64_t when_ns )
+{
+    _rf_sched_sleep_until_ns( when_ns - RF_SCHED_SPIN_NS );
+    while ( _rf_sched_now_ns() < when_ns )
+    {
+    }
+}
+
+/*****************************************************************************/
+/** Convert an RF timestamp to the host time (CLOCK_MONOTONIC) at which the model predicts it.
+
+    @param[in] c            clock model
+    @param[in] rf_ts        RF timestamp
+
+    @return host time in nanoseconds
+*/
+static inline int64_t rf_clock_host_ns( const struct rf_clock *c,
+                                        uint64_t rf_ts )
+{
+    int64_t delta_rf = (int64_t)( rf_ts - c->anchor_rf );
+
+    return c->anchor_ns + (int64_t)( (double)delta_rf * ( 1e9 / c->rate ) );
+}
+
+/*****************************************************************************/
+/** Predict the RF timestamp at a host time.
+
+    @param[in] c            clock model
+    @param[in] host_ns      host time (CLOCK_MONOTONIC) in nanoseconds
+
+    @return the predicted RF timestamp
+*/
+static inline uint64_t rf_clock_rf_at( const struct rf_clock *c,
+                                       int64_t host_ns )
+{
+    int64_t delta_ns = host_ns - c->anchor_ns;
+
+    return c->anchor_rf + (uint64_t)(int64_t)( (double)delta_ns * ( c->rate / 1e9 ) );
+}
+
+/* read the current timestamp along with the host time half way through the read */
+static inline int32_t _rf_clock_sample( const struct rf_clock *c,
+                                        uint64_t *p_rf_ts,
+                                        int64_t *p_host_ns,
+                                        int64_t *p_bracket_ns )
+{
+    int64_t before_ns, after_ns;
+    int32_t status;
+
+    before_ns = _rf_sched_now_ns();
+    if ( c->use_tx )
+    {
+        status = skiq_read_curr_tx_timestamp( c->card, c->tx_hdl, p_rf_ts );
+    }
+    else
+    {
+        status = skiq_read_curr_rx_timestamp( c->card, c->rx_hdl, p_rf_ts );
+    }
+    after_ns = _rf_sched_now_ns();
+
+    *p_host_ns = before_ns + ( ( after_ns - before_ns ) / 2 );
+    *p_bracket_ns = after_ns - before_ns;
+
+    return status;
+}
+
+/* fold a timestamp read into the model */
+static inline void _rf_clock_update( struct rf_clock *c,
+                                     uint64_t rf_ts,
+                                     int64_t host_ns,
+                                     int64_t bracket_ns )
+{
+    if ( !c->synced )
+    {
+        c->base_rf = c->anchor_rf = rf_ts;
+        c->base_ns = c->anchor_ns = host_ns;
+        c->synced = true;
+        c->nr_syncs++;
+        return;
+    }
+
+    if ( bracket_ns > RF_CLOCK_MAX_BRACKET_NS )
+    {
+        /* the read was preempted, the host time of the sample is too uncertain */
+        return;
+    }
+
+    if ( !c->rate_from_pps && ( ( host_ns - c->base_ns ) >= RF_CLOCK_MIN_RATE_SPAN_NS ) )
+    {
+        double rate = (double)( rf_ts - c->base_rf ) * 1e9 / (double)( host_ns - c->base_ns );
+
+        if ( ( rate > c->nominal_rate * ( 1.0 - RF_CLOCK_RATE_TOLERANCE ) ) &&
+             ( rate < c->nominal_rate * ( 1.0 + RF_CLOCK_RATE_TOLERANCE ) ) )
+        {
+            c->rate = rate;
+        }
+    }
+
+    {
+        int64_t correction_ns = host_ns - rf_clock_host_ns( c, rf_ts );
+
+        if ( correction_ns < 0 )
+        {
+            correction_ns = -correction_ns;
+        }
+        if ( correction_ns > c->max_correction_ns )
+        {
+            c->max_correction_ns = correction_ns;
+        }
+    }
+
+    c->anchor_rf = rf_ts;
+    c->anchor_ns = host_ns;
+    c->nr_syncs++;
+}
+
+/* refine the rate from the RF timestamps of two 1PPS edges */
+static inline void _rf_clock_update_pps( struct rf_clock *c,
+                                         uint64_t pps_rf_ts )
+{
+    if ( ( c->last_pps_rf != 0 ) && ( pps_rf_ts > c->last_pps_rf ) )
+    {
+        double delta = (double)( pps_rf_ts - c->last_pps_rf );
+        double nr_seconds = (double)(int64_t)( ( delta / c->nominal_rate ) + 0.5 );
+
+        if ( nr_seconds >= 1.0 )
+        {
+            double rate = delta / nr_seconds;
+
+            if ( ( rate > c->nominal_rate * ( 1.0 - RF_CLOCK_RATE_TOLERANCE ) ) &&
+                 ( rate < c->nominal_rate * ( 1.0 + RF_CLOCK_RATE_TOLERANCE ) ) )
+            {
+                c->rate = rate;
+                c->rate_from_pps = true;
+                c->nr_pps_updates++;
+            }
+        }
+    }
+    c->last_pps_rf = pps_rf_ts;
+}
+
+/*****************************************************************************/
+/** Initialize a clock model.  The timestamp read is the RX timestamp of rx_hdl; set use_tx and
+    tx_hdl afterwards to read a TX timestamp instead.
+
+    @param[out] c               clock model
+    @param[in]  card            Sidekiq card
+    @param[in]  rx_hdl          handle whose timestamp is read
+    @param[in]  sample_rate     nominal rate of the RF timestamp
+
+    @return void
+*/
+static inline void rf_clock_init( struct rf_clock *c,
+                                  uint8_t card,
+                                  skiq_rx_hdl_t rx_hdl,
+                                  uint32_t sample_rate )
+{
+    memset( c, 0, sizeof(*c) );
+    c->card = card;
+    c->rx_hdl = rx_hdl;
+    c->tx_hdl = skiq_tx_hdl_A1;
+    c->use_pps = true;
+    c->nominal_rate = (double)sample_rate;
+    c->rate = (double)sample_rate;
+}
+
+/*****************************************************************************/
+/** Stop the scheduler thread and release its resources.  Pending actions are dropped.  Safe to call on a scheduler that failed
+    to initialize.
+
+    @param[in] s            scheduler
+
+    @return void
+*/
+static inline void rf_sched_exit( struct rf_sched *s )
+{
+    pthread_mutex_lock( &(s->lock) );
+    s->running = false;
+    s->nr_actions = 0;
+#if (defined RF_SCHED_HAVE_TIMERFD)
+    if ( s->timer_fd >= 0 )
+    {
+        /* expire immediately so that the thread sees the stop request */
+        struct itimerspec its = { .it_value = { .tv_sec = 0, .tv_nsec = 1 } };
+        (void)timerfd_settime( s->timer_fd, 0, &its, NULL );
+    }
+#endif
+    pthread_cond_broadcast( &(s->wake) );
+    pthread_mutex_unlock( &(s->lock) );
+
+    if ( s->thread_started )
+    {
+        pthread_join( s->thread, NULL );
+        s->thread_started = false;
+    }
+    if ( s->timer_fd >= 0 )
+    {
+        close( s->timer_fd );
+        s->timer_fd = -1;
+    }
+}
+
+/* must be called with the lock held */
+static inline void _rf_sched_arm( struct rf_sched *s,
+                                  int64_t when_ns )
+{
+#if (defined RF_SCHED_HAVE_TIMERFD)
+    struct itimerspec its;
+
+    memset( &its, 0, sizeof(its) );
+    if ( when_ns > 0 )
+    {
+        its.it_value.tv_sec = (time_t)( when_ns / RF_SCHED_NSEC_PER_SEC );
+        its.it_value.tv_nsec = (long)( when_ns % RF_SCHED_NSEC_PER_SEC );
+        if ( ( its.it_value.tv_sec == 0 ) && ( its.it_value.tv_nsec == 0 ) )
+        {
+            its.it_value.tv_nsec = 1;
+        }
+    }
+    (void)timerfd_settime( s->timer_fd, TFD_TIMER_ABSTIME, &its, NULL );
+#else
+    (void)when_ns;
+    pthread_cond_signal( &(s->wake) );
+#endif
+}
+
+/* must be called with the lock held, returns with it held */
+static inline void _rf_sched_wait_timer( struct rf_sched *s,
+                                         int64_t when_ns )
+{
+#if (defined RF_SCHED_HAVE_TIMERFD)
+    uint64_t nr_expirations;
+
+    _rf_sched_arm( s, when_ns );
+    pthread_mutex_unlock( &(s->lock) );
+    while ( ( read( s->timer_fd, &nr_expirations, sizeof(nr_expirations) ) < 0 ) &&
+            ( errno == EINTR ) )
+    {
+    }
+    pthread_mutex_lock( &(s->lock) );
+#else
+    if ( when_ns <= 0 )
+    {
+        pthread_cond_wait( &(s->wake), &(s->lock) );
+    }
+    else
+    {
+        struct timespec ts;
+        int64_t deadline_ns;
+
+        /* condition variables wait on CLOCK_REALTIME, convert the deadline */
+        clock_gettime( CLOCK_REALTIME, &ts );
+        deadline_ns = ( (int64_t)ts.tv_sec * RF_SCHED_NSEC_PER_SEC ) + ts.tv_nsec +
+            ( when_ns - _rf_sched_now_ns() );
+        ts.tv_sec = (time_t)( deadline_ns / RF_SCHED_NSEC_PER_SEC );
+        ts.tv_nsec = (long)( deadline_ns % RF_SCHED_NSEC_PER_SEC );
+        (void)pthread_cond_timedwait( &(s->wake), &(s->lock), &ts );
+    }
+#endif
+}
+
+static inline bool _rf_sched_before( const struct rf_sched_action *a,
+                                     const struct rf_sched_action *b )
+{
+    return ( a->rf_ts < b->rf_ts ) || ( ( a->rf_ts == b->rf_ts ) && ( a->seq < b->seq ) );
+}
+
+/* remove heap entry i, must be called with the lock held */
+static inline void _rf_sched_heap_remove( struct rf_sched *s,
+                                          uint32_t i )
+{
+    s->nr_actions--;
+    if ( i == s->nr_actions )
+    {
+        return;
+    }
+    s->heap[i] = s->heap[s->nr_actions];
+
+    /* the moved entry may need to go either up or down */
+    while ( ( i > 0 ) && _rf_sched_before( &(s->heap[i]), &(s->heap[(i - 1) / 2]) ) )
+    {
+        struct rf_sched_action tmp = s->heap[i];
+        s->heap[i] = s->heap[(i - 1) / 2];
+        s->heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+    for (;;)
+    {
+        uint32_t left = ( 2 * i ) + 1, smallest = i;
+
+        if ( ( left < s->nr_actions ) && _rf_sched_before( &(s->heap[left]), &(s->heap[smallest]) ) )
+        {
+            smallest = left;
+        }
+        if ( ( ( left + 1 ) < s->nr_actions ) &&
+             _rf_sched_before( &(s->heap[left + 1]), &(s->heap[smallest]) ) )
+        {
+            smallest = left + 1;
+        }
+        if ( smallest == i )
+        {
+            break;
+        }
+        {
+            struct rf_sched_action tmp = s->heap[i];
+            s->heap[i] = s->heap[smallest];
+            s->heap[smallest] = tmp;
+        }
+        i = smallest;
+    }
+}
+
+static inline void *_rf_sched_thread( void *p_arg )
+{
+    struct rf_sched *s = (struct rf_sched *)p_arg;
+    bool confirmed = false;
+    uint64_t confirmed_seq = 0;
+
+#if (defined __linux__)
+    /* keep the kernel from deferring the wake ups of this thread */
+    (void)prctl( PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL );
+#endif
+
+    pthread_mutex_lock( &(s->lock) );
+    while ( s->running )
+    {
+        struct rf_sched_action next;
+        int64_t now_ns, due_ns;
+
+        if ( s->nr_actions == 0 )
+        {
+            _rf_sched_wait_timer( s, 0 );
+            continue;
+        }
+
+        next = s->heap[0];
+        now_ns = _rf_sched_now_ns();
+        due_ns = rf_clock_host_ns( &(s->clock), next.rf_ts );
+
+        if ( confirmed && ( confirmed_seq == next.seq ) && ( now_ns >= due_ns ) )
+        {
+            int64_t late_ns = now_ns - due_ns;
+
+            _rf_sched_heap_remove( s, 0 );
+            confirmed = false;
+            s->nr_fired++;
+            if ( late_ns > RF_SCHED_LATE_NS )
+            {
+                s->nr_late++;
+            }
+            if ( late_ns > s->max_late_ns )
+            {
+                s->max_late_ns = late_ns;
+            }
+
+            pthread_mutex_unlock( &(s->lock) );
+            next.fn( next.rf_ts, next.p_arg );
+            pthread_mutex_lock( &(s->lock) );
+        }
+        else if ( now_ns >= ( due_ns - s->guard_ns ) )
+        {
+            uint64_t rf_ts;
+            int64_t host_ns, bracket_ns;
+            int32_t status;
+
+            /* close to the action, correct the model with one read and sleep the remainder */
+            pthread_mutex_unlock( &(s->lock) );
+            status = _rf_clock_sample( &(s->clock), &rf_ts, &host_ns, &bracket_ns );
+            pthread_mutex_lock( &(s->lock) );
+
+            if ( status == 0 )
+            {
+                _rf_clock_update( &(s->clock), rf_ts, host_ns, bracket_ns );
+            }
+            confirmed = true;
+            confirmed_seq = next.seq;
+
+            due_ns = rf_clock_host_ns( &(s->clock), next.rf_ts );
+            if ( ( status == 0 ) && ( rf_ts >= next.rf_ts ) )
+            {
+                /* already reached */
+                due_ns = host_ns;
+            }
+            if ( due_ns <= ( _rf_sched_now_ns() + s->guard_ns ) )
+            {
+                pthread_mutex_unlock( &(s->lock) );
+                _rf_sched_approach_ns( due_ns );
+                pthread_mutex_lock( &(s->lock) );
+            }
+            /* if the model moved the action further out, the timer is simply re-armed */
+        }
+        else
+        {
+            _rf_sched_wait_timer( s, due_ns - s->guard_ns );
+        }
+    }
+    pthread_mutex_unlock( &(s->lock) );
+
+    return NULL;
+}
+
+/*****************************************************************************/
+/** Read the current RF timestamp and correct the clock model with it.  A 1PPS timestamp is
+    also read (at most every RF_CLOCK_PPS_INTERVAL_NS) to refine the rate.
+
+    @param[in] s            scheduler
+
+    @return 0 on success, else the status of the timestamp read
+*/
+static inline int32_t rf_sched_sync( struct rf_sched *s )
+{
+    uint64_t rf_ts, pps_rf_ts = 0, pps_sys_ts = 0;
+    int64_t host_ns, bracket_ns;
+    bool read_pps = false;
+    int32_t status;
+
+    status = _rf_clock_sample( &(s->clock), &rf_ts, &host_ns, &bracket_ns );
+    if ( s->clock.use_pps &&
+         ( ( host_ns - s->clock.last_pps_read_ns ) >= RF_CLOCK_PPS_INTERVAL_NS ) )
+    {
+        read_pps = ( skiq_read_last_1pps_timestamp( s->clock.card, &pps_rf_ts,
+                                                    &pps_sys_ts ) == 0 );
+    }
+
+    pthread_mutex_lock( &(s->lock) );
+    if ( status == 0 )
+    {
+        _rf_clock_update( &(s->clock), rf_ts, host_ns, bracket_ns );
+    }
+    if ( s->clock.use_pps &&
+         ( ( host_ns - s->clock.last_pps_read_ns ) >= RF_CLOCK_PPS_INTERVAL_NS ) )
+    {
+        s->clock.last_pps_read_ns = host_ns;
+        if ( read_pps && ( pps_rf_ts != 0 ) )
+        {
+            _rf_clock_update_pps( &(s->clock), pps_rf_ts );
+        }
+    }
+    pthread_mutex_unlock( &(s->lock) );
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Correct the clock model from a received block: when the block is seen, the RF timestamp has
+    at least reached the end of the block.  Intended to be called as each block is received.
+
+    @param[in] s                scheduler
+    @param[in] rf_ts            RF timestamp of the first sample in the block
+    @param[in] nr_samples       number of samples in the block
+
+    @return void
+*/
+static inline void rf_sched_observe_block( struct rf_sched *s,
+                                           uint64_t rf_ts,
+                                           uint32_t nr_samples )
+{
+    int64_t host_ns = _rf_sched_now_ns();
+    uint64_t end_rf_ts = rf_ts + nr_samples;
+
+    pthread_mutex_lock( &(s->lock) );
+    if ( s->clock.synced && ( end_rf_ts > rf_clock_rf_at( &(s->clock), host_ns ) ) )
+    {
+        s->clock.anchor_rf = end_rf_ts;
+        s->clock.anchor_ns = host_ns;
+        s->clock.nr_block_corrections++;
+    }
+    pthread_mutex_unlock( &(s->lock) );
+}
+
+/*****************************************************************************/
+/** Predict the host time (CLOCK_MONOTONIC) at which the RF timestamp reaches rf_ts.
+
+    @param[in] s            scheduler
+    @param[in] rf_ts        RF timestamp
+
+    @return host time in nanoseconds
+*/
+static inline int64_t rf_sched_host_ns( struct rf_sched *s,
+                                        uint64_t rf_ts )
+{
+    int64_t host_ns;
+
+    pthread_mutex_lock( &(s->lock) );
+    host_ns = rf_clock_host_ns( &(s->clock), rf_ts );
+    pthread_mutex_unlock( &(s->lock) );
+
+    return host_ns;
+}
+
+/*****************************************************************************/
+/** Predict the current RF timestamp without reading it from the card.
+
+    @param[in] s            scheduler
+
+    @return the predicted RF timestamp
+*/
+static inline uint64_t rf_sched_rf_now( struct rf_sched *s )
+{
+    int64_t host_ns = _rf_sched_now_ns();
+    uint64_t rf_ts;
+
+    pthread_mutex_lock( &(s->lock) );
+    rf_ts = rf_clock_rf_at( &(s->clock), host_ns );
+    pthread_mutex_unlock( &(s->lock) );
+
+    return rf_ts;
+}
+
+/* take the first timestamp reading and start the scheduler thread */
+static inline int32_t _rf_sched_start( struct rf_sched *s )
+{
+    int32_t status;
+
+    status = rf_sched_sync( s );
+    if ( status != 0 )
+    {
+        return status;
+    }
+
+#if (defined RF_SCHED_HAVE_TIMERFD)
+    s->timer_fd = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC );
+    if ( s->timer_fd < 0 )
+    {
+        return -errno;
+    }
+#endif
+
+    s->running = true;
+    status = pthread_create( &(s->thread), NULL, _rf_sched_thread, s );
+    if ( status != 0 )
+    {
+        s->running = false;
+        rf_sched_exit( s );
+        return -status;
+    }
+    s->thread_started = true;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Initialize the scheduler and start its thread.  The clock model reads the RX timestamp of
+    rx_hdl, which must be running (e.g. the RF timestamps have been reset or streaming started).
+
+    @param[out] s               scheduler
+    @param[in]  card            Sidekiq card
+    @param[in]  rx_hdl          handle whose RX timestamp is read
+    @param[in]  sample_rate     nominal rate of the RF timestamp
+
+    @return 0 on success, else a negative errno or the status of the timestamp read
+*/
+static inline int32_t rf_sched_init( struct rf_sched *s,
+                                     uint8_t card,
+                                     skiq_rx_hdl_t rx_hdl,
+                                     uint32_t sample_rate )
+{
+    *s = RF_SCHED_INITIALIZER;
+    if ( sample_rate == 0 )
+    {
+        return -EINVAL;
+    }
+    rf_clock_init( &(s->clock), card, rx_hdl, sample_rate );
+
+    return _rf_sched_start( s );
+}
+
+/*****************************************************************************/
+/** Initialize the scheduler with a clock model that reads the TX timestamp of tx_hdl, for
+    applications that only transmit.
+
+    @param[out] s               scheduler
+    @param[in]  card            Sidekiq card
+    @param[in]  tx_hdl          handle whose TX timestamp is read
+    @param[in]  sample_rate     nominal rate of the RF timestamp
+
+    @return 0 on success, else a negative errno or the status of the timestamp read
+*/
+static inline int32_t rf_sched_init_tx( struct rf_sched *s,
+                                        uint8_t card,
+                                        skiq_tx_hdl_t tx_hdl,
+                                        uint32_t sample_rate )
+{
+    *s = RF_SCHED_INITIALIZER;
+    if ( sample_rate == 0 )
+    {
+        return -EINVAL;
+    }
+    rf_clock_init( &(s->clock), card, skiq_rx_hdl_A1, sample_rate );
+    s->clock.use_tx = true;
+    s->clock.tx_hdl = tx_hdl;
+
+    return _rf_sched_start( s );
+}
+
+/*****************************************************************************/
+/** Schedule an action to run from the scheduler thread once the RF timestamp reaches rf_ts.
+    Actions already in the past run immediately.  The action should be short, later actions
+    wait for it to return.
+
+    @param[in] s            scheduler
+    @param[in] rf_ts        RF timestamp at which to run the action
+    @param[in] fn           action
+    @param[in] p_arg        argument passed to the action
+
+    @return 0 on success, -ENOSPC if RF_SCHED_MAX_ACTIONS are pending, -ESHUTDOWN if the
+            scheduler is not running
+*/
+static inline int32_t rf_sched_at( struct rf_sched *s,
+                                   uint64_t rf_ts,
+                                   rf_sched_fn_t fn,
+                                   void *p_arg )
+{
+    uint32_t i;
+    int32_t status = 0;
+
+    pthread_mutex_lock( &(s->lock) );
+    if ( !s->running )
+    {
+        status = -ESHUTDOWN;
+    }
+    else if ( s->nr_actions >= RF_SCHED_MAX_ACTIONS )
+    {
+        status = -ENOSPC;
+    }
+    else
+    {
+        i = s->nr_actions++;
+        s->heap[i] = (struct rf_sched_action){ .rf_ts = rf_ts, .seq = s->next_seq++,
+                                               .fn = fn, .p_arg = p_arg };
+        while ( ( i > 0 ) && _rf_sched_before( &(s->heap[i]), &(s->heap[(i - 1) / 2]) ) )
+        {
+            struct rf_sched_action tmp = s->heap[i];
+            s->heap[i] = s->heap[(i - 1) / 2];
+            s->heap[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+        if ( i == 0 )
+        {
+            /* the new action is the earliest, bring the timer forward */
+            _rf_sched_arm( s, rf_clock_host_ns( &(s->clock), rf_ts ) - s->guard_ns );
+        }
+    }
+    pthread_mutex_unlock( &(s->lock) );
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Remove every pending action matching fn and p_arg.
+
+    @param[in] s            scheduler
+    @param[in] fn           action
+    @param[in] p_arg        argument the action was scheduled with
+
+    @return the number of actions removed
+*/
+static inline uint32_t rf_sched_cancel( struct rf_sched *s,
+                                        rf_sched_fn_t fn,
+                                        void *p_arg )
+{
+    uint32_t i = 0, nr_removed = 0;
+
+    pthread_mutex_lock( &(s->lock) );
+    while ( i < s->nr_actions )
+    {
+        if ( ( s->heap[i].fn == fn ) && ( s->heap[i].p_arg == p_arg ) )
+        {
+            _rf_sched_heap_remove( s, i );
+            nr_removed++;
+            i = 0;
+        }
+        else
+        {
+            i++;
+        }
+    }
+    pthread_mutex_unlock( &(s->lock) );
+
+    return nr_removed;
+}
+
+static inline void _rf_clock_lock( pthread_mutex_t *p_lock )
+{
+    if ( p_lock != NULL )
+    {
+        pthread_mutex_lock( p_lock );
+    }
+}
+
+static inline void _rf_clock_unlock( pthread_mutex_t *p_lock )
+{
+    if ( p_lock != NULL )
+    {
+        pthread_mutex_unlock( p_lock );
+    }
+}
+
+/* sleep on the clock model until rf_ts, with one timestamp read shortly before it; p_lock
+   protects the model when a scheduler thread also updates it, NULL for a caller-owned model */
+static inline int32_t _rf_clock_wait_until( struct rf_clock *c,
+                                            pthread_mutex_t *p_lock,
+                                            int64_t guard_ns,
+                                            uint64_t rf_ts,
+                                            volatile bool *p_running )
+{
+    bool confirmed = false;
+
+    while ( ( p_running == NULL ) || *p_running )
+    {
+        int64_t now_ns = _rf_sched_now_ns();
+        int64_t due_ns;
+
+        _rf_clock_lock( p_lock );
+        due_ns = rf_clock_host_ns( c, rf_ts );
+        _rf_clock_unlock( p_lock );
+
+        if ( confirmed && ( now_ns >= due_ns ) )
+        {
+            return 0;
+        }
+        else if ( now_ns >= ( due_ns - guard_ns ) )
+        {
+            uint64_t curr_ts;
+            int64_t host_ns, bracket_ns;
+
+            if ( _rf_clock_sample( c, &curr_ts, &host_ns, &bracket_ns ) == 0 )
+            {
+                if ( curr_ts >= rf_ts )
+                {
+                    return 0;
+                }
+                _rf_clock_lock( p_lock );
+                _rf_clock_update( c, curr_ts, host_ns, bracket_ns );
+                due_ns = rf_clock_host_ns( c, rf_ts );
+                _rf_clock_unlock( p_lock );
+            }
+            confirmed = true;
+            if ( due_ns <= ( _rf_sched_now_ns() + guard_ns ) )
+            {
+                _rf_sched_approach_ns( due_ns );
+            }
+        }
+        else
+        {
+            /* sleep in bounded steps so that a stop request is noticed */
+            int64_t wake_ns = due_ns - guard_ns;
+
+            if ( wake_ns > ( now_ns + RF_SCHED_PARK_NS ) )
+            {
+                wake_ns = now_ns + RF_SCHED_PARK_NS;
+            }
+            _rf_sched_sleep_until_ns( wake_ns );
+        }
+    }
+
+    return -ECANCELED;
+}
+
+/*****************************************************************************/
+/** Block the calling thread until the RF timestamp reaches rf_ts, or until *p_running becomes
+    false.  The caller sleeps on the clock model in the same way as the scheduler thread (one
+    timestamp read shortly before rf_ts), so no action is queued and there is no hand-off to the
+    scheduler thread.
+
+    @param[in] s            scheduler
+    @param[in] rf_ts        RF timestamp to wait for
+    @param[in] p_running    stop waiting once this becomes false, may be NULL
+
+    @return 0 once the timestamp is reached, -ECANCELED if the wait was abandoned
+*/
+static inline int32_t rf_sched_wait_until( struct rf_sched *s,
+                                           uint64_t rf_ts,
+                                           volatile bool *p_running )
+{
+    return _rf_clock_wait_until( &(s->clock), &(s->lock), s->guard_ns, rf_ts, p_running );
+}
+
+/*****************************************************************************/
+/** Take a timestamp reading into a clock model owned by the caller.  Needed once before
+    rf_clock_wait_until(); the wait keeps the model corrected afterwards.
+
+    @param[in] c            clock model
+
+    @return 0 on success, else the status of the timestamp read
+*/
+static inline int32_t rf_clock_sync( struct rf_clock *c )
+{
+    uint64_t rf_ts;
+    int64_t host_ns, bracket_ns;
+    int32_t status;
+
+    status = _rf_clock_sample( c, &rf_ts, &host_ns, &bracket_ns );
+    if ( status == 0 )
+    {
+        _rf_clock_update( c, rf_ts, host_ns, bracket_ns );
+    }
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Block the calling thread until the RF timestamp reaches rf_ts, or until *p_running becomes
+    false, using a clock model owned by the caller.  For applications that only need to wait
+    (e.g. to stop a stream after its last block) and have no actions to schedule, so there is
+    no scheduler thread or timer.
+
+    @param[in] c            clock model, synchronized with rf_clock_sync()
+    @param[in] rf_ts        RF timestamp to wait for
+    @param[in] p_running    stop waiting once this becomes false, may be NULL
+
+    @return 0 once the timestamp is reached, -ECANCELED if the wait was abandoned
+*/
+static inline int32_t rf_clock_wait_until( struct rf_clock *c,
+                                           uint64_t rf_ts,
+                                           volatile bool *p_running )
+{
+    return _rf_clock_wait_until( c, NULL, RF_SCHED_DEFAULT_GUARD_NS, rf_ts, p_running );
+}
+
+/*****************************************************************************/
+/** Print the scheduler statistics.
+
+    @param[in] s            scheduler
+    @param[in] p_fp         destination, e.g. stdout
+
+    @return void
+*/
+static inline void rf_sched_print_stats( struct rf_sched *s,
+                                         FILE *p_fp )
+{
+    pthread_mutex_lock( &(s->lock) );
+    fprintf( p_fp, "Info: RF scheduler ran %" PRIu64 " actions (%" PRIu64 " late, worst %.1f us),"
+             " clock rate %.3f Hz (%s), %" PRIu64 " timestamp reads, %" PRIu64
+             " block corrections, largest correction %.1f us\n",
+             s->nr_fired, s->nr_late, (double)s->max_late_ns / 1e3, s->clock.rate,
+             s->clock.rate_from_pps ? "1PPS" : "host clock", s->clock.nr_syncs,
+             s->clock.nr_block_corrections, (double)s->clock.max_correction_ns / 1e3 );
+    pthread_mutex_unlock( &(s->lock) );
+}
+
+#endif  /* __RF_SCHEDULER_H__ */
@@ -0,0 +1,459 @@
+/**
+ * @file   rt_thread.h
+ *
+ * @brief  CPU pinning, real-time scheduling, memory locking and NUMA placement for the streaming
+ *         threads of the test applications.
+ *
+ * An application adds RT_THREAD_APP_ARGS() to its argument list, calls rt_thread_config_init()
+ * once the arguments are parsed and then rt_thread_apply() for each of its threads.  Threads are
+ * identified by an index that the application documents in its help text; thread N is pinned to
+ * the Nth CPU of --cpus and threads beyond the end of the list are left unpinned.  Only threads
+ * applied as real-time are switched to SCHED_FIFO with --rt-priority, so monitor threads do not
+ * compete with the receive and transmit loops.
+ *
+ * libsidekiq does not report the PCIe location of a card, so the receive buffers are placed on
+ * --numa-node, or by default on the node of the CPU that the thread is pinned to.  Pick CPUs that
+ * are local to the root port of the card (see /sys/bus/pci/devices/<address>/numa_node) to keep
+ * both the thread and its buffers next to the card.
+ *
+ * Threads should be applied before they create other threads, since new threads inherit the
+ * affinity and the scheduling policy of their creator.
+ */
+
+#ifndef __RT_THREAD_H__
+#define __RT_THREAD_H__
+
+#if (!defined __MINGW32__) && (!defined _GNU_SOURCE)
+#error "rt_thread.h needs _GNU_SOURCE defined before the first include"
+#endif
+
+/***** INCLUDES *****/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+
+#if (!defined __MINGW32__)
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include <arg_parser.h>
+
+/***** DEFINES *****/
+
+/* maximum number of CPUs in --cpus */
+#define RT_THREAD_MAX_CPUS              (64)
+
+/* from <linux/mempolicy.h>, allocate on the node if possible and fall back to the others */
+#define RT_THREAD_MPOL_PREFERRED        (1)
+
+/* number of NUMA nodes that a buffer can be placed on */
+#define RT_THREAD_MAX_NODES             (64)
+
+/* the shared command line options, place them before APP_ARG_TERMINATOR */
+#define RT_THREAD_APP_ARGS(p_cfg)                                                       \
+    APP_ARG_OPT("cpus",                                                                 \
+                0,                                                                      \
+                "Comma delimited list of CPUs to pin the streaming threads to, in order", \
+                "CPU[,CPU]...",                                                         \
+                &((p_cfg)->p_cpus),                                                     \
+                STRING_VAR_TYPE),                                                       \
+    APP_ARG_OPT("rt-priority",                                                          \
+                0,                                                                      \
+                "Run the streaming threads with SCHED_FIFO at this priority (1-99)",    \
+                "PRIORITY",                                                             \
+                &((p_cfg)->priority),                                                   \
+                UINT32_VAR_TYPE),                                                       \
+    APP_ARG_OPT("mlock",                                                                \
+                0,                                                                      \
+                "Lock all current and future memory of the process into RAM",          \
+                NULL,                                                                   \
+                &((p_cfg)->lock_memory),                                                \
+                BOOL_VAR_TYPE),                                                         \
+    APP_ARG_OPT("numa-node",                                                            \
+                0,                                                                      \
+                "NUMA node to allocate the receive buffers on",                         \
+                "NODE",                                                                 \
+                &((p_cfg)->numa_node),                                                  \
+                INT32_VAR_TYPE)
+
+/* the matching lines for the Defaults section of the help text */
+#define RT_THREAD_HELP_DEFAULTS                                         \
+    "  --cpus=unpinned\n"                                               \
+    "  --rt-priority=0 (not real-time)\n"                               \
+    "  --numa-node=node of the pinned CPU\n"
+
+/***** TYPEDEFS *****/
+
+struct rt_thread_config
+{
+    /* command line options */
+    char *p_cpus;
+    uint32_t priority;                  /* 0 to leave the scheduling policy alone */
+    bool lock_memory;
+    int32_t numa_node;                  /* negative for the node of the pinned CPU */
+
+    /* parsed by rt_thread_config_init() */
+    int32_t cpus[RT_THREAD_MAX_CPUS];
+    uint32_t nr_cpus;
+};
+
+#define RT_THREAD_CONFIG_INITIALIZER                    \
+    (struct rt_thread_config){                          \
+        .p_cpus = NULL,                                 \
+        .priority = 0,                                  \
+        .lock_memory = false,                           \
+        .numa_node = -1,                                \
+        .nr_cpus = 0,                                   \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+/*****************************************************************************/
+/** Restrict a thread to a single CPU.
+
+    @param[in] thread       thread to pin
+    @param[in] cpu          CPU number, or negative to leave the thread unpinned
+    @param[in] p_name       name of the thread for the log
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t rt_thread_pin( pthread_t thread,
+                                     int32_t cpu,
+                                     const char *p_name )
+{
+    int32_t status = 0;
+
+    if ( cpu < 0 )
+    {
+        return 0;
+    }
+#if (defined __MINGW32__)
+    (void)thread;
+    fprintf(stderr, "Warning: CPU pinning is not supported, %s thread left unpinned\n", p_name);
+    status = -ENOTSUP;
+#else
+    {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        status = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+        if ( status != 0 )
+        {
+            fprintf(stderr, "Warning: unable to pin %s thread to CPU %" PRIi32 " (result code %"
+                    PRIi32 ")\n", p_name, cpu, status);
+            status = -status;
+        }
+        else
+        {
+            printf("Info: pinned %s thread to CPU %" PRIi32 "\n", p_name, cpu);
+        }
+    }
+#endif
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Look up the NUMA node of a CPU.
+
+    @param[in] cpu          CPU number
+
+    @return the node, or -1 if it is not known (e.g. a kernel without NUMA support)
+*/
+static inline int32_t rt_thread_cpu_node( int32_t cpu )
+{
+    int32_t node = -1;
+#if (!defined __MINGW32__)
+    char p_path[64];
+    DIR *p_dir;
+    struct dirent *p_ent;
+
+    snprintf(p_path, sizeof(p_path), "/sys/devices/system/cpu/cpu%" PRIi32, cpu);
+    p_dir = opendir(p_path);
+    if ( p_dir == NULL )
+    {
+        return -1;
+    }
+    while ( ( p_ent = readdir(p_dir) ) != NULL )
+    {
+        if ( ( strncmp(p_ent->d_name, "node", 4) == 0 ) &&
+             ( p_ent->d_name[4] >= '0' ) && ( p_ent->d_name[4] <= '9' ) )
+        {
+            node = (int32_t)strtol(&(p_ent->d_name[4]), NULL, 10);
+            break;
+        }
+    }
+    closedir(p_dir);
+#else
+    (void)cpu;
+#endif
+
+    return node;
+}
+
+/*****************************************************************************/
+/** Parse the command line options and lock the memory of the process if requested.  Call this
+    once after arg_parser() and before any of the streaming threads are started.
+
+    @param[in,out] p_cfg    configuration filled in by RT_THREAD_APP_ARGS()
+
+    @return 0 on success, -EINVAL for an invalid option, else a negative errno
+*/
+static inline int32_t rt_thread_config_init( struct rt_thread_config *p_cfg )
+{
+    const char *p_str = p_cfg->p_cpus;
+
+    p_cfg->nr_cpus = 0;
+    while ( ( p_str != NULL ) && ( *p_str != '\0' ) )
+    {
+        char *p_end = NULL;
+        long cpu;
+
+        errno = 0;
+        cpu = strtol(p_str, &p_end, 10);
+        if ( ( errno != 0 ) || ( p_end == p_str ) || ( cpu < 0 ) || ( cpu > INT32_MAX ) ||
+             ( ( *p_end != ',' ) && ( *p_end != '\0' ) ) )
+        {
+            fprintf(stderr, "Error: invalid CPU list '%s'\n", p_cfg->p_cpus);
+            return -EINVAL;
+        }
+        if ( p_cfg->nr_cpus == RT_THREAD_MAX_CPUS )
+        {
+            fprintf(stderr, "Error: at most %u CPUs can be listed\n", RT_THREAD_MAX_CPUS);
+            return -EINVAL;
+        }
+        p_cfg->cpus[p_cfg->nr_cpus++] = (int32_t)cpu;
+        p_str = ( *p_end == ',' ) ? ( p_end + 1 ) : p_end;
+    }
+
+    if ( p_cfg->priority != 0 )
+    {
+#if (defined __MINGW32__)
+        fprintf(stderr, "Warning: real-time scheduling is not supported, ignoring"
+                " --rt-priority\n");
+        p_cfg->priority = 0;
+#else
+        int min_prio = sched_get_priority_min(SCHED_FIFO);
+        int max_prio = sched_get_priority_max(SCHED_FIFO);
+
+        if ( ( (int)p_cfg->priority < min_prio ) || ( (int)p_cfg->priority > max_prio ) )
+        {
+            fprintf(stderr, "Error: real-time priority must be between %d and %d\n", min_prio,
+                    max_prio);
+            return -EINVAL;
+        }
+#endif
+    }
+
+    if ( p_cfg->numa_node >= RT_THREAD_MAX_NODES )
+    {
+        fprintf(stderr, "Error: NUMA node must be less than %u\n", RT_THREAD_MAX_NODES);
+        return -EINVAL;
+    }
+
+    if ( p_cfg->lock_memory )
+    {
+#if (defined __MINGW32__)
+        fprintf(stderr, "Warning: locking memory is not supported, ignoring --mlock\n");
+#else
+        if ( mlockall(MCL_CURRENT | MCL_FUTURE) != 0 )
+        {
+            int32_t status = -errno;
+
+            fprintf(stderr, "Error: unable to lock memory (errno %d), check the memlock"
+                    " limit (ulimit -l)\n", errno);
+            return status;
+        }
+        printf("Info: locked the memory of the process\n");
+#endif
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Pin a thread to its CPU from --cpus and, if it is a real-time thread, switch it to SCHED_FIFO
+    at --rt-priority.  Failures are reported as warnings, the thread keeps running as before.
+
+    @param[in] p_cfg        configuration
+    @param[in] thread       thread to apply the configuration to, e.g. pthread_self()
+    @param[in] index        index of the thread, selects the CPU from --cpus
+    @param[in] realtime     true for the streaming threads, false for monitor threads
+    @param[in] p_name       name of the thread for the log
+
+    @return 0 on success, else the negative errno of the last failure
+*/
+static inline int32_t rt_thread_apply( const struct rt_thread_config *p_cfg,
+                                       pthread_t thread,
+                                       uint32_t index,
+                                       bool realtime,
+                                       const char *p_name )
+{
+    int32_t status = 0;
+
+    if ( index < p_cfg->nr_cpus )
+    {
+        status = rt_thread_pin(thread, p_cfg->cpus[index], p_name);
+    }
+
+#if (!defined __MINGW32__)
+    if ( realtime && ( p_cfg->priority != 0 ) )
+    {
+        struct sched_param param = { .sched_priority = (int)p_cfg->priority };
+        int result;
+
+        result = pthread_setschedparam(thread, SCHED_FIFO, &param);
+        if ( result != 0 )
+        {
+            fprintf(stderr, "Warning: unable to run %s thread with SCHED_FIFO priority %" PRIu32
+                    " (result code %d)%s\n", p_name, p_cfg->priority, result,
+                    ( result == EPERM ) ? ", requires CAP_SYS_NICE or an rtprio limit" : "");
+            status = -result;
+        }
+        else
+        {
+            printf("Info: running %s thread with SCHED_FIFO priority %" PRIu32 "\n", p_name,
+                   p_cfg->priority);
+        }
+    }
+#else
+    (void)realtime;
+#endif
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Look up the NUMA node for the buffers of a thread, either --numa-node or the node of the CPU
+    that the thread is pinned to.
+
+    @param[in] p_cfg        configuration
+    @param[in] index        index of the thread that will use the buffers
+
+    @return the node, or negative if unknown
+*/
+static inline int32_t rt_thread_node( const struct rt_thread_config *p_cfg,
+                                      uint32_t index )
+{
+    int32_t node = p_cfg->numa_node;
+
+    if ( ( node < 0 ) && ( index < p_cfg->nr_cpus ) )
+    {
+        node = rt_thread_cpu_node(p_cfg->cpus[index]);
+    }
+
+    return node;
+}
+
+/*****************************************************************************/
+/** Prefer a NUMA node for a memory mapping.  The pages that have not been touched yet are
+    allocated on the node if possible, a failure is reported as a warning.
+
+    @param[in] p_mem        start of the mapping, page aligned
+    @param[in] size         size of the mapping in bytes
+    @param[in] node         NUMA node, negative to leave the mapping alone
+
+    @return void
+*/
+static inline void rt_thread_bind( void *p_mem,
+                                   size_t size,
+                                   int32_t node )
+{
+#if (!defined __MINGW32__) && (defined SYS_mbind)
+    if ( ( node >= 0 ) && ( node < RT_THREAD_MAX_NODES ) )
+    {
+        /* one spare bit, the kernel ignores the last bit of the mask */
+        unsigned long nodemask[( RT_THREAD_MAX_NODES / ( 8 * sizeof(unsigned long) ) ) + 1];
+
+        memset(nodemask, 0, sizeof(nodemask));
+        nodemask[node / ( 8 * sizeof(unsigned long) )] |=
+            1UL << ( node % ( 8 * sizeof(unsigned long) ) );
+
+        if ( syscall(SYS_mbind, p_mem, size, RT_THREAD_MPOL_PREFERRED, nodemask,
+                     (unsigned long)( 8 * sizeof(nodemask) ), 0) != 0 )
+        {
+            fprintf(stderr, "Warning: unable to place a buffer on NUMA node %" PRIi32
+                    " (errno %d)\n", node, errno);
+        }
+    }
+#else
+    (void)p_mem;
+    (void)size;
+    (void)node;
+#endif
+}
+
+/*****************************************************************************/
+/** Allocate a zeroed buffer on the NUMA node of a thread, either --numa-node or the node of the
+    CPU that the thread is pinned to.  Without a known node this is the same as calloc().  The
+    node is a preference, the kernel falls back to other nodes when it runs out of memory.
+
+    @param[in] p_cfg        configuration
+    @param[in] index        index of the thread that will use the buffer
+    @param[in] size         size of the buffer in bytes
+
+    @return the buffer, to be released with rt_thread_free(), or NULL if out of memory
+*/
+static inline void *rt_thread_alloc( const struct rt_thread_config *p_cfg,
+                                     uint32_t index,
+                                     size_t size )
+{
+#if (defined __MINGW32__)
+    (void)p_cfg;
+    (void)index;
+    return calloc(1, size);
+#else
+    void *p_mem;
+
+    if ( size == 0 )
+    {
+        size = 1;
+    }
+
+    p_mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ( p_mem == MAP_FAILED )
+    {
+        return NULL;
+    }
+
+    /* the pages have not been touched yet, so the policy applies to all of them */
+    rt_thread_bind(p_mem, size, rt_thread_node(p_cfg, index));
+
+    return p_mem;
+#endif
+}
+
+/*****************************************************************************/
+/** Release a buffer from rt_thread_alloc().
+
+    @param[in] p_mem        buffer, may be NULL
+    @param[in] size         size passed to rt_thread_alloc()
+
+    @return void
+*/
+static inline void rt_thread_free( void *p_mem,
+                                   size_t size )
+{
+#if (defined __MINGW32__)
+    (void)size;
+    free(p_mem);
+#else
+    if ( p_mem != NULL )
+    {
+        munmap(p_mem, ( size == 0 ) ? 1 : size);
+    }
+#endif
+}
+
+#endif  /* __RT_THREAD_H__ */
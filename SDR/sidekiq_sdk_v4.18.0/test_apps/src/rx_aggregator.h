@@ -0,0 +1,630 @@
+/**
+ * @file   rx_aggregator.h
+ *
+ * @brief  Merges the blocks received on several cards (and handles) into a single stream ordered
+ *         on the RF timestamp.
+ *
+ * Each receive thread retains the blocks of its stream (one card / handle pair) into a bounded
+ * per-stream reorder buffer with rx_aggregator_push().  An aggregator thread performs a k-way
+ * merge: a min-heap holds the oldest buffered block of every stream, keyed on rf_timestamp (ties
+ * are broken on the stream index so that blocks with the same timestamp come out interleaved
+ * in stream order), and the top of the heap is handed to the output callback.
+ *
+ * The oldest block overall is only known once every stream that is still running has a block
+ * buffered, so the aggregator normally waits for the slowest stream.  When a reorder buffer
+ * stays full for longer than the stall timeout, the streams that are still empty are marked as
+ * stalled and the aggregator stops waiting for them until they push again; the blocks emitted
+ * meanwhile are counted as forced emits.  This keeps memory bounded and keeps a stalled or dead
+ * card from holding the others to one block per stall timeout.
+ *
+ * The RF timestamps of different cards are only comparable when the cards share a reference
+ * and their timestamps were reset together (e.g. skiq_write_timestamp_reset_on_1pps()).
+ */
+
+#ifndef __RX_AGGREGATOR_H__
+#define __RX_AGGREGATOR_H__
+
+/***** INCLUDES *****/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sidekiq_api.h>
+
+#include "rx_consumer.h"
+
+/***** DEFINES *****/
+
+/* maximum number of merged streams */
+#define RX_AGGREGATOR_MAX_STREAMS       (SKIQ_MAX_NUM_CARDS * 2)
+
+/* default number of blocks buffered per stream */
+#define RX_AGGREGATOR_DEFAULT_DEPTH     (64)
+
+/* default time a full reorder buffer waits for an empty stream before blocks are forced out */
+#define RX_AGGREGATOR_DEFAULT_STALL_NS  (50 * 1000 * 1000)
+
+/* upper bound on the time a thread stays parked without re-checking its condition */
+#define RX_AGGREGATOR_PARK_NS           (5 * 1000 * 1000)
+
+/***** TYPEDEFS *****/
+
+/* called from the aggregator thread for every block, in timestamp order; nr_words may be less
+   than the payload of the block (e.g. for the last block of a capture); return 0 to continue or
+   a negative errno to stop the aggregator */
+typedef int32_t (*rx_aggregator_fn)( const struct rx_block_view *p_view,
+                                     uint32_t nr_words,
+                                     uint32_t stream,
+                                     void *p_arg );
+
+struct rx_aggregator_entry
+{
+    struct rx_block_ref *p_ref;
+    uint32_t nr_words;
+};
+
+struct rx_aggregator_stream
+{
+    struct rx_aggregator_entry *p_entries;  /* depth entries, used as a FIFO */
+    uint32_t head;                          /* next entry to emit */
+    uint32_t count;
+    bool done;                              /* the producer will not push any more blocks */
+    bool in_heap;
+    bool stalled;                           /* empty and no longer waited for */
+
+    /* statistics */
+    uint64_t nr_blocks;
+    uint32_t max_count;
+    uint64_t nr_producer_waits;             /* pushes that found the buffer full */
+    uint64_t nr_stalls;                     /* times the stream was marked as stalled */
+};
+
+struct rx_aggregator
+{
+    struct rx_aggregator_stream streams[RX_AGGREGATOR_MAX_STREAMS];
+    uint32_t nr_streams;
+    uint32_t depth;
+    uint64_t stall_ns;
+
+    /* min-heap of stream indices, keyed on the timestamp of their oldest block */
+    uint32_t heap[RX_AGGREGATOR_MAX_STREAMS];
+    uint32_t nr_heap;
+    uint32_t nr_waiting;                    /* running, not stalled streams with an empty buffer */
+    uint32_t nr_stalled;                    /* streams marked as stalled */
+    uint32_t nr_full;                       /* streams with a full buffer */
+    uint64_t stall_since_ns;                /* when a full buffer started waiting, 0 if none */
+
+    rx_aggregator_fn fn;
+    void *p_arg;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;                    /* signalled to the aggregator thread */
+    pthread_cond_t space;                   /* signalled to the producers */
+    pthread_t thread;
+    bool thread_started;
+    int32_t status;                         /* first error returned by the callback */
+
+    /* statistics */
+    uint64_t nr_emitted;
+    uint64_t nr_forced;                     /* emitted while a stream was stalled */
+    uint64_t nr_out_of_order;               /* blocks older than a block already emitted */
+    uint64_t last_ts;
+    uint64_t max_skew;                      /* largest head timestamp spread between streams */
+};
+
+#define RX_AGGREGATOR_INITIALIZER                       \
+    (struct rx_aggregator){                             \
+        .nr_streams = 0,                                \
+        .depth = RX_AGGREGATOR_DEFAULT_DEPTH,           \
+        .stall_ns = RX_AGGREGATOR_DEFAULT_STALL_NS,     \
+        .nr_heap = 0,                                   \
+        .nr_waiting = 0,                                \
+        .nr_stalled = 0,                                \
+        .nr_full = 0,                                   \
+        .stall_since_ns = 0,                            \
+        .fn = NULL,                                     \
+        .p_arg = NULL,                                  \
+        .lock = PTHREAD_MUTEX_INITIALIZER,              \
+        .work = PTHREAD_COND_INITIALIZER,               \
+        .space = PTHREAD_COND_INITIALIZER,              \
+        .thread_started = false,                        \
+        .status = 0,                                    \
+        .nr_emitted = 0,                                \
+        .nr_forced = 0,                                 \
+        .nr_out_of_order = 0,                           \
+        .last_ts = 0,                                   \
+        .max_skew = 0,                                  \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+static inline uint64_t _rx_aggregator_now_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ( (uint64_t)ts.tv_sec * 1000000000ULL ) + (uint64_t)ts.tv_nsec;
+}
+
+static inline void _rx_aggregator_park( pthread_cond_t *p_cond,
+                                        pthread_mutex_t *p_lock )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_REALTIME, &ts );
+    ts.tv_nsec += RX_AGGREGATOR_PARK_NS;
+    if ( ts.tv_nsec >= 1000000000L )
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    (void)pthread_cond_timedwait( p_cond, p_lock, &ts );
+}
+
+static inline uint64_t _rx_aggregator_head_ts( const struct rx_aggregator *a,
+                                               uint32_t stream )
+{
+    const struct rx_aggregator_stream *s = &(a->streams[stream]);
+
+    return s->p_entries[s->head].p_ref->view.p_block->rf_timestamp;
+}
+
+static inline bool _rx_aggregator_before( const struct rx_aggregator *a,
+                                          uint32_t x,
+                                          uint32_t y )
+{
+    uint64_t ts_x = _rx_aggregator_head_ts( a, x );
+    uint64_t ts_y = _rx_aggregator_head_ts( a, y );
+
+    return ( ts_x < ts_y ) || ( ( ts_x == ts_y ) && ( x < y ) );
+}
+
+static inline void _rx_aggregator_heap_push( struct rx_aggregator *a,
+                                             uint32_t stream )
+{
+    uint32_t i = a->nr_heap++;
+
+    a->heap[i] = stream;
+    while ( ( i > 0 ) && _rx_aggregator_before( a, a->heap[i], a->heap[(i - 1) / 2] ) )
+    {
+        uint32_t tmp = a->heap[i];
+        a->heap[i] = a->heap[(i - 1) / 2];
+        a->heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+    a->streams[stream].in_heap = true;
+}
+
+static inline uint32_t _rx_aggregator_heap_pop( struct rx_aggregator *a )
+{
+    uint32_t top = a->heap[0];
+    uint32_t i = 0;
+
+    a->heap[0] = a->heap[--a->nr_heap];
+    for (;;)
+    {
+        uint32_t left = ( 2 * i ) + 1, smallest = i;
+
+        if ( ( left < a->nr_heap ) && _rx_aggregator_before( a, a->heap[left], a->heap[smallest] ) )
+        {
+            smallest = left;
+        }
+        if ( ( ( left + 1 ) < a->nr_heap ) &&
+             _rx_aggregator_before( a, a->heap[left + 1], a->heap[smallest] ) )
+        {
+            smallest = left + 1;
+        }
+        if ( smallest == i )
+        {
+            break;
+        }
+        {
+            uint32_t tmp = a->heap[i];
+            a->heap[i] = a->heap[smallest];
+            a->heap[smallest] = tmp;
+        }
+        i = smallest;
+    }
+    a->streams[top].in_heap = false;
+
+    return top;
+}
+
+/* the full buffers waited long enough, stop waiting for the empty streams; lock held */
+static inline void _rx_aggregator_stall( struct rx_aggregator *a )
+{
+    uint32_t i;
+
+    for ( i = 0; i < a->nr_streams; i++ )
+    {
+        struct rx_aggregator_stream *s = &(a->streams[i]);
+
+        if ( ( s->count == 0 ) && !s->done && !s->stalled )
+        {
+            s->stalled = true;
+            s->nr_stalls++;
+            a->nr_stalled++;
+            a->nr_waiting--;
+        }
+    }
+    a->stall_since_ns = 0;
+}
+
+/* true once every stream is done and drained */
+static inline bool _rx_aggregator_finished( const struct rx_aggregator *a )
+{
+    uint32_t i;
+
+    for ( i = 0; i < a->nr_streams; i++ )
+    {
+        if ( !a->streams[i].done || ( a->streams[i].count > 0 ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static inline void *_rx_aggregator_thread( void *p_arg )
+{
+    struct rx_aggregator *a = (struct rx_aggregator *)p_arg;
+
+    pthread_mutex_lock( &(a->lock) );
+    while ( !_rx_aggregator_finished( a ) )
+    {
+        struct rx_aggregator_stream *s;
+        struct rx_aggregator_entry e;
+        uint32_t stream;
+        int32_t status = 0;
+
+        /* the oldest block is only known once every running stream has one, unless a buffer has
+           been full for so long that waiting any longer would stall its producer */
+        if ( a->nr_heap == 0 )
+        {
+            pthread_cond_wait( &(a->work), &(a->lock) );
+            continue;
+        }
+        if ( ( a->nr_waiting > 0 ) && ( a->nr_full == 0 ) )
+        {
+            a->stall_since_ns = 0;
+            pthread_cond_wait( &(a->work), &(a->lock) );
+            continue;
+        }
+        if ( a->nr_waiting > 0 )
+        {
+            uint64_t now_ns = _rx_aggregator_now_ns();
+
+            if ( a->stall_since_ns == 0 )
+            {
+                a->stall_since_ns = now_ns;
+            }
+            if ( ( now_ns - a->stall_since_ns ) < a->stall_ns )
+            {
+                _rx_aggregator_park( &(a->work), &(a->lock) );
+                continue;
+            }
+            /* latched until the stalled streams push again, so the others run at full rate */
+            _rx_aggregator_stall( a );
+        }
+        else
+        {
+            a->stall_since_ns = 0;
+        }
+        if ( a->nr_stalled > 0 )
+        {
+            a->nr_forced++;
+        }
+
+        if ( ( a->nr_waiting == 0 ) && ( a->nr_heap > 1 ) )
+        {
+            uint64_t min_ts = _rx_aggregator_head_ts( a, a->heap[0] ), max_ts = min_ts;
+            uint32_t i;
+
+            for ( i = 1; i < a->nr_heap; i++ )
+            {
+                uint64_t ts = _rx_aggregator_head_ts( a, a->heap[i] );
+                max_ts = ( ts > max_ts ) ? ts : max_ts;
+            }
+            if ( ( max_ts - min_ts ) > a->max_skew )
+            {
+                a->max_skew = max_ts - min_ts;
+            }
+        }
+
+        stream = _rx_aggregator_heap_pop( a );
+        s = &(a->streams[stream]);
+        e = s->p_entries[s->head];
+        if ( s->count == a->depth )
+        {
+            a->nr_full--;
+        }
+        s->head = ( s->head + 1 ) % a->depth;
+        s->count--;
+        if ( s->count > 0 )
+        {
+            _rx_aggregator_heap_push( a, stream );
+        }
+        else if ( !s->done )
+        {
+            a->nr_waiting++;
+        }
+        pthread_cond_broadcast( &(a->space) );
+
+        if ( ( a->nr_emitted > 0 ) && ( e.p_ref->view.p_block->rf_timestamp < a->last_ts ) )
+        {
+            a->nr_out_of_order++;
+        }
+        a->last_ts = e.p_ref->view.p_block->rf_timestamp;
+        a->nr_emitted++;
+
+        /* the callback runs without the lock so that the producers are not held up */
+        pthread_mutex_unlock( &(a->lock) );
+        if ( a->status == 0 )
+        {
+            status = a->fn( &(e.p_ref->view), e.nr_words, stream, a->p_arg );
+        }
+        rx_block_ref_put( e.p_ref );
+        pthread_mutex_lock( &(a->lock) );
+
+        if ( ( status != 0 ) && ( a->status == 0 ) )
+        {
+            a->status = status;
+        }
+    }
+    pthread_mutex_unlock( &(a->lock) );
+
+    return NULL;
+}
+
+/*****************************************************************************/
+/** Wait for the aggregator thread to emit every buffered block and release the reorder
+    buffers.  Every stream must have been marked done with rx_aggregator_stream_done() first.
+    Safe to call on an aggregator that failed to initialize.
+
+    @param[in] a            aggregator
+
+    @return the first error returned by the output callback, or 0
+*/
+static inline int32_t rx_aggregator_close( struct rx_aggregator *a )
+{
+    uint32_t i;
+
+    if ( a->thread_started )
+    {
+        pthread_join( a->thread, NULL );
+        a->thread_started = false;
+    }
+    for ( i = 0; i < a->nr_streams; i++ )
+    {
+        struct rx_aggregator_stream *s = &(a->streams[i]);
+
+        /* only left over if the thread never started */
+        while ( s->p_entries != NULL && s->count > 0 )
+        {
+            rx_block_ref_put( s->p_entries[s->head].p_ref );
+            s->head = ( s->head + 1 ) % a->depth;
+            s->count--;
+        }
+        free( s->p_entries );
+        s->p_entries = NULL;
+    }
+
+    return a->status;
+}
+
+/*****************************************************************************/
+/** Allocate the reorder buffers and start the aggregator thread.
+
+    @param[out] a           aggregator to initialize
+    @param[in]  nr_streams  number of merged streams, at most RX_AGGREGATOR_MAX_STREAMS
+    @param[in]  depth       number of blocks buffered per stream, 0 for the default
+    @param[in]  stall_ns    how long a full buffer waits for the empty streams before blocks
+                            are emitted without them, 0 for the default
+    @param[in]  fn          output callback
+    @param[in]  p_arg       argument passed to the callback
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t rx_aggregator_init( struct rx_aggregator *a,
+                                          uint32_t nr_streams,
+                                          uint32_t depth,
+                                          uint64_t stall_ns,
+                                          rx_aggregator_fn fn,
+                                          void *p_arg )
+{
+    uint32_t i;
+    int32_t status;
+
+    *a = RX_AGGREGATOR_INITIALIZER;
+    if ( ( nr_streams == 0 ) || ( nr_streams > RX_AGGREGATOR_MAX_STREAMS ) || ( fn == NULL ) )
+    {
+        return -EINVAL;
+    }
+    if ( depth != 0 )
+    {
+        a->depth = depth;
+    }
+    if ( stall_ns != 0 )
+    {
+        a->stall_ns = stall_ns;
+    }
+    a->nr_streams = nr_streams;
+    a->fn = fn;
+    a->p_arg = p_arg;
+
+    for ( i = 0; i < nr_streams; i++ )
+    {
+        a->streams[i].p_entries = calloc( a->depth, sizeof(struct rx_aggregator_entry) );
+        if ( a->streams[i].p_entries == NULL )
+        {
+            (void)rx_aggregator_close( a );
+            return -ENOMEM;
+        }
+    }
+    /* every stream starts out running and empty */
+    a->nr_waiting = nr_streams;
+
+    status = pthread_create( &(a->thread), NULL, _rx_aggregator_thread, a );
+    if ( status != 0 )
+    {
+        (void)rx_aggregator_close( a );
+        return -status;
+    }
+    a->thread_started = true;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Copy a received block into the reorder buffer of its stream, waiting while the buffer is full.
+    Called from the receive thread of the stream, typically from a processing stage.
+
+    @param[in] a            aggregator
+    @param[in] stream       index of the stream
+    @param[in] p_view       view of the received block
+    @param[in] nr_words     number of payload words of the block to emit
+    @param[in] p_running    stop waiting once this becomes false, may be NULL
+
+    @return 0 on success, -ENOMEM if the block could not be copied, -ECANCELED if the wait was
+            abandoned, or the error returned by the output callback
+*/
+static inline int32_t rx_aggregator_push( struct rx_aggregator *a,
+                                          uint32_t stream,
+                                          const struct rx_block_view *p_view,
+                                          uint32_t nr_words,
+                                          volatile bool *p_running )
+{
+    struct rx_aggregator_stream *s = &(a->streams[stream]);
+    struct rx_block_ref *p_ref;
+    int32_t status;
+
+    /* copy the block before taking the lock */
+    p_ref = rx_view_retain( NULL, p_view );
+    if ( p_ref == NULL )
+    {
+        return -ENOMEM;
+    }
+
+    pthread_mutex_lock( &(a->lock) );
+    if ( s->count == a->depth )
+    {
+        s->nr_producer_waits++;
+    }
+    while ( ( s->count == a->depth ) && ( a->status == 0 ) &&
+            ( ( p_running == NULL ) || *p_running ) )
+    {
+        _rx_aggregator_park( &(a->space), &(a->lock) );
+    }
+
+    status = a->status;
+    if ( ( status == 0 ) && ( s->count == a->depth ) )
+    {
+        status = -ECANCELED;
+    }
+    if ( status == 0 )
+    {
+        s->p_entries[( s->head + s->count ) % a->depth] =
+            (struct rx_aggregator_entry){ .p_ref = p_ref, .nr_words = nr_words };
+        s->count++;
+        s->nr_blocks++;
+        if ( s->count > s->max_count )
+        {
+            s->max_count = s->count;
+        }
+        if ( s->count == a->depth )
+        {
+            a->nr_full++;
+        }
+        if ( !s->in_heap )
+        {
+            /* the stream was empty, its oldest block joins the merge */
+            _rx_aggregator_heap_push( a, stream );
+            if ( s->stalled )
+            {
+                s->stalled = false;
+                a->nr_stalled--;
+            }
+            else
+            {
+                a->nr_waiting--;
+            }
+        }
+        pthread_cond_signal( &(a->work) );
+        p_ref = NULL;
+    }
+    pthread_mutex_unlock( &(a->lock) );
+
+    rx_block_ref_put( p_ref );
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Mark a stream as finished, so the aggregator no longer waits for it.  The blocks that are
+    still buffered for the stream are emitted.
+
+    @param[in] a            aggregator
+    @param[in] stream       index of the stream
+
+    @return void
+*/
+static inline void rx_aggregator_stream_done( struct rx_aggregator *a,
+                                              uint32_t stream )
+{
+    struct rx_aggregator_stream *s = &(a->streams[stream]);
+
+    pthread_mutex_lock( &(a->lock) );
+    if ( !s->done )
+    {
+        s->done = true;
+        if ( s->stalled )
+        {
+            s->stalled = false;
+            a->nr_stalled--;
+        }
+        else if ( s->count == 0 )
+        {
+            a->nr_waiting--;
+        }
+    }
+    pthread_cond_signal( &(a->work) );
+    pthread_mutex_unlock( &(a->lock) );
+}
+
+/*****************************************************************************/
+/** Print the aggregator statistics.  Should be called after rx_aggregator_close().
+
+    @param[in] a            aggregator
+    @param[in] p_fp         destination, e.g. stdout
+
+    @return void
+*/
+static inline void rx_aggregator_print_stats( const struct rx_aggregator *a,
+                                              FILE *p_fp )
+{
+    uint32_t i;
+
+    fprintf( p_fp, "Info: aggregated %" PRIu64 " blocks from %" PRIu32 " streams (%" PRIu64
+             " emitted while a stream was stalled, %" PRIu64 " out of order), largest"
+             " timestamp skew between streams %" PRIu64 "\n", a->nr_emitted, a->nr_streams,
+             a->nr_forced, a->nr_out_of_order, a->max_skew );
+    for ( i = 0; i < a->nr_streams; i++ )
+    {
+        fprintf( p_fp, "Info:   stream %" PRIu32 ": %" PRIu64 " blocks, reorder buffer high"
+                 " water %" PRIu32 " of %" PRIu32 ", waited on a full buffer %" PRIu64
+                 " times, stalled %" PRIu64 " times\n", i, a->streams[i].nr_blocks,
+                 a->streams[i].max_count, a->depth, a->streams[i].nr_producer_waits,
+                 a->streams[i].nr_stalls );
+    }
+}
+
+#endif  /* __RX_AGGREGATOR_H__ */
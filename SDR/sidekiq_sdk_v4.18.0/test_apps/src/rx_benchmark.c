@@ -7,6 +7,10 @@
  * </pre>
  */
 
+#if (!defined _GNU_SOURCE)
+#define _GNU_SOURCE         /* for pthread_setaffinity_np, see feature_test_macros(7) */
+#endif
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -16,10 +20,15 @@
 #include <pthread.h>
 #include <signal.h>
 #include <inttypes.h>
+#include <time.h>
 
 #include <sidekiq_api.h>
 #include <arg_parser.h>
 
+#include "rt_thread.h"
+#include "rx_continuity.h"
+#include "telemetry.h"
+
 /* https://gcc.gnu.org/onlinedocs/gcc-4.8.5/cpp/Stringification.html */
 #define xstr(s)                         str(s)
 #define str(s)                          #s
@@ -28,6 +37,19 @@
 #   define DEFAULT_CARD_NUMBER  0
 #endif
 
+/* counters are padded to this size so the receive loop and the monitor thread
+   do not false share */
+#ifndef CACHE_LINE_SIZE
+#   define CACHE_LINE_SIZE      64
+#endif
+
+/* inter-block arrival histogram buckets, bucket N counts intervals in
+   [2^(N-1), 2^N) microseconds, the last bucket counts everything larger */
+#define NR_ARRIVAL_BUCKETS      (20)
+
+#define NUM_NANOSEC_IN_SEC      (1000000000ULL)
+#define NUM_NANOSEC_IN_USEC     (1000ULL)
+
 /* these are used to provide help strings for the application when running it
    with either the "-h" or "--help" flags */
 static const char* p_help_short = "characterize receive";
@@ -38,7 +60,24 @@ information collected during execution.\n\
 Defaults:\n\
   --card=" xstr(DEFAULT_CARD_NUMBER) "\n\
   --handle=A1\n\
-  --rate=1000000";
+  --rate=1000000\n\
+" RT_THREAD_HELP_DEFAULTS "\
+\n\
+The receive loop is thread 0 and the monitor thread is thread 1 for --cpus,\n\
+only the receive loop runs with --rt-priority.\n\
+\n\
+With --latency, the time spent in each skiq_receive() call that returns a\n\
+block is reported (min/avg/max) every second, along with the time between\n\
+blocks on each handle.  A histogram of those inter-block arrival times is\n\
+printed when the benchmark exits.\n\
+\n\
+Sensors are read by a background thread, never by the receive loop or the\n\
+monitor.  --temp-log samples the temperature every second; --telemetry=LIST\n\
+sets the sampling periods in milliseconds of the temperature, the\n\
+accelerometer, the GPSDO (lock and frequency accuracy) and the last 1PPS\n\
+timestamps, in that order (0 or an empty entry leaves a sensor out, e.g.\n\
+--telemetry=1000,100,,250), and the latest values are reported every\n\
+second.";
 
 /* command line argument variables */
 static char* p_handle = "A1";
@@ -51,22 +90,43 @@ static bool low_latency = false;
 static bool balanced = false;
 static char* p_temp_log_name = NULL;
 static bool temp_log_is_set = false;
+static bool measure_latency = false;
+static char* p_telemetry = NULL;
+static struct rt_thread_config rt_cfg = RT_THREAD_CONFIG_INITIALIZER;
+
+/* per handle counters, only written by the receive loop and read by the monitor
+   thread without taking a lock (counters only ever increase, the monitor
+   reports the difference between snapshots) */
+struct hdl_counters
+{
+    uint64_t num_bytes;                 // # bytes received
+    uint64_t num_pkts;                  // # blocks received
+    uint64_t ts_gaps;                   // # timestamp gaps detected
+
+    /* only updated with --latency */
+    uint64_t lat_sum_ns;                // total time spent in skiq_receive()
+    uint64_t lat_min_ns;                // reset by the monitor every interval
+    uint64_t lat_max_ns;                // reset by the monitor every interval
+    uint64_t arrival_sum_ns;            // total time between blocks
+    uint64_t nr_arrivals;
+    uint64_t last_arrival_ns;           // private to the receive loop
+    uint64_t arrival_hist[NR_ARRIVAL_BUCKETS];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
 
 /* global variables shared amongst threads */
 static pthread_t monitor_thread;
-static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 
 static bool running = true;
-static uint64_t num_bytes=0; // # bytes received
 static uint32_t throughput=0; // current MB/s
 static uint32_t target=0; // desired MB/s
 static bool target_is_set = false;
-static uint32_t num_pkts[skiq_rx_hdl_end] = { [0 ... skiq_rx_hdl_end-1] = 0 };
-static uint64_t ts_gaps[skiq_rx_hdl_end] = { [0 ... skiq_rx_hdl_end-1] = 0 };
+static struct hdl_counters counters[skiq_rx_hdl_end];
 static uint64_t threshold=0; // max number of timestamp errors before failure
 static bool threshold_is_set = false;
 static uint32_t run_time=0;
 static FILE *p_temp_log=NULL;
+static struct telemetry telemetry = TELEMETRY_INITIALIZER;
+static bool telemetry_started = false;
 
 /* keep track of the specified handles to start streaming */
 static skiq_rx_hdl_t handles[skiq_rx_hdl_end];
@@ -150,6 +210,19 @@ static struct application_argument p_args[] =
                         &p_temp_log_name,
                         STRING_VAR_TYPE,
                         &temp_log_is_set),    
+    APP_ARG_OPT("latency",
+                0,
+                "Report per-block receive latency and inter-block arrival times",
+                NULL,
+                &measure_latency,
+                BOOL_VAR_TYPE),
+    APP_ARG_OPT("telemetry",
+                0,
+                "Sample the sensors in the background every TEMP,ACCEL,GPSDO,PPS milliseconds",
+                "LIST",
+                &p_telemetry,
+                STRING_VAR_TYPE),
+    RT_THREAD_APP_ARGS(&rt_cfg),
     APP_ARG_TERMINATOR,
 };
 
@@ -249,6 +322,114 @@ parse_hdl_list( char *handle_str,
 }
 
 
+/*****************************************************************************/
+/** The counter helpers below are only ever called by a single writer (the
+    receive loop) so a plain load followed by an atomic store is enough; the
+    monitor uses atomic loads to take its snapshots.
+*/
+static inline void counter_add( uint64_t *p_counter, uint64_t value )
+{
+    __atomic_store_n( p_counter, *p_counter + value, __ATOMIC_RELAXED );
+}
+
+static inline uint64_t counter_read( uint64_t *p_counter )
+{
+    return __atomic_load_n( p_counter, __ATOMIC_RELAXED );
+}
+
+/* update a minimum that the monitor may concurrently reset */
+static inline void counter_min( uint64_t *p_counter, uint64_t value )
+{
+    uint64_t curr = __atomic_load_n( p_counter, __ATOMIC_RELAXED );
+
+    while ( ( value < curr ) &&
+            !__atomic_compare_exchange_n( p_counter, &curr, value, false, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED ) )
+    {
+    }
+}
+
+/* update a maximum that the monitor may concurrently reset */
+static inline void counter_max( uint64_t *p_counter, uint64_t value )
+{
+    uint64_t curr = __atomic_load_n( p_counter, __ATOMIC_RELAXED );
+
+    while ( ( value > curr ) &&
+            !__atomic_compare_exchange_n( p_counter, &curr, value, false, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED ) )
+    {
+    }
+}
+
+static inline uint64_t get_time_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ( (uint64_t)ts.tv_sec * NUM_NANOSEC_IN_SEC ) + (uint64_t)ts.tv_nsec;
+}
+
+/* the bucket for an interval is the number of bits needed to represent it in microseconds */
+static inline uint8_t arrival_bucket( uint64_t interval_ns )
+{
+    uint64_t interval_us = interval_ns / NUM_NANOSEC_IN_USEC;
+    uint8_t bucket = 0;
+
+    while ( ( interval_us > 0 ) && ( bucket < ( NR_ARRIVAL_BUCKETS - 1 ) ) )
+    {
+        interval_us >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+/*****************************************************************************/
+/** This function prints the inter-block arrival histogram for each handle.
+
+    @param none
+    @return void
+*/
+static void print_arrival_histogram( void )
+{
+    uint8_t i, bucket;
+
+    for ( i = 0; i < nr_handles; i++ )
+    {
+        struct hdl_counters *p_cnt = &(counters[handles[i]]);
+        uint64_t nr_arrivals = counter_read( &(p_cnt->nr_arrivals) );
+
+        printf("Info: Rx%s inter-block arrival times (%" PRIu64 " intervals)\n",
+               rx_hdl_cstr(handles[i]), nr_arrivals);
+        for ( bucket = 0; bucket < NR_ARRIVAL_BUCKETS; bucket++ )
+        {
+            uint64_t count = counter_read( &(p_cnt->arrival_hist[bucket]) );
+
+            if ( count == 0 )
+            {
+                continue;
+            }
+
+            if ( bucket == 0 )
+            {
+                printf("        < 1 us");
+            }
+            else if ( bucket == ( NR_ARRIVAL_BUCKETS - 1 ) )
+            {
+                printf("    >= %7" PRIu64 " us", (uint64_t)1 << (bucket - 1));
+            }
+            else
+            {
+                printf(" %7" PRIu64 "-%7" PRIu64 " us", (uint64_t)1 << (bucket - 1),
+                       ((uint64_t)1 << bucket) - 1);
+            }
+            printf(": %12" PRIu64 " (%6.2f%%)\n", count,
+                   (nr_arrivals > 0) ? (100.0 * (double)count / (double)nr_arrivals) : 0.0);
+        }
+    }
+}
+
 /*****************************************************************************/
 /** This is the cleanup handler to ensure that the app properly exits and
     does the needed cleanup if it ends unexpectedly.
@@ -262,6 +443,47 @@ void app_cleanup(int signum)
     running = false; // clears the running flag so that everything exits
 }
 
+/*****************************************************************************/
+/** This function prints the latest sensor readings of the telemetry thread.
+
+    @param p_sample: snapshot of the telemetry
+    @return void
+*/
+static void print_telemetry( const struct telemetry_sample *p_sample )
+{
+    printf("Telemetry:");
+    if( p_sample->valid & TELEMETRY_VALID_TEMP )
+    {
+        printf(" temperature %d C", p_sample->temp_c);
+    }
+    if( p_sample->valid & TELEMETRY_VALID_ACCEL )
+    {
+        printf(" accel (%d, %d, %d) mg", p_sample->accel[0], p_sample->accel[1],
+               p_sample->accel[2]);
+    }
+    if( p_sample->valid & TELEMETRY_VALID_GPSDO )
+    {
+        if( p_sample->gpsdo_locked )
+        {
+            printf(" GPSDO locked (%.6f ppm)", p_sample->gpsdo_ppm);
+        }
+        else
+        {
+            printf(" GPSDO unlocked");
+        }
+    }
+    if( p_sample->valid & TELEMETRY_VALID_PPS )
+    {
+        printf(" last 1PPS RF 0x%016" PRIx64 " sys 0x%016" PRIx64, p_sample->pps_rf_timestamp,
+               p_sample->pps_sys_timestamp);
+    }
+    if( p_sample->valid == 0 )
+    {
+        printf(" no sensor read yet");
+    }
+    printf("\n");
+}
+
 /*****************************************************************************/
 /** This is a separate thread that monitors the performance of the DMA engine.
 
@@ -271,6 +493,11 @@ void app_cleanup(int signum)
 void* monitor_performance(void *ptr)
 {
     uint64_t last_ts_gaps[skiq_rx_hdl_end] = { [0 ... skiq_rx_hdl_end-1] = 0 };
+    uint64_t last_num_bytes[skiq_rx_hdl_end] = { [0 ... skiq_rx_hdl_end-1] = 0 };
+    uint64_t last_num_pkts[skiq_rx_hdl_end] = { [0 ... skiq_rx_hdl_end-1] = 0 };
+    uint64_t last_lat_sum_ns[skiq_rx_hdl_end] = { [0 ... skiq_rx_hdl_end-1] = 0 };
+    uint64_t last_arrival_sum_ns[skiq_rx_hdl_end] = { [0 ... skiq_rx_hdl_end-1] = 0 };
+    uint64_t last_nr_arrivals[skiq_rx_hdl_end] = { [0 ... skiq_rx_hdl_end-1] = 0 };
     uint64_t monitor_time=0;
 
     /* run until the running flag gets cleared */
@@ -280,9 +507,22 @@ void* monitor_performance(void *ptr)
         /* if still running after sleeping, report statistics */
         if ( running )
         {
+            uint64_t num_bytes = 0;
+            uint64_t curr_num_bytes[skiq_rx_hdl_end];
+            uint64_t curr_num_pkts[skiq_rx_hdl_end];
+            uint64_t curr_ts_gaps[skiq_rx_hdl_end];
             uint8_t i;
 
-            pthread_mutex_lock(&lock);
+            /* take a snapshot of the counters before printing anything */
+            for (i = 0; i < nr_handles; i++)
+            {
+                skiq_rx_hdl_t hdl = handles[i];
+
+                curr_num_bytes[hdl] = counter_read( &(counters[hdl].num_bytes) );
+                curr_num_pkts[hdl] = counter_read( &(counters[hdl].num_pkts) );
+                curr_ts_gaps[hdl] = counter_read( &(counters[hdl].ts_gaps) );
+                num_bytes += curr_num_bytes[hdl] - last_num_bytes[hdl];
+            }
 
             throughput = num_bytes / 1000000;
 
@@ -291,47 +531,99 @@ void* monitor_performance(void *ptr)
             {
                 skiq_rx_hdl_t hdl = handles[i];
 
-                if ( hdl < skiq_rx_hdl_end )
+                printf(" (RX%s pkts %" PRIu64 ") (# Rx%s timestamp gaps total %" PRIu64
+                       ", delta %" PRIu64 ")", rx_hdl_cstr(hdl), curr_num_pkts[hdl],
+                       rx_hdl_cstr(hdl), curr_ts_gaps[hdl], curr_ts_gaps[hdl] - last_ts_gaps[hdl]);
+            }
+            printf("\n");
+
+            if ( measure_latency )
+            {
+                for (i = 0; i < nr_handles; i++)
                 {
-                    printf(" (RX%s pkts %" PRIu32 ") (# Rx%s timestamp gaps total %" PRIu64
-                           ", delta %" PRIu64 ")", rx_hdl_cstr(hdl), num_pkts[hdl],
-                           rx_hdl_cstr(hdl), ts_gaps[hdl], ts_gaps[hdl] - last_ts_gaps[hdl]);
+                    skiq_rx_hdl_t hdl = handles[i];
+                    struct hdl_counters *p_cnt = &(counters[hdl]);
+                    uint64_t lat_sum_ns = counter_read( &(p_cnt->lat_sum_ns) );
+                    uint64_t arrival_sum_ns = counter_read( &(p_cnt->arrival_sum_ns) );
+                    uint64_t nr_arrivals = counter_read( &(p_cnt->nr_arrivals) );
+                    uint64_t nr_pkts = curr_num_pkts[hdl] - last_num_pkts[hdl];
+                    uint64_t lat_min_ns, lat_max_ns;
+
+                    /* reset the interval min/max, a concurrent update from the receive
+                       loop lands in either this interval or the next */
+                    lat_min_ns = __atomic_exchange_n( &(p_cnt->lat_min_ns), UINT64_MAX,
+                                                      __ATOMIC_RELAXED );
+                    lat_max_ns = __atomic_exchange_n( &(p_cnt->lat_max_ns), 0, __ATOMIC_RELAXED );
+
+                    if ( nr_pkts == 0 )
+                    {
+                        printf("  Rx%s latency: no blocks received\n", rx_hdl_cstr(hdl));
+                    }
+                    else
+                    {
+                        printf("  Rx%s latency (us) min %.3f avg %.3f max %.3f, inter-block"
+                               " arrival (us) avg %.3f\n", rx_hdl_cstr(hdl),
+                               (double)lat_min_ns / NUM_NANOSEC_IN_USEC,
+                               (double)(lat_sum_ns - last_lat_sum_ns[hdl]) / nr_pkts /
+                               NUM_NANOSEC_IN_USEC,
+                               (double)lat_max_ns / NUM_NANOSEC_IN_USEC,
+                               (nr_arrivals > last_nr_arrivals[hdl]) ?
+                               ((double)(arrival_sum_ns - last_arrival_sum_ns[hdl]) /
+                                (nr_arrivals - last_nr_arrivals[hdl]) / NUM_NANOSEC_IN_USEC) :
+                               0.0);
+                    }
 
-                    last_ts_gaps[hdl] = ts_gaps[hdl];
+                    last_lat_sum_ns[hdl] = lat_sum_ns;
+                    last_arrival_sum_ns[hdl] = arrival_sum_ns;
+                    last_nr_arrivals[hdl] = nr_arrivals;
                 }
             }
-            printf("\n");
+
+            for (i = 0; i < nr_handles; i++)
+            {
+                skiq_rx_hdl_t hdl = handles[i];
+
+                last_ts_gaps[hdl] = curr_ts_gaps[hdl];
+                last_num_bytes[hdl] = curr_num_bytes[hdl];
+                last_num_pkts[hdl] = curr_num_pkts[hdl];
+            }
 
             if( run_time > 0 )
             {
                 running = (0 == --run_time) ? false : running;
             }
 
-            num_bytes=0;
-            pthread_mutex_unlock(&lock);
-
-            if( p_temp_log != NULL )
+            if( telemetry_started )
             {
-                int32_t temp_status=0;
-                int8_t temp=0;
+                struct telemetry_sample sample;
 
-                // append the header if the beginning of the file
-                if( monitor_time == 0 )
+                /* the sensors are read by the telemetry thread, this is only a copy */
+                (void)telemetry_read( &telemetry, &sample );
+                if( p_telemetry != NULL )
                 {
-                    fprintf(p_temp_log, "Time(s),Temperature(C)\n");
+                    print_telemetry( &sample );
                 }
-                monitor_time++;
-
-                if( (temp_status=skiq_read_temp(card, &temp)) == 0 )
+                if( p_temp_log != NULL )
                 {
-                    printf("Current temperature: %d C\n", temp);
-                    // write the temperature to the file
-                    fprintf(p_temp_log, "%" PRIu64 ",%d\n", monitor_time, temp);
-                }
-                else
-                {
-                    printf("Unable to obtain temperature (status=%d)\n",
-                           temp_status);
+                    // append the header if the beginning of the file
+                    if( monitor_time == 0 )
+                    {
+                        fprintf(p_temp_log, "Time(s),Temperature(C)\n");
+                    }
+                    monitor_time++;
+
+                    if( sample.valid & TELEMETRY_VALID_TEMP )
+                    {
+                        printf("Current temperature: %d C\n", sample.temp_c);
+                        // write the temperature to the file
+                        fprintf(p_temp_log, "%" PRIu64 ",%d\n", monitor_time, sample.temp_c);
+                    }
+                    else
+                    {
+                        printf("Unable to obtain temperature (status=%d)\n",
+                               __atomic_load_n( &(telemetry.last_status[telemetry_temp]),
+                                                __ATOMIC_RELAXED ));
+                    }
                 }
             }
         }
@@ -356,12 +648,20 @@ int main( int argc, char *argv[] )
     skiq_xport_init_level_t level = skiq_xport_init_level_full;
     skiq_chan_mode_t chan_mode = skiq_chan_mode_single;
     skiq_rx_hdl_t rx_hdl=skiq_rx_hdl_A1;
-    uint64_t curr_ts[skiq_rx_hdl_end] = { [0 ... skiq_rx_hdl_end-1] = 0 };
-    uint64_t next_ts[skiq_rx_hdl_end] = { [0 ... skiq_rx_hdl_end-1] = 0 };
-    bool first_block[skiq_rx_hdl_end] = { [0 ... skiq_rx_hdl_end-1] = true };
+    struct rx_continuity cont[skiq_rx_hdl_end];
+    skiq_rx_status_t rx_status;
     uint8_t i;
     pid_t owner = 0;
     skiq_rx_stream_mode_t stream_mode = skiq_rx_stream_mode_high_tput;
+    uint64_t rx_start_ns = 0;
+
+    memset( counters, 0, sizeof(counters) );
+    for ( rx_hdl = skiq_rx_hdl_A1; rx_hdl < skiq_rx_hdl_end; rx_hdl++ )
+    {
+        counters[rx_hdl].lat_min_ns = UINT64_MAX;
+        cont[rx_hdl] = RX_CONTINUITY_INITIALIZER;
+    }
+    rx_hdl = skiq_rx_hdl_A1;
 
     /* always install a handler for proper cleanup */
     signal(SIGINT, app_cleanup);
@@ -373,6 +673,11 @@ int main( int argc, char *argv[] )
         return (-1);
     }
 
+    if ( rt_thread_config_init( &rt_cfg ) != 0 )
+    {
+        return (-1);
+    }
+
     if ( threshold_is_set && ( threshold == 0 ) )
     {
         fprintf(stderr, "Error: cannot specify a timestamp gap threshold of 0\n");
@@ -541,6 +846,11 @@ int main( int argc, char *argv[] )
         return (-1);
     }
     printf("Info: IQ pack mode: %s\n", (packed == true) ? "enabled" : "disabled");
+    for ( i = 0; i < nr_handles; i++ )
+    {
+        /* only classify, the benchmark doesn't consume the samples */
+        (void)rx_continuity_init( &(cont[handles[i]]), handles[i], packed, rx_cont_fill_none, 0, 0 );
+    }
 
     // configure the sample rate and start streaming
     for( i=0; i<nr_handles; i++ )
@@ -570,8 +880,37 @@ int main( int argc, char *argv[] )
         return (-3);
     }
 
+    /* the sensors are sampled in the background, the first readings are in by the time the
+       monitor reports */
+    if( ( p_telemetry != NULL ) || ( p_temp_log != NULL ) )
+    {
+        uint32_t periods[telemetry_nr_sensors] = { 0 };
+
+        if( p_temp_log != NULL )
+        {
+            periods[telemetry_temp] = TELEMETRY_DEFAULT_TEMP_MS;
+        }
+        if( telemetry_parse_periods( p_telemetry, periods ) != 0 )
+        {
+            fprintf(stderr, "Error: invalid --telemetry periods '%s'\n", p_telemetry);
+            status = -1;
+            goto sidekiq_exit;
+        }
+        status = telemetry_start( &telemetry, card, periods );
+        if( status != 0 )
+        {
+            fprintf(stderr, "Error: unable to start the telemetry thread (status %d)\n", status);
+            goto sidekiq_exit;
+        }
+        telemetry_started = true;
+    }
+
     /* initialize a thread to monitor our performance */
     pthread_create( &monitor_thread, NULL, monitor_performance, NULL );
+    (void)rt_thread_apply( &rt_cfg, monitor_thread, 1, false, "monitor" );
+
+    /* the monitor thread is started first so it doesn't inherit the receive settings */
+    (void)rt_thread_apply( &rt_cfg, pthread_self(), 0, true, "Rx" );
 
     /* start receive streaming */
     printf("Info: starting %u Rx interface(s) on card %u\n", nr_handles, card);
@@ -585,50 +924,66 @@ int main( int argc, char *argv[] )
     /* run forever and ever and ever (or until Ctrl-C) */
     while( running )
     {
-        if( skiq_receive(card,
-                         &rx_hdl,
-                         &p_rx_block,
-                         &data_len) == skiq_rx_status_success )
+        if ( measure_latency )
+        {
+            rx_start_ns = get_time_ns();
+        }
+
+        rx_status = skiq_receive( card, &rx_hdl, &p_rx_block, &data_len );
+        if ( rx_status == skiq_rx_status_error_overrun )
+        {
+            /* an overrun isn't reported per handle, the next gap of any of them may be due to it */
+            for ( i = 0; i < nr_handles; i++ )
+            {
+                rx_continuity_overrun( &(cont[handles[i]]) );
+            }
+        }
+        else if ( rx_status == skiq_rx_status_success )
         {
-            pthread_mutex_lock(&lock);
             if ( rx_hdl < skiq_rx_hdl_end )
             {
-                curr_ts[rx_hdl] = p_rx_block->rf_timestamp;
-                if ( !first_block[rx_hdl] )
+                struct hdl_counters *p_cnt = &(counters[rx_hdl]);
+                enum rx_cont_event event;
+
+                if ( measure_latency )
                 {
-                    if ( curr_ts[rx_hdl] != next_ts[rx_hdl] )
+                    uint64_t now_ns = get_time_ns();
+                    uint64_t lat_ns = now_ns - rx_start_ns;
+
+                    counter_add( &(p_cnt->lat_sum_ns), lat_ns );
+                    counter_min( &(p_cnt->lat_min_ns), lat_ns );
+                    counter_max( &(p_cnt->lat_max_ns), lat_ns );
+                    if ( cont[rx_hdl].started )
                     {
-                        if ( curr_ts[rx_hdl] < next_ts[rx_hdl] )
-                        {
-                            fprintf(stderr, "Error: Rx%s backward timestamp detected: current = "
-                                    "0x%016" PRIx64 ", expected = 0x%016" PRIx64 "\n",
-                                    rx_hdl_cstr(rx_hdl), curr_ts[rx_hdl], next_ts[rx_hdl] );
-                        }
-                        ts_gaps[rx_hdl]++;
+                        uint64_t interval_ns = now_ns - p_cnt->last_arrival_ns;
+
+                        counter_add( &(p_cnt->arrival_sum_ns), interval_ns );
+                        counter_add( &(p_cnt->arrival_hist[arrival_bucket(interval_ns)]), 1 );
+                        counter_add( &(p_cnt->nr_arrivals), 1 );
                     }
-                }
-                else
-                {
-                    first_block[rx_hdl] = false;
+                    p_cnt->last_arrival_ns = now_ns;
                 }
 
-                /* next timestamp value depends on IQ pack mode setting */
-                if (packed)
-                {
-                    next_ts[rx_hdl] = curr_ts[rx_hdl] + SKIQ_NUM_PACKED_SAMPLES_IN_BLOCK((data_len / 4) - SKIQ_RX_HEADER_SIZE_IN_WORDS);
-                }
-                else
+                /* the samples per block depend on the IQ pack mode setting */
+                event = rx_continuity_check_block( &(cont[rx_hdl]), p_rx_block, data_len );
+                if ( event != rx_cont_ok && event != rx_cont_first )
                 {
-                    next_ts[rx_hdl] = curr_ts[rx_hdl] + (data_len / 4) - SKIQ_RX_HEADER_SIZE_IN_WORDS;
+                    if ( event == rx_cont_backward )
+                    {
+                        fprintf(stderr, "Error: Rx%s backward timestamp detected: current = "
+                                "0x%016" PRIx64 ", expected = 0x%016" PRIx64 "\n",
+                                rx_hdl_cstr(rx_hdl), p_rx_block->rf_timestamp,
+                                cont[rx_hdl].last_expected_ts );
+                    }
+                    counter_add( &(p_cnt->ts_gaps), 1 );
                 }
-                num_pkts[rx_hdl]++;
+                counter_add( &(p_cnt->num_pkts), 1 );
+                counter_add( &(p_cnt->num_bytes), data_len );
             }
             else
             {
                 fprintf(stderr, "Error: out-of-range receive handle %u provided by skiq_receive()\n", rx_hdl);
             }
-            num_bytes += data_len;
-            pthread_mutex_unlock(&lock);
         }
     }
 
@@ -639,7 +994,23 @@ int main( int argc, char *argv[] )
     /* wait for the monitor thread to complete */
     pthread_join(monitor_thread,NULL);
 
+    if ( measure_latency )
+    {
+        print_arrival_histogram();
+    }
+
+    for ( i = 0; i < nr_handles; i++ )
+    {
+        const struct rx_continuity *c = &(cont[handles[i]]);
+
+        printf("Info: Rx%s continuity: %" PRIu64 " gap(s) (%" PRIu64 " after an overrun, %"
+               PRIu64 " samples missing), %" PRIu64 " backward timestamp(s)\n",
+               rx_hdl_cstr(handles[i]), c->nr_gaps, c->nr_overruns, c->nr_missing_samples,
+               c->nr_backward);
+    }
+
 sidekiq_exit:
+    telemetry_stop( &telemetry );
     if( p_temp_log != NULL )
     {
         fclose( p_temp_log );
@@ -655,10 +1026,12 @@ sidekiq_exit:
 
     for ( i = 0; i < nr_handles; i++ )
     {
-        if ( threshold_is_set && ( ts_gaps[handles[i]] >= threshold ) )
+        uint64_t ts_gaps = counter_read( &(counters[handles[i]].ts_gaps) );
+
+        if ( threshold_is_set && ( ts_gaps >= threshold ) )
         {
             fprintf(stderr, "Error: Number of timestamp gaps (%" PRIu64 ") on handle %s exceeded "
-                    "specified threshold (%" PRIu64 ")\n", ts_gaps[handles[i]],
+                    "specified threshold (%" PRIu64 ")\n", ts_gaps,
                     rx_hdl_cstr(handles[i]), threshold);
             return (1);
         }
@@ -0,0 +1,311 @@
+/**
+ * @file   rx_consumer.h
+ *
+ * @brief  Zero-copy block consumer layered on top of skiq_receive().
+ *
+ * The consumer receives a block from libsidekiq and hands a read-only view of the DMA buffer to
+ * each registered processing stage in turn, without copying the samples.  The view is only valid
+ * for the duration of the stage callback since libsidekiq reclaims the buffer on the next call to
+ * skiq_receive().  A stage that needs the data after returning must take an explicit copy with
+ * rx_view_retain(), which returns a reference counted block that may be shared with other threads
+ * and is freed when the last reference is dropped.
+ */
+
+#ifndef __RX_CONSUMER_H__
+#define __RX_CONSUMER_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sidekiq_api.h>
+
+#include "trace.h"
+
+/***** DEFINES *****/
+
+/* maximum number of stages that may be registered with a single consumer */
+#define RX_CONSUMER_MAX_NR_STAGES       (8)
+
+/* a stage may return this to skip the remaining stages for the current block */
+#define RX_STAGE_DONE                   (1)
+
+/***** TYPEDEFS *****/
+
+/* read-only view of a received block, valid only until the stage callback returns */
+struct rx_block_view
+{
+    uint8_t card;
+    skiq_rx_hdl_t hdl;
+    const skiq_rx_block_t *p_block;     /* DMA buffer, including the metadata header */
+    uint32_t nr_bytes;                  /* length of the block including the header */
+    const uint32_t *p_payload;          /* first payload word */
+    uint32_t nr_payload_words;
+};
+
+/* explicit, reference counted copy of a received block */
+struct rx_block_ref
+{
+    uint32_t refcount;
+    struct rx_block_view view;          /* view into the copied block */
+};
+
+/* return 0 to continue, RX_STAGE_DONE to skip the remaining stages, or a negative errno */
+typedef int32_t (*rx_stage_fn)( const struct rx_block_view *p_view, void *p_arg );
+
+struct rx_stage
+{
+    const char *p_name;
+    rx_stage_fn fn;
+    void *p_arg;
+    skiq_rx_hdl_t hdl;                  /* skiq_rx_hdl_end to receive blocks from all handles */
+};
+
+struct rx_consumer
+{
+    struct rx_stage stages[RX_CONSUMER_MAX_NR_STAGES];
+    uint8_t nr_stages;
+
+    /* trace buffer of the receiving thread, NULL when not traced */
+    struct trace_buffer *p_trace;
+
+    /* statistics */
+    uint64_t nr_blocks;
+    uint64_t nr_retained;               /* number of blocks explicitly copied by a stage */
+    uint64_t nr_retained_bytes;
+};
+
+#define RX_CONSUMER_INITIALIZER                         \
+    (struct rx_consumer){                               \
+        .nr_stages = 0,                                 \
+        .p_trace = NULL,                                \
+        .nr_blocks = 0,                                 \
+        .nr_retained = 0,                               \
+        .nr_retained_bytes = 0,                         \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+/*****************************************************************************/
+/** Register a processing stage.  Stages are called in the order they were registered.
+
+    @param[in] c            consumer
+    @param[in] p_name       name of the stage, used in error messages and trace spans
+    @param[in] hdl          handle the stage is interested in, or skiq_rx_hdl_end for all
+    @param[in] fn           stage callback
+    @param[in] p_arg        opaque argument passed to the callback
+
+    @return 0 on success, -ENOSPC if the stage table is full
+*/
+static inline int32_t rx_consumer_register( struct rx_consumer *c,
+                                            const char *p_name,
+                                            skiq_rx_hdl_t hdl,
+                                            rx_stage_fn fn,
+                                            void *p_arg )
+{
+    struct rx_stage *p_stage;
+
+    if ( c->nr_stages >= RX_CONSUMER_MAX_NR_STAGES )
+    {
+        return -ENOSPC;
+    }
+
+    p_stage = &(c->stages[c->nr_stages++]);
+    p_stage->p_name = p_name;
+    p_stage->hdl = hdl;
+    p_stage->fn = fn;
+    p_stage->p_arg = p_arg;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Pass a view to every registered stage interested in its handle.
+
+    @param[in] c            consumer
+    @param[in] p_view       view of the received block
+    @param[out] pp_failed   name of the stage that failed (may be NULL)
+
+    @return 0 on success, else the negative status returned by the first failing stage
+*/
+static inline int32_t rx_consumer_dispatch( struct rx_consumer *c,
+                                            const struct rx_block_view *p_view,
+                                            const char **pp_failed )
+{
+    uint8_t i;
+
+    c->nr_blocks++;
+    for ( i = 0; i < c->nr_stages; i++ )
+    {
+        const struct rx_stage *p_stage = &(c->stages[i]);
+        struct trace_span span;
+        int32_t status;
+
+        if ( ( p_stage->hdl != skiq_rx_hdl_end ) && ( p_stage->hdl != p_view->hdl ) )
+        {
+            continue;
+        }
+
+        trace_begin( c->p_trace, &span );
+        status = p_stage->fn( p_view, p_stage->p_arg );
+        trace_end( c->p_trace, &span, p_stage->p_name, p_view->hdl );
+        if ( status == RX_STAGE_DONE )
+        {
+            break;
+        }
+        else if ( status != 0 )
+        {
+            if ( pp_failed != NULL )
+            {
+                *pp_failed = p_stage->p_name;
+            }
+            return status;
+        }
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Fill in a view of a block returned by skiq_receive(), for callers that need to look at the
+    block before dispatching it.
+
+    @param[out] p_view      view
+    @param[in] card         card the block was received from
+    @param[in] hdl          handle of the block
+    @param[in] p_block      block, may be NULL
+    @param[in] len          length of the block including the header
+
+    @return void
+*/
+static inline void rx_consumer_view( struct rx_block_view *p_view,
+                                     uint8_t card,
+                                     skiq_rx_hdl_t hdl,
+                                     const skiq_rx_block_t *p_block,
+                                     uint32_t len )
+{
+    p_view->card = card;
+    p_view->hdl = hdl;
+    p_view->p_block = p_block;
+    p_view->nr_bytes = len;
+    p_view->p_payload = ( p_block != NULL ) ? (const uint32_t *)p_block->data : NULL;
+    p_view->nr_payload_words = ( len > SKIQ_RX_HEADER_SIZE_IN_BYTES ) ?
+        ( ( len - SKIQ_RX_HEADER_SIZE_IN_BYTES ) / 4 ) : 0;
+}
+
+/*****************************************************************************/
+/** Receive a block and dispatch it to the registered stages.  The view is filled in on success
+    so the caller may also inspect the block after the stages have run; it remains valid until the
+    next call to skiq_receive() for the card.  p_view->p_block is NULL if libsidekiq reported
+    success without a block.
+
+    @param[in] c            consumer
+    @param[in] card         card to receive from
+    @param[out] p_view      view of the received block
+    @param[out] p_stage_status  status of the stages (0 unless a stage failed)
+    @param[out] pp_failed   name of the stage that failed (may be NULL)
+
+    @return the status of skiq_receive()
+*/
+static inline skiq_rx_status_t rx_consumer_receive( struct rx_consumer *c,
+                                                    uint8_t card,
+                                                    struct rx_block_view *p_view,
+                                                    int32_t *p_stage_status,
+                                                    const char **pp_failed )
+{
+    skiq_rx_block_t *p_block = NULL;
+    skiq_rx_hdl_t hdl = skiq_rx_hdl_end;
+    uint32_t len = 0;
+    skiq_rx_status_t rx_status;
+    struct trace_span span;
+
+    *p_stage_status = 0;
+    trace_begin( c->p_trace, &span );
+    rx_status = skiq_receive( card, &hdl, &p_block, &len );
+    trace_end( c->p_trace, &span, "receive", len );
+    if ( rx_status != skiq_rx_status_success )
+    {
+        return rx_status;
+    }
+
+    rx_consumer_view( p_view, card, hdl, p_block, len );
+
+    /* a missing block or a handle outside of the valid range is left to the caller to report */
+    if ( ( p_block != NULL ) && ( hdl < skiq_rx_hdl_end ) )
+    {
+        *p_stage_status = rx_consumer_dispatch( c, p_view, pp_failed );
+    }
+
+    return rx_status;
+}
+
+/*****************************************************************************/
+/** Copy a block so it can be kept after the stage returns.  The copy starts with a reference
+    count of one.
+
+    @param[in] c            consumer (for statistics, may be NULL)
+    @param[in] p_view       view to copy
+
+    @return the copy, or NULL if memory could not be allocated
+*/
+static inline struct rx_block_ref *rx_view_retain( struct rx_consumer *c,
+                                                   const struct rx_block_view *p_view )
+{
+    struct rx_block_ref *p_ref;
+    skiq_rx_block_t *p_block;
+    size_t hdr_size = ( sizeof(struct rx_block_ref) + 15 ) & ~(size_t)15;
+
+    p_ref = malloc( hdr_size + p_view->nr_bytes );
+    if ( p_ref == NULL )
+    {
+        return NULL;
+    }
+    p_block = (skiq_rx_block_t *)((uint8_t *)p_ref + hdr_size);
+    memcpy( p_block, (const void *)p_view->p_block, p_view->nr_bytes );
+
+    p_ref->refcount = 1;
+    p_ref->view = *p_view;
+    p_ref->view.p_block = p_block;
+    p_ref->view.p_payload = (const uint32_t *)p_block->data;
+
+    if ( c != NULL )
+    {
+        c->nr_retained++;
+        c->nr_retained_bytes += p_view->nr_bytes;
+    }
+
+    return p_ref;
+}
+
+/*****************************************************************************/
+/** Take an additional reference to a retained block.
+
+    @param[in] p_ref        retained block
+
+    @return p_ref
+*/
+static inline struct rx_block_ref *rx_block_ref_get( struct rx_block_ref *p_ref )
+{
+    __atomic_add_fetch( &(p_ref->refcount), 1, __ATOMIC_RELAXED );
+    return p_ref;
+}
+
+/*****************************************************************************/
+/** Drop a reference to a retained block, freeing it when the last reference is dropped.
+
+    @param[in] p_ref        retained block (may be NULL)
+*/
+static inline void rx_block_ref_put( struct rx_block_ref *p_ref )
+{
+    if ( ( p_ref != NULL ) &&
+         ( __atomic_sub_fetch( &(p_ref->refcount), 1, __ATOMIC_ACQ_REL ) == 0 ) )
+    {
+        free( p_ref );
+    }
+}
+
+#endif  /* __RX_CONSUMER_H__ */
@@ -0,0 +1,444 @@
+/**
+ * @file   rx_continuity.h
+ *
+ * @brief  Per-handle tracker of the RF timestamp continuity of a receive stream, with optional
+ *         placeholder blocks that fill the gaps so that downstream processing stays sample
+ *         accurate.
+ *
+ * Each block of a handle must start at the RF timestamp of the previous block plus the number of
+ * samples it carried.  rx_continuity_check() compares the two and, in the common case, returns
+ * rx_cont_ok after a single comparison.  Anything else is classified:
+ *
+ * - rx_cont_first     the first block after rx_continuity_init() or rx_continuity_reset();
+ * - rx_cont_gap       samples are missing before the block;
+ * - rx_cont_overrun   samples are missing and skiq_receive() reported an overrun since the
+ *                     previous block (rx_continuity_overrun());
+ * - rx_cont_backward  the timestamp went back, e.g. it was reset on a 1PPS edge or samples were
+ *                     repeated.
+ *
+ * The tracker always follows the stream, the next block is expected after the one just checked
+ * whatever its classification.
+ *
+ * With a fill mode other than rx_cont_fill_none, a gap (or overrun) of at most max_fill_samples
+ * is followed by placeholder blocks that cover the missing samples, produced one at a time by
+ * rx_continuity_next_fill() before the block that revealed the gap is processed.  Their samples
+ * are zero, their RF timestamps continue the stream and their system timestamps are interpolated
+ * between the blocks on either side of the gap.  With rx_cont_fill_flag their header is also
+ * marked (see rx_continuity_is_placeholder()) so that a consumer can tell them from received
+ * blocks.  Larger gaps are only counted, filling them would stall the stream.
+ *
+ * A tracker belongs to the thread receiving its handle and takes no lock.
+ */
+
+#ifndef __RX_CONTINUITY_H__
+#define __RX_CONTINUITY_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sidekiq_api.h>
+
+#include "rx_consumer.h"
+
+/***** DEFINES *****/
+
+/* user_meta of a placeholder block with rx_cont_fill_flag, "FILL" */
+#define RX_CONT_FILL_MAGIC              (0x46494c4c)
+
+/* system_meta of a placeholder block with rx_cont_fill_flag (the field is otherwise unused) */
+#define RX_CONT_FILL_SYSTEM_META        (0x3f)
+
+/* by default gaps up to one second at 61.44 Msps are filled */
+#define RX_CONT_DEFAULT_MAX_FILL        (61440000ULL)
+
+/***** TYPEDEFS *****/
+
+/* every event after rx_cont_first is a discontinuity */
+enum rx_cont_event
+{
+    rx_cont_ok = 0,
+    rx_cont_first,
+    rx_cont_gap,
+    rx_cont_overrun,
+    rx_cont_backward,
+};
+
+enum rx_cont_fill
+{
+    rx_cont_fill_none = 0,              /* classify only */
+    rx_cont_fill_zero,                  /* zero samples, ordinary header */
+    rx_cont_fill_flag,                  /* zero samples, header marked as a placeholder */
+};
+
+struct rx_continuity
+{
+    /* hot path */
+    uint64_t next_ts;                   /* expected RF timestamp of the next block */
+    bool started;
+    bool overrun;                       /* an overrun was reported since the last block */
+    bool packed;
+
+    /* configuration */
+    skiq_rx_hdl_t hdl;
+    enum rx_cont_fill fill;
+    uint32_t block_samples;             /* samples per placeholder block */
+    uint64_t max_fill_samples;
+
+    /* gap being filled */
+    uint64_t fill_ts;                   /* RF timestamp of the next placeholder */
+    uint64_t fill_end_ts;               /* RF timestamp of the block after the gap */
+    uint64_t prev_rf_ts, prev_sys_ts;   /* last block checked */
+    uint64_t gap_rf_ts, gap_sys_ts;     /* last block before the gap */
+    uint64_t end_sys_ts;                /* system timestamp of the block after the gap */
+    skiq_rx_block_t *p_fill;            /* placeholder block, samples always zero */
+
+    /* last classification that wasn't rx_cont_ok */
+    bool gap_filled;                    /* placeholders cover the last gap */
+    int64_t last_delta;                 /* received minus expected RF timestamp */
+    uint64_t last_expected_ts;
+
+    /* statistics */
+    uint64_t nr_blocks;
+    uint64_t nr_gaps;                   /* including the ones after an overrun */
+    uint64_t nr_overruns;               /* gaps after a reported overrun */
+    uint64_t nr_overrun_reports;
+    uint64_t nr_backward;
+    uint64_t nr_missing_samples;
+    uint64_t nr_filled_samples;
+    uint64_t nr_fill_blocks;
+    uint64_t nr_unfilled_gaps;          /* gaps above max_fill_samples */
+};
+
+#define RX_CONTINUITY_INITIALIZER                       \
+    (struct rx_continuity){                             \
+        .next_ts = 0,                                   \
+        .started = false,                               \
+        .overrun = false,                               \
+        .packed = false,                                \
+        .gap_filled = false,                            \
+        .hdl = skiq_rx_hdl_end,                         \
+        .fill = rx_cont_fill_none,                      \
+        .max_fill_samples = RX_CONT_DEFAULT_MAX_FILL,   \
+        .p_fill = NULL,                                 \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+static inline const char *rx_cont_event_cstr( enum rx_cont_event event )
+{
+    switch ( event )
+    {
+        case rx_cont_ok:        return "ok";
+        case rx_cont_first:     return "first";
+        case rx_cont_gap:       return "gap";
+        case rx_cont_overrun:   return "overrun";
+        case rx_cont_backward:  return "backward";
+        default:                return "unknown";
+    }
+}
+
+/*****************************************************************************/
+/** Parse the name of a fill mode: "none", "zero" or "flag".  NULL selects none.
+
+    @param[in] p_str        name
+    @param[out] p_fill      fill mode
+
+    @return 0 on success, -EINVAL for an unknown name
+*/
+static inline int32_t rx_cont_fill_parse( const char *p_str,
+                                          enum rx_cont_fill *p_fill )
+{
+    if ( ( p_str == NULL ) || ( strcmp( p_str, "none" ) == 0 ) )
+    {
+        *p_fill = rx_cont_fill_none;
+    }
+    else if ( strcmp( p_str, "zero" ) == 0 )
+    {
+        *p_fill = rx_cont_fill_zero;
+    }
+    else if ( strcmp( p_str, "flag" ) == 0 )
+    {
+        *p_fill = rx_cont_fill_flag;
+    }
+    else
+    {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Prepare a tracker for one handle.
+
+    @param[out] c               tracker
+    @param[in] hdl              handle of the stream, stored in placeholder blocks
+    @param[in] packed           the samples are packed, 4 samples in 3 words
+    @param[in] fill             fill mode
+    @param[in] block_samples    samples per block, the size of the placeholder blocks
+    @param[in] max_fill_samples longest gap filled, 0 for RX_CONT_DEFAULT_MAX_FILL
+
+    @return 0 on success, -ENOMEM if the placeholder block could not be allocated
+*/
+static inline int32_t rx_continuity_init( struct rx_continuity *c,
+                                          skiq_rx_hdl_t hdl,
+                                          bool packed,
+                                          enum rx_cont_fill fill,
+                                          uint32_t block_samples,
+                                          uint64_t max_fill_samples )
+{
+    *c = RX_CONTINUITY_INITIALIZER;
+    c->hdl = hdl;
+    c->packed = packed;
+    c->fill = fill;
+    c->block_samples = block_samples;
+    if ( max_fill_samples != 0 )
+    {
+        c->max_fill_samples = max_fill_samples;
+    }
+
+    if ( ( fill != rx_cont_fill_none ) && ( block_samples != 0 ) )
+    {
+        c->p_fill = (skiq_rx_block_t *)calloc( 1, SKIQ_RX_HEADER_SIZE_IN_BYTES +
+                                                  ( (size_t)block_samples * sizeof(uint32_t) ) );
+        if ( c->p_fill == NULL )
+        {
+            return -ENOMEM;
+        }
+    }
+    else
+    {
+        c->fill = rx_cont_fill_none;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Forget the stream position, e.g. when streaming restarts; the next block is rx_cont_first.
+    Statistics are kept.
+
+    @param[in] c            tracker
+
+    @return void
+*/
+static inline void rx_continuity_reset( struct rx_continuity *c )
+{
+    c->started = false;
+    c->overrun = false;
+    c->fill_ts = c->fill_end_ts = 0;
+}
+
+/*****************************************************************************/
+/** Record that skiq_receive() reported an overrun, so the next gap of the handle is
+    classified as rx_cont_overrun.
+
+    @param[in] c            tracker
+
+    @return void
+*/
+static inline void rx_continuity_overrun( struct rx_continuity *c )
+{
+    c->overrun = true;
+    c->nr_overrun_reports++;
+}
+
+static inline enum rx_cont_event _rx_continuity_classify( struct rx_continuity *c,
+                                                          uint64_t rf_ts,
+                                                          uint64_t sys_ts,
+                                                          uint32_t nr_samples )
+{
+    enum rx_cont_event event;
+
+    c->last_expected_ts = c->next_ts;
+    c->last_delta = (int64_t)( rf_ts - c->next_ts );
+    c->gap_filled = false;
+
+    if ( !c->started )
+    {
+        c->started = true;
+        c->last_delta = 0;
+        event = rx_cont_first;
+    }
+    else if ( c->last_delta < 0 )
+    {
+        c->nr_backward++;
+        event = rx_cont_backward;
+    }
+    else
+    {
+        uint64_t missing = (uint64_t)c->last_delta;
+
+        c->nr_gaps++;
+        c->nr_missing_samples += missing;
+        event = c->overrun ? rx_cont_overrun : rx_cont_gap;
+        if ( c->overrun )
+        {
+            c->nr_overruns++;
+        }
+
+        if ( c->fill != rx_cont_fill_none )
+        {
+            if ( missing <= c->max_fill_samples )
+            {
+                c->fill_ts = c->next_ts;
+                c->fill_end_ts = rf_ts;
+                c->gap_rf_ts = c->prev_rf_ts;
+                c->gap_sys_ts = c->prev_sys_ts;
+                c->end_sys_ts = sys_ts;
+                c->gap_filled = true;
+            }
+            else
+            {
+                c->nr_unfilled_gaps++;
+            }
+        }
+    }
+
+    c->overrun = false;
+    c->next_ts = rf_ts + nr_samples;
+    c->prev_rf_ts = rf_ts;
+    c->prev_sys_ts = sys_ts;
+
+    return event;
+}
+
+/*****************************************************************************/
+/** Check that a block follows the previous one of its handle.
+
+    @param[in] c            tracker of the block's handle
+    @param[in] rf_ts        RF timestamp of the block
+    @param[in] sys_ts       system timestamp of the block
+    @param[in] nr_samples   samples carried by the block
+
+    @return the classification of the block
+*/
+static inline enum rx_cont_event rx_continuity_check( struct rx_continuity *c,
+                                                      uint64_t rf_ts,
+                                                      uint64_t sys_ts,
+                                                      uint32_t nr_samples )
+{
+    c->nr_blocks++;
+    if ( __builtin_expect( ( rf_ts == c->next_ts ) && c->started, 1 ) )
+    {
+        c->next_ts = rf_ts + nr_samples;
+        c->prev_rf_ts = rf_ts;
+        c->prev_sys_ts = sys_ts;
+        c->overrun = false;
+        return rx_cont_ok;
+    }
+
+    return _rx_continuity_classify( c, rf_ts, sys_ts, nr_samples );
+}
+
+/*****************************************************************************/
+/** Check a block as returned by skiq_receive(), with the number of samples derived from its
+    length (header included) and the pack mode of the tracker.
+
+    @param[in] c            tracker of the block's handle
+    @param[in] p_block      block
+    @param[in] nr_bytes     length of the block including the header
+
+    @return the classification of the block
+*/
+static inline enum rx_cont_event rx_continuity_check_block( struct rx_continuity *c,
+                                                            const skiq_rx_block_t *p_block,
+                                                            uint32_t nr_bytes )
+{
+    uint32_t nr_words = ( nr_bytes > SKIQ_RX_HEADER_SIZE_IN_BYTES ) ?
+        ( ( nr_bytes - SKIQ_RX_HEADER_SIZE_IN_BYTES ) / 4 ) : 0;
+
+    return rx_continuity_check( c, p_block->rf_timestamp, p_block->sys_timestamp,
+                                c->packed ? SKIQ_NUM_PACKED_SAMPLES_IN_BLOCK( nr_words ) :
+                                nr_words );
+}
+
+/*****************************************************************************/
+/** Produce the next placeholder block of the gap found by the last check.  Call it until it
+    returns false before handling the block that revealed the gap.  The view is valid until the
+    next call.
+
+    @param[in] c            tracker
+    @param[out] p_view      view of the placeholder (card is left untouched)
+
+    @return true if a placeholder was produced, false once the gap is covered
+*/
+static inline bool rx_continuity_next_fill( struct rx_continuity *c,
+                                            struct rx_block_view *p_view )
+{
+    uint64_t nr_samples;
+    uint32_t nr_words;
+    uint64_t rf_span, sys_span;
+    skiq_rx_block_t *p_block = c->p_fill;
+
+    if ( c->fill_ts >= c->fill_end_ts )
+    {
+        return false;
+    }
+
+    nr_samples = c->fill_end_ts - c->fill_ts;
+    if ( nr_samples > c->block_samples )
+    {
+        nr_samples = c->block_samples;
+    }
+    /* packed samples come in groups of 4 per 3 words, gaps are whole blocks */
+    nr_words = c->packed ? (uint32_t)( ( ( nr_samples + 3 ) / 4 ) * 3 ) : (uint32_t)nr_samples;
+
+    /* the system timestamp is interpolated between the blocks around the gap */
+    rf_span = c->fill_end_ts - c->gap_rf_ts;
+    sys_span = ( c->end_sys_ts > c->gap_sys_ts ) ? ( c->end_sys_ts - c->gap_sys_ts ) : 0;
+    p_block->rf_timestamp = c->fill_ts;
+    p_block->sys_timestamp = c->gap_sys_ts +
+        (uint64_t)( (double)sys_span * (double)( c->fill_ts - c->gap_rf_ts ) / (double)rf_span );
+    p_block->hdl = c->hdl;
+    if ( c->fill == rx_cont_fill_flag )
+    {
+        p_block->system_meta = RX_CONT_FILL_SYSTEM_META;
+        p_block->user_meta = RX_CONT_FILL_MAGIC;
+    }
+
+    p_view->hdl = c->hdl;
+    p_view->p_block = p_block;
+    p_view->nr_bytes = SKIQ_RX_HEADER_SIZE_IN_BYTES + ( nr_words * 4 );
+    p_view->p_payload = (const uint32_t *)p_block->data;
+    p_view->nr_payload_words = nr_words;
+
+    c->fill_ts += nr_samples;
+    c->nr_filled_samples += nr_samples;
+    c->nr_fill_blocks++;
+
+    return true;
+}
+
+/*****************************************************************************/
+/** Tell whether a block is a placeholder produced with rx_cont_fill_flag.
+
+    @param[in] p_block      block
+
+    @return true for a placeholder
+*/
+static inline bool rx_continuity_is_placeholder( const skiq_rx_block_t *p_block )
+{
+    return ( p_block->system_meta == RX_CONT_FILL_SYSTEM_META ) &&
+        ( p_block->user_meta == RX_CONT_FILL_MAGIC );
+}
+
+/*****************************************************************************/
+/** Release the placeholder block of a tracker.
+
+    @param[in] c            tracker
+
+    @return void
+*/
+static inline void rx_continuity_free( struct rx_continuity *c )
+{
+    free( c->p_fill );
+    c->p_fill = NULL;
+}
+
+#endif  /* __RX_CONTINUITY_H__ */
@@ -0,0 +1,601 @@
+/*! \file rx_latency.c
+ * \brief This file contains an application that measures how old received
+ * samples are by the time skiq_receive() hands them to the host, for each
+ * receive stream mode.
+ *
+ * <pre>
+ * Copyright 2014-2021 Epiq Solutions, All Rights Reserved
+ * </pre>
+ */
+
+#if (!defined _GNU_SOURCE)
+#define _GNU_SOURCE         /* for pthread_setaffinity_np, see feature_test_macros(7) */
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <inttypes.h>
+
+#include <sidekiq_api.h>
+#include <arg_parser.h>
+
+#include "elapsed.h"
+#include "rt_thread.h"
+
+/* https://gcc.gnu.org/onlinedocs/gcc-4.8.5/cpp/Stringification.html */
+#define xstr(s)                         str(s)
+#define str(s)                          #s
+
+#ifndef DEFAULT_CARD_NUMBER
+#   define DEFAULT_CARD_NUMBER  0
+#endif
+
+#ifndef DEFAULT_SAMPLE_RATE
+#   define DEFAULT_SAMPLE_RATE  10000000
+#endif
+
+#ifndef DEFAULT_RUN_TIME
+#   define DEFAULT_RUN_TIME     5
+#endif
+
+/* number of bracketed timestamp reads from which the tightest is kept */
+#define NR_ANCHOR_READS         (8)
+
+/* how often the host clock is re-aligned with the RF timestamp */
+#define ANCHOR_PERIOD_NS        (1000000000ULL)
+
+#define NUM_NANOSEC_IN_SEC      (1000000000ULL)
+
+/* timeout of the blocking receive, so that Ctrl-C is noticed */
+#define BLOCKING_TIMEOUT_US     (100000)
+
+#if (defined __x86_64__ || defined __i386__)
+#   define CPU_RELAX()          __asm__ __volatile__( "pause" ::: "memory" )
+#elif (defined __aarch64__) || (defined __arm__)
+#   define CPU_RELAX()          __asm__ __volatile__( "yield" ::: "memory" )
+#else
+#   define CPU_RELAX()          __asm__ __volatile__( "" ::: "memory" )
+#endif
+
+/* these are used to provide help strings for the application when running it
+   with either the "-h" or "--help" flags */
+static const char* p_help_short = "- measure receive latency per stream mode";
+static const char* p_help_long = "\
+Receives on handle A1 for '--time' seconds in each of the '--stream-modes'\n\
+(high_tput, low_latency, balanced) and reports the distribution of the age of\n\
+every block, from the RF timestamp of its last sample to the moment\n\
+skiq_receive() returned it:\n\
+\n\
+  rf       skiq_read_curr_rx_timestamp() read right after the block arrived,\n\
+           minus the timestamp of its last sample, once every '--rf-every'\n\
+           blocks (each read is a register access)\n\
+  host     the host clock when the block arrived, minus the host time of its\n\
+           last sample; the host clock is aligned with the RF timestamp once a\n\
+           second from the tightest of several bracketed timestamp reads\n\
+  receive  the duration of the skiq_receive() calls that returned a block\n\
+\n\
+By default skiq_receive() is busy-polled without waiting, which keeps the\n\
+receive thread on its CPU; pin it with '--cpus' to a core isolated from the\n\
+scheduler (isolcpus=, nohz_full=) and consider '--rt-priority' and '--mlock'.\n\
+'--blocking' waits in skiq_receive() instead, for comparison.\n\
+\n\
+With '--stats', one line per histogram and stream mode is appended to PATH\n\
+as CSV or JSON ('--stats-format').\n\
+\n\
+Defaults:\n\
+  --card=" xstr(DEFAULT_CARD_NUMBER) "\n\
+  --rate=" xstr(DEFAULT_SAMPLE_RATE) "\n\
+  --stream-modes=low_latency,balanced,high_tput\n\
+  --time=" xstr(DEFAULT_RUN_TIME) "\n\
+  --rf-every=1\n\
+  --stats-format=csv\n\
+" RT_THREAD_HELP_DEFAULTS "\
+\n\
+The receive loop is thread 0 for --cpus.";
+
+/* command line argument variables */
+static uint8_t card = UINT8_MAX;
+static char* p_serial = NULL;
+static uint32_t sample_rate = DEFAULT_SAMPLE_RATE;
+static char* p_stream_modes = "low_latency,balanced,high_tput";
+static uint32_t run_time = DEFAULT_RUN_TIME;
+static uint32_t rf_every = 1;
+static bool blocking_rx = false;
+static char* p_stats_path = NULL;
+static char* p_stats_format = NULL;
+static struct rt_thread_config rt_cfg = RT_THREAD_CONFIG_INITIALIZER;
+
+/* the command line arguments available to this application */
+static struct application_argument p_args[] =
+{
+    APP_ARG_OPT("card",
+                'c',
+                "Specify Sidekiq by card index",
+                "ID",
+                &card,
+                UINT8_VAR_TYPE),
+    APP_ARG_OPT("serial",
+                'S',
+                "Specify Sidekiq by serial number",
+                "SERNUM",
+                &p_serial,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("rate",
+                'r',
+                "Sample rate in Hertz",
+                "Hz",
+                &sample_rate,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("stream-modes",
+                0,
+                "Comma delimited list of receive stream modes to measure",
+                "MODE[,MODE]...",
+                &p_stream_modes,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("time",
+                't',
+                "Number of seconds to measure each stream mode",
+                "SECONDS",
+                &run_time,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("rf-every",
+                0,
+                "Read the current RF timestamp once every N blocks",
+                "N",
+                &rf_every,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("blocking",
+                0,
+                "Wait in skiq_receive instead of busy-polling it",
+                NULL,
+                &blocking_rx,
+                BOOL_VAR_TYPE),
+    APP_ARG_OPT("stats",
+                0,
+                "Append the latency percentiles of each stream mode to PATH",
+                "PATH",
+                &p_stats_path,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("stats-format",
+                0,
+                "Format of the --stats lines, csv or json",
+                "FORMAT",
+                &p_stats_format,
+                STRING_VAR_TYPE),
+    RT_THREAD_APP_ARGS(&rt_cfg),
+    APP_ARG_TERMINATOR,
+};
+
+/* maps the RF timestamp of A1 onto the host clock */
+struct clock_anchor
+{
+    uint64_t host_ns;
+    uint64_t rf_ts;
+    uint64_t window_ns;                 /* uncertainty of the pair */
+};
+
+static bool running = true;
+
+static const char *stream_mode_names[] =
+{
+    [skiq_rx_stream_mode_high_tput] = "high_tput",
+    [skiq_rx_stream_mode_low_latency] = "low_latency",
+    [skiq_rx_stream_mode_balanced] = "balanced",
+};
+
+static struct elapsed_hist rf_hist;
+static struct elapsed_hist host_hist;
+static struct elapsed_hist receive_hist;
+
+/*****************************************************************************/
+/** This is the cleanup handler to ensure that the app properly exits and
+    does the needed cleanup if it ends unexpectedly.
+
+    @param signum: the signal number that occurred
+    @return void
+*/
+static void app_cleanup(int signum)
+{
+    printf("Info: received signal %d, cleaning up libsidekiq\n", signum);
+    running = false;
+}
+
+/*****************************************************************************/
+/** This function aligns the host clock with the RF timestamp by bracketing
+    several timestamp reads with the host clock and keeping the tightest.
+
+    @param p_anchor the resulting alignment
+    @return int32_t 0 on success, else the status of skiq_read_curr_rx_timestamp
+*/
+static int32_t read_anchor( struct clock_anchor *p_anchor )
+{
+    uint32_t i;
+
+    p_anchor->window_ns = UINT64_MAX;
+    for ( i = 0; i < NR_ANCHOR_READS; i++ )
+    {
+        uint64_t before, after, ts = 0;
+        int32_t status;
+
+        before = elapsed_now_ns();
+        status = skiq_read_curr_rx_timestamp( card, skiq_rx_hdl_A1, &ts );
+        after = elapsed_now_ns();
+        if ( status != 0 )
+        {
+            return status;
+        }
+        if ( ( after - before ) < p_anchor->window_ns )
+        {
+            p_anchor->window_ns = after - before;
+            p_anchor->host_ns = before + ( ( after - before ) / 2 );
+            p_anchor->rf_ts = ts;
+        }
+    }
+
+    return 0;
+}
+
+/* converts a (signed) number of samples into nanoseconds, clamped at 0 */
+static uint64_t samples_to_ns( int64_t nr_samples, double rate )
+{
+    return ( nr_samples > 0 ) ? (uint64_t)( (double)nr_samples * NUM_NANOSEC_IN_SEC / rate ) : 0;
+}
+
+/*****************************************************************************/
+/** This function computes how long before a host time a sample was taken,
+    from the host time that the anchor predicts for the sample.
+
+    @param p_anchor alignment of the host clock with the RF timestamp
+    @param ts RF timestamp of the sample
+    @param host_ns host time
+    @param rate the actual sample rate
+    @return uint64_t the age in nanoseconds, clamped at 0
+*/
+static uint64_t host_age_ns( const struct clock_anchor *p_anchor,
+                             uint64_t ts,
+                             uint64_t host_ns,
+                             double rate )
+{
+    double sample_ns = (double)p_anchor->host_ns +
+        ( (double)(int64_t)( ts - p_anchor->rf_ts ) * NUM_NANOSEC_IN_SEC / rate );
+    double age_ns = (double)host_ns - sample_ns;
+
+    return ( age_ns > 0.0 ) ? (uint64_t)age_ns : 0;
+}
+
+/*****************************************************************************/
+/** This function receives in one stream mode for the run time and records
+    the latency of every block.
+
+    @param mode the stream mode
+    @param rate the actual sample rate
+    @param p_nr_blocks number of blocks received
+    @param p_nr_gaps number of timestamp gaps
+    @return int32_t 0 on success, else the status of the failing libsidekiq call
+*/
+static int32_t measure( skiq_rx_stream_mode_t mode,
+                        double rate,
+                        uint64_t *p_nr_blocks,
+                        uint64_t *p_nr_gaps )
+{
+    struct clock_anchor anchor;
+    skiq_rx_block_t *p_rx_block = NULL;
+    skiq_rx_hdl_t hdl = skiq_rx_hdl_A1;
+    uint32_t data_len = 0;
+    uint64_t next_ts = 0, stop_ns, anchor_due_ns;
+    bool first_block = true;
+    int32_t status;
+
+    *p_nr_blocks = 0;
+    *p_nr_gaps = 0;
+    elapsed_hist_init( &rf_hist );
+    elapsed_hist_init( &host_hist );
+    elapsed_hist_init( &receive_hist );
+
+    status = skiq_write_rx_stream_mode( card, mode );
+    if ( status == 0 )
+    {
+        status = skiq_start_rx_streaming( card, skiq_rx_hdl_A1 );
+    }
+    if ( status == 0 )
+    {
+        status = read_anchor( &anchor );
+    }
+    if ( status != 0 )
+    {
+        return status;
+    }
+    anchor_due_ns = anchor.host_ns + ANCHOR_PERIOD_NS;
+    stop_ns = elapsed_now_ns() + ( (uint64_t)run_time * NUM_NANOSEC_IN_SEC );
+
+    while ( running )
+    {
+        uint64_t call_ns = elapsed_now_ns(), arrival_ns;
+        uint64_t last_ts;
+        uint32_t nr_samples;
+        skiq_rx_status_t rx_status;
+
+        if ( call_ns >= stop_ns )
+        {
+            break;
+        }
+
+        rx_status = skiq_receive( card, &hdl, &p_rx_block, &data_len );
+        if ( rx_status != skiq_rx_status_success )
+        {
+            if ( !blocking_rx )
+            {
+                CPU_RELAX();
+            }
+            continue;
+        }
+        arrival_ns = elapsed_now_ns();
+        if ( hdl != skiq_rx_hdl_A1 )
+        {
+            continue;
+        }
+        elapsed_hist_record( &receive_hist, arrival_ns - call_ns );
+
+        nr_samples = ( data_len / 4 ) - SKIQ_RX_HEADER_SIZE_IN_WORDS;
+        if ( !first_block && ( p_rx_block->rf_timestamp != next_ts ) )
+        {
+            (*p_nr_gaps)++;
+        }
+        first_block = false;
+        next_ts = p_rx_block->rf_timestamp + nr_samples;
+        last_ts = next_ts - 1;
+
+        elapsed_hist_record( &host_hist, host_age_ns( &anchor, last_ts, arrival_ns, rate ) );
+
+        if ( ( *p_nr_blocks % rf_every ) == 0 )
+        {
+            uint64_t curr_ts = 0;
+
+            if ( skiq_read_curr_rx_timestamp( card, skiq_rx_hdl_A1, &curr_ts ) == 0 )
+            {
+                elapsed_hist_record( &rf_hist, samples_to_ns( (int64_t)( curr_ts - last_ts ),
+                                                              rate ) );
+            }
+        }
+        (*p_nr_blocks)++;
+
+        /* re-align periodically so that the two clocks don't drift apart */
+        if ( arrival_ns >= anchor_due_ns )
+        {
+            struct clock_anchor fresh;
+
+            if ( read_anchor( &fresh ) == 0 )
+            {
+                anchor = fresh;
+            }
+            anchor_due_ns = anchor.host_ns + ANCHOR_PERIOD_NS;
+        }
+    }
+
+    return skiq_stop_rx_streaming( card, skiq_rx_hdl_A1 );
+}
+
+/*****************************************************************************/
+/** This is the main function for executing the rx_latency app.
+
+    @param argc-the # of arguments from the cmd line
+    @param argv-a vector of ascii string aruments from the cmd line
+    @return int-indicating status
+*/
+int main( int argc, char *argv[] )
+{
+    skiq_rx_stream_mode_t modes[8];
+    uint32_t nr_modes = 0, i;
+    enum elapsed_export_format stats_format = elapsed_export_csv;
+    FILE *p_stats_fp = NULL;
+    const char *p = NULL;
+    uint32_t actual_rate = 0;
+    double rate = 0.0;
+    int32_t status = 0;
+    pid_t owner = 0;
+
+    /* install a signal handler for proper cleanup */
+    signal(SIGINT, app_cleanup);
+
+    if ( 0 != arg_parser(argc, argv, p_help_short, p_help_long, p_args) )
+    {
+        perror("Command Line");
+        arg_parser_print_help(argv[0], p_help_short, p_help_long, p_args);
+        return (-1);
+    }
+
+    if ( rt_thread_config_init( &rt_cfg ) != 0 )
+    {
+        return (-1);
+    }
+
+    /* parse the list of stream modes */
+    for ( p = p_stream_modes; *p != '\0'; )
+    {
+        size_t len = strcspn( p, "," );
+        uint32_t m;
+
+        for ( m = 0; m < sizeof(stream_mode_names) / sizeof(stream_mode_names[0]); m++ )
+        {
+            if ( ( stream_mode_names[m] != NULL ) && ( strlen( stream_mode_names[m] ) == len ) &&
+                 ( strncasecmp( p, stream_mode_names[m], len ) == 0 ) )
+            {
+                break;
+            }
+        }
+        if ( ( m == sizeof(stream_mode_names) / sizeof(stream_mode_names[0]) ) ||
+             ( nr_modes == sizeof(modes) / sizeof(modes[0]) ) )
+        {
+            fprintf(stderr, "Error: invalid list of stream modes '%s'\n", p_stream_modes);
+            return (-1);
+        }
+        modes[nr_modes++] = (skiq_rx_stream_mode_t)m;
+        p += len;
+        p += ( *p == ',' ) ? 1 : 0;
+    }
+    if ( ( nr_modes == 0 ) || ( run_time == 0 ) || ( rf_every == 0 ) )
+    {
+        fprintf(stderr, "Error: need at least one stream mode and a non-zero --time and"
+                " --rf-every\n");
+        return (-1);
+    }
+
+    if ( 0 != elapsed_export_parse_format(p_stats_format, &stats_format) )
+    {
+        fprintf(stderr, "Error: unknown statistics format '%s', expected csv or json\n",
+                p_stats_format);
+        return (-1);
+    }
+
+    if( (UINT8_MAX != card) && (NULL != p_serial) )
+    {
+        fprintf(stderr, "Error: must specify EITHER card ID or serial number, not"
+                " both\n");
+        return (-1);
+    }
+    if (UINT8_MAX == card)
+    {
+        card = DEFAULT_CARD_NUMBER;
+    }
+
+    /* If specified, attempt to find the card with a matching serial number. */
+    if ( NULL != p_serial )
+    {
+        status = skiq_get_card_from_serial_string(p_serial, &card);
+        if ( 0 != status )
+        {
+            fprintf(stderr, "Error: cannot find card with serial number %s (result"
+                    " code %" PRIi32 ")\n", p_serial, status);
+            return (-1);
+        }
+
+        printf("Info: found serial number %s as card ID %" PRIu8 "\n",
+                p_serial, card);
+    }
+
+    if ( (SKIQ_MAX_NUM_CARDS - 1) < card )
+    {
+        fprintf(stderr, "Error: card ID %" PRIu8 " exceeds the maximum card ID"
+                " (%" PRIu8 ")\n", card, (SKIQ_MAX_NUM_CARDS - 1));
+        return (-1);
+    }
+
+    if ( NULL != p_stats_path )
+    {
+        p_stats_fp = fopen(p_stats_path, "a");
+        if ( NULL == p_stats_fp )
+        {
+            fprintf(stderr, "Error: unable to open statistics file %s (errno %d)\n",
+                    p_stats_path, errno);
+            return (-1);
+        }
+        elapsed_hist_export_header(p_stats_fp, stats_format);
+    }
+
+    printf("Info: initializing card %" PRIu8 "...\n", card);
+
+    status = skiq_init(skiq_xport_type_auto, skiq_xport_init_level_full, &card, 1);
+    if ( status != 0 )
+    {
+        if ( ( EBUSY == status ) &&
+             ( 0 != skiq_is_card_avail(card, &owner) ) )
+        {
+            fprintf(stderr, "Error: card %" PRIu8 " is already in use (by process ID"
+                    " %u); cannot initialize card.\n", card,
+                    (unsigned int) owner);
+        }
+        else if ( -EINVAL == status )
+        {
+            fprintf(stderr, "Error: unable to initialize libsidekiq; was a valid card"
+                    " specified? (result code %" PRIi32 ")\n", status);
+        }
+        else
+        {
+            fprintf(stderr, "Error: unable to initialize libsidekiq with status %" PRIi32
+                    "\n", status);
+        }
+        if ( NULL != p_stats_fp )
+        {
+            fclose(p_stats_fp);
+        }
+        return (-1);
+    }
+
+    /* the receive loop runs on the main thread, applied after skiq_init() so that the
+       threads of libsidekiq don't inherit the pinning and compete with the busy poll */
+    (void)rt_thread_apply( &rt_cfg, pthread_self(), 0, true, "Rx" );
+
+    status = skiq_set_rx_transfer_timeout( card, blocking_rx ? BLOCKING_TIMEOUT_US :
+                                           RX_TRANSFER_NO_WAIT );
+    if ( status != 0 )
+    {
+        fprintf(stderr, "Error: unable to set RX transfer timeout with status %" PRIi32 "\n",
+                status);
+        goto finished;
+    }
+
+    status = skiq_write_rx_sample_rate_and_bandwidth( card, skiq_rx_hdl_A1, sample_rate,
+                                                      (uint32_t)(0.8 * sample_rate) );
+    if ( status == 0 )
+    {
+        status = skiq_read_rx_sample_rate( card, skiq_rx_hdl_A1, &actual_rate, &rate );
+    }
+    if ( ( status != 0 ) || ( rate <= 0.0 ) )
+    {
+        fprintf(stderr, "Error: unable to configure a sample rate of %" PRIu32 " Hz (status %"
+                PRIi32 ")\n", sample_rate, status);
+        status = ( status != 0 ) ? status : -ERANGE;
+        goto finished;
+    }
+    printf("Info: actual sample rate is %f Hz, %s receive\n", rate,
+           blocking_rx ? "blocking" : "busy-polling");
+
+    for ( i = 0; ( i < nr_modes ) && running; i++ )
+    {
+        uint64_t nr_blocks = 0, nr_gaps = 0;
+        char name[32];
+
+        status = measure( modes[i], rate, &nr_blocks, &nr_gaps );
+        if ( status != 0 )
+        {
+            fprintf(stderr, "Error: unable to stream in %s mode (status %" PRIi32 ")\n",
+                    stream_mode_names[modes[i]], status);
+            continue;
+        }
+
+        printf("Info: %s stream mode, %" PRIu64 " blocks, %" PRIu64 " timestamp gaps\n",
+               stream_mode_names[modes[i]], nr_blocks, nr_gaps);
+        printf("    rf latency:      ");
+        elapsed_hist_print( &rf_hist );
+        printf("    host latency:    ");
+        elapsed_hist_print( &host_hist );
+        printf("    skiq_receive():  ");
+        elapsed_hist_print( &receive_hist );
+
+        if ( NULL != p_stats_fp )
+        {
+            snprintf(name, sizeof(name), "%s.rf", stream_mode_names[modes[i]]);
+            elapsed_hist_export(p_stats_fp, stats_format, name, i, &rf_hist);
+            snprintf(name, sizeof(name), "%s.host", stream_mode_names[modes[i]]);
+            elapsed_hist_export(p_stats_fp, stats_format, name, i, &host_hist);
+            snprintf(name, sizeof(name), "%s.receive", stream_mode_names[modes[i]]);
+            elapsed_hist_export(p_stats_fp, stats_format, name, i, &receive_hist);
+        }
+    }
+
+finished:
+    skiq_exit();
+    if ( NULL != p_stats_fp )
+    {
+        fclose(p_stats_fp);
+    }
+
+    return ( status == 0 ) ? 0 : -1;
+}
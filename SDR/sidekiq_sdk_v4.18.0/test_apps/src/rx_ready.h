@@ -0,0 +1,412 @@
+/**
+ * @file   rx_ready.h
+ *
+ * @brief  Receive readiness for one or more cards, so that a receive thread sleeps until a card
+ *         has blocks instead of spinning on skiq_receive() returning skiq_rx_status_no_data.
+ *
+ * Without skiq_set_rx_transfer_timeout(), skiq_receive() returns at once when there is no
+ * block, and a receive loop polling it keeps a core busy per card whatever the sample rate.
+ * Here every card gets a file descriptor in one epoll set, and rx_ready_wait() returns the cards
+ * worth calling skiq_receive() on:
+ *
+ * - on the reference custom transport (custom_xport_bare), when the application is linked with
+ *   it, the descriptor comes from my_xport_rx_ready_fd() and is signalled when a block arrives;
+ * - on any other transport libsidekiq has no readiness to offer, so the descriptor is a periodic
+ *   timerfd firing every RX_READY_TIMER_BLOCKS blocks at the card's sample rate (clamped to
+ *   [RX_READY_MIN_PERIOD_NS, RX_READY_MAX_PERIOD_NS]); the DMA buffers the blocks in between.
+ *
+ * Either way the number of wakeups follows the data rate, and a single thread can serve several
+ * cards.  Readiness is per card, skiq_receive() returns the blocks of all handles of a card.
+ *
+ * The caller drains a ready card by calling skiq_receive() until it returns
+ * skiq_rx_status_no_data, which is what re-arms the transport notification.  A caller that stops
+ * earlier, e.g. to take turns between cards, marks the card with rx_ready_more() so that the next
+ * rx_ready_wait() reports it again without sleeping.
+ */
+
+#ifndef __RX_READY_H__
+#define __RX_READY_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#if (!defined __MINGW32__)
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
+#include <sidekiq_api.h>
+
+/***** DEFINES *****/
+
+/* the timer fallback wakes up once per this many blocks */
+#ifndef RX_READY_TIMER_BLOCKS
+#   define RX_READY_TIMER_BLOCKS        (16)
+#endif
+
+#define RX_READY_MIN_PERIOD_NS          (50000)
+#define RX_READY_MAX_PERIOD_NS          (2000000)
+
+/***** TYPEDEFS *****/
+
+enum rx_ready_source
+{
+    rx_ready_source_none = 0,
+    rx_ready_source_event,              /* transport eventfd, read after waking */
+    rx_ready_source_socket,             /* transport socket, never read here */
+    rx_ready_source_timer,              /* periodic timerfd owned by rx_ready */
+};
+
+struct rx_ready_card
+{
+    int fd;
+    enum rx_ready_source source;
+    bool pending;                       /* not drained, report without waiting */
+    uint64_t period_ns;                 /* timer source only */
+    uint64_t nr_wakeups;
+};
+
+struct rx_ready
+{
+    int epoll_fd;
+    uint8_t nr_cards;
+    uint8_t nr_pending;
+    struct rx_ready_card cards[SKIQ_MAX_NUM_CARDS];     /* indexed by card number */
+
+    /* statistics */
+    uint64_t nr_waits;
+    uint64_t nr_timeouts;
+};
+
+#define RX_READY_INITIALIZER                            \
+    (struct rx_ready){                                  \
+        .epoll_fd = -1,                                 \
+        .nr_cards = 0,                                  \
+        .nr_pending = 0,                                \
+        .nr_waits = 0,                                  \
+        .nr_timeouts = 0,                               \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+#if (!defined __MINGW32__)
+/* defined by custom_xport_bare/src/my_custom_xport.c when the application is linked with it */
+extern int my_xport_rx_ready_fd( uint64_t xport_uid,
+                                 bool *p_is_eventfd ) __attribute__((weak));
+#endif
+
+static inline const char *rx_ready_source_cstr( enum rx_ready_source source )
+{
+    switch ( source )
+    {
+        case rx_ready_source_event:     return "transport event";
+        case rx_ready_source_socket:    return "transport socket";
+        case rx_ready_source_timer:     return "timer";
+        default:                        return "none";
+    }
+}
+
+/*****************************************************************************/
+/** Prepare an empty readiness set.
+
+    @param[out] r           readiness set
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t rx_ready_init( struct rx_ready *r )
+{
+    uint8_t i;
+
+    *r = RX_READY_INITIALIZER;
+    for ( i = 0; i < SKIQ_MAX_NUM_CARDS; i++ )
+    {
+        r->cards[i].fd = -1;
+    }
+
+#if (!defined __MINGW32__)
+    r->epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+    if ( r->epoll_fd < 0 )
+    {
+        return -errno;
+    }
+#endif
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Add a card to a readiness set.  The sample rate and block size only matter when the card
+    falls back to the timer.
+
+    @param[in] r            readiness set
+    @param[in] card         card, already initialized
+    @param[in] sample_rate  receive sample rate of the card in Hz, 0 if unknown
+    @param[in] block_words  sample words per block
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t rx_ready_add( struct rx_ready *r,
+                                    uint8_t card,
+                                    uint32_t sample_rate,
+                                    uint32_t block_words )
+{
+    struct rx_ready_card *c;
+    uint64_t period_ns = RX_READY_MAX_PERIOD_NS;
+
+    if ( card >= SKIQ_MAX_NUM_CARDS )
+    {
+        return -EINVAL;
+    }
+    c = &(r->cards[card]);
+    if ( c->source != rx_ready_source_none )
+    {
+        return -EEXIST;
+    }
+
+    if ( sample_rate != 0 )
+    {
+        period_ns = ( (uint64_t)block_words * RX_READY_TIMER_BLOCKS * 1000000000ULL ) /
+            sample_rate;
+        if ( period_ns < RX_READY_MIN_PERIOD_NS )
+        {
+            period_ns = RX_READY_MIN_PERIOD_NS;
+        }
+        else if ( period_ns > RX_READY_MAX_PERIOD_NS )
+        {
+            period_ns = RX_READY_MAX_PERIOD_NS;
+        }
+    }
+    c->period_ns = period_ns;
+
+#if (defined __MINGW32__)
+    c->source = rx_ready_source_timer;
+#else
+    {
+        struct epoll_event ev;
+        skiq_param_t params;
+
+        if ( ( my_xport_rx_ready_fd != NULL ) &&
+             ( skiq_read_parameters( card, &params ) == 0 ) &&
+             ( params.card_param.xport == skiq_xport_type_custom ) )
+        {
+            bool is_eventfd = false;
+
+            /* the reference transport probes its cards with UIDs equal to their index */
+            c->fd = my_xport_rx_ready_fd( card, &is_eventfd );
+            if ( c->fd >= 0 )
+            {
+                c->source = is_eventfd ? rx_ready_source_event : rx_ready_source_socket;
+            }
+        }
+
+        if ( c->source == rx_ready_source_none )
+        {
+            struct itimerspec its;
+
+            c->fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+            if ( c->fd < 0 )
+            {
+                return -errno;
+            }
+            its.it_interval.tv_sec = period_ns / 1000000000ULL;
+            its.it_interval.tv_nsec = period_ns % 1000000000ULL;
+            its.it_value = its.it_interval;
+            if ( timerfd_settime( c->fd, 0, &its, NULL ) != 0 )
+            {
+                int32_t status = -errno;
+
+                close( c->fd );
+                c->fd = -1;
+                return status;
+            }
+            c->source = rx_ready_source_timer;
+        }
+
+        memset( &ev, 0, sizeof(ev) );
+        ev.events = EPOLLIN;
+        ev.data.u32 = card;
+        if ( epoll_ctl( r->epoll_fd, EPOLL_CTL_ADD, c->fd, &ev ) != 0 )
+        {
+            int32_t status = -errno;
+
+            if ( c->source == rx_ready_source_timer )
+            {
+                close( c->fd );
+            }
+            c->fd = -1;
+            c->source = rx_ready_source_none;
+            return status;
+        }
+    }
+#endif
+
+    /* the first wait doesn't sleep, blocks may have arrived before the card was added */
+    c->pending = true;
+    r->nr_pending++;
+    r->nr_cards++;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Report that a card may still have blocks because it wasn't drained down to
+    skiq_rx_status_no_data, so that the next rx_ready_wait() returns it at once.
+
+    @param[in] r            readiness set
+    @param[in] card         card in the set
+
+    @return void
+*/
+static inline void rx_ready_more( struct rx_ready *r,
+                                  uint8_t card )
+{
+    if ( ( card < SKIQ_MAX_NUM_CARDS ) && !r->cards[card].pending &&
+         ( r->cards[card].source != rx_ready_source_none ) )
+    {
+        r->cards[card].pending = true;
+        r->nr_pending++;
+    }
+}
+
+/*****************************************************************************/
+/** Wait until cards of the set are ready to be received from.  Cards marked with
+    rx_ready_more() are returned without sleeping.
+
+    @param[in] r            readiness set
+    @param[in] timeout_ms   longest wait in milliseconds, -1 to wait forever
+    @param[out] p_cards     ready cards, room for SKIQ_MAX_NUM_CARDS entries
+
+    @return the number of ready cards, 0 on a timeout or a signal, else a negative errno
+*/
+static inline int32_t rx_ready_wait( struct rx_ready *r,
+                                     int timeout_ms,
+                                     uint8_t *p_cards )
+{
+    int32_t nr_ready = 0;
+    uint8_t i;
+
+    r->nr_waits++;
+
+#if (defined __MINGW32__)
+    if ( r->nr_pending == 0 )
+    {
+        uint64_t period_ns = RX_READY_MAX_PERIOD_NS;
+        struct timespec nap;
+
+        for ( i = 0; i < SKIQ_MAX_NUM_CARDS; i++ )
+        {
+            if ( ( r->cards[i].source != rx_ready_source_none ) &&
+                 ( r->cards[i].period_ns < period_ns ) )
+            {
+                period_ns = r->cards[i].period_ns;
+            }
+        }
+        if ( ( timeout_ms >= 0 ) && ( ( (uint64_t)timeout_ms * 1000000ULL ) < period_ns ) )
+        {
+            period_ns = (uint64_t)timeout_ms * 1000000ULL;
+        }
+        nap.tv_sec = period_ns / 1000000000ULL;
+        nap.tv_nsec = period_ns % 1000000000ULL;
+        nanosleep( &nap, NULL );
+    }
+    for ( i = 0; i < SKIQ_MAX_NUM_CARDS; i++ )
+    {
+        if ( r->cards[i].source != rx_ready_source_none )
+        {
+            r->cards[i].nr_wakeups += r->cards[i].pending ? 0 : 1;
+            r->cards[i].pending = false;
+            p_cards[nr_ready++] = i;
+        }
+    }
+    r->nr_pending = 0;
+#else
+    {
+        struct epoll_event events[SKIQ_MAX_NUM_CARDS];
+        int nr_events;
+        int e;
+
+        nr_events = epoll_wait( r->epoll_fd, events, SKIQ_MAX_NUM_CARDS,
+                                ( r->nr_pending > 0 ) ? 0 : timeout_ms );
+        if ( nr_events < 0 )
+        {
+            return ( errno == EINTR ) ? 0 : -errno;
+        }
+
+        /* pending cards first, then the ones woken up that aren't pending */
+        for ( i = 0; ( r->nr_pending > 0 ) && ( i < SKIQ_MAX_NUM_CARDS ); i++ )
+        {
+            if ( r->cards[i].pending )
+            {
+                p_cards[nr_ready++] = i;
+            }
+        }
+        for ( e = 0; e < nr_events; e++ )
+        {
+            uint8_t card = (uint8_t)events[e].data.u32;
+            struct rx_ready_card *c = &(r->cards[card]);
+
+            if ( c->source != rx_ready_source_socket )
+            {
+                uint64_t count;
+
+                /* clear the eventfd or the timer expirations before draining the card */
+                (void)( read( c->fd, &count, sizeof(count) ) == sizeof(count) );
+            }
+            c->nr_wakeups++;
+            if ( !c->pending )
+            {
+                p_cards[nr_ready++] = card;
+            }
+        }
+        for ( i = 0; ( r->nr_pending > 0 ) && ( i < SKIQ_MAX_NUM_CARDS ); i++ )
+        {
+            r->cards[i].pending = false;
+        }
+        r->nr_pending = 0;
+    }
+#endif
+
+    if ( nr_ready == 0 )
+    {
+        r->nr_timeouts++;
+    }
+
+    return nr_ready;
+}
+
+/*****************************************************************************/
+/** Release a readiness set.  Descriptors of the transport stay open, they belong to it.
+
+    @param[in] r            readiness set
+
+    @return void
+*/
+static inline void rx_ready_close( struct rx_ready *r )
+{
+    uint8_t i;
+
+    for ( i = 0; i < SKIQ_MAX_NUM_CARDS; i++ )
+    {
+        if ( ( r->cards[i].source == rx_ready_source_timer ) && ( r->cards[i].fd >= 0 ) )
+        {
+            close( r->cards[i].fd );
+        }
+        r->cards[i].fd = -1;
+        r->cards[i].source = rx_ready_source_none;
+    }
+    if ( r->epoll_fd >= 0 )
+    {
+        close( r->epoll_fd );
+    }
+    r->epoll_fd = -1;
+    r->nr_cards = 0;
+    r->nr_pending = 0;
+}
+
+#endif  /* __RX_READY_H__ */
@@ -8,6 +8,10 @@
  * </pre>
  */
 
+#if (!defined _GNU_SOURCE)
+#define _GNU_SOURCE         /* for O_DIRECT, see feature_test_macros(7) */
+#endif
+
 #include <ctype.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -29,13 +33,26 @@
 
 #include "sidekiq_api.h"
 #include "arg_parser.h"
+#include "rx_writer.h"
+#include "iq_unpack.h"
+#include "rx_consumer.h"
+#include "rx_verify.h"
+#include "psd.h"
+#include "capture_index.h"
+#include "burst_detect.h"
+#include "ddc.h"
+#include "iq_convert.h"
+#include "iq_net.h"
+#include "rx_continuity.h"
+#include "telemetry.h"
+#include "trace.h"
 
 /* a simple pair of MACROs to round up integer division */
 #define _ROUND_UP(_numerator, _denominator)    (_numerator + (_denominator - 1)) / _denominator
 #define ROUND_UP(_numerator, _denominator)     (_ROUND_UP((_numerator),(_denominator)))
 
-/* MACRO used to swap elements, used depending on the IQ order mode before verify_data() */
-#define SWAP(a, b) do { typeof(a) t; t = a; a = b; b = t; } while(0)
+/* number of chunks per worker thread that a capture is split into for verification */
+#define VERIFY_CHUNKS_PER_WORKER        (4)
 
 /* https://gcc.gnu.org/onlinedocs/gcc-4.8.5/cpp/Stringification.html */
 #define xstr(s)                         str(s)
@@ -94,11 +111,105 @@ from 12 to 16-bits (when appropriate for the product).\n\
 \n\
 NOTE: --packed and --low-latency modes conflict with one another\n\
 \n\
+With --stream, received blocks are written to the output file(s) while the\n\
+capture is in progress through a bounded ring of --stream-chunks 4 MiB\n\
+buffers per handle, instead of being held in RAM until the capture has\n\
+completed.  In this mode --words=0 captures until interrupted (Ctrl-C), so\n\
+the capture length is limited only by disk space.  --direct-io additionally\n\
+bypasses the page cache (O_DIRECT) when the file system supports it.\n\
+\n\
+With --psd=N, an N point Welch power spectrum (Hann window, 50% overlap) is\n\
+also computed from each block as it is received.  Every --psd-average\n\
+segments, a frame of N float32 bins in dBFS (DC centred) is written to an\n\
+additional <file>.psd output per handle, each frame preceded by a header\n\
+holding the RF timestamp, frequency, sample rate and number of segments.\n\
+\n\
+With --index, every output file also gets a <file>.idx block index mapping\n\
+the RF and system timestamp of each received block to its offset in the\n\
+file, and a <file>.sigmf-meta SigMF description of the capture listing\n\
+timestamp gaps and RF overload.  See capture_index.h for the formats.\n\
+Packed captures (--packed) are written as received, 12-bit samples packed\n\
+4 to 3 words, so the capture rate is bound by the packed data rate; with\n\
+--index, capture_extract unpacks any part of them later.\n\
+\n\
+With --burst-threshold=dBFS, an energy detector averages the power of every\n\
+received block over 2048 samples and only the blocks from the start of a\n\
+burst (average at or above the threshold) to its end (average below the\n\
+threshold minus --burst-hysteresis), plus --burst-hangover blocks, are\n\
+kept; --words then counts kept samples.  Bursts start and end on block\n\
+boundaries, the block in which a burst begins is the first one kept, and\n\
+with --index every dropped stretch is recorded as a timestamp gap.  Use\n\
+rx_samples_on_trigger --pretrigger to keep samples from before a burst.\n\
+\n\
+With --ddc=HZ[,HZ...], up to " xstr(DDC_MAX_CHANNELS) " narrowband channels centred HZ away from\n\
+the LO are mixed down, low-pass filtered to --ddc-bandwidth and decimated\n\
+by --ddc-decimation as the blocks are received.  Each channel is written\n\
+to <file>.ddc<N> as complex float32 pairs, I first, at --rate divided by\n\
+--ddc-decimation.  The default bandwidth is 80% of the channel rate.  With\n\
+--ddc-only (requires --stream) the wideband samples are not written, so the\n\
+disk only sees the channel rate.  See ddc.h for the filter and timing.\n\
+\n\
+With --convert=cf32 (or bf16), every block is also written to <file>.cf32\n\
+(or <file>.bf16) as complex float32 (or bfloat16) pairs, I first, scaled by\n\
+the receive calibration offset of the block's gain index so that the power\n\
+of a sample reads dBm.  The offsets of all gain indexes are read once\n\
+before streaming starts; without calibration data the samples are\n\
+fractions of full scale.\n\
+\n\
+With --net=HOST:PORT, every block is also sent over UDP to HOST, which may\n\
+be a multicast group, cut into datagrams that fit --net-mtu.  Each datagram\n\
+carries the RF timestamp of its first sample.  --net-format=vita49 sends\n\
+VITA-49 IF data packets (stream id = handle, fractional timestamp = sample\n\
+count) with big-endian samples, I first; --net-format=raw sends the samples\n\
+as received behind a small header (see iq_net.h), packed or not.  Datagrams\n\
+are sent in batches with sendmmsg(); --net-gso lets the kernel or the NIC\n\
+do the segmentation when it is supported.  iq_net_receive captures the\n\
+stream on the other end.\n\
+\n\
+With --stream, a timestamp gap normally ends the capture.  --fill-gaps=zero\n\
+instead covers each gap of up to one second (at 61.44 Msps) with blocks of\n\
+zero samples whose timestamps continue the stream, so the output file, the\n\
+index and every --psd, --ddc, --convert or --net output stay sample\n\
+accurate; --fill-gaps=flag also marks the header of each placeholder block\n\
+(see rx_continuity.h), which --include-meta keeps in the file.  Backward\n\
+timestamps and longer gaps still end the capture.\n\
+\n\
+With --index, --telemetry=LIST also samples the sensors of the card from a\n\
+background thread every TEMP,ACCEL,GPSDO,PPS milliseconds (temperature,\n\
+accelerometer, GPSDO lock and frequency accuracy, last 1PPS timestamps; 0\n\
+or an empty entry leaves a sensor out) and writes each new reading to a\n\
+<file>.telem sidecar, tagging the first block indexed after it.  The\n\
+receive loop only compares a sequence number per block.\n\
+\n\
+With --trace=PATH, the receive loop records a span for every skiq_receive()\n\
+call, stage (verify, psd, ddc, ...), unpack and write, and an instant event\n\
+for every timestamp gap, into a ring of the last --trace-events events.\n\
+They are written to PATH in the Chrome trace format when the capture ends\n\
+(open it in chrome://tracing or ui.perfetto.dev) to see which stage was\n\
+running when a gap appeared.  --trace-counters adds the cycles,\n\
+instructions and cache misses of each span and --trace-marker also writes\n\
+the events to the ftrace trace_marker file as they happen (see trace.h).\n\
+\n\
+With --stream, --compress cuts each output file into chunks of 4 MiB and\n\
+compresses them losslessly (delta and bit-packing per I and Q lane, see\n\
+iq_compress.h) on a pool of --compress-threads threads shared by all of the\n\
+handles, so spare cores make up for a slow disk.  Chunks that don't shrink\n\
+are stored as is.  The files are only readable through capture_reader.h,\n\
+e.g. with capture_extract; --index offsets still count uncompressed bytes.\n\
+\n\
 Defaults:\n\
   --card=" xstr(DEFAULT_CARD_NUMBER) "\n\
   --frequency=850000000\n\
   --handle=A1\n\
   --rate=1000000\n\
+  --psd-average=" xstr(PSD_DEFAULT_NR_AVERAGE) "\n\
+  --burst-hysteresis=" xstr(BURST_DETECT_DEFAULT_HYSTERESIS) "\n\
+  --burst-hangover=1\n\
+  --ddc-decimation=" xstr(DDC_DEFAULT_DECIMATION) "\n\
+  --net-format=vita49\n\
+  --net-mtu=" xstr(IQ_NET_DEFAULT_MTU) "\n\
+  --stream-chunks=" xstr(RX_WRITER_DEFAULT_NR_CHUNKS) "\n\
+" TRACE_HELP_DEFAULTS "\
   --words=100000\
 ";
 
@@ -140,6 +251,40 @@ static char *p_cal_type= "all";
 static bool cal_mode_is_set = false;
 static bool rfic_pin_enable = false;
 static uint32_t retries_on_ts_err = 0;
+static bool stream_to_disk = false;
+static bool direct_io = false;
+static uint32_t stream_chunks = RX_WRITER_DEFAULT_NR_CHUNKS;
+static bool compress = false;
+static uint32_t compress_threads = 0;
+static struct work_pool compress_pool;
+static uint8_t rx_resolution = 0;
+static uint32_t psd_nr_bins = 0;
+static uint32_t psd_nr_average = PSD_DEFAULT_NR_AVERAGE;
+static bool index_capture = false;
+static double burst_threshold = 0.0;
+static bool burst_threshold_present = false;
+static double burst_hysteresis = BURST_DETECT_DEFAULT_HYSTERESIS;
+static uint32_t burst_hangover = 1;
+static char *p_ddc_offsets = NULL;
+static uint32_t ddc_decimation = DDC_DEFAULT_DECIMATION;
+static double ddc_bandwidth = 0.0;
+static bool ddc_only = false;
+static double ddc_offsets[DDC_MAX_CHANNELS];
+static uint32_t ddc_nr_channels = 0;
+static char *p_convert = NULL;
+static char *p_net_dest = NULL;
+static char *p_net_format = "vita49";
+static uint32_t net_mtu = IQ_NET_DEFAULT_MTU;
+static bool net_gso = false;
+static char *p_fill_gaps = NULL;
+static enum rx_cont_fill fill_mode = rx_cont_fill_none;
+static char *p_telemetry = NULL;
+static struct telemetry telemetry = TELEMETRY_INITIALIZER;
+static struct trace trace = TRACE_INITIALIZER;
+static struct trace_buffer *p_rx_trace = NULL;    /* receive thread, NULL when not traced */
+static struct iq_cal_cache cal_caches[skiq_rx_hdl_end];
+static struct capture_index indexes[skiq_rx_hdl_end];
+static char hw_desc[64];
 
 static char p_filename[OUTPUT_PATH_MAX];
 static ssize_t filename_len = 0;
@@ -318,22 +463,266 @@ static struct application_argument p_args[] =
                 NULL,
                 &retries_on_ts_err,
                 UINT32_VAR_TYPE),
+    APP_ARG_OPT("stream",
+                0,
+                "Write samples to the output file(s) while receiving (bounded memory)",
+                NULL,
+                &stream_to_disk,
+                BOOL_VAR_TYPE),
+    APP_ARG_OPT("stream-chunks",
+                0,
+                "Number of 4 MiB write buffers per handle used by --stream",
+                "N",
+                &stream_chunks,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("direct-io",
+                0,
+                "Bypass the page cache (O_DIRECT) when used with --stream",
+                NULL,
+                &direct_io,
+                BOOL_VAR_TYPE),
+    APP_ARG_OPT("compress",
+                0,
+                "Compress the output file(s) losslessly when used with --stream",
+                NULL,
+                &compress,
+                BOOL_VAR_TYPE),
+    APP_ARG_OPT("compress-threads",
+                0,
+                "Number of threads compressing with --compress (0 for one per CPU)",
+                "N",
+                &compress_threads,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT_PRESENT("burst-threshold",
+                        0,
+                        "Only keep the blocks of bursts whose mean power reaches this level",
+                        "dBFS",
+                        &burst_threshold,
+                        DOUBLE_VAR_TYPE,
+                        &burst_threshold_present),
+    APP_ARG_OPT("burst-hysteresis",
+                0,
+                "Drop below the burst threshold by this much for a burst to end",
+                "dB",
+                &burst_hysteresis,
+                DOUBLE_VAR_TYPE),
+    APP_ARG_OPT("burst-hangover",
+                0,
+                "Number of blocks still kept after a burst ends",
+                "N",
+                &burst_hangover,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("index",
+                0,
+                "Write a block index and SigMF metadata next to the output file(s)",
+                NULL,
+                &index_capture,
+                BOOL_VAR_TYPE),
+    APP_ARG_OPT("psd",
+                0,
+                "Also write an N point power spectrum of the received samples",
+                "N",
+                &psd_nr_bins,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("psd-average",
+                0,
+                "Number of FFT segments averaged into each power spectrum",
+                "N",
+                &psd_nr_average,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("ddc",
+                0,
+                "Comma separated offsets from the LO of narrowband channels to extract",
+                "HZ[,HZ...]",
+                &p_ddc_offsets,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("ddc-decimation",
+                0,
+                "Decimation factor of the --ddc channels",
+                "N",
+                &ddc_decimation,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("ddc-bandwidth",
+                0,
+                "Passband of the --ddc channels",
+                "Hz",
+                &ddc_bandwidth,
+                DOUBLE_VAR_TYPE),
+    APP_ARG_OPT("convert",
+                0,
+                "Also write calibrated complex samples in this format (cf32 or bf16)",
+                "FORMAT",
+                &p_convert,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("ddc-only",
+                0,
+                "Only write the --ddc channels, not the received samples",
+                NULL,
+                &ddc_only,
+                BOOL_VAR_TYPE),
+    APP_ARG_OPT("net",
+                0,
+                "Also stream the received samples over UDP to this destination",
+                "HOST:PORT",
+                &p_net_dest,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("net-format",
+                0,
+                "Datagram format of --net (vita49 or raw)",
+                "FORMAT",
+                &p_net_format,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("net-mtu",
+                0,
+                "MTU of the --net link, datagrams are sized to fit",
+                "BYTES",
+                &net_mtu,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("net-gso",
+                0,
+                "Use UDP segmentation offload for --net when available",
+                NULL,
+                &net_gso,
+                BOOL_VAR_TYPE),
+    APP_ARG_OPT("fill-gaps",
+                0,
+                "Fill timestamp gaps with zero samples when used with --stream (zero or flag)",
+                "MODE",
+                &p_fill_gaps,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("telemetry",
+                0,
+                "With --index, record the sensors every TEMP,ACCEL,GPSDO,PPS milliseconds",
+                "LIST",
+                &p_telemetry,
+                STRING_VAR_TYPE),
+    TRACE_APP_ARGS(&trace),
     APP_ARG_TERMINATOR,
 };
 
+/* counter verification performed on each block as it is received with --stream */
+struct stream_verify
+{
+    struct rx_verify verifiers[skiq_rx_hdl_end];
+    int16_t *p_unpacked;            /* one block of unpacked samples when packed */
+};
+
+/* power spectrum computed on each block as it is received with --psd */
+struct stream_psd
+{
+    struct psd estimators[skiq_rx_hdl_end];
+    FILE *p_files[skiq_rx_hdl_end];
+    int16_t *p_unpacked;            /* one block of unpacked samples when packed */
+};
+
+/* burst detection performed on each block as it is received with --burst-threshold */
+struct stream_burst
+{
+    struct burst_detector detectors[skiq_rx_hdl_end];
+    bool keep[skiq_rx_hdl_end];     /* the last block of the handle is part of a burst */
+    uint32_t hangover[skiq_rx_hdl_end];
+    uint64_t nr_kept[skiq_rx_hdl_end];
+    uint64_t nr_dropped[skiq_rx_hdl_end];
+    int16_t *p_unpacked;            /* one block of unpacked samples when packed */
+    struct burst_event *p_events;   /* events of one block */
+    uint32_t max_events;
+};
+
+/* narrowband channels extracted from each block as it is received with --ddc */
+struct stream_ddc
+{
+    struct ddc converters[skiq_rx_hdl_end];
+    FILE *p_files[skiq_rx_hdl_end][DDC_MAX_CHANNELS];
+    int16_t *p_unpacked;            /* one block of unpacked samples when packed */
+};
+
+/* calibrated conversion of each block as it is received with --convert */
+struct stream_convert
+{
+    FILE *p_files[skiq_rx_hdl_end];
+    bool bf16;                      /* write bfloat16 rather than float32 */
+    bool q_first;                   /* the samples are ordered Q then I */
+    bool block_gain;                /* the gain index is in the rfic_control of each block */
+    uint8_t gain_index[skiq_rx_hdl_end];    /* gain index when it is not in the blocks */
+    int16_t *p_unpacked;            /* one block of unpacked samples when packed */
+    float *p_cf32;                  /* one block of converted samples */
+    uint16_t *p_bf16;
+};
+
+/* network streaming of each block as it is received with --net */
+struct stream_net
+{
+    struct iq_net_sink sink;
+    bool iq_order;                  /* the samples are ordered I then Q */
+    int16_t *p_unpacked;            /* one block of unpacked samples for packed VITA-49 */
+};
+
 /* local functions */
-static void print_block_contents( skiq_rx_block_t* p_block,
+static void print_block_contents( const skiq_rx_block_t* p_block,
                                   int32_t block_size_in_bytes );
-static int32_t verify_data( int16_t* p_data,
+static int32_t verify_data( struct work_pool *p_pool,
+                            const int16_t* p_data,
                             uint32_t num_samps,
-                            int32_t block_size_in_bytes );
-static void unpack_data( int16_t *packed_data,
-                         int16_t *unpacked_data,
-                         uint32_t num_unpacked_samples,
-                         int32_t block_size_in_words );
-static int16_t sign_extend( int16_t in );
+                            uint32_t block_size_in_words,
+                            uint32_t header_words,
+                            skiq_rx_hdl_t hdl );
+static int32_t verify_stage( const struct rx_block_view *p_view,
+                             void *p_arg );
+static int32_t open_psd( struct stream_psd *p_sp,
+                         skiq_rx_hdl_t *p_handles,
+                         uint8_t nr_handles,
+                         uint32_t payload_words );
+static int32_t close_psd( struct stream_psd *p_sp,
+                          skiq_rx_hdl_t *p_handles,
+                          uint8_t nr_handles );
+static int32_t psd_stage( const struct rx_block_view *p_view,
+                          void *p_arg );
+static int32_t open_burst( struct stream_burst *p_sb,
+                           skiq_rx_hdl_t *p_handles,
+                           uint8_t nr_handles,
+                           uint32_t payload_words );
+static void close_burst( struct stream_burst *p_sb,
+                         skiq_rx_hdl_t *p_handles,
+                         uint8_t nr_handles );
+static int32_t burst_stage( const struct rx_block_view *p_view,
+                            void *p_arg );
+static int32_t parse_ddc_offsets( const char *p_list );
+static int32_t open_ddc( struct stream_ddc *p_sd,
+                         skiq_rx_hdl_t *p_handles,
+                         uint8_t nr_handles,
+                         uint32_t payload_words );
+static int32_t close_ddc( struct stream_ddc *p_sd,
+                          skiq_rx_hdl_t *p_handles,
+                          uint8_t nr_handles );
+static int32_t ddc_stage( const struct rx_block_view *p_view,
+                          void *p_arg );
+static int32_t open_convert( struct stream_convert *p_sc,
+                             skiq_rx_hdl_t *p_handles,
+                             uint8_t nr_handles,
+                             uint32_t payload_words,
+                             bool block_gain );
+static int32_t close_convert( struct stream_convert *p_sc,
+                              skiq_rx_hdl_t *p_handles,
+                              uint8_t nr_handles );
+static int32_t convert_stage( const struct rx_block_view *p_view,
+                              void *p_arg );
+static int32_t open_net( struct stream_net *p_sn,
+                         uint32_t payload_words );
+static int32_t close_net( struct stream_net *p_sn );
+static int32_t net_stage( const struct rx_block_view *p_view,
+                          void *p_arg );
 static skiq_rf_port_t map_int_to_rf_port( uint32_t port );
 static void close_open_files( FILE **p_files, uint8_t nr_handles );
+static int32_t close_writers( struct rx_writer *p_writers,
+                              skiq_rx_hdl_t *p_handles,
+                              uint8_t nr_handles );
+static int32_t tag_telemetry( struct capture_index *p_index,
+                              uint32_t *p_seen );
+static int32_t store_fill_block( struct rx_writer *p_writer,
+                                 struct capture_index *p_index,
+                                 const struct rx_block_view *p_fill,
+                                 bool is_packed,
+                                 uint32_t *p_words_received );
 
 /*****************************************************************************/
 /** This is the cleanup handler to ensure that the app properly exits and
@@ -367,7 +756,9 @@ int main( int argc, char *argv[])
     int num_blocks = 0;
     uint32_t total_num_payload_words_acquired[skiq_rx_hdl_end];
     uint64_t curr_ts[skiq_rx_hdl_end];
-    uint64_t next_ts[skiq_rx_hdl_end];
+    uint32_t telemetry_seen[skiq_rx_hdl_end];
+    struct rx_continuity conts[skiq_rx_hdl_end];
+    enum rx_cont_event cont_event = rx_cont_ok;
     uint64_t first_ts[skiq_rx_hdl_end];
     uint32_t rx_block_cnt[skiq_rx_hdl_end];
     int32_t status=0;
@@ -375,8 +766,21 @@ int main( int argc, char *argv[])
     uint32_t* p_next_write[skiq_rx_hdl_end];
     uint32_t num_words_written=0;
     uint32_t num_words_read=0;
-    skiq_rx_block_t* p_rx_block;
+    const skiq_rx_block_t* p_rx_block;
+    skiq_rx_block_t* p_recv_block;
     uint32_t len;
+    struct rx_consumer consumer = RX_CONSUMER_INITIALIZER;
+    struct stream_verify stream_verify = { .p_unpacked = NULL };
+    struct stream_psd stream_psd = { .p_unpacked = NULL };
+    struct stream_burst stream_burst = { .p_unpacked = NULL, .p_events = NULL };
+    struct stream_ddc stream_ddc = { .p_unpacked = NULL };
+    struct stream_convert stream_convert = { .p_unpacked = NULL, .p_cf32 = NULL, .p_bf16 = NULL };
+    struct stream_net stream_net = { .sink = { .fd = -1 }, .p_unpacked = NULL };
+    struct rx_block_view view;
+    struct rx_block_view fill_view;
+    const char *p_stage = NULL;
+    int32_t stage_status = 0;
+    struct trace_span span;
     uint32_t* p_rx_data[skiq_rx_hdl_end];
     uint32_t* p_rx_data_start[skiq_rx_hdl_end];
     skiq_rx_hdl_t curr_rx_hdl;
@@ -407,6 +811,10 @@ int main( int argc, char *argv[])
     uint32_t payload_words=0;
     uint32_t words_received[skiq_rx_hdl_end];
 
+    /* used instead of the capture buffers when streaming to disk */
+    struct rx_writer writers[skiq_rx_hdl_end];
+    bool continuous = false;
+
     bool cal_type_all = false;
     bool rfic_ctrl_out = false;
 
@@ -421,6 +829,8 @@ int main( int argc, char *argv[])
         rx_overload[curr_rx_hdl] = false;
         gain_meta[curr_rx_hdl] = UINT8_MAX;
         words_received[curr_rx_hdl] = 0;
+        writers[curr_rx_hdl] = RX_WRITER_INITIALIZER;
+        indexes[curr_rx_hdl] = CAPTURE_INDEX_INITIALIZER;
     }
 
     /* initialize everything based on the arguments provided */
@@ -582,6 +992,126 @@ int main( int argc, char *argv[])
         return(-1);
     }
 
+    if( align_samples && burst_threshold_present )
+    {
+        fprintf(stderr, "Error: either --burst-threshold OR --align-samples may be specified, not"
+                " both\n");
+        return(-1);
+    }
+
+    if( p_ddc_offsets != NULL )
+    {
+        if( parse_ddc_offsets( p_ddc_offsets ) != 0 )
+        {
+            fprintf(stderr, "Error: --ddc takes 1 to %u comma separated offsets in Hertz, got"
+                    " '%s'\n", DDC_MAX_CHANNELS, p_ddc_offsets);
+            return(-1);
+        }
+        if( ( ddc_decimation == 0 ) || ( ddc_decimation > DDC_MAX_DECIMATION ) )
+        {
+            fprintf(stderr, "Error: --ddc-decimation must be between 1 and %u\n",
+                    DDC_MAX_DECIMATION);
+            return(-1);
+        }
+        if( align_samples )
+        {
+            fprintf(stderr, "Error: either --ddc OR --align-samples may be specified, not"
+                    " both\n");
+            return(-1);
+        }
+    }
+
+    if( ( p_convert != NULL ) && ( strcasecmp( p_convert, "cf32" ) != 0 ) &&
+        ( strcasecmp( p_convert, "bf16" ) != 0 ) )
+    {
+        fprintf(stderr, "Error: --convert takes cf32 or bf16, got '%s'\n", p_convert);
+        return(-1);
+    }
+
+    if( ( p_net_dest != NULL ) && ( strcasecmp( p_net_format, "vita49" ) != 0 ) &&
+        ( strcasecmp( p_net_format, "raw" ) != 0 ) )
+    {
+        fprintf(stderr, "Error: --net-format takes vita49 or raw, got '%s'\n", p_net_format);
+        return(-1);
+    }
+
+    if( ddc_only && ( ( ddc_nr_channels == 0 ) || !stream_to_disk || index_capture ) )
+    {
+        /* only --stream writes as it receives, and the index would describe an empty file */
+        fprintf(stderr, "Error: --ddc-only requires --ddc and --stream, and excludes --index\n");
+        return(-1);
+    }
+
+    if( ( p_telemetry != NULL ) && !index_capture )
+    {
+        /* the readings are only recorded next to the block index */
+        fprintf(stderr, "Error: --telemetry requires --index\n");
+        return(-1);
+    }
+
+    status = trace_init( &trace );
+    if( status != 0 )
+    {
+        fprintf(stderr, "Error: unable to trace to %s (%s)\n", trace.p_path,
+                strerror(abs(status)));
+        return(-1);
+    }
+
+    if( align_samples && index_capture )
+    {
+        /* aligning discards samples that have already been indexed */
+        fprintf(stderr, "Error: either --index OR --align-samples may be specified, not both\n");
+        return(-1);
+    }
+
+    if( stream_to_disk )
+    {
+        /* both of these rewrite samples that have already been captured */
+        if( align_samples )
+        {
+            fprintf(stderr, "Error: either --stream OR --align-samples may be specified, not both\n");
+            return(-1);
+        }
+        if( retries_on_ts_err > 0 )
+        {
+            fprintf(stderr, "Error: either --stream OR --retries-on-ts-err may be specified, not"
+                    " both\n");
+            return(-1);
+        }
+        if( num_payload_words_to_acquire == 0 )
+        {
+            continuous = true;
+        }
+    }
+    else if( direct_io )
+    {
+        fprintf(stderr, "Error: --direct-io may only be specified with --stream\n");
+        return(-1);
+    }
+    else if( compress )
+    {
+        fprintf(stderr, "Error: --compress may only be specified with --stream\n");
+        return(-1);
+    }
+    if( compress && direct_io )
+    {
+        /* compressed chunks have arbitrary sizes */
+        fprintf(stderr, "Error: either --compress OR --direct-io may be specified, not both\n");
+        return(-1);
+    }
+
+    if( rx_cont_fill_parse( p_fill_gaps, &fill_mode ) != 0 )
+    {
+        fprintf(stderr, "Error: invalid --fill-gaps mode '%s' (zero or flag)\n", p_fill_gaps);
+        return(-1);
+    }
+    if( ( fill_mode != rx_cont_fill_none ) && !stream_to_disk )
+    {
+        /* a capture held in RAM is sized for the received blocks only */
+        fprintf(stderr, "Error: --fill-gaps may only be specified with --stream\n");
+        return(-1);
+    }
+
     if ( 0 == strcasecmp( p_trigger_src, "immediate" ) )
     {
         trigger_src = skiq_trigger_src_immediate;
@@ -799,6 +1329,72 @@ int main( int argc, char *argv[])
                      (OUTPUT_PATH_MAX-1) - filename_len );
         }
 
+        if( index_capture )
+        {
+            char *p_serial_num = NULL;
+            struct capture_meta meta = {
+                .p_recorder = "sidekiq rx_samples",
+                .p_hw = hw_desc,
+                .sample_rate = sample_rate,
+                .frequency = lo_freq,
+                .include_meta = include_meta,
+                .packed = packed,
+                .iq_order = ( iq_order_mode == skiq_iq_order_iq ),
+                .compressed = compress,
+            };
+
+            if( skiq_read_serial_string( card, &p_serial_num ) == 0 )
+            {
+                snprintf( hw_desc, sizeof(hw_desc), "Sidekiq %s", p_serial_num );
+            }
+            status = capture_index_open( &(indexes[curr_rx_hdl]), p_filename, &meta );
+            if( status != 0 )
+            {
+                printf("Error: unable to open the index of output file %s (%s)\n", p_filename,
+                       strerror(abs(status)));
+                skiq_exit();
+                return(-1);
+            }
+        }
+
+        if( stream_to_disk )
+        {
+            if( compress && ( compress_pool.nr_workers == 0 ) )
+            {
+                status = work_pool_init( &compress_pool, compress_threads );
+                if( status != 0 )
+                {
+                    printf("Error: unable to start the compression threads (%s)\n",
+                           strerror(abs(status)));
+                    skiq_exit();
+                    return(-1);
+                }
+                printf("Info: compressing output with %" PRIu32 " thread(s)\n",
+                       compress_pool.nr_workers);
+            }
+            if( compress )
+            {
+                status = rx_writer_open_compressed( &(writers[curr_rx_hdl]), p_filename,
+                                                    RX_WRITER_DEFAULT_CHUNK_SIZE, stream_chunks,
+                                                    &compress_pool );
+            }
+            else
+            {
+                status = rx_writer_open( &(writers[curr_rx_hdl]), p_filename,
+                                         RX_WRITER_DEFAULT_CHUNK_SIZE, stream_chunks, direct_io );
+            }
+            if( status != 0 )
+            {
+                printf("Error: unable to open output file %s for streaming (%s)\n", p_filename,
+                       strerror(abs(status)));
+                skiq_exit();
+                return(-1);
+            }
+            printf("Info: opened file %s for streaming output%s\n", p_filename,
+                   writers[curr_rx_hdl].direct_io ? " (O_DIRECT)" : "");
+            continue;
+        }
+
         output_fp[curr_rx_hdl] = fopen(p_filename, "wb");
         if (output_fp[curr_rx_hdl] == NULL)
         {
@@ -1140,6 +1736,7 @@ int main( int argc, char *argv[])
         {
             printf("Info: actual sample rate is %f, actual bandwidth is %u\n",
                    actual_sample_rate, actual_bandwidth);
+            indexes[curr_rx_hdl].meta.sample_rate = actual_sample_rate;
         }
 
         /* tune the Rx chain to the requested freq */
@@ -1190,7 +1787,14 @@ int main( int argc, char *argv[])
     {
         payload_words = block_size_in_words - SKIQ_RX_HEADER_SIZE_IN_WORDS;
     }
-    printf("Info: acquiring %d words at %d words per block\n", num_payload_words_to_acquire, payload_words);
+    if( continuous )
+    {
+        printf("Info: streaming at %d words per block until interrupted\n", payload_words);
+    }
+    else
+    {
+        printf("Info: acquiring %d words at %d words per block\n", num_payload_words_to_acquire, payload_words);
+    }
 
     /* set up the # of blocks to acquire according to the cmd line args */
     num_blocks = ROUND_UP(num_payload_words_to_acquire, payload_words);
@@ -1217,6 +1821,46 @@ int main( int argc, char *argv[])
             skiq_write_rx_data_src(card, handles[i], skiq_data_src_counter);
         }
         printf("Info: configured for counter data mode\n");
+
+        /* the resolution determines where the counter wraps, read it once for all verification */
+        status = skiq_read_rx_iq_resolution( card, &rx_resolution );
+        if ( ( status != 0 ) || ( rx_resolution == 0 ) )
+        {
+            printf("Error: unable to read the RX IQ resolution (status %" PRIi32 ")\n", status);
+            skiq_exit();
+            close_open_files( output_fp, nr_handles );
+            close_writers( writers, handles, nr_handles );
+            return(-1);
+        }
+
+        /* when streaming, the capture is never held in RAM so each block is verified as it
+           is received */
+        if ( stream_to_disk )
+        {
+            const char *p_kernel = NULL;
+
+            (void)rx_verify_select( &p_kernel );
+            for ( i = 0; i < nr_handles; i++ )
+            {
+                rx_verify_init( &(stream_verify.verifiers[handles[i]]), rx_resolution, iq_swap );
+            }
+            if ( packed )
+            {
+                stream_verify.p_unpacked = calloc( payload_words, sizeof(uint32_t) );
+            }
+            if ( ( packed && ( stream_verify.p_unpacked == NULL ) ) ||
+                 ( rx_consumer_register( &consumer, "verify", skiq_rx_hdl_end, verify_stage,
+                                         &stream_verify ) != 0 ) )
+            {
+                printf("Error: unable to set up counter verification while streaming\n");
+                skiq_exit();
+                close_open_files( output_fp, nr_handles );
+                close_writers( writers, handles, nr_handles );
+                return(-3);
+            }
+            printf("Info: verifying counter while streaming (RX resolution %" PRIu8 ", %s)\n",
+                   rx_resolution, p_kernel);
+        }
     }
     else
     {
@@ -1224,8 +1868,9 @@ int main( int argc, char *argv[])
     }
 
     /************************* buffer allocation ******************************/
-    /* allocate memory to hold the data when it comes in */
-    for ( i = 0; i < nr_handles; i++ )
+    /* allocate memory to hold the data when it comes in (unless streaming, in
+       which case the writers already hold a bounded set of buffers) */
+    for ( i = 0; (i < nr_handles) && !stream_to_disk; i++ )
     {
         curr_rx_hdl = handles[i];
         p_rx_data[curr_rx_hdl] = (uint32_t*)calloc(block_size_in_words * num_blocks, sizeof(uint32_t));
@@ -1240,49 +1885,267 @@ int main( int argc, char *argv[])
         p_rx_data_start[curr_rx_hdl] = p_rx_data[curr_rx_hdl];
     }
 
-    /************************** start Rx data flowing *************************/
-
-    /* begin streaming on the Rx interface */
-    for ( i = 0; i < nr_handles; i++ )
+    if( psd_nr_bins != 0 )
     {
-        curr_rx_hdl = handles[i];
-        next_ts[curr_rx_hdl] = (uint64_t) 0;
-        rx_block_cnt[curr_rx_hdl] = 0;
-        total_num_payload_words_acquired[curr_rx_hdl] = 0;
+        status = open_psd( &stream_psd, handles, nr_handles, payload_words );
+        if( ( status != 0 ) ||
+            ( rx_consumer_register( &consumer, "psd", skiq_rx_hdl_end, psd_stage,
+                                    &stream_psd ) != 0 ) )
+        {
+            printf("Error: unable to set up the power spectrum (%s)\n",
+                   strerror(abs((status != 0) ? status : ENOSPC)));
+            close_psd( &stream_psd, handles, nr_handles );
+            skiq_exit();
+            close_open_files( output_fp, nr_handles );
+            close_writers( writers, handles, nr_handles );
+            return(-3);
+        }
     }
 
-    if( settle_time != 0 )
+    if( burst_threshold_present )
     {
-        printf("Info: waiting %" PRIu32 " ms prior to streaming\n", settle_time);
-        usleep(NUM_USEC_IN_MS*settle_time);
+        status = open_burst( &stream_burst, handles, nr_handles, payload_words );
+        if( ( status != 0 ) ||
+            ( rx_consumer_register( &consumer, "burst", skiq_rx_hdl_end, burst_stage,
+                                    &stream_burst ) != 0 ) )
+        {
+            printf("Error: unable to set up the burst detector (%s)\n",
+                   strerror(abs((status != 0) ? status : ENOSPC)));
+            close_burst( &stream_burst, handles, nr_handles );
+            skiq_exit();
+            close_open_files( output_fp, nr_handles );
+            close_writers( writers, handles, nr_handles );
+            return(-3);
+        }
     }
 
-    printf( "Info: starting %u Rx interface(s)\n", nr_handles );
-    status = skiq_start_rx_streaming_multi_on_trigger(card, handles, nr_handles, trigger_src, 0);
-    if ( status != 0 )
+    if( ddc_nr_channels != 0 )
     {
-        printf("Error: receive streaming failed to start with status code %d\n", status);
-        running = false;
+        status = open_ddc( &stream_ddc, handles, nr_handles, payload_words );
+        if( ( status != 0 ) ||
+            ( rx_consumer_register( &consumer, "ddc", skiq_rx_hdl_end, ddc_stage,
+                                    &stream_ddc ) != 0 ) )
+        {
+            printf("Error: unable to set up the down-converter (%s)\n",
+                   strerror(abs((status != 0) ? status : ENOSPC)));
+            close_ddc( &stream_ddc, handles, nr_handles );
+            skiq_exit();
+            close_open_files( output_fp, nr_handles );
+            close_writers( writers, handles, nr_handles );
+            return(-3);
+        }
     }
 
-    /* loop through and acquire the requested # of data words, verifying
-       that the timestamp (ts) increments as expected */
-    while ( (num_hdl_rcv > 0) && (running==true) )
+    if( p_convert != NULL )
     {
-        rx_status = skiq_receive(card, &curr_rx_hdl, &p_rx_block, &len);
-        if ( skiq_rx_status_success == rx_status )
+        status = open_convert( &stream_convert, handles, nr_handles, payload_words,
+                               rfic_ctrl_out );
+        if( ( status != 0 ) ||
+            ( rx_consumer_register( &consumer, "convert", skiq_rx_hdl_end, convert_stage,
+                                    &stream_convert ) != 0 ) )
         {
-            if ( ( ( curr_rx_hdl < skiq_rx_hdl_end ) && ( output_fp[curr_rx_hdl] == NULL ) ) ||
-                 ( curr_rx_hdl >= skiq_rx_hdl_end ) )
+            printf("Error: unable to set up the sample conversion (%s)\n",
+                   strerror(abs((status != 0) ? status : ENOSPC)));
+            close_convert( &stream_convert, handles, nr_handles );
+            skiq_exit();
+            close_open_files( output_fp, nr_handles );
+            close_writers( writers, handles, nr_handles );
+            return(-3);
+        }
+    }
+    else if( rfic_ctrl_out )
+    {
+        /* the gain change reports below look the offsets up, not the API */
+        for ( i = 0; i < nr_handles; i++ )
+        {
+            if( ( rx_resolution != 0 ) ||
+                ( skiq_read_rx_iq_resolution( card, &rx_resolution ) == 0 ) )
             {
-                printf("Error: received unexpected data from unspecified hdl %u\n", curr_rx_hdl);
-                print_block_contents(p_rx_block, len);
-                app_cleanup(0);
-                skiq_exit();
-                close_open_files( output_fp, nr_handles );
-                exit(-4);
+                (void)iq_cal_cache_init( &(cal_caches[handles[i]]), rx_resolution );
+                (void)iq_cal_cache_fill( &(cal_caches[handles[i]]), card, handles[i] );
             }
-            if ( NULL != p_rx_block )
+        }
+    }
+
+    if( p_net_dest != NULL )
+    {
+        status = open_net( &stream_net, payload_words );
+        if( ( status != 0 ) ||
+            ( rx_consumer_register( &consumer, "net", skiq_rx_hdl_end, net_stage,
+                                    &stream_net ) != 0 ) )
+        {
+            printf("Error: unable to set up streaming to %s (%s)\n", p_net_dest,
+                   strerror(abs((status != 0) ? status : ENOSPC)));
+            close_net( &stream_net );
+            skiq_exit();
+            close_open_files( output_fp, nr_handles );
+            close_writers( writers, handles, nr_handles );
+            return(-3);
+        }
+    }
+
+    /************************** start Rx data flowing *************************/
+
+    /* the timestamp of every block is checked against the previous one of its handle, gaps
+       may be covered with placeholder blocks of payload_words samples */
+    for ( curr_rx_hdl = skiq_rx_hdl_A1; curr_rx_hdl < skiq_rx_hdl_end; curr_rx_hdl++ )
+    {
+        conts[curr_rx_hdl] = RX_CONTINUITY_INITIALIZER;
+    }
+    for ( i = 0; i < nr_handles; i++ )
+    {
+        if( rx_continuity_init( &(conts[handles[i]]), handles[i], packed, fill_mode,
+                                payload_words, 0 ) != 0 )
+        {
+            printf("Error: unable to allocate the gap placeholder of hdl %u\n", handles[i]);
+            skiq_exit();
+            close_open_files( output_fp, nr_handles );
+            close_writers( writers, handles, nr_handles );
+            return(-3);
+        }
+    }
+    if( fill_mode != rx_cont_fill_none )
+    {
+        printf("Info: filling timestamp gaps with %s placeholder blocks\n",
+               ( fill_mode == rx_cont_fill_flag ) ? "flagged" : "zero");
+    }
+
+    /* begin streaming on the Rx interface */
+    for ( i = 0; i < nr_handles; i++ )
+    {
+        curr_rx_hdl = handles[i];
+        rx_block_cnt[curr_rx_hdl] = 0;
+        total_num_payload_words_acquired[curr_rx_hdl] = 0;
+    }
+
+    if( settle_time != 0 )
+    {
+        printf("Info: waiting %" PRIu32 " ms prior to streaming\n", settle_time);
+        usleep(NUM_USEC_IN_MS*settle_time);
+    }
+
+    if( p_telemetry != NULL )
+    {
+        uint32_t periods[telemetry_nr_sensors] = { TELEMETRY_DEFAULT_TEMP_MS,
+                                                   TELEMETRY_DEFAULT_ACCEL_MS,
+                                                   TELEMETRY_DEFAULT_GPSDO_MS,
+                                                   TELEMETRY_DEFAULT_PPS_MS };
+
+        if( ( telemetry_parse_periods( p_telemetry, periods ) != 0 ) ||
+            ( telemetry_start( &telemetry, card, periods ) != 0 ) )
+        {
+            printf("Error: unable to sample the sensors with --telemetry=%s\n", p_telemetry);
+            skiq_exit();
+            close_open_files( output_fp, nr_handles );
+            close_writers( writers, handles, nr_handles );
+            return(-3);
+        }
+    }
+    for ( i = 0; i < nr_handles; i++ )
+    {
+        /* odd, so the first published reading is recorded */
+        telemetry_seen[handles[i]] = 1;
+    }
+
+    p_rx_trace = trace_thread( &trace, "Rx" );
+    consumer.p_trace = p_rx_trace;
+
+    printf( "Info: starting %u Rx interface(s)\n", nr_handles );
+    status = skiq_start_rx_streaming_multi_on_trigger(card, handles, nr_handles, trigger_src, 0);
+    if ( status != 0 )
+    {
+        printf("Error: receive streaming failed to start with status code %d\n", status);
+        running = false;
+    }
+
+    /* loop through and acquire the requested # of data words, verifying
+       that the timestamp (ts) increments as expected */
+    while ( (num_hdl_rcv > 0) && (running==true) )
+    {
+        /* the block is handed to the registered stages in place, it is only
+           copied below when it has to be kept for the capture */
+        trace_begin( p_rx_trace, &span );
+        rx_status = skiq_receive(card, &curr_rx_hdl, &p_recv_block, &len);
+        trace_end( p_rx_trace, &span, "receive", len );
+        if ( skiq_rx_status_error_overrun == rx_status )
+        {
+            for ( i = 0; i < nr_handles; i++ )
+            {
+                rx_continuity_overrun( &(conts[handles[i]]) );
+            }
+        }
+        else if ( skiq_rx_status_success == rx_status )
+        {
+            rx_consumer_view( &view, card, curr_rx_hdl, p_recv_block, len );
+            stage_status = 0;
+            if ( ( p_recv_block != NULL ) && ( curr_rx_hdl < skiq_rx_hdl_end ) )
+            {
+                struct rx_continuity *p_cont = &(conts[curr_rx_hdl]);
+
+                cont_event = rx_continuity_check_block( p_cont, p_recv_block, len );
+                if ( cont_event > rx_cont_first )
+                {
+                    trace_instant( p_rx_trace, rx_cont_event_cstr( cont_event ),
+                                   p_cont->last_delta );
+                }
+
+                /* the placeholders of a gap go through the stages and into the capture
+                   ahead of the block that revealed it */
+                while ( ( stage_status == 0 ) && rx_continuity_next_fill( p_cont, &fill_view ) )
+                {
+                    fill_view.card = card;
+                    stage_status = rx_consumer_dispatch( &consumer, &fill_view, &p_stage );
+                    if( ( stage_status != 0 ) || last_block[curr_rx_hdl] ||
+                        ( stream_to_disk && ddc_only ) ||
+                        ( burst_threshold_present && !stream_burst.keep[curr_rx_hdl] ) ||
+                        ( !continuous &&
+                          ( (total_num_payload_words_acquired[curr_rx_hdl] + payload_words) >=
+                            num_payload_words_to_acquire ) ) )
+                    {
+                        /* the end of a capture is always taken from a received block */
+                        continue;
+                    }
+                    if( store_fill_block( &(writers[curr_rx_hdl]), &(indexes[curr_rx_hdl]),
+                                          &fill_view, packed,
+                                          &(words_received[curr_rx_hdl]) ) != 0 )
+                    {
+                        printf("Error: failed to write a gap placeholder for hdl %u\n",
+                               curr_rx_hdl);
+                        running = false;
+                    }
+                    total_num_payload_words_acquired[curr_rx_hdl] += payload_words;
+                    rx_block_cnt[curr_rx_hdl]++;
+                }
+                if ( stage_status == 0 )
+                {
+                    stage_status = rx_consumer_dispatch( &consumer, &view, &p_stage );
+                }
+            }
+
+            curr_rx_hdl = view.hdl;
+            p_rx_block = view.p_block;
+            len = view.nr_bytes;
+            if ( stage_status != 0 )
+            {
+                printf("Error: %s stage failed for hdl %u (status %" PRIi32 ")\n",
+                       p_stage, curr_rx_hdl, stage_status);
+                running = false;
+                continue;
+            }
+            if ( ( ( curr_rx_hdl < skiq_rx_hdl_end ) && ( output_fp[curr_rx_hdl] == NULL ) &&
+                   ( writers[curr_rx_hdl].fd < 0 ) ) ||
+                 ( curr_rx_hdl >= skiq_rx_hdl_end ) )
+            {
+                printf("Error: received unexpected data from unspecified hdl %u\n", curr_rx_hdl);
+                print_block_contents(p_rx_block, len);
+                app_cleanup(0);
+                telemetry_stop( &telemetry );
+                skiq_exit();
+                close_open_files( output_fp, nr_handles );
+                close_writers( writers, handles, nr_handles );
+                exit(-4);
+            }
+            if ( NULL != p_rx_block )
             {
                 /* verify timestamp and data */
                 curr_ts[curr_rx_hdl] = p_rx_block->rf_timestamp;
@@ -1295,8 +2158,7 @@ int main( int argc, char *argv[])
                         (first_block[curr_rx_hdl] == true) )
                     {
                         double g;
-                        if ( 0 == skiq_read_rx_cal_offset_by_gain_index( card, curr_rx_hdl,
-                                                                         curr_gain, &g ) )
+                        if ( iq_cal_cache_offset( &(cal_caches[curr_rx_hdl]), curr_gain, &g ) )
                         {
                             printf("New gain for handle %u is %u (RX cal"
                                    " offset: %.10f)\n", curr_rx_hdl, curr_gain, g);
@@ -1313,22 +2175,20 @@ int main( int argc, char *argv[])
                     }
                     gain_meta[curr_rx_hdl] = curr_gain;
                 }
-                /* check for the overload condition */
-                if( rx_overload[curr_rx_hdl] == true )
+                /* check for a change of the overload condition */
+                if( rx_overload[curr_rx_hdl] != ( p_rx_block->overload != 0 ) )
                 {
-                    /* see if we're still in overload */
-                    if ( p_rx_block->overload == 0 )
+                    rx_overload[curr_rx_hdl] = ( p_rx_block->overload != 0 );
+                    if( rx_overload[curr_rx_hdl] )
+                    {
+                        printf("Info: overload condition detected on hdl %u!\n", curr_rx_hdl);
+                    }
+                    else
                     {
                         printf("Info: overload condition no longer detected on"
                                 " hdl %u\n", curr_rx_hdl);
-                        rx_overload[curr_rx_hdl] = false;
                     }
                 }
-                else if ( p_rx_block->overload != 0 )
-                {
-                    printf("Info: overload condition detected on hdl %u!\n", curr_rx_hdl);
-                    rx_overload[curr_rx_hdl] = true;
-                }
 
 #if CHECK_TIMESTAMPS
                 if (first_block[curr_rx_hdl] == true)
@@ -1342,7 +2202,6 @@ int main( int argc, char *argv[])
                     /*
                         will be incremented properly below for next time through
                     */
-                    next_ts[curr_rx_hdl] = curr_ts[curr_rx_hdl];
                     num_handles_started++;
                     if( (num_handles_started == nr_handles) && (align_samples==true) )
                     {
@@ -1385,8 +2244,8 @@ int main( int argc, char *argv[])
                         }
                     }
                 }
-                else if ( !last_block[curr_rx_hdl] &&
-                          ( curr_ts[curr_rx_hdl] != next_ts[curr_rx_hdl] ) )
+                else if ( !last_block[curr_rx_hdl] && ( cont_event > rx_cont_first ) &&
+                          !conts[curr_rx_hdl].gap_filled )
                 {
                     /* Check for timestamp errors only if loop is still collecting blocks for
                        `curr_rx_hdl` (e.g. last block has not yet occurred) */
@@ -1395,15 +2254,17 @@ int main( int argc, char *argv[])
                             "expected 0x%016" PRIx64 " but got 0x%016" PRIx64
                             " (delta %" PRId64 ")\n", \
                            rx_block_cnt[curr_rx_hdl], curr_rx_hdl,
-                           next_ts[curr_rx_hdl], curr_ts[curr_rx_hdl],
-                           curr_ts[curr_rx_hdl] - next_ts[curr_rx_hdl]);
+                           conts[curr_rx_hdl].last_expected_ts, curr_ts[curr_rx_hdl],
+                           conts[curr_rx_hdl].last_delta);
                     // we've exceeded our retry count, exit
                     if( retry_count >= retries_on_ts_err )
                     {
                         print_block_contents(p_rx_block, len);
                         app_cleanup(0);
+                        telemetry_stop( &telemetry );
                         skiq_exit();
                         close_open_files( output_fp, nr_handles );
+                        close_writers( writers, handles, nr_handles );
                         return(-1);
                     }
                     else
@@ -1422,36 +2283,79 @@ int main( int argc, char *argv[])
                             gain_meta[curr_rx_hdl] = UINT8_MAX;
                             words_received[curr_rx_hdl] = 0;
 
-                            next_ts[curr_rx_hdl] = (uint64_t) 0;
+                            rx_continuity_reset( &(conts[curr_rx_hdl]) );
                             rx_block_cnt[curr_rx_hdl] = 0;
                             total_num_payload_words_acquired[curr_rx_hdl] = 0;
                             num_handles_started=0;
 
                             p_next_write[curr_rx_hdl] = p_rx_data_start[curr_rx_hdl];
+                            capture_index_reset( &(indexes[curr_rx_hdl]) );
+                            telemetry_seen[curr_rx_hdl] = 1;
                         }
                         retry_count++;
                         continue;
                     }
                 }
 #endif
-                num_words_read = len/4; /* len is in bytes */
+                if( burst_threshold_present && !stream_burst.keep[curr_rx_hdl] )
+                {
+                    /* outside of a burst, the block only advances the timestamp */
+                    continue;
+                }
+
+                /* a new sensor reading tags the next block indexed, one load per block */
+                if( ( p_telemetry != NULL ) &&
+                    ( telemetry_seq( &telemetry ) != telemetry_seen[curr_rx_hdl] ) &&
+                    ( tag_telemetry( &(indexes[curr_rx_hdl]),
+                                     &(telemetry_seen[curr_rx_hdl]) ) != 0 ) )
+                {
+                    printf("Error: failed to write the telemetry of hdl %u\n", curr_rx_hdl);
+                    running = false;
+                }
 
                 /* copy over all the data if this isn't the last block */
-                if( (total_num_payload_words_acquired[curr_rx_hdl] + payload_words) < num_payload_words_to_acquire )
+                if( continuous ||
+                    ( (total_num_payload_words_acquired[curr_rx_hdl] + payload_words) < num_payload_words_to_acquire ) )
                 {
-                    if( include_meta == true )
+                    const uint32_t *p_src = (const uint32_t *)p_rx_block;
+
+                    num_words_read = len/4; /* len is in bytes */
+                    if( include_meta == false )
                     {
-                        memcpy(p_next_write[curr_rx_hdl],((uint32_t*)p_rx_block),
-                               (num_words_read)*sizeof(uint32_t));
-                        p_next_write[curr_rx_hdl] += num_words_read;
+                        num_words_read = num_words_read - SKIQ_RX_HEADER_SIZE_IN_WORDS;
+                        p_src = (const uint32_t *)p_rx_block->data;
+                    }
+
+                    if( stream_to_disk && ddc_only )
+                    {
+                        /* only the --ddc channels are written */
+                    }
+                    else if( stream_to_disk )
+                    {
+                        trace_begin( p_rx_trace, &span );
+                        status = rx_writer_write( &(writers[curr_rx_hdl]), p_src,
+                                                  num_words_read * sizeof(uint32_t) );
+                        trace_end( p_rx_trace, &span, "write", curr_rx_hdl );
+                        if( status != 0 )
+                        {
+                            printf("Error: failed to write to output file for hdl %u (%s)\n",
+                                   curr_rx_hdl, strerror(abs(status)));
+                            running = false;
+                        }
                     }
                     else
                     {
-                        num_words_read = num_words_read - SKIQ_RX_HEADER_SIZE_IN_WORDS;
-                        memcpy(p_next_write[curr_rx_hdl],
-                               (void *)p_rx_block->data,
+                        memcpy(p_next_write[curr_rx_hdl], p_src,
                                (num_words_read)*sizeof(uint32_t));
-                        p_next_write[curr_rx_hdl] += (num_words_read);
+                        p_next_write[curr_rx_hdl] += num_words_read;
+                    }
+                    if( capture_index_add( &(indexes[curr_rx_hdl]), curr_ts[curr_rx_hdl],
+                                           p_rx_block->sys_timestamp,
+                                           (uint64_t)words_received[curr_rx_hdl] * sizeof(uint32_t),
+                                           payload_words, p_rx_block->overload ) != 0 )
+                    {
+                        printf("Error: failed to write to the index of hdl %u\n", curr_rx_hdl);
+                        running = false;
                     }
                     // update the # of words received and num samples received
                     words_received[curr_rx_hdl] += num_words_read;
@@ -1483,21 +2387,45 @@ int main( int argc, char *argv[])
                         // if the metadata is included, make sure to increment
                         // # words to copy and update the offset into the last
                         // block of data
+                        const uint32_t *p_src = (const uint32_t *)p_rx_block->data;
                         if (include_meta)
                         {
                             num_words_to_copy += SKIQ_RX_HEADER_SIZE_IN_WORDS;
-                            memcpy(p_next_write[curr_rx_hdl],
-                                   ((uint32_t*)p_rx_block),
-                                   num_words_to_copy*sizeof(uint32_t));
-                            p_next_write[curr_rx_hdl] += num_words_to_copy;
+                            p_src = (const uint32_t *)p_rx_block;
+                        }
+
+                        if( stream_to_disk && ddc_only )
+                        {
+                            /* only the --ddc channels are written */
+                        }
+                        else if( stream_to_disk )
+                        {
+                            trace_begin( p_rx_trace, &span );
+                            status = rx_writer_write( &(writers[curr_rx_hdl]), p_src,
+                                                      num_words_to_copy * sizeof(uint32_t) );
+                            trace_end( p_rx_trace, &span, "write", curr_rx_hdl );
+                            if( status != 0 )
+                            {
+                                printf("Error: failed to write to output file for hdl %u (%s)\n",
+                                       curr_rx_hdl, strerror(abs(status)));
+                                running = false;
+                            }
                         }
                         else
                         {
-                            memcpy(p_next_write[curr_rx_hdl],
-                                   (void *)p_rx_block->data,
+                            memcpy(p_next_write[curr_rx_hdl], p_src,
                                    num_words_to_copy*sizeof(uint32_t));
                             p_next_write[curr_rx_hdl] += num_words_to_copy;
                         }
+                        if( capture_index_add( &(indexes[curr_rx_hdl]), curr_ts[curr_rx_hdl],
+                                               p_rx_block->sys_timestamp,
+                                               (uint64_t)words_received[curr_rx_hdl] * sizeof(uint32_t),
+                                               last_block_num_payload_words,
+                                               p_rx_block->overload ) != 0 )
+                        {
+                            printf("Error: failed to write to the index of hdl %u\n", curr_rx_hdl);
+                            running = false;
+                        }
 
                         total_num_payload_words_acquired[curr_rx_hdl] += \
                             last_block_num_payload_words;
@@ -1509,7 +2437,6 @@ int main( int argc, char *argv[])
                         words_received[curr_rx_hdl] += num_words_to_copy;
                     }
                 }
-                next_ts[curr_rx_hdl] += (payload_words);
             }
         }
     }
@@ -1517,12 +2444,150 @@ int main( int argc, char *argv[])
     /* all done, so stop streaming */
     printf( "Info: stopping %u Rx interface(s)\n", nr_handles );
     skiq_stop_rx_streaming_multi_immediate(card, handles, nr_handles);
+    telemetry_stop( &telemetry );
+    if( trace.enabled )
+    {
+        int32_t tmp_status = trace_export( &trace );
+
+        trace_print_stats( &trace, stdout );
+        if( tmp_status != 0 )
+        {
+            printf("Error: failed to write the trace to %s (%s)\n", trace.p_path,
+                   strerror(abs(tmp_status)));
+        }
+        else
+        {
+            printf("Info: trace written to %s\n", trace.p_path);
+        }
+        p_rx_trace = NULL;
+        consumer.p_trace = NULL;
+        trace_free( &trace );
+    }
+    if( p_telemetry != NULL )
+    {
+        for ( i = 0; i < telemetry_nr_sensors; i++ )
+        {
+            if( telemetry.nr_errors[i] != 0 )
+            {
+                printf("Info: %" PRIu64 " of %" PRIu64 " %s reading(s) failed (last status %"
+                       PRIi32 ")\n", telemetry.nr_errors[i], telemetry.nr_reads[i],
+                       telemetry_sensor_cstr( (enum telemetry_sensor)i ),
+                       telemetry.last_status[i]);
+            }
+        }
+    }
+
+    if( psd_nr_bins != 0 )
+    {
+        int32_t tmp_status = close_psd( &stream_psd, handles, nr_handles );
+        if( (tmp_status != 0) && (status == 0) )
+        {
+            status = tmp_status;
+        }
+    }
+    if( burst_threshold_present )
+    {
+        close_burst( &stream_burst, handles, nr_handles );
+    }
+    if( ddc_nr_channels != 0 )
+    {
+        int32_t tmp_status = close_ddc( &stream_ddc, handles, nr_handles );
+        if( (tmp_status != 0) && (status == 0) )
+        {
+            status = tmp_status;
+        }
+    }
+    if( p_convert != NULL )
+    {
+        int32_t tmp_status = close_convert( &stream_convert, handles, nr_handles );
+        if( (tmp_status != 0) && (status == 0) )
+        {
+            status = tmp_status;
+        }
+    }
+    if( p_net_dest != NULL )
+    {
+        int32_t tmp_status = close_net( &stream_net );
+        if( (tmp_status != 0) && (status == 0) )
+        {
+            status = tmp_status;
+        }
+    }
+    for ( i = 0; i < nr_handles; i++ )
+    {
+        const struct rx_continuity *c = &(conts[handles[i]]);
+
+        if( ( c->nr_gaps != 0 ) || ( c->nr_backward != 0 ) )
+        {
+            printf("Info: hdl %u had %" PRIu64 " timestamp gap(s) (%" PRIu64 " after an overrun,"
+                   " %" PRIu64 " samples missing, %" PRIu64 " samples filled), %" PRIu64
+                   " backward timestamp(s)\n", handles[i], c->nr_gaps, c->nr_overruns,
+                   c->nr_missing_samples, c->nr_filled_samples, c->nr_backward);
+        }
+        rx_continuity_free( &(conts[handles[i]]) );
+    }
+
+    if ( stream_to_disk )
+    {
+        /* the samples are already on disk, just drain what is still buffered */
+        int32_t tmp_status;
 
+        for ( i = 0; (i < nr_handles) && (use_counter == true); i++ )
+        {
+            const struct rx_verify *v = &(stream_verify.verifiers[handles[i]]);
+
+            if ( v->mismatch )
+            {
+                printf("Error: hdl %u counter mismatch at sample %" PRIu64 ", expected 0x%x but"
+                       " got 0x%x (%" PRIu64 " discontinuities)\n", handles[i],
+                       v->mismatch_sample, (uint16_t)v->mismatch_expected,
+                       (uint16_t)v->mismatch_got, v->nr_mismatches);
+                status = (status == 0) ? -EINVAL : status;
+            }
+            else
+            {
+                printf("Info: verified %" PRIu64 " samples for hdl %u\n", v->nr_samples,
+                       handles[i]);
+            }
+        }
+        free( stream_verify.p_unpacked );
+        stream_verify.p_unpacked = NULL;
+        tmp_status = close_writers( writers, handles, nr_handles );
+        if( (tmp_status != 0) && (status == 0) )
+        {
+            status = tmp_status;
+        }
+        for ( i = 0; i < nr_handles; i++ )
+        {
+            curr_rx_hdl = handles[i];
+            printf("Info: wrote %" PRIu64 " bytes for hdl %u (at most %" PRIu32 " of %" PRIu32
+                   " chunks pending, stalled %" PRIu32 " time(s) waiting on disk)\n",
+                   writers[curr_rx_hdl].nr_bytes_written, curr_rx_hdl,
+                   writers[curr_rx_hdl].max_nr_full, writers[curr_rx_hdl].nr_chunks,
+                   writers[curr_rx_hdl].nr_stalls);
+            if( compress && ( writers[curr_rx_hdl].nr_bytes_written > 0 ) )
+            {
+                printf("Info: compressed %" PRIu64 " bytes for hdl %u to %.1f%% (%" PRIu64
+                       " chunk(s) stored raw)\n", writers[curr_rx_hdl].nr_bytes_in, curr_rx_hdl,
+                       100.0 * (double)writers[curr_rx_hdl].nr_bytes_written /
+                       (double)writers[curr_rx_hdl].nr_bytes_in,
+                       writers[curr_rx_hdl].nr_raw_chunks);
+            }
+        }
+    }
     /* verify data if a counter was used instead of real I/Q data */
-    if ( (use_counter == true) && (running==true) )
+    else if ( (use_counter == true) && (running==true) )
     {
         int16_t *unpacked_data = NULL;
         int32_t tmp_status = 0;
+        struct work_pool pool;
+        struct work_pool *p_pool = NULL;
+
+        /* the chunks of each capture are verified on all of the available cores */
+        if ( work_pool_init( &pool, 0 ) == 0 )
+        {
+            p_pool = &pool;
+        }
 
         for ( i = 0; i < nr_handles; i++ )
         {
@@ -1531,16 +2596,21 @@ int main( int argc, char *argv[])
             {
                 uint32_t num_samples=total_num_payload_words_acquired[curr_rx_hdl];
                 uint32_t header_words=0;
+                const char *p_kernel = NULL;
                 if( include_meta == true )
                 {
-                    header_words = rx_block_cnt[curr_rx_hdl]*SKIQ_RX_HEADER_SIZE_IN_WORDS;
+                    header_words = SKIQ_RX_HEADER_SIZE_IN_WORDS;
                 }
-                // allocate the memory
-                unpacked_data = calloc( num_samples + header_words, sizeof(int32_t) );
+                // allocate the memory, the unpacked samples do not include the metadata
+                unpacked_data = calloc( num_samples, sizeof(int32_t) );
                 if( unpacked_data != NULL )
                 {
-                    unpack_data( (int16_t*)(p_rx_data_start[curr_rx_hdl]), unpacked_data, num_samples, block_size_in_words );
-                    tmp_status = verify_data( unpacked_data, num_samples, block_size_in_words );
+                    (void)iq_unpack_select( &p_kernel );
+                    printf("Info: unpacking %" PRIu32 " samples (%s)\n", num_samples, p_kernel);
+                    iq_unpack_blocks( p_rx_data_start[curr_rx_hdl], unpacked_data, num_samples,
+                                      block_size_in_words, header_words );
+                    tmp_status = verify_data( p_pool, unpacked_data, num_samples,
+                                              num_samples, 0, curr_rx_hdl );
                     free(unpacked_data);
                     if( (tmp_status != 0) && (status == 0) )
                     {
@@ -1558,9 +2628,11 @@ int main( int argc, char *argv[])
             }
             else
             {
-                tmp_status = verify_data( (int16_t*)(p_rx_data_start[curr_rx_hdl]),
-                                           words_received[curr_rx_hdl],
-                                           block_size_in_words );
+                tmp_status = verify_data( p_pool, (int16_t*)(p_rx_data_start[curr_rx_hdl]),
+                                          total_num_payload_words_acquired[curr_rx_hdl],
+                                          block_size_in_words,
+                                          include_meta ? SKIQ_RX_HEADER_SIZE_IN_WORDS : 0,
+                                          curr_rx_hdl );
                 if( (tmp_status != 0) && (status == 0) )
                 {
                     /*
@@ -1571,11 +2643,16 @@ int main( int argc, char *argv[])
                 }
             }
         }
+
+        if ( p_pool != NULL )
+        {
+            work_pool_destroy( p_pool );
+        }
     }
 
     /********************* write output file and clean up **********************/
     /* all file data has been verified, write off to our output file */
-    for ( i = 0; (i < nr_handles) && running; i++ )
+    for ( i = 0; (i < nr_handles) && running && !stream_to_disk; i++ )
     {
         curr_rx_hdl = handles[i];
         printf("Info: done receiving, start write to file for hdl %u\n",
@@ -1594,6 +2671,22 @@ int main( int argc, char *argv[])
         p_rx_data_start[curr_rx_hdl] = NULL;
     }
     close_open_files( output_fp, nr_handles );
+    for ( i = 0; i < nr_handles; i++ )
+    {
+        int32_t tmp_status = capture_index_close( &(indexes[handles[i]]) );
+        if( tmp_status != 0 )
+        {
+            printf("Error: failed to write the index of hdl %u (%s)\n", handles[i],
+                   strerror(abs(tmp_status)));
+            status = (status == 0) ? tmp_status : status;
+        }
+        else if( indexes[handles[i]].data_path[0] != '\0' )
+        {
+            printf("Info: indexed %" PRIu64 " blocks for hdl %u (%" PRIu64 " timestamp gaps, %"
+                   PRIu64 " overloaded blocks)\n", indexes[handles[i]].nr_records, handles[i],
+                   indexes[handles[i]].nr_gaps, indexes[handles[i]].nr_overloaded_blocks);
+        }
+    }
     if( p_rfic_file != NULL )
     {
         fclose(p_rfic_file);
@@ -1617,72 +2710,65 @@ int main( int argc, char *argv[])
 
 /*****************************************************************************/
 /** This function verifies that the received sample data is a monotonically
-    increasing counter.
+    increasing counter.  The capture is split into chunks on block boundaries
+    that are verified in parallel, reporting the first mismatch of each chunk.
 
+    @param p_pool: the pool used to verify the chunks (may be NULL)
     @param p_data: a pointer to the first 32-bit sample in the buffer to
     be verified
-    @param num_samps: the number of samples to verify
-    @param block_size_in_words: the number of samples in a block (in words)
-    @return: void
+    @param num_samps: the number of samples to verify, excluding the metadata
+    @param block_size_in_words: the distance between consecutive blocks (in words)
+    @param header_words: the number of metadata words at the start of each block
+    @param hdl: the handle the samples were received on
+    @return: 0 if the counter is intact, else -EINVAL
 */
-int32_t verify_data(int16_t* p_data, uint32_t num_samps, int32_t block_size_in_words)
+int32_t verify_data( struct work_pool *p_pool,
+                     const int16_t* p_data,
+                     uint32_t num_samps,
+                     uint32_t block_size_in_words,
+                     uint32_t header_words,
+                     skiq_rx_hdl_t hdl )
 {
+    struct rx_verify verifier;
+    struct rx_verify *p_chunks = NULL;
+    uint32_t nr_chunks = VERIFY_CHUNKS_PER_WORKER;
+    const char *p_kernel = NULL;
     int32_t status=0;
-    uint32_t offset=0;
-    int16_t last_data=0;
-    uint8_t rx_resolution;
-    int16_t max_data=0;
-
-    skiq_read_rx_iq_resolution( card, &rx_resolution );
-    max_data = (1 << (rx_resolution-1))-1;
+    uint32_t i;
 
-    printf("Info: verifying data contents, num_samps %u (RX resolution %u max"
-            " ADC value %d)...\n", num_samps, rx_resolution, max_data);
-
-    if( include_meta == true )
+    if( p_pool != NULL )
     {
-        offset = (SKIQ_RX_HEADER_SIZE_IN_WORDS*2);
+        nr_chunks *= p_pool->nr_workers;
     }
-
-    /* Check the IQ ordering mode.  If IQ ordering, use the SWAP macro on the 
-    received array so the original verify_data() function can be used. */
-    if (iq_swap == true)
+    p_chunks = calloc( nr_chunks, sizeof(struct rx_verify) );
+    if( p_chunks == NULL )
     {
-        for(uint32_t temp_offset=offset; temp_offset<(num_samps*2); temp_offset+=2 )
-        {
-            SWAP(p_data[temp_offset], p_data[temp_offset+1]);
-        }
+        printf("Error: unable to allocate space for verifying samples\n");
+        return -ENOMEM;
     }
 
-    last_data = p_data[offset]+1;
-    offset++;
-    for( ; (offset<(num_samps*2)) && (status == 0); offset++ )
-    {
-        if( (include_meta == true) &&
-            ((offset % (block_size_in_words * 2))==0) &&
-            (packed == false) )
-        {
-            /*
-                If the metadata is included in the sample data and we've reached the end of
-                a block, skip over the metadata header
-            */
-            offset += (SKIQ_RX_HEADER_SIZE_IN_WORDS*2);
-        }
+    (void)rx_verify_select( &p_kernel );
+    printf("Info: verifying data contents for hdl %u, num_samps %u (RX resolution %u, %u"
+           " chunks, %s)...\n", hdl, num_samps, rx_resolution, nr_chunks, p_kernel);
 
-        if( last_data != p_data[offset] )
-        {
-            printf("Error: at sample %u, expected 0x%x but got 0x%x\n",
-                   offset, (uint16_t)last_data, (uint16_t)p_data[offset]);
-            status = -EINVAL;
-            continue;
-        }
-        last_data = p_data[offset]+1;
-        /* see if we need to wrap the data */
-        if( last_data == (max_data+1) )
+    rx_verify_init( &verifier, rx_resolution, iq_swap );
+    status = rx_verify_parallel( &verifier, p_pool, p_data, num_samps, block_size_in_words,
+                                 header_words, p_chunks, nr_chunks );
+    if( status == -ENOMEM )
+    {
+        printf("Error: unable to allocate space for verifying samples\n");
+    }
+    for( i = 0; (i < nr_chunks) && (status == -EINVAL); i++ )
+    {
+        if( p_chunks[i].mismatch )
         {
-            last_data = -(max_data+1);
+            printf("Error: chunk %u at sample %" PRIu64 ", expected 0x%x but got 0x%x\n",
+                   i, p_chunks[i].mismatch_sample, (uint16_t)p_chunks[i].mismatch_expected,
+                   (uint16_t)p_chunks[i].mismatch_got);
         }
     }
+    free( p_chunks );
+
     printf("done\n");
     printf("-------------------------\n");
 
@@ -1691,42 +2777,983 @@ int32_t verify_data(int16_t* p_data, uint32_t num_samps, int32_t block_size_in_w
 
 
 /*****************************************************************************/
-/** This function prints contents of raw data
-
-    @param p_data: a reference to raw bytes
-    @param length: the number of bytes references by p_data
-    @return: void
+/** This function verifies the counter in each block as it is received, it is
+    registered as a consumer stage when streaming to disk.  Mismatches are
+    recorded by the verifier of the handle and reported once the capture has
+    completed, they do not stop the capture.
+
+    @param p_view: the block that was received
+    @param p_arg: a pointer to the struct stream_verify
+    @return: always 0
 */
-static void hex_dump(uint8_t* p_data, uint32_t length)
+static int32_t verify_stage( const struct rx_block_view *p_view,
+                             void *p_arg )
 {
-    unsigned int i, j;
-    uint8_t c;
+    struct stream_verify *p_sv = (struct stream_verify *)p_arg;
+    struct rx_verify *v = &(p_sv->verifiers[p_view->hdl]);
 
-    for (i = 0; i < length; i += 16)
+    if( rx_continuity_is_placeholder( p_view->p_block ) )
     {
-        /* print offset */
-        printf("%06X:", i);
+        /* the counter kept running through the gap, so the placeholder's samples
+           only move the expected value on */
+        rx_verify_skip( v, ( p_sv->p_unpacked != NULL ) ?
+                        SKIQ_NUM_PACKED_SAMPLES_IN_BLOCK(p_view->nr_payload_words) :
+                        p_view->nr_payload_words );
+        return 0;
+    }
 
-        /* print HEX */
-        for (j = 0; j < 16; j++)
-        {
-            if ( ( j % 2 ) == 0 ) printf(" ");
-            if ( ( j % 8 ) == 0 ) printf(" ");
-            if ( i + j < length )
-                printf("%02X", p_data[i + j]);
-            else
-                printf("  ");
-        }
-        printf("    ");
+    if( p_sv->p_unpacked != NULL )
+    {
+        uint32_t num_samples = SKIQ_NUM_PACKED_SAMPLES_IN_BLOCK(p_view->nr_payload_words);
+        struct trace_span span;
 
-        /* print ASCII (if printable) */
-        for (j = 0; j < 16; j++)
-        {
-            if ( ( j % 8 ) == 0 ) printf(" ");
-            if ( i + j < length )
-            {
-                c = p_data[i + j];
-                if ( 0 == isprint(c) )
+        trace_begin( p_rx_trace, &span );
+        iq_unpack( p_view->p_payload, p_sv->p_unpacked, num_samples );
+        trace_end( p_rx_trace, &span, "unpack", num_samples );
+        (void)rx_verify_samples( v, p_sv->p_unpacked, num_samples );
+    }
+    else
+    {
+        (void)rx_verify_samples( v, (const int16_t *)p_view->p_payload,
+                                 p_view->nr_payload_words );
+    }
+
+    return 0;
+}
+
+
+/*****************************************************************************/
+/** This function records the latest --telemetry reading in the index of a
+    handle, it applies from the next block indexed.
+
+    @param p_index: the index of the handle
+    @param p_seen: sequence of the last reading recorded for the handle, updated
+    @return: 0 on success, else a negative errno
+*/
+static int32_t tag_telemetry( struct capture_index *p_index,
+                              uint32_t *p_seen )
+{
+    struct telemetry_sample sample;
+    struct capture_telemetry_record rec;
+
+    *p_seen = telemetry_read( &telemetry, &sample );
+    if( sample.valid == 0 )
+    {
+        /* nothing has been read yet */
+        return 0;
+    }
+
+    memset( &rec, 0, sizeof(rec) );
+    rec.sys_timestamp = sample.sys_timestamp;
+    rec.pps_rf_timestamp = sample.pps_rf_timestamp;
+    rec.pps_sys_timestamp = sample.pps_sys_timestamp;
+    rec.gpsdo_ppm = sample.gpsdo_ppm;
+    rec.valid = sample.valid;
+    memcpy( rec.accel, sample.accel, sizeof(rec.accel) );
+    rec.temp_c = sample.temp_c;
+    rec.gpsdo_locked = sample.gpsdo_locked ? 1 : 0;
+
+    return capture_index_add_telemetry( p_index, &rec );
+}
+
+/*****************************************************************************/
+/** This function writes a --fill-gaps placeholder block to the output file
+    of its handle and indexes it like a received block.
+
+    @param p_writer: the writer of the handle
+    @param p_index: the index of the handle
+    @param p_fill: the placeholder block
+    @param is_packed: the capture is packed
+    @param p_words_received: words written to the capture so far, updated
+    @return: 0 on success, else a negative errno
+*/
+static int32_t store_fill_block( struct rx_writer *p_writer,
+                                 struct capture_index *p_index,
+                                 const struct rx_block_view *p_fill,
+                                 bool is_packed,
+                                 uint32_t *p_words_received )
+{
+    const uint32_t *p_src = (const uint32_t *)p_fill->p_block;
+    uint32_t nr_words = p_fill->nr_bytes / 4;
+    uint32_t nr_samples = is_packed ?
+        SKIQ_NUM_PACKED_SAMPLES_IN_BLOCK(p_fill->nr_payload_words) : p_fill->nr_payload_words;
+    int32_t status;
+
+    if( include_meta == false )
+    {
+        nr_words -= SKIQ_RX_HEADER_SIZE_IN_WORDS;
+        p_src = (const uint32_t *)p_fill->p_block->data;
+    }
+    status = rx_writer_write( p_writer, p_src, nr_words * sizeof(uint32_t) );
+    if( status == 0 )
+    {
+        status = capture_index_add( p_index, p_fill->p_block->rf_timestamp,
+                                    p_fill->p_block->sys_timestamp,
+                                    (uint64_t)(*p_words_received) * sizeof(uint32_t),
+                                    nr_samples, false );
+    }
+    *p_words_received += nr_words;
+
+    return status;
+}
+
+/*****************************************************************************/
+/** This function writes a completed power spectrum frame.
+
+    @param p: estimator that completed the frame
+    @param p_db: the frame
+    @param p_arg: the output file of the handle
+    @return: 0 on success, else -EIO
+*/
+static int32_t psd_frame_ready( const struct psd *p,
+                                const float *p_db,
+                                void *p_arg )
+{
+    return psd_write_frame( (FILE *)p_arg, p, p_db, lo_freq, sample_rate );
+}
+
+/*****************************************************************************/
+/** This function creates a power spectrum estimator and output file for each
+    handle.  The output files are named after the capture files with a
+    ".psd" extension.
+
+    @param p_sp: power spectrum state
+    @param p_handles: the receive handles in use
+    @param nr_handles: the number of entries in p_handles
+    @param payload_words: the number of samples in each block
+    @return: 0 on success, else a negative errno
+*/
+static int32_t open_psd( struct stream_psd *p_sp,
+                         skiq_rx_hdl_t *p_handles,
+                         uint8_t nr_handles,
+                         uint32_t payload_words )
+{
+    char p_psd_filename[OUTPUT_PATH_MAX];
+    int32_t status = 0;
+    uint8_t i;
+
+    /* the resolution sets full scale, it is not read when the counter is not in use */
+    if ( rx_resolution == 0 )
+    {
+        status = skiq_read_rx_iq_resolution( card, &rx_resolution );
+        if ( ( status != 0 ) || ( rx_resolution == 0 ) )
+        {
+            return (status != 0) ? status : -EINVAL;
+        }
+    }
+    if ( packed )
+    {
+        p_sp->p_unpacked = calloc( payload_words, sizeof(uint32_t) );
+        if ( p_sp->p_unpacked == NULL )
+        {
+            return -ENOMEM;
+        }
+    }
+
+    for ( i = 0; (i < nr_handles) && (status == 0); i++ )
+    {
+        skiq_rx_hdl_t hdl = p_handles[i];
+
+        snprintf( p_psd_filename, OUTPUT_PATH_MAX, "%s%s.psd", p_file_path, p_file_suffix[hdl] );
+        p_sp->p_files[hdl] = fopen( p_psd_filename, "wb" );
+        if ( p_sp->p_files[hdl] == NULL )
+        {
+            status = -errno;
+            break;
+        }
+        status = psd_init( &(p_sp->estimators[hdl]), psd_nr_bins, psd_nr_average,
+                           rx_resolution, iq_swap, psd_frame_ready, p_sp->p_files[hdl] );
+        if ( status == 0 )
+        {
+            printf("Info: writing %" PRIu32 " point power spectra averaged over %" PRIu32
+                   " segments to %s\n", psd_nr_bins, psd_nr_average, p_psd_filename);
+        }
+    }
+
+    return (status);
+}
+
+/*****************************************************************************/
+/** This function writes the power spectrum frame that is still being averaged
+    and closes the power spectrum output files.
+
+    @param p_sp: power spectrum state
+    @param p_handles: the receive handles in use
+    @param nr_handles: the number of entries in p_handles
+    @return: 0 on success, else the first write error encountered
+*/
+static int32_t close_psd( struct stream_psd *p_sp,
+                          skiq_rx_hdl_t *p_handles,
+                          uint8_t nr_handles )
+{
+    int32_t status = 0;
+    uint8_t i;
+
+    for ( i = 0; i < nr_handles; i++ )
+    {
+        skiq_rx_hdl_t hdl = p_handles[i];
+        struct psd *p = &(p_sp->estimators[hdl]);
+
+        if ( p_sp->p_files[hdl] == NULL )
+        {
+            continue;
+        }
+        if ( p->plan.nr_bins != 0 )
+        {
+            if ( ( psd_flush( p ) != 0 ) && ( status == 0 ) )
+            {
+                status = -EIO;
+            }
+            printf("Info: wrote %" PRIu64 " power spectra (%" PRIu64 " segments) for hdl %u\n",
+                   p->nr_frames, p->nr_segments, hdl);
+            psd_free( p );
+        }
+        if ( ( fclose( p_sp->p_files[hdl] ) != 0 ) && ( status == 0 ) )
+        {
+            status = -EIO;
+        }
+        p_sp->p_files[hdl] = NULL;
+    }
+    free( p_sp->p_unpacked );
+    p_sp->p_unpacked = NULL;
+
+    return (status);
+}
+
+/*****************************************************************************/
+/** This function is the receive stage that adds each block to the power
+    spectrum of its handle.
+
+    @param p_view: the received block
+    @param p_arg: power spectrum state
+    @return: 0 on success, else the status of a failed frame write
+*/
+static int32_t psd_stage( const struct rx_block_view *p_view,
+                          void *p_arg )
+{
+    struct stream_psd *p_sp = (struct stream_psd *)p_arg;
+    struct psd *p = &(p_sp->estimators[p_view->hdl]);
+
+    if ( p->plan.nr_bins == 0 )
+    {
+        return 0;
+    }
+    if( p_sp->p_unpacked != NULL )
+    {
+        uint32_t num_samples = SKIQ_NUM_PACKED_SAMPLES_IN_BLOCK(p_view->nr_payload_words);
+
+        iq_unpack( p_view->p_payload, p_sp->p_unpacked, num_samples );
+        return psd_feed( p, p_sp->p_unpacked, num_samples, p_view->p_block->rf_timestamp );
+    }
+
+    return psd_feed( p, (const int16_t *)p_view->p_payload, p_view->nr_payload_words,
+                     p_view->p_block->rf_timestamp );
+}
+
+
+/*****************************************************************************/
+/** This function sets up a burst detector for every receive handle.
+
+    @param p_sb: burst detection state
+    @param p_handles: the receive handles in use
+    @param nr_handles: the number of entries in p_handles
+    @param payload_words: the number of samples in a received block
+    @return: 0 on success, else a negative errno
+*/
+static int32_t open_burst( struct stream_burst *p_sb,
+                           skiq_rx_hdl_t *p_handles,
+                           uint8_t nr_handles,
+                           uint32_t payload_words )
+{
+    const char *p_kernel = NULL;
+    int32_t status = 0;
+    uint8_t i;
+
+    /* the resolution sets full scale, it is not read when the counter is not in use */
+    if ( rx_resolution == 0 )
+    {
+        status = skiq_read_rx_iq_resolution( card, &rx_resolution );
+        if ( ( status != 0 ) || ( rx_resolution == 0 ) )
+        {
+            return (status != 0) ? status : -EINVAL;
+        }
+    }
+    if ( packed )
+    {
+        p_sb->p_unpacked = calloc( payload_words, sizeof(uint32_t) );
+        if ( p_sb->p_unpacked == NULL )
+        {
+            return -ENOMEM;
+        }
+    }
+    p_sb->max_events = 1 + ( payload_words / BURST_DETECT_DEFAULT_SEGMENT );
+    p_sb->p_events = calloc( p_sb->max_events, sizeof(struct burst_event) );
+    if ( p_sb->p_events == NULL )
+    {
+        return -ENOMEM;
+    }
+
+    for ( i = 0; (i < nr_handles) && (status == 0); i++ )
+    {
+        skiq_rx_hdl_t hdl = p_handles[i];
+
+        p_sb->keep[hdl] = false;
+        p_sb->hangover[hdl] = 0;
+        p_sb->nr_kept[hdl] = 0;
+        p_sb->nr_dropped[hdl] = 0;
+        status = burst_detect_init( &(p_sb->detectors[hdl]), BURST_DETECT_DEFAULT_SEGMENT,
+                                    BURST_DETECT_DEFAULT_SEGMENTS, burst_threshold,
+                                    burst_threshold - burst_hysteresis,
+                                    (double)(1 << (rx_resolution - 1)) );
+    }
+    if ( status == 0 )
+    {
+        (void)burst_detect_select( &p_kernel );
+        printf("Info: keeping bursts at or above %.1f dBFS (ending %.1f dB lower, %s)\n",
+               burst_threshold, burst_hysteresis, p_kernel);
+    }
+
+    return (status);
+}
+
+/*****************************************************************************/
+/** This function reports and frees the burst detectors.
+
+    @param p_sb: burst detection state
+    @param p_handles: the receive handles in use
+    @param nr_handles: the number of entries in p_handles
+    @return: void
+*/
+static void close_burst( struct stream_burst *p_sb,
+                         skiq_rx_hdl_t *p_handles,
+                         uint8_t nr_handles )
+{
+    uint8_t i;
+
+    for ( i = 0; i < nr_handles; i++ )
+    {
+        skiq_rx_hdl_t hdl = p_handles[i];
+        struct burst_detector *d = &(p_sb->detectors[hdl]);
+
+        if ( d->p_history != NULL )
+        {
+            printf("Info: %" PRIu64 " burst(s) on hdl %u, kept %" PRIu64 " of %" PRIu64
+                   " blocks\n", d->nr_bursts, hdl, p_sb->nr_kept[hdl],
+                   p_sb->nr_kept[hdl] + p_sb->nr_dropped[hdl]);
+        }
+        burst_detect_free( d );
+    }
+    free( p_sb->p_unpacked );
+    p_sb->p_unpacked = NULL;
+    free( p_sb->p_events );
+    p_sb->p_events = NULL;
+}
+
+/*****************************************************************************/
+/** This function is the receive stage that runs the burst detector of the
+    block's handle and decides whether the block is kept.
+
+    @param p_view: the received block
+    @param p_arg: burst detection state
+    @return: 0
+*/
+static int32_t burst_stage( const struct rx_block_view *p_view,
+                            void *p_arg )
+{
+    struct stream_burst *p_sb = (struct stream_burst *)p_arg;
+    struct burst_detector *d = &(p_sb->detectors[p_view->hdl]);
+    const int16_t *p_iq = (const int16_t *)p_view->p_payload;
+    uint32_t num_samples = p_view->nr_payload_words;
+    bool was_active = d->active;
+    uint32_t nr_events, i;
+
+    if ( d->p_history == NULL )
+    {
+        return 0;
+    }
+    if( p_sb->p_unpacked != NULL )
+    {
+        num_samples = SKIQ_NUM_PACKED_SAMPLES_IN_BLOCK(p_view->nr_payload_words);
+        iq_unpack( p_view->p_payload, p_sb->p_unpacked, num_samples );
+        p_iq = p_sb->p_unpacked;
+    }
+
+    nr_events = burst_detect_process( d, p_iq, num_samples, p_view->p_block->rf_timestamp,
+                                      p_sb->p_events, p_sb->max_events );
+    for ( i = 0; i < nr_events; i++ )
+    {
+        const struct burst_event *e = &(p_sb->p_events[i]);
+
+        printf("Info: burst %s on hdl %u at RF timestamp 0x%016" PRIx64 " (%.1f dBFS)\n",
+               e->start ? "start" : "end", p_view->hdl, e->rf_timestamp, e->power_dbfs);
+    }
+
+    if ( was_active && !d->active )
+    {
+        p_sb->hangover[p_view->hdl] = burst_hangover;
+    }
+    if ( was_active || d->active || ( nr_events > 0 ) )
+    {
+        p_sb->keep[p_view->hdl] = true;
+    }
+    else if ( p_sb->hangover[p_view->hdl] > 0 )
+    {
+        p_sb->hangover[p_view->hdl]--;
+        p_sb->keep[p_view->hdl] = true;
+    }
+    else
+    {
+        p_sb->keep[p_view->hdl] = false;
+    }
+
+    if ( p_sb->keep[p_view->hdl] )
+    {
+        p_sb->nr_kept[p_view->hdl]++;
+    }
+    else
+    {
+        p_sb->nr_dropped[p_view->hdl]++;
+    }
+
+    return 0;
+}
+
+
+/*****************************************************************************/
+/** This function parses the --ddc list of channel offsets into ddc_offsets.
+
+    @param p_list: comma separated offsets in Hertz
+    @return: 0 on success, else -EINVAL
+*/
+static int32_t parse_ddc_offsets( const char *p_list )
+{
+    const char *p = p_list;
+
+    ddc_nr_channels = 0;
+    while( *p != '\0' )
+    {
+        char *p_end = NULL;
+        double offset = strtod( p, &p_end );
+
+        if( ( p_end == p ) || ( ( *p_end != ',' ) && ( *p_end != '\0' ) ) ||
+            ( ddc_nr_channels >= DDC_MAX_CHANNELS ) )
+        {
+            return -EINVAL;
+        }
+        ddc_offsets[ddc_nr_channels++] = offset;
+        p = ( *p_end == ',' ) ? p_end + 1 : p_end;
+    }
+
+    return ( ddc_nr_channels > 0 ) ? 0 : -EINVAL;
+}
+
+/*****************************************************************************/
+/** This function writes the outputs of a down-converter channel.
+
+    @param d: down-converter that produced the outputs
+    @param channel: index of the channel
+    @param p_iq: interleaved I/Q outputs
+    @param nr_outputs: the number of outputs
+    @param rf_timestamp: RF timestamp of the first output
+    @param p_arg: the output files of the handle, one per channel
+    @return: 0 on success, else -EIO
+*/
+static int32_t ddc_output_ready( const struct ddc *d,
+                                 uint32_t channel,
+                                 const float *p_iq,
+                                 uint32_t nr_outputs,
+                                 uint64_t rf_timestamp,
+                                 void *p_arg )
+{
+    FILE **p_files = (FILE **)p_arg;
+
+    (void)d;
+    (void)rf_timestamp;
+    if( fwrite( p_iq, 2 * sizeof(float), nr_outputs, p_files[channel] ) != nr_outputs )
+    {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** This function creates a down-converter with the --ddc channels and an
+    output file per channel for each handle.  The output files are named after
+    the capture files with a ".ddc<N>" extension.
+
+    @param p_sd: down-converter state
+    @param p_handles: the receive handles in use
+    @param nr_handles: the number of entries in p_handles
+    @param payload_words: the number of samples in each block
+    @return: 0 on success, else a negative errno
+*/
+static int32_t open_ddc( struct stream_ddc *p_sd,
+                         skiq_rx_hdl_t *p_handles,
+                         uint8_t nr_handles,
+                         uint32_t payload_words )
+{
+    char p_ddc_filename[OUTPUT_PATH_MAX];
+    const char *p_kernel = NULL;
+    int32_t status = 0;
+    uint8_t i;
+    uint32_t c;
+
+    /* the resolution sets full scale, it is not read when the counter is not in use */
+    if ( rx_resolution == 0 )
+    {
+        status = skiq_read_rx_iq_resolution( card, &rx_resolution );
+        if ( ( status != 0 ) || ( rx_resolution == 0 ) )
+        {
+            return (status != 0) ? status : -EINVAL;
+        }
+    }
+    if ( packed )
+    {
+        p_sd->p_unpacked = calloc( payload_words, sizeof(uint32_t) );
+        if ( p_sd->p_unpacked == NULL )
+        {
+            return -ENOMEM;
+        }
+    }
+
+    for ( i = 0; (i < nr_handles) && (status == 0); i++ )
+    {
+        skiq_rx_hdl_t hdl = p_handles[i];
+
+        status = ddc_init( &(p_sd->converters[hdl]), sample_rate, rx_resolution, iq_swap,
+                           ddc_output_ready, p_sd->p_files[hdl] );
+        for ( c = 0; (c < ddc_nr_channels) && (status == 0); c++ )
+        {
+            int32_t channel = ddc_add_channel( &(p_sd->converters[hdl]), ddc_offsets[c],
+                                               ddc_decimation, ddc_bandwidth );
+            if ( channel < 0 )
+            {
+                status = channel;
+                break;
+            }
+
+            snprintf( p_ddc_filename, OUTPUT_PATH_MAX, "%s%s.ddc%u", p_file_path,
+                      p_file_suffix[hdl], c );
+            p_sd->p_files[hdl][c] = fopen( p_ddc_filename, "wb" );
+            if ( p_sd->p_files[hdl][c] == NULL )
+            {
+                status = -errno;
+                break;
+            }
+            if ( i == 0 )
+            {
+                const struct ddc_channel *ch = &(p_sd->converters[hdl].channels[channel]);
+
+                printf("Info: channel %u at %+.0f Hz, %.0f Hz wide, %u taps, %.1f samples/s to"
+                       " %s\n", c, ch->offset, ch->bandwidth, ch->nr_taps,
+                       (double)sample_rate / ch->decimation, p_ddc_filename);
+            }
+        }
+    }
+    if ( status == 0 )
+    {
+        (void)ddc_select( &p_kernel );
+        printf("Info: down-converting %u channel(s) per handle (%s)\n", ddc_nr_channels,
+               p_kernel);
+    }
+
+    return (status);
+}
+
+/*****************************************************************************/
+/** This function frees the down-converters and closes the channel output
+    files.
+
+    @param p_sd: down-converter state
+    @param p_handles: the receive handles in use
+    @param nr_handles: the number of entries in p_handles
+    @return: 0 on success, else -EIO if a channel file could not be written
+*/
+static int32_t close_ddc( struct stream_ddc *p_sd,
+                          skiq_rx_hdl_t *p_handles,
+                          uint8_t nr_handles )
+{
+    int32_t status = 0;
+    uint8_t i;
+    uint32_t c;
+
+    for ( i = 0; i < nr_handles; i++ )
+    {
+        skiq_rx_hdl_t hdl = p_handles[i];
+        struct ddc *d = &(p_sd->converters[hdl]);
+
+        for ( c = 0; c < d->nr_channels; c++ )
+        {
+            printf("Info: wrote %" PRIu64 " samples of channel %u for hdl %u\n",
+                   d->channels[c].nr_outputs, c, hdl);
+        }
+        if ( d->nr_discontinuities > 0 )
+        {
+            printf("Info: down-converter of hdl %u restarted after %" PRIu64 " timestamp"
+                   " gap(s)\n", hdl, d->nr_discontinuities);
+        }
+        ddc_free( d );
+        for ( c = 0; c < DDC_MAX_CHANNELS; c++ )
+        {
+            if ( ( p_sd->p_files[hdl][c] != NULL ) && ( fclose( p_sd->p_files[hdl][c] ) != 0 ) &&
+                 ( status == 0 ) )
+            {
+                status = -EIO;
+            }
+            p_sd->p_files[hdl][c] = NULL;
+        }
+    }
+    free( p_sd->p_unpacked );
+    p_sd->p_unpacked = NULL;
+
+    return (status);
+}
+
+/*****************************************************************************/
+/** This function is the receive stage that feeds each block to the
+    down-converter of its handle.
+
+    @param p_view: the received block
+    @param p_arg: down-converter state
+    @return: 0 on success, else the status of a failed channel write
+*/
+static int32_t ddc_stage( const struct rx_block_view *p_view,
+                          void *p_arg )
+{
+    struct stream_ddc *p_sd = (struct stream_ddc *)p_arg;
+    struct ddc *d = &(p_sd->converters[p_view->hdl]);
+
+    if ( d->nr_channels == 0 )
+    {
+        return 0;
+    }
+    if( p_sd->p_unpacked != NULL )
+    {
+        uint32_t num_samples = SKIQ_NUM_PACKED_SAMPLES_IN_BLOCK(p_view->nr_payload_words);
+
+        iq_unpack( p_view->p_payload, p_sd->p_unpacked, num_samples );
+        return ddc_process( d, p_sd->p_unpacked, num_samples, p_view->p_block->rf_timestamp );
+    }
+
+    return ddc_process( d, (const int16_t *)p_view->p_payload, p_view->nr_payload_words,
+                        p_view->p_block->rf_timestamp );
+}
+
+
+/*****************************************************************************/
+/** This function reads the calibration offsets of every handle and opens a
+    converted output file per handle.  The output files are named after the
+    capture files with a ".cf32" or ".bf16" extension.
+
+    @param p_sc: conversion state
+    @param p_handles: the receive handles in use
+    @param nr_handles: the number of entries in p_handles
+    @param payload_words: the number of samples in each block
+    @param block_gain: the gain index is in the rfic_control of each block
+    @return: 0 on success, else a negative errno
+*/
+static int32_t open_convert( struct stream_convert *p_sc,
+                             skiq_rx_hdl_t *p_handles,
+                             uint8_t nr_handles,
+                             uint32_t payload_words,
+                             bool block_gain )
+{
+    char p_convert_filename[OUTPUT_PATH_MAX];
+    const char *p_kernel = NULL;
+    int32_t status = 0;
+    uint8_t i;
+
+    /* the resolution sets full scale, it is not read when the counter is not in use */
+    if ( rx_resolution == 0 )
+    {
+        status = skiq_read_rx_iq_resolution( card, &rx_resolution );
+        if ( ( status != 0 ) || ( rx_resolution == 0 ) )
+        {
+            return (status != 0) ? status : -EINVAL;
+        }
+    }
+
+    p_sc->bf16 = ( strcasecmp( p_convert, "bf16" ) == 0 );
+    p_sc->q_first = ( iq_order_mode == skiq_iq_order_qi );
+    p_sc->block_gain = block_gain;
+    if ( packed )
+    {
+        p_sc->p_unpacked = calloc( payload_words, sizeof(uint32_t) );
+    }
+    p_sc->p_cf32 = calloc( 2 * payload_words, sizeof(float) );
+    if ( p_sc->bf16 )
+    {
+        p_sc->p_bf16 = calloc( 2 * payload_words, sizeof(uint16_t) );
+    }
+    if ( ( packed && ( p_sc->p_unpacked == NULL ) ) || ( p_sc->p_cf32 == NULL ) ||
+         ( p_sc->bf16 && ( p_sc->p_bf16 == NULL ) ) )
+    {
+        return -ENOMEM;
+    }
+
+    for ( i = 0; (i < nr_handles) && (status == 0); i++ )
+    {
+        skiq_rx_hdl_t hdl = p_handles[i];
+        int32_t nr_cal;
+
+        /* a manual gain is fixed for the whole capture */
+        p_sc->gain_index[hdl] = rx_gain;
+        status = iq_cal_cache_init( &(cal_caches[hdl]), rx_resolution );
+        if ( status != 0 )
+        {
+            break;
+        }
+        nr_cal = iq_cal_cache_fill( &(cal_caches[hdl]), card, hdl );
+        if ( nr_cal <= 0 )
+        {
+            printf("Warning: no RX calibration data for hdl %u, writing fractions of full"
+                   " scale\n", hdl);
+        }
+
+        snprintf( p_convert_filename, OUTPUT_PATH_MAX, "%s%s.%s", p_file_path,
+                  p_file_suffix[hdl], p_sc->bf16 ? "bf16" : "cf32" );
+        p_sc->p_files[hdl] = fopen( p_convert_filename, "wb" );
+        if ( p_sc->p_files[hdl] == NULL )
+        {
+            status = -errno;
+            break;
+        }
+        printf("Info: writing calibrated samples for hdl %u to %s\n", hdl, p_convert_filename);
+    }
+    if ( status == 0 )
+    {
+        (void)iq_convert_select( NULL, &p_kernel );
+        printf("Info: converting to %s (%s)\n", p_sc->bf16 ? "bf16" : "cf32", p_kernel);
+    }
+
+    return (status);
+}
+
+/*****************************************************************************/
+/** This function closes the converted output files.
+
+    @param p_sc: conversion state
+    @param p_handles: the receive handles in use
+    @param nr_handles: the number of entries in p_handles
+    @return: 0 on success, else -EIO if a file could not be written
+*/
+static int32_t close_convert( struct stream_convert *p_sc,
+                              skiq_rx_hdl_t *p_handles,
+                              uint8_t nr_handles )
+{
+    int32_t status = 0;
+    uint8_t i;
+
+    for ( i = 0; i < nr_handles; i++ )
+    {
+        skiq_rx_hdl_t hdl = p_handles[i];
+
+        if ( ( p_sc->p_files[hdl] != NULL ) && ( fclose( p_sc->p_files[hdl] ) != 0 ) )
+        {
+            status = -EIO;
+        }
+        p_sc->p_files[hdl] = NULL;
+    }
+    free( p_sc->p_unpacked );
+    p_sc->p_unpacked = NULL;
+    free( p_sc->p_cf32 );
+    p_sc->p_cf32 = NULL;
+    free( p_sc->p_bf16 );
+    p_sc->p_bf16 = NULL;
+
+    return (status);
+}
+
+/*****************************************************************************/
+/** This function is the receive stage that converts each block with the
+    calibration of its gain index and writes it out.
+
+    @param p_view: the received block
+    @param p_arg: conversion state
+    @return: 0 on success, else -EIO
+*/
+static int32_t convert_stage( const struct rx_block_view *p_view,
+                              void *p_arg )
+{
+    struct stream_convert *p_sc = (struct stream_convert *)p_arg;
+    const int16_t *p_iq = (const int16_t *)p_view->p_payload;
+    uint32_t num_samples = p_view->nr_payload_words;
+    uint8_t gain_index = p_sc->gain_index[p_view->hdl];
+    float scale;
+    size_t nr_written;
+
+    if ( p_sc->p_files[p_view->hdl] == NULL )
+    {
+        return 0;
+    }
+    if( p_sc->p_unpacked != NULL )
+    {
+        num_samples = SKIQ_NUM_PACKED_SAMPLES_IN_BLOCK(p_view->nr_payload_words);
+        iq_unpack( p_view->p_payload, p_sc->p_unpacked, num_samples );
+        p_iq = p_sc->p_unpacked;
+    }
+    if ( p_sc->block_gain )
+    {
+        gain_index = (uint8_t)p_view->p_block->rfic_control;
+    }
+    scale = iq_cal_cache_scale( &(cal_caches[p_view->hdl]), gain_index );
+
+    if ( p_sc->bf16 )
+    {
+        iq_convert_bf16( p_iq, num_samples, p_sc->q_first, scale, p_sc->p_cf32, p_sc->p_bf16 );
+        nr_written = fwrite( p_sc->p_bf16, 2 * sizeof(uint16_t), num_samples,
+                             p_sc->p_files[p_view->hdl] );
+    }
+    else
+    {
+        iq_convert_cf32( p_iq, num_samples, p_sc->q_first, scale, p_sc->p_cf32 );
+        nr_written = fwrite( p_sc->p_cf32, 2 * sizeof(float), num_samples,
+                             p_sc->p_files[p_view->hdl] );
+    }
+
+    return ( nr_written == num_samples ) ? 0 : -EIO;
+}
+
+
+/*****************************************************************************/
+/** This function opens the UDP sink of --net.
+
+    @param p_sn: network streaming state
+    @param payload_words: the number of samples in each block
+    @return: 0 on success, else a negative errno
+*/
+static int32_t open_net( struct stream_net *p_sn,
+                         uint32_t payload_words )
+{
+    const enum iq_net_format format = ( strcasecmp( p_net_format, "raw" ) == 0 ) ?
+        iq_net_format_raw : iq_net_format_vita49;
+    int32_t status;
+
+    p_sn->iq_order = ( iq_order_mode == skiq_iq_order_iq );
+    if ( packed && ( format == iq_net_format_vita49 ) )
+    {
+        /* VITA-49 carries 16-bit samples, raw sends the packed words as they are */
+        p_sn->p_unpacked = calloc( SKIQ_NUM_PACKED_SAMPLES_IN_BLOCK(payload_words),
+                                   sizeof(uint32_t) );
+        if ( p_sn->p_unpacked == NULL )
+        {
+            return -ENOMEM;
+        }
+    }
+
+    status = iq_net_sink_open( &(p_sn->sink), p_net_dest, format, net_mtu, net_gso );
+    if ( status == 0 )
+    {
+        printf("Info: streaming %s datagrams of up to %u samples to %s%s\n",
+               ( format == iq_net_format_raw ) ? "raw" : "VITA-49",
+               iq_net_samples_per_datagram( format, p_sn->sink.max_datagram,
+                                            packed && ( format == iq_net_format_raw ) ),
+               p_net_dest, p_sn->sink.gso ? " with segmentation offload" : "");
+        if ( net_gso && !p_sn->sink.gso )
+        {
+            printf("Info: UDP segmentation offload is not available, sending datagrams one"
+                   " by one\n");
+        }
+    }
+
+    return (status);
+}
+
+/*****************************************************************************/
+/** This function sends what is still staged, reports the totals and closes
+    the UDP sink of --net.
+
+    @param p_sn: network streaming state
+    @return: 0 on success, else the status of the last send
+*/
+static int32_t close_net( struct stream_net *p_sn )
+{
+    struct iq_net_sink *s = &(p_sn->sink);
+    int32_t status = 0;
+
+    if ( s->fd >= 0 )
+    {
+        status = iq_net_sink_flush( s );
+        printf("Info: sent %" PRIu64 " datagrams (%" PRIu64 " bytes) in %" PRIu64
+               " system calls to %s, %" PRIu64 " dropped\n", s->nr_datagrams, s->nr_bytes,
+               s->nr_send_calls, p_net_dest, s->nr_send_errors);
+    }
+    iq_net_sink_close( s );
+    free( p_sn->p_unpacked );
+    p_sn->p_unpacked = NULL;
+
+    return (status);
+}
+
+/*****************************************************************************/
+/** This function is the receive stage that cuts each block into datagrams
+    and queues them on the UDP sink.
+
+    @param p_view: the received block
+    @param p_arg: network streaming state
+    @return: 0 on success, else the status of the send
+*/
+static int32_t net_stage( const struct rx_block_view *p_view,
+                          void *p_arg )
+{
+    struct stream_net *p_sn = (struct stream_net *)p_arg;
+    const uint32_t *p_payload = p_view->p_payload;
+    uint32_t num_samples = p_view->nr_payload_words;
+
+    if( packed )
+    {
+        num_samples = SKIQ_NUM_PACKED_SAMPLES_IN_BLOCK(p_view->nr_payload_words);
+        if( p_sn->p_unpacked != NULL )
+        {
+            iq_unpack( p_view->p_payload, p_sn->p_unpacked, num_samples );
+            p_payload = (const uint32_t *)p_sn->p_unpacked;
+        }
+    }
+
+    return iq_net_sink_block( &(p_sn->sink), (uint8_t)p_view->hdl, p_payload, num_samples,
+                              packed && ( p_sn->p_unpacked == NULL ), p_sn->iq_order,
+                              p_view->p_block->overload, p_view->p_block->rf_timestamp,
+                              p_view->p_block->sys_timestamp );
+}
+
+/*****************************************************************************/
+/** This function prints contents of raw data
+
+    @param p_data: a reference to raw bytes
+    @param length: the number of bytes references by p_data
+    @return: void
+*/
+static void hex_dump(uint8_t* p_data, uint32_t length)
+{
+    unsigned int i, j;
+    uint8_t c;
+
+    for (i = 0; i < length; i += 16)
+    {
+        /* print offset */
+        printf("%06X:", i);
+
+        /* print HEX */
+        for (j = 0; j < 16; j++)
+        {
+            if ( ( j % 2 ) == 0 ) printf(" ");
+            if ( ( j % 8 ) == 0 ) printf(" ");
+            if ( i + j < length )
+                printf("%02X", p_data[i + j]);
+            else
+                printf("  ");
+        }
+        printf("    ");
+
+        /* print ASCII (if printable) */
+        for (j = 0; j < 16; j++)
+        {
+            if ( ( j % 8 ) == 0 ) printf(" ");
+            if ( i + j < length )
+            {
+                c = p_data[i + j];
+                if ( 0 == isprint(c) )
                     printf(".");
                 else
                     printf("%c", c);
@@ -1744,7 +3771,7 @@ static void hex_dump(uint8_t* p_data, uint32_t length)
     @param num_samples: the # of 32-bit samples to print
     @return: void
 */
-static void print_block_contents( skiq_rx_block_t* p_block,
+static void print_block_contents( const skiq_rx_block_t* p_block,
                                   int32_t block_size_in_bytes )
 {
     printf("    RF Timestamp: %20" PRIu64 " (0x%016" PRIx64 ")\n",
@@ -1768,105 +3795,6 @@ static void print_block_contents( skiq_rx_block_t* p_block,
                block_size_in_bytes - SKIQ_RX_HEADER_SIZE_IN_BYTES );
 }
 
-/*****************************************************************************/
-/** This function performs sign extension for the 12-bit value passed in.
-
-    @param in: 12-bit value to be sign extended
-    @return: sign extended representation of value passed in
-*/
-int16_t sign_extend( int16_t in )
-{
-    int16_t out=0;
-
-    if( in & 0x800 )
-    {
-        out = in | 0xF000;
-    }
-    else
-    {
-        out = in;
-    }
-
-    return out;
-}
-
-/*****************************************************************************/
-/** This unpacks the sample data, packed as 12-bits and unpacked to 16-bits.
-
-    @param packed_data: pointer to packed data
-    @param unpacked_data: pointer to unpacked data
-    @param num_unpacked_samples: number of samples contained in sample data
-    @return: sign extended representation of value passed in
-*/
-static void unpack_data( int16_t *packed_data,
-                         int16_t *unpacked_data,
-                         uint32_t num_unpacked_samples,
-                         int32_t block_size_in_words )
-{
-    int16_t i0;
-    int16_t q0;
-    int16_t i1;
-    int16_t q1;
-    int16_t i2;
-    int16_t q2;
-    int16_t q3;
-    int16_t i3;
-
-    uint32_t num_samples=0;
-    uint32_t packed_offset=0;
-
-    int32_t *data;
-
-    if( include_meta == true )
-    {
-        packed_offset += SKIQ_RX_HEADER_SIZE_IN_WORDS;
-    }
-
-    // loop through all the samples and unpack them
-    for( num_samples=0; num_samples < (num_unpacked_samples*2); num_samples+=8 )
-    {
-        // determine if the metadata needs to be skipped over in the unpacking
-        if( (include_meta == true) && ((packed_offset % (block_size_in_words-1))==0) )
-        {
-            // increment over the header
-            packed_offset += SKIQ_RX_HEADER_SIZE_IN_WORDS;
-        }
-        data = (int32_t*)(&(packed_data[packed_offset*2]));
-
-        // unpack the data
-        i0 = (data[0] & 0xFFF00000) >> 20;
-        i0 = sign_extend(i0);
-        q0 = (data[0] & 0x000FFF00) >> 8;
-        q0 = sign_extend(q0);
-        i1 = ((data[0] & 0x000000FF) << 4) | ((data[1] & 0xF0000000)>>28);
-        i1 = sign_extend(i1);
-        q1 = (data[1] & 0x0FFF0000) >> 16;
-        q1 = sign_extend(q1);
-        i2 = (data[1] & 0x0000FFF0) >> 4;
-        i2 = sign_extend(i2);
-        q2 = ((data[1] & 0x0000000F) << 8) | ((data[2] & 0xFF000000) >> 24);
-        q2 = sign_extend(q2);
-        i3 = ((data[2] & 0x00FFF000) >> 12);
-        i3 = sign_extend(i3);
-        q3 = (data[2] & 0x00000FFF);
-        q3 = sign_extend(q3);
-
-        // save the unpacked data
-        unpacked_data[num_samples] = q0;
-        unpacked_data[num_samples+1] = i0;
-        unpacked_data[num_samples+2] = q1;
-        unpacked_data[num_samples+3] = i1;
-        unpacked_data[num_samples+4] = q2;
-        unpacked_data[num_samples+5] = i2;
-        unpacked_data[num_samples+6] = q3;
-        unpacked_data[num_samples+7] = i3;
-
-        // every 3 words of data contain 4 samples in packed mode
-        packed_offset += 3;
-    }
-
-}
-
 skiq_rf_port_t map_int_to_rf_port( uint32_t port )
 {
     skiq_rf_port_t rf_port = skiq_rf_port_unknown;
@@ -1920,3 +3848,37 @@ void close_open_files( FILE **p_files, uint8_t nr_handles )
         p_files[i] = NULL;
     }
 }
+
+/*****************************************************************************/
+/** This function flushes and closes the streaming writers of all the handles, then
+    stops the compression threads if they were started.
+
+    @param p_writers: streaming writers, indexed by receive handle
+    @param p_handles: the receive handles in use
+    @param nr_handles: the number of entries in p_handles
+    @return: 0 on success, else the first write error encountered
+*/
+int32_t close_writers( struct rx_writer *p_writers,
+                       skiq_rx_hdl_t *p_handles,
+                       uint8_t nr_handles )
+{
+    int32_t status = 0;
+    uint8_t i=0;
+
+    for( i=0; i<nr_handles; i++ )
+    {
+        int32_t tmp_status = rx_writer_close( &(p_writers[p_handles[i]]) );
+        if( tmp_status != 0 )
+        {
+            printf("Error: failed to finish writing output file for hdl %u (%s)\n",
+                   p_handles[i], strerror(abs(tmp_status)));
+            if( status == 0 )
+            {
+                status = tmp_status;
+            }
+        }
+    }
+    work_pool_destroy( &compress_pool );
+
+    return (status);
+}
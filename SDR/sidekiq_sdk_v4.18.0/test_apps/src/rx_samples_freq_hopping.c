@@ -34,14 +34,14 @@
 #include "sidekiq_api.h"
 #include "arg_parser.h"
 
+#include "rf_scheduler.h"
+
 /* a simple pair of MACROs to round up integer division */
 #define _ROUND_UP(_numerator, _denominator)    (_numerator + (_denominator - 1)) / _denominator
 #define ROUND_UP(_numerator, _denominator)     (_ROUND_UP((_numerator),(_denominator)))
 
 #define NUM_USEC_IN_MS (1000)
 
-#define NUM_NANOSEC_IN_SEC (1000000000)
-
 /* https://gcc.gnu.org/onlinedocs/gcc-4.8.5/cpp/Stringification.html */
 #define xstr(s)                         str(s)
 #define str(s)                          #s
@@ -111,6 +111,9 @@ static uint64_t hop_timestamp_offset = 0;
 /* variable used to signal force quit of application */
 static bool running = true;
 
+/* wakes the application when the RF timestamp of a hop is reached */
+static struct rf_sched rf_sched = RF_SCHED_INITIALIZER;
+
 /* the command line arguments available to this application */
 static struct application_argument p_args[] =
 {
@@ -236,73 +239,6 @@ void app_cleanup(int signum)
     running = false;
 }
 
-/*****************************************************************************/
-/** This is the a function that blocks until a specific RF timestamp is reached.
-
-    @param card_: Sidekiq card of intereset
-    @param hdl_: Sidekiq handle of interest
-    @param rf_ts_: RF timestamp to wait for
-
-    @return 0 upon success
-*/
-int32_t wait_until_after_rf_ts( uint8_t card_,
-                                skiq_tx_hdl_t hdl_,
-                                uint64_t rf_ts_ )
-{
-    int32_t status=0;
-    uint64_t curr_ts=0;
-    struct timespec ts;
-    uint64_t num_nanosecs=0;
-    uint32_t num_wait_secs=0;
-
-    if( (status=skiq_read_curr_rx_timestamp(card_, hdl_, &curr_ts)) == 0 )
-    {
-        // if our current timestamp is already larger than what was requested,
-        // just disable the stream immediately
-        if( curr_ts < rf_ts_ )
-        {
-            // calculate how long to sleep for before checking our timestamp
-            num_nanosecs = ceil((double)((double)(rf_ts_ - curr_ts) / (double)(sample_rate)) * NUM_NANOSEC_IN_SEC);
-            while (num_nanosecs >= NUM_NANOSEC_IN_SEC)
-            {
-                num_nanosecs -= NUM_NANOSEC_IN_SEC;
-                num_wait_secs++;
-            }
-            ts.tv_sec = num_wait_secs;
-            ts.tv_nsec = (uint32_t)(num_nanosecs);
-            while( (nanosleep(&ts, &ts) == -1) && (running==true) )
-            {
-                if ( (errno == ENOSYS) || (errno == EINVAL) ||
-                     (errno == EFAULT) )
-                {
-                    fprintf(stderr, "Error: catastrophic timer failure (errno"
-                        " %d)!\n", errno);
-                    status = -errno;
-                    break;
-                }
-            }
-
-            if( status == 0 )
-            {
-                status = skiq_read_curr_rx_timestamp(card_, hdl_, &curr_ts);
-            }
-
-            while( (curr_ts < rf_ts_) && (running==true) && (status==0) )
-            {
-                // just sleep 1 uS and read the timestamp again...we should be close based on the initial sleep calculation
-                usleep(1);
-                status = skiq_read_curr_rx_timestamp(card_, hdl_, &curr_ts);
-            }
-        }
-        if( status == 0 )
-        {
-            printf("Timestamp reached (curr=%" PRIu64 ")\n", curr_ts);
-        }
-    }
-
-    return (status);
-}
-
 /*****************************************************************************/
 /** This is the main function for executing the rx_samples_freq_hopping app.
 
@@ -633,6 +569,14 @@ int main( int argc, char *argv[] )
         skiq_read_curr_rx_timestamp(card, hdl, &curr_ts);
     }
     printf("Resetting timestamp complete (current=%" PRIu64 ")\n", curr_ts);
+
+    if( (status=rf_sched_init( &rf_sched, card, hdl, sample_rate )) != 0 )
+    {
+        printf("Error: unable to start the RF timestamp scheduler (status %d)\n", status);
+        skiq_exit();
+        free( p_rx_data );
+        return (-1);
+    }
     
     // receive data for each frequency
     for( i=0; (i<num_hop_freqs) && (running==true); i++ )
@@ -691,7 +635,8 @@ int main( int argc, char *argv[] )
         }
 
         // wait until we've reached our timestamp before starting streaming
-        if( wait_until_after_rf_ts( card, hdl, hop_ts ) != 0 )
+        status = rf_sched_wait_until( &rf_sched, hop_ts, &running );
+        if( (status != 0) && (running == true) )
         {
             printf("Never received timestamp %" PRIu64 "\n", hop_ts);
             _exit(-1);
@@ -733,6 +678,8 @@ int main( int argc, char *argv[] )
                 {
                     /* verify timestamp and data */
                     curr_ts = p_rx_block->rf_timestamp;
+                    rf_sched_observe_block( &rf_sched, curr_ts,
+                                            (len/4) - SKIQ_RX_HEADER_SIZE_IN_WORDS );
                     
                     if (next_ts == 0)
                     {
@@ -827,6 +774,8 @@ int main( int argc, char *argv[] )
         hop_ts += total_num_payload_words_acquired;
     } // end of frequency hopping list
 
+    rf_sched_print_stats( &rf_sched, stdout );
+    rf_sched_exit( &rf_sched );
     skiq_exit();
     free(p_rx_data);
 
@@ -37,6 +37,10 @@
 
 
 /***** INCLUDES *****/
+#if (!defined _GNU_SOURCE)
+#define _GNU_SOURCE         /* for pthread_setaffinity_np, see feature_test_macros(7) */
+#endif
+
 #include <ctype.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -47,6 +51,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <math.h>
 
 #include <fcntl.h>
 #include <pthread.h>
@@ -60,9 +65,20 @@
 
 #define NUM_USEC_IN_MS                      (1000)
 #define TRANSFER_TIMEOUT                    (10000)
+#define RX_READY_TIMEOUT_MS                 (100)
 
 #include "sidekiq_api.h"
 #include "arg_parser.h"
+#include "iq_unpack.h"
+#include "work_pool.h"
+#include "rx_verify.h"
+#include "rt_thread.h"
+#include "mem_arena.h"
+#include "pretrigger_ring.h"
+#include "burst_detect.h"
+#include "rx_ready.h"
+#include "rx_continuity.h"
+#include "capture_index.h"
 
 /***** DEFINES *****/
 
@@ -174,6 +190,37 @@
 #   define DEFAULT_IQ_ORDER                 skiq_iq_order_qi
 #endif
 
+#ifndef DEFAULT_PIPELINE
+#   define DEFAULT_PIPELINE                 false
+#endif
+
+/* 0 selects one worker per online CPU */
+#ifndef DEFAULT_NR_WORKERS
+#   define DEFAULT_NR_WORKERS               0
+#endif
+
+#ifndef DEFAULT_RING_TRIGGER
+#   define DEFAULT_RING_TRIGGER             "signal"
+#endif
+
+#ifndef DEFAULT_HUGEPAGES
+#   define DEFAULT_HUGEPAGES                "auto"
+#endif
+
+/* captures written with --pretrigger before exiting, 0 for until interrupted */
+#ifndef DEFAULT_NR_CAPTURES
+#   define DEFAULT_NR_CAPTURES              1
+#endif
+
+#ifndef DEFAULT_THRESHOLD_DBFS
+#   define DEFAULT_THRESHOLD_DBFS           -30.0
+#endif
+
+/* number of received blocks handed to the processing pool at once when pipelining */
+#ifndef PIPELINE_CHUNK_BLOCKS
+#   define PIPELINE_CHUNK_BLOCKS            64
+#endif
+
 #if (DEFAULT_IQ_ORDER == skiq_iq_order_iq)
 #   define DEFAULT_I_THEN_Q                 true
 #else
@@ -214,6 +261,7 @@ struct radio_config
     uint8_t             num_cards;                      // skiq_get_cards
     uint8_t             cards[SKIQ_MAX_NUM_CARDS];      // skiq_get_cards
     bool                blocking_rx;                    // skiq_set_rx_transfer_timeout
+    bool                event_driven;                   // rx_ready_wait
     bool                all_chans;                      // set to indicate RX all handles
     bool                packed;                         // skiq_write_iq_pack_mode
     bool                use_counter;                    // skiq_write_rx_data_src
@@ -241,6 +289,7 @@ struct radio_config
     .bandwidth          = DEFAULT_RX_BW,                  \
     .num_cards          = 0,                              \
     .blocking_rx        = DEFAULT_BLOCKING_RX,            \
+    .event_driven       = false,                          \
     .all_chans          = false,                          /* parse_hdl_list */ \
     .packed             = DEFAULT_PACKED,                 \
     .use_counter        = DEFAULT_USE_COUNTER,            \
@@ -273,6 +322,14 @@ struct rx_stats
     .first_block        = true, \
 }                               \
 
+/* Event that freezes a pre-trigger window (--ring-trigger) */
+enum ring_trigger
+{
+    ring_trigger_signal,        // SIGUSR1 sent to the application
+    ring_trigger_1pps,          // next 1PPS edge
+    ring_trigger_energy,        // mean power of a block at or above --threshold
+};
+
 /* Parameters passed to threads
    Instantiated by main() and passed to the threads
 */
@@ -286,6 +343,13 @@ struct thread_params
     volatile bool               init_complete;  // flag indicating that the thread has completed init
     bool                        include_meta;
     bool                        perform_verify;
+    bool                        index;          // write a block index next to each output file
+    struct work_pool*           p_pool;         // processing pool, NULL unless pipelining
+    uint32_t                    pretrigger_words; // samples kept before a trigger, 0 if no ring
+    enum ring_trigger           ring_trigger;
+    double                      threshold;      // dBFS, ring_trigger_energy only
+    uint32_t                    nr_captures;    // 0 to capture until interrupted
+    enum mem_arena_pages        pages;          // page size of the capture buffer arena
 };
 
 #define THREAD_PARAMS_INITIALIZER                             \
@@ -296,7 +360,14 @@ struct thread_params
     .init_complete                  = false,                  \
     .include_meta                   = DEFAULT_INCLUDE_META,   \
     .perform_verify                 = DEFAULT_PERFORM_VERIFY, \
+    .index                          = false,                  \
     .num_payload_words_to_acquire   = 0,                      \
+    .p_pool                         = NULL,                   \
+    .pretrigger_words               = 0,                      \
+    .ring_trigger                   = ring_trigger_signal,    \
+    .threshold                      = DEFAULT_THRESHOLD_DBFS, \
+    .nr_captures                    = DEFAULT_NR_CAPTURES,    \
+    .pages                          = mem_arena_pages_auto,   \
 }                                                             \
 
 /* Local variables for each thread
@@ -312,8 +383,107 @@ struct thread_variables
     uint32_t            words_received;
     char *              p_file_path;
     bool                last_block;
+    struct capture_index index;
+    bool                written;        // the capture buffer made it to the output file
+};
+
+/* A range of whole blocks in a handle's capture buffer that is handed to the
+   processing pool when pipelining
+*/
+struct rx_chunk
+{
+    struct rx_pipeline* p_pipe;
+    uint32_t*           p_words;        // first word of the chunk in the capture buffer
+    uint32_t            nr_words;       // words to write, including metadata if enabled
+    uint32_t            nr_samples;     // samples contained in the chunk
+};
+
+/* Per handle state of the processing pipeline.  The receive thread fills in
+   the chunks, everything else is only touched by the handle's strand so the
+   chunks of a handle are verified and written in order.
+*/
+struct rx_pipeline
+{
+    struct work_strand  strand;
+    struct rx_chunk*    p_chunks;       // preallocated, one per PIPELINE_CHUNK_BLOCKS blocks
+    uint32_t            nr_chunks;
+    uint32_t            next_chunk;
+    uint32_t*           p_chunk_start;  // start of the chunk being accumulated
+    uint32_t            chunk_nr_blocks;
+    uint32_t            chunk_nr_samples;
+    int16_t*            p_unpacked;     // scratch buffer used to verify packed chunks
+    FILE*               output_fp;
+    const char*         p_hdl_str;
+    uint8_t             card;
+    int32_t             block_size_in_words; // stride between blocks in the capture buffer
+    bool                include_meta;
+    bool                packed;
+    bool                verify;
+    struct rx_verify    verifier;       // counter state carried across the chunks
+    uint64_t            nr_words_written;
+    int32_t             status;         // first error encountered by the strand
+};
+
+/* Pre-trigger state of a handle, the window is [window_start, window_end) in
+   ring sequence numbers
+*/
+struct ring_handle
+{
+    struct pretrigger_ring  ring;
+    struct burst_detector   detector;   // ring_trigger_energy only
+    FILE*               output_fp;
+    struct capture_index index;
+    uint64_t            nr_bytes_written;
+    struct rx_continuity cont;
+    uint64_t            window_start;
+    uint64_t            window_end;
+    bool                handed;         // every block of the window is in the ring
+};
+
+#define RING_HANDLE_INITIALIZER                         \
+{                                                       \
+    .ring               = PRETRIGGER_RING_INITIALIZER,  \
+    .detector           = BURST_DETECTOR_INITIALIZER,   \
+    .output_fp          = NULL,                         \
+    .index              = CAPTURE_INDEX_INITIALIZER,    \
+    .nr_bytes_written   = 0,                            \
+    .cont               = RX_CONTINUITY_INITIALIZER,    \
+    .window_start       = 0,                            \
+    .window_end         = 0,                            \
+    .handed             = false,                        \
+}
+
+/* Writer thread of a card's pre-trigger windows, pending and exit are
+   protected by lock
+*/
+struct ring_writer
+{
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      wake;
+    struct ring_handle* p_handles[skiq_rx_hdl_end];
+    uint8_t             nr_handles;
+    bool                include_meta;
+    bool                packed;
+    bool                pending;        // a window of every handle is ready to be written
+    bool                exit;
+    uint32_t            nr_written;
+    int32_t             status;
 };
 
+#define RING_WRITER_INITIALIZER                         \
+{                                                       \
+    .lock               = PTHREAD_MUTEX_INITIALIZER,    \
+    .wake               = PTHREAD_COND_INITIALIZER,     \
+    .nr_handles         = 0,                            \
+    .include_meta       = false,                        \
+    .packed             = false,                        \
+    .pending            = false,                        \
+    .exit               = false,                        \
+    .nr_written         = 0,                            \
+    .status             = 0,                            \
+}
+
 #define THREAD_VARIABLES_INITIALIZER        \
 {                                           \
     .output_fp = NULL,                      \
@@ -324,6 +494,8 @@ struct thread_variables
     .last_block = false,                    \
     .p_file_path = NULL,                    \
     .words_received = 0,                    \
+    .index = CAPTURE_INDEX_INITIALIZER,     \
+    .written = false,                       \
 }                                           \
 
 struct cmd_line_args
@@ -342,13 +514,22 @@ struct cmd_line_args
     bool                use_counter;
     bool                num_payload_words_is_present;
     bool                blocking_rx;
+    bool                event_driven;
     bool                disable_dc_corr;
     bool                perform_verify;
     bool                packed;
     bool                include_meta;
+    bool                index;
     bool                card_is_present;
     bool                i_then_q;
     bool                rx_gain_manual;
+    bool                pipeline;
+    uint32_t            nr_workers;
+    uint32_t            pretrigger;
+    char*               p_ring_trigger;
+    double              threshold;
+    uint32_t            nr_captures;
+    char*               p_hugepages;
 };
 
 #define COMMAND_LINE_ARGS_INITIALIZER                                           \
@@ -369,11 +550,20 @@ struct cmd_line_args
     .use_counter                     = DEFAULT_USE_COUNTER,                     \
     .num_payload_words_is_present    = DEFAULT_NUM_PAYLOAD_WORDS_IS_PRESENT,    \
     .blocking_rx                     = DEFAULT_BLOCKING_RX,                     \
+    .event_driven                    = false,                                   \
     .disable_dc_corr                 = DEFAULT_DISABLE_DC_CORR,                 \
     .perform_verify                  = DEFAULT_PERFORM_VERIFY,                  \
     .packed                          = DEFAULT_PACKED,                          \
     .include_meta                    = DEFAULT_INCLUDE_META,                    \
+    .index                           = false,                                   \
     .i_then_q                        = DEFAULT_I_THEN_Q,                        \
+    .pipeline                        = DEFAULT_PIPELINE,                        \
+    .nr_workers                      = DEFAULT_NR_WORKERS,                      \
+    .pretrigger                      = 0,                                       \
+    .p_ring_trigger                  = DEFAULT_RING_TRIGGER,                    \
+    .threshold                       = DEFAULT_THRESHOLD_DBFS,                  \
+    .nr_captures                     = DEFAULT_NR_CAPTURES,                     \
+    .p_hugepages                     = DEFAULT_HUGEPAGES,                       \
 }
 
 /***** LOCAL FUNCTIONS *****/
@@ -399,14 +589,6 @@ static void hex_dump(                           uint8_t* p_data,
 static void print_block_contents(               skiq_rx_block_t* p_block,
                                                 int32_t block_size_in_bytes );
 
-static int16_t sign_extend(                     int16_t in );
-
-static void unpack_data(                        int16_t *packed_data,
-                                                int16_t *unpacked_data,
-                                                uint32_t num_unpacked_samples,
-                                                int32_t block_size_in_words,
-                                                bool include_meta );
-
 // Command line parsing
 static int32_t parse_hdl_list(                  const char *handle_str,
                                                 skiq_rx_hdl_t rx_handles[], //Assumed to be skiq_rx_hdl_end elements long 
@@ -467,10 +649,51 @@ static void update_rx_stats(                    struct rx_stats *p_rx_stats,
 static int32_t open_files(                      FILE **output_fp, 
                                                 uint8_t card, 
                                                 const char *handle_str,
-                                                const char *p_file_path );
+                                                const char *p_file_path,
+                                                struct capture_index *p_index,
+                                                const struct capture_meta *p_meta );
+
+static int32_t pipeline_init(                   struct rx_pipeline *p_pipe,
+                                                struct work_pool *p_pool,
+                                                uint8_t card,
+                                                skiq_rx_hdl_t hdl,
+                                                FILE *output_fp,
+                                                uint32_t *p_rx_data,
+                                                uint32_t num_blocks,
+                                                int32_t block_size_in_words,
+                                                uint32_t payload_words,
+                                                bool include_meta,
+                                                const struct radio_config *p_rconfig );
+
+static int32_t pipeline_block_added(            struct rx_pipeline *p_pipe,
+                                                uint32_t *p_next_write,
+                                                uint32_t nr_samples,
+                                                bool last_block );
+
+static void pipeline_free(                      struct rx_pipeline *p_pipe );
+
+static void capture_meta_init(                  struct capture_meta *p_meta,
+                                                const struct radio_config *p_rconfig,
+                                                bool include_meta );
+
+static int32_t close_index(                     struct capture_index *p_index,
+                                                uint8_t card,
+                                                const char *handle_str,
+                                                bool written );
 
 static void *receive_card(                      void *params );
 
+static const char *ring_trigger_cstr(           enum ring_trigger trigger );
+
+static uint64_t ring_find_sys_ts(               const struct pretrigger_ring *p_ring,
+                                                uint64_t sys_ts );
+
+static void *ring_writer_thread(                void *params );
+
+static void *receive_card_ring(                 void *params );
+
+static void app_trigger(                        int signum );
+
 static void app_cleanup(                        int signum );
 
 
@@ -480,6 +703,7 @@ static pthread_cond_t           g_sync_start = PTHREAD_COND_INITIALIZER;  // use
 static pthread_mutex_t          g_sync_lock = PTHREAD_MUTEX_INITIALIZER; // used to sync thread
 static struct cmd_line_args     g_cmd_line_args = COMMAND_LINE_ARGS_INITIALIZER;
 static struct thread_params     g_thread_parameters[SKIQ_MAX_NUM_CARDS] = INIT_ARRAY(SKIQ_MAX_NUM_CARDS, THREAD_PARAMS_INITIALIZER);
+static struct rt_thread_config  g_rt_config = RT_THREAD_CONFIG_INITIALIZER;
 
 /* running is written to true here and only here.
    Setting 'running' to false will cause the threads to close and the 
@@ -487,6 +711,9 @@ static struct thread_params     g_thread_parameters[SKIQ_MAX_NUM_CARDS] = INIT_A
 */
 static volatile bool g_running=true;
 
+/* incremented by the SIGUSR1 handler, every change is a software trigger */
+static uint32_t g_nr_trigger_signals = 0;
+
 
 /*************************** COMMAND LINE VARIABLES ***************************/
 /******************************************************************************/
@@ -526,6 +753,57 @@ Defaults:\n\
   --trigger-src="xstr(DEFAULT_TRIGGER_SRC) "\n\
   --bandwidth="xstr(DEFAULT_RX_BW) "\n\
   --words="xstr(DEFAULT_NUM_SAMPLES) "\n\
+  --workers="xstr(DEFAULT_NR_WORKERS) " (one per online CPU)\n\
+  --ring-trigger="DEFAULT_RING_TRIGGER "\n\
+  --captures="xstr(DEFAULT_NR_CAPTURES) "\n\
+  --threshold="xstr(DEFAULT_THRESHOLD_DBFS) "\n\
+  --hugepages="DEFAULT_HUGEPAGES "\n\
+" RT_THREAD_HELP_DEFAULTS "\
+\n\
+   The receive thread of the Nth card is thread N for --cpus, its capture\n\
+   buffers are allocated on the NUMA node of that CPU unless --numa-node is\n\
+   given.  The worker threads of --pipeline are not pinned.\n\
+\n\
+   The capture buffers of each card come from a single arena that is faulted\n\
+   in and locked into RAM before streaming starts, backed by 1 GB or 2 MB\n\
+   hugepages when they are reserved (--hugepages=auto picks 1 GB pages for\n\
+   captures of at least 1 GB).  Without reserved hugepages the arena falls\n\
+   back to normal pages.\n\
+\n\
+   With --pipeline, each card's receive thread only copies the received blocks\n\
+   into the capture buffers; counter verification, unpacking and file output\n\
+   for every handle run concurrently on a shared pool of worker threads\n\
+   (--workers) while the capture is in progress.  The blocks of each handle are\n\
+   still verified and written in order.  Since the output files are written\n\
+   during the capture, they are not discarded if a later error occurs.\n\
+\n\
+   With --pretrigger=N, every handle streams continuously into a ring in\n\
+   memory holding twice the capture window, and each trigger (--ring-trigger)\n\
+   freezes the N samples received before it and the --words samples from it\n\
+   on, rounded to whole blocks.  The window is appended to the output file\n\
+   by a writer thread while streaming goes on, so the samples before the\n\
+   event are never missed and the trigger costs no stream start.  The\n\
+   windows of all the handles of a card start at the same system time.\n\
+   Triggers are:\n\
+     signal   SIGUSR1 sent to the application (kill -USR1 <pid>)\n\
+     1pps     the next 1PPS edge\n\
+     energy   the start of a burst whose mean power reaches --threshold\n\
+              dBFS, a burst ends "xstr(BURST_DETECT_DEFAULT_HYSTERESIS) " dB below it\n\
+   --captures windows are written before exiting (0 for until Ctrl-C);\n\
+   triggers arriving while a window is written are ignored.  --pretrigger\n\
+   conflicts with --pipeline and --perform-verify, and --trigger-src still\n\
+   selects when streaming starts.\n\
+\n\
+   Without --blocking, each receive thread polls skiq_receive() and keeps a\n\
+   core busy whatever the sample rate.  With --event-driven it sleeps until\n\
+   its card signals blocks instead (on transports that can't, until enough\n\
+   blocks have accumulated), so the CPU used follows the data rate.\n\
+\n\
+   With --index, every output file also gets a <file>.idx block index mapping\n\
+   the RF and system timestamps of each block to its offset in the file, and a\n\
+   <file>.sigmf-meta SigMF description annotating timestamp gaps and RF\n\
+   overload.  The --pretrigger windows appended to a file show up as gaps.\n\
+   See capture_index.h for the formats.\n\
 ";
 
 /* the command line arguments available to this application */
@@ -612,6 +890,12 @@ static struct application_argument p_args[] =
                 NULL,
                 &g_cmd_line_args.include_meta,
                 BOOL_VAR_TYPE),
+    APP_ARG_OPT("index",
+                0,
+                "Write a block index and SigMF metadata next to each output file",
+                NULL,
+                &g_cmd_line_args.index,
+                BOOL_VAR_TYPE),
     APP_ARG_OPT("packed",
                 0,
                 "Use packed mode for I/Q samples",
@@ -624,6 +908,12 @@ static struct application_argument p_args[] =
                 NULL,
                 &g_cmd_line_args.blocking_rx,
                 BOOL_VAR_TYPE),
+    APP_ARG_OPT("event-driven",
+                0,
+                "Sleep until the card signals blocks instead of polling skiq_receive",
+                NULL,
+                &g_cmd_line_args.event_driven,
+                BOOL_VAR_TYPE),
     APP_ARG_OPT("disable-dc",
                 0,
                 "Disable DC offset correction",
@@ -643,6 +933,44 @@ static struct application_argument p_args[] =
                 NULL,
                 &g_cmd_line_args.i_then_q,
                 BOOL_VAR_TYPE),
+    APP_ARG_OPT("pipeline",
+                0,
+                "Verify and write samples on a pool of worker threads while receiving",
+                NULL,
+                &g_cmd_line_args.pipeline,
+                BOOL_VAR_TYPE),
+    APP_ARG_OPT("workers",
+                0,
+                "Number of worker threads used by --pipeline (0 for one per online CPU)",
+                "N",
+                &g_cmd_line_args.nr_workers,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("pretrigger",
+                0,
+                "Stream into a ring and keep N samples before each trigger",
+                "N",
+                &g_cmd_line_args.pretrigger,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("ring-trigger",
+                0,
+                "Event that freezes a --pretrigger window",
+                "[\"signal\",\"1pps\",\"energy\"]",
+                &g_cmd_line_args.p_ring_trigger,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("threshold",
+                0,
+                "Burst power that fires --ring-trigger=energy",
+                "dBFS",
+                &g_cmd_line_args.threshold,
+                DOUBLE_VAR_TYPE),
+    APP_ARG_OPT("captures",
+                0,
+                "Number of --pretrigger windows to write (0 for until interrupted)",
+                "N",
+                &g_cmd_line_args.nr_captures,
+                UINT32_VAR_TYPE),
+    MEM_ARENA_APP_ARG(&g_cmd_line_args.p_hugepages),
+    RT_THREAD_APP_ARGS(&g_rt_config),
     APP_ARG_TERMINATOR,
 };
 
@@ -886,6 +1214,24 @@ iq_order_desc_cstr( skiq_iq_order_t order )
 }
 
 
+/*****************************************************************************/
+/** Convert enum ring_trigger constant to string representation
+
+    @param[in] trigger: enum ring_trigger
+
+    @return char*: string representation of the trigger
+*/
+static const char *
+ring_trigger_cstr( enum ring_trigger trigger )
+{
+    return \
+        (trigger == ring_trigger_signal) ? "signal" :
+        (trigger == ring_trigger_1pps) ? "1pps" :
+        (trigger == ring_trigger_energy) ? "energy" :
+        "unknown";
+}
+
+
 #ifdef VERBOSE
 /*****************************************************************************/
 /** Dump rconfig to console for debugging
@@ -903,6 +1249,7 @@ dump_rconfig(const struct radio_config *p_rconfig)
         printf("\nDEBUG: rconfig dump");
         printf("\nDEBUG: number of cards   %" PRIu8,  p_rconfig->num_cards );
         printf("\nDEBUG: blocking_rx:      %s",       p_rconfig->blocking_rx      ? "true" : "false");
+        printf("\nDEBUG: event_driven:     %s",       p_rconfig->event_driven     ? "true" : "false");
         printf("\nDEBUG: all_chans:        %s",       p_rconfig->all_chans        ? "true" : "false");
         printf("\nDEBUG: packed:           %s",       p_rconfig->packed           ? "true" : "false");
         printf("\nDEBUG: use_counter:      %s",       p_rconfig->use_counter      ? "true" : "false");
@@ -1011,104 +1358,6 @@ print_block_contents( skiq_rx_block_t* p_block,
                block_size_in_bytes - SKIQ_RX_HEADER_SIZE_IN_BYTES );
 }
 
-/*****************************************************************************/
-/** This function performs sign extension for the 12-bit value passed in.
-
-    @param[in]: 12-bit value to be sign extended
-
-    @return:    sign extended representation of value passed in
-*/
-static int16_t 
-sign_extend( int16_t in )
-{
-    int16_t out=0;
-
-    if( in & 0x800 )
-    {
-        out = in | 0xF000;
-    }
-    else
-    {
-        out = in;
-    }
-
-    return out;
-}
-
-/*****************************************************************************/
-/** This unpacks the sample data, packed as 12-bits and unpacked to 16-bits.
-
-    @param[in]  *packed_data:         pointer to packed data
-    @param[out] *unpacked_data:       pointer to unpacked data
-    @param[in]  num_unpacked_samples: number of samples contained in sample data
-    @param[in]  block_size_in_words:  block size in words
-    @param[in]  include_meta:         set to include meta data
-
-    @return:    sign extended representation of value passed in
-*/
-static void 
-unpack_data( int16_t  *packed_data,
-             int16_t  *unpacked_data,
-             uint32_t num_unpacked_samples,
-             int32_t  block_size_in_words,
-             bool     include_meta)
-{
-    uint32_t num_samples=0;
-    uint32_t packed_offset=0;
-
-    if( include_meta == true )
-    {
-        packed_offset += SKIQ_RX_HEADER_SIZE_IN_WORDS;
-    }
-
-    // loop through all the samples and unpack them
-    for( num_samples=0; num_samples < (num_unpacked_samples*2); num_samples+=8 )
-    {
-        int32_t *data;
-
-        // determine if the metadata needs to be skipped over in the unpacking
-        if( (include_meta == true) && ((packed_offset % (block_size_in_words-1))==0) )
-        {
-            // increment over the header
-            packed_offset += SKIQ_RX_HEADER_SIZE_IN_WORDS;
-        }
-        data = (int32_t*)(&(packed_data[packed_offset*2]));
-
-        /* When the mode is set to true, then the 12-bit samples are packed in to make optimal use of the available bits,
-           and packed as follows:
-                    -31-------------------------------------------------------0-
-            word 0 |I0b11|...|I0b0|Q0b11|.................|Q0b0|I1b11|...|I1b4|
-                    ------------------------------------------------------------
-            word 1 |I1b3|...|I1b0|Q1b11|...|Q1b0|I2b11|...|I2b0|Q2b11|...|Q2b8|
-                    -31-------------------------------------------------------0-
-            word 2 |Q2b7|...|Q2b0|I3b11|.................|I3b0|Q1311|....|Q3b4|
-                    ------------------------------------------------------------
-        */
-        // unpack the data - save the unpacked data
-        // q0 = bits 19(inclusive) - 8(inclusive) of word 0
-        unpacked_data[num_samples] = sign_extend((data[0] & 0x000FFF00) >> 8);
-        // i0 = bits 31(inclusive) - 20(inclusive) of word 0
-        unpacked_data[num_samples+1] = sign_extend((data[0] & 0xFFF00000) >> 20);
-        // q1 = bits 27(inclusive) - 16(inclusive) of word 1
-        unpacked_data[num_samples+2] = sign_extend((data[1] & 0x0FFF0000) >> 16);
-        // l1 = bits 7(inclusive) - 0(inclusive) of word 0 with bits 31(inclusive) - 28(inclusive) or word 1
-        unpacked_data[num_samples+3] = sign_extend(((data[0] & 0x000000FF) << 4) | ((data[1] & 0xF0000000)>>28));
-        // q2 = bits 3(inclusive) - 0(inclusive) of word 1 with bits 31(inclusive) - 24(inclusive) of word 2
-        unpacked_data[num_samples+4] = sign_extend(((data[1] & 0x0000000F) << 8) | ((data[2] & 0xFF000000) >> 24));
-        // i2 = bits 15(inclusive) to 4(inclusive)
-        unpacked_data[num_samples+5] = sign_extend((data[1] & 0x0000FFF0) >> 4);
-        // q3 = lower 12 bits of word 2
-        unpacked_data[num_samples+6] = sign_extend((data[2] & 0x00000FFF));
-        // i3 = bits 23(inclusive) - 12 of word 2
-        unpacked_data[num_samples+7] = sign_extend(((data[2] & 0x00FFF000) >> 12));
-
-        // every 3 words of data contain 4 samples in packed mode
-        packed_offset += 3;
-    }
-
-}
-
-
 /************************ VERIFICATION FUNCTIONS *****************************/
 /*****************************************************************************/
 
@@ -1160,7 +1409,8 @@ verify_data( uint8_t     card,
             printf("Info: card %" PRIu8 " verifying counter data, number of samples %" PRIu32 " (RX resolution %" PRIu8 " bits) for handle %s\n", 
                     card, num_samps, rx_resolution, p_hdl_str);
 
-            if( include_meta == true )
+            /* unpacked copies of packed captures never include the metadata */
+            if( (include_meta == true) && (packed == false) )
             {
                 offset = (SKIQ_RX_HEADER_SIZE_IN_WORDS*2);
             }
@@ -1547,6 +1797,7 @@ get_all_handles( uint8_t card,
         use_counter      (set to p_cmd_line_args->use_counter)
         disable_dc_corr  (set to p_cmd_line_args->disable_dc_corr)
         blocking_rx      (set to p_cmd_line_args->blocking_rx)
+        event_driven     (set to p_cmd_line_args->event_driven)
         iq_swap          (set to p_cmd_line_args->iq_swap)
         rx_gain_manual   (set to p_cmd_line_args->rx_gain_manual)
         gain             (set to p_cmd_line_args->rx_gain)
@@ -1572,6 +1823,7 @@ map_arguments_to_radio_config(  const struct cmd_line_args *p_cmd_line_args,
     p_rconfig->use_counter      = p_cmd_line_args->use_counter;
     p_rconfig->disable_dc_corr  = p_cmd_line_args->disable_dc_corr;
     p_rconfig->blocking_rx      = p_cmd_line_args->blocking_rx;
+    p_rconfig->event_driven     = p_cmd_line_args->event_driven;
     p_rconfig->rx_gain_manual   = p_cmd_line_args->rx_gain_manual;
     p_rconfig->rx_gain          = p_cmd_line_args->rx_gain;
 
@@ -1695,6 +1947,37 @@ map_arguments_to_radio_config(  const struct cmd_line_args *p_cmd_line_args,
         fprintf(stderr, "Error: --perform-verify conflicts with --trigger-src=immediate\n");
         status = ERROR_COMMAND_LINE;
     }
+    if ( p_cmd_line_args->blocking_rx && p_cmd_line_args->event_driven )
+    {
+        fprintf(stderr, "Error: --blocking conflicts with --event-driven\n");
+        status = ERROR_COMMAND_LINE;
+    }
+    if ( p_cmd_line_args->pretrigger > 0 )
+    {
+        if ( p_cmd_line_args->pipeline || p_cmd_line_args->perform_verify )
+        {
+            fprintf(stderr, "Error: --pretrigger conflicts with --pipeline and --perform-verify\n");
+            status = ERROR_COMMAND_LINE;
+        }
+        if ( ( 0 != strcasecmp( p_cmd_line_args->p_ring_trigger, "signal" ) ) &&
+             ( 0 != strcasecmp( p_cmd_line_args->p_ring_trigger, "1pps" ) ) &&
+             ( 0 != strcasecmp( p_cmd_line_args->p_ring_trigger, "energy" ) ) )
+        {
+            fprintf(stderr, "Error: invalid ring trigger '%s' specified\n",
+                    p_cmd_line_args->p_ring_trigger);
+            status = ERROR_COMMAND_LINE;
+        }
+    }
+    {
+        enum mem_arena_pages pages;
+
+        if ( 0 != mem_arena_parse_pages( p_cmd_line_args->p_hugepages, &pages ) )
+        {
+            fprintf(stderr, "Error: invalid hugepage size '%s' specified\n",
+                    p_cmd_line_args->p_hugepages);
+            status = ERROR_COMMAND_LINE;
+        }
+    }
 
 
     if ( (status == 0) && (p_cmd_line_args->p_pps_source != NULL) )
@@ -2023,6 +2306,8 @@ configure_radio( uint8_t card,
     @param[in]  card:         card #
     @param[in]  *handle_str:  pointer to handle string
     @param[in]  *p_file_path: pointer to file path string
+    @param[out] *p_index:     block index of the file, left closed if p_meta is NULL
+    @param[in]  *p_meta:      description of the capture for the index, NULL for no index
 
     @return status: indicating status
 */
@@ -2030,7 +2315,9 @@ static int32_t
 open_files( FILE **output_fp, 
             uint8_t card, 
             const char *handle_str, 
-            const char *p_file_path  )
+            const char *p_file_path,
+            struct capture_index *p_index,
+            const struct capture_meta *p_meta )
 {
     char p_filename[OUTPUT_PATH_MAX];
     const char *dev_prefix = "/dev/";
@@ -2066,10 +2353,88 @@ open_files( FILE **output_fp,
     printf("Info: card %" PRIu8 " opened file %s for output\n", 
             card, p_filename);
 
+    if ( p_meta != NULL )
+    {
+        int32_t status = capture_index_open( p_index, p_filename, p_meta );
+
+        if ( status != 0 )
+        {
+            fprintf(stderr, "Error: card %" PRIu8 " unable to open the index of output file %s"
+                    " (%" PRIi32 ": '%s')\n", card, p_filename, status, strerror(-status));
+            return status;
+        }
+    }
+
     return 0;
 }
 
 
+/******************************************************************************/
+/** Describe the captures of a card for their block index.
+
+    @param[out] *p_meta:      capture description
+    @param[in]  *p_rconfig:   pointer to the radio config
+    @param[in]  include_meta: true if the blocks are stored with their metadata
+
+    @return void
+*/
+static void
+capture_meta_init( struct capture_meta *p_meta,
+                   const struct radio_config *p_rconfig,
+                   bool include_meta )
+{
+    memset( p_meta, 0, sizeof(*p_meta) );
+    p_meta->p_recorder = "sidekiq rx_samples_on_trigger";
+    p_meta->p_hw = NULL;
+    p_meta->sample_rate = p_rconfig->sample_rate;
+    p_meta->frequency = p_rconfig->lo_freq;
+    p_meta->include_meta = include_meta;
+    p_meta->packed = p_rconfig->packed;
+    p_meta->iq_order = ( p_rconfig->iq_order_mode == skiq_iq_order_iq );
+    p_meta->compressed = false;
+}
+
+
+/******************************************************************************/
+/** Close the block index of an output file - called from thread.
+
+    @param[in] *p_index:      block index
+    @param[in] card:          card #
+    @param[in] *handle_str:   pointer to handle string
+    @param[in] written:       false if the samples never made it to the file, the
+                              index is emptied so it doesn't point past its end
+
+    @return int32_t:          0 on success, else a negative errno
+*/
+static int32_t
+close_index( struct capture_index *p_index,
+             uint8_t card,
+             const char *handle_str,
+             bool written )
+{
+    int32_t status;
+
+    if ( !written )
+    {
+        capture_index_reset( p_index );
+    }
+    status = capture_index_close( p_index );
+    if ( status != 0 )
+    {
+        fprintf(stderr, "Error: card %" PRIu8 " failed to write the index of handle %s"
+                " (%" PRIi32 ": '%s')\n", card, handle_str, status, strerror(-status));
+    }
+    else if ( p_index->data_path[0] != '\0' )
+    {
+        printf("Info: card %" PRIu8 " indexed %" PRIu64 " blocks for handle %s (%" PRIu64
+               " timestamp gaps, %" PRIu64 " overloaded blocks)\n", card, p_index->nr_records,
+               handle_str, p_index->nr_gaps, p_index->nr_overloaded_blocks);
+    }
+
+    return status;
+}
+
+
 /******************************** THREADS *************************************/
 /******************************************************************************/
 
@@ -2098,69 +2463,321 @@ update_rx_stats( struct rx_stats *p_rx_stats,
 
 
 /******************************************************************************/
-/** This is the main function for receiving data for a specific card.
+/** Verify and write a chunk of received blocks - called from the pool, the
+    chunks of a handle are always processed in order
 
-    @param[in/out] *params: thread params structure
+    @param[in] *p_arg:  pointer to struct rx_chunk
 
-    @return void*:          indicating status
+    @return void
 */
-static void *receive_card( void *params )
+static void
+pipeline_process_chunk( void *p_arg )
 {
-    struct thread_params *p_thread_params = params;
-
-    // Declare the read only parameters const.       
-    const struct    radio_config *p_rconfig           = p_thread_params->p_rconfig;
-    const uint8_t   card                              = p_rconfig->cards[p_thread_params->card_index];
-    const uint32_t  num_payload_words_to_acquire      = p_thread_params->num_payload_words_to_acquire;
-    const char*     p_file_path                       = p_thread_params->p_file_path;
-    const bool      include_meta                      = p_thread_params->include_meta;
-    const bool      perform_verify                    = p_thread_params->perform_verify;
+    struct rx_chunk *p_chunk = (struct rx_chunk *)p_arg;
+    struct rx_pipeline *p_pipe = p_chunk->p_pipe;
+    int32_t status = 0;
 
-    /* variables that need to be tracked per rx handle */
-    struct thread_variables tv[skiq_rx_hdl_end] = { [0 ... (skiq_rx_hdl_end-1)] = THREAD_VARIABLES_INITIALIZER };
-    struct rx_stats rx_stats[skiq_rx_hdl_end] = { [0 ... (skiq_rx_hdl_end-1)] = RX_STATS_INITIALIZER };
+    /* stop processing the handle after the first error */
+    if ( p_pipe->status != 0 )
+    {
+        return;
+    }
 
-    /* pointer to file to save the samples */
+    if ( p_pipe->verify )
+    {
+        if ( p_pipe->packed )
+        {
+            /* block_size_in_words is already the stride in the capture buffer, without the
+               headers unless they are kept */
+            uint32_t header_words = p_pipe->include_meta ? SKIQ_RX_HEADER_SIZE_IN_WORDS : 0;
+
+            iq_unpack_blocks( p_chunk->p_words, p_pipe->p_unpacked, p_chunk->nr_samples,
+                              p_pipe->block_size_in_words, header_words );
+            status = rx_verify_samples( &(p_pipe->verifier), p_pipe->p_unpacked,
+                                        p_chunk->nr_samples );
+        }
+        else
+        {
+            uint32_t header_words = p_pipe->include_meta ? SKIQ_RX_HEADER_SIZE_IN_WORDS : 0;
 
-    int32_t  num_blocks                 = 0;
-    int32_t  block_size_in_words        = 0;
-    uint32_t payload_words              = 0;
-    uint32_t num_words_read             = 0;
-    uint32_t num_blocks_received        = 0;
-    uint8_t  num_hdl_rcv                = 0;
-    int32_t  status                     = 0;
-    uint32_t num_words_written          = 0;
-    skiq_rx_stream_mode_t stream_mode   = skiq_rx_stream_mode_high_tput;
-    skiq_rx_hdl_t curr_rx_hdl           = skiq_rx_hdl_end;
+            status = rx_verify_blocks( &(p_pipe->verifier), (const int16_t *)p_chunk->p_words,
+                                       p_chunk->nr_samples, p_pipe->block_size_in_words,
+                                       header_words );
+        }
 
-    uint8_t i;
-    uint32_t len;                    // length (in bytes) of received data
-    skiq_rx_status_t rx_status;
-    skiq_rx_block_t* p_rx_block;
+        if ( status != 0 )
+        {
+            fprintf(stderr, "Error: at sample %" PRIu64 ", expected 0x%x but got 0x%x for"
+                    " handle %s\n", p_pipe->verifier.mismatch_sample,
+                    (uint16_t)p_pipe->verifier.mismatch_expected,
+                    (uint16_t)p_pipe->verifier.mismatch_got, p_pipe->p_hdl_str);
+            status = ERROR_COMMAND_LINE;
+        }
+    }
 
-    /* initialize rx_stats for each handle, regardless if it's been requested or not */
-    for ( i = 0; i < p_rconfig->nr_handles[card]; i++ )
+    if ( ( status == 0 ) && ( p_pipe->output_fp != NULL ) )
     {
-        skiq_rx_hdl_t hdl;
-        hdl = p_rconfig->handles[card][i];
-
-        rx_stats[hdl].nr_blocks_to_write = num_payload_words_to_acquire;
+        size_t num_words_written = fwrite( p_chunk->p_words, sizeof(uint32_t),
+                                           p_chunk->nr_words, p_pipe->output_fp );
 
-        /******************************* open files *******************************/
-        status = open_files(&tv[hdl].output_fp, card, hdl_cstr(hdl), p_file_path);
-        if(status != 0)
+        p_pipe->nr_words_written += num_words_written;
+        if ( num_words_written < p_chunk->nr_words )
         {
-            g_running = false; // Signal system that we have an error and need to stop
-            goto thread_exit;
+            fprintf(stderr, "Error: card %" PRIu8 " attempted to write %" PRIu32
+                    " words to output file for hdl %s but only wrote %" PRIu32 "\n",
+                    p_pipe->card, p_chunk->nr_words, p_pipe->p_hdl_str,
+                    (uint32_t)num_words_written);
+            status = -EIO;
         }
     }
 
-    /************************* calculate buffer sizes *************************/
-    /* read the expected RX block size and convert to 
-       number of words: ( words = bytes / 4 )
-    */
-    block_size_in_words = skiq_read_rx_block_size( card, stream_mode ) / 4;
-    if ( block_size_in_words < 0 )
+    p_pipe->status = status;
+}
+
+
+/******************************************************************************/
+/** Prepare the processing pipeline of a handle - called from thread
+
+    @param[out] *p_pipe:            pointer to the handle's pipeline
+    @param[in]  *p_pool:            pool that processes the chunks
+    @param[in]  card:               card id
+    @param[in]  hdl:                handle
+    @param[in]  *output_fp:         output file of the handle
+    @param[in]  *p_rx_data:         start of the handle's capture buffer
+    @param[in]  num_blocks:         number of blocks that will be received
+    @param[in]  block_size_in_words: stride between blocks in the capture buffer
+    @param[in]  payload_words:      number of samples in a complete block
+    @param[in]  include_meta:       true if the capture buffer contains metadata
+    @param[in]  *p_rconfig:         pointer to the radio config
+
+    @return int32_t:                0 on success, else a negative errno
+*/
+static int32_t
+pipeline_init( struct rx_pipeline *p_pipe,
+               struct work_pool *p_pool,
+               uint8_t card,
+               skiq_rx_hdl_t hdl,
+               FILE *output_fp,
+               uint32_t *p_rx_data,
+               uint32_t num_blocks,
+               int32_t block_size_in_words,
+               uint32_t payload_words,
+               bool include_meta,
+               const struct radio_config *p_rconfig )
+{
+    int32_t status;
+
+    memset( p_pipe, 0, sizeof(*p_pipe) );
+    p_pipe->card = card;
+    p_pipe->p_hdl_str = hdl_cstr(hdl);
+    p_pipe->output_fp = output_fp;
+    p_pipe->p_chunk_start = p_rx_data;
+    p_pipe->block_size_in_words = block_size_in_words;
+    p_pipe->include_meta = include_meta;
+    p_pipe->packed = p_rconfig->packed;
+    p_pipe->verify = p_rconfig->use_counter;
+
+    if ( p_pipe->verify )
+    {
+        uint8_t rx_resolution = 0;
+
+        status = skiq_read_rx_iq_resolution( card, &rx_resolution );
+        if ( ( status != 0 ) || ( rx_resolution == 0 ) )
+        {
+            fprintf(stderr, "Error: card %" PRIu8 " getting IQ resolution (status: %" PRIi32
+                    ", resolution %" PRIu8 ") for handle %s\n", card, status, rx_resolution,
+                    p_pipe->p_hdl_str);
+            return ERROR_CARD_CONFIGURATION;
+        }
+        /* the counter is expected in 'Q then I' order, the verifier swaps the pairs otherwise */
+        rx_verify_init( &(p_pipe->verifier), rx_resolution,
+                        (p_rconfig->iq_order_mode == skiq_iq_order_iq) );
+
+        if ( p_pipe->packed )
+        {
+            p_pipe->p_unpacked = calloc( (size_t)PIPELINE_CHUNK_BLOCKS * payload_words,
+                                         sizeof(uint32_t) );
+            if ( p_pipe->p_unpacked == NULL )
+            {
+                return ERROR_NO_MEMORY;
+            }
+        }
+    }
+
+    p_pipe->nr_chunks = ROUND_UP(num_blocks, PIPELINE_CHUNK_BLOCKS);
+    p_pipe->p_chunks = calloc( p_pipe->nr_chunks, sizeof(struct rx_chunk) );
+    if ( p_pipe->p_chunks == NULL )
+    {
+        free( p_pipe->p_unpacked );
+        p_pipe->p_unpacked = NULL;
+        return ERROR_NO_MEMORY;
+    }
+
+    /* prefer a different worker for each handle, idle workers steal as needed */
+    status = work_strand_init( &(p_pipe->strand), p_pool, WORK_POOL_ANY_WORKER );
+    if ( status != 0 )
+    {
+        free( p_pipe->p_chunks );
+        p_pipe->p_chunks = NULL;
+        free( p_pipe->p_unpacked );
+        p_pipe->p_unpacked = NULL;
+    }
+
+    return status;
+}
+
+
+/******************************************************************************/
+/** Account for a block copied into the capture buffer and hand the chunk to
+    the pool once it is complete - called from thread
+
+    @param[in] *p_pipe:         pointer to the handle's pipeline
+    @param[in] *p_next_write:   capture buffer position after the block
+    @param[in] nr_samples:      number of samples in the block
+    @param[in] last_block:      true if this is the last block for the handle
+
+    @return int32_t:            0 on success, else a negative errno
+*/
+static int32_t
+pipeline_block_added( struct rx_pipeline *p_pipe,
+                      uint32_t *p_next_write,
+                      uint32_t nr_samples,
+                      bool last_block )
+{
+    struct rx_chunk *p_chunk;
+
+    p_pipe->chunk_nr_blocks++;
+    p_pipe->chunk_nr_samples += nr_samples;
+    if ( ( p_pipe->chunk_nr_blocks < PIPELINE_CHUNK_BLOCKS ) && !last_block )
+    {
+        return 0;
+    }
+
+    if ( p_pipe->next_chunk >= p_pipe->nr_chunks )
+    {
+        return ERROR_BLOCK_SIZE;
+    }
+
+    p_chunk = &(p_pipe->p_chunks[p_pipe->next_chunk++]);
+    p_chunk->p_pipe = p_pipe;
+    p_chunk->p_words = p_pipe->p_chunk_start;
+    p_chunk->nr_words = (uint32_t)(p_next_write - p_pipe->p_chunk_start);
+    p_chunk->nr_samples = p_pipe->chunk_nr_samples;
+
+    p_pipe->p_chunk_start = p_next_write;
+    p_pipe->chunk_nr_blocks = 0;
+    p_pipe->chunk_nr_samples = 0;
+
+    return work_strand_submit( &(p_pipe->strand), pipeline_process_chunk, p_chunk );
+}
+
+
+/******************************************************************************/
+/** Wait for the outstanding chunks of a handle and release the pipeline -
+    called from thread.  Safe to call on a pipeline that was never initialized.
+
+    @param[in] *p_pipe:  pointer to the handle's pipeline
+
+    @return void
+*/
+static void
+pipeline_free( struct rx_pipeline *p_pipe )
+{
+    if ( p_pipe->p_chunks != NULL )
+    {
+        work_strand_wait( &(p_pipe->strand) );
+        work_strand_destroy( &(p_pipe->strand) );
+        free( p_pipe->p_chunks );
+        p_pipe->p_chunks = NULL;
+    }
+    free( p_pipe->p_unpacked );
+    p_pipe->p_unpacked = NULL;
+}
+
+
+/******************************************************************************/
+/** This is the main function for receiving data for a specific card.
+
+    @param[in/out] *params: thread params structure
+
+    @return void*:          indicating status
+*/
+static void *receive_card( void *params )
+{
+    struct thread_params *p_thread_params = params;
+
+    // Declare the read only parameters const.       
+    const struct    radio_config *p_rconfig           = p_thread_params->p_rconfig;
+    const uint8_t   card                              = p_rconfig->cards[p_thread_params->card_index];
+    const uint32_t  num_payload_words_to_acquire      = p_thread_params->num_payload_words_to_acquire;
+    const char*     p_file_path                       = p_thread_params->p_file_path;
+    const bool      include_meta                      = p_thread_params->include_meta;
+    const bool      perform_verify                    = p_thread_params->perform_verify;
+    struct work_pool* const p_pool                    = p_thread_params->p_pool;
+
+    /* variables that need to be tracked per rx handle */
+    struct thread_variables tv[skiq_rx_hdl_end] = { [0 ... (skiq_rx_hdl_end-1)] = THREAD_VARIABLES_INITIALIZER };
+    struct rx_stats rx_stats[skiq_rx_hdl_end] = { [0 ... (skiq_rx_hdl_end-1)] = RX_STATS_INITIALIZER };
+    struct rx_pipeline pipe[skiq_rx_hdl_end];
+
+    /* pointer to file to save the samples */
+
+    int32_t  num_blocks                 = 0;
+    int32_t  block_size_in_words        = 0;
+    uint32_t payload_words              = 0;
+    uint32_t num_words_read             = 0;
+    uint32_t num_blocks_received        = 0;
+    uint8_t  num_hdl_rcv                = 0;
+    int32_t  status                     = 0;
+    uint32_t num_words_written          = 0;
+    uint64_t block_offset               = 0;
+    uint32_t block_samples              = 0;
+    skiq_rx_stream_mode_t stream_mode   = skiq_rx_stream_mode_high_tput;
+    skiq_rx_hdl_t curr_rx_hdl           = skiq_rx_hdl_end;
+
+    uint8_t i;
+    uint32_t len;                    // length (in bytes) of received data
+    skiq_rx_status_t rx_status;
+    skiq_rx_block_t* p_rx_block;
+    size_t rx_data_size = 0;         // size (in bytes) of each capture buffer
+    struct mem_arena arena = MEM_ARENA_INITIALIZER; // holds the capture buffers of every handle
+    struct rx_ready ready = RX_READY_INITIALIZER;   // with --event-driven
+    uint8_t ready_cards[SKIQ_MAX_NUM_CARDS];
+    char p_thread_name[32];
+    struct capture_meta meta;
+
+    memset( pipe, 0, sizeof(pipe) );
+    capture_meta_init( &meta, p_rconfig, include_meta );
+
+    /* pin the thread before allocating so the capture buffers end up next to it */
+    snprintf( p_thread_name, sizeof(p_thread_name), "card %" PRIu8 " Rx", card );
+    (void)rt_thread_apply( &g_rt_config, pthread_self(), p_thread_params->card_index, true,
+                           p_thread_name );
+
+    /* initialize rx_stats for each handle, regardless if it's been requested or not */
+    for ( i = 0; i < p_rconfig->nr_handles[card]; i++ )
+    {
+        skiq_rx_hdl_t hdl;
+        hdl = p_rconfig->handles[card][i];
+
+        rx_stats[hdl].nr_blocks_to_write = num_payload_words_to_acquire;
+
+        /******************************* open files *******************************/
+        status = open_files(&tv[hdl].output_fp, card, hdl_cstr(hdl), p_file_path,
+                            &(tv[hdl].index), p_thread_params->index ? &meta : NULL);
+        if(status != 0)
+        {
+            g_running = false; // Signal system that we have an error and need to stop
+            goto thread_exit;
+        }
+    }
+
+    /************************* calculate buffer sizes *************************/
+    /* read the expected RX block size and convert to 
+       number of words: ( words = bytes / 4 )
+    */
+    block_size_in_words = skiq_read_rx_block_size( card, stream_mode ) / 4;
+    if ( block_size_in_words < 0 )
     {
         fprintf(stderr, "Error: Card %" PRIu8 " Failed to read RX block size for specified stream mode with status %" PRIi32 "\n", 
                 card, block_size_in_words);
@@ -2199,11 +2816,27 @@ static void *receive_card( void *params )
 
     /************************* buffer allocation ******************************/
     /* allocate memory to hold the data when it comes in */
+    rx_data_size = (size_t)block_size_in_words * num_blocks * sizeof(uint32_t);
+    snprintf( p_thread_name, sizeof(p_thread_name), "card %" PRIu8 " capture", card );
+    if ( 0 != mem_arena_init( &arena,
+                              p_rconfig->nr_handles[card] * MEM_ARENA_SLAB( rx_data_size,
+                                                                            MEM_ARENA_ALIGN ),
+                              p_thread_params->pages,
+                              rt_thread_node( &g_rt_config, p_thread_params->card_index ),
+                              p_thread_name ) )
+    {
+        fprintf(stderr,"Error: card %" PRIu8 " unable to map %" PRIu8 " capture buffer(s) of %zu"
+                " bytes\n", card, p_rconfig->nr_handles[card], rx_data_size);
+        status = ERROR_NO_MEMORY;
+        g_running = false; // Signal system that we have an error and need to stop
+        goto thread_close_files;
+    }
     for ( i = 0; i < p_rconfig->nr_handles[card]; i++ )
     {
         skiq_rx_hdl_t hdl;
         hdl = p_rconfig->handles[card][i];
-        tv[hdl].p_rx_data = (uint32_t*)calloc(block_size_in_words * num_blocks, sizeof(uint32_t));
+        /* the arena is already zeroed and faulted in */
+        tv[hdl].p_rx_data = (uint32_t*)mem_arena_alloc( &arena, rx_data_size, MEM_ARENA_ALIGN );
         if (tv[hdl].p_rx_data == NULL)
         {
             fprintf(stderr,"Error: card %" PRIu8 " didn't successfully allocate %" PRIi32 " words to hold"
@@ -2212,14 +2845,45 @@ static void *receive_card( void *params )
             g_running = false; // Signal system that we have an error and need to stop
             goto thread_close_files;
         }
-        memset( tv[hdl].p_rx_data, 0, block_size_in_words * num_blocks * sizeof(uint32_t) );
         tv[hdl].p_next_write = tv[hdl].p_rx_data;
         tv[hdl].p_rx_data_start = tv[hdl].p_rx_data;
         tv[hdl].rx_block_cnt = 0;
         tv[hdl].total_num_payload_words_acquired = 0;
     }
 
+    /* with a processing pool, the blocks are verified and written while receiving */
+    for ( i = 0; (p_pool != NULL) && (i < p_rconfig->nr_handles[card]); i++ )
+    {
+        skiq_rx_hdl_t hdl;
+        hdl = p_rconfig->handles[card][i];
+        status = pipeline_init( &(pipe[hdl]), p_pool, card, hdl, tv[hdl].output_fp,
+                                tv[hdl].p_rx_data_start, num_blocks, block_size_in_words,
+                                payload_words, include_meta, p_rconfig );
+        if ( status != 0 )
+        {
+            fprintf(stderr,"Error: card %" PRIu8 " failed to initialize the processing pipeline"
+                    " for hdl %s (status %" PRIi32 ")\n", card, hdl_cstr(hdl), status);
+            g_running = false; // Signal system that we have an error and need to stop
+            goto thread_stop_streaming;
+        }
+    }
+
     /************************** start Rx data flowing *************************/
+    if ( p_rconfig->event_driven && ( g_running == true ) )
+    {
+        status = rx_ready_init( &ready );
+        if ( status == 0 )
+        {
+            status = rx_ready_add( &ready, card, p_rconfig->sample_rate, payload_words );
+        }
+        if ( status != 0 )
+        {
+            fprintf(stderr,"Error: card %" PRIu8 " failed to set up receive readiness, status code"
+                    " %" PRIi32 "\n", card, status);
+            g_running = false; // Signal system that we have an error and need to stop
+        }
+    }
+
     if ( p_rconfig->trigger_src == skiq_trigger_src_1pps )
     {
         /* setup the timestamps to reset on the next PPS */
@@ -2318,6 +2982,11 @@ static void *receive_card( void *params )
                 num_words_read = (len/4); /* len is in bytes */
                 num_blocks_received++;
 
+                /* the blocks are stored back to back, so they reach the file at the
+                   offset at which they're copied into the capture buffer */
+                block_offset = (uint64_t)tv[curr_rx_hdl].words_received * sizeof(uint32_t);
+                block_samples = 0;
+
                 /* copy over all the data if this isn't the last block */
                 if( (tv[curr_rx_hdl].total_num_payload_words_acquired + payload_words) < num_payload_words_to_acquire )
                 {
@@ -2340,6 +3009,14 @@ static void *receive_card( void *params )
                     tv[curr_rx_hdl].total_num_payload_words_acquired += \
                         payload_words;
                     tv[curr_rx_hdl].rx_block_cnt++;
+                    block_samples = payload_words;
+
+                    if ( p_pool != NULL )
+                    {
+                        status = pipeline_block_added( &(pipe[curr_rx_hdl]),
+                                                       tv[curr_rx_hdl].p_next_write,
+                                                       payload_words, false );
+                    }
                 }
                 else
                 {
@@ -2389,6 +3066,39 @@ static void *receive_card( void *params )
                         tv[curr_rx_hdl].last_block = true;
 
                         tv[curr_rx_hdl].words_received += num_words_to_copy;
+                        block_samples = last_block_num_payload_words;
+
+                        if ( p_pool != NULL )
+                        {
+                            status = pipeline_block_added( &(pipe[curr_rx_hdl]),
+                                                           tv[curr_rx_hdl].p_next_write,
+                                                           last_block_num_payload_words, true );
+                        }
+                    }
+                }
+
+                if ( status != 0 )
+                {
+                    fprintf(stderr,"Error: card %" PRIu8 " failed to queue samples for processing"
+                            " for hdl %s (status %" PRIi32 ")\n", card, hdl_cstr(curr_rx_hdl),
+                            status);
+                    g_running = false; // Signal system that we have an error and need to stop
+                    goto thread_stop_streaming;
+                }
+
+                if ( block_samples > 0 )
+                {
+                    status = capture_index_add( &(tv[curr_rx_hdl].index),
+                                                p_rx_block->rf_timestamp,
+                                                p_rx_block->sys_timestamp, block_offset,
+                                                block_samples, p_rx_block->overload );
+                    if ( status != 0 )
+                    {
+                        fprintf(stderr,"Error: card %" PRIu8 " failed to index samples for hdl"
+                                " %s (status %" PRIi32 ")\n", card, hdl_cstr(curr_rx_hdl),
+                                status);
+                        g_running = false; // Signal system that we have an error and need to stop
+                        goto thread_stop_streaming;
                     }
                 }
             }
@@ -2402,6 +3112,10 @@ static void *receive_card( void *params )
             g_running = false; // Signal system that we have an error and need to stop
             goto thread_stop_streaming;
         }
+        else if ( ( skiq_rx_status_no_data == rx_status ) && p_rconfig->event_driven )
+        {
+            (void)rx_ready_wait( &ready, RX_READY_TIMEOUT_MS, ready_cards );
+        }
         else if (skiq_rx_status_no_data != rx_status)
         {
             //What to do here?
@@ -2434,8 +3148,37 @@ thread_stop_streaming: // Does not over write status
         }
     }
 
+    /* wait for the processing pool to finish verifying and writing each handle */
+    for ( i = 0; (p_pool != NULL) && (i < p_rconfig->nr_handles[card]); i++ )
+    {
+        skiq_rx_hdl_t hdl;
+        hdl = p_rconfig->handles[card][i];
+        pipeline_free( &(pipe[hdl]) );
+        /* a capture cut short leaves its last chunk unwritten */
+        tv[hdl].written = ( pipe[hdl].status == 0 ) && tv[hdl].last_block;
+        if ( (pipe[hdl].status != 0) && (status == 0) )
+        {
+            status = pipe[hdl].status;
+        }
+        else if ( (pipe[hdl].status == 0) && pipe[hdl].verify && (g_running == true) )
+        {
+            printf("Info: card %" PRIu8 " verification completed successfully for handle %s"
+                   " (%" PRIu64 " samples)\n", card, hdl_cstr(hdl),
+                   pipe[hdl].verifier.nr_samples);
+        }
+        if ( tv[hdl].output_fp != NULL )
+        {
+            (void)fflush(tv[hdl].output_fp);
+#if (defined __MINGW32__)
+            (void)_commit(fileno(tv[hdl].output_fp));
+#else
+            (void)fsync(fileno(tv[hdl].output_fp));
+#endif
+        }
+    }
+
     /* verify data if a counter was used instead of real I/Q data */
-    if ( (p_rconfig->use_counter == true) && (g_running==true) )
+    if ( (p_rconfig->use_counter == true) && (g_running==true) && (p_pool == NULL) )
     {
         int16_t *unpacked_data = NULL;
 
@@ -2450,14 +3193,14 @@ thread_stop_streaming: // Does not over write status
                 uint32_t header_words=0;
                 if( include_meta == true )
                 {
-                    header_words = tv[hdl].rx_block_cnt*SKIQ_RX_HEADER_SIZE_IN_WORDS;
+                    header_words = SKIQ_RX_HEADER_SIZE_IN_WORDS;
                 }
-                // allocate the memory
-                unpacked_data = calloc( num_samples + header_words, sizeof(int32_t) );
+                // allocate the memory, the unpacked samples do not include the metadata
+                unpacked_data = calloc( num_samples, sizeof(int32_t) );
                 if( unpacked_data != NULL )
                 {
-                    unpack_data( (int16_t*)(tv[hdl].p_rx_data_start), unpacked_data, num_samples, 
-                            block_size_in_words, include_meta);
+                    iq_unpack_blocks( tv[hdl].p_rx_data_start, unpacked_data, num_samples,
+                                      block_size_in_words, header_words );
                     tmp_status = verify_data(   card, 
                                                 unpacked_data, 
                                                 num_samples, 
@@ -2513,7 +3256,8 @@ thread_stop_streaming: // Does not over write status
         printf("Shutdown detected, skipping write to output files\n");
     }
 
-    for ( i = 0; (i < p_rconfig->nr_handles[card]) && (g_running == true) && (status == 0); i++ )
+    for ( i = 0; (i < p_rconfig->nr_handles[card]) && (g_running == true) && (status == 0) &&
+                 (p_pool == NULL); i++ )
     {
         skiq_rx_hdl_t hdl;
         hdl = p_rconfig->handles[card][i];
@@ -2539,6 +3283,10 @@ thread_stop_streaming: // Does not over write status
                     " words to output file but only wrote %" PRIu32  "\n", 
                     card, tv[hdl].words_received, num_words_written);
         }
+        else
+        {
+            tv[hdl].written = true;
+        }
         (void)fflush(tv[hdl].output_fp);
 #if (defined __MINGW32__)
         (void)_commit(fileno(tv[hdl].output_fp));
@@ -2554,12 +3302,11 @@ thread_stop_streaming: // Does not over write status
     {
         skiq_rx_hdl_t hdl;
         hdl = p_rconfig->handles[card][i];
-        if( tv[hdl].p_rx_data_start != NULL )
-        {
-            free(tv[hdl].p_rx_data_start);
-            tv[hdl].p_rx_data_start = NULL;
-        }
+        tv[hdl].p_rx_data_start = NULL;
+        tv[hdl].p_rx_data = NULL;
     }
+    mem_arena_print( &arena, p_thread_name );
+    mem_arena_free( &arena );
 
     /******************** verify timestamps *****************************/
     /* last timestamp received for each handle */
@@ -2602,6 +3349,7 @@ thread_stop_streaming: // Does not over write status
     }
 
 thread_close_files: // Does not over write status
+    rx_ready_close( &ready );
     for ( curr_rx_hdl = skiq_rx_hdl_A1; curr_rx_hdl < skiq_rx_hdl_end; curr_rx_hdl++)
     {
         if( tv[curr_rx_hdl].output_fp != NULL )
@@ -2609,16 +3357,577 @@ thread_close_files: // Does not over write status
             fclose( tv[curr_rx_hdl].output_fp );
             tv[curr_rx_hdl].output_fp = NULL;
         }
+        if ( ( close_index( &(tv[curr_rx_hdl].index), card, hdl_cstr(curr_rx_hdl),
+                            tv[curr_rx_hdl].written ) != 0 ) && ( status == 0 ) )
+        {
+            status = -EIO;
+        }
     }
+    /* already released unless the thread failed before writing the captures */
+    mem_arena_free( &arena );
 
 thread_exit:
     return (void *)(intptr_t)status;
 }
 
 
+/******************************************************************************/
+/** First block in a handle's ring received at or after a system timestamp -
+    called from thread.  The blocks are stored with their metadata.
+
+    @param[in] *p_ring:      pointer to the handle's ring
+    @param[in] sys_ts:       system timestamp of the trigger
+
+    @return uint64_t:        sequence number of the block, the head of the ring if
+                             every block in it is older
+*/
+static uint64_t
+ring_find_sys_ts( const struct pretrigger_ring *p_ring,
+                  uint64_t sys_ts )
+{
+    const uint64_t oldest = pretrigger_ring_oldest( p_ring );
+    uint64_t seq = p_ring->head;
+
+    while ( seq > oldest )
+    {
+        uint32_t len;
+        const skiq_rx_block_t *p_block = pretrigger_ring_block( p_ring, seq - 1, &len );
+
+        if ( p_block->sys_timestamp < sys_ts )
+        {
+            break;
+        }
+        seq--;
+    }
+
+    return seq;
+}
+
+
+/******************************************************************************/
+/** Write the frozen windows of a card's handles to their output files, releasing
+    each block of the rings as soon as it is written - runs as a thread.
+
+    @param[in] *params:  pointer to struct ring_writer
+
+    @return void*:       always NULL, errors are stored in the writer
+*/
+static void *
+ring_writer_thread( void *params )
+{
+    struct ring_writer *p_writer = params;
+
+    pthread_mutex_lock( &(p_writer->lock) );
+    while ( true )
+    {
+        uint8_t i;
+
+        while ( !p_writer->pending && !p_writer->exit )
+        {
+            pthread_cond_wait( &(p_writer->wake), &(p_writer->lock) );
+        }
+        if ( !p_writer->pending )
+        {
+            break;
+        }
+        pthread_mutex_unlock( &(p_writer->lock) );
+
+        for ( i = 0; i < p_writer->nr_handles; i++ )
+        {
+            struct ring_handle *p_rh = p_writer->p_handles[i];
+            uint64_t seq;
+
+            for ( seq = p_rh->window_start; seq < p_rh->window_end; seq++ )
+            {
+                uint32_t len, nr_words;
+                const uint8_t *p_block = pretrigger_ring_block( &(p_rh->ring), seq, &len );
+                const skiq_rx_block_t *p_rx_block = (const skiq_rx_block_t *)p_block;
+
+                nr_words = ( len - SKIQ_RX_HEADER_SIZE_IN_BYTES ) / sizeof(uint32_t);
+                if ( !p_writer->include_meta )
+                {
+                    p_block += SKIQ_RX_HEADER_SIZE_IN_BYTES;
+                    len -= SKIQ_RX_HEADER_SIZE_IN_BYTES;
+                }
+                if ( ( p_writer->status == 0 ) &&
+                     ( fwrite( p_block, 1, len, p_rh->output_fp ) != len ) )
+                {
+                    p_writer->status = -EIO;
+                }
+                else if ( ( p_writer->status == 0 ) &&
+                          ( capture_index_add( &(p_rh->index), p_rx_block->rf_timestamp,
+                                               p_rx_block->sys_timestamp, p_rh->nr_bytes_written,
+                                               p_writer->packed ?
+                                               SKIQ_NUM_PACKED_SAMPLES_IN_BLOCK( nr_words ) :
+                                               nr_words, p_rx_block->overload ) != 0 ) )
+                {
+                    p_writer->status = -EIO;
+                }
+                p_rh->nr_bytes_written += len;
+                pretrigger_ring_release( &(p_rh->ring), seq + 1 );
+            }
+            (void)fflush( p_rh->output_fp );
+            pretrigger_ring_release( &(p_rh->ring), PRETRIGGER_RING_NO_HOLD );
+        }
+
+        pthread_mutex_lock( &(p_writer->lock) );
+        p_writer->pending = false;
+        p_writer->nr_written++;
+    }
+    pthread_mutex_unlock( &(p_writer->lock) );
+
+    return NULL;
+}
+
+
+/******************************************************************************/
+/** Receive continuously into a pre-trigger ring per handle and write a window
+    around every trigger - called from thread in place of receive_card() when
+    --pretrigger is given.
+
+    @param[in] *params:  pointer to struct thread_params
+
+    @return void*:       status cast to a pointer
+*/
+static void *receive_card_ring( void *params )
+{
+    struct thread_params *p_thread_params = params;
+
+    const struct    radio_config *p_rconfig           = p_thread_params->p_rconfig;
+    const uint8_t   card                              = p_rconfig->cards[p_thread_params->card_index];
+    const bool      include_meta                      = p_thread_params->include_meta;
+
+    struct ring_handle rh[skiq_rx_hdl_end] = { [0 ... (skiq_rx_hdl_end-1)] = RING_HANDLE_INITIALIZER };
+    struct ring_writer writer = RING_WRITER_INITIALIZER;
+    bool writer_started = false;
+
+    int32_t  block_size_in_words        = 0;
+    uint32_t payload_words              = 0;
+    uint32_t pre_blocks                 = 0;
+    uint32_t post_blocks                = 0;
+    uint32_t nr_handed                  = 0;
+    uint32_t nr_captures                = 0;
+    uint64_t nr_ts_gaps                 = 0;
+    uint64_t nr_ignored                 = 0;
+    uint64_t event_sys_ts               = UINT64_MAX;
+    uint64_t sys_ts_freq                = 0;
+    uint64_t next_pps_poll              = 0;
+    uint64_t pps_base_sys_ts            = UINT64_MAX;
+    uint32_t signals_seen               = 0;
+    int16_t *p_scratch                  = NULL;
+    struct burst_event *p_events        = NULL;
+    struct rx_ready ready               = RX_READY_INITIALIZER;
+    uint8_t ready_cards[SKIQ_MAX_NUM_CARDS];
+    double   full_scale                 = 2048.0;
+    bool     capturing                  = false;
+    int32_t  status                     = 0;
+    skiq_rx_hdl_t curr_rx_hdl           = skiq_rx_hdl_end;
+    uint8_t  rx_resolution              = 0;
+
+    uint8_t i;
+    uint32_t len;                    // length (in bytes) of received data
+    skiq_rx_status_t rx_status;
+    skiq_rx_block_t* p_rx_block;
+    char p_thread_name[32];
+    struct capture_meta meta;
+
+    snprintf( p_thread_name, sizeof(p_thread_name), "card %" PRIu8 " Rx", card );
+    (void)rt_thread_apply( &g_rt_config, pthread_self(), p_thread_params->card_index, true,
+                           p_thread_name );
+    capture_meta_init( &meta, p_rconfig, include_meta );
+
+    block_size_in_words = skiq_read_rx_block_size( card, skiq_rx_stream_mode_high_tput ) / 4;
+    if ( block_size_in_words <= SKIQ_RX_HEADER_SIZE_IN_WORDS )
+    {
+        fprintf(stderr, "Error: Card %" PRIu8 " Failed to read RX block size (%" PRIi32 ")\n",
+                card, block_size_in_words);
+        status = ERROR_BLOCK_SIZE;
+        g_running = false; // Signal system that we have an error and need to stop
+        goto ring_exit;
+    }
+    if( p_rconfig->packed == true )
+    {
+        payload_words = SKIQ_NUM_PACKED_SAMPLES_IN_BLOCK((block_size_in_words-SKIQ_RX_HEADER_SIZE_IN_WORDS));
+    }
+    else
+    {
+        payload_words = block_size_in_words - SKIQ_RX_HEADER_SIZE_IN_WORDS;
+    }
+    pre_blocks = ROUND_UP(p_thread_params->pretrigger_words, payload_words);
+    post_blocks = ROUND_UP(p_thread_params->num_payload_words_to_acquire, payload_words);
+
+    (void)skiq_read_sys_timestamp_freq( card, &sys_ts_freq );
+    if ( ( skiq_read_rx_iq_resolution( card, &rx_resolution ) == 0 ) && ( rx_resolution > 1 ) )
+    {
+        full_scale = (double)( 1 << ( rx_resolution - 1 ) );
+    }
+    p_scratch = calloc( payload_words, 2 * sizeof(int16_t) );
+    p_events = calloc( 1 + ( payload_words / BURST_DETECT_DEFAULT_SEGMENT ),
+                       sizeof(struct burst_event) );
+
+    /* the ring holds the window twice over, so it can be written while the next one fills */
+    for ( i = 0; (i < p_rconfig->nr_handles[card]) && (status == 0); i++ )
+    {
+        skiq_rx_hdl_t hdl = p_rconfig->handles[card][i];
+
+        status = open_files( &(rh[hdl].output_fp), card, hdl_cstr(hdl),
+                             p_thread_params->p_file_path, &(rh[hdl].index),
+                             p_thread_params->index ? &meta : NULL );
+        if ( ( status == 0 ) && ( p_thread_params->ring_trigger == ring_trigger_energy ) )
+        {
+            status = burst_detect_init( &(rh[hdl].detector), BURST_DETECT_DEFAULT_SEGMENT,
+                                        BURST_DETECT_DEFAULT_SEGMENTS, p_thread_params->threshold,
+                                        p_thread_params->threshold - BURST_DETECT_DEFAULT_HYSTERESIS,
+                                        full_scale );
+            if ( status != 0 )
+            {
+                fprintf(stderr, "Error: card %" PRIu8 " unable to allocate the burst detector"
+                        " for handle %s\n", card, hdl_cstr(hdl));
+            }
+        }
+        if ( status == 0 )
+        {
+            status = pretrigger_ring_init( &(rh[hdl].ring), 2 * ( pre_blocks + post_blocks ),
+                                           block_size_in_words * sizeof(uint32_t) );
+            if ( status != 0 )
+            {
+                fprintf(stderr, "Error: card %" PRIu8 " unable to allocate the pre-trigger ring"
+                        " for handle %s\n", card, hdl_cstr(hdl));
+            }
+        }
+        if ( status == 0 )
+        {
+            (void)rx_continuity_init( &(rh[hdl].cont), hdl, p_rconfig->packed, rx_cont_fill_none,
+                                      0, 0 );
+        }
+        writer.p_handles[writer.nr_handles++] = &(rh[hdl]);
+    }
+    if ( ( status == 0 ) && ( ( p_scratch == NULL ) || ( p_events == NULL ) ) )
+    {
+        status = ERROR_NO_MEMORY;
+    }
+    if ( status != 0 )
+    {
+        g_running = false; // Signal system that we have an error and need to stop
+        goto ring_close;
+    }
+    printf("Info: card %" PRIu8 " keeping %" PRIu32 " block(s) before and %" PRIu32 " block(s)"
+           " from each trigger (%s), ring of %" PRIu32 " blocks per handle\n", card, pre_blocks,
+           post_blocks, ring_trigger_cstr( p_thread_params->ring_trigger ),
+           rh[p_rconfig->handles[card][0]].ring.nr_slots);
+
+    writer.include_meta = include_meta;
+    writer.packed = p_rconfig->packed;
+    if ( pthread_create( &(writer.thread), NULL, ring_writer_thread, &writer ) != 0 )
+    {
+        status = ERROR_NO_MEMORY;
+        g_running = false; // Signal system that we have an error and need to stop
+        goto ring_close;
+    }
+    writer_started = true;
+
+    if ( p_rconfig->event_driven && ( g_running == true ) )
+    {
+        status = rx_ready_init( &ready );
+        if ( status == 0 )
+        {
+            status = rx_ready_add( &ready, card, p_rconfig->sample_rate, payload_words );
+        }
+        if ( status != 0 )
+        {
+            fprintf(stderr,"Error: card %" PRIu8 " failed to set up receive readiness, status code"
+                    " %" PRIi32 "\n", card, status);
+            g_running = false; // Signal system that we have an error and need to stop
+        }
+    }
+
+    if ( p_rconfig->trigger_src == skiq_trigger_src_1pps )
+    {
+        status = skiq_write_timestamp_reset_on_1pps(card, 0);
+        if( status != 0 )
+        {
+            fprintf(stderr,"Error: card %" PRIu8 " failed to reset timestamp, status code %" PRIi32 "\n",
+                    card, status);
+            g_running = false; // Signal system that we have an error and need to stop
+        }
+    }
+
+    if( g_running == true )
+    {
+        pthread_mutex_lock(&g_sync_lock);
+        p_thread_params->init_complete = true;
+        pthread_cond_wait(&g_sync_start, &g_sync_lock);
+        pthread_mutex_unlock(&g_sync_lock);
+
+        status = skiq_start_rx_streaming_multi_on_trigger( card, (skiq_rx_hdl_t *)p_rconfig->handles[card],
+                                                           p_rconfig->nr_handles[card],
+                                                           p_rconfig->trigger_src, 0 );
+        if ( status == 0 )
+        {
+            printf("Info: card %" PRIu8 " streaming %u Rx handle(s) into the pre-trigger ring\n",
+                   card, p_rconfig->nr_handles[card]);
+        }
+        else
+        {
+            fprintf(stderr,"Error: card %" PRIu8 " receive streaming failed to start with status code %" PRIi32 "\n",
+                    card, status);
+            g_running = false; // Signal system that we have an error and need to stop
+        }
+    }
+    signals_seen = __atomic_load_n( &g_nr_trigger_signals, __ATOMIC_RELAXED );
+
+    while ( g_running == true )
+    {
+        struct ring_handle *p_rh;
+        bool burst_start;
+        bool armed;
+
+        rx_status = skiq_receive(card, &curr_rx_hdl, &p_rx_block, &len);
+        if ( skiq_rx_status_error_overrun == rx_status )
+        {
+            fprintf(stderr, "Warning: card %" PRIu8 " I/Q sample overrun detected\n", card);
+            for ( i = 0; i < skiq_rx_hdl_end; i++ )
+            {
+                rx_continuity_overrun( &(rh[i].cont) );
+            }
+            continue;
+        }
+        else if ( ( skiq_rx_status_no_data == rx_status ) && p_rconfig->event_driven )
+        {
+            (void)rx_ready_wait( &ready, RX_READY_TIMEOUT_MS, ready_cards );
+            continue;
+        }
+        else if ( ( skiq_rx_status_success != rx_status ) || ( p_rx_block == NULL ) )
+        {
+            continue;
+        }
+        if ( ( curr_rx_hdl >= skiq_rx_hdl_end ) || ( rh[curr_rx_hdl].output_fp == NULL ) )
+        {
+            fprintf(stderr,"Error: card %" PRIu8 " received unexpected data from unspecified hdl %u\n",
+                    card, curr_rx_hdl);
+            status = ERROR_UNEXPECTED_DATA_FROM_HANDLE;
+            g_running = false; // Signal system that we have an error and need to stop
+            break;
+        }
+        p_rh = &(rh[curr_rx_hdl]);
+
+        if ( rx_continuity_check_block( &(p_rh->cont), p_rx_block, len ) > rx_cont_first )
+        {
+            nr_ts_gaps++;
+        }
+
+        /* a full ring of held blocks drops the block, the writer can't keep up */
+        (void)pretrigger_ring_push( &(p_rh->ring), p_rx_block, len );
+
+        /* the detector sees every block so that its average is current when armed */
+        burst_start = false;
+        if ( p_thread_params->ring_trigger == ring_trigger_energy )
+        {
+            const int16_t *p_iq = (const int16_t *)p_rx_block->data;
+            uint32_t nr_events, e;
+
+            if ( p_rconfig->packed )
+            {
+                iq_unpack( (const uint32_t *)p_rx_block->data, p_scratch, payload_words );
+                p_iq = p_scratch;
+            }
+            nr_events = burst_detect_process( &(p_rh->detector), p_iq, payload_words,
+                                              p_rx_block->rf_timestamp, p_events,
+                                              1 + ( payload_words / BURST_DETECT_DEFAULT_SEGMENT ) );
+            for ( e = 0; e < nr_events; e++ )
+            {
+                burst_start = burst_start || p_events[e].start;
+            }
+        }
+
+        if ( capturing )
+        {
+            if ( !p_rh->handed && ( p_rh->ring.head >= p_rh->window_end ) )
+            {
+                p_rh->handed = true;
+                nr_handed++;
+            }
+            if ( nr_handed == writer.nr_handles )
+            {
+                pthread_mutex_lock( &(writer.lock) );
+                writer.pending = true;
+                pthread_cond_signal( &(writer.wake) );
+                pthread_mutex_unlock( &(writer.lock) );
+
+                capturing = false;
+                nr_captures++;
+                printf("Info: card %" PRIu8 " capture %" PRIu32 " complete, writing it out\n",
+                       card, nr_captures);
+                if ( ( p_thread_params->nr_captures != 0 ) &&
+                     ( nr_captures >= p_thread_params->nr_captures ) )
+                {
+                    break;
+                }
+            }
+            continue;
+        }
+
+        /* armed once the writer has released every window */
+        armed = true;
+        for ( i = 0; i < writer.nr_handles; i++ )
+        {
+            armed = armed && !pretrigger_ring_is_held( &(writer.p_handles[i]->ring) );
+        }
+
+        switch ( p_thread_params->ring_trigger )
+        {
+            case ring_trigger_signal:
+            {
+                uint32_t nr_signals = __atomic_load_n( &g_nr_trigger_signals, __ATOMIC_RELAXED );
+
+                if ( nr_signals != signals_seen )
+                {
+                    signals_seen = nr_signals;
+                    if ( !armed )
+                    {
+                        nr_ignored++;
+                    }
+                    else if ( skiq_read_curr_sys_timestamp( card, &event_sys_ts ) != 0 )
+                    {
+                        event_sys_ts = p_rx_block->sys_timestamp;
+                    }
+                }
+                break;
+            }
+
+            case ring_trigger_1pps:
+                /* poll the last 1PPS timestamp 20 times a second, it is a register read */
+                if ( armed && ( p_rx_block->sys_timestamp >= next_pps_poll ) )
+                {
+                    uint64_t pps_sys_ts = 0;
+
+                    next_pps_poll = p_rx_block->sys_timestamp + ( sys_ts_freq / 20 );
+                    if ( skiq_read_last_1pps_timestamp( card, NULL, &pps_sys_ts ) == 0 )
+                    {
+                        if ( ( pps_base_sys_ts != UINT64_MAX ) && ( pps_sys_ts != pps_base_sys_ts ) )
+                        {
+                            event_sys_ts = pps_sys_ts;
+                        }
+                        pps_base_sys_ts = pps_sys_ts;
+                    }
+                }
+                break;
+
+            case ring_trigger_energy:
+                if ( armed && burst_start )
+                {
+                    event_sys_ts = p_rx_block->sys_timestamp;
+                }
+                else if ( burst_start )
+                {
+                    nr_ignored++;
+                }
+                break;
+        }
+
+        if ( event_sys_ts == UINT64_MAX )
+        {
+            continue;
+        }
+
+        /* freeze the window of every handle around the same system time */
+        for ( i = 0; i < writer.nr_handles; i++ )
+        {
+            struct ring_handle *p = writer.p_handles[i];
+            uint64_t trigger_seq = ring_find_sys_ts( &(p->ring), event_sys_ts );
+            uint64_t oldest = pretrigger_ring_oldest( &(p->ring) );
+
+            p->window_start = ( trigger_seq > oldest + pre_blocks ) ? trigger_seq - pre_blocks : oldest;
+            p->window_end = trigger_seq + post_blocks;
+            p->handed = ( p->ring.head >= p->window_end );
+            pretrigger_ring_hold( &(p->ring), p->window_start );
+        }
+        nr_handed = 0;
+        for ( i = 0; i < writer.nr_handles; i++ )
+        {
+            nr_handed += writer.p_handles[i]->handed ? 1 : 0;
+        }
+        printf("Info: card %" PRIu8 " triggered at system timestamp 0x%016" PRIx64 "\n", card,
+               event_sys_ts);
+        event_sys_ts = UINT64_MAX;
+        pps_base_sys_ts = UINT64_MAX;
+        capturing = true;
+    }
+
+    if ( g_running == true )
+    {
+        printf("Info: card %" PRIu8 " stopping %u Rx handle(s)\n", card, p_rconfig->nr_handles[card]);
+    }
+    (void)skiq_stop_rx_streaming_multi_immediate(card, (skiq_rx_hdl_t *)p_rconfig->handles[card],
+                                                 p_rconfig->nr_handles[card]);
+
+ring_close:
+    rx_ready_close( &ready );
+    if ( writer_started )
+    {
+        pthread_mutex_lock( &(writer.lock) );
+        writer.exit = true;
+        pthread_cond_signal( &(writer.wake) );
+        pthread_mutex_unlock( &(writer.lock) );
+        pthread_join( writer.thread, NULL );
+
+        if ( ( writer.status != 0 ) && ( status == 0 ) )
+        {
+            fprintf(stderr, "Error: card %" PRIu8 " failed to write a capture\n", card);
+            status = writer.status;
+        }
+        printf("Info: card %" PRIu8 " wrote %" PRIu32 " capture(s), %" PRIu64 " timestamp gap(s),"
+               " %" PRIu64 " trigger(s) ignored while writing\n", card, writer.nr_written,
+               nr_ts_gaps, nr_ignored);
+    }
+
+    for ( i = 0; i < skiq_rx_hdl_end; i++ )
+    {
+        if ( rh[i].ring.nr_dropped > 0 )
+        {
+            fprintf(stderr, "Warning: card %" PRIu8 " dropped %" PRIu64 " block(s) of handle %s"
+                    " while a capture was written\n", card, rh[i].ring.nr_dropped,
+                    hdl_cstr((skiq_rx_hdl_t)i));
+        }
+        pretrigger_ring_free( &(rh[i].ring) );
+        burst_detect_free( &(rh[i].detector) );
+        if ( rh[i].output_fp != NULL )
+        {
+            fclose( rh[i].output_fp );
+            rh[i].output_fp = NULL;
+        }
+        /* only whole windows are written, so the index always matches the file */
+        if ( ( close_index( &(rh[i].index), card, hdl_cstr((skiq_rx_hdl_t)i), true ) != 0 ) &&
+             ( status == 0 ) )
+        {
+            status = -EIO;
+        }
+    }
+    free( p_scratch );
+    free( p_events );
+
+ring_exit:
+    return (void *)(intptr_t)status;
+}
+
+
 /****************************** APPLICATION **********************************/
 /*****************************************************************************/
 
+/*****************************************************************************/
+/** This is the SIGUSR1 handler that fires the software trigger of --pretrigger.
+
+    @param[in] signum: the signal number that occurred
+
+    @return void
+*/
+static void app_trigger(int signum)
+{
+    (void)signum;
+    __atomic_add_fetch( &g_nr_trigger_signals, 1, __ATOMIC_RELAXED );
+}
+
+
 /*****************************************************************************/
 /** This is the cleanup handler to ensure that the app properly exits and
     does the needed cleanup if it ends unexpectedly.
@@ -2656,14 +3965,18 @@ int main( int argc, char *argv[])
 
     /* always install a handler for proper cleanup */
     signal(SIGINT, app_cleanup);
+    signal(SIGUSR1, app_trigger);
 
     /************************ parse command line ******************************/
     /* Parse command line into rconfig and pps_source. 
     */
 
-    if( 0 == arg_parser(argc, argv, p_help_short, p_help_long, p_args) )
+    if( ( 0 == arg_parser(argc, argv, p_help_short, p_help_long, p_args) ) &&
+        ( 0 == rt_thread_config_init( &g_rt_config ) ) )
     {
         struct radio_config rconfig = RADIO_CONFIG_INITIALIZER;
+        struct work_pool pool;
+        struct work_pool *p_pool = NULL;
 
         /* map command line arguments to radio config */
         status = map_arguments_to_radio_config((const struct cmd_line_args *)&g_cmd_line_args, &rconfig);
@@ -2682,6 +3995,22 @@ int main( int argc, char *argv[])
 
             VERBOSE_DUMP_RCONFIG(&rconfig)
 
+            if( (status == 0) && (g_cmd_line_args.pipeline == true) )
+            {
+                status = work_pool_init( &pool, g_cmd_line_args.nr_workers );
+                if( status == 0 )
+                {
+                    printf("Info: processing samples on %" PRIu32 " worker thread(s)\n",
+                           pool.nr_workers);
+                    p_pool = &pool;
+                }
+                else
+                {
+                    fprintf(stderr, "Error: unable to start the processing pool (status %"
+                            PRIi32 ")\n", status);
+                }
+            }
+
             if( status == 0 )
             {
                 /*************************** kickoff threads ******************************/
@@ -2697,11 +4026,23 @@ int main( int argc, char *argv[])
                     g_thread_parameters[i].init_complete                  = false;
                     g_thread_parameters[i].include_meta                   = g_cmd_line_args.include_meta;
                     g_thread_parameters[i].perform_verify                 = g_cmd_line_args.perform_verify;
+                    g_thread_parameters[i].index                          = g_cmd_line_args.index;
                     g_thread_parameters[i].p_file_path                    = g_cmd_line_args.p_file_path;
                     g_thread_parameters[i].num_payload_words_to_acquire   = g_cmd_line_args.num_payload_words_to_acquire;
+                    g_thread_parameters[i].p_pool                         = p_pool;
+                    g_thread_parameters[i].pretrigger_words               = g_cmd_line_args.pretrigger;
+                    g_thread_parameters[i].threshold                      = g_cmd_line_args.threshold;
+                    g_thread_parameters[i].nr_captures                    = g_cmd_line_args.nr_captures;
+                    (void)mem_arena_parse_pages( g_cmd_line_args.p_hugepages,
+                                                 &(g_thread_parameters[i].pages) );
+                    g_thread_parameters[i].ring_trigger                   =
+                        ( 0 == strcasecmp( g_cmd_line_args.p_ring_trigger, "1pps" ) ) ? ring_trigger_1pps :
+                        ( 0 == strcasecmp( g_cmd_line_args.p_ring_trigger, "energy" ) ) ? ring_trigger_energy :
+                        ring_trigger_signal;
 
                     create_rvalue = pthread_create( &(g_thread_parameters[i].receive_thread), 
-                            NULL, receive_card, &g_thread_parameters[i] );
+                            NULL, ( g_cmd_line_args.pretrigger > 0 ) ? receive_card_ring : receive_card,
+                            &g_thread_parameters[i] );
                     if( create_rvalue != 0 )
                     {
                         g_running = false; // Tell all the threads to terminate
@@ -2770,6 +4111,14 @@ int main( int argc, char *argv[])
                 }
             }
 
+            if( p_pool != NULL )
+            {
+                printf("Info: processing pool executed %" PRIu64 " work items (%" PRIu64
+                       " stolen)\n", p_pool->nr_executed, p_pool->nr_stolen);
+                work_pool_destroy( p_pool );
+                p_pool = NULL;
+            }
+
             if( rconfig.skiq_initialized == true )
             {
                 skiq_exit();
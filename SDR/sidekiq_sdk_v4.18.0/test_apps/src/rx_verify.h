@@ -0,0 +1,555 @@
+/**
+ * @file   rx_verify.h
+ *
+ * @brief  Block-at-a-time verification of the receive counter test pattern.
+ *
+ * When the FPGA is configured to send a counter (skiq_data_src_counter) instead of I/Q samples,
+ * every 16-bit value is one greater than the previous value, wrapping from the maximum ADC value
+ * to the minimum (sign extended to 16 bits).  The expected value at any position is therefore a
+ * pure function of the first value, so the check is done a vector at a time against a ramp,
+ * with the I/Q swap folded into the ramp itself instead of swapping the capture in place.
+ *
+ * A verifier keeps its state between calls, so it may be fed one block at a time while
+ * receiving, or a whole capture may be split into chunks that are checked in parallel on a
+ * work_pool.  Only the first mismatch of each run is recorded; the verifier then resynchronizes
+ * on the received data so a single dropped block is reported once instead of on every value
+ * that follows.
+ *
+ * The compare kernel is selected once at first use: AVX2 on x86 hosts that support it, NEON on
+ * aarch64, and a scalar implementation everywhere else.
+ */
+
+#ifndef __RX_VERIFY_H__
+#define __RX_VERIFY_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "work_pool.h"
+
+#if (defined __x86_64__ || defined __i386__) && (defined __GNUC__) && \
+    ( (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)) || (defined __clang__) )
+#   define RX_VERIFY_HAVE_AVX2
+#   include <immintrin.h>
+#elif (defined __aarch64__) && (defined __ARM_NEON)
+#   define RX_VERIFY_HAVE_NEON
+#   include <arm_neon.h>
+#endif
+
+/***** DEFINES *****/
+
+/* wrap a 16-bit counter value into the signed range of the ADC resolution encoded by _shift */
+#define RX_VERIFY_WRAP(_x,_shift)   \
+    ((int16_t)((uint16_t)((uint16_t)(_x) << (_shift))) >> (_shift))
+
+/* number of values the scalar kernel checks between branches */
+#define RX_VERIFY_SCALAR_STRIDE     (32)
+
+/***** TYPEDEFS *****/
+
+/* returns the index of the first value that does not match the ramp starting at first, or
+   nr_values if they all match; swap is 1 if the I/Q values of each sample are swapped */
+typedef uint32_t (*rx_verify_run_fn)( const int16_t *p_values,
+                                      uint32_t nr_values,
+                                      uint16_t first,
+                                      uint32_t swap,
+                                      uint32_t shift );
+
+struct rx_verify
+{
+    uint32_t shift;                 /* 16 - ADC resolution */
+    uint32_t swap;                  /* 1 if the samples are in I/Q order, 0 for Q/I */
+
+    bool have_expected;
+    uint16_t next;                  /* counter value expected for the next sample's first value */
+    uint64_t nr_samples;            /* position of the next sample */
+
+    /* results */
+    uint64_t nr_mismatches;         /* number of discontinuities found */
+    bool mismatch;
+    uint64_t mismatch_sample;       /* sample holding the first mismatch */
+    int16_t mismatch_expected;
+    int16_t mismatch_got;
+};
+
+/***** INLINE FUNCTIONS  *****/
+
+static inline uint32_t _rx_verify_run_scalar( const int16_t *p_values,
+                                              uint32_t nr_values,
+                                              uint16_t first,
+                                              uint32_t swap,
+                                              uint32_t shift )
+{
+    uint32_t i = 0, j;
+
+    /* branch-free across each stride so that the compiler may vectorize it */
+    for ( ; ( i + RX_VERIFY_SCALAR_STRIDE ) <= nr_values; i += RX_VERIFY_SCALAR_STRIDE )
+    {
+        uint16_t diff = 0;
+
+        for ( j = 0; j < RX_VERIFY_SCALAR_STRIDE; j++ )
+        {
+            diff |= (uint16_t)( p_values[i + j] ^
+                                RX_VERIFY_WRAP( first + ( ( i + j ) ^ swap ), shift ) );
+        }
+        if ( diff != 0 )
+        {
+            break;
+        }
+    }
+
+    for ( ; i < nr_values; i++ )
+    {
+        if ( p_values[i] != RX_VERIFY_WRAP( first + ( i ^ swap ), shift ) )
+        {
+            break;
+        }
+    }
+
+    return i;
+}
+
+#if (defined RX_VERIFY_HAVE_AVX2)
+__attribute__((target("avx2")))
+static inline uint32_t _rx_verify_run_avx2( const int16_t *p_values,
+                                            uint32_t nr_values,
+                                            uint16_t first,
+                                            uint32_t swap,
+                                            uint32_t shift )
+{
+    const __m256i ramp = swap ?
+        _mm256_setr_epi16( 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 ) :
+        _mm256_setr_epi16( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 );
+    const __m256i step = _mm256_set1_epi16( 16 );
+    const __m128i count = _mm_cvtsi32_si128( (int)shift );
+    __m256i base = _mm256_add_epi16( _mm256_set1_epi16( (int16_t)first ), ramp );
+    uint32_t i;
+
+    for ( i = 0; ( i + 16 ) <= nr_values; i += 16 )
+    {
+        const __m256i expected = _mm256_sra_epi16( _mm256_sll_epi16( base, count ), count );
+        const __m256i values = _mm256_loadu_si256( (const __m256i *)(p_values + i) );
+
+        if ( _mm256_movemask_epi8( _mm256_cmpeq_epi16( values, expected ) ) != -1 )
+        {
+            break;
+        }
+        base = _mm256_add_epi16( base, step );
+    }
+
+    return i + _rx_verify_run_scalar( p_values + i, nr_values - i, (uint16_t)(first + i), swap,
+                                      shift );
+}
+#endif  /* RX_VERIFY_HAVE_AVX2 */
+
+#if (defined RX_VERIFY_HAVE_NEON)
+static inline uint32_t _rx_verify_run_neon( const int16_t *p_values,
+                                            uint32_t nr_values,
+                                            uint16_t first,
+                                            uint32_t swap,
+                                            uint32_t shift )
+{
+    const int16x8_t ramp_qi = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    const int16x8_t ramp_iq = { 1, 0, 3, 2, 5, 4, 7, 6 };
+    const int16x8_t step = vdupq_n_s16( 8 );
+    const int16x8_t left = vdupq_n_s16( (int16_t)shift );
+    const int16x8_t right = vdupq_n_s16( -(int16_t)shift );
+    int16x8_t base = vaddq_s16( vdupq_n_s16( (int16_t)first ), swap ? ramp_iq : ramp_qi );
+    uint32_t i;
+
+    for ( i = 0; ( i + 8 ) <= nr_values; i += 8 )
+    {
+        const int16x8_t expected = vshlq_s16( vreinterpretq_s16_u16(
+                                                  vshlq_u16( vreinterpretq_u16_s16( base ), left ) ),
+                                              right );
+
+        if ( vminvq_u16( vceqq_s16( vld1q_s16( p_values + i ), expected ) ) != UINT16_MAX )
+        {
+            break;
+        }
+        base = vaddq_s16( base, step );
+    }
+
+    return i + _rx_verify_run_scalar( p_values + i, nr_values - i, (uint16_t)(first + i), swap,
+                                      shift );
+}
+#endif  /* RX_VERIFY_HAVE_NEON */
+
+/*****************************************************************************/
+/** Select (on first call) and return the fastest compare kernel available on this host.
+
+    @param[out] pp_name     optional, set to a string naming the selected kernel
+
+    @return the selected kernel
+*/
+static inline rx_verify_run_fn rx_verify_select( const char **pp_name )
+{
+    static rx_verify_run_fn p_fn = NULL;
+    static const char *p_name = NULL;
+
+    if ( p_fn == NULL )
+    {
+        p_fn = _rx_verify_run_scalar;
+        p_name = "scalar";
+#if (defined RX_VERIFY_HAVE_AVX2)
+        __builtin_cpu_init();
+        if ( __builtin_cpu_supports("avx2") )
+        {
+            p_fn = _rx_verify_run_avx2;
+            p_name = "avx2";
+        }
+#elif (defined RX_VERIFY_HAVE_NEON)
+        p_fn = _rx_verify_run_neon;
+        p_name = "neon";
+#endif
+    }
+
+    if ( pp_name != NULL )
+    {
+        *pp_name = p_name;
+    }
+
+    return p_fn;
+}
+
+/*****************************************************************************/
+/** Initialize a verifier.  The expected counter value is taken from the first sample verified.
+
+    @param[out] v           verifier to initialize
+    @param[in]  resolution  RX IQ resolution in bits, as reported by skiq_read_rx_iq_resolution()
+    @param[in]  iq_swap     true if the samples are in I/Q order (skiq_iq_order_iq)
+
+    @return void
+*/
+static inline void rx_verify_init( struct rx_verify *v,
+                                   uint8_t resolution,
+                                   bool iq_swap )
+{
+    if ( ( resolution == 0 ) || ( resolution > 16 ) )
+    {
+        resolution = 16;
+    }
+
+    v->shift = 16 - resolution;
+    v->swap = iq_swap ? 1 : 0;
+    v->have_expected = false;
+    v->next = 0;
+    v->nr_samples = 0;
+    v->nr_mismatches = 0;
+    v->mismatch = false;
+    v->mismatch_sample = 0;
+    v->mismatch_expected = 0;
+    v->mismatch_got = 0;
+
+    (void)rx_verify_select( NULL );
+}
+
+/*****************************************************************************/
+/** Verify a contiguous run of samples, continuing from the previous call.
+
+    @param[in] v            verifier
+    @param[in] p_values     sample data, 2 * nr_samples int16 values
+    @param[in] nr_samples   number of I/Q samples to verify
+
+    @return 0 if every sample matched, else -EINVAL
+*/
+static inline int32_t rx_verify_samples( struct rx_verify *v,
+                                         const int16_t *p_values,
+                                         uint32_t nr_samples )
+{
+    const rx_verify_run_fn run = rx_verify_select( NULL );
+    const uint32_t nr_values = 2 * nr_samples;
+    uint32_t pos = 0;
+    int32_t status = 0;
+
+    if ( nr_samples == 0 )
+    {
+        return 0;
+    }
+
+    if ( !v->have_expected )
+    {
+        v->next = (uint16_t)p_values[v->swap];
+        v->have_expected = true;
+    }
+
+    while ( pos < nr_values )
+    {
+        uint32_t idx = pos + run( p_values + pos, nr_values - pos, v->next, v->swap, v->shift );
+        uint32_t pair;
+
+        if ( idx >= nr_values )
+        {
+            v->next = (uint16_t)( v->next + ( nr_values - pos ) );
+            break;
+        }
+
+        if ( !v->mismatch )
+        {
+            v->mismatch = true;
+            v->mismatch_sample = v->nr_samples + ( idx / 2 );
+            v->mismatch_expected = RX_VERIFY_WRAP( v->next + ( ( idx - pos ) ^ v->swap ),
+                                                   v->shift );
+            v->mismatch_got = p_values[idx];
+        }
+        v->nr_mismatches++;
+        status = -EINVAL;
+
+        /* resynchronize on the sample following the mismatch */
+        pair = ( idx & ~1U ) + 2;
+        if ( pair < nr_values )
+        {
+            v->next = (uint16_t)( p_values[pair + v->swap] );
+        }
+        else
+        {
+            v->next = (uint16_t)( p_values[( idx & ~1U ) + v->swap] + 2 );
+        }
+        pos = pair;
+    }
+
+    v->nr_samples += nr_samples;
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Account for samples that were not received (e.g. a timestamp gap covered by a placeholder),
+    so the counter expected after them is the one the FPGA kept counting to.
+
+    @param[in] v            verifier
+    @param[in] nr_samples   number of I/Q samples that are missing
+
+    @return void
+*/
+static inline void rx_verify_skip( struct rx_verify *v,
+                                   uint64_t nr_samples )
+{
+    if ( v->have_expected )
+    {
+        v->next = (uint16_t)( v->next + ( 2 * nr_samples ) );
+    }
+    v->nr_samples += nr_samples;
+}
+
+/*****************************************************************************/
+/** Verify samples held in a buffer of consecutive receive blocks, skipping the metadata header
+    at the start of each block.
+
+    @param[in] v                    verifier
+    @param[in] p_data               first block
+    @param[in] nr_samples           number of I/Q samples to verify (excluding the headers)
+    @param[in] block_stride_in_words  distance between the start of consecutive blocks
+    @param[in] header_words         number of metadata words at the start of each block, 0 if the
+                                    samples are contiguous
+
+    @return 0 if every sample matched, else -EINVAL
+*/
+static inline int32_t rx_verify_blocks( struct rx_verify *v,
+                                        const int16_t *p_data,
+                                        uint32_t nr_samples,
+                                        uint32_t block_stride_in_words,
+                                        uint32_t header_words )
+{
+    const uint32_t samples_per_block = block_stride_in_words - header_words;
+    int32_t status = 0;
+
+    if ( ( header_words == 0 ) || ( block_stride_in_words <= header_words ) )
+    {
+        return rx_verify_samples( v, p_data, nr_samples );
+    }
+
+    while ( nr_samples > 0 )
+    {
+        uint32_t nr = ( nr_samples < samples_per_block ) ? nr_samples : samples_per_block;
+
+        if ( rx_verify_samples( v, p_data + 2 * header_words, nr ) != 0 )
+        {
+            status = -EINVAL;
+        }
+        p_data += 2 * block_stride_in_words;
+        nr_samples -= nr;
+    }
+
+    return status;
+}
+
+struct _rx_verify_job
+{
+    struct rx_verify v;
+    uint16_t first;                 /* counter value the chunk started with */
+    const int16_t *p_data;
+    uint32_t nr_samples;
+    uint32_t block_stride_in_words;
+    uint32_t header_words;
+};
+
+static inline void _rx_verify_job_run( void *p_arg )
+{
+    struct _rx_verify_job *p_job = (struct _rx_verify_job *)p_arg;
+
+    (void)rx_verify_blocks( &(p_job->v), p_job->p_data, p_job->nr_samples,
+                            p_job->block_stride_in_words, p_job->header_words );
+}
+
+/*****************************************************************************/
+/** Split a capture into chunks on block boundaries and verify them in parallel.  Every chunk
+    but the first is seeded from its own data and the seams between chunks are checked once all
+    chunks have completed, so the outcome is the same as a single rx_verify_blocks() call.
+
+    @param[in]  v                   verifier, updated as though the whole capture was verified
+    @param[in]  p_pool              pool to run the chunks on, NULL to run them in this thread
+    @param[in]  p_data              first block
+    @param[in]  nr_samples          number of I/Q samples to verify (excluding the headers)
+    @param[in]  block_stride_in_words  distance between the start of consecutive blocks
+    @param[in]  header_words        number of metadata words at the start of each block
+    @param[out] p_chunks            optional, per chunk results (nr_chunks entries)
+    @param[in]  nr_chunks           number of chunks to split the capture into
+
+    @return 0 if every sample matched, -EINVAL on a mismatch, -ENOMEM if the chunks could not be
+    allocated
+*/
+static inline int32_t rx_verify_parallel( struct rx_verify *v,
+                                          struct work_pool *p_pool,
+                                          const int16_t *p_data,
+                                          uint32_t nr_samples,
+                                          uint32_t block_stride_in_words,
+                                          uint32_t header_words,
+                                          struct rx_verify *p_chunks,
+                                          uint32_t nr_chunks )
+{
+    const uint32_t samples_per_block = ( header_words > 0 ) ?
+        ( block_stride_in_words - header_words ) : 1;
+    struct _rx_verify_job *p_jobs;
+    struct work_group group;
+    uint32_t chunk_samples, i, nr_jobs = 0;
+    int32_t status = 0;
+
+    if ( nr_samples == 0 )
+    {
+        return 0;
+    }
+    if ( nr_chunks == 0 )
+    {
+        nr_chunks = 1;
+    }
+
+    /* chunks must start on a block boundary so that the header skipping stays aligned */
+    chunk_samples = ( nr_samples + nr_chunks - 1 ) / nr_chunks;
+    chunk_samples = ( ( chunk_samples + samples_per_block - 1 ) / samples_per_block ) *
+        samples_per_block;
+
+    p_jobs = calloc( nr_chunks, sizeof(struct _rx_verify_job) );
+    if ( p_jobs == NULL )
+    {
+        return -ENOMEM;
+    }
+
+    for ( i = 0; i < nr_chunks; i++ )
+    {
+        struct _rx_verify_job *p_job = &(p_jobs[i]);
+        uint64_t start = (uint64_t)i * chunk_samples;
+        uint64_t nr_blocks_before = start / samples_per_block;
+        const int16_t *p_start;
+
+        if ( start >= nr_samples )
+        {
+            break;
+        }
+
+        if ( header_words > 0 )
+        {
+            p_start = p_data + 2 * nr_blocks_before * block_stride_in_words;
+        }
+        else
+        {
+            p_start = p_data + 2 * start;
+        }
+
+        p_job->v = *v;
+        p_job->v.nr_mismatches = 0;
+        p_job->v.mismatch = false;
+        p_job->v.nr_samples = v->nr_samples + start;
+        if ( i > 0 )
+        {
+            p_job->v.have_expected = false;
+        }
+        p_job->p_data = p_start;
+        p_job->nr_samples = ( ( nr_samples - start ) < chunk_samples ) ?
+            (uint32_t)( nr_samples - start ) : chunk_samples;
+        p_job->block_stride_in_words = block_stride_in_words;
+        p_job->header_words = header_words;
+        p_job->first = (uint16_t)p_start[2 * header_words + v->swap];
+        nr_jobs++;
+    }
+
+    /* the pool may be shared, so only the chunks queued here are waited on */
+    work_group_init( &group );
+    for ( i = 0; i < nr_jobs; i++ )
+    {
+        if ( ( p_pool == NULL ) ||
+             ( work_group_submit( &group, p_pool, _rx_verify_job_run, &(p_jobs[i]),
+                                  WORK_POOL_ANY_WORKER ) != 0 ) )
+        {
+            _rx_verify_job_run( &(p_jobs[i]) );
+        }
+    }
+    work_group_wait( &group );
+    work_group_destroy( &group );
+
+    /* merge the chunks, checking that each one continues where the previous one ended */
+    for ( i = 0; i < nr_jobs; i++ )
+    {
+        struct rx_verify *p_chunk = &(p_jobs[i].v);
+
+        if ( ( i > 0 ) && v->have_expected &&
+             ( (int16_t)p_jobs[i].first != RX_VERIFY_WRAP( v->next, v->shift ) ) )
+        {
+            if ( !p_chunk->mismatch || ( p_chunk->mismatch_sample > v->nr_samples ) )
+            {
+                p_chunk->mismatch = true;
+                p_chunk->mismatch_sample = v->nr_samples;
+                p_chunk->mismatch_expected = RX_VERIFY_WRAP( v->next, v->shift );
+                p_chunk->mismatch_got = (int16_t)p_jobs[i].first;
+            }
+            p_chunk->nr_mismatches++;
+        }
+
+        if ( p_chunk->mismatch && !v->mismatch )
+        {
+            v->mismatch = true;
+            v->mismatch_sample = p_chunk->mismatch_sample;
+            v->mismatch_expected = p_chunk->mismatch_expected;
+            v->mismatch_got = p_chunk->mismatch_got;
+        }
+        if ( p_chunk->nr_mismatches > 0 )
+        {
+            status = -EINVAL;
+        }
+        v->nr_mismatches += p_chunk->nr_mismatches;
+        v->have_expected = p_chunk->have_expected;
+        v->next = p_chunk->next;
+        v->nr_samples = p_chunk->nr_samples;
+
+        if ( ( p_chunks != NULL ) && ( i < nr_chunks ) )
+        {
+            p_chunks[i] = *p_chunk;
+        }
+    }
+    for ( i = nr_jobs; ( p_chunks != NULL ) && ( i < nr_chunks ); i++ )
+    {
+        p_chunks[i] = *v;
+        p_chunks[i].nr_mismatches = 0;
+        p_chunks[i].mismatch = false;
+    }
+
+    free( p_jobs );
+
+    return status;
+}
+
+#endif  /* __RX_VERIFY_H__ */
@@ -0,0 +1,657 @@
+/**
+ * @file   rx_writer.h
+ *
+ * @brief  Bounded-memory streaming writer for receive captures.
+ *
+ * Received blocks are copied into a ring of fixed-size, page-aligned chunk buffers.  A dedicated
+ * writer thread drains full chunks to the output file with one large write() per chunk, so the
+ * receive loop never blocks on the disk unless every chunk in the ring is waiting to be written.
+ * When requested, the output file is opened with O_DIRECT to bypass the page cache; the final
+ * partial chunk is written after clearing O_DIRECT since it is generally not a multiple of the
+ * device block size.
+ *
+ * The producer (receive thread) only takes the ring lock when it hands off a full chunk, not on
+ * every block.
+ *
+ * A writer opened with rx_writer_open_compressed() stores the capture in the chunked container
+ * of iq_compress.h instead.  Each full chunk is compressed on a worker pool as soon as it is
+ * handed off, so as many chunks are compressed at once as there are workers, and the writer
+ * thread writes the compressed chunks in ring order and records their offsets in the chunk
+ * table.  The table and the final header are written by rx_writer_close().
+ */
+
+#ifndef __RX_WRITER_H__
+#define __RX_WRITER_H__
+
+/***** INCLUDES *****/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "iq_compress.h"
+#include "work_pool.h"
+
+/***** DEFINES *****/
+
+/* alignment of each chunk buffer, satisfies O_DIRECT on all supported file systems */
+#define RX_WRITER_ALIGN                 (4096)
+
+/* default size of each chunk, roughly 1000 receive blocks in high throughput mode */
+#define RX_WRITER_DEFAULT_CHUNK_SIZE    (4 * 1024 * 1024)
+
+/* default number of chunks in the ring */
+#define RX_WRITER_DEFAULT_NR_CHUNKS     (16)
+
+/***** TYPEDEFS *****/
+
+struct rx_writer;
+
+/* compression of one ring chunk, submitted to the pool */
+struct _rx_writer_job
+{
+    struct rx_writer *w;
+    uint32_t idx;
+};
+
+struct rx_writer
+{
+    int fd;
+    bool direct_io;
+
+    uint8_t *p_mem;             /* nr_chunks * chunk_size bytes, RX_WRITER_ALIGN aligned */
+    uint32_t *p_chunk_len;      /* number of valid bytes in each chunk */
+    uint32_t chunk_size;
+    uint32_t nr_chunks;
+
+    /* producer state, only touched by the receive thread */
+    uint32_t head;              /* chunk currently being filled */
+    uint32_t fill;              /* number of bytes in the current chunk */
+
+    /* shared state, protected by lock */
+    pthread_mutex_t lock;
+    pthread_cond_t chunk_ready;
+    pthread_cond_t chunk_free;
+    uint32_t tail;              /* next chunk for the writer thread to drain */
+    uint32_t nr_full;           /* number of chunks handed off and not yet written */
+    bool closing;
+    int32_t status;             /* first error encountered by the writer thread */
+
+    pthread_t thread;
+    bool thread_started;
+
+    /* compression, p_pool is NULL for a plain capture */
+    struct work_pool *p_pool;
+    struct _rx_writer_job *p_jobs;      /* one per chunk */
+    uint8_t *p_zmem;                    /* nr_chunks * chunk_size bytes of compressed chunks */
+    uint32_t *p_zlen;                   /* compressed size of each chunk, 0 if stored raw */
+    bool *p_zdone;                      /* protected by lock */
+    struct iq_compress_chunk *p_table;  /* only touched by the writer thread until it exits */
+    uint64_t nr_table;
+    uint64_t table_capacity;
+    uint64_t file_offset;
+
+    /* statistics */
+    uint64_t nr_bytes_written;          /* to the file, i.e. after compression */
+    uint64_t nr_bytes_in;               /* handed to the writer */
+    uint64_t nr_raw_chunks;             /* chunks that didn't compress */
+    uint32_t nr_stalls;         /* number of times the producer waited for a free chunk */
+    uint32_t max_nr_full;       /* high water mark of chunks waiting to be written */
+};
+
+#define RX_WRITER_INITIALIZER                           \
+    (struct rx_writer){                                 \
+        .fd = -1,                                       \
+        .direct_io = false,                             \
+        .p_mem = NULL,                                  \
+        .p_chunk_len = NULL,                            \
+        .chunk_size = 0,                                \
+        .nr_chunks = 0,                                 \
+        .head = 0,                                      \
+        .fill = 0,                                      \
+        .lock = PTHREAD_MUTEX_INITIALIZER,              \
+        .chunk_ready = PTHREAD_COND_INITIALIZER,        \
+        .chunk_free = PTHREAD_COND_INITIALIZER,         \
+        .tail = 0,                                      \
+        .nr_full = 0,                                   \
+        .closing = false,                               \
+        .status = 0,                                    \
+        .thread_started = false,                        \
+        .p_pool = NULL,                                 \
+        .p_jobs = NULL,                                 \
+        .p_zmem = NULL,                                 \
+        .p_zlen = NULL,                                 \
+        .p_zdone = NULL,                                \
+        .p_table = NULL,                                \
+        .nr_table = 0,                                  \
+        .table_capacity = 0,                            \
+        .file_offset = 0,                               \
+        .nr_bytes_written = 0,                          \
+        .nr_bytes_in = 0,                               \
+        .nr_raw_chunks = 0,                             \
+        .nr_stalls = 0,                                 \
+        .max_nr_full = 0,                               \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+/* write the entire buffer, retrying on short writes and EINTR */
+static inline int32_t _rx_writer_write_all( int fd,
+                                            const uint8_t *p_data,
+                                            size_t nr_bytes )
+{
+    while ( nr_bytes > 0 )
+    {
+        ssize_t nr_written = write( fd, p_data, nr_bytes );
+        if ( nr_written < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            return -errno;
+        }
+        else if ( nr_written == 0 )
+        {
+            return -EIO;
+        }
+        p_data += nr_written;
+        nr_bytes -= (size_t)nr_written;
+    }
+
+    return 0;
+}
+
+/* compress a ring chunk, runs on the pool */
+static inline void _rx_writer_compress( void *p_arg )
+{
+    struct _rx_writer_job *j = (struct _rx_writer_job *)p_arg;
+    struct rx_writer *w = j->w;
+    size_t pos = (size_t)j->idx * w->chunk_size;
+    uint32_t len;
+
+    len = iq_compress_chunk( &(w->p_mem[pos]), w->p_chunk_len[j->idx], &(w->p_zmem[pos]) );
+
+    pthread_mutex_lock( &(w->lock) );
+    w->p_zlen[j->idx] = len;
+    w->p_zdone[j->idx] = true;
+    pthread_cond_broadcast( &(w->chunk_ready) );
+    pthread_mutex_unlock( &(w->lock) );
+}
+
+/* write ring chunk idx, compressed if the writer compresses, and record it in the chunk table */
+static inline int32_t _rx_writer_write_chunk( struct rx_writer *w,
+                                              uint32_t idx,
+                                              uint32_t *p_nr_written )
+{
+    size_t pos = (size_t)idx * w->chunk_size;
+    struct iq_compress_chunk *p_chunk;
+    uint32_t len = w->p_chunk_len[idx];
+    int32_t status;
+
+    if ( w->p_pool == NULL )
+    {
+        *p_nr_written = len;
+        return _rx_writer_write_all( w->fd, &(w->p_mem[pos]), len );
+    }
+
+    if ( w->nr_table == w->table_capacity )
+    {
+        uint64_t capacity = ( w->table_capacity > 0 ) ? 2 * w->table_capacity : 1024;
+        struct iq_compress_chunk *p_table;
+
+        p_table = realloc( w->p_table, capacity * sizeof(struct iq_compress_chunk) );
+        if ( p_table == NULL )
+        {
+            return -ENOMEM;
+        }
+        w->p_table = p_table;
+        w->table_capacity = capacity;
+    }
+
+    p_chunk = &(w->p_table[w->nr_table]);
+    p_chunk->offset = w->file_offset;
+    if ( w->p_zlen[idx] > 0 )
+    {
+        p_chunk->size = w->p_zlen[idx];
+        p_chunk->flags = 0;
+        status = _rx_writer_write_all( w->fd, &(w->p_zmem[pos]), p_chunk->size );
+    }
+    else
+    {
+        p_chunk->size = len;
+        p_chunk->flags = IQ_COMPRESS_CHUNK_RAW;
+        status = _rx_writer_write_all( w->fd, &(w->p_mem[pos]), len );
+        w->nr_raw_chunks++;
+    }
+    if ( status == 0 )
+    {
+        w->nr_table++;
+        w->file_offset += p_chunk->size;
+        *p_nr_written = p_chunk->size;
+    }
+
+    return status;
+}
+
+static inline void *_rx_writer_thread( void *p_arg )
+{
+    struct rx_writer *w = (struct rx_writer *)p_arg;
+
+    pthread_mutex_lock( &(w->lock) );
+    while ( true )
+    {
+        uint32_t idx, len, nr_written = 0;
+        int32_t status;
+
+        /* chunks are written in ring order, wait for the oldest one to be compressed */
+        while ( ( ( w->nr_full == 0 ) && !w->closing ) ||
+                ( ( w->nr_full > 0 ) && ( w->p_pool != NULL ) && !w->p_zdone[w->tail] ) )
+        {
+            pthread_cond_wait( &(w->chunk_ready), &(w->lock) );
+        }
+        if ( w->nr_full == 0 )
+        {
+            /* closing and nothing left to drain */
+            break;
+        }
+
+        idx = w->tail;
+        len = w->p_chunk_len[idx];
+        pthread_mutex_unlock( &(w->lock) );
+
+        /* only full chunks reach here with O_DIRECT still set, the producer writes the tail */
+        status = _rx_writer_write_chunk( w, idx, &nr_written );
+
+        pthread_mutex_lock( &(w->lock) );
+        if ( ( status != 0 ) && ( w->status == 0 ) )
+        {
+            w->status = status;
+        }
+        else if ( status == 0 )
+        {
+            w->nr_bytes_written += nr_written;
+            w->nr_bytes_in += len;
+        }
+        w->tail = ( w->tail + 1 ) % w->nr_chunks;
+        w->nr_full--;
+        pthread_cond_signal( &(w->chunk_free) );
+    }
+    pthread_mutex_unlock( &(w->lock) );
+
+    return NULL;
+}
+
+static inline void _rx_writer_free( struct rx_writer *w )
+{
+    free( w->p_mem );
+    free( w->p_chunk_len );
+    free( w->p_jobs );
+    free( w->p_zmem );
+    free( w->p_zlen );
+    free( w->p_zdone );
+    free( w->p_table );
+}
+
+static inline int32_t _rx_writer_open( struct rx_writer *w,
+                                       const char *p_path,
+                                       uint32_t chunk_size,
+                                       uint32_t nr_chunks,
+                                       bool direct_io,
+                                       struct work_pool *p_pool )
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    int32_t status = 0;
+    uint32_t i;
+
+    *w = RX_WRITER_INITIALIZER;
+
+    if ( nr_chunks < 2 )
+    {
+        nr_chunks = 2;
+    }
+    chunk_size = ( ( chunk_size + RX_WRITER_ALIGN - 1 ) / RX_WRITER_ALIGN ) * RX_WRITER_ALIGN;
+    if ( chunk_size == 0 )
+    {
+        chunk_size = RX_WRITER_DEFAULT_CHUNK_SIZE;
+    }
+
+#ifdef O_DIRECT
+    if ( direct_io )
+    {
+        w->fd = open( p_path, flags | O_DIRECT, 0644 );
+        if ( w->fd >= 0 )
+        {
+            w->direct_io = true;
+        }
+        else if ( errno == EINVAL )
+        {
+            fprintf(stderr, "Warning: O_DIRECT not supported for %s, using buffered writes\n",
+                    p_path);
+        }
+        else
+        {
+            return -errno;
+        }
+    }
+#else
+    if ( direct_io )
+    {
+        fprintf(stderr, "Warning: O_DIRECT not available on this platform, using buffered"
+                " writes\n");
+    }
+#endif
+
+    if ( w->fd < 0 )
+    {
+        w->fd = open( p_path, flags, 0644 );
+        if ( w->fd < 0 )
+        {
+            return -errno;
+        }
+    }
+
+    w->chunk_size = chunk_size;
+    w->nr_chunks = nr_chunks;
+    if ( posix_memalign( (void **)&(w->p_mem), RX_WRITER_ALIGN,
+                         (size_t)chunk_size * nr_chunks ) != 0 )
+    {
+        w->p_mem = NULL;
+    }
+    w->p_chunk_len = calloc( nr_chunks, sizeof(uint32_t) );
+    if ( ( w->p_mem == NULL ) || ( w->p_chunk_len == NULL ) )
+    {
+        status = -ENOMEM;
+    }
+
+    if ( ( status == 0 ) && ( p_pool != NULL ) )
+    {
+        struct iq_compress_header hdr;
+
+        w->p_pool = p_pool;
+        w->p_jobs = calloc( nr_chunks, sizeof(struct _rx_writer_job) );
+        w->p_zmem = malloc( (size_t)chunk_size * nr_chunks );
+        w->p_zlen = calloc( nr_chunks, sizeof(uint32_t) );
+        w->p_zdone = calloc( nr_chunks, sizeof(bool) );
+        if ( ( w->p_jobs == NULL ) || ( w->p_zmem == NULL ) || ( w->p_zlen == NULL ) ||
+             ( w->p_zdone == NULL ) )
+        {
+            status = -ENOMEM;
+        }
+        else
+        {
+            for ( i = 0; i < nr_chunks; i++ )
+            {
+                w->p_jobs[i].w = w;
+                w->p_jobs[i].idx = i;
+            }
+
+            /* completed by rx_writer_close(), a header with no chunks marks an open capture */
+            memset( &hdr, 0, sizeof(hdr) );
+            hdr.magic = IQ_COMPRESS_MAGIC;
+            hdr.version = IQ_COMPRESS_VERSION;
+            hdr.codec = IQ_COMPRESS_CODEC_DELTA_PACK;
+            hdr.chunk_size = chunk_size;
+            status = _rx_writer_write_all( w->fd, (const uint8_t *)&hdr, sizeof(hdr) );
+            w->file_offset = sizeof(hdr);
+        }
+    }
+
+    if ( status == 0 )
+    {
+        status = -pthread_create( &(w->thread), NULL, _rx_writer_thread, w );
+    }
+    if ( status != 0 )
+    {
+        _rx_writer_free( w );
+        close( w->fd );
+        *w = RX_WRITER_INITIALIZER;
+        return status;
+    }
+    w->thread_started = true;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Open the output file and start the writer thread.
+
+    @param[out] w           writer to initialize
+    @param[in]  p_path      output file path
+    @param[in]  chunk_size  size of each ring chunk in bytes, rounded up to RX_WRITER_ALIGN
+    @param[in]  nr_chunks   number of chunks in the ring (at least 2)
+    @param[in]  direct_io   true to bypass the page cache with O_DIRECT (falls back to buffered
+                            I/O if the file system refuses it)
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t rx_writer_open( struct rx_writer *w,
+                                      const char *p_path,
+                                      uint32_t chunk_size,
+                                      uint32_t nr_chunks,
+                                      bool direct_io )
+{
+    return _rx_writer_open( w, p_path, chunk_size, nr_chunks, direct_io, NULL );
+}
+
+/*****************************************************************************/
+/** Open the output file as a compressed capture (iq_compress.h) and start the writer thread.
+    The file is written with buffered I/O since compressed chunks have arbitrary sizes.
+
+    @param[out] w           writer to initialize
+    @param[in]  p_path      output file path
+    @param[in]  chunk_size  uncompressed size of each chunk in bytes, rounded up to
+                            RX_WRITER_ALIGN
+    @param[in]  nr_chunks   number of chunks in the ring (at least 2), at most this many chunks
+                            are compressed at once
+    @param[in]  p_pool      pool to compress the chunks on, can be shared between writers and
+                            must outlive the writer
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t rx_writer_open_compressed( struct rx_writer *w,
+                                                 const char *p_path,
+                                                 uint32_t chunk_size,
+                                                 uint32_t nr_chunks,
+                                                 struct work_pool *p_pool )
+{
+    return _rx_writer_open( w, p_path, chunk_size, nr_chunks, false, p_pool );
+}
+
+/* hand the current chunk to the writer thread and wait for the next one to be free */
+static inline int32_t _rx_writer_submit_chunk( struct rx_writer *w )
+{
+    int32_t status;
+
+    w->p_chunk_len[w->head] = w->fill;
+    if ( w->p_pool != NULL )
+    {
+        /* the writer thread doesn't look at the chunk until it is counted in nr_full */
+        w->p_zdone[w->head] = false;
+        if ( work_pool_submit( w->p_pool, _rx_writer_compress, &(w->p_jobs[w->head]),
+                               WORK_POOL_ANY_WORKER ) != 0 )
+        {
+            _rx_writer_compress( &(w->p_jobs[w->head]) );
+        }
+    }
+
+    pthread_mutex_lock( &(w->lock) );
+    w->nr_full++;
+    if ( w->nr_full > w->max_nr_full )
+    {
+        w->max_nr_full = w->nr_full;
+    }
+    pthread_cond_signal( &(w->chunk_ready) );
+
+    /* the next chunk is still owned by the writer thread when the ring is full */
+    if ( w->nr_full == w->nr_chunks )
+    {
+        w->nr_stalls++;
+        while ( w->nr_full == w->nr_chunks )
+        {
+            pthread_cond_wait( &(w->chunk_free), &(w->lock) );
+        }
+    }
+    status = w->status;
+    pthread_mutex_unlock( &(w->lock) );
+
+    w->head = ( w->head + 1 ) % w->nr_chunks;
+    w->fill = 0;
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Copy data into the ring.  Only blocks if every chunk is waiting to be written.
+
+    @param[in] w            writer
+    @param[in] p_data       data to write
+    @param[in] nr_bytes     number of bytes to write
+
+    @return 0 on success, else the first error reported by the writer thread
+*/
+static inline int32_t rx_writer_write( struct rx_writer *w,
+                                       const void *p_data,
+                                       uint32_t nr_bytes )
+{
+    const uint8_t *p_src = (const uint8_t *)p_data;
+    int32_t status = 0;
+
+    while ( ( nr_bytes > 0 ) && ( status == 0 ) )
+    {
+        uint32_t nr_copy = w->chunk_size - w->fill;
+
+        if ( nr_copy > nr_bytes )
+        {
+            nr_copy = nr_bytes;
+        }
+        memcpy( &(w->p_mem[(size_t)w->head * w->chunk_size + w->fill]), p_src, nr_copy );
+        w->fill += nr_copy;
+        p_src += nr_copy;
+        nr_bytes -= nr_copy;
+
+        if ( w->fill == w->chunk_size )
+        {
+            status = _rx_writer_submit_chunk( w );
+        }
+    }
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Drain the ring, write the final partial chunk, sync and close the file, and release all
+    memory.  Safe to call on a writer that failed to open.
+
+    @param[in] w            writer
+
+    @return 0 on success, else the first error encountered while writing
+*/
+static inline int32_t rx_writer_close( struct rx_writer *w )
+{
+    int32_t status = 0;
+
+    if ( w->thread_started )
+    {
+        pthread_mutex_lock( &(w->lock) );
+        w->closing = true;
+        pthread_cond_signal( &(w->chunk_ready) );
+        pthread_mutex_unlock( &(w->lock) );
+        pthread_join( w->thread, NULL );
+        w->thread_started = false;
+        status = w->status;
+    }
+
+    if ( ( w->fd >= 0 ) && ( w->p_pool != NULL ) && ( status == 0 ) )
+    {
+        uint32_t nr_written = 0;
+
+        /* the writer thread is gone, compress and write the tail here and complete the file */
+        if ( w->fill > 0 )
+        {
+            struct _rx_writer_job job = { .w = w, .idx = w->head };
+
+            w->p_chunk_len[w->head] = w->fill;
+            _rx_writer_compress( &job );
+            status = _rx_writer_write_chunk( w, w->head, &nr_written );
+            if ( status == 0 )
+            {
+                w->nr_bytes_written += nr_written;
+                w->nr_bytes_in += w->fill;
+            }
+            w->fill = 0;
+        }
+        if ( status == 0 )
+        {
+            struct iq_compress_header hdr;
+
+            memset( &hdr, 0, sizeof(hdr) );
+            hdr.magic = IQ_COMPRESS_MAGIC;
+            hdr.version = IQ_COMPRESS_VERSION;
+            hdr.codec = IQ_COMPRESS_CODEC_DELTA_PACK;
+            hdr.chunk_size = w->chunk_size;
+            hdr.nr_chunks = w->nr_table;
+            hdr.data_size = w->nr_bytes_in;
+            hdr.table_offset = w->file_offset;
+            status = _rx_writer_write_all( w->fd, (const uint8_t *)w->p_table,
+                                           w->nr_table * sizeof(struct iq_compress_chunk) );
+            if ( ( status == 0 ) && ( lseek( w->fd, 0, SEEK_SET ) != 0 ) )
+            {
+                status = -errno;
+            }
+            if ( status == 0 )
+            {
+                status = _rx_writer_write_all( w->fd, (const uint8_t *)&hdr, sizeof(hdr) );
+            }
+        }
+    }
+    else if ( ( w->fd >= 0 ) && ( w->fill > 0 ) && ( status == 0 ) )
+    {
+#ifdef O_DIRECT
+        if ( w->direct_io )
+        {
+            /* the tail is generally not a multiple of the device block size */
+            (void)fcntl( w->fd, F_SETFL, fcntl( w->fd, F_GETFL ) & ~O_DIRECT );
+        }
+#endif
+        status = _rx_writer_write_all( w->fd, &(w->p_mem[(size_t)w->head * w->chunk_size]),
+                                       w->fill );
+        if ( status == 0 )
+        {
+            w->nr_bytes_written += w->fill;
+            w->nr_bytes_in += w->fill;
+        }
+        w->fill = 0;
+    }
+
+    if ( w->fd >= 0 )
+    {
+        (void)fsync( w->fd );
+        if ( ( close( w->fd ) != 0 ) && ( status == 0 ) )
+        {
+            status = -errno;
+        }
+        w->fd = -1;
+    }
+
+    _rx_writer_free( w );
+    w->p_mem = NULL;
+    w->p_chunk_len = NULL;
+    w->p_jobs = NULL;
+    w->p_zmem = NULL;
+    w->p_zlen = NULL;
+    w->p_zdone = NULL;
+    w->p_table = NULL;
+    w->p_pool = NULL;
+
+    return status;
+}
+
+#endif  /* __RX_WRITER_H__ */
@@ -0,0 +1,470 @@
+/**
+ * @file   spsc_ring.h
+ *
+ * @brief  Bounded single-producer / single-consumer ring used to decouple a streaming thread from
+ *         the thread that feeds or drains it.
+ *
+ * The ring has a power of two number of slots.  The producer and the consumer each own one index
+ * (on separate cache lines) and only read the other side's index when their cached copy says the
+ * ring is full or empty, so passing an entry costs no lock and usually no shared cache line
+ * transfer.  Slots either carry slot_size bytes of payload, or (slot_size == 0) only an index,
+ * which lets the caller keep its own array of buffers (e.g. transmit blocks) parallel to the
+ * ring.
+ *
+ * A side that finds the ring full (or empty) spins briefly and then parks on a condition
+ * variable; the other side only takes the mutex when it sees that its peer is parked.
+ *
+ * The producer samples the ring occupancy on every commit, which tells which side of a pipeline
+ * is the bottleneck: a ring that is usually full means the consumer cannot keep up, a ring that
+ * is usually empty means the producer cannot.
+ */
+
+#ifndef __SPSC_RING_H__
+#define __SPSC_RING_H__
+
+/***** INCLUDES *****/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+
+/***** DEFINES *****/
+
+/* alignment of each slot, and of the indices to keep them on separate cache lines */
+#define SPSC_RING_ALIGN                 (64)
+
+/* number of times a side polls the other side's index before it parks */
+#define SPSC_RING_DEFAULT_SPIN          (4000)
+
+/* upper bound on the time a side stays parked without re-checking for progress */
+#define SPSC_RING_PARK_NS               (10 * 1000 * 1000)
+
+/* the occupancy histogram splits the ring into this many equal ranges */
+#define SPSC_RING_NR_OCCUPANCY_BINS     (4)
+
+#if (defined __x86_64__ || defined __i386__)
+#   define SPSC_RING_CPU_RELAX()        __asm__ __volatile__( "pause" ::: "memory" )
+#elif (defined __aarch64__) || (defined __arm__)
+#   define SPSC_RING_CPU_RELAX()        __asm__ __volatile__( "yield" ::: "memory" )
+#else
+#   define SPSC_RING_CPU_RELAX()        __asm__ __volatile__( "" ::: "memory" )
+#endif
+
+/***** TYPEDEFS *****/
+
+struct spsc_ring
+{
+    uint8_t *p_mem;                     /* nr_slots * slot_size bytes, or NULL */
+    uint32_t *p_len;                    /* number of valid bytes in each slot */
+    uint64_t *p_meta;                   /* caller defined value for each slot (e.g. timestamp) */
+    uint32_t slot_size;
+    uint32_t nr_slots;
+    uint32_t mask;
+    uint32_t spin_count;
+
+    /* producer state */
+    uint64_t head __attribute__((aligned(SPSC_RING_ALIGN)));
+    uint64_t cached_tail;
+    uint64_t nr_full_waits;             /* times the producer found the ring full */
+    uint64_t nr_commits;
+    uint64_t occupancy_sum;
+    uint32_t max_occupancy;
+    uint64_t occupancy_hist[SPSC_RING_NR_OCCUPANCY_BINS];
+
+    /* consumer state */
+    uint64_t tail __attribute__((aligned(SPSC_RING_ALIGN)));
+    uint64_t cached_head;
+    uint64_t nr_empty_waits;            /* times the consumer found the ring empty */
+
+    /* parking, shared */
+    uint32_t producer_parked __attribute__((aligned(SPSC_RING_ALIGN)));
+    uint32_t consumer_parked;
+    bool closed;                        /* the producer will not commit any more entries */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+#define SPSC_RING_INITIALIZER                           \
+    (struct spsc_ring){                                 \
+        .p_mem = NULL,                                  \
+        .p_len = NULL,                                  \
+        .p_meta = NULL,                                 \
+        .slot_size = 0,                                 \
+        .nr_slots = 0,                                  \
+        .mask = 0,                                      \
+        .spin_count = SPSC_RING_DEFAULT_SPIN,           \
+        .head = 0,                                      \
+        .cached_tail = 0,                               \
+        .tail = 0,                                      \
+        .cached_head = 0,                               \
+        .producer_parked = 0,                           \
+        .consumer_parked = 0,                           \
+        .closed = false,                                \
+        .lock = PTHREAD_MUTEX_INITIALIZER,              \
+        .wake = PTHREAD_COND_INITIALIZER,               \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+/*****************************************************************************/
+/** Release the memory of a ring.  Safe to call on a ring that failed to initialize.
+
+    @param[in] r            ring
+
+    @return void
+*/
+static inline void spsc_ring_free( struct spsc_ring *r )
+{
+    free( r->p_mem );
+    free( r->p_len );
+    free( r->p_meta );
+    r->p_mem = NULL;
+    r->p_len = NULL;
+    r->p_meta = NULL;
+    r->nr_slots = 0;
+}
+
+/*****************************************************************************/
+/** Allocate a ring.
+
+    @param[out] r           ring to initialize
+    @param[in]  nr_slots    number of slots, rounded up to a power of two
+    @param[in]  slot_size   number of payload bytes in each slot, 0 for an index-only ring
+    @param[in]  spin_count  number of polls before parking, 0 to park immediately
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t spsc_ring_init( struct spsc_ring *r,
+                                      uint32_t nr_slots,
+                                      uint32_t slot_size,
+                                      uint32_t spin_count )
+{
+    uint32_t n = 1;
+
+    *r = SPSC_RING_INITIALIZER;
+    if ( ( nr_slots == 0 ) || ( nr_slots > ( UINT32_MAX / 2 ) ) )
+    {
+        return -EINVAL;
+    }
+    while ( n < nr_slots )
+    {
+        n <<= 1;
+    }
+
+    r->nr_slots = n;
+    r->mask = n - 1;
+    r->spin_count = spin_count;
+    r->slot_size = ( slot_size + SPSC_RING_ALIGN - 1 ) & ~( SPSC_RING_ALIGN - 1 );
+
+    r->p_len = calloc( n, sizeof(uint32_t) );
+    r->p_meta = calloc( n, sizeof(uint64_t) );
+    if ( ( r->p_len == NULL ) || ( r->p_meta == NULL ) )
+    {
+        spsc_ring_free( r );
+        return -ENOMEM;
+    }
+    if ( r->slot_size > 0 )
+    {
+        if ( posix_memalign( (void **)&(r->p_mem), SPSC_RING_ALIGN,
+                             (size_t)n * r->slot_size ) != 0 )
+        {
+            r->p_mem = NULL;
+            spsc_ring_free( r );
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Get the payload of a slot.
+
+    @param[in] r            ring
+    @param[in] index        slot index from spsc_ring_reserve() or spsc_ring_peek()
+
+    @return the slot payload, or NULL for an index-only ring
+*/
+static inline void *spsc_ring_slot( struct spsc_ring *r,
+                                    uint32_t index )
+{
+    return ( r->p_mem == NULL ) ? NULL : (void *)( r->p_mem + ( (size_t)index * r->slot_size ) );
+}
+
+/* park until the counter at p_index moves away from seen, announcing it through *p_parked */
+static inline void _spsc_ring_park( struct spsc_ring *r,
+                                    uint64_t *p_index,
+                                    uint64_t seen,
+                                    uint32_t *p_parked,
+                                    volatile bool *p_running )
+{
+    __atomic_store_n( p_parked, 1, __ATOMIC_SEQ_CST );
+    pthread_mutex_lock( &(r->lock) );
+    while ( ( __atomic_load_n( p_index, __ATOMIC_SEQ_CST ) == seen ) &&
+            !__atomic_load_n( &(r->closed), __ATOMIC_SEQ_CST ) &&
+            ( ( p_running == NULL ) || *p_running ) )
+    {
+        struct timespec ts;
+
+        /* a bounded wait so that a stop request is noticed without progress */
+        clock_gettime( CLOCK_REALTIME, &ts );
+        ts.tv_nsec += SPSC_RING_PARK_NS;
+        if ( ts.tv_nsec >= 1000000000L )
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        (void)pthread_cond_timedwait( &(r->wake), &(r->lock), &ts );
+    }
+    pthread_mutex_unlock( &(r->lock) );
+    __atomic_store_n( p_parked, 0, __ATOMIC_SEQ_CST );
+}
+
+static inline void _spsc_ring_wake( struct spsc_ring *r,
+                                    uint32_t *p_parked )
+{
+    if ( __atomic_load_n( p_parked, __ATOMIC_SEQ_CST ) != 0 )
+    {
+        pthread_mutex_lock( &(r->lock) );
+        pthread_cond_broadcast( &(r->wake) );
+        pthread_mutex_unlock( &(r->lock) );
+    }
+}
+
+/*****************************************************************************/
+/** Reserve the next slot for the producer, waiting while the ring is full.
+
+    @param[in]  r           ring
+    @param[out] p_index     index of the reserved slot
+    @param[in]  p_running   stop waiting once this becomes false, may be NULL
+
+    @return 0 on success, -ECANCELED if the wait was abandoned
+*/
+static inline int32_t spsc_ring_reserve( struct spsc_ring *r,
+                                         uint32_t *p_index,
+                                         volatile bool *p_running )
+{
+    bool counted = false;
+
+    while ( ( r->head - r->cached_tail ) >= r->nr_slots )
+    {
+        uint32_t spin;
+
+        r->cached_tail = __atomic_load_n( &(r->tail), __ATOMIC_ACQUIRE );
+        if ( ( r->head - r->cached_tail ) < r->nr_slots )
+        {
+            break;
+        }
+        if ( !counted )
+        {
+            r->nr_full_waits++;
+            counted = true;
+        }
+        if ( ( p_running != NULL ) && !*p_running )
+        {
+            return -ECANCELED;
+        }
+
+        for ( spin = 0; spin < r->spin_count; spin++ )
+        {
+            if ( __atomic_load_n( &(r->tail), __ATOMIC_ACQUIRE ) != r->cached_tail )
+            {
+                break;
+            }
+            SPSC_RING_CPU_RELAX();
+        }
+        if ( spin == r->spin_count )
+        {
+            _spsc_ring_park( r, &(r->tail), r->cached_tail, &(r->producer_parked), p_running );
+        }
+    }
+
+    *p_index = (uint32_t)( r->head & r->mask );
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Publish the slot reserved with spsc_ring_reserve() to the consumer.
+
+    @param[in] r            ring
+    @param[in] len          number of valid payload bytes in the slot
+    @param[in] meta         caller defined value passed along with the slot
+
+    @return void
+*/
+static inline void spsc_ring_commit( struct spsc_ring *r,
+                                     uint32_t len,
+                                     uint64_t meta )
+{
+    uint32_t index = (uint32_t)( r->head & r->mask );
+    uint32_t occupancy;
+
+    r->p_len[index] = len;
+    r->p_meta[index] = meta;
+    __atomic_store_n( &(r->head), r->head + 1, __ATOMIC_SEQ_CST );
+    _spsc_ring_wake( r, &(r->consumer_parked) );
+
+    /* the occupancy including the entry just committed, unless the consumer already took it */
+    occupancy = (uint32_t)( r->head - __atomic_load_n( &(r->tail), __ATOMIC_RELAXED ) );
+    if ( occupancy == 0 )
+    {
+        occupancy = 1;
+    }
+    else if ( occupancy > r->nr_slots )
+    {
+        occupancy = r->nr_slots;
+    }
+    r->nr_commits++;
+    r->occupancy_sum += occupancy;
+    if ( occupancy > r->max_occupancy )
+    {
+        r->max_occupancy = occupancy;
+    }
+    r->occupancy_hist[ ( (uint64_t)( occupancy - 1 ) * SPSC_RING_NR_OCCUPANCY_BINS ) /
+                       r->nr_slots ]++;
+}
+
+/*****************************************************************************/
+/** Tell the consumer that no more entries will be committed.  The consumer still drains the
+    entries that are in the ring.
+
+    @param[in] r            ring
+
+    @return void
+*/
+static inline void spsc_ring_close( struct spsc_ring *r )
+{
+    __atomic_store_n( &(r->closed), true, __ATOMIC_SEQ_CST );
+    pthread_mutex_lock( &(r->lock) );
+    pthread_cond_broadcast( &(r->wake) );
+    pthread_mutex_unlock( &(r->lock) );
+}
+
+/*****************************************************************************/
+/** Get the oldest entry for the consumer, waiting while the ring is empty.
+
+    @param[in]  r           ring
+    @param[out] p_index     index of the entry's slot
+    @param[out] p_len       number of valid payload bytes, may be NULL
+    @param[out] p_meta      value committed with the entry, may be NULL
+    @param[in]  p_running   stop waiting once this becomes false, may be NULL
+
+    @return 0 on success, -ENODATA once the ring is closed and drained, -ECANCELED if the wait was
+            abandoned
+*/
+static inline int32_t spsc_ring_peek( struct spsc_ring *r,
+                                      uint32_t *p_index,
+                                      uint32_t *p_len,
+                                      uint64_t *p_meta,
+                                      volatile bool *p_running )
+{
+    bool counted = false;
+
+    while ( r->tail == r->cached_head )
+    {
+        uint32_t spin;
+
+        r->cached_head = __atomic_load_n( &(r->head), __ATOMIC_ACQUIRE );
+        if ( r->tail != r->cached_head )
+        {
+            break;
+        }
+        if ( __atomic_load_n( &(r->closed), __ATOMIC_SEQ_CST ) )
+        {
+            /* the producer may have committed a last entry just before closing */
+            r->cached_head = __atomic_load_n( &(r->head), __ATOMIC_ACQUIRE );
+            if ( r->tail != r->cached_head )
+            {
+                break;
+            }
+            return -ENODATA;
+        }
+        if ( !counted )
+        {
+            r->nr_empty_waits++;
+            counted = true;
+        }
+        if ( ( p_running != NULL ) && !*p_running )
+        {
+            return -ECANCELED;
+        }
+
+        for ( spin = 0; spin < r->spin_count; spin++ )
+        {
+            if ( __atomic_load_n( &(r->head), __ATOMIC_ACQUIRE ) != r->cached_head )
+            {
+                break;
+            }
+            SPSC_RING_CPU_RELAX();
+        }
+        if ( spin == r->spin_count )
+        {
+            _spsc_ring_park( r, &(r->head), r->cached_head, &(r->consumer_parked), p_running );
+        }
+    }
+
+    *p_index = (uint32_t)( r->tail & r->mask );
+    if ( p_len != NULL )
+    {
+        *p_len = r->p_len[*p_index];
+    }
+    if ( p_meta != NULL )
+    {
+        *p_meta = r->p_meta[*p_index];
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Hand the entry returned by spsc_ring_peek() back to the producer.
+
+    @param[in] r            ring
+
+    @return void
+*/
+static inline void spsc_ring_release( struct spsc_ring *r )
+{
+    __atomic_store_n( &(r->tail), r->tail + 1, __ATOMIC_SEQ_CST );
+    _spsc_ring_wake( r, &(r->producer_parked) );
+}
+
+/*****************************************************************************/
+/** Print the occupancy statistics of a ring.  Should be called once both sides are done.
+
+    @param[in] r            ring
+    @param[in] p_name       name of the ring in the report
+    @param[in] p_fp         destination, e.g. stdout
+
+    @return void
+*/
+static inline void spsc_ring_print_stats( const struct spsc_ring *r,
+                                          const char *p_name,
+                                          FILE *p_fp )
+{
+    uint32_t i;
+
+    fprintf( p_fp, "Info: %s ring: %" PRIu64 " entries, occupancy mean %.1f / max %" PRIu32
+             " of %" PRIu32 " slots, producer waited on full %" PRIu64 " times, consumer"
+             " waited on empty %" PRIu64 " times\n", p_name, r->nr_commits,
+             ( r->nr_commits > 0 ) ? (double)r->occupancy_sum / (double)r->nr_commits : 0.0,
+             r->max_occupancy, r->nr_slots, r->nr_full_waits, r->nr_empty_waits );
+    fprintf( p_fp, "Info: %s ring occupancy:", p_name );
+    for ( i = 0; i < SPSC_RING_NR_OCCUPANCY_BINS; i++ )
+    {
+        fprintf( p_fp, " %" PRIu32 "-%" PRIu32 "%%: %.1f%%", ( 100 * i ) / SPSC_RING_NR_OCCUPANCY_BINS,
+                 ( 100 * ( i + 1 ) ) / SPSC_RING_NR_OCCUPANCY_BINS,
+                 ( r->nr_commits > 0 ) ?
+                 ( 100.0 * (double)r->occupancy_hist[i] / (double)r->nr_commits ) : 0.0 );
+    }
+    fprintf( p_fp, "\n" );
+}
+
+#endif  /* __SPSC_RING_H__ */
@@ -0,0 +1,953 @@
+/*! \file stream_benchmark.c
+ * \brief This file contains an application that benchmarks the receive or
+ * transmit streaming path over a sweep of configurations and reports one
+ * machine-readable record per configuration.
+ *
+ * <pre>
+ * Copyright 2014-2021 Epiq Solutions, All Rights Reserved
+ * </pre>
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <sidekiq_api.h>
+#include <arg_parser.h>
+
+#include "elapsed.h"
+
+/* https://gcc.gnu.org/onlinedocs/gcc-4.8.5/cpp/Stringification.html */
+#define xstr(s)                         str(s)
+#define str(s)                          #s
+
+#ifndef DEFAULT_CARD_NUMBER
+#   define DEFAULT_CARD_NUMBER  0
+#endif
+
+#ifndef DEFAULT_RUN_TIME
+#   define DEFAULT_RUN_TIME     5
+#endif
+
+#ifndef DEFAULT_WARMUP_TIME
+#   define DEFAULT_WARMUP_TIME  1
+#endif
+
+#ifndef DEFAULT_NUM_THREADS
+#   define DEFAULT_NUM_THREADS  4
+#endif
+
+/* longest list accepted by any of the sweep options */
+#define MAX_NR_VALUES           (16)
+
+#define NUM_NANOSEC_IN_SEC      (1000000000ULL)
+
+/* these are used to provide help strings for the application when running it
+   with either the "-h" or "--help" flags */
+static const char* p_help_short = "- benchmark streaming over a sweep of configurations";
+static const char* p_help_long = "\
+Streams in one direction with every combination of the listed settings and\n\
+reports one record per combination: sustained throughput in MB/s, timestamp\n\
+gaps (receive), underruns and late timestamps (transmit), process CPU\n\
+utilization (100% is one CPU) and the latency percentiles of skiq_receive() or\n\
+skiq_transmit().  Each combination streams for '--warmup' seconds that are\n\
+not measured and then for '--time' seconds.\n\
+\n\
+Receive sweeps '--rates', '--stream-modes' (high_tput, low_latency, balanced)\n\
+and '--packed'; transmit sweeps '--rates', '--packed', '--block-sizes' (in\n\
+words) and '--transfer-modes' (sync, async).  Lists are comma separated.\n\
+libsidekiq has no receive block size setting, the stream mode selects it, so\n\
+'--block-sizes' only applies to transmit and the receive records hold the\n\
+block size each stream mode delivered.\n\
+Low latency with packed samples is not supported and is skipped.\n\
+\n\
+The records are written to '--output' (or stdout) as CSV with a header line\n\
+or as one JSON object per line ('--format'), tagged with the libsidekiq\n\
+version so results of different SDK releases can be compared.  The fastest\n\
+combination without gaps, underruns or late timestamps is printed at the end.\n\
+\n\
+Defaults:\n\
+  --card=" xstr(DEFAULT_CARD_NUMBER) "\n\
+  --direction=rx\n\
+  --rates=1000000,10000000\n\
+  --stream-modes=high_tput\n\
+  --packed=0\n\
+  --block-sizes=1020\n\
+  --transfer-modes=sync\n\
+  --threads=" xstr(DEFAULT_NUM_THREADS) "\n\
+  --time=" xstr(DEFAULT_RUN_TIME) "\n\
+  --warmup=" xstr(DEFAULT_WARMUP_TIME) "\n\
+  --format=csv\n\
+";
+
+/* command line argument variables */
+static uint8_t card = UINT8_MAX;
+static char* p_serial = NULL;
+static char* p_direction = "rx";
+static char* p_rates = "1000000,10000000";
+static char* p_stream_modes = "high_tput";
+static char* p_packed = "0";
+static char* p_block_sizes = "1020";
+static char* p_transfer_modes = "sync";
+static uint8_t num_threads = DEFAULT_NUM_THREADS;
+static uint32_t run_time = DEFAULT_RUN_TIME;
+static uint32_t warmup_time = DEFAULT_WARMUP_TIME;
+static bool blocking_rx = false;
+static char* p_output_path = NULL;
+static char* p_format = NULL;
+
+/* the command line arguments available to this application */
+static struct application_argument p_args[] =
+{
+    APP_ARG_OPT("card",
+                'c',
+                "Specify Sidekiq by card index",
+                "ID",
+                &card,
+                UINT8_VAR_TYPE),
+    APP_ARG_OPT("serial",
+                'S',
+                "Specify Sidekiq by serial number",
+                "SERNUM",
+                &p_serial,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("direction",
+                'd',
+                "Benchmark receive (rx) or transmit (tx) on handle A1",
+                "rx|tx",
+                &p_direction,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("rates",
+                'r',
+                "Sample rates to sweep",
+                "Hz[,Hz]...",
+                &p_rates,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("stream-modes",
+                0,
+                "Receive stream modes to sweep",
+                "MODE[,MODE]...",
+                &p_stream_modes,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("packed",
+                0,
+                "I/Q pack modes to sweep (0 unpacked, 1 packed)",
+                "0|1[,0|1]",
+                &p_packed,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("block-sizes",
+                0,
+                "Transmit block sizes to sweep",
+                "WORDS[,WORDS]...",
+                &p_block_sizes,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("transfer-modes",
+                0,
+                "Transmit transfer modes to sweep",
+                "MODE[,MODE]",
+                &p_transfer_modes,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("threads",
+                0,
+                "Number of threads for asynchronous transmit",
+                "N",
+                &num_threads,
+                UINT8_VAR_TYPE),
+    APP_ARG_OPT("time",
+                't',
+                "Number of seconds to measure each combination",
+                "SECONDS",
+                &run_time,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("warmup",
+                0,
+                "Number of seconds to stream before measuring",
+                "SECONDS",
+                &warmup_time,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("blocking",
+                0,
+                "Perform blocking during skiq_receive call",
+                NULL,
+                &blocking_rx,
+                BOOL_VAR_TYPE),
+    APP_ARG_OPT("output",
+                'o',
+                "Write the records to PATH instead of stdout",
+                "PATH",
+                &p_output_path,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("format",
+                0,
+                "Format of the records, csv or json",
+                "FORMAT",
+                &p_format,
+                STRING_VAR_TYPE),
+    APP_ARG_TERMINATOR,
+};
+
+
+/***** TYPEDEFS *****/
+
+/* one combination of the sweep */
+struct run_config
+{
+    bool transmit;
+    uint32_t sample_rate;
+    skiq_rx_stream_mode_t stream_mode;
+    bool packed;
+    uint16_t block_size_in_words;       /* transmit only */
+    skiq_tx_transfer_mode_t transfer_mode;
+};
+
+struct run_result
+{
+    int32_t status;
+    double seconds;
+    double cpu_pct;
+    uint64_t num_bytes;
+    uint64_t num_blocks;
+    uint64_t ts_gaps;
+    uint32_t underruns;
+    uint32_t late;
+    uint32_t block_size_in_words;       /* as received, or as configured */
+    struct elapsed_hist latency;        /* skiq_receive() or skiq_transmit() */
+};
+
+
+/***** LOCAL VARIABLES *****/
+
+static bool running = true;
+static char sdk_version[32];
+
+static const char *stream_mode_names[] =
+{
+    [skiq_rx_stream_mode_high_tput] = "high_tput",
+    [skiq_rx_stream_mode_low_latency] = "low_latency",
+    [skiq_rx_stream_mode_balanced] = "balanced",
+};
+
+static SKIQ_TX_BLOCK_INITIALIZER_BY_WORDS(tx_block, SKIQ_MAX_TX_BLOCK_SIZE_IN_WORDS);
+
+/* signaled by the transmit complete callback in async mode */
+static pthread_mutex_t space_avail_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t space_avail_cond = PTHREAD_COND_INITIALIZER;
+
+/* a run_result holds a histogram, keep them off the stack */
+static struct run_result result;
+static struct run_result best;
+static struct run_config best_cfg;
+static bool have_best = false;
+
+
+/***** LOCAL FUNCTIONS *****/
+
+/*****************************************************************************/
+/** This is the cleanup handler to ensure that the app properly exits and
+    does the needed cleanup if it ends unexpectedly.
+
+    @param signum: the signal number that occurred
+    @return void
+*/
+static void app_cleanup(int signum)
+{
+    printf("Info: received signal %d, cleaning up libsidekiq\n", signum);
+    running = false;
+}
+
+/*****************************************************************************/
+/** This is the callback function that is called when running in async mode
+    when a packet has completed processing.
+
+    @param status status of the transmit packet completed
+    @param p_block pointer to the transmit block that has completed processing
+    @param p_user pointer to user data (ignored)
+    @return void
+*/
+static void tx_complete_callback( int32_t status, skiq_tx_block_t *p_block, void *p_user )
+{
+    (void)status;
+    (void)p_block;
+    (void)p_user;
+
+    pthread_mutex_lock( &space_avail_mutex );
+    pthread_cond_signal( &space_avail_cond );
+    pthread_mutex_unlock( &space_avail_mutex );
+}
+
+/*****************************************************************************/
+/** This function parses a comma separated list of unsigned numbers.
+
+    @param p_list the list
+    @param p_values array that receives the values
+    @param max_value largest value accepted
+    @param p_nr_values number of values parsed
+    @return int32_t 0 on success, -EINVAL on a malformed list
+*/
+static int32_t parse_uint_list( const char *p_list,
+                                uint32_t p_values[MAX_NR_VALUES],
+                                uint32_t max_value,
+                                uint32_t *p_nr_values )
+{
+    const char *p = p_list;
+
+    *p_nr_values = 0;
+    while ( *p != '\0' )
+    {
+        char *p_end = NULL;
+        unsigned long long value;
+
+        errno = 0;
+        value = strtoull( p, &p_end, 0 );
+        if ( ( p_end == p ) || ( errno != 0 ) || ( value > max_value ) ||
+             ( *p_nr_values == MAX_NR_VALUES ) || ( ( *p_end != ',' ) && ( *p_end != '\0' ) ) )
+        {
+            return -EINVAL;
+        }
+        p_values[(*p_nr_values)++] = (uint32_t)value;
+        p = ( *p_end == ',' ) ? p_end + 1 : p_end;
+    }
+
+    return ( *p_nr_values > 0 ) ? 0 : -EINVAL;
+}
+
+/*****************************************************************************/
+/** This function parses a comma separated list of names into the index of
+    each name in a table.
+
+    @param p_list the list
+    @param p_names table of names, NULL entries are skipped
+    @param nr_names number of entries in the table
+    @param p_values array that receives the indices
+    @param p_nr_values number of values parsed
+    @return int32_t 0 on success, -EINVAL on an unknown name
+*/
+static int32_t parse_name_list( const char *p_list,
+                                const char *p_names[],
+                                uint32_t nr_names,
+                                uint32_t p_values[MAX_NR_VALUES],
+                                uint32_t *p_nr_values )
+{
+    const char *p = p_list;
+
+    *p_nr_values = 0;
+    while ( *p != '\0' )
+    {
+        size_t len = strcspn( p, "," );
+        uint32_t i;
+
+        for ( i = 0; i < nr_names; i++ )
+        {
+            if ( ( p_names[i] != NULL ) && ( strlen( p_names[i] ) == len ) &&
+                 ( strncasecmp( p, p_names[i], len ) == 0 ) )
+            {
+                break;
+            }
+        }
+        if ( ( i == nr_names ) || ( *p_nr_values == MAX_NR_VALUES ) )
+        {
+            return -EINVAL;
+        }
+        p_values[(*p_nr_values)++] = i;
+        p += len;
+        p += ( *p == ',' ) ? 1 : 0;
+    }
+
+    return ( *p_nr_values > 0 ) ? 0 : -EINVAL;
+}
+
+/* CPU time (user and system) consumed by all threads of the process so far */
+static uint64_t process_cpu_ns( void )
+{
+    struct rusage usage;
+
+    if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+    {
+        return 0;
+    }
+
+    return ( (uint64_t)( usage.ru_utime.tv_sec + usage.ru_stime.tv_sec ) * NUM_NANOSEC_IN_SEC ) +
+        ( (uint64_t)( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec ) * 1000 );
+}
+
+/*****************************************************************************/
+/** This function receives for the warm-up and measurement periods of one
+    combination and fills in the measurements.
+
+    @param p_cfg combination to measure
+    @param p_res measurements
+    @return int32_t 0 on success, else the status of the failing libsidekiq call
+*/
+static int32_t run_rx( const struct run_config *p_cfg,
+                       struct run_result *p_res )
+{
+    skiq_rx_hdl_t hdl = skiq_rx_hdl_A1;
+    skiq_rx_block_t *p_rx_block;
+    uint32_t data_len = 0;
+    uint64_t next_ts = 0;
+    bool first_block = true;
+    bool measuring = false;
+    uint64_t start_ns, measure_ns = 0, stop_ns, cpu_start_ns = 0;
+    int32_t status;
+
+    status = skiq_write_rx_stream_mode( card, p_cfg->stream_mode );
+    if ( status == 0 )
+    {
+        status = skiq_write_iq_pack_mode( card, p_cfg->packed );
+    }
+    if ( status == 0 )
+    {
+        status = skiq_write_rx_sample_rate_and_bandwidth( card, hdl, p_cfg->sample_rate,
+                                                          (uint32_t)(0.8 * p_cfg->sample_rate) );
+    }
+    if ( status == 0 )
+    {
+        status = skiq_start_rx_streaming( card, hdl );
+    }
+    if ( status != 0 )
+    {
+        return status;
+    }
+
+    start_ns = elapsed_now_ns();
+    stop_ns = start_ns + ( (uint64_t)( warmup_time + run_time ) * NUM_NANOSEC_IN_SEC );
+    while ( running )
+    {
+        uint64_t call_ns = elapsed_now_ns();
+        skiq_rx_status_t rx_status;
+
+        if ( !measuring && ( call_ns >= start_ns + ( (uint64_t)warmup_time * NUM_NANOSEC_IN_SEC ) ) )
+        {
+            measuring = true;
+            measure_ns = call_ns;
+            cpu_start_ns = process_cpu_ns();
+        }
+        if ( call_ns >= stop_ns )
+        {
+            break;
+        }
+
+        rx_status = skiq_receive( card, &hdl, &p_rx_block, &data_len );
+        if ( rx_status != skiq_rx_status_success )
+        {
+            continue;
+        }
+        if ( measuring )
+        {
+            elapsed_hist_record( &(p_res->latency), elapsed_now_ns() - call_ns );
+        }
+        if ( hdl != skiq_rx_hdl_A1 )
+        {
+            continue;
+        }
+
+        /* timestamps keep counting during the warm-up, so gaps are tracked throughout */
+        if ( !first_block && ( p_rx_block->rf_timestamp != next_ts ) && measuring )
+        {
+            p_res->ts_gaps++;
+        }
+        first_block = false;
+
+        p_res->block_size_in_words = (data_len / 4) - SKIQ_RX_HEADER_SIZE_IN_WORDS;
+        if ( p_cfg->packed )
+        {
+            next_ts = p_rx_block->rf_timestamp +
+                SKIQ_NUM_PACKED_SAMPLES_IN_BLOCK(p_res->block_size_in_words);
+        }
+        else
+        {
+            next_ts = p_rx_block->rf_timestamp + p_res->block_size_in_words;
+        }
+        if ( measuring )
+        {
+            p_res->num_blocks++;
+            p_res->num_bytes += data_len;
+        }
+    }
+
+    if ( measuring )
+    {
+        uint64_t end_ns = elapsed_now_ns();
+
+        p_res->seconds = (double)( end_ns - measure_ns ) / NUM_NANOSEC_IN_SEC;
+        p_res->cpu_pct = 100.0 * (double)( process_cpu_ns() - cpu_start_ns ) /
+            (double)( end_ns - measure_ns );
+    }
+
+    return skiq_stop_rx_streaming( card, skiq_rx_hdl_A1 );
+}
+
+/*****************************************************************************/
+/** This function transmits for the warm-up and measurement periods of one
+    combination and fills in the measurements.
+
+    @param p_cfg combination to measure
+    @param p_res measurements
+    @return int32_t 0 on success, else the status of the failing libsidekiq call
+*/
+static int32_t run_tx( const struct run_config *p_cfg,
+                       struct run_result *p_res )
+{
+    skiq_tx_hdl_t hdl = skiq_tx_hdl_A1;
+    bool measuring = false;
+    uint32_t underruns_start = 0, late_start = 0;
+    uint64_t start_ns, measure_ns = 0, stop_ns, cpu_start_ns = 0;
+    uint32_t num_bytes_in_block = p_cfg->block_size_in_words * sizeof(uint32_t);
+    int32_t status;
+
+    status = skiq_write_iq_pack_mode( card, p_cfg->packed );
+    if ( status == 0 )
+    {
+        status = skiq_write_tx_sample_rate_and_bandwidth( card, hdl, p_cfg->sample_rate,
+                                                          p_cfg->sample_rate );
+    }
+    if ( status == 0 )
+    {
+        status = skiq_write_tx_data_flow_mode( card, hdl, skiq_tx_immediate_data_flow_mode );
+    }
+    if ( status == 0 )
+    {
+        status = skiq_write_tx_block_size( card, hdl, p_cfg->block_size_in_words );
+    }
+    if ( status == 0 )
+    {
+        status = skiq_write_tx_transfer_mode( card, hdl, p_cfg->transfer_mode );
+    }
+    if ( ( status == 0 ) && ( p_cfg->transfer_mode == skiq_tx_transfer_mode_async ) )
+    {
+        status = skiq_write_num_tx_threads( card, num_threads );
+        if ( status == 0 )
+        {
+            status = skiq_register_tx_complete_callback( card, &tx_complete_callback );
+        }
+    }
+    if ( status == 0 )
+    {
+        status = skiq_start_tx_streaming( card, hdl );
+    }
+    if ( status != 0 )
+    {
+        return status;
+    }
+    p_res->block_size_in_words = p_cfg->block_size_in_words;
+
+    start_ns = elapsed_now_ns();
+    stop_ns = start_ns + ( (uint64_t)( warmup_time + run_time ) * NUM_NANOSEC_IN_SEC );
+    while ( running )
+    {
+        uint64_t call_ns = elapsed_now_ns();
+
+        if ( !measuring && ( call_ns >= start_ns + ( (uint64_t)warmup_time * NUM_NANOSEC_IN_SEC ) ) )
+        {
+            measuring = true;
+            measure_ns = call_ns;
+            cpu_start_ns = process_cpu_ns();
+            skiq_read_tx_num_underruns( card, hdl, &underruns_start );
+            skiq_read_tx_num_late_timestamps( card, hdl, &late_start );
+        }
+        if ( call_ns >= stop_ns )
+        {
+            break;
+        }
+
+        status = skiq_transmit( card, hdl, (skiq_tx_block_t *)&tx_block, NULL );
+        if ( ( status == SKIQ_TX_ASYNC_SEND_QUEUE_FULL ) &&
+             ( p_cfg->transfer_mode == skiq_tx_transfer_mode_async ) )
+        {
+            /* wait for a completion, but not forever in case it was missed */
+            struct timespec deadline;
+
+            clock_gettime( CLOCK_REALTIME, &deadline );
+            deadline.tv_nsec += 10000000;
+            if ( deadline.tv_nsec >= (long)NUM_NANOSEC_IN_SEC )
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= NUM_NANOSEC_IN_SEC;
+            }
+            pthread_mutex_lock( &space_avail_mutex );
+            pthread_cond_timedwait( &space_avail_cond, &space_avail_mutex, &deadline );
+            pthread_mutex_unlock( &space_avail_mutex );
+            /* a full queue is back pressure, not a failure of the combination */
+            status = 0;
+            continue;
+        }
+        else if ( status != 0 )
+        {
+            fprintf(stderr, "Error: transmit failed with status %" PRIi32 "\n", status);
+            break;
+        }
+
+        if ( measuring )
+        {
+            elapsed_hist_record( &(p_res->latency), elapsed_now_ns() - call_ns );
+            p_res->num_blocks++;
+            p_res->num_bytes += num_bytes_in_block;
+        }
+        status = 0;
+    }
+
+    if ( measuring )
+    {
+        uint64_t end_ns = elapsed_now_ns();
+        uint32_t underruns = underruns_start, late = late_start;
+
+        p_res->seconds = (double)( end_ns - measure_ns ) / NUM_NANOSEC_IN_SEC;
+        p_res->cpu_pct = 100.0 * (double)( process_cpu_ns() - cpu_start_ns ) /
+            (double)( end_ns - measure_ns );
+        skiq_read_tx_num_underruns( card, hdl, &underruns );
+        skiq_read_tx_num_late_timestamps( card, hdl, &late );
+        p_res->underruns = underruns - underruns_start;
+        p_res->late = late - late_start;
+    }
+
+    if ( skiq_stop_tx_streaming( card, hdl ) != 0 )
+    {
+        fprintf(stderr, "Warning: failed to stop transmit streaming\n");
+    }
+
+    return status;
+}
+
+/*****************************************************************************/
+/** This function writes the record of one combination.
+
+    @param fp destination
+    @param format csv or json
+    @param p_cfg combination
+    @param p_res its measurements
+    @return void
+*/
+static void write_record( FILE *fp,
+                          enum elapsed_export_format format,
+                          const struct run_config *p_cfg,
+                          const struct run_result *p_res )
+{
+    double mbps = ( p_res->seconds > 0.0 ) ?
+        ( (double)p_res->num_bytes / 1000000.0 / p_res->seconds ) : 0.0;
+    const char *p_fmt = ( format == elapsed_export_csv ) ?
+        "%s,%s,%" PRIu32 ",%s,%u,%" PRIu32 ",%s,%u,%" PRIi32 ",%.3f,%.3f,%" PRIu64 ",%" PRIu64
+        ",%" PRIu32 ",%" PRIu32 ",%.1f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n" :
+        "{\"sdk\":\"%s\",\"direction\":\"%s\",\"rate\":%" PRIu32 ",\"stream_mode\":\"%s\","
+        "\"packed\":%u,\"block_words\":%" PRIu32 ",\"transfer_mode\":\"%s\",\"threads\":%u,"
+        "\"status\":%" PRIi32 ",\"seconds\":%.3f,\"mbps\":%.3f,\"blocks\":%" PRIu64 ","
+        "\"ts_gaps\":%" PRIu64 ",\"underruns\":%" PRIu32 ",\"late\":%" PRIu32 ",\"cpu_pct\":%.1f,"
+        "\"p50_ns\":%" PRIu64 ",\"p99_ns\":%" PRIu64 ",\"p999_ns\":%" PRIu64 ",\"max_ns\":%" PRIu64
+        "}\n";
+
+    fprintf(fp, p_fmt, sdk_version, p_cfg->transmit ? "tx" : "rx", p_cfg->sample_rate,
+            p_cfg->transmit ? "" : stream_mode_names[p_cfg->stream_mode],
+            p_cfg->packed ? 1 : 0, p_res->block_size_in_words,
+            !p_cfg->transmit ? "" :
+            ( p_cfg->transfer_mode == skiq_tx_transfer_mode_async ) ? "async" : "sync",
+            ( p_cfg->transmit && ( p_cfg->transfer_mode == skiq_tx_transfer_mode_async ) ) ?
+            num_threads : 1,
+            p_res->status, p_res->seconds, mbps, p_res->num_blocks, p_res->ts_gaps,
+            p_res->underruns, p_res->late, p_res->cpu_pct,
+            elapsed_hist_percentile( &(p_res->latency), 0.50 ),
+            elapsed_hist_percentile( &(p_res->latency), 0.99 ),
+            elapsed_hist_percentile( &(p_res->latency), 0.999 ),
+            p_res->latency.max_ns);
+    fflush(fp);
+}
+
+/*****************************************************************************/
+/** This function measures one combination, records it and keeps track of
+    the fastest clean one.
+
+    @param fp destination of the record
+    @param format csv or json
+    @param p_cfg combination
+    @return void
+*/
+static void run_one( FILE *fp,
+                     enum elapsed_export_format format,
+                     const struct run_config *p_cfg )
+{
+    memset( &result, 0, sizeof(result) );
+    elapsed_hist_init( &(result.latency) );
+
+    if ( !p_cfg->transmit && p_cfg->packed &&
+         ( p_cfg->stream_mode == skiq_rx_stream_mode_low_latency ) )
+    {
+        printf("Info: skipping low latency stream mode with packed samples\n");
+        return;
+    }
+
+    printf("Info: %s at %" PRIu32 " Hz, %s%s, %s\n", p_cfg->transmit ? "transmit" : "receive",
+           p_cfg->sample_rate, p_cfg->packed ? "packed" : "unpacked",
+           p_cfg->transmit ? "" : ", stream mode ",
+           p_cfg->transmit ?
+           ( ( p_cfg->transfer_mode == skiq_tx_transfer_mode_async ) ? "async" : "sync" ) :
+           stream_mode_names[p_cfg->stream_mode]);
+
+    result.status = p_cfg->transmit ? run_tx( p_cfg, &result ) : run_rx( p_cfg, &result );
+    if ( result.status != 0 )
+    {
+        fprintf(stderr, "Error: combination failed with status %" PRIi32 "\n", result.status);
+    }
+    if ( !running )
+    {
+        /* an interrupted run isn't representative */
+        return;
+    }
+    write_record( fp, format, p_cfg, &result );
+
+    if ( ( result.status == 0 ) && ( result.ts_gaps == 0 ) && ( result.underruns == 0 ) &&
+         ( result.late == 0 ) && ( result.seconds > 0.0 ) )
+    {
+        double mbps = (double)result.num_bytes / result.seconds;
+
+        if ( !have_best || ( mbps > ( (double)best.num_bytes / best.seconds ) ) )
+        {
+            best = result;
+            best_cfg = *p_cfg;
+            have_best = true;
+        }
+    }
+}
+
+/*****************************************************************************/
+/** This is the main function for executing the stream_benchmark app.
+
+    @param argc-the # of arguments from the cmd line
+    @param argv-a vector of ascii string aruments from the cmd line
+    @return int-indicating status
+*/
+int main( int argc, char *argv[] )
+{
+    static const char *packed_names[] = { "0", "1" };
+    static const char *transfer_mode_names[] =
+    {
+        [skiq_tx_transfer_mode_sync] = "sync",
+        [skiq_tx_transfer_mode_async] = "async",
+    };
+    uint32_t rates[MAX_NR_VALUES], nr_rates = 0;
+    uint32_t stream_modes[MAX_NR_VALUES], nr_stream_modes = 0;
+    uint32_t packed_modes[MAX_NR_VALUES], nr_packed_modes = 0;
+    uint32_t block_sizes[MAX_NR_VALUES], nr_block_sizes = 0;
+    uint32_t transfer_modes[MAX_NR_VALUES], nr_transfer_modes = 0;
+    uint32_t r, s, p, b, t;
+    enum elapsed_export_format format = elapsed_export_csv;
+    FILE *p_output_fp = stdout;
+    struct run_config cfg;
+    uint8_t major = 0, minor = 0, patch = 0;
+    const char *p_label = "";
+    bool transmit;
+    int32_t status = 0;
+    pid_t owner = 0;
+
+    /* install a signal handler for proper cleanup */
+    signal(SIGINT, app_cleanup);
+
+    if ( 0 != arg_parser(argc, argv, p_help_short, p_help_long, p_args) )
+    {
+        perror("Command Line");
+        arg_parser_print_help(argv[0], p_help_short, p_help_long, p_args);
+        return (-1);
+    }
+
+    if ( ( strcasecmp( p_direction, "rx" ) != 0 ) && ( strcasecmp( p_direction, "tx" ) != 0 ) )
+    {
+        fprintf(stderr, "Error: direction must be rx or tx, not '%s'\n", p_direction);
+        return (-1);
+    }
+    transmit = ( strcasecmp( p_direction, "tx" ) == 0 );
+
+    if ( parse_uint_list( p_rates, rates, UINT32_MAX, &nr_rates ) != 0 )
+    {
+        fprintf(stderr, "Error: invalid list of sample rates '%s'\n", p_rates);
+        return (-1);
+    }
+    if ( parse_name_list( p_stream_modes, stream_mode_names,
+                          sizeof(stream_mode_names) / sizeof(stream_mode_names[0]),
+                          stream_modes, &nr_stream_modes ) != 0 )
+    {
+        fprintf(stderr, "Error: invalid list of stream modes '%s'\n", p_stream_modes);
+        return (-1);
+    }
+    if ( parse_name_list( p_packed, packed_names, 2, packed_modes, &nr_packed_modes ) != 0 )
+    {
+        fprintf(stderr, "Error: invalid list of pack modes '%s'\n", p_packed);
+        return (-1);
+    }
+    if ( ( parse_uint_list( p_block_sizes, block_sizes, SKIQ_MAX_TX_BLOCK_SIZE_IN_WORDS,
+                            &nr_block_sizes ) != 0 ) )
+    {
+        fprintf(stderr, "Error: invalid list of block sizes '%s' (at most %u words)\n",
+                p_block_sizes, SKIQ_MAX_TX_BLOCK_SIZE_IN_WORDS);
+        return (-1);
+    }
+    if ( parse_name_list( p_transfer_modes, transfer_mode_names,
+                          sizeof(transfer_mode_names) / sizeof(transfer_mode_names[0]),
+                          transfer_modes, &nr_transfer_modes ) != 0 )
+    {
+        fprintf(stderr, "Error: invalid list of transfer modes '%s'\n", p_transfer_modes);
+        return (-1);
+    }
+    if ( ( run_time == 0 ) || ( ( num_threads == 0 ) && transmit ) )
+    {
+        fprintf(stderr, "Error: the measurement time and number of threads must be non-zero\n");
+        return (-1);
+    }
+    if ( 0 != elapsed_export_parse_format( p_format, &format ) )
+    {
+        fprintf(stderr, "Error: unknown record format '%s', expected csv or json\n", p_format);
+        return (-1);
+    }
+
+    if( (UINT8_MAX != card) && (NULL != p_serial) )
+    {
+        fprintf(stderr, "Error: must specify EITHER card ID or serial number, not"
+                " both\n");
+        return (-1);
+    }
+    if (UINT8_MAX == card)
+    {
+        card = DEFAULT_CARD_NUMBER;
+    }
+
+    /* If specified, attempt to find the card with a matching serial number. */
+    if ( NULL != p_serial )
+    {
+        status = skiq_get_card_from_serial_string(p_serial, &card);
+        if ( 0 != status )
+        {
+            fprintf(stderr, "Error: cannot find card with serial number %s (result"
+                    " code %" PRIi32 ")\n", p_serial, status);
+            return (-1);
+        }
+
+        printf("Info: found serial number %s as card ID %" PRIu8 "\n",
+                p_serial, card);
+    }
+
+    if ( (SKIQ_MAX_NUM_CARDS - 1) < card )
+    {
+        fprintf(stderr, "Error: card ID %" PRIu8 " exceeds the maximum card ID"
+                " (%" PRIu8 ")\n", card, (SKIQ_MAX_NUM_CARDS - 1));
+        return (-1);
+    }
+
+    if ( NULL != p_output_path )
+    {
+        p_output_fp = fopen( p_output_path, "a" );
+        if ( NULL == p_output_fp )
+        {
+            fprintf(stderr, "Error: unable to open output file %s (errno %d)\n", p_output_path,
+                    errno);
+            return (-1);
+        }
+    }
+
+    skiq_read_libsidekiq_version( &major, &minor, &patch, &p_label );
+    snprintf( sdk_version, sizeof(sdk_version), "%u.%u.%u%s", major, minor, patch,
+              ( p_label != NULL ) ? p_label : "" );
+
+    printf("Info: initializing card %" PRIu8 "...\n", card);
+
+    status = skiq_init(skiq_xport_type_auto, skiq_xport_init_level_full, &card, 1);
+    if ( status != 0 )
+    {
+        if ( ( EBUSY == status ) &&
+             ( 0 != skiq_is_card_avail(card, &owner) ) )
+        {
+            fprintf(stderr, "Error: card %" PRIu8 " is already in use (by process ID"
+                    " %u); cannot initialize card.\n", card,
+                    (unsigned int) owner);
+        }
+        else if ( -EINVAL == status )
+        {
+            fprintf(stderr, "Error: unable to initialize libsidekiq; was a valid card"
+                    " specified? (result code %" PRIi32 ")\n", status);
+        }
+        else
+        {
+            fprintf(stderr, "Error: unable to initialize libsidekiq with status %" PRIi32
+                    "\n", status);
+        }
+        if ( p_output_fp != stdout )
+        {
+            fclose( p_output_fp );
+        }
+        return (-1);
+    }
+
+    if ( blocking_rx && !transmit )
+    {
+        /* set a modest rx timeout */
+        status = skiq_set_rx_transfer_timeout( card, 100000 );
+        if ( status != 0 )
+        {
+            fprintf(stderr, "Error: unable to set RX transfer timeout with status %" PRIi32
+                    "\n", status);
+            goto finished;
+        }
+    }
+
+    if ( format == elapsed_export_csv )
+    {
+        fprintf(p_output_fp, "sdk,direction,rate,stream_mode,packed,block_words,transfer_mode,"
+                "threads,status,seconds,mbps,blocks,ts_gaps,underruns,late,cpu_pct,p50_ns,"
+                "p99_ns,p999_ns,max_ns\n");
+    }
+
+    /* the transmit settings are held at their first value when receiving and
+       the other way around, so each direction only sweeps what applies to it */
+    memset( &cfg, 0, sizeof(cfg) );
+    cfg.transmit = transmit;
+    for ( r = 0; ( r < nr_rates ) && running; r++ )
+    {
+        cfg.sample_rate = rates[r];
+        for ( p = 0; ( p < nr_packed_modes ) && running; p++ )
+        {
+            cfg.packed = ( packed_modes[p] != 0 );
+            for ( s = 0; ( s < ( transmit ? 1 : nr_stream_modes ) ) && running; s++ )
+            {
+                cfg.stream_mode = (skiq_rx_stream_mode_t)stream_modes[s];
+                for ( b = 0; ( b < ( transmit ? nr_block_sizes : 1 ) ) && running; b++ )
+                {
+                    cfg.block_size_in_words = (uint16_t)block_sizes[b];
+                    for ( t = 0; ( t < ( transmit ? nr_transfer_modes : 1 ) ) && running; t++ )
+                    {
+                        cfg.transfer_mode = (skiq_tx_transfer_mode_t)transfer_modes[t];
+                        run_one( p_output_fp, format, &cfg );
+                    }
+                }
+            }
+        }
+    }
+
+    if ( have_best )
+    {
+        printf("Info: fastest clean combination: %.3f MB/s at %" PRIu32 " Hz, %s, %s\n",
+               (double)best.num_bytes / 1000000.0 / best.seconds, best_cfg.sample_rate,
+               best_cfg.packed ? "packed" : "unpacked",
+               best_cfg.transmit ?
+               ( ( best_cfg.transfer_mode == skiq_tx_transfer_mode_async ) ? "async" : "sync" ) :
+               stream_mode_names[best_cfg.stream_mode]);
+    }
+    else
+    {
+        printf("Info: no combination ran without gaps, underruns or late timestamps\n");
+    }
+
+finished:
+    skiq_exit();
+    if ( p_output_fp != stdout )
+    {
+        fclose( p_output_fp );
+    }
+
+    return ( status == 0 ) ? 0 : -1;
+}
@@ -23,31 +23,56 @@
 #include "arg_parser.h"
 #include "sidekiq_api.h"
 #include "elapsed.h"
+#include "psd.h"
+#include "rx_ready.h"
+#include "rx_continuity.h"
+#include "trace.h"
 
 #define SET_RX_LO_FREQ(_card,_hdl,_freq)                        \
     ({                                                          \
         int32_t _status;                                        \
+        struct trace_span _span;                                \
+        trace_begin(p_sweep_trace, &_span);                     \
         elapsed_start(&tune_time);                              \
         _status = skiq_write_rx_LO_freq( _card, _hdl, _freq );  \
         elapsed_end(&tune_time);                                \
+        trace_end(p_sweep_trace, &_span, "tune", (int64_t)(_freq)); \
         _status;                                                \
     })
 
 #define START_STREAM(_card,_hdl)                                \
     ({                                                          \
         int32_t _status;                                        \
+        struct trace_span _span;                                \
+        trace_begin(p_sweep_trace, &_span);                     \
         elapsed_start(&start_stream_time);                      \
         _status = skiq_start_rx_streaming(_card, _hdl);         \
         elapsed_end(&start_stream_time);                        \
+        trace_end(p_sweep_trace, &_span, "start", _hdl);        \
         _status;                                                \
     })
 
 #define STOP_STREAM(_card,_hdl)                                 \
     ({                                                          \
         int32_t _status;                                        \
+        struct trace_span _span;                                \
+        trace_begin(p_sweep_trace, &_span);                     \
         elapsed_start(&stop_stream_time);                       \
         _status = skiq_stop_rx_streaming(_card, _hdl);          \
         elapsed_end(&stop_stream_time);                         \
+        trace_end(p_sweep_trace, &_span, "stop", _hdl);         \
+        _status;                                                \
+    })
+
+#define RECEIVE(_card,_p_hdl,_pp_block,_p_len)                  \
+    ({                                                          \
+        skiq_rx_status_t _status;                               \
+        struct trace_span _span;                                \
+        uint64_t _start_ns = elapsed_now_ns();                  \
+        trace_begin(p_sweep_trace, &_span);                     \
+        _status = skiq_receive(_card, _p_hdl, _pp_block, _p_len); \
+        trace_end(p_sweep_trace, &_span, "receive", *(_p_len)); \
+        elapsed_hist_record(&receive_hist, elapsed_now_ns() - _start_ns); \
         _status;                                                \
     })
 
@@ -66,6 +91,17 @@
 #   define DEFAULT_CARD_NUMBER  0
 #endif
 
+#ifndef DEFAULT_SETTLE_BLOCKS
+#   define DEFAULT_SETTLE_BLOCKS    1
+#endif
+
+#ifndef DEFAULT_PSD_THRESHOLD
+#   define DEFAULT_PSD_THRESHOLD    -60
+#endif
+
+/* longest sleep with --event-driven, bounds the reaction to a stop */
+#define RX_READY_TIMEOUT_MS         100
+
 /* these are used to provide help strings for the application when running it
    with either the "-h" or "--help" flags */
 static const char* p_help_short = "- sweep LO and receive samples";
@@ -75,6 +111,41 @@ then stops streaming. The LO frequency is updated and streaming is restarted\n\
 and data is received for the number of iterations specified. Various metrics\n\
 are reported.\n\
 \n\
+With '--fast', the frequencies from start to stop are instead loaded into the\n\
+frequency hopping list and streaming is started only once.  Each hop is\n\
+scheduled on an RF timestamp that falls on a block boundary, so every block\n\
+received belongs to exactly one frequency.  The first '--settle' blocks after\n\
+each hop are discarded, then '--blocks' blocks are kept.  The sweep may have at\n\
+most 512 steps.  If '--destination' is given, each block that is\n\
+kept is written as a record: the frequency (uint64), the RF timestamp\n\
+(uint64), the hop number (uint32), the number of sample words (uint32), and\n\
+then the sample words.\n\
+\n\
+Adding '--psd=N' to '--fast' receives I/Q samples rather than the counter and\n\
+averages the kept blocks of each dwell into one N point Welch power spectrum\n\
+(Hann window, 50% overlap).  A line with the peak bin and the share of bins\n\
+above '--psd-threshold' dBFS is printed per dwell.  With '--destination',\n\
+the spectra are written instead of the samples: each frame is N float32\n\
+bins in dBFS (DC centred), preceded by a header holding the RF timestamp,\n\
+frequency, sample rate and number of segments.\n\
+\n\
+The latency of LO tuning, starting and stopping streaming, skiq_receive() and\n\
+(with '--fast') hop scheduling is kept in histograms; their percentiles are\n\
+printed at the end.  With '--stats', one line per histogram is also appended\n\
+to PATH after every pass of the sweep, as CSV or JSON ('--stats-format'), so\n\
+a long run can be watched while it is going.\n\
+\n\
+Without '--blocking', skiq_receive() is polled until a block arrives.  With\n\
+'--event-driven' the app sleeps instead until the card signals blocks (or, on\n\
+transports that can't, until enough of them have accumulated), so the CPU used\n\
+follows the sample rate.\n\
+\n\
+With '--trace=PATH', every tune, start, stop, hop and skiq_receive() call is\n\
+also recorded as a span, and every timestamp gap as an instant event, and\n\
+the last '--trace-events' of them are written to PATH in the Chrome trace\n\
+format at the end of the run (see trace.h for '--trace-counters' and\n\
+'--trace-marker').\n\
+\n\
 Defaults:\n\
   --card=" xstr(DEFAULT_CARD_NUMBER) "\n\
   --blocks=100\n\
@@ -82,21 +153,48 @@ Defaults:\n\
   --start=75000000\n\
   --stop=6000000000\n\
   --step=30000000\n\
+  --settle=" xstr(DEFAULT_SETTLE_BLOCKS) "\n\
+  --psd-threshold=" xstr(DEFAULT_PSD_THRESHOLD) "\n\
+  --stats-format=csv\n\
+" TRACE_HELP_DEFAULTS "\
 ";
 
 /* command line argument variables */
 static uint8_t card = UINT8_MAX ;
 static char* p_serial = NULL;
 static bool blocking_rx = false;
+static bool event_driven = false;
 static uint32_t num_blocks = 100;
 static uint32_t sample_rate = 10000000;
 static uint64_t start_freq = 75000000;
 static uint64_t stop_freq = 6000000000;
 static uint64_t step_size = 30000000;
 static uint32_t repeat = 0;
+static bool fast_sweep = false;
+static uint32_t settle_blocks = DEFAULT_SETTLE_BLOCKS;
+static char* p_file_path = NULL;
+static uint32_t psd_nr_bins = 0;
+static float psd_threshold = DEFAULT_PSD_THRESHOLD;
+static char* p_stats_path = NULL;
+static char* p_stats_format = NULL;
 /* boolean used to track status of application */
 static bool running = true;
 
+/* latency histograms, all recorded by the main thread */
+static struct elapsed_hist tune_hist;
+static struct elapsed_hist start_stream_hist;
+static struct elapsed_hist stop_stream_hist;
+static struct elapsed_hist receive_hist;
+static struct elapsed_hist hop_hist;
+static FILE *p_stats_fp = NULL;
+static enum elapsed_export_format stats_format = elapsed_export_csv;
+static struct rx_ready rx_ready = RX_READY_INITIALIZER;
+static struct trace trace = TRACE_INITIALIZER;
+static struct trace_buffer *p_sweep_trace = NULL;
+
+/* RF timestamp continuity of the A1 stream */
+static struct rx_continuity rx_cont = RX_CONTINUITY_INITIALIZER;
+
 /* the command line arguments available to this application */
 static struct application_argument p_args[] =
 {
@@ -154,14 +252,88 @@ static struct application_argument p_args[] =
                 NULL,
                 &blocking_rx,
                 BOOL_VAR_TYPE),
+    APP_ARG_OPT("event-driven",
+                0,
+                "Sleep until the card signals blocks instead of polling skiq_receive",
+                NULL,
+                &event_driven,
+                BOOL_VAR_TYPE),
+    APP_ARG_OPT("fast",
+                0,
+                "Sweep with timestamped frequency hops while streaming continuously",
+                NULL,
+                &fast_sweep,
+                BOOL_VAR_TYPE),
+    APP_ARG_OPT("settle",
+                0,
+                "Number of blocks discarded after each hop (with --fast)",
+                "N",
+                &settle_blocks,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("psd",
+                0,
+                "Reduce each dwell to an N point power spectrum (with --fast)",
+                "N",
+                &psd_nr_bins,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("psd-threshold",
+                0,
+                "Power above which a spectrum bin counts as occupied",
+                "dBFS",
+                &psd_threshold,
+                FLOAT_VAR_TYPE),
+    APP_ARG_OPT("destination",
+                'd',
+                "Output file for the frequency tagged blocks (with --fast)",
+                "PATH",
+                &p_file_path,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("stats",
+                0,
+                "Append latency percentiles to PATH after every pass",
+                "PATH",
+                &p_stats_path,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("stats-format",
+                0,
+                "Format of the --stats lines, csv or json",
+                "FORMAT",
+                &p_stats_format,
+                STRING_VAR_TYPE),
+    TRACE_APP_ARGS(&trace),
     APP_ARG_TERMINATOR,
 };
 
 
+/***** TYPEDEFS *****/
+
+/* record header written ahead of each block kept by the fast sweep */
+struct sweep_tag
+{
+    uint64_t freq;
+    uint64_t rf_timestamp;
+    uint32_t hop;
+    uint32_t nr_words;
+};
+
+/* power spectrum of the dwell in progress with --psd */
+struct sweep_psd
+{
+    struct psd psd;
+    FILE *p_output_fp;
+    uint64_t freq;
+    uint64_t hop;
+};
+
+
 /***** LOCAL FUNCTIONS *****/
 
 static void app_cleanup(int signum);
 static int32_t receive_data( uint32_t num_blocks );
+static int32_t wait_rx_ready( void );
+static void export_stats( uint64_t pass );
+static void export_trace( void );
+static int32_t run_fast_sweep( void );
 static void print_block_contents( skiq_rx_block_t* p_block,
                                   int32_t block_size_in_bytes );
 
@@ -202,6 +374,15 @@ int main( int argc, char *argv[] )
 
     pid_t owner = 0;
 
+    elapsed_hist_init(&tune_hist);
+    elapsed_hist_init(&start_stream_hist);
+    elapsed_hist_init(&stop_stream_hist);
+    elapsed_hist_init(&receive_hist);
+    elapsed_hist_init(&hop_hist);
+    elapsed_hist_attach(&tune_time, &tune_hist);
+    elapsed_hist_attach(&start_stream_time, &start_stream_hist);
+    elapsed_hist_attach(&stop_stream_time, &stop_stream_hist);
+
     /* install a signal handler for proper cleanup */
     signal(SIGINT, app_cleanup);
 
@@ -223,6 +404,35 @@ int main( int argc, char *argv[] )
     {
         card = DEFAULT_CARD_NUMBER;
     }
+    if ( blocking_rx && event_driven )
+    {
+        printf("Error: must specify EITHER --blocking or --event-driven, not both\n");
+        return (-1);
+    }
+
+    if ( 0 != elapsed_export_parse_format(p_stats_format, &stats_format) )
+    {
+        printf("Error: unknown statistics format '%s', expected csv or json\n", p_stats_format);
+        return (-1);
+    }
+    if ( NULL != p_stats_path )
+    {
+        p_stats_fp = fopen(p_stats_path, "a");
+        if ( NULL == p_stats_fp )
+        {
+            printf("Error: unable to open statistics file %s (errno %d)\n", p_stats_path, errno);
+            return (-1);
+        }
+        elapsed_hist_export_header(p_stats_fp, stats_format);
+    }
+
+    status = trace_init(&trace);
+    if ( 0 != status )
+    {
+        printf("Error: unable to trace to %s (%s)\n", trace.p_path, strerror(abs(status)));
+        return (-1);
+    }
+    p_sweep_trace = trace_thread(&trace, "sweep");
 
     /* If specified, attempt to find the card with a matching serial number. */
     if ( NULL != p_serial )
@@ -302,6 +512,26 @@ int main( int argc, char *argv[] )
         return (-4);
     }
 
+    if ( event_driven )
+    {
+        status = rx_ready_init(&rx_ready);
+        if ( status == 0 )
+        {
+            status = rx_ready_add(&rx_ready, card, sample_rate,
+                        SKIQ_MAX_RX_BLOCK_SIZE_IN_WORDS - SKIQ_RX_HEADER_SIZE_IN_WORDS);
+        }
+        if ( status != 0 )
+        {
+            printf("Error: unable to set up receive readiness (result code %" PRIi32 ")\n",
+                   status);
+            rx_ready_close(&rx_ready);
+            skiq_exit();
+            return (-4);
+        }
+        printf("Info: waiting on receive readiness from the %s\n",
+               rx_ready_source_cstr(rx_ready.cards[card].source));
+    }
+
     // set the frequency to some default value
     status = SET_RX_LO_FREQ(card, skiq_rx_hdl_A1, curr_freq);
     if( status != 0 )
@@ -312,9 +542,10 @@ int main( int argc, char *argv[] )
         return (-3);
     }
 
-    // set counter mode for easier debug if it breaks
+    // set counter mode for easier debug if it breaks (unless the spectrum
+    // of real samples is wanted)
     status = skiq_write_rx_data_src(card, skiq_rx_hdl_A1,
-                skiq_data_src_counter);
+                (fast_sweep && (psd_nr_bins != 0)) ? skiq_data_src_iq : skiq_data_src_counter);
     if( status != 0 )
     {
         printf("Error: unable to set counter mode (result code %" PRIi32 ")\n",
@@ -323,6 +554,19 @@ int main( int argc, char *argv[] )
         return (-5);
     }
 
+    if ( fast_sweep )
+    {
+        status = run_fast_sweep();
+        export_trace();
+        rx_ready_close(&rx_ready);
+        skiq_exit();
+        if ( NULL != p_stats_fp )
+        {
+            fclose(p_stats_fp);
+        }
+        return (status);
+    }
+
     // tune to the "end" frequency to start without metrics
     SET_RX_LO_FREQ(card, skiq_rx_hdl_A1, stop_freq);
 
@@ -377,6 +621,8 @@ int main( int argc, char *argv[] )
             curr_freq += step_size;
         }
 
+        export_stats(curr_iteration);
+
         // print out a status
         if( ((curr_iteration % 500) == 0) && (curr_iteration != 0) )
         {
@@ -394,6 +640,7 @@ int main( int argc, char *argv[] )
     printf(" Minimum time for a single RX LO retune: "),print_minimum(&tune_time);
     printf(" Average time for a single RX LO retune: "),print_average(&tune_time);
     printf(" Maximum time for a single RX LO retune: "),print_maximum(&tune_time);
+    printf("   Percentiles of a single RX LO retune: "),elapsed_hist_print(&tune_hist);
 
     printf("======================================================================\n");
     printf("        Total time for starting streaming: "),print_total(&start_stream_time);
@@ -401,6 +648,7 @@ int main( int argc, char *argv[] )
     printf("   Minimum time for a single start stream: "),print_minimum(&start_stream_time);
     printf("   Average time for a single start stream: "),print_average(&start_stream_time);
     printf("   Maximum time for a single start stream: "),print_maximum(&start_stream_time);
+    printf("   Percentiles of a single start stream: "),elapsed_hist_print(&start_stream_hist);
 
     printf("======================================================================\n");
     printf("       Total time for stopping streaming: "),print_total(&stop_stream_time);
@@ -408,6 +656,7 @@ int main( int argc, char *argv[] )
     printf("   Minimum time for a single stop stream: "),print_minimum(&stop_stream_time);
     printf("   Average time for a single stop stream: "),print_average(&stop_stream_time);
     printf("   Maximum time for a single stop stream: "),print_maximum(&stop_stream_time);
+    printf("   Percentiles of a single stop stream: "),elapsed_hist_print(&stop_stream_hist);
 
     printf("======================================================================\n");
     printf("         Total time for capturing samples: "),print_total(&capture_time);
@@ -416,14 +665,112 @@ int main( int argc, char *argv[] )
     printf("       Average time for a capture session: "),print_average(&capture_time);
     printf("       Maximum time for a capture session: "),print_maximum(&capture_time);
 
+    printf("======================================================================\n");
+    printf("   Percentiles of a skiq_receive() call: "),elapsed_hist_print(&receive_hist);
+    if ( event_driven )
+    {
+        printf("   Readiness waits: %" PRIu64 " (%" PRIu64 " wakeups, %" PRIu64 " timeouts)\n",
+               rx_ready.nr_waits, rx_ready.cards[card].nr_wakeups, rx_ready.nr_timeouts);
+    }
+
     // determine the total run time of the sweep across multiple iterations
     printf("Application run time is %3" PRId64 ".%09lu seconds, number of sweeps is %u (%"
            PRIu64 " Hz - %" PRIu64 " Hz), number of receive errors %" PRIu32 "\n",
            (uint64_t)app_time.total.tv_sec, app_time.total.tv_nsec,
            curr_iteration, start_freq, stop_freq, num_receive_errors);
 
+    export_trace();
+    rx_ready_close(&rx_ready);
     skiq_exit();
 
+    if ( NULL != p_stats_fp )
+    {
+        fclose(p_stats_fp);
+    }
+
+    return (0);
+}
+
+/*****************************************************************************/
+/** This function appends the percentiles of the latency histograms to the
+    --stats file, if there is one.  The histograms are cumulative, each line
+    covers the run up to the end of the pass.
+
+    @param pass number of the pass that just completed
+    @return void
+*/
+static void export_stats( uint64_t pass )
+{
+    if ( NULL == p_stats_fp )
+    {
+        return;
+    }
+
+    elapsed_hist_export(p_stats_fp, stats_format, "tune", pass, &tune_hist);
+    elapsed_hist_export(p_stats_fp, stats_format, "start_stream", pass, &start_stream_hist);
+    elapsed_hist_export(p_stats_fp, stats_format, "stop_stream", pass, &stop_stream_hist);
+    elapsed_hist_export(p_stats_fp, stats_format, "receive", pass, &receive_hist);
+    if ( fast_sweep )
+    {
+        elapsed_hist_export(p_stats_fp, stats_format, "hop", pass, &hop_hist);
+    }
+}
+
+/*****************************************************************************/
+/** This function writes the --trace events once the sweep has finished and
+    releases them.
+
+    @return void
+*/
+static void export_trace( void )
+{
+    int32_t status;
+
+    if ( !trace.enabled )
+    {
+        return;
+    }
+
+    status = trace_export(&trace);
+    trace_print_stats(&trace, stdout);
+    if ( 0 != status )
+    {
+        printf("Error: failed to write the trace to %s (%s)\n", trace.p_path,
+               strerror(abs(status)));
+    }
+    else
+    {
+        printf("Info: trace written to %s\n", trace.p_path);
+    }
+    p_sweep_trace = NULL;
+    trace_free(&trace);
+}
+
+/*****************************************************************************/
+/** This function sleeps with --event-driven after skiq_receive() found no
+    block, until the card signals that it has some.  Otherwise it returns at
+    once and the caller polls again.
+
+    @return int-0 when skiq_receive() should be called again, negative on error
+*/
+static int32_t wait_rx_ready( void )
+{
+    uint8_t ready_cards[SKIQ_MAX_NUM_CARDS];
+    int32_t status;
+
+    if ( !event_driven )
+    {
+        return (0);
+    }
+
+    status = rx_ready_wait(&rx_ready, RX_READY_TIMEOUT_MS, ready_cards);
+    if ( status < 0 )
+    {
+        printf("Error: waiting for receive readiness failed (result code %" PRIi32 ")\n",
+               status);
+        return (status);
+    }
+
     return (0);
 }
 
@@ -439,17 +786,18 @@ static int32_t receive_data( uint32_t num_rx_blocks )
     skiq_rx_hdl_t hdl;
     uint32_t len=0;
     uint64_t curr_ts=0;
-    uint64_t next_ts=0;
     int32_t status=0;
     skiq_rx_status_t rx_status;
     skiq_rx_block_t *p_rx_block;
-    uint32_t ts_offset = \
-        SKIQ_MAX_RX_BLOCK_SIZE_IN_WORDS-SKIQ_RX_HEADER_SIZE_IN_WORDS;
+    enum rx_cont_event event;
+
+    /* streaming was restarted at the new frequency */
+    rx_continuity_reset( &rx_cont );
 
     // receive the number of blocks requested per iteration
     while( (curr_num_blocks<num_rx_blocks) && (running==true) )
     {
-        rx_status = skiq_receive(card, &hdl, &p_rx_block, &len);
+        rx_status = RECEIVE(card, &hdl, &p_rx_block, &len);
         if ( rx_status == skiq_rx_status_success )
         {
             // Ensure that the handle is correct
@@ -485,19 +833,22 @@ static int32_t receive_data( uint32_t num_rx_blocks )
             }
 
             // look at the RF pair timestamp to make sure we didn't drop data
-            if( (curr_num_blocks != 0) && (curr_ts != next_ts) )
+            event = rx_continuity_check_block( &rx_cont, p_rx_block, len );
+            if( (event != rx_cont_ok) && (event != rx_cont_first) )
             {
-                printf("Error: timestamp error in block %d....expected"
+                trace_instant(p_sweep_trace, rx_cont_event_cstr(event), rx_cont.last_delta);
+                printf("Error: timestamp error (%s) in block %d....expected"
                         " 0x%016" PRIx64 " but got 0x%016" PRIx64
-                        "\n", curr_num_blocks, next_ts, curr_ts);
+                        "\n", rx_cont_event_cstr(event), curr_num_blocks,
+                        rx_cont.last_expected_ts, curr_ts);
                 status = -1;
                 return (status);
             }
-            next_ts = curr_ts + ts_offset;
             curr_num_blocks++;
         }
         else if ( rx_status == skiq_rx_status_error_overrun )
         {
+            rx_continuity_overrun( &rx_cont );
             printf("Warning: overrun detected on block %" PRIu32 " of %"
                     PRIu32 " (result code %" PRIi32 "); continuing.\n",
                     curr_num_blocks, num_rx_blocks, (int32_t) rx_status);
@@ -516,7 +867,14 @@ static int32_t receive_data( uint32_t num_rx_blocks )
             skiq_exit();
             _exit(-4);
         }
-        else if ( ( rx_status != skiq_rx_status_no_data ) && ( rx_status != skiq_rx_status_error_not_streaming ) )
+        else if ( rx_status == skiq_rx_status_no_data )
+        {
+            if ( 0 != wait_rx_ready() )
+            {
+                return (-1);
+            }
+        }
+        else if ( rx_status != skiq_rx_status_error_not_streaming )
         {
             printf("Warning: unknown error detected on block %" PRIu32
                     " of %" PRIu32 " (result code %" PRIi32 "); continuing.\n",
@@ -528,6 +886,423 @@ static int32_t receive_data( uint32_t num_rx_blocks )
 }
 
 
+/*****************************************************************************/
+/** This function schedules a frequency hop on an RF timestamp.  The hopping
+    list index is written first (except for the first hop, whose index was set
+    when the list was loaded), then the hop is armed for the timestamp.
+
+    @param hop_index index into the hopping list, or UINT16_MAX to keep the
+                     one already configured
+    @param hop_ts RF timestamp at which the hop takes effect
+    @param p_late set to true if the RF timestamp had already passed
+    @return int-0 if the hop was scheduled, else the libsidekiq status
+*/
+static int32_t schedule_hop( uint16_t hop_index,
+                             uint64_t hop_ts,
+                             bool *p_late )
+{
+    int32_t status = 0;
+    uint64_t curr_ts = 0;
+    struct trace_span span;
+
+    trace_begin( p_sweep_trace, &span );
+    if ( hop_index != UINT16_MAX )
+    {
+        status = skiq_write_next_rx_freq_hop( card, skiq_rx_hdl_A1, hop_index );
+    }
+    if ( status == 0 )
+    {
+        status = skiq_perform_rx_freq_hop( card, skiq_rx_hdl_A1, hop_ts );
+    }
+    trace_end( p_sweep_trace, &span, "hop", (int64_t)hop_ts );
+
+    /* libsidekiq executes a hop whose timestamp has passed immediately, which
+       shifts it into the window it should have started */
+    *p_late = ( status == 0 ) &&
+        ( skiq_read_curr_rx_timestamp( card, skiq_rx_hdl_A1, &curr_ts ) == 0 ) &&
+        ( curr_ts >= hop_ts );
+
+    return (status);
+}
+
+/*****************************************************************************/
+/** This function reports (and optionally writes) the power spectrum of a
+    completed dwell.
+
+    @param p estimator that completed the frame
+    @param p_db the frame
+    @param p_arg the sweep_psd of the sweep
+    @return int-0 on success, else -EIO
+*/
+static int32_t dwell_psd_ready( const struct psd *p,
+                                const float *p_db,
+                                void *p_arg )
+{
+    struct sweep_psd *p_sp = (struct sweep_psd *)p_arg;
+    uint32_t nr_bins = p->plan.nr_bins;
+    uint32_t peak_bin = 0;
+    float peak_db = 0.0f;
+    float occupancy;
+    double bin_hz = (double)sample_rate / nr_bins;
+
+    occupancy = psd_frame_occupancy( p_db, nr_bins, psd_threshold, &peak_bin, &peak_db );
+    printf("Hop %6" PRIu64 " %12" PRIu64 " Hz: peak %7.1f dBFS at %+12.0f Hz, %5.1f%% of bins"
+           " above %.1f dBFS\n", p_sp->hop, p_sp->freq, peak_db,
+           ((double)peak_bin - (nr_bins / 2)) * bin_hz, occupancy * 100.0f, psd_threshold);
+
+    if ( p_sp->p_output_fp != NULL )
+    {
+        return psd_write_frame( p_sp->p_output_fp, p, p_db, p_sp->freq, sample_rate );
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** This function performs the sweep by loading every step into the frequency
+    hopping list and hopping on RF timestamps while streaming continuously.
+
+    Hop k takes effect at first_ts + (k + 1) * dwell, where first_ts is the
+    timestamp of the first block received and a dwell is (settle + blocks)
+    blocks.  Each hop is scheduled as soon as the first block of the previous
+    dwell arrives, so the host has nearly a full dwell to arm it.  A block
+    is tagged with the frequency reported by libsidekiq once its dwell has
+    started, which is also when the next hop has not been armed yet.  With
+    --psd, the kept blocks of a dwell are reduced to one power spectrum that
+    is completed when the next dwell starts.
+
+    @param none
+    @return int-0 if the sweep completed, negative if there was an error
+*/
+static int32_t run_fast_sweep( void )
+{
+    uint64_t freq_list[SKIQ_MAX_NUM_FREQ_HOPS];
+    uint16_t num_freqs=0;
+    uint64_t freq;
+    uint64_t num_hops;
+    uint64_t dwell_words=0;
+    uint64_t first_hop_ts=0;
+    uint64_t curr_hop=UINT64_MAX;       /* dwell of the most recent block */
+    uint64_t num_scheduled=0;           /* number of hops armed so far */
+    uint64_t curr_freq=0;
+    uint32_t words_per_block=0;
+    uint64_t num_kept=0, num_settle=0, num_late=0, num_bytes=0;
+    uint16_t hop_index=0;
+    bool first_block=true;
+    bool late=false;
+    int32_t status=0;
+    skiq_rx_status_t rx_status;
+    enum rx_cont_event event;
+    skiq_rx_block_t *p_rx_block;
+    skiq_rx_hdl_t hdl;
+    uint32_t len=0;
+    FILE *p_output_fp = NULL;
+    struct sweep_psd sweep_psd;
+    uint8_t resolution = 0;
+
+    ELAPSED(sweep_time);
+    ELAPSED(hop_time);
+    ELAPSED(start_stream_time);
+    ELAPSED(stop_stream_time);
+
+    elapsed_hist_attach(&hop_time, &hop_hist);
+    elapsed_hist_attach(&start_stream_time, &start_stream_hist);
+    elapsed_hist_attach(&stop_stream_time, &stop_stream_hist);
+
+    if ( step_size == 0 )
+    {
+        printf("Error: step size must be non-zero\n");
+        return (-1);
+    }
+    for ( freq = start_freq;
+          (freq <= stop_freq) && (num_freqs < SKIQ_MAX_NUM_FREQ_HOPS);
+          freq += step_size )
+    {
+        freq_list[num_freqs++] = freq;
+    }
+    if ( freq <= stop_freq )
+    {
+        printf("Error: %" PRIu64 " Hz - %" PRIu64 " Hz in %" PRIu64 " Hz steps exceeds the %u"
+               " entries of the hopping list\n", start_freq, stop_freq, step_size,
+               SKIQ_MAX_NUM_FREQ_HOPS);
+        return (-1);
+    }
+    num_hops = (uint64_t)num_freqs * (repeat + 1);
+
+    status = skiq_write_rx_freq_tune_mode( card, skiq_rx_hdl_A1,
+                                           skiq_freq_tune_mode_hop_on_timestamp );
+    if ( status != 0 )
+    {
+        printf("Error: unable to configure tune on timestamp mode (result code %" PRIi32
+               ")\n", status);
+        return (-7);
+    }
+    status = skiq_write_rx_freq_hop_list( card, skiq_rx_hdl_A1, num_freqs, freq_list, 0 );
+    if ( status != 0 )
+    {
+        printf("Error: unable to load %" PRIu16 " frequencies into the hopping list (result"
+               " code %" PRIi32 ")\n", num_freqs, status);
+        return (-7);
+    }
+    printf("Info: loaded %" PRIu16 " frequencies into the hopping list\n", num_freqs);
+
+    if ( p_file_path != NULL )
+    {
+        p_output_fp = fopen( p_file_path, "wb" );
+        if ( p_output_fp == NULL )
+        {
+            printf("Error: unable to open output file %s\n", p_file_path);
+            return (-1);
+        }
+    }
+
+    memset( &sweep_psd, 0, sizeof(sweep_psd) );
+    sweep_psd.p_output_fp = p_output_fp;
+    if ( psd_nr_bins != 0 )
+    {
+        status = skiq_read_rx_iq_resolution( card, &resolution );
+        if ( status == 0 )
+        {
+            status = psd_init( &(sweep_psd.psd), psd_nr_bins, PSD_AVERAGE_UNTIL_FLUSH,
+                               resolution, false, dwell_psd_ready, &sweep_psd );
+        }
+        if ( status != 0 )
+        {
+            printf("Error: unable to set up a %" PRIu32 " point power spectrum (result code %"
+                   PRIi32 ")\n", psd_nr_bins, status);
+            goto finished;
+        }
+    }
+
+    printf("Starting fast sweep\n");
+    rx_continuity_reset( &rx_cont );
+    elapsed_start(&sweep_time);
+    status = START_STREAM(card, skiq_rx_hdl_A1);
+    if ( 0 != status )
+    {
+        printf("Error: failed to start RX streaming (result code %" PRIi32 ")\n", status);
+        goto finished;
+    }
+
+    while ( running == true )
+    {
+        uint64_t curr_ts;
+        uint64_t hop;
+
+        rx_status = RECEIVE(card, &hdl, &p_rx_block, &len);
+        if ( rx_status != skiq_rx_status_success )
+        {
+            if ( rx_status == skiq_rx_status_error_packet_malformed )
+            {
+                printf("Error: malformed packet received (result code %" PRIi32 ")\n",
+                       (int32_t) rx_status);
+                status = -4;
+                break;
+            }
+            if ( rx_status == skiq_rx_status_error_overrun )
+            {
+                rx_continuity_overrun( &rx_cont );
+            }
+            if ( ( rx_status == skiq_rx_status_no_data ) && ( 0 != wait_rx_ready() ) )
+            {
+                status = -1;
+                break;
+            }
+            continue;
+        }
+        if ( ( p_rx_block == NULL ) || ( hdl != skiq_rx_hdl_A1 ) ||
+             ( len <= SKIQ_RX_HEADER_SIZE_IN_BYTES ) )
+        {
+            continue;
+        }
+
+        curr_ts = p_rx_block->rf_timestamp;
+        if ( first_block )
+        {
+            /* place the hops on block boundaries, one dwell from now */
+            words_per_block = (len / 4) - SKIQ_RX_HEADER_SIZE_IN_WORDS;
+            dwell_words = (uint64_t)(settle_blocks + num_blocks) * words_per_block;
+            first_hop_ts = curr_ts + dwell_words;
+            first_block = false;
+
+            elapsed_start(&hop_time);
+            status = schedule_hop( UINT16_MAX, first_hop_ts, &late );
+            elapsed_end(&hop_time);
+            if ( status != 0 )
+            {
+                printf("Error: failed to schedule the first hop (result code %" PRIi32 ")\n",
+                       status);
+                break;
+            }
+            num_scheduled = 1;
+            num_late += late ? 1 : 0;
+        }
+        event = rx_continuity_check_block( &rx_cont, p_rx_block, len );
+        if ( event > rx_cont_first )
+        {
+            trace_instant(p_sweep_trace, rx_cont_event_cstr(event), rx_cont.last_delta);
+        }
+
+        if ( curr_ts < first_hop_ts )
+        {
+            /* still waiting for the first hop */
+            continue;
+        }
+        hop = (curr_ts - first_hop_ts) / dwell_words;
+        if ( hop >= num_hops )
+        {
+            break;
+        }
+
+        if ( hop != curr_hop )
+        {
+            /* the dwell for this hop has started; the current hop can only
+               be read back now, before the next hop is armed below */
+            if ( skiq_read_curr_rx_freq_hop( card, skiq_rx_hdl_A1, &hop_index,
+                                             &curr_freq ) != 0 )
+            {
+                curr_freq = freq_list[hop % num_freqs];
+            }
+            curr_hop = hop;
+            if ( ( hop != 0 ) && ( ( hop % num_freqs ) == 0 ) )
+            {
+                /* a pass over the frequency list is complete */
+                export_stats((hop / num_freqs) - 1);
+            }
+
+            if ( psd_nr_bins != 0 )
+            {
+                /* complete the spectrum of the previous dwell */
+                status = psd_flush( &(sweep_psd.psd) );
+                if ( status != 0 )
+                {
+                    printf("Error: unable to write to output file %s\n", p_file_path);
+                    break;
+                }
+                psd_reset( &(sweep_psd.psd) );
+                sweep_psd.freq = curr_freq;
+                sweep_psd.hop = hop;
+            }
+
+            if ( num_scheduled <= hop )
+            {
+                /* a dwell was skipped before its hop could be armed */
+                num_late += (hop + 1) - num_scheduled;
+                num_scheduled = hop + 1;
+            }
+            if ( num_scheduled < num_hops )
+            {
+                elapsed_start(&hop_time);
+                status = schedule_hop( (uint16_t)(num_scheduled % num_freqs),
+                                       first_hop_ts + (num_scheduled * dwell_words), &late );
+                elapsed_end(&hop_time);
+                if ( status != 0 )
+                {
+                    printf("Error: failed to schedule hop %" PRIu64 " (result code %" PRIi32
+                           ")\n", num_scheduled, status);
+                    break;
+                }
+                num_late += late ? 1 : 0;
+                num_scheduled++;
+            }
+        }
+
+        if ( ((curr_ts - first_hop_ts) % dwell_words) < ((uint64_t)settle_blocks * words_per_block) )
+        {
+            num_settle++;
+            continue;
+        }
+
+        num_kept++;
+        if ( psd_nr_bins != 0 )
+        {
+            status = psd_feed( &(sweep_psd.psd), (const int16_t *)p_rx_block->data,
+                               words_per_block, curr_ts );
+            if ( status != 0 )
+            {
+                printf("Error: unable to write to output file %s\n", p_file_path);
+                break;
+            }
+        }
+        else if ( p_output_fp != NULL )
+        {
+            struct sweep_tag tag = {
+                .freq = curr_freq,
+                .rf_timestamp = curr_ts,
+                .hop = (uint32_t)hop,
+                .nr_words = words_per_block,
+            };
+
+            if ( ( fwrite( &tag, sizeof(tag), 1, p_output_fp ) != 1 ) ||
+                 ( fwrite( (void *)p_rx_block->data, sizeof(uint32_t), words_per_block,
+                           p_output_fp ) != words_per_block ) )
+            {
+                printf("Error: unable to write to output file %s\n", p_file_path);
+                status = -EIO;
+                break;
+            }
+            num_bytes += sizeof(tag) + (words_per_block * sizeof(uint32_t));
+        }
+    }
+
+    if ( STOP_STREAM(card, skiq_rx_hdl_A1) != 0 )
+    {
+        printf("Error: failed to stop RX streaming\n");
+    }
+    elapsed_end(&sweep_time);
+    if ( curr_hop != UINT64_MAX )
+    {
+        export_stats(curr_hop / num_freqs);
+    }
+
+    if ( ( psd_nr_bins != 0 ) && ( psd_flush( &(sweep_psd.psd) ) != 0 ) && ( status == 0 ) )
+    {
+        printf("Error: unable to write to output file %s\n", p_file_path);
+        status = -EIO;
+    }
+
+    printf("======================================================================\n");
+    printf("        Total time for scheduling hops: "),print_total(&hop_time);
+    printf("       Total number of scheduled hops: "),print_nr_calls(&hop_time);
+    printf(" Minimum time for scheduling one hop: "),print_minimum(&hop_time);
+    printf(" Average time for scheduling one hop: "),print_average(&hop_time);
+    printf(" Maximum time for scheduling one hop: "),print_maximum(&hop_time);
+    printf(" Percentiles of scheduling one hop: "),elapsed_hist_print(&hop_hist);
+    printf(" Percentiles of a skiq_receive() call: "),elapsed_hist_print(&receive_hist);
+    printf("======================================================================\n");
+    printf("        Time for starting streaming once: "),print_total(&start_stream_time);
+    printf("        Time for stopping streaming once: "),print_total(&stop_stream_time);
+    printf("======================================================================\n");
+    printf("Fast sweep run time is %3" PRId64 ".%09lu seconds for %" PRIu64 " hops of %" PRIu64
+           " samples (%" PRIu64 " Hz - %" PRIu64 " Hz)\n", (uint64_t)sweep_time.total.tv_sec,
+           sweep_time.total.tv_nsec, (curr_hop == UINT64_MAX) ? 0 : curr_hop + 1, dwell_words,
+           start_freq, stop_freq);
+    printf("Blocks kept %" PRIu64 ", discarded while settling %" PRIu64 ", timestamp gaps %"
+           PRIu64 " (%" PRIu64 " after an overrun, %" PRIu64 " samples missing), backward "
+           "timestamps %" PRIu64 ", late hops %" PRIu64 "\n", num_kept, num_settle,
+           rx_cont.nr_gaps, rx_cont.nr_overruns, rx_cont.nr_missing_samples, rx_cont.nr_backward,
+           num_late);
+    if ( psd_nr_bins != 0 )
+    {
+        printf("Info: computed %" PRIu64 " power spectra from %" PRIu64 " segments\n",
+               sweep_psd.psd.nr_frames, sweep_psd.psd.nr_segments);
+    }
+    else if ( p_output_fp != NULL )
+    {
+        printf("Info: wrote %" PRIu64 " bytes of tagged blocks to %s\n", num_bytes, p_file_path);
+    }
+
+finished:
+    psd_free( &(sweep_psd.psd) );
+    if ( p_output_fp != NULL )
+    {
+        fclose( p_output_fp );
+    }
+
+    return (status);
+}
+
+
 /*****************************************************************************/
 /** This function prints contents of raw data
 
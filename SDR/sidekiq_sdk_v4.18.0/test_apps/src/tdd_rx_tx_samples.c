@@ -21,6 +21,10 @@
  * </pre>
  */
 
+#if (!defined _GNU_SOURCE)
+#define _GNU_SOURCE         /* for the NUMA helpers of rt_thread.h, see feature_test_macros(7) */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
@@ -34,6 +38,11 @@
 #include <arg_parser.h>
 #include <sidekiq_api.h>
 
+#include "rx_consumer.h"
+#include "rf_scheduler.h"
+#include "tx_burst_queue.h"
+#include "mem_arena.h"
+
 /* https://gcc.gnu.org/onlinedocs/gcc-4.8.5/cpp/Stringification.html */
 #define xstr(s)                         str(s)
 #define str(s)                          #s
@@ -74,9 +83,26 @@
 #   define DEFAULT_BLOCK_SIZE 16380
 #endif
 
+#ifndef DEFAULT_TX_LEAD
+#   define DEFAULT_TX_LEAD  20000
+#endif
+
+#ifndef DEFAULT_HUGEPAGES
+#   define DEFAULT_HUGEPAGES "auto"
+#endif
+
 #define NUM_RX_PAYLOAD_WORDS_IN_BLOCK (SKIQ_MAX_RX_BLOCK_SIZE_IN_WORDS-SKIQ_RX_HEADER_SIZE_IN_WORDS)
 
-#define NUM_NANOSEC_IN_SEC (1000000000)
+
+/* state of a single receive period, shared by the receive stages */
+struct recv_state
+{
+    uint32_t* p_next_rx_write;
+    uint32_t tot_blocks_acquired;
+    uint64_t next_timestamp;
+    bool first_timestamp;
+    bool done;
+};
 
 /* local functions */
 static int32_t process_cmd_line_args(int argc, char *argv[]);
@@ -84,11 +110,15 @@ static int32_t configure_sample_rate(void);
 static int32_t prepare_rx(void);
 static int32_t prepare_tx(void);
 static void recv_samples(void);
+static int32_t timestamp_stage( const struct rx_block_view *p_view, void *p_arg );
+static int32_t capture_stage( const struct rx_block_view *p_view, void *p_arg );
+static int32_t clock_stage( const struct rx_block_view *p_view, void *p_arg );
 static void send_samples(void);
 static void flush_receive(void);
 static void switch_to_rx(void);
 static void switch_to_tx(void);
 static int32_t init_tx_buffer(void);
+static int32_t init_sample_arena(void);
 
 static char* app_name;
 
@@ -111,6 +141,18 @@ Defaults:\n\
   --num-loops=" xstr(DEFAULT_LOOPS) "\n\
   --rf-port-config=" xstr(DEFAULT_RF_PORT_CONFIG) "\n\
   --block-size=" xstr(DEFAULT_BLOCK_SIZE) "\n\
+  --tx-lead=" xstr(DEFAULT_TX_LEAD) "\n\
+  --hugepages=" DEFAULT_HUGEPAGES "\n\
+\n\
+The receive buffer and the transmit blocks come from a single arena that is\n\
+faulted in and locked into RAM before streaming starts, backed by hugepages\n\
+when they are reserved (see /sys/kernel/mm/hugepages).\n\
+\n\
+Each transmit burst is queued for the RF timestamp --tx-lead microseconds\n\
+ahead of the current one and handed to the radio by a submission thread.  A\n\
+burst that can no longer make its slot when its turn comes is dropped rather\n\
+than sent late, and the late timestamps and underruns of every burst are\n\
+reported.\n\
 ";
 
 // parameters read from command line
@@ -128,6 +170,10 @@ static char* rf_port_config=DEFAULT_RF_PORT_CONFIG;
 static skiq_tx_block_t **p_tx_blocks = NULL; /* reference to an array of transmit block references */
 static uint32_t num_blocks = 0;
 static uint32_t block_size_in_words = DEFAULT_BLOCK_SIZE;
+static uint32_t tx_lead_us = DEFAULT_TX_LEAD;
+static char* p_hugepages = DEFAULT_HUGEPAGES;
+static enum mem_arena_pages arena_pages = mem_arena_pages_auto;
+static struct mem_arena arena = MEM_ARENA_INITIALIZER; /* holds the Rx buffer and Tx blocks */
 skiq_tx_flow_mode_t tx_mode = skiq_tx_with_timestamps_data_flow_mode;
 static uint32_t rx_gain = UINT32_MAX;
 static bool rx_gain_is_present = false;
@@ -142,6 +188,12 @@ static FILE* output_fp = NULL;
 
 static bool running=true;
 
+/* wakes the RX/TX switches on RF timestamps */
+static struct rf_sched rf_sched = RF_SCHED_INITIALIZER;
+
+/* submits the transmit bursts ahead of their timestamps */
+static struct tx_burst_queue tx_queue = TX_BURST_QUEUE_INITIALIZER;
+
 static skiq_rf_port_config_t rf_port=skiq_rf_port_config_fixed;
 
 uint32_t num_complete_rx_blocks = 0;  // # full blocks to receive
@@ -227,6 +279,12 @@ static struct application_argument p_args[] =
                 "N",
                 &block_size_in_words,
                 UINT32_VAR_TYPE),
+    APP_ARG_OPT("tx-lead",
+                0,
+                "Microseconds between handing a transmit burst to the radio and its timestamp",
+                "US",
+                &tx_lead_us,
+                UINT32_VAR_TYPE),
     APP_ARG_OPT_PRESENT("gain",
                 'g',
                 "Manually configure the gain by index rather than using automatic",
@@ -234,6 +292,7 @@ static struct application_argument p_args[] =
                 &rx_gain,
                 UINT32_VAR_TYPE,
                 &rx_gain_is_present),
+    MEM_ARENA_APP_ARG(&p_hugepages),
     APP_ARG_TERMINATOR
 };
 
@@ -281,78 +340,6 @@ _tx_hdl_cstr( skiq_tx_hdl_t hdl )
     return p_hdl_str;
 }
 
-/*****************************************************************************/
-/** This is the a function that blocks until a specific RF timestamp is reached.
-
-    @param card_: Sidekiq card of interest
-    @param hdl_: Sidekiq handle of interest
-    @param rf_ts_: RF timestamp to wait for
-
-    @return 0 upon success
-*/
-int32_t wait_until_after_rf_ts( uint8_t card_,
-                                skiq_tx_hdl_t hdl_,
-                                uint64_t rf_ts_ )
-{
-    int32_t status=0;
-    uint64_t curr_ts=0;
-    struct timespec ts;
-    uint64_t num_nanosecs=0;
-    uint32_t num_wait_secs=0;
-
-    if( (status=skiq_read_curr_rx_timestamp(card_, hdl_, &curr_ts)) == 0 )
-    {
-        // if our current timestamp is already larger than what was requested,
-        // just disable the stream immediately
-        if( curr_ts < rf_ts_ )
-        {
-            // calculate how long to sleep for before checking our timestamp
-            num_nanosecs = ceil((double)((double)(rf_ts_ - curr_ts) / (double)(sample_rate)) * NUM_NANOSEC_IN_SEC);
-            while (num_nanosecs >= NUM_NANOSEC_IN_SEC)
-            {
-                num_nanosecs -= NUM_NANOSEC_IN_SEC;
-                num_wait_secs++;
-            }
-            ts.tv_sec = num_wait_secs;
-            ts.tv_nsec = (uint32_t)(num_nanosecs);
-            while( (nanosleep(&ts, &ts) == -1) && (running==true) )
-            {
-                if ( (errno == ENOSYS) || (errno == EINVAL) ||
-                     (errno == EFAULT) )
-                {
-                    fprintf(stderr, "Error: catastrophic timer failure (errno"
-                        " %d)!\n", errno);
-                    status = -errno;
-                    break;
-                }
-            }
-
-            if( status == 0 )
-            {
-                status = skiq_read_curr_rx_timestamp(card_, hdl_, &curr_ts);
-            }
-
-            while( (curr_ts < rf_ts_) && (running==true) && (status==0) )
-            {
-                // just sleep 1 uS and read the timestamp again...we should be close based on the initial sleep calculation
-                status = usleep(1);
-                if (0 != status)
-                {
-                    fprintf(stderr, "Warning: failed to sleep (result = %" PRIi32 "); attempting"
-                        " to continue...\n", status);
-                }
-                status = skiq_read_curr_rx_timestamp(card_, hdl_, &curr_ts);
-            }
-        }
-        if( status == 0 )
-        {
-            printf("Timestamp reached (curr=%" PRIu64 ")\n", curr_ts);
-        }
-    }
-
-    return (status);
-}
-
 /*****************************************************************************/
 /** This is the main function for executing the tdd_rx_tx_samples app.
 
@@ -495,10 +482,28 @@ int main( int argc, char *argv[] )
         goto finished;
     }
 
-    /* receive / send data for specified # times */
+    status = rf_sched_init(&rf_sched, card, rx_hdl, sample_rate);
+    if ( status != 0 )
+    {
+        fprintf(stderr, "Error: unable to start the RF timestamp scheduler (result code %"
+                PRIi32 ")\n", status);
+        goto finished;
+    }
+
+    status = tx_burst_queue_start(&tx_queue, card, tx_hdl, &rf_sched,
+                                  (int64_t)tx_lead_us * 1000, 0);
+    if ( status != 0 )
+    {
+        fprintf(stderr, "Error: unable to start the transmit burst queue (result code %"
+                PRIi32 ")\n", status);
+        goto finished;
+    }
+
+    /* receive / send data for specified # times, each transmit burst schedules the switch
+       back to receive at its last timestamp */
+    switch_to_rx();
     for( i=0; (i<num_loops) && (running==true); i++ )
     {
-        switch_to_rx();
         flush_receive(); // flush any samples that came already
         recv_samples();
         switch_to_tx();
@@ -514,6 +519,17 @@ int main( int argc, char *argv[] )
 
 finished:
 
+    tx_burst_queue_stop(&tx_queue);
+    if (tx_queue.nr_submitted > 0)
+    {
+        tx_burst_queue_print_stats(&tx_queue, stdout);
+    }
+    if (rf_sched.thread_started)
+    {
+        rf_sched_print_stats(&rf_sched, stdout);
+    }
+    rf_sched_exit(&rf_sched);
+
     if (skiq_initialized)
     {
         // stop streaming
@@ -535,17 +551,20 @@ finished:
         input_fp = NULL;
     }
 
-    if (NULL != p_rx_iq)
+    if (NULL != p_tx_blocks)
     {
-        free(p_rx_iq);
-        p_rx_iq = NULL;
+        free(p_tx_blocks);
+        p_tx_blocks = NULL;
     }
 
-    if (NULL != p_tx_block)
+    /* the Rx buffer and all of the Tx blocks live in the arena */
+    p_rx_iq = NULL;
+    p_tx_block = NULL;
+    if (arena.p_base != NULL)
     {
-        free(p_tx_block);
-        p_tx_block = NULL;
+        mem_arena_print(&arena, "sample");
     }
+    mem_arena_free(&arena);
 
     return (int) status;
 }
@@ -620,7 +639,7 @@ static int32_t prepare_rx(void)
 
     num_bytes_to_alloc =
         (num_complete_rx_blocks*NUM_RX_PAYLOAD_WORDS_IN_BLOCK*sizeof(uint32_t)) + last_block_num_bytes;
-    p_rx_iq = malloc( num_bytes_to_alloc );
+    p_rx_iq = mem_arena_alloc( &arena, num_bytes_to_alloc, MEM_ARENA_ALIGN );
     if( p_rx_iq == NULL )
     {
         fprintf(stderr, "Error: failed to allocate %" PRIu32 " bytes for Rx"
@@ -671,8 +690,8 @@ static int32_t prepare_tx(void)
         return (status);
     }
 
-    /* allocate a transmit block by number of words */
-    p_tx_block = skiq_tx_block_allocate( block_size_in_words );
+    /* take a transmit block out of the arena by number of words */
+    p_tx_block = mem_arena_tx_block( &arena, block_size_in_words );
     if( p_tx_block == NULL )
     {
         fprintf(stderr, "Error: unable to allocate memory for transmit block\n");
@@ -691,65 +710,46 @@ static int32_t prepare_tx(void)
 */
 void recv_samples(void)
 {
-    skiq_rx_hdl_t hdl;
-    skiq_rx_block_t *p_rx_block;
+    struct rx_consumer consumer = RX_CONSUMER_INITIALIZER;
+    struct rx_block_view view;
+    struct recv_state state;
+    const char *p_stage = NULL;
+    int32_t stage_status = 0;
     uint32_t len;
-    uint32_t tot_blocks_acquired=0;
-    uint64_t curr_timestamp=0;
     skiq_rx_status_t status;
-    bool done=false;
-    bool first_timestamp = true;
     uint32_t* p_next_rx_write;
 
-    uint64_t next_timestamp = 0;
+    state.p_next_rx_write = p_rx_iq;
+    state.tot_blocks_acquired = 0;
+    state.next_timestamp = 0;
+    state.first_timestamp = true;
+    state.done = false;
 
-    p_next_rx_write = p_rx_iq;
+    /* the blocks are checked in place and only the samples are copied out, their timestamps
+       also keep the scheduler's clock model aligned */
+    rx_consumer_register(&consumer, "clock", rx_hdl, clock_stage, &rf_sched);
+    rx_consumer_register(&consumer, "timestamp", rx_hdl, timestamp_stage, &state);
+    rx_consumer_register(&consumer, "capture", rx_hdl, capture_stage, &state);
 
     printf("Info: receiving samples\n");
 
-    while( (done==false) && (running==true) )
+    while( (state.done==false) && (running==true) )
     {
-        status = skiq_receive(card, &hdl, &p_rx_block, &len);
+        status = rx_consumer_receive(&consumer, card, &view, &stage_status, &p_stage);
         if( skiq_rx_status_success == status )
         {
-            if( hdl != rx_hdl )
+            if( view.hdl != rx_hdl )
             {
-                fprintf(stderr, "Error: received unexpected data from hdl %u %s\n", hdl, _rx_hdl_cstr(hdl));
+                fprintf(stderr, "Error: received unexpected data from hdl %u %s\n", view.hdl, _rx_hdl_cstr(view.hdl));
                 running = false;
                 continue;
             }
-            curr_timestamp = p_rx_block->rf_timestamp; // peek at timestamp
-            if( first_timestamp == true )
-            {
-                first_timestamp = false;
-                next_timestamp = curr_timestamp;
-            }
-            else
+            if( stage_status != 0 )
             {
-                if( curr_timestamp != next_timestamp )
-                {
-                    fprintf(stderr, "Error: timestamp error...expected 0x%016" PRIx64 " but got 0x%016" PRIx64 "\n",
-                           next_timestamp, curr_timestamp);
-                }
-            }
-            // copy either a complete block of data or a partial block at the end
-            if( tot_blocks_acquired < num_complete_rx_blocks )
-            {
-                memcpy( p_next_rx_write,
-                        (void *)p_rx_block->data,
-                        NUM_RX_PAYLOAD_WORDS_IN_BLOCK*4 );
-                p_next_rx_write += NUM_RX_PAYLOAD_WORDS_IN_BLOCK;
-                tot_blocks_acquired++;
-            }
-            else
-            {
-                // we're at the end, just copy a partial block
-                memcpy( p_next_rx_write,
-                        (void *)p_rx_block->data,
-                        last_block_num_bytes );
-                done = true;
+                fprintf(stderr, "Error: %s stage failed (result code %" PRIi32 ")\n", p_stage,
+                        stage_status);
+                running = false;
             }
-            next_timestamp += (len - SKIQ_RX_HEADER_SIZE_IN_BYTES)/4;
         }
         else if (status !=  skiq_rx_status_no_data)
         {
@@ -771,6 +771,91 @@ void recv_samples(void)
     }
 }
 
+/*****************************************************************************/
+/** The timestamp_stage function validates that the received blocks are
+    contiguous.
+
+    @param p_view   view of the received block
+    @param p_arg    pointer to the recv_state of the current receive period
+    @return int32_t  always 0, timestamp errors are reported but not fatal
+*/
+static int32_t timestamp_stage( const struct rx_block_view *p_view, void *p_arg )
+{
+    struct recv_state *p_state = (struct recv_state *)p_arg;
+    uint64_t curr_timestamp = p_view->p_block->rf_timestamp; // peek at timestamp
+
+    if( p_state->first_timestamp == true )
+    {
+        p_state->first_timestamp = false;
+        p_state->next_timestamp = curr_timestamp;
+    }
+    else
+    {
+        if( curr_timestamp != p_state->next_timestamp )
+        {
+            fprintf(stderr, "Error: timestamp error...expected 0x%016" PRIx64 " but got 0x%016" PRIx64 "\n",
+                   p_state->next_timestamp, curr_timestamp);
+        }
+    }
+    p_state->next_timestamp += p_view->nr_payload_words;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** The clock_stage function corrects the RF scheduler's clock model from the
+    timestamp of each received block.
+
+    @param p_view   view of the received block
+    @param p_arg    pointer to the rf_sched
+    @return int32_t  always 0
+*/
+static int32_t clock_stage( const struct rx_block_view *p_view, void *p_arg )
+{
+    rf_sched_observe_block( (struct rf_sched *)p_arg, p_view->p_block->rf_timestamp,
+                            p_view->nr_payload_words );
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** The capture_stage function copies the samples out of the receive block
+    since they are only written to the file once the receive period is over.
+
+    @param p_view   view of the received block
+    @param p_arg    pointer to the recv_state of the current receive period
+    @return int32_t  always 0
+*/
+static int32_t capture_stage( const struct rx_block_view *p_view, void *p_arg )
+{
+    struct recv_state *p_state = (struct recv_state *)p_arg;
+
+    if( p_state->done == true )
+    {
+        return 0;
+    }
+
+    // copy either a complete block of data or a partial block at the end
+    if( p_state->tot_blocks_acquired < num_complete_rx_blocks )
+    {
+        memcpy( p_state->p_next_rx_write,
+                p_view->p_payload,
+                NUM_RX_PAYLOAD_WORDS_IN_BLOCK*4 );
+        p_state->p_next_rx_write += NUM_RX_PAYLOAD_WORDS_IN_BLOCK;
+        p_state->tot_blocks_acquired++;
+    }
+    else
+    {
+        // we're at the end, just copy a partial block
+        memcpy( p_state->p_next_rx_write,
+                p_view->p_payload,
+                last_block_num_bytes );
+        p_state->done = true;
+    }
+
+    return 0;
+}
+
 /*****************************************************************************/
 /** The send_samples function is responsible for sending the samples from
     the user specified input file.
@@ -781,60 +866,67 @@ void recv_samples(void)
 static void send_samples(void)
 {
     int32_t status = 0;
-    uint32_t errors = 0;
-    uint32_t curr_block=0;
-    uint64_t next_tx_timestamp = 0;
-    uint32_t timestamp_increment = block_size_in_words;
+    uint64_t curr_tx_timestamp = 0;
+    uint64_t end_tx_timestamp = 0;
+    struct tx_burst burst = TX_BURST_INITIALIZER;
+    enum tx_burst_state state;
 
     printf("Info: sending samples: (num_blocks=%" PRIu32 ")\n", num_blocks);
-    status = skiq_read_curr_tx_timestamp(card, tx_hdl, &next_tx_timestamp);
+    status = skiq_read_curr_tx_timestamp(card, tx_hdl, &curr_tx_timestamp);
     if (status != 0)
     {
         fprintf(stderr, "Error: failed to read tx timestamp for card %u \
                 hdl %s(result code %" PRIi32 ")\n", card, _tx_hdl_cstr(tx_hdl),status);
+        running = false;
+        return;
     }
 
-    // transmit a block at a time
-    while( (curr_block < num_blocks) && (running==true) )
+    // queue the whole transmission as one burst, the queue hands it to the radio one lead
+    // time ahead of its first timestamp
+    burst.rf_ts = curr_tx_timestamp + ((uint64_t)tx_lead_us * sample_rate) / 1000000;
+    burst.pp_blocks = p_tx_blocks;
+    burst.nr_blocks = num_blocks;
+    burst.samples_per_block = block_size_in_words;
+    status = tx_burst_queue_submit(&tx_queue, &burst);
+    if (status != 0)
     {
-        next_tx_timestamp += timestamp_increment;
-
-        skiq_tx_set_block_timestamp( p_tx_blocks[curr_block], next_tx_timestamp);
-
-        // transmit the data
-        if (running)
-        {
-            status = skiq_transmit(card, tx_hdl, p_tx_blocks[curr_block], NULL );
-            if (0 != status)
-            {
-                fprintf(stderr, "Error: failed to transmit data (result code %"
-                        PRIi32 ")\n", status);
-                running = false;
-            }
-
-            curr_block++;
-        }
+        fprintf(stderr, "Error: failed to queue the transmit burst (result code %"
+                PRIi32 ")\n", status);
+        running = false;
+        return;
     }
 
+    // switch back to receive once the last block has gone out; the switch is made here
+    // rather than from the scheduler thread so that it is complete before the flush and
+    // receive that follow, and also when the wait is abandoned on exit
+    end_tx_timestamp = burst.rf_ts + ((uint64_t)num_blocks * block_size_in_words);
+    status = rf_sched_wait_until( &rf_sched, end_tx_timestamp, &running );
     if (status == 0)
     {
-        status = wait_until_after_rf_ts( card, tx_hdl, next_tx_timestamp );
-
-        /* The scheduled transmissions should be completed, check to ensure
-           they were transmitted on the desired timestamp */
+        printf("Timestamp reached (end=%" PRIu64 ")\n", end_tx_timestamp);
+    }
+    switch_to_rx();
 
-        if(status == 0)
-        {
-            status = skiq_read_tx_num_late_timestamps(card, tx_hdl, &errors);
-            if (status != 0)
-            {
-                fprintf(stderr, "Error: failed to read the number of Tx late timestamps (result code %"
-                        PRIi32 ")\n", status);
-                running = false;
-            }
-            printf("Info: total number of Tx late timestamps detected is %" PRIu32 "\n",
-                        errors);
-        }
+    /* the burst is done once the FPGA counters were read after its end, check that it was
+       transmitted on the desired timestamps */
+    state = tx_burst_queue_wait(&tx_queue, &burst);
+    if (state == tx_burst_sent)
+    {
+        printf("Info: burst %" PRIu64 " sent at timestamp %" PRIu64 " (margin %" PRIi64
+               " samples, %" PRIi64 " after the last block), %" PRIu32 " late timestamps, %"
+               PRIu32 " underruns\n", burst.id, burst.rf_ts, burst.margin, burst.end_margin,
+               burst.nr_late, burst.nr_underruns);
+    }
+    else if (state == tx_burst_failed)
+    {
+        fprintf(stderr, "Error: failed to transmit data (result code %" PRIi32 ")\n",
+                burst.result);
+        running = false;
+    }
+    else
+    {
+        fprintf(stderr, "Warning: burst %" PRIu64 " %s (margin %" PRIi64 " samples)\n",
+                burst.id, tx_burst_state_cstr(state), burst.margin);
     }
 }
 
@@ -852,9 +944,9 @@ void flush_receive(void)
     uint64_t current_ts=0;
     uint64_t rx_ts=0;
     int32_t status = 0;
-    skiq_rx_hdl_t hdl;
-    skiq_rx_block_t *p_rx_block;
-    uint32_t len;
+    int32_t stage_status = 0;
+    struct rx_consumer consumer = RX_CONSUMER_INITIALIZER;
+    struct rx_block_view view;
 
     // read the current timestamp to determine how much we need to receive until flush is done
     status = skiq_read_curr_rx_timestamp(card,
@@ -868,16 +960,17 @@ void flush_receive(void)
 
     while( (done==false) && (status == 0) )
     {
-        status = skiq_receive(card, &hdl, &p_rx_block, &len);
+        // no stages are registered, the blocks are only peeked at and released
+        status = rx_consumer_receive(&consumer, card, &view, &stage_status, NULL);
         if( skiq_rx_status_success == status )
         {
             flush_count++;
-            if( hdl != rx_hdl )
+            if( view.hdl != rx_hdl )
             {
-                fprintf(stderr, "Error: received unexpected data from hdl %u\n", hdl);
+                fprintf(stderr, "Error: received unexpected data from hdl %u\n", view.hdl);
                 continue;
             }
-            rx_ts = p_rx_block->rf_timestamp; // peek at timestamp
+            rx_ts = view.p_block->rf_timestamp; // peek at timestamp
             // if the received timestamp is past the saved timestamp, we're done flushing
             if( rx_ts > current_ts )
             {
@@ -1005,6 +1098,22 @@ static int32_t process_cmd_line_args(int argc, char* argv[])
         goto finished;
     }
 
+    if (0 != mem_arena_parse_pages(p_hugepages, &arena_pages))
+    {
+        fprintf(stderr, "Error: invalid hugepage size '%s', choose either 'auto', '2M', '1G'"
+                " or 'off'\n", p_hugepages);
+        status = -EINVAL;
+        goto finished;
+    }
+
+    if ( ((int64_t)tx_lead_us * 1000) <= TX_BURST_DEFAULT_MIN_MARGIN_NS )
+    {
+        fprintf(stderr, "Error: the Tx lead time must exceed %" PRIi64 " microseconds\n",
+                (int64_t)(TX_BURST_DEFAULT_MIN_MARGIN_NS / 1000));
+        status = -EINVAL;
+        goto finished;
+    }
+
     /* ----------------first rx args---------------- */
     output_fp=fopen(output_filepath,"wb");
     if (output_fp == NULL)
@@ -1089,6 +1198,12 @@ static int32_t init_tx_buffer(void)
     }
     printf("Info: %u blocks contained in the file\n", num_blocks);
 
+    status = init_sample_arena();
+    if (0 != status)
+    {
+        goto finished;
+    }
+
     // allocate the buffer
     p_tx_blocks = calloc( num_blocks, sizeof( skiq_tx_block_t* ) );
     if( p_tx_blocks == NULL )
@@ -1105,8 +1220,8 @@ static int32_t init_tx_buffer(void)
     {
         if ( !feof(input_fp)  )
         {
-            /* allocate a transmit block by number of words */
-            p_tx_blocks[i] = skiq_tx_block_allocate( block_size_in_words );
+            /* take a transmit block out of the arena by number of words */
+            p_tx_blocks[i] = mem_arena_tx_block( &arena, block_size_in_words );
 
             if ( p_tx_blocks[i] == NULL )
             {
@@ -1142,13 +1257,7 @@ finished:
     if (0 != status)
     {
         if (NULL != p_tx_blocks)
-        {   /* i contains the number of blocks successfully allocated */
-            uint32_t j = 0;
-            for (j = 0; j < i; j++)
-            {
-                skiq_tx_block_free(p_tx_blocks[j]);
-            }
-
+        {   /* the blocks themselves are released with the arena */
             free(p_tx_blocks);
             p_tx_blocks = NULL;
         }
@@ -1163,3 +1272,28 @@ finished:
 
     return status;
 }
+
+/*****************************************************************************/
+/** The init_sample_arena function maps the arena that holds the Rx buffer,
+    the Tx block of prepare_tx() and the num_blocks Tx blocks read from the
+    input file, so that none of them are allocated while streaming.
+
+    @param void
+    @return int32_t  status where 0=success, anything else is an error
+*/
+static int32_t init_sample_arena(void)
+{
+    size_t arena_size = 0;
+    int32_t status = 0;
+
+    arena_size = MEM_ARENA_SLAB((size_t)num_samples_to_rx * sizeof(uint32_t), MEM_ARENA_ALIGN) +
+        ((size_t)num_blocks + 1) * MEM_ARENA_TX_BLOCK_SLAB(block_size_in_words);
+
+    status = mem_arena_init(&arena, arena_size, arena_pages, -1, "sample");
+    if (0 != status)
+    {
+        fprintf(stderr, "Error: unable to map %zu bytes for the sample buffers\n", arena_size);
+    }
+
+    return status;
+}
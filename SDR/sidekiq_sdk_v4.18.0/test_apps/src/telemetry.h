@@ -0,0 +1,485 @@
+/**
+ * @file   telemetry.h
+ *
+ * @brief  Background sampler of the slow sensors of a card (temperature, accelerometer, GPSDO
+ *         lock and frequency accuracy, last 1PPS timestamps), published as a snapshot that
+ *         streaming threads read without a lock or a call into libsidekiq.
+ *
+ * Each sensor is read by a single thread at its own period, so the transport of a streaming card
+ * only sees a few low rate register reads and the receive loop never waits for one.  A sensor
+ * that reports -ENOTSUP or -ENODEV on its first read is not read again.
+ *
+ * The snapshot is protected by a sequence lock: the sampler makes the sequence odd, updates the
+ * snapshot and makes it even again.  telemetry_read() copies the snapshot and retries if the
+ * sequence was odd or changed meanwhile.  telemetry_seq() alone is one load, so a receive loop
+ * can check once per block whether a new sample has been published (e.g. to tag the block in a
+ * capture index, see capture_index_add_telemetry()).
+ */
+
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sidekiq_api.h>
+
+/***** DEFINES *****/
+
+/* struct telemetry_sample valid flags, a sensor that was never read successfully is not valid */
+#define TELEMETRY_VALID_TEMP            (1 << 0)
+#define TELEMETRY_VALID_ACCEL           (1 << 1)
+#define TELEMETRY_VALID_GPSDO           (1 << 2)
+#define TELEMETRY_VALID_PPS             (1 << 3)
+#define TELEMETRY_VALID_SYS_TS          (1 << 4)
+
+/* default sampling periods */
+#define TELEMETRY_DEFAULT_TEMP_MS       (1000)
+#define TELEMETRY_DEFAULT_ACCEL_MS      (100)
+#define TELEMETRY_DEFAULT_GPSDO_MS      (1000)
+#define TELEMETRY_DEFAULT_PPS_MS        (250)
+
+#define TELEMETRY_NSEC_PER_MSEC         (1000000LL)
+#define TELEMETRY_NSEC_PER_SEC          (1000000000LL)
+
+/***** TYPEDEFS *****/
+
+enum telemetry_sensor
+{
+    telemetry_temp = 0,
+    telemetry_accel,
+    telemetry_gpsdo,
+    telemetry_pps,
+    telemetry_nr_sensors,
+};
+
+struct telemetry_sample
+{
+    uint32_t valid;                     /* TELEMETRY_VALID_TEMP, ... */
+    uint64_t sys_timestamp;             /* system timestamp of the card when last updated */
+    int64_t host_ns;                    /* CLOCK_MONOTONIC when last updated */
+
+    int8_t temp_c;
+    int16_t accel[3];                   /* X, Y and Z in thousandths of g */
+    bool gpsdo_locked;
+    double gpsdo_ppm;                   /* only meaningful while locked */
+    uint64_t pps_rf_timestamp;          /* RF and system timestamps of the last 1PPS edge */
+    uint64_t pps_sys_timestamp;
+};
+
+struct telemetry
+{
+    uint8_t card;
+    uint32_t period_ms[telemetry_nr_sensors];   /* 0 disables the sensor */
+
+    /* snapshot, written by the sampler only */
+    uint32_t seq;                       /* odd while the snapshot is being updated */
+    struct telemetry_sample snap;
+
+    pthread_mutex_t lock;               /* only for the sampler's sleep */
+    pthread_cond_t wake;
+    pthread_t thread;
+    bool thread_started;
+    bool running;
+
+    /* statistics, owned by the sampler */
+    uint64_t nr_reads[telemetry_nr_sensors];
+    uint64_t nr_errors[telemetry_nr_sensors];
+    int32_t last_status[telemetry_nr_sensors];
+    int64_t max_read_ns;                /* longest single sensor read */
+};
+
+#define TELEMETRY_INITIALIZER                           \
+    (struct telemetry){                                 \
+        .card = 0,                                      \
+        .period_ms = { 0 },                             \
+        .seq = 0,                                       \
+        .lock = PTHREAD_MUTEX_INITIALIZER,              \
+        .wake = PTHREAD_COND_INITIALIZER,               \
+        .thread_started = false,                        \
+        .running = false,                               \
+        .max_read_ns = 0,                               \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+static inline const char *telemetry_sensor_cstr( enum telemetry_sensor sensor )
+{
+    switch ( sensor )
+    {
+        case telemetry_temp:    return "temperature";
+        case telemetry_accel:   return "accelerometer";
+        case telemetry_gpsdo:   return "GPSDO";
+        case telemetry_pps:     return "1PPS";
+        default:                return "unknown";
+    }
+}
+
+static inline int64_t _telemetry_now_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( (int64_t)ts.tv_sec * TELEMETRY_NSEC_PER_SEC ) + ts.tv_nsec;
+}
+
+/*****************************************************************************/
+/** Sequence of the snapshot, even when stable.  It changes each time a sample is published.
+
+    @param[in] t            sampler
+
+    @return the sequence
+*/
+static inline uint32_t telemetry_seq( const struct telemetry *t )
+{
+    return __atomic_load_n( &(t->seq), __ATOMIC_ACQUIRE );
+}
+
+/*****************************************************************************/
+/** Copy a consistent snapshot.  Never blocks on the sampler, it retries the copy (under a
+    hundred bytes) if the sampler published meanwhile.
+
+    @param[in] t            sampler
+    @param[out] p_sample    snapshot
+
+    @return the sequence of the snapshot
+*/
+static inline uint32_t telemetry_read( const struct telemetry *t,
+                                       struct telemetry_sample *p_sample )
+{
+    uint32_t seq0, seq1;
+
+    do
+    {
+        seq0 = __atomic_load_n( &(t->seq), __ATOMIC_ACQUIRE );
+        memcpy( p_sample, (const void *)&(t->snap), sizeof(*p_sample) );
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        seq1 = __atomic_load_n( &(t->seq), __ATOMIC_RELAXED );
+    } while ( ( seq0 & 1 ) || ( seq0 != seq1 ) );
+
+    return seq0;
+}
+
+/* publish the sampler's working copy */
+static inline void _telemetry_publish( struct telemetry *t,
+                                       const struct telemetry_sample *p_sample )
+{
+    __atomic_store_n( &(t->seq), t->seq + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    memcpy( &(t->snap), p_sample, sizeof(*p_sample) );
+    __atomic_store_n( &(t->seq), t->seq + 1, __ATOMIC_RELEASE );
+}
+
+/* read one sensor into the working copy, returns the status of the read */
+static inline int32_t _telemetry_read_sensor( struct telemetry *t,
+                                              enum telemetry_sensor sensor,
+                                              struct telemetry_sample *p_sample )
+{
+    uint8_t card = t->card;
+    int32_t status = 0;
+
+    switch ( sensor )
+    {
+        case telemetry_temp:
+            status = skiq_read_temp( card, &(p_sample->temp_c) );
+            if ( status == 0 )
+            {
+                p_sample->valid |= TELEMETRY_VALID_TEMP;
+            }
+            break;
+
+        case telemetry_accel:
+            status = skiq_read_accel( card, &(p_sample->accel[0]), &(p_sample->accel[1]),
+                                      &(p_sample->accel[2]) );
+            if ( status == 0 )
+            {
+                p_sample->valid |= TELEMETRY_VALID_ACCEL;
+            }
+            break;
+
+        case telemetry_gpsdo:
+            status = skiq_gpsdo_is_locked( card, &(p_sample->gpsdo_locked) );
+            if ( ( status == 0 ) && p_sample->gpsdo_locked )
+            {
+                double ppm = 0.0;
+
+                /* -EAGAIN while a fix or the lock is momentarily lost keeps the last value */
+                if ( skiq_gpsdo_read_freq_accuracy( card, &ppm ) == 0 )
+                {
+                    p_sample->gpsdo_ppm = ppm;
+                }
+            }
+            if ( status == 0 )
+            {
+                p_sample->valid |= TELEMETRY_VALID_GPSDO;
+            }
+            break;
+
+        case telemetry_pps:
+            status = skiq_read_last_1pps_timestamp( card, &(p_sample->pps_rf_timestamp),
+                                                    &(p_sample->pps_sys_timestamp) );
+            if ( ( status == 0 ) && ( p_sample->pps_sys_timestamp != 0 ) )
+            {
+                p_sample->valid |= TELEMETRY_VALID_PPS;
+            }
+            break;
+
+        default:
+            status = -EINVAL;
+            break;
+    }
+
+    return status;
+}
+
+static void *_telemetry_thread( void *p_arg )
+{
+    struct telemetry *t = (struct telemetry *)p_arg;
+    struct telemetry_sample work;
+    int64_t due_ns[telemetry_nr_sensors];
+    bool disabled[telemetry_nr_sensors];
+    uint32_t i;
+
+    memset( &work, 0, sizeof(work) );
+    for ( i = 0; i < telemetry_nr_sensors; i++ )
+    {
+        due_ns[i] = _telemetry_now_ns();
+        disabled[i] = ( t->period_ms[i] == 0 );
+    }
+
+    pthread_mutex_lock( &(t->lock) );
+    while ( t->running )
+    {
+        int64_t now_ns, next_ns = INT64_MAX;
+        bool changed = false;
+        struct timespec ts;
+
+        pthread_mutex_unlock( &(t->lock) );
+
+        now_ns = _telemetry_now_ns();
+        for ( i = 0; i < telemetry_nr_sensors; i++ )
+        {
+            int64_t read_ns;
+            int32_t status;
+
+            if ( disabled[i] )
+            {
+                continue;
+            }
+            if ( due_ns[i] <= now_ns )
+            {
+                read_ns = _telemetry_now_ns();
+                status = _telemetry_read_sensor( t, (enum telemetry_sensor)i, &work );
+                read_ns = _telemetry_now_ns() - read_ns;
+                if ( read_ns > t->max_read_ns )
+                {
+                    t->max_read_ns = read_ns;
+                }
+
+                t->nr_reads[i]++;
+                t->last_status[i] = status;
+                if ( status == 0 )
+                {
+                    changed = true;
+                }
+                else
+                {
+                    t->nr_errors[i]++;
+                    if ( ( t->nr_reads[i] == 1 ) && ( ( status == -ENOTSUP ) ||
+                                                      ( status == -ENODEV ) ) )
+                    {
+                        /* not fitted on this product */
+                        disabled[i] = true;
+                        continue;
+                    }
+                }
+
+                /* keep the cadence, but don't try to catch up on missed periods */
+                due_ns[i] += (int64_t)t->period_ms[i] * TELEMETRY_NSEC_PER_MSEC;
+                if ( due_ns[i] <= now_ns )
+                {
+                    due_ns[i] = now_ns + ( (int64_t)t->period_ms[i] * TELEMETRY_NSEC_PER_MSEC );
+                }
+            }
+            if ( due_ns[i] < next_ns )
+            {
+                next_ns = due_ns[i];
+            }
+        }
+
+        if ( changed )
+        {
+            uint64_t sys_ts;
+
+            if ( skiq_read_curr_sys_timestamp( t->card, &sys_ts ) == 0 )
+            {
+                work.sys_timestamp = sys_ts;
+                work.valid |= TELEMETRY_VALID_SYS_TS;
+            }
+            work.host_ns = _telemetry_now_ns();
+            _telemetry_publish( t, &work );
+        }
+
+        if ( next_ns == INT64_MAX )
+        {
+            /* every sensor is disabled, wait to be stopped */
+            next_ns = _telemetry_now_ns() + TELEMETRY_NSEC_PER_SEC;
+        }
+
+        /* the condition variable uses CLOCK_REALTIME, convert the wait */
+        clock_gettime( CLOCK_REALTIME, &ts );
+        now_ns = next_ns - _telemetry_now_ns();
+        if ( now_ns < 0 )
+        {
+            now_ns = 0;
+        }
+        ts.tv_sec += (time_t)( now_ns / TELEMETRY_NSEC_PER_SEC );
+        ts.tv_nsec += (long)( now_ns % TELEMETRY_NSEC_PER_SEC );
+        if ( ts.tv_nsec >= TELEMETRY_NSEC_PER_SEC )
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= TELEMETRY_NSEC_PER_SEC;
+        }
+
+        pthread_mutex_lock( &(t->lock) );
+        if ( t->running )
+        {
+            (void)pthread_cond_timedwait( &(t->wake), &(t->lock), &ts );
+        }
+    }
+    pthread_mutex_unlock( &(t->lock) );
+
+    return NULL;
+}
+
+/*****************************************************************************/
+/** Start sampling the sensors of a card.  The accelerometer is enabled when it is sampled and
+    the product has one.
+
+    @param[out] t           sampler
+    @param[in] card         Sidekiq card, initialized
+    @param[in] p_period_ms  sampling period in milliseconds of each sensor, indexed by
+                            enum telemetry_sensor, 0 to leave a sensor out
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t telemetry_start( struct telemetry *t,
+                                       uint8_t card,
+                                       const uint32_t p_period_ms[telemetry_nr_sensors] )
+{
+    int32_t status;
+
+    *t = TELEMETRY_INITIALIZER;
+    t->card = card;
+    memcpy( t->period_ms, p_period_ms, sizeof(t->period_ms) );
+
+    if ( t->period_ms[telemetry_accel] != 0 )
+    {
+        bool supported = false;
+
+        if ( ( skiq_is_accel_supported( card, &supported ) != 0 ) || !supported )
+        {
+            t->period_ms[telemetry_accel] = 0;
+        }
+        else
+        {
+            (void)skiq_write_accel_state( card, 1 );
+        }
+    }
+    if ( t->period_ms[telemetry_gpsdo] != 0 )
+    {
+        skiq_gpsdo_support_t supported = skiq_gpsdo_support_unknown;
+
+        if ( ( skiq_is_gpsdo_supported( card, &supported ) != 0 ) ||
+             ( supported != skiq_gpsdo_support_is_supported ) )
+        {
+            t->period_ms[telemetry_gpsdo] = 0;
+        }
+    }
+
+    t->running = true;
+    status = pthread_create( &(t->thread), NULL, _telemetry_thread, t );
+    if ( status != 0 )
+    {
+        t->running = false;
+        return -status;
+    }
+    t->thread_started = true;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Stop the sampler.  The last snapshot remains readable.  Safe to call on a sampler that was
+    never started.
+
+    @param[in] t            sampler
+
+    @return void
+*/
+static inline void telemetry_stop( struct telemetry *t )
+{
+    pthread_mutex_lock( &(t->lock) );
+    t->running = false;
+    pthread_cond_signal( &(t->wake) );
+    pthread_mutex_unlock( &(t->lock) );
+
+    if ( t->thread_started )
+    {
+        pthread_join( t->thread, NULL );
+        t->thread_started = false;
+    }
+}
+
+/*****************************************************************************/
+/** Parse a sampling period list "TEMP,ACCEL,GPSDO,PPS" in milliseconds.  Missing trailing
+    entries keep their value and an empty entry or 0 leaves the sensor out.
+
+    @param[in] p_str        list
+    @param[in,out] p_period_ms  periods, indexed by enum telemetry_sensor
+
+    @return 0 on success, -EINVAL for a malformed list
+*/
+static inline int32_t telemetry_parse_periods( const char *p_str,
+                                               uint32_t p_period_ms[telemetry_nr_sensors] )
+{
+    uint32_t i = 0;
+
+    while ( ( p_str != NULL ) && ( *p_str != '\0' ) )
+    {
+        char *p_end = NULL;
+        unsigned long period;
+
+        if ( i >= telemetry_nr_sensors )
+        {
+            return -EINVAL;
+        }
+        if ( *p_str == ',' )
+        {
+            p_period_ms[i++] = 0;
+            p_str++;
+            continue;
+        }
+
+        errno = 0;
+        period = strtoul( p_str, &p_end, 10 );
+        if ( ( errno != 0 ) || ( p_end == p_str ) || ( period > UINT32_MAX ) ||
+             ( ( *p_end != ',' ) && ( *p_end != '\0' ) ) )
+        {
+            return -EINVAL;
+        }
+        p_period_ms[i++] = (uint32_t)period;
+        p_str = ( *p_end == ',' ) ? p_end + 1 : p_end;
+    }
+
+    return 0;
+}
+
+#endif  /* __TELEMETRY_H__ */
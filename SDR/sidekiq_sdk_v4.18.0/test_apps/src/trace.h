@@ -0,0 +1,684 @@
+/**
+ * @file   trace.h
+ *
+ * @brief  Per-stage trace events for profiling the streaming loops of the test applications.
+ *
+ * Each thread that takes part registers once with trace_thread() from the thread itself and gets
+ * its own ring of events.  Only the owning thread writes to its ring, so recording a span costs
+ * two clock reads and a few stores, with no lock or atomic read-modify-write on the hot path.
+ * When a ring is full the oldest events are overwritten and counted, which keeps the end of the
+ * run (usually the interesting part) and a bounded amount of memory however long the run is.
+ *
+ * A span is started with trace_begin() and recorded by trace_end() under a name that must outlive
+ * the trace (a string literal or a stage name).  trace_instant() records a point in time, for
+ * example the detection of a timestamp gap, so it can be lined up with the spans around it.
+ *
+ * When the run is over and the traced threads have stopped, trace_export() writes the events in
+ * the Chrome trace event format (load the file in chrome://tracing or https://ui.perfetto.dev).
+ * With --trace-marker the events are also written live to the ftrace trace_marker file as they
+ * complete so they show up next to the scheduler events in `perf record -e ftrace:print` or
+ * `trace-cmd record`; this costs a system call per event and is meant for short runs.
+ *
+ * With --trace-counters each thread also opens a group of hardware counters (cycles, instructions
+ * and cache misses) with perf_event_open() and every span records the counts taken while it ran.
+ * The counters need kernel.perf_event_paranoid <= 2 (or CAP_PERFMON); threads that can't open
+ * them are traced without them.
+ *
+ * Every function accepts a NULL buffer and does nothing, so the call sites don't need to check
+ * whether tracing is enabled.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/***** INCLUDES *****/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+
+#if (defined __linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include <arg_parser.h>
+
+/***** DEFINES *****/
+
+/* maximum number of threads that may register with a trace */
+#define TRACE_MAX_THREADS               (32)
+
+/* default number of events kept per thread, rounded up to a power of two */
+#define TRACE_DEFAULT_NR_EVENTS         (65536)
+
+/* hardware counters recorded per span with --trace-counters */
+#define TRACE_NR_COUNTERS               (3)
+
+/* duration of an instant event */
+#define TRACE_INSTANT                   (UINT64_MAX)
+
+#define TRACE_APP_ARGS(p_trace)                                                         \
+    APP_ARG_OPT("trace",                                                                \
+                0,                                                                      \
+                "Write per-stage trace events to this file (Chrome trace format)",      \
+                "PATH",                                                                 \
+                &((p_trace)->p_path),                                                   \
+                STRING_VAR_TYPE),                                                       \
+    APP_ARG_OPT("trace-events",                                                         \
+                0,                                                                      \
+                "Number of most recent trace events kept per thread",                   \
+                "N",                                                                    \
+                &((p_trace)->nr_events),                                                \
+                UINT32_VAR_TYPE),                                                       \
+    APP_ARG_OPT("trace-marker",                                                         \
+                0,                                                                      \
+                "Also write the trace events to the ftrace trace_marker file as they occur", \
+                NULL,                                                                   \
+                &((p_trace)->marker),                                                   \
+                BOOL_VAR_TYPE),                                                         \
+    APP_ARG_OPT("trace-counters",                                                       \
+                0,                                                                      \
+                "Record cycles, instructions and cache misses for each traced span",    \
+                NULL,                                                                   \
+                &((p_trace)->counters),                                                 \
+                BOOL_VAR_TYPE)
+
+/* the matching lines for the Defaults section of the help text */
+#define TRACE_HELP_DEFAULTS                                             \
+    "  --trace=not traced\n"                                            \
+    "  --trace-events=65536\n"
+
+/***** TYPEDEFS *****/
+
+struct trace_event
+{
+    const char *p_name;
+    uint64_t start_ns;                  /* CLOCK_MONOTONIC */
+    uint64_t dur_ns;                    /* TRACE_INSTANT for an instant event */
+    int64_t arg;
+    uint64_t counters[TRACE_NR_COUNTERS];
+};
+
+struct trace;
+
+/* events recorded by one thread, written by that thread only */
+struct trace_buffer
+{
+    struct trace *p_trace;
+    char name[32];
+    int32_t tid;
+    struct trace_event *p_events;
+    uint32_t mask;                      /* number of events - 1 */
+    uint64_t head;                      /* number of events ever recorded */
+    int counter_fd[TRACE_NR_COUNTERS];  /* counter_fd[0] leads the group, -1 if not opened */
+    bool has_counters;
+};
+
+/* state of a span between trace_begin() and trace_end() */
+struct trace_span
+{
+    uint64_t start_ns;
+    uint64_t counters[TRACE_NR_COUNTERS];
+};
+
+struct trace
+{
+    /* command line options */
+    char *p_path;                       /* NULL to disable tracing */
+    uint32_t nr_events;
+    bool marker;
+    bool counters;
+
+    /* set up by trace_init() */
+    bool enabled;
+    uint64_t start_ns;
+    int marker_fd;
+    int32_t counter_status;             /* first failure to open the counters of a thread */
+    struct trace_buffer *p_buffers[TRACE_MAX_THREADS];
+    uint32_t nr_buffers;
+};
+
+#define TRACE_INITIALIZER                               \
+    (struct trace){                                     \
+        .p_path = NULL,                                 \
+        .nr_events = TRACE_DEFAULT_NR_EVENTS,           \
+        .marker = false,                                \
+        .counters = false,                              \
+        .enabled = false,                               \
+        .start_ns = 0,                                  \
+        .marker_fd = -1,                                \
+        .counter_status = 0,                            \
+        .nr_buffers = 0,                                \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+static inline uint64_t _trace_now_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ( (uint64_t)ts.tv_sec * 1000000000ULL ) + (uint64_t)ts.tv_nsec;
+}
+
+static inline const char *_trace_counter_cstr( uint32_t i )
+{
+    static const char *names[TRACE_NR_COUNTERS] = { "cycles", "instructions", "cache_misses" };
+
+    return names[i];
+}
+
+#if (defined __linux__)
+static inline void _trace_open_counters( struct trace_buffer *b )
+{
+    static const uint64_t config[TRACE_NR_COUNTERS] =
+    {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+    };
+    uint32_t i;
+
+    for ( i = 0; i < TRACE_NR_COUNTERS; i++ )
+    {
+        struct perf_event_attr attr;
+
+        memset( &attr, 0, sizeof(attr) );
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config[i];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.disabled = ( i == 0 ) ? 1 : 0;
+
+        /* this thread, any CPU */
+        b->counter_fd[i] = (int)syscall( SYS_perf_event_open, &attr, 0, -1,
+                                         ( i == 0 ) ? -1 : b->counter_fd[0], 0 );
+        if ( b->counter_fd[i] < 0 )
+        {
+            int32_t status = -errno;
+
+            __atomic_compare_exchange_n( &(b->p_trace->counter_status), &(int32_t){ 0 }, status,
+                                         false, __ATOMIC_RELAXED, __ATOMIC_RELAXED );
+            while ( i-- > 0 )
+            {
+                close( b->counter_fd[i] );
+                b->counter_fd[i] = -1;
+            }
+            return;
+        }
+    }
+
+    ioctl( b->counter_fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+    b->has_counters = true;
+}
+
+static inline void _trace_read_counters( const struct trace_buffer *b, uint64_t *p_counters )
+{
+    struct
+    {
+        uint64_t nr;
+        uint64_t values[TRACE_NR_COUNTERS];
+    } group;
+
+    if ( ( read( b->counter_fd[0], &group, sizeof(group) ) == (ssize_t)sizeof(group) ) &&
+         ( group.nr == TRACE_NR_COUNTERS ) )
+    {
+        memcpy( p_counters, group.values, sizeof(group.values) );
+    }
+}
+#else
+static inline void _trace_open_counters( struct trace_buffer *b )
+{
+    b->p_trace->counter_status = -ENOTSUP;
+}
+
+static inline void _trace_read_counters( const struct trace_buffer *b, uint64_t *p_counters )
+{
+    (void)b;
+    (void)p_counters;
+}
+#endif
+
+static inline void _trace_write_marker( const struct trace_buffer *b,
+                                        const struct trace_event *p_event )
+{
+#if (defined __linux__)
+    char line[160];
+    int len;
+
+    if ( p_event->dur_ns == TRACE_INSTANT )
+    {
+        len = snprintf( line, sizeof(line), "trace %s %s arg=%" PRId64 "\n", b->name,
+                        p_event->p_name, p_event->arg );
+    }
+    else
+    {
+        len = snprintf( line, sizeof(line), "trace %s %s dur_ns=%" PRIu64 " arg=%" PRId64 "\n",
+                        b->name, p_event->p_name, p_event->dur_ns, p_event->arg );
+    }
+    if ( len > 0 )
+    {
+        /* best effort, a full trace buffer is not worth stopping the stream for */
+        (void)!write( b->p_trace->marker_fd, line,
+                      ( len < (int)sizeof(line) ) ? (size_t)len : sizeof(line) - 1 );
+    }
+#else
+    (void)b;
+    (void)p_event;
+#endif
+}
+
+/*****************************************************************************/
+/** Enable tracing if --trace was given.  Must be called before any thread registers.
+
+    @param[in] t            trace with its command line options filled in
+
+    @return 0 on success (including when tracing is disabled), -EINVAL for a bad --trace-events,
+            or a negative errno if the trace_marker file can't be opened
+*/
+static inline int32_t trace_init( struct trace *t )
+{
+    uint32_t nr_events = 1;
+
+    if ( t->p_path == NULL )
+    {
+        return 0;
+    }
+    if ( ( t->nr_events == 0 ) || ( t->nr_events > ( 1u << 31 ) ) )
+    {
+        return -EINVAL;
+    }
+    while ( nr_events < t->nr_events )
+    {
+        nr_events <<= 1;
+    }
+    t->nr_events = nr_events;
+
+    if ( t->marker )
+    {
+#if (defined __linux__)
+        t->marker_fd = open( "/sys/kernel/tracing/trace_marker", O_WRONLY | O_CLOEXEC );
+        if ( t->marker_fd < 0 )
+        {
+            t->marker_fd = open( "/sys/kernel/debug/tracing/trace_marker", O_WRONLY | O_CLOEXEC );
+        }
+        if ( t->marker_fd < 0 )
+        {
+            return -errno;
+        }
+#else
+        return -ENOTSUP;
+#endif
+    }
+
+    t->start_ns = _trace_now_ns();
+    t->enabled = true;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Register the calling thread.  The returned buffer must only be used by this thread.
+
+    @param[in] t            trace
+    @param[in] p_name       name of the thread in the exported trace
+
+    @return the thread's buffer, or NULL if tracing is disabled or the buffer can't be allocated
+            (the thread is then not traced)
+*/
+static inline struct trace_buffer *trace_thread( struct trace *t, const char *p_name )
+{
+    struct trace_buffer *b;
+    uint32_t i, slot;
+
+    if ( ( t == NULL ) || !t->enabled )
+    {
+        return NULL;
+    }
+
+    b = calloc( 1, sizeof(struct trace_buffer) );
+    if ( b == NULL )
+    {
+        return NULL;
+    }
+    b->p_events = malloc( (size_t)t->nr_events * sizeof(struct trace_event) );
+    if ( b->p_events == NULL )
+    {
+        free( b );
+        return NULL;
+    }
+    b->p_trace = t;
+    b->mask = t->nr_events - 1;
+    snprintf( b->name, sizeof(b->name), "%s", p_name );
+#if (defined __linux__)
+    b->tid = (int32_t)syscall( SYS_gettid );
+#endif
+    for ( i = 0; i < TRACE_NR_COUNTERS; i++ )
+    {
+        b->counter_fd[i] = -1;
+    }
+
+    slot = __atomic_fetch_add( &(t->nr_buffers), 1, __ATOMIC_RELAXED );
+    if ( slot >= TRACE_MAX_THREADS )
+    {
+        __atomic_fetch_sub( &(t->nr_buffers), 1, __ATOMIC_RELAXED );
+        free( b->p_events );
+        free( b );
+        return NULL;
+    }
+#if (!defined __linux__)
+    b->tid = (int32_t)slot;
+#endif
+
+    if ( t->counters )
+    {
+        _trace_open_counters( b );
+    }
+    __atomic_store_n( &(t->p_buffers[slot]), b, __ATOMIC_RELEASE );
+
+    return b;
+}
+
+/*****************************************************************************/
+/** Start a span.
+
+    @param[in] b            buffer of the calling thread, may be NULL
+    @param[out] p_span      span to pass to trace_end()
+
+    @return void
+*/
+static inline void trace_begin( struct trace_buffer *b, struct trace_span *p_span )
+{
+    p_span->start_ns = 0;
+    if ( b == NULL )
+    {
+        return;
+    }
+    if ( b->has_counters )
+    {
+        _trace_read_counters( b, p_span->counters );
+    }
+    p_span->start_ns = _trace_now_ns();
+}
+
+static inline struct trace_event *_trace_next( struct trace_buffer *b )
+{
+    return &(b->p_events[b->head & b->mask]);
+}
+
+static inline void _trace_commit( struct trace_buffer *b, const struct trace_event *p_event )
+{
+    __atomic_store_n( &(b->head), b->head + 1, __ATOMIC_RELEASE );
+    if ( b->p_trace->marker_fd >= 0 )
+    {
+        _trace_write_marker( b, p_event );
+    }
+}
+
+/*****************************************************************************/
+/** Record a span started by trace_begin().
+
+    @param[in] b            buffer of the calling thread, may be NULL
+    @param[in] p_span       span
+    @param[in] p_name       name of the span, must outlive the trace
+    @param[in] arg          value shown with the span (e.g. a handle or a byte count)
+
+    @return void
+*/
+static inline void trace_end( struct trace_buffer *b,
+                              const struct trace_span *p_span,
+                              const char *p_name,
+                              int64_t arg )
+{
+    struct trace_event *p_event;
+    uint64_t end_ns;
+    uint32_t i;
+
+    if ( b == NULL )
+    {
+        return;
+    }
+    end_ns = _trace_now_ns();
+
+    p_event = _trace_next( b );
+    p_event->p_name = p_name;
+    p_event->start_ns = p_span->start_ns;
+    p_event->dur_ns = end_ns - p_span->start_ns;
+    p_event->arg = arg;
+    if ( b->has_counters )
+    {
+        _trace_read_counters( b, p_event->counters );
+        for ( i = 0; i < TRACE_NR_COUNTERS; i++ )
+        {
+            p_event->counters[i] -= p_span->counters[i];
+        }
+    }
+    _trace_commit( b, p_event );
+}
+
+/*****************************************************************************/
+/** Record an instant event.
+
+    @param[in] b            buffer of the calling thread, may be NULL
+    @param[in] p_name       name of the event, must outlive the trace
+    @param[in] arg          value shown with the event
+
+    @return void
+*/
+static inline void trace_instant( struct trace_buffer *b, const char *p_name, int64_t arg )
+{
+    struct trace_event *p_event;
+
+    if ( b == NULL )
+    {
+        return;
+    }
+
+    p_event = _trace_next( b );
+    p_event->p_name = p_name;
+    p_event->start_ns = _trace_now_ns();
+    p_event->dur_ns = TRACE_INSTANT;
+    p_event->arg = arg;
+    _trace_commit( b, p_event );
+}
+
+static inline void _trace_export_ts( FILE *fp, uint64_t ns )
+{
+    /* the format is in microseconds, keep nanosecond resolution */
+    fprintf( fp, "%" PRIu64 ".%03" PRIu64, ns / 1000, ns % 1000 );
+}
+
+static inline void _trace_export_event( FILE *fp,
+                                        const struct trace *t,
+                                        const struct trace_buffer *b,
+                                        const struct trace_event *p_event )
+{
+    uint32_t i;
+
+    fprintf( fp, ",\n{\"name\":\"%s\",\"cat\":\"skiq\",\"pid\":1,\"tid\":%" PRId32 ",\"ts\":",
+             p_event->p_name, b->tid );
+    _trace_export_ts( fp, p_event->start_ns - t->start_ns );
+    if ( p_event->dur_ns == TRACE_INSTANT )
+    {
+        fprintf( fp, ",\"ph\":\"i\",\"s\":\"t\"" );
+    }
+    else
+    {
+        fprintf( fp, ",\"ph\":\"X\",\"dur\":" );
+        _trace_export_ts( fp, p_event->dur_ns );
+    }
+    fprintf( fp, ",\"args\":{\"arg\":%" PRId64, p_event->arg );
+    if ( b->has_counters && ( p_event->dur_ns != TRACE_INSTANT ) )
+    {
+        for ( i = 0; i < TRACE_NR_COUNTERS; i++ )
+        {
+            fprintf( fp, ",\"%s\":%" PRIu64, _trace_counter_cstr( i ), p_event->counters[i] );
+        }
+    }
+    fprintf( fp, "}}" );
+}
+
+/*****************************************************************************/
+/** Write the recorded events to --trace in the Chrome trace event format.  The traced threads
+    must have stopped recording.
+
+    @param[in] t            trace
+
+    @return 0 on success (or if tracing is disabled), else a negative errno
+*/
+static inline int32_t trace_export( const struct trace *t )
+{
+    uint32_t i, nr_buffers;
+    int32_t status = 0;
+    FILE *fp;
+
+    if ( !t->enabled )
+    {
+        return 0;
+    }
+
+    fp = fopen( t->p_path, "w" );
+    if ( fp == NULL )
+    {
+        return -errno;
+    }
+
+    fprintf( fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n" );
+    fprintf( fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+             "\"args\":{\"name\":\"sidekiq\"}}" );
+
+    nr_buffers = __atomic_load_n( &(t->nr_buffers), __ATOMIC_ACQUIRE );
+    if ( nr_buffers > TRACE_MAX_THREADS )
+    {
+        nr_buffers = TRACE_MAX_THREADS;
+    }
+    for ( i = 0; i < nr_buffers; i++ )
+    {
+        const struct trace_buffer *b = __atomic_load_n( &(t->p_buffers[i]), __ATOMIC_ACQUIRE );
+        uint64_t head, first, n;
+
+        if ( b == NULL )
+        {
+            continue;
+        }
+
+        head = __atomic_load_n( &(b->head), __ATOMIC_ACQUIRE );
+        first = ( head > (uint64_t)b->mask + 1 ) ? head - ( (uint64_t)b->mask + 1 ) : 0;
+
+        fprintf( fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%" PRId32
+                 ",\"args\":{\"name\":\"%s\",\"overwritten\":%" PRIu64 "}}",
+                 b->tid, b->name, first );
+        for ( n = first; n < head; n++ )
+        {
+            _trace_export_event( fp, t, b, &(b->p_events[n & b->mask]) );
+        }
+    }
+
+    fprintf( fp, "\n]}\n" );
+    if ( ferror( fp ) )
+    {
+        status = -EIO;
+    }
+    if ( ( fclose( fp ) != 0 ) && ( status == 0 ) )
+    {
+        status = -errno;
+    }
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Print how many events each thread recorded and how many were overwritten.
+
+    @param[in] t            trace
+    @param[in] fp           stream to print to
+
+    @return void
+*/
+static inline void trace_print_stats( const struct trace *t, FILE *fp )
+{
+    uint32_t i, nr_buffers;
+
+    if ( !t->enabled )
+    {
+        return;
+    }
+
+    nr_buffers = __atomic_load_n( &(t->nr_buffers), __ATOMIC_ACQUIRE );
+    for ( i = 0; ( i < nr_buffers ) && ( i < TRACE_MAX_THREADS ); i++ )
+    {
+        const struct trace_buffer *b = __atomic_load_n( &(t->p_buffers[i]), __ATOMIC_ACQUIRE );
+        uint64_t head, kept;
+
+        if ( b == NULL )
+        {
+            continue;
+        }
+        head = __atomic_load_n( &(b->head), __ATOMIC_ACQUIRE );
+        kept = ( head > (uint64_t)b->mask + 1 ) ? (uint64_t)b->mask + 1 : head;
+        fprintf( fp, "Info: trace %s recorded %" PRIu64 " events, kept the last %" PRIu64 "%s\n",
+                 b->name, head, kept, b->has_counters ? " with hardware counters" : "" );
+    }
+    if ( t->counters && ( t->counter_status != 0 ) )
+    {
+        fprintf( fp, "Warning: hardware counters unavailable for some threads (%s)\n",
+                 strerror( -t->counter_status ) );
+    }
+}
+
+/*****************************************************************************/
+/** Release the buffers.  The traced threads must have stopped recording.
+
+    @param[in] t            trace
+
+    @return void
+*/
+static inline void trace_free( struct trace *t )
+{
+    uint32_t i, j;
+
+    for ( i = 0; ( i < t->nr_buffers ) && ( i < TRACE_MAX_THREADS ); i++ )
+    {
+        struct trace_buffer *b = t->p_buffers[i];
+
+        if ( b == NULL )
+        {
+            continue;
+        }
+#if (defined __linux__)
+        for ( j = 0; j < TRACE_NR_COUNTERS; j++ )
+        {
+            if ( b->counter_fd[j] >= 0 )
+            {
+                close( b->counter_fd[j] );
+            }
+        }
+#else
+        (void)j;
+#endif
+        free( b->p_events );
+        free( b );
+        t->p_buffers[i] = NULL;
+    }
+    t->nr_buffers = 0;
+#if (defined __linux__)
+    if ( t->marker_fd >= 0 )
+    {
+        close( t->marker_fd );
+        t->marker_fd = -1;
+    }
+#endif
+    t->enabled = false;
+}
+
+#endif  /* __TRACE_H__ */
@@ -20,6 +20,8 @@
 #include <sidekiq_api.h>
 #include <arg_parser.h>
 
+#include "elapsed.h"
+
 /* https://gcc.gnu.org/onlinedocs/gcc-4.8.5/cpp/Stringification.html */
 #define xstr(s)                         str(s)
 #define str(s)                          #s
@@ -36,11 +38,16 @@ Transmit data using the chosen transport layer, reporting back benchmark\n\
 information collected during execution. Note that transmit will default to\n\
 synchronous mode unless threads is specified to be greater than one.\n\
 \n\
+The latency of each skiq_transmit() call is kept in a histogram whose\n\
+percentiles are reported every second.  With '--stats', they are also\n\
+appended to PATH every second as CSV or JSON ('--stats-format').\n\
+\n\
 Defaults:\n\
   --block-size=1020\n\
   --card=" xstr(DEFAULT_CARD_NUMBER) "\n\
   --rate=1000000\n\
-  --threads=1";
+  --threads=1\n\
+  --stats-format=csv";
 
 /* command line argument variables */
 static uint8_t card = UINT8_MAX;
@@ -51,6 +58,8 @@ static int32_t priority = -1;
 static uint16_t pkt_size_in_words = 1020;
 static char* p_temp_log_name = NULL;
 static bool temp_log_is_set = false;
+static char* p_stats_path = NULL;
+static char* p_stats_format = NULL;
 
 /* global variables shared amongst threads */
 static pthread_t monitor_thread;
@@ -66,6 +75,11 @@ static uint32_t underruns=0;
 static uint32_t threshold=0; // max number of errors/underruns before failure
 static FILE *p_temp_log=NULL;
 
+/* recorded by the transmitting thread only, read by the monitor */
+static struct elapsed_hist transmit_hist;
+static FILE *p_stats_fp=NULL;
+static enum elapsed_export_format stats_format = elapsed_export_csv;
+
 static skiq_tx_transfer_mode_t transfer_mode = skiq_tx_transfer_mode_sync;
 static uint32_t usleep_period;
 static SKIQ_TX_BLOCK_INITIALIZER_BY_WORDS(buf, SKIQ_MAX_TX_BLOCK_SIZE_IN_WORDS);
@@ -138,6 +152,18 @@ static struct application_argument p_args[] =
                         &p_temp_log_name,
                         STRING_VAR_TYPE,
                         &temp_log_is_set),
+    APP_ARG_OPT("stats",
+                0,
+                "Append skiq_transmit() latency percentiles to PATH every second",
+                "PATH",
+                &p_stats_path,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("stats-format",
+                0,
+                "Format of the --stats lines, csv or json",
+                "FORMAT",
+                &p_stats_format,
+                STRING_VAR_TYPE),
     APP_ARG_TERMINATOR,
 };
 
@@ -186,6 +212,8 @@ void* monitor_performance(void *ptr)
 {
     uint32_t last_underruns = 0;
     uint64_t monitor_time=0;
+    uint64_t interval=0;
+    static struct elapsed_hist snapshot;
 
     /* run until we get canceled */
     while( running )
@@ -213,6 +241,16 @@ void* monitor_performance(void *ptr)
             last_underruns = underruns;
             pthread_mutex_unlock(&lock);
 
+            /* a private copy can be read while transmitting carries on */
+            elapsed_hist_init(&snapshot);
+            elapsed_hist_merge(&snapshot, &transmit_hist);
+            printf("skiq_transmit() latency: "), elapsed_hist_print(&snapshot);
+            if( p_stats_fp != NULL )
+            {
+                elapsed_hist_export(p_stats_fp, stats_format, "transmit", interval, &snapshot);
+            }
+            interval++;
+
             if( p_temp_log != NULL )
             {
                 int32_t temp_status=0;
@@ -329,6 +367,25 @@ int main( int argc, char *argv[] )
         }
     }
 
+    elapsed_hist_init(&transmit_hist);
+    if( elapsed_export_parse_format( p_stats_format, &stats_format ) != 0 )
+    {
+        fprintf(stderr, "Error: unknown statistics format '%s', expected csv or json\n",
+                p_stats_format);
+        return (-1);
+    }
+    if( p_stats_path != NULL )
+    {
+        p_stats_fp = fopen( p_stats_path, "a" );
+        if( p_stats_fp == NULL )
+        {
+            fprintf(stderr, "Error: unable to open statistics file %s (errno=%d)\n",
+                    p_stats_path, errno);
+            return (-1);
+        }
+        elapsed_hist_export_header( p_stats_fp, stats_format );
+    }
+
     printf("Info: initializing card %" PRIu8 "...\n", card);
 
     /* initialize the interface */
@@ -433,8 +490,10 @@ int main( int argc, char *argv[] )
     while( running==true )
     {
         /* send the data */
+        uint64_t start_ns = elapsed_now_ns();
         status=skiq_transmit(card, skiq_tx_hdl_A1, (skiq_tx_block_t *)&buf,
                     NULL);
+        elapsed_hist_record(&transmit_hist, elapsed_now_ns() - start_ns);
         if( status != 0 )
         {
             // if we're running async and we got a queue full indication,
@@ -469,10 +528,16 @@ int main( int argc, char *argv[] )
     /* wait for the monitor thread to complete */
     pthread_join(monitor_thread,NULL);
 
+    printf("skiq_transmit() latency over the run: "), elapsed_hist_print(&transmit_hist);
+
     if( p_temp_log != NULL )
     {
         fclose( p_temp_log );
     }
+    if( p_stats_fp != NULL )
+    {
+        fclose( p_stats_fp );
+    }
 
     skiq_exit();
 
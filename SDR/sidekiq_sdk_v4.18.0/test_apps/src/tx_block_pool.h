@@ -0,0 +1,344 @@
+/**
+ * @file   tx_block_pool.h
+ *
+ * @brief  Pre-allocated pool of transmit blocks recycled through a lock-free free-list.
+ *
+ * All of the transmit blocks are allocated up front with skiq_tx_block_allocate_by_bytes().  The
+ * submitting thread takes a free block, fills it and passes the pool entry to skiq_transmit() as
+ * the user data; the transmit complete callback returns the entry to the pool.
+ *
+ * Completed blocks are pushed onto a shared singly linked list with a compare-and-swap, which
+ * is safe with any number of concurrent callbacks (libsidekiq may use several transmit threads).
+ * There is only one consumer, and it detaches the entire shared list with a single atomic
+ * exchange whenever its private list runs dry, so neither side ever takes a lock and there is no
+ * ABA hazard.
+ *
+ * When no block is free the submitter spins briefly, since a completion is usually imminent at
+ * high sample rates, and only then parks on a condition variable.  The callback only touches the
+ * mutex when the submitter has announced that it is parked.
+ */
+
+#ifndef __TX_BLOCK_POOL_H__
+#define __TX_BLOCK_POOL_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sidekiq_api.h>
+
+/***** DEFINES *****/
+
+/* number of times the submitter polls for a completion before it parks */
+#define TX_BLOCK_POOL_DEFAULT_SPIN      (4000)
+
+/* upper bound on the time the submitter stays parked without re-checking for progress */
+#define TX_BLOCK_POOL_PARK_NS           (10 * 1000 * 1000)
+
+#if (defined __x86_64__ || defined __i386__)
+#   define TX_BLOCK_POOL_CPU_RELAX()    __asm__ __volatile__( "pause" ::: "memory" )
+#elif (defined __aarch64__) || (defined __arm__)
+#   define TX_BLOCK_POOL_CPU_RELAX()    __asm__ __volatile__( "yield" ::: "memory" )
+#else
+#   define TX_BLOCK_POOL_CPU_RELAX()    __asm__ __volatile__( "" ::: "memory" )
+#endif
+
+/***** TYPEDEFS *****/
+
+struct tx_pool_entry
+{
+    skiq_tx_block_t *p_block;
+    struct tx_pool_entry *p_next;       /* free-list link */
+    uint32_t index;
+};
+
+struct tx_block_pool
+{
+    struct tx_pool_entry *p_entries;
+    uint32_t nr_blocks;
+    uint32_t block_size_in_bytes;
+    uint32_t spin_count;
+
+    /* consumer state, only touched by the submitting thread */
+    struct tx_pool_entry *p_private;
+    uint32_t nr_private;
+    uint64_t nr_taken;                  /* number of blocks handed out for transmission */
+
+    /* shared state, written by the completion callbacks */
+    struct tx_pool_entry *p_free __attribute__((aligned(64)));
+    uint64_t nr_completed;
+    uint32_t parked;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+
+    /* statistics */
+    uint64_t nr_spin_waits;             /* waits satisfied while spinning */
+    uint64_t nr_parks;                  /* waits that had to park */
+    uint32_t max_in_flight;
+};
+
+#define TX_BLOCK_POOL_INITIALIZER                       \
+    (struct tx_block_pool){                             \
+        .p_entries = NULL,                              \
+        .nr_blocks = 0,                                 \
+        .block_size_in_bytes = 0,                       \
+        .spin_count = TX_BLOCK_POOL_DEFAULT_SPIN,       \
+        .p_private = NULL,                              \
+        .nr_private = 0,                                \
+        .nr_taken = 0,                                  \
+        .p_free = NULL,                                 \
+        .nr_completed = 0,                              \
+        .parked = 0,                                    \
+        .lock = PTHREAD_MUTEX_INITIALIZER,              \
+        .wake = PTHREAD_COND_INITIALIZER,               \
+        .nr_spin_waits = 0,                             \
+        .nr_parks = 0,                                  \
+        .max_in_flight = 0,                             \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+/*****************************************************************************/
+/** Release all of the transmit blocks.  Must only be called once no blocks are in flight (e.g.
+    after transmit streaming has been stopped).  Safe to call on a pool that failed to
+    initialize.
+
+    @param[in] p            pool
+
+    @return void
+*/
+static inline void tx_block_pool_free( struct tx_block_pool *p )
+{
+    uint32_t i;
+
+    for ( i = 0; ( p->p_entries != NULL ) && ( i < p->nr_blocks ); i++ )
+    {
+        if ( p->p_entries[i].p_block != NULL )
+        {
+            skiq_tx_block_free( p->p_entries[i].p_block );
+        }
+    }
+    free( p->p_entries );
+    p->p_entries = NULL;
+    p->p_private = NULL;
+    p->p_free = NULL;
+    p->nr_blocks = 0;
+    p->nr_private = 0;
+}
+
+/*****************************************************************************/
+/** Allocate the transmit blocks of the pool, all of which start out free.
+
+    @param[out] p                   pool to initialize
+    @param[in]  nr_blocks           number of transmit blocks
+    @param[in]  block_size_in_bytes size of the data portion of each block
+    @param[in]  spin_count          number of polls before parking, 0 to park immediately
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t tx_block_pool_init( struct tx_block_pool *p,
+                                          uint32_t nr_blocks,
+                                          uint32_t block_size_in_bytes,
+                                          uint32_t spin_count )
+{
+    uint32_t i;
+
+    *p = TX_BLOCK_POOL_INITIALIZER;
+    if ( nr_blocks == 0 )
+    {
+        return -EINVAL;
+    }
+
+    p->p_entries = calloc( nr_blocks, sizeof(struct tx_pool_entry) );
+    if ( p->p_entries == NULL )
+    {
+        return -ENOMEM;
+    }
+    p->nr_blocks = nr_blocks;
+    p->block_size_in_bytes = block_size_in_bytes;
+    p->spin_count = spin_count;
+
+    for ( i = 0; i < nr_blocks; i++ )
+    {
+        struct tx_pool_entry *e = &(p->p_entries[i]);
+
+        e->index = i;
+        e->p_block = skiq_tx_block_allocate_by_bytes( block_size_in_bytes );
+        if ( e->p_block == NULL )
+        {
+            tx_block_pool_free( p );
+            return -ENOMEM;
+        }
+        e->p_next = p->p_private;
+        p->p_private = e;
+    }
+    p->nr_private = nr_blocks;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Take a free block without waiting - called from the submitting thread only.
+
+    @param[in] p            pool
+
+    @return a free entry, or NULL if every block is in flight
+*/
+static inline struct tx_pool_entry *tx_block_pool_get( struct tx_block_pool *p )
+{
+    struct tx_pool_entry *e;
+    uint32_t in_flight;
+
+    if ( p->p_private == NULL )
+    {
+        /* detach everything the callbacks have returned since the last time */
+        e = __atomic_exchange_n( &(p->p_free), NULL, __ATOMIC_ACQUIRE );
+        while ( e != NULL )
+        {
+            struct tx_pool_entry *p_next = e->p_next;
+
+            e->p_next = p->p_private;
+            p->p_private = e;
+            p->nr_private++;
+            e = p_next;
+        }
+    }
+
+    e = p->p_private;
+    if ( e != NULL )
+    {
+        p->p_private = e->p_next;
+        p->nr_private--;
+        e->p_next = NULL;
+        p->nr_taken++;
+        in_flight = (uint32_t)( p->nr_taken -
+                                __atomic_load_n( &(p->nr_completed), __ATOMIC_RELAXED ) );
+        if ( in_flight > p->nr_blocks )
+        {
+            /* the completion count may be stale, but never by more than the pool */
+            in_flight = p->nr_blocks;
+        }
+        if ( in_flight > p->max_in_flight )
+        {
+            p->max_in_flight = in_flight;
+        }
+    }
+
+    return e;
+}
+
+/*****************************************************************************/
+/** Give back a block that was taken with tx_block_pool_get() but never transmitted - called
+    from the submitting thread only.
+
+    @param[in] p            pool
+    @param[in] e            entry to return
+
+    @return void
+*/
+static inline void tx_block_pool_unget( struct tx_block_pool *p,
+                                        struct tx_pool_entry *e )
+{
+    e->p_next = p->p_private;
+    p->p_private = e;
+    p->nr_private++;
+    p->nr_taken--;
+}
+
+/*****************************************************************************/
+/** Return a transmitted block to the pool - called from the transmit complete callback, any
+    number of callbacks may run concurrently.
+
+    @param[in] p            pool
+    @param[in] e            entry that completed
+
+    @return void
+*/
+static inline void tx_block_pool_put( struct tx_block_pool *p,
+                                      struct tx_pool_entry *e )
+{
+    struct tx_pool_entry *p_head = __atomic_load_n( &(p->p_free), __ATOMIC_RELAXED );
+
+    do
+    {
+        e->p_next = p_head;
+    } while ( !__atomic_compare_exchange_n( &(p->p_free), &p_head, e, true,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED ) );
+
+    /* the completion count must not become visible before the entry is on the list */
+    __atomic_add_fetch( &(p->nr_completed), 1, __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &(p->parked), __ATOMIC_SEQ_CST ) != 0 )
+    {
+        pthread_mutex_lock( &(p->lock) );
+        pthread_cond_signal( &(p->wake) );
+        pthread_mutex_unlock( &(p->lock) );
+    }
+}
+
+/*****************************************************************************/
+/** Read the number of blocks completed so far, used as the reference for
+    tx_block_pool_wait().
+
+    @param[in] p            pool
+
+    @return the number of completed blocks
+*/
+static inline uint64_t tx_block_pool_completed( struct tx_block_pool *p )
+{
+    return __atomic_load_n( &(p->nr_completed), __ATOMIC_ACQUIRE );
+}
+
+/*****************************************************************************/
+/** Wait until at least one block completes after the completion count was read as seen, or
+    until *p_running becomes false - called from the submitting thread only.
+
+    @param[in] p            pool
+    @param[in] seen         completion count read before the resource was found unavailable
+    @param[in] p_running    stop waiting once this becomes false
+
+    @return void
+*/
+static inline void tx_block_pool_wait( struct tx_block_pool *p,
+                                       uint64_t seen,
+                                       volatile bool *p_running )
+{
+    uint32_t spin;
+
+    for ( spin = 0; spin < p->spin_count; spin++ )
+    {
+        if ( tx_block_pool_completed( p ) != seen )
+        {
+            p->nr_spin_waits++;
+            return;
+        }
+        TX_BLOCK_POOL_CPU_RELAX();
+    }
+
+    p->nr_parks++;
+    __atomic_store_n( &(p->parked), 1, __ATOMIC_SEQ_CST );
+    pthread_mutex_lock( &(p->lock) );
+    while ( ( __atomic_load_n( &(p->nr_completed), __ATOMIC_SEQ_CST ) == seen ) && *p_running )
+    {
+        struct timespec ts;
+
+        /* a bounded wait so that a stop request is noticed without a completion */
+        clock_gettime( CLOCK_REALTIME, &ts );
+        ts.tv_nsec += TX_BLOCK_POOL_PARK_NS;
+        if ( ts.tv_nsec >= 1000000000L )
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        (void)pthread_cond_timedwait( &(p->wake), &(p->lock), &ts );
+    }
+    pthread_mutex_unlock( &(p->lock) );
+    __atomic_store_n( &(p->parked), 0, __ATOMIC_SEQ_CST );
+}
+
+#endif  /* __TX_BLOCK_POOL_H__ */
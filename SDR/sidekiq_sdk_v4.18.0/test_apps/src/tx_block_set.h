@@ -0,0 +1,378 @@
+/**
+ * @file   tx_block_set.h
+ *
+ * @brief  Transmit blocks loaded once from a sample file and shared by several transmit threads.
+ *
+ * A loader thread copies the blocks of a tx_file_source into transmit blocks in file order and
+ * publishes how many are ready, so the transmit threads can start on the first block while the
+ * rest of the file is still being loaded.  The payloads are never written again; every thread
+ * transmits the shared blocks directly (transmission must be synchronous, i.e. skiq_transmit()
+ * is done with a block when it returns).
+ *
+ * When timestamps are requested, all of the threads follow the same timeline: block i of pass p
+ * (0 for the first transmission of the file) carries
+ *
+ *      start_timestamp + ( p * nr_blocks + i ) * block_size_in_words
+ *
+ * so one header per block serves every thread.  The headers are double buffered: pass p is
+ * transmitted from copy p % 2, and the loader stamps the first two passes.  A thread that
+ * finishes pass p reports it with tx_block_set_end_pass() and moves straight on to pass p + 1;
+ * copy p % 2 is restamped for pass p + 2 once every thread has finished pass p.  A thread only
+ * waits when it is a whole pass ahead of the slowest one, so cards that reset their timestamps
+ * and started streaming at slightly different times don't hold each other up at the end of
+ * every pass.  A thread that stops early calls tx_block_set_leave() so the others don't wait for
+ * it.  Without timestamps (immediate mode) a single copy is loaded, tx_block_set_end_pass()
+ * returns at once and the threads run independently.
+ */
+
+#ifndef __TX_BLOCK_SET_H__
+#define __TX_BLOCK_SET_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sidekiq_api.h>
+
+#include "tx_file_source.h"
+
+/***** DEFINES *****/
+
+/* number of stamped copies of the blocks with timestamps, i.e. the passes in flight */
+#define TX_BLOCK_SET_NR_COPIES          (2)
+
+/***** TYPEDEFS *****/
+
+struct tx_block_set
+{
+    struct tx_file_source *p_src;
+    skiq_tx_block_t **pp_blocks[TX_BLOCK_SET_NR_COPIES];  /* the second only with timestamps */
+    uint32_t nr_copies;
+    uint32_t nr_blocks;
+    uint32_t block_size_in_words;
+    bool timestamps;
+    uint64_t start_timestamp;
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    uint32_t nr_ready;              /* blocks loaded in every copy, also read without the lock */
+    int32_t status;                 /* loader failure */
+    bool closing;
+
+    /* passes, protected by lock */
+    uint32_t nr_users;              /* threads still transmitting from the set */
+    uint32_t oldest;                /* oldest pass stamped, the other copy holds oldest + 1 */
+    uint32_t nr_finished[TX_BLOCK_SET_NR_COPIES];   /* threads done with pass oldest (+ 1) */
+
+    pthread_t loader;
+    bool loader_started;
+};
+
+#define TX_BLOCK_SET_INITIALIZER                        \
+    (struct tx_block_set){                              \
+        .p_src = NULL,                                  \
+        .pp_blocks = { NULL, NULL },                    \
+        .nr_copies = 1,                                 \
+        .nr_blocks = 0,                                 \
+        .block_size_in_words = 0,                       \
+        .timestamps = false,                            \
+        .start_timestamp = 0,                           \
+        .lock = PTHREAD_MUTEX_INITIALIZER,              \
+        .ready = PTHREAD_COND_INITIALIZER,              \
+        .nr_ready = 0,                                  \
+        .status = 0,                                    \
+        .closing = false,                               \
+        .nr_users = 0,                                  \
+        .oldest = 0,                                    \
+        .nr_finished = { 0, 0 },                        \
+        .loader_started = false,                        \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+static inline uint64_t _tx_block_set_timestamp( const struct tx_block_set *set,
+                                                uint32_t pass,
+                                                uint32_t block_num )
+{
+    return set->start_timestamp +
+        ( ( (uint64_t)pass * set->nr_blocks ) + block_num ) * set->block_size_in_words;
+}
+
+static inline void _tx_block_set_fail( struct tx_block_set *set, int32_t status )
+{
+    pthread_mutex_lock( &(set->lock) );
+    set->status = status;
+    pthread_cond_broadcast( &(set->ready) );
+    pthread_mutex_unlock( &(set->lock) );
+}
+
+static inline void *_tx_block_set_loader( void *p_arg )
+{
+    struct tx_block_set *set = (struct tx_block_set *)p_arg;
+    struct tx_file_reader reader;
+    uint32_t i, c;
+
+    tx_file_reader_init( &reader, set->p_src );
+    for ( i = 0; ( i < set->nr_blocks ) && !__atomic_load_n( &(set->closing), __ATOMIC_RELAXED );
+          i++ )
+    {
+        for ( c = 0; c < set->nr_copies; c++ )
+        {
+            skiq_tx_block_t *p_block = skiq_tx_block_allocate( set->block_size_in_words );
+
+            if ( p_block == NULL )
+            {
+                _tx_block_set_fail( set, -ENOMEM );
+                return NULL;
+            }
+            if ( c == 0 )
+            {
+                tx_file_reader_fill( &reader, i, p_block->data );
+            }
+            else
+            {
+                memcpy( p_block->data, set->pp_blocks[0][i]->data,
+                        (size_t)set->block_size_in_words * sizeof(uint32_t) );
+            }
+            if ( set->timestamps )
+            {
+                /* copy c starts out holding pass c */
+                skiq_tx_set_block_timestamp( p_block, _tx_block_set_timestamp( set, c, i ) );
+            }
+            set->pp_blocks[c][i] = p_block;
+        }
+
+        pthread_mutex_lock( &(set->lock) );
+        __atomic_store_n( &(set->nr_ready), i + 1, __ATOMIC_RELEASE );
+        pthread_cond_broadcast( &(set->ready) );
+        pthread_mutex_unlock( &(set->lock) );
+    }
+
+    return NULL;
+}
+
+/*****************************************************************************/
+/** Stop the loader and free the blocks.  Safe to call on a set that failed to open.
+
+    @param[in] set          block set, no thread may be transmitting from it
+
+    @return void
+*/
+static inline void tx_block_set_close( struct tx_block_set *set )
+{
+    uint32_t i, c;
+
+    if ( set->loader_started )
+    {
+        pthread_mutex_lock( &(set->lock) );
+        __atomic_store_n( &(set->closing), true, __ATOMIC_RELAXED );
+        pthread_cond_broadcast( &(set->ready) );
+        pthread_mutex_unlock( &(set->lock) );
+        pthread_join( set->loader, NULL );
+        set->loader_started = false;
+    }
+    for ( c = 0; c < TX_BLOCK_SET_NR_COPIES; c++ )
+    {
+        if ( set->pp_blocks[c] == NULL )
+        {
+            continue;
+        }
+        /* a failed load may leave the block after the last ready one allocated */
+        for ( i = 0; i < set->nr_blocks; i++ )
+        {
+            if ( set->pp_blocks[c][i] != NULL )
+            {
+                skiq_tx_block_free( set->pp_blocks[c][i] );
+            }
+        }
+        free( set->pp_blocks[c] );
+        set->pp_blocks[c] = NULL;
+    }
+    set->nr_ready = 0;
+}
+
+/*****************************************************************************/
+/** Start loading the blocks of a source in the background.
+
+    @param[out] set                 block set to initialize
+    @param[in]  p_src               opened source, must remain open until the set is closed
+    @param[in]  block_size_in_words number of samples per block, as the source was opened with
+    @param[in]  timestamps          true to stamp the blocks for timestamp data flow modes
+    @param[in]  start_timestamp     timestamp of the first block of the first pass
+    @param[in]  nr_users            number of threads transmitting from the set
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t tx_block_set_open( struct tx_block_set *set,
+                                         struct tx_file_source *p_src,
+                                         uint32_t block_size_in_words,
+                                         bool timestamps,
+                                         uint64_t start_timestamp,
+                                         uint32_t nr_users )
+{
+    int32_t status;
+    uint32_t c;
+
+    *set = TX_BLOCK_SET_INITIALIZER;
+    set->p_src = p_src;
+    set->nr_blocks = p_src->nr_blocks;
+    set->block_size_in_words = block_size_in_words;
+    set->timestamps = timestamps;
+    set->nr_copies = timestamps ? TX_BLOCK_SET_NR_COPIES : 1;
+    set->start_timestamp = start_timestamp;
+    set->nr_users = nr_users;
+
+    for ( c = 0; c < set->nr_copies; c++ )
+    {
+        set->pp_blocks[c] = calloc( ( set->nr_blocks > 0 ) ? set->nr_blocks : 1,
+                                    sizeof(skiq_tx_block_t *) );
+        if ( set->pp_blocks[c] == NULL )
+        {
+            tx_block_set_close( set );
+            return -ENOMEM;
+        }
+    }
+
+    status = pthread_create( &(set->loader), NULL, _tx_block_set_loader, set );
+    if ( status != 0 )
+    {
+        tx_block_set_close( set );
+        return -status;
+    }
+    set->loader_started = true;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Get a block, waiting for the loader if it hasn't reached it yet.
+
+    @param[in]  set         block set
+    @param[in]  pass        pass the caller is transmitting (0 for the first), only returned
+                            once tx_block_set_end_pass() of the previous pass has returned
+    @param[in]  block_num   index of the block within the file
+
+    @return the block, or NULL if the loader failed or the set is closing
+*/
+static inline skiq_tx_block_t *tx_block_set_get( struct tx_block_set *set,
+                                                 uint32_t pass,
+                                                 uint32_t block_num )
+{
+    skiq_tx_block_t **pp_copy = set->pp_blocks[pass % set->nr_copies];
+    skiq_tx_block_t *p_block = NULL;
+
+    if ( __builtin_expect( __atomic_load_n( &(set->nr_ready), __ATOMIC_ACQUIRE ) > block_num,
+                           1 ) )
+    {
+        return pp_copy[block_num];
+    }
+
+    pthread_mutex_lock( &(set->lock) );
+    while ( ( set->nr_ready <= block_num ) && ( set->status == 0 ) && !set->closing )
+    {
+        pthread_cond_wait( &(set->ready), &(set->lock) );
+    }
+    if ( set->nr_ready > block_num )
+    {
+        p_block = pp_copy[block_num];
+    }
+    pthread_mutex_unlock( &(set->lock) );
+
+    return p_block;
+}
+
+/* restamp the copies whose pass every user has finished; lock held */
+static inline void _tx_block_set_advance( struct tx_block_set *set )
+{
+    bool advanced = false;
+
+    while ( ( set->nr_users > 0 ) &&
+            ( set->nr_finished[set->oldest % TX_BLOCK_SET_NR_COPIES] >= set->nr_users ) )
+    {
+        uint32_t copy = set->oldest % TX_BLOCK_SET_NR_COPIES;
+        uint32_t pass = set->oldest + TX_BLOCK_SET_NR_COPIES;
+        uint32_t i;
+
+        for ( i = 0; i < set->nr_blocks; i++ )
+        {
+            skiq_tx_set_block_timestamp( set->pp_blocks[copy][i],
+                                         _tx_block_set_timestamp( set, pass, i ) );
+        }
+        set->nr_finished[copy] = 0;
+        set->oldest++;
+        advanced = true;
+    }
+    if ( advanced )
+    {
+        pthread_cond_broadcast( &(set->ready) );
+    }
+}
+
+/*****************************************************************************/
+/** Called by a user once it has transmitted every block of a pass and before it transmits the
+    next pass.  With timestamps, waits only if the next pass is not stamped yet, i.e. if the
+    caller is a whole pass ahead of the slowest user.
+
+    @param[in]  set         block set
+    @param[in]  pass        pass the caller has just finished
+
+    @return void
+*/
+static inline void tx_block_set_end_pass( struct tx_block_set *set,
+                                          uint32_t pass )
+{
+    if ( !set->timestamps )
+    {
+        return;
+    }
+
+    pthread_mutex_lock( &(set->lock) );
+    set->nr_finished[pass % TX_BLOCK_SET_NR_COPIES]++;
+    _tx_block_set_advance( set );
+
+    /* pass + 1 is stamped once pass - 1 is done by everyone */
+    while ( ( ( pass + 1 ) >= ( set->oldest + TX_BLOCK_SET_NR_COPIES ) ) && !set->closing )
+    {
+        pthread_cond_wait( &(set->ready), &(set->lock) );
+    }
+    pthread_mutex_unlock( &(set->lock) );
+}
+
+/*****************************************************************************/
+/** Called once by each user when it stops transmitting from the set, whether or not it
+    transmitted every pass.
+
+    @param[in]  set         block set
+    @param[in]  nr_passes   number of passes the caller reported with tx_block_set_end_pass()
+
+    @return void
+*/
+static inline void tx_block_set_leave( struct tx_block_set *set,
+                                       uint32_t nr_passes )
+{
+    uint32_t pass;
+
+    pthread_mutex_lock( &(set->lock) );
+    if ( set->timestamps )
+    {
+        /* take back the passes the caller finished but the others haven't */
+        for ( pass = set->oldest; pass < nr_passes; pass++ )
+        {
+            set->nr_finished[pass % TX_BLOCK_SET_NR_COPIES]--;
+        }
+    }
+    if ( set->nr_users > 0 )
+    {
+        set->nr_users--;
+    }
+    /* the remaining users may have only been waiting for this one */
+    _tx_block_set_advance( set );
+    pthread_mutex_unlock( &(set->lock) );
+}
+
+#endif  /* __TX_BLOCK_SET_H__ */
@@ -0,0 +1,600 @@
+/**
+ * @file   tx_burst_queue.h
+ *
+ * @brief  Queue of timed transmit bursts, handed to skiq_transmit() ahead of their RF timestamp
+ *         by a single submission thread.
+ *
+ * A burst is a run of transmit blocks whose first sample goes out at a given RF timestamp.
+ * Callers queue bursts as early as they like; the bursts are kept in a min-heap ordered on their
+ * timestamp and the submission thread transmits each one, stamping its blocks with consecutive
+ * timestamps, when the RF timestamp comes within the lead time of the burst.  The lead time
+ * bounds how much data sits in the FPGA ahead of the air (and how long skiq_transmit() blocks on
+ * a full FIFO), while leaving enough slack that scheduling jitter on the host doesn't make the
+ * burst late.
+ *
+ * The RF timestamp is predicted by the clock model of an rf_sched (rf_scheduler.h), which is
+ * resynchronized with one timestamp read before each burst is submitted.  A burst whose slot is
+ * closer than the minimum margin at that point can no longer make it and is dropped without
+ * being transmitted.  Once the end of a burst has gone out, the late timestamp and underrun
+ * counters of the handle are read and their increase is charged to the burst; bursts must not
+ * overlap for this accounting to be exact.
+ *
+ * The blocks of a burst belong to the caller and must stay untouched until the burst is done
+ * (see tx_burst_queue_wait()).  Transmission must be synchronous (no transmit complete
+ * callback), so the blocks of a burst may be shared with later bursts: they are only stamped
+ * once every block of the earlier bursts has been handed to skiq_transmit().
+ */
+
+#ifndef __TX_BURST_QUEUE_H__
+#define __TX_BURST_QUEUE_H__
+
+/***** INCLUDES *****/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sidekiq_api.h>
+
+#include "rf_scheduler.h"
+
+/***** DEFINES *****/
+
+/* maximum number of bursts queued or in flight */
+#define TX_BURST_QUEUE_MAX_BURSTS       (64)
+
+/* default time between handing a burst to skiq_transmit() and its first sample going out */
+#define TX_BURST_DEFAULT_LEAD_NS        (20 * 1000 * 1000)
+
+/* default minimum slack at submission, bursts closer than this to their slot are dropped */
+#define TX_BURST_DEFAULT_MIN_MARGIN_NS  (1 * 1000 * 1000)
+
+/* wait after the end of a burst before charging the FPGA counters to it */
+#define TX_BURST_RETIRE_NS              (2 * 1000 * 1000)
+
+/***** TYPEDEFS *****/
+
+enum tx_burst_state
+{
+    tx_burst_queued = 0,
+    tx_burst_in_flight,             /* handed to skiq_transmit(), not yet on the air */
+    tx_burst_sent,
+    tx_burst_dropped,               /* couldn't make its slot, nothing was transmitted */
+    tx_burst_failed,                /* skiq_transmit() failed part way */
+    tx_burst_cancelled,             /* the queue stopped before its slot */
+};
+
+struct tx_burst
+{
+    /* filled in by the caller */
+    uint64_t rf_ts;                 /* RF timestamp of the first sample */
+    skiq_tx_block_t **pp_blocks;
+    uint32_t nr_blocks;
+    uint32_t samples_per_block;     /* timestamp increment between blocks */
+
+    /* filled in by the queue */
+    uint64_t id;
+    enum tx_burst_state state;
+    int32_t result;                 /* status of the failed skiq_transmit() */
+    int64_t margin;                 /* samples between the RF timestamp and rf_ts at submission */
+    int64_t end_margin;             /* the same for the last block, once it was transmitted */
+    uint32_t nr_late;               /* late timestamps counted while the burst went out */
+    uint32_t nr_underruns;
+};
+
+#define TX_BURST_INITIALIZER                            \
+    (struct tx_burst){                                  \
+        .rf_ts = 0,                                     \
+        .pp_blocks = NULL,                              \
+        .nr_blocks = 0,                                 \
+        .samples_per_block = 0,                         \
+        .id = 0,                                        \
+        .state = tx_burst_queued,                       \
+        .result = 0,                                    \
+        .margin = 0,                                    \
+        .end_margin = 0,                                \
+        .nr_late = 0,                                   \
+        .nr_underruns = 0,                              \
+    }
+
+struct tx_burst_queue
+{
+    uint8_t card;
+    skiq_tx_hdl_t hdl;
+    struct rf_sched *p_sched;       /* clock model only, no actions are scheduled */
+    int64_t lead_ns;
+    int64_t min_margin_ns;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;            /* submission thread */
+    pthread_cond_t done;            /* bursts completing, space in the queue */
+    struct tx_burst *heap[TX_BURST_QUEUE_MAX_BURSTS];
+    uint32_t nr_queued;
+    struct tx_burst *in_flight[TX_BURST_QUEUE_MAX_BURSTS];  /* ring, in submission order */
+    uint32_t in_flight_head;
+    uint32_t nr_in_flight;
+    uint64_t next_id;
+    uint32_t last_late;             /* counter values when the previous burst was charged */
+    uint32_t last_underruns;
+
+    pthread_t thread;
+    bool thread_started;
+    bool running;
+
+    /* statistics */
+    uint64_t nr_submitted;
+    uint64_t nr_sent;
+    uint64_t nr_dropped;
+    uint64_t nr_failed;
+    uint64_t nr_cancelled;
+    uint64_t nr_late_bursts;        /* bursts with late timestamps or a negative end margin */
+    uint64_t nr_late;
+    uint64_t nr_underruns;
+    int64_t min_margin;             /* smallest margin of a transmitted burst, in samples */
+    int64_t min_end_margin;
+};
+
+#define TX_BURST_QUEUE_INITIALIZER                      \
+    (struct tx_burst_queue){                            \
+        .p_sched = NULL,                                \
+        .lead_ns = TX_BURST_DEFAULT_LEAD_NS,            \
+        .min_margin_ns = TX_BURST_DEFAULT_MIN_MARGIN_NS,        \
+        .lock = PTHREAD_MUTEX_INITIALIZER,              \
+        .wake = PTHREAD_COND_INITIALIZER,               \
+        .done = PTHREAD_COND_INITIALIZER,               \
+        .nr_queued = 0,                                 \
+        .in_flight_head = 0,                            \
+        .nr_in_flight = 0,                              \
+        .next_id = 0,                                   \
+        .last_late = 0,                                 \
+        .last_underruns = 0,                            \
+        .thread_started = false,                        \
+        .running = false,                               \
+        .nr_submitted = 0,                              \
+        .nr_sent = 0,                                   \
+        .nr_dropped = 0,                                \
+        .nr_failed = 0,                                 \
+        .nr_cancelled = 0,                              \
+        .nr_late_bursts = 0,                            \
+        .nr_late = 0,                                   \
+        .nr_underruns = 0,                              \
+        .min_margin = INT64_MAX,                        \
+        .min_end_margin = INT64_MAX,                    \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+static inline const char *tx_burst_state_cstr( enum tx_burst_state state )
+{
+    const char *p_state =
+        ( state == tx_burst_queued ) ? "queued" :
+        ( state == tx_burst_in_flight ) ? "in flight" :
+        ( state == tx_burst_sent ) ? "sent" :
+        ( state == tx_burst_dropped ) ? "dropped" :
+        ( state == tx_burst_failed ) ? "failed" :
+        ( state == tx_burst_cancelled ) ? "cancelled" :
+        "unknown";
+
+    return p_state;
+}
+
+static inline uint64_t _tx_burst_end( const struct tx_burst *b )
+{
+    return b->rf_ts + ( (uint64_t)b->nr_blocks * b->samples_per_block );
+}
+
+static inline bool _tx_burst_before( const struct tx_burst *a,
+                                     const struct tx_burst *b )
+{
+    return ( a->rf_ts < b->rf_ts ) || ( ( a->rf_ts == b->rf_ts ) && ( a->id < b->id ) );
+}
+
+/* remove and return the earliest burst; lock held */
+static inline struct tx_burst *_tx_burst_queue_pop( struct tx_burst_queue *q )
+{
+    struct tx_burst *p_first = q->heap[0];
+    uint32_t i = 0;
+
+    q->nr_queued--;
+    q->heap[0] = q->heap[q->nr_queued];
+    while ( true )
+    {
+        uint32_t left = ( 2 * i ) + 1, right = left + 1, smallest = i;
+        struct tx_burst *p_tmp;
+
+        if ( ( left < q->nr_queued ) && _tx_burst_before( q->heap[left], q->heap[smallest] ) )
+        {
+            smallest = left;
+        }
+        if ( ( right < q->nr_queued ) && _tx_burst_before( q->heap[right], q->heap[smallest] ) )
+        {
+            smallest = right;
+        }
+        if ( smallest == i )
+        {
+            break;
+        }
+        p_tmp = q->heap[i];
+        q->heap[i] = q->heap[smallest];
+        q->heap[smallest] = p_tmp;
+        i = smallest;
+    }
+
+    return p_first;
+}
+
+/* read the FPGA counters; lock not held */
+static inline void _tx_burst_queue_read_counters( struct tx_burst_queue *q,
+                                                  uint32_t *p_late,
+                                                  uint32_t *p_underruns )
+{
+    if ( skiq_read_tx_num_late_timestamps( q->card, q->hdl, p_late ) != 0 )
+    {
+        *p_late = q->last_late;
+    }
+    if ( skiq_read_tx_num_underruns( q->card, q->hdl, p_underruns ) != 0 )
+    {
+        *p_underruns = q->last_underruns;
+    }
+}
+
+/* charge the counters to the oldest burst in flight and complete it; lock held, released while
+   the counters are read */
+static inline void _tx_burst_queue_retire( struct tx_burst_queue *q )
+{
+    struct tx_burst *b = q->in_flight[q->in_flight_head];
+    uint32_t late, underruns;
+
+    q->in_flight_head = ( q->in_flight_head + 1 ) % TX_BURST_QUEUE_MAX_BURSTS;
+    q->nr_in_flight--;
+
+    pthread_mutex_unlock( &(q->lock) );
+    _tx_burst_queue_read_counters( q, &late, &underruns );
+    pthread_mutex_lock( &(q->lock) );
+
+    b->nr_late = late - q->last_late;
+    b->nr_underruns = underruns - q->last_underruns;
+    q->last_late = late;
+    q->last_underruns = underruns;
+    q->nr_late += b->nr_late;
+    q->nr_underruns += b->nr_underruns;
+    if ( ( b->nr_late > 0 ) || ( b->end_margin < 0 ) )
+    {
+        q->nr_late_bursts++;
+    }
+    if ( b->state == tx_burst_in_flight )
+    {
+        b->state = tx_burst_sent;
+        q->nr_sent++;
+    }
+    pthread_cond_broadcast( &(q->done) );
+}
+
+/* transmit a burst whose turn has come; lock held, released while transmitting */
+static inline void _tx_burst_queue_transmit( struct tx_burst_queue *q,
+                                             struct tx_burst *b )
+{
+    uint64_t rf_now;
+    int64_t slack_ns;
+    int32_t status = 0;
+    uint32_t i;
+
+    b->state = tx_burst_in_flight;
+    pthread_mutex_unlock( &(q->lock) );
+
+    /* one timestamp read per burst keeps the model honest when nothing else corrects it */
+    (void)rf_sched_sync( q->p_sched );
+    slack_ns = rf_sched_host_ns( q->p_sched, b->rf_ts ) - _rf_sched_now_ns();
+    rf_now = rf_sched_rf_now( q->p_sched );
+    b->margin = (int64_t)( b->rf_ts - rf_now );
+
+    if ( slack_ns < q->min_margin_ns )
+    {
+        pthread_mutex_lock( &(q->lock) );
+        b->state = tx_burst_dropped;
+        q->nr_dropped++;
+        pthread_cond_broadcast( &(q->done) );
+        return;
+    }
+
+    for ( i = 0; ( i < b->nr_blocks ) && ( status == 0 ); i++ )
+    {
+        skiq_tx_set_block_timestamp( b->pp_blocks[i],
+                                     b->rf_ts + ( (uint64_t)i * b->samples_per_block ) );
+        status = skiq_transmit( q->card, q->hdl, b->pp_blocks[i], NULL );
+    }
+    b->end_margin = (int64_t)( ( _tx_burst_end( b ) - b->samples_per_block ) -
+                               rf_sched_rf_now( q->p_sched ) );
+
+    pthread_mutex_lock( &(q->lock) );
+    if ( status != 0 )
+    {
+        b->state = tx_burst_failed;
+        b->result = status;
+        q->nr_failed++;
+    }
+    if ( b->margin < q->min_margin )
+    {
+        q->min_margin = b->margin;
+    }
+    if ( b->end_margin < q->min_end_margin )
+    {
+        q->min_end_margin = b->end_margin;
+    }
+    /* retired once its end has gone out, whether or not every block was transmitted */
+    q->in_flight[( q->in_flight_head + q->nr_in_flight ) % TX_BURST_QUEUE_MAX_BURSTS] = b;
+    q->nr_in_flight++;
+}
+
+/* wait for a new burst or until when_ns (0 for no deadline); lock held */
+static inline void _tx_burst_queue_sleep( struct tx_burst_queue *q,
+                                          int64_t when_ns )
+{
+    if ( when_ns <= 0 )
+    {
+        pthread_cond_wait( &(q->wake), &(q->lock) );
+    }
+    else
+    {
+        struct timespec ts;
+        int64_t deadline_ns;
+
+        /* condition variables wait on CLOCK_REALTIME, convert the deadline */
+        clock_gettime( CLOCK_REALTIME, &ts );
+        deadline_ns = ( (int64_t)ts.tv_sec * RF_SCHED_NSEC_PER_SEC ) + ts.tv_nsec +
+            ( when_ns - _rf_sched_now_ns() );
+        ts.tv_sec = (time_t)( deadline_ns / RF_SCHED_NSEC_PER_SEC );
+        ts.tv_nsec = (long)( deadline_ns % RF_SCHED_NSEC_PER_SEC );
+        (void)pthread_cond_timedwait( &(q->wake), &(q->lock), &ts );
+    }
+}
+
+static inline void *_tx_burst_queue_thread( void *p_arg )
+{
+    struct tx_burst_queue *q = (struct tx_burst_queue *)p_arg;
+
+#if (defined __linux__)
+    (void)prctl( PR_SET_NAME, "tx_burst_queue" );
+#endif
+
+    pthread_mutex_lock( &(q->lock) );
+    while ( q->running )
+    {
+        int64_t now_ns = _rf_sched_now_ns();
+        int64_t wake_ns = 0;
+
+        if ( q->nr_in_flight > 0 )
+        {
+            const struct tx_burst *b = q->in_flight[q->in_flight_head];
+            int64_t end_ns = rf_sched_host_ns( q->p_sched, _tx_burst_end( b ) ) +
+                TX_BURST_RETIRE_NS;
+
+            if ( now_ns >= end_ns )
+            {
+                _tx_burst_queue_retire( q );
+                continue;
+            }
+            wake_ns = end_ns;
+        }
+
+        if ( q->nr_queued > 0 )
+        {
+            int64_t submit_ns = rf_sched_host_ns( q->p_sched, q->heap[0]->rf_ts ) - q->lead_ns;
+
+            if ( now_ns >= submit_ns )
+            {
+                _tx_burst_queue_transmit( q, _tx_burst_queue_pop( q ) );
+                continue;
+            }
+            if ( ( wake_ns == 0 ) || ( submit_ns < wake_ns ) )
+            {
+                wake_ns = submit_ns;
+            }
+        }
+
+        _tx_burst_queue_sleep( q, wake_ns );
+    }
+
+    /* stopping: what hasn't been transmitted is cancelled, what has is charged right away */
+    while ( q->nr_queued > 0 )
+    {
+        struct tx_burst *b = _tx_burst_queue_pop( q );
+
+        b->state = tx_burst_cancelled;
+        q->nr_cancelled++;
+    }
+    while ( q->nr_in_flight > 0 )
+    {
+        _tx_burst_queue_retire( q );
+    }
+    pthread_cond_broadcast( &(q->done) );
+    pthread_mutex_unlock( &(q->lock) );
+
+    return NULL;
+}
+
+/*****************************************************************************/
+/** Start the submission thread of a queue.  The handle should be streaming in a timestamp data
+    flow mode.
+
+    @param[out] q               queue
+    @param[in]  card            Sidekiq card
+    @param[in]  hdl             transmit handle
+    @param[in]  p_sched         running scheduler whose clock model predicts the RF timestamp of
+                                the handle, must outlive the queue
+    @param[in]  lead_ns         time before its slot at which a burst is transmitted, 0 for
+                                TX_BURST_DEFAULT_LEAD_NS
+    @param[in]  min_margin_ns   bursts that are closer than this to their slot when their turn
+                                comes are dropped, 0 for TX_BURST_DEFAULT_MIN_MARGIN_NS
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t tx_burst_queue_start( struct tx_burst_queue *q,
+                                            uint8_t card,
+                                            skiq_tx_hdl_t hdl,
+                                            struct rf_sched *p_sched,
+                                            int64_t lead_ns,
+                                            int64_t min_margin_ns )
+{
+    int32_t status;
+
+    *q = TX_BURST_QUEUE_INITIALIZER;
+    q->card = card;
+    q->hdl = hdl;
+    q->p_sched = p_sched;
+    if ( lead_ns > 0 )
+    {
+        q->lead_ns = lead_ns;
+    }
+    if ( min_margin_ns > 0 )
+    {
+        q->min_margin_ns = min_margin_ns;
+    }
+    if ( q->min_margin_ns >= q->lead_ns )
+    {
+        return -EINVAL;
+    }
+    _tx_burst_queue_read_counters( q, &(q->last_late), &(q->last_underruns) );
+
+    q->running = true;
+    status = pthread_create( &(q->thread), NULL, _tx_burst_queue_thread, q );
+    if ( status != 0 )
+    {
+        q->running = false;
+        return -status;
+    }
+    q->thread_started = true;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Queue a burst.  Blocks while TX_BURST_QUEUE_MAX_BURSTS bursts are queued or in flight.
+
+    @param[in] q            queue
+    @param[in] b            burst, rf_ts, pp_blocks, nr_blocks and samples_per_block filled in;
+                            must stay valid until it is done
+
+    @return 0 on success, -EINVAL for an empty burst, -ESHUTDOWN if the queue is stopped
+*/
+static inline int32_t tx_burst_queue_submit( struct tx_burst_queue *q,
+                                             struct tx_burst *b )
+{
+    uint32_t i;
+
+    if ( ( b->nr_blocks == 0 ) || ( b->pp_blocks == NULL ) )
+    {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock( &(q->lock) );
+    while ( q->running && ( ( q->nr_queued + q->nr_in_flight ) >= TX_BURST_QUEUE_MAX_BURSTS ) )
+    {
+        pthread_cond_wait( &(q->done), &(q->lock) );
+    }
+    if ( !q->running )
+    {
+        pthread_mutex_unlock( &(q->lock) );
+        return -ESHUTDOWN;
+    }
+
+    b->id = q->next_id++;
+    b->state = tx_burst_queued;
+    b->result = 0;
+    b->nr_late = 0;
+    b->nr_underruns = 0;
+
+    i = q->nr_queued++;
+    q->heap[i] = b;
+    while ( ( i > 0 ) && _tx_burst_before( q->heap[i], q->heap[( i - 1 ) / 2] ) )
+    {
+        struct tx_burst *p_tmp = q->heap[i];
+
+        q->heap[i] = q->heap[( i - 1 ) / 2];
+        q->heap[( i - 1 ) / 2] = p_tmp;
+        i = ( i - 1 ) / 2;
+    }
+    q->nr_submitted++;
+    pthread_cond_signal( &(q->wake) );
+    pthread_mutex_unlock( &(q->lock) );
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Wait for a burst to be done: sent and charged, dropped, failed or cancelled.
+
+    @param[in] q            queue
+    @param[in] b            burst queued with tx_burst_queue_submit()
+
+    @return the final state of the burst
+*/
+static inline enum tx_burst_state tx_burst_queue_wait( struct tx_burst_queue *q,
+                                                       const struct tx_burst *b )
+{
+    enum tx_burst_state state;
+
+    pthread_mutex_lock( &(q->lock) );
+    while ( ( b->state == tx_burst_queued ) || ( b->state == tx_burst_in_flight ) )
+    {
+        pthread_cond_wait( &(q->done), &(q->lock) );
+    }
+    state = b->state;
+    pthread_mutex_unlock( &(q->lock) );
+
+    return state;
+}
+
+/*****************************************************************************/
+/** Stop the submission thread.  Bursts that haven't been transmitted are cancelled.  Safe to
+    call on a queue that failed to start.
+
+    @param[in] q            queue
+
+    @return void
+*/
+static inline void tx_burst_queue_stop( struct tx_burst_queue *q )
+{
+    if ( q->thread_started )
+    {
+        pthread_mutex_lock( &(q->lock) );
+        q->running = false;
+        pthread_cond_signal( &(q->wake) );
+        pthread_cond_broadcast( &(q->done) );
+        pthread_mutex_unlock( &(q->lock) );
+        pthread_join( q->thread, NULL );
+        q->thread_started = false;
+    }
+}
+
+/*****************************************************************************/
+/** Print the queue statistics.
+
+    @param[in] q            queue
+    @param[in] p_fp         destination, e.g. stdout
+
+    @return void
+*/
+static inline void tx_burst_queue_print_stats( struct tx_burst_queue *q,
+                                               FILE *p_fp )
+{
+    pthread_mutex_lock( &(q->lock) );
+    fprintf( p_fp, "Info: card %" PRIu8 " queued %" PRIu64 " TX bursts: %" PRIu64 " sent, %"
+             PRIu64 " dropped, %" PRIu64 " failed, %" PRIu64 " cancelled; %" PRIu64
+             " late (%" PRIu64 " late timestamps, %" PRIu64 " underruns)\n",
+             q->card, q->nr_submitted, q->nr_sent, q->nr_dropped, q->nr_failed, q->nr_cancelled,
+             q->nr_late_bursts, q->nr_late, q->nr_underruns );
+    if ( q->min_margin != INT64_MAX )
+    {
+        fprintf( p_fp, "Info: card %" PRIu8 " smallest TX burst margin %" PRIi64 " samples at"
+                 " submission, %" PRIi64 " samples after the last block (lead %.3f ms)\n",
+                 q->card, q->min_margin, q->min_end_margin, (double)q->lead_ns / 1e6 );
+    }
+    pthread_mutex_unlock( &(q->lock) );
+}
+
+#endif  /* __TX_BURST_QUEUE_H__ */
@@ -21,6 +21,8 @@
 #include <sidekiq_api.h>
 #include "arg_parser.h"
 
+#include "rf_scheduler.h"
+
 /* https://gcc.gnu.org/onlinedocs/gcc-4.8.5/cpp/Stringification.html */
 #define xstr(s)                         str(s)
 #define str(s)                          #s
@@ -60,6 +62,10 @@ Defaults:\n\
 ";
 
 static bool running=true;
+
+/* times hop_on_timestamp hops, synchronized on the first hop */
+static struct rf_clock rf_clock;
+static bool rf_clock_synced = false;
 static uint8_t card=UINT8_MAX;
 static char* p_serial = NULL;
 static uint64_t lo_freq = DEFAULT_TX_FREQUENCY;
@@ -250,49 +256,24 @@ int32_t wait_until_after_rf_ts( uint8_t card_,
 {
     int32_t status=0;
     uint64_t curr_ts=0;
-    struct timespec ts;
-    uint64_t num_nanosecs=0;
-    uint32_t num_wait_secs=0;
 
-    if( (status=skiq_read_curr_tx_timestamp(card_, hdl_, &curr_ts)) == 0 )
+    // the clock model is synchronized on the first hop and kept for the following ones
+    if( rf_clock_synced == false )
     {
-        // if our current timestamp is already larger than what was requested,
-        // just disable the stream immediately
-        if( curr_ts < rf_ts_ )
-        {
-            // calculate how long to sleep for before checking our timestamp
-            num_nanosecs = ceil((double)((double)(rf_ts_ - curr_ts) / (double)(sample_rate)) * 1000000000);
-            while (num_nanosecs >= 1000000000)
-            {
-                num_nanosecs -= 1000000000;
-                num_wait_secs++;
-            }
-            ts.tv_sec = num_wait_secs;
-            ts.tv_nsec = (uint32_t)(num_nanosecs);
-            while( (nanosleep(&ts, &ts) == -1) && (running==true) )
-            {
-                if ( (errno == ENOSYS) || (errno == EINVAL) ||
-                     (errno == EFAULT) )
-                {
-                    fprintf(stderr, "Error: catastrophic timer failure (errno"
-                        " %d)!\n", errno);
-                    status = -errno;
-                    break;
-                }
-            }
-
-            if( status == 0 )
-            {
-                status = skiq_read_curr_tx_timestamp(card_, hdl_, &curr_ts);
-            }
+        rf_clock_init( &rf_clock, card_, skiq_rx_hdl_A1, sample_rate );
+        rf_clock.use_tx = true;
+        rf_clock.tx_hdl = hdl_;
+        status = rf_clock_sync( &rf_clock );
+        rf_clock_synced = ( status == 0 );
+    }
 
-            while( (curr_ts < rf_ts_) && (running==true) && (status==0) )
-            {
-                // just sleep 1 uS and read the timestamp again...we should be close based on the initial sleep calculation
-                usleep(1);
-                status = skiq_read_curr_tx_timestamp(card_, hdl_, &curr_ts);
-            }
-        }
+    if( status == 0 )
+    {
+        (void)rf_clock_wait_until( &rf_clock, rf_ts_, &running );
+        status = skiq_read_curr_tx_timestamp(card_, hdl_, &curr_ts);
+    }
+    if( status == 0 )
+    {
         printf("Timestamp reached (curr=%" PRIu64 ")\n", curr_ts);
     }
 
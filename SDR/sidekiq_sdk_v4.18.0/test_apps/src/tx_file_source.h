@@ -0,0 +1,395 @@
+/**
+ * @file   tx_file_source.h
+ *
+ * @brief  Memory-mapped replay source for transmit sample files.
+ *
+ * The input file is mapped read-only instead of being read into transmit blocks up front, so
+ * transmission can start as soon as the file is opened, regardless of its size.  Each transmit
+ * block is filled from the mapping just before it is sent.  A reader keeps a window of the file
+ * ahead of the block being filled advised with MADV_WILLNEED, so the kernel reads it in the
+ * background while earlier blocks are being transmitted.  For files much larger than the
+ * window, the pages behind the reader are released with MADV_DONTNEED, so replaying the file
+ * (e.g. with a repeat count) does not keep the whole file resident in the process.
+ *
+ * Several readers (e.g. one per card) may share a single source.  On platforms without mmap()
+ * the file is read into memory when it is opened.
+ *
+ * A capture recorded with a block index (capture_index.h) can be replayed from the sample
+ * received at a given RF timestamp with tx_file_source_seek_rf(); the blocks are then counted
+ * from that sample on.
+ */
+
+#ifndef __TX_FILE_SOURCE_H__
+#define __TX_FILE_SOURCE_H__
+
+/***** INCLUDES *****/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "capture_index.h"
+
+#if (defined __MINGW32__)
+#   define TX_FILE_SOURCE_NO_MMAP
+#else
+#   include <sys/mman.h>
+#endif
+
+/***** DEFINES *****/
+
+/* default amount of the file advised ahead of the block being filled */
+#define TX_FILE_SOURCE_DEFAULT_READAHEAD    (16 * 1024 * 1024)
+
+/* pages behind the reader are only released for files larger than this many windows */
+#define TX_FILE_SOURCE_RELEASE_WINDOWS      (8)
+
+/***** TYPEDEFS *****/
+
+struct tx_file_source
+{
+    int fd;
+    const uint8_t *p_data;          /* contents of the file */
+    uint64_t size;                  /* size of the file in bytes */
+    bool mapped;                    /* p_data is a mapping rather than a heap copy */
+    uint64_t start;                 /* offset of the first block in the file */
+
+    uint32_t block_size_in_bytes;
+    uint32_t nr_blocks;             /* from start, including a zero padded partial last block */
+
+    uint64_t readahead_bytes;
+    bool release_behind;
+};
+
+#define TX_FILE_SOURCE_INITIALIZER                      \
+    (struct tx_file_source){                            \
+        .fd = -1,                                       \
+        .p_data = NULL,                                 \
+        .size = 0,                                      \
+        .mapped = false,                                \
+        .start = 0,                                     \
+        .block_size_in_bytes = 0,                       \
+        .nr_blocks = 0,                                 \
+        .readahead_bytes = TX_FILE_SOURCE_DEFAULT_READAHEAD,    \
+        .release_behind = false,                        \
+    }
+
+/* per-thread position within a source */
+struct tx_file_reader
+{
+    const struct tx_file_source *p_src;
+    uint64_t advised_end;           /* end of the range advised with MADV_WILLNEED */
+    uint64_t released_end;          /* end of the range released with MADV_DONTNEED */
+};
+
+/***** INLINE FUNCTIONS  *****/
+
+/*****************************************************************************/
+/** Unmap (or free) the file contents and close the file.  Safe to call on a source that failed
+    to open.
+
+    @param[in] src          source
+
+    @return void
+*/
+static inline void tx_file_source_close( struct tx_file_source *src )
+{
+    if ( src->p_data != NULL )
+    {
+#if (defined TX_FILE_SOURCE_NO_MMAP)
+        free( (void *)src->p_data );
+#else
+        if ( src->mapped )
+        {
+            (void)munmap( (void *)src->p_data, (size_t)src->size );
+        }
+        else
+        {
+            free( (void *)src->p_data );
+        }
+#endif
+        src->p_data = NULL;
+    }
+    if ( src->fd >= 0 )
+    {
+        close( src->fd );
+        src->fd = -1;
+    }
+}
+
+/*****************************************************************************/
+/** Open and map a sample file.
+
+    @param[out] src                 source to initialize
+    @param[in]  p_path              input file path
+    @param[in]  block_size_in_bytes number of bytes of the file in each transmit block
+    @param[in]  readahead_bytes     size of the readahead window, 0 for the default
+
+    @return 0 on success, else a negative errno (-ENODATA if the file is empty)
+*/
+static inline int32_t tx_file_source_open( struct tx_file_source *src,
+                                           const char *p_path,
+                                           uint32_t block_size_in_bytes,
+                                           uint64_t readahead_bytes )
+{
+    struct stat st;
+
+    *src = TX_FILE_SOURCE_INITIALIZER;
+    if ( block_size_in_bytes == 0 )
+    {
+        return -EINVAL;
+    }
+    if ( readahead_bytes != 0 )
+    {
+        src->readahead_bytes = readahead_bytes;
+    }
+
+    src->fd = open( p_path, O_RDONLY );
+    if ( src->fd < 0 )
+    {
+        return -errno;
+    }
+    if ( fstat( src->fd, &st ) != 0 )
+    {
+        int32_t status = -errno;
+        tx_file_source_close( src );
+        return status;
+    }
+    if ( st.st_size <= 0 )
+    {
+        tx_file_source_close( src );
+        return -ENODATA;
+    }
+
+    src->size = (uint64_t)st.st_size;
+    src->block_size_in_bytes = block_size_in_bytes;
+    src->nr_blocks = (uint32_t)( ( src->size + block_size_in_bytes - 1 ) / block_size_in_bytes );
+    src->release_behind = ( src->size > ( TX_FILE_SOURCE_RELEASE_WINDOWS * src->readahead_bytes ) );
+
+#if !(defined TX_FILE_SOURCE_NO_MMAP)
+    {
+        void *p_map = mmap( NULL, (size_t)src->size, PROT_READ, MAP_SHARED, src->fd, 0 );
+        if ( p_map != MAP_FAILED )
+        {
+            src->p_data = (const uint8_t *)p_map;
+            src->mapped = true;
+            (void)madvise( p_map, (size_t)src->size, MADV_SEQUENTIAL );
+            return 0;
+        }
+    }
+#endif
+
+    /* mmap() is not available, fall back to holding the file in memory */
+    {
+        uint8_t *p_buf = malloc( (size_t)src->size );
+        uint64_t offset = 0;
+
+        if ( p_buf == NULL )
+        {
+            tx_file_source_close( src );
+            return -ENOMEM;
+        }
+        while ( offset < src->size )
+        {
+            ssize_t nr_read = read( src->fd, p_buf + offset, (size_t)( src->size - offset ) );
+            if ( nr_read < 0 )
+            {
+                int32_t status = -errno;
+
+                if ( errno == EINTR )
+                {
+                    continue;
+                }
+                free( p_buf );
+                tx_file_source_close( src );
+                return status;
+            }
+            else if ( nr_read == 0 )
+            {
+                break;
+            }
+            offset += (uint64_t)nr_read;
+        }
+        src->size = offset;
+        src->p_data = p_buf;
+        src->release_behind = false;
+    }
+
+    return 0;
+}
+
+#if (!defined __MINGW32__)
+/*****************************************************************************/
+/** Start the blocks of a source at the sample received at an RF timestamp, using the block
+    index of the capture.  Only captures of plain 16-bit samples (no metadata, packing or
+    compression) can be replayed.  A timestamp that falls in a gap of the capture starts at the
+    first sample after the gap.
+
+    @param[in] src          opened source
+    @param[in] p_path       input file path, the index is <p_path>.idx
+    @param[in] rf_timestamp RF timestamp of the first sample to replay
+
+    @return 0 on success, -ENOTSUP if the capture can't be replayed, -ERANGE if the timestamp
+    is outside of the capture, else a negative errno from opening the index
+*/
+static inline int32_t tx_file_source_seek_rf( struct tx_file_source *src,
+                                              const char *p_path,
+                                              uint64_t rf_timestamp )
+{
+    struct capture_index_map m;
+    const struct capture_index_record *p_rec;
+    uint64_t start;
+    int32_t status;
+
+    status = capture_index_map_open( &m, p_path );
+    if ( status != 0 )
+    {
+        return status;
+    }
+    if ( ( m.p_hdr->flags & ( CAPTURE_INDEX_INCLUDE_META | CAPTURE_INDEX_PACKED |
+                              CAPTURE_INDEX_COMPRESSED ) ) != 0 )
+    {
+        capture_index_map_close( &m );
+        return -ENOTSUP;
+    }
+    if ( ( m.nr_records == 0 ) || ( rf_timestamp < m.p_records[0].rf_timestamp ) )
+    {
+        capture_index_map_close( &m );
+        return -ERANGE;
+    }
+
+    p_rec = &(m.p_records[capture_index_find_rf( &m, rf_timestamp )]);
+    if ( rf_timestamp - p_rec->rf_timestamp < p_rec->nr_samples )
+    {
+        start = p_rec->offset + ( ( rf_timestamp - p_rec->rf_timestamp ) * sizeof(uint32_t) );
+    }
+    else
+    {
+        /* past the end of the block, either in a gap or after the last block */
+        start = p_rec->offset + ( (uint64_t)p_rec->nr_samples * sizeof(uint32_t) );
+    }
+    capture_index_map_close( &m );
+
+    if ( start >= src->size )
+    {
+        return -ERANGE;
+    }
+    src->start = start;
+    src->nr_blocks = (uint32_t)( ( src->size - start + src->block_size_in_bytes - 1 ) /
+                                 src->block_size_in_bytes );
+
+    return 0;
+}
+#endif
+
+/*****************************************************************************/
+/** Prepare to read from a source.
+
+    @param[out] r           reader to initialize
+    @param[in]  src         opened source
+
+    @return void
+*/
+static inline void tx_file_reader_init( struct tx_file_reader *r,
+                                        const struct tx_file_source *src )
+{
+    r->p_src = src;
+    r->advised_end = 0;
+    r->released_end = 0;
+}
+
+#if !(defined TX_FILE_SOURCE_NO_MMAP)
+/* keep the readahead window in front of offset advised, and release what is well behind it */
+static inline void _tx_file_reader_advise( struct tx_file_reader *r,
+                                           uint64_t offset )
+{
+    const struct tx_file_source *src = r->p_src;
+    const uint64_t page_mask = ~((uint64_t)sysconf( _SC_PAGESIZE ) - 1);
+
+    if ( offset < r->released_end )
+    {
+        /* the reader wrapped around to the start of the file */
+        r->advised_end = 0;
+        r->released_end = 0;
+    }
+
+    /* advise the next window once the reader is half way into the current one */
+    if ( ( offset + ( src->readahead_bytes / 2 ) ) >= r->advised_end )
+    {
+        uint64_t start = ( offset > r->advised_end ? offset : r->advised_end ) & page_mask;
+        uint64_t end = offset + src->readahead_bytes;
+
+        if ( end > src->size )
+        {
+            end = src->size;
+        }
+        if ( end > start )
+        {
+            (void)madvise( (void *)(src->p_data + start), (size_t)( end - start ),
+                           MADV_WILLNEED );
+        }
+        r->advised_end = end;
+    }
+
+    if ( src->release_behind && ( offset > ( r->released_end + 2 * src->readahead_bytes ) ) )
+    {
+        uint64_t end = ( offset - src->readahead_bytes ) & page_mask;
+
+        if ( end > r->released_end )
+        {
+            (void)madvise( (void *)(src->p_data + r->released_end),
+                           (size_t)( end - r->released_end ), MADV_DONTNEED );
+            r->released_end = end;
+        }
+    }
+}
+#endif
+
+/*****************************************************************************/
+/** Copy a block of the file into a transmit buffer.  The part of the last block beyond the end
+    of the file is zero filled.
+
+    @param[in]  r           reader
+    @param[in]  block_num   index of the block from the start of the source
+    @param[out] p_dst       destination, block_size_in_bytes long
+
+    @return the number of bytes copied from the file
+*/
+static inline uint32_t tx_file_reader_fill( struct tx_file_reader *r,
+                                            uint32_t block_num,
+                                            void *p_dst )
+{
+    const struct tx_file_source *src = r->p_src;
+    uint64_t offset = src->start + ( (uint64_t)block_num * src->block_size_in_bytes );
+    uint32_t nr_bytes = src->block_size_in_bytes;
+
+    if ( offset >= src->size )
+    {
+        memset( p_dst, 0, nr_bytes );
+        return 0;
+    }
+
+#if !(defined TX_FILE_SOURCE_NO_MMAP)
+    if ( src->mapped )
+    {
+        _tx_file_reader_advise( r, offset );
+    }
+#endif
+
+    if ( ( src->size - offset ) < nr_bytes )
+    {
+        nr_bytes = (uint32_t)( src->size - offset );
+        memset( (uint8_t *)p_dst + nr_bytes, 0, src->block_size_in_bytes - nr_bytes );
+    }
+    memcpy( p_dst, src->p_data + offset, nr_bytes );
+
+    return nr_bytes;
+}
+
+#endif  /* __TX_FILE_SOURCE_H__ */
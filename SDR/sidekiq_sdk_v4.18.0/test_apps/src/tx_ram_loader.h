@@ -0,0 +1,380 @@
+/**
+ * @file   tx_ram_loader.h
+ *
+ * @brief  Loads waveforms into the transmit RAM of the FPGA user app with bulk register writes,
+ *         skipping the load when the RAM already holds the same waveform.
+ *
+ * The transmit RAM is filled through a single data register, one register write per word.
+ * libsidekiq has no vectored register access, so each word costs a round trip over the
+ * transport.  When the card is on the reference custom transport (custom_xport_bare) and the
+ * application is linked with it, the words are handed to my_xport_fpga_reg_write_burst() in one
+ * call instead, otherwise they fall back to skiq_write_user_fpga_reg() one at a time.
+ *
+ * What was loaded into each FIFO (loop size and a checksum of the words) is remembered in a small
+ * file per card under TX_RAM_CACHE_DIR, so that a later run with an unchanged waveform doesn't
+ * load it again.  An entry is only trusted for the same FPGA bitstream (git hash and build date)
+ * and while the FPGA system timestamp has advanced by the host time elapsed since the load.  A
+ * reprogramming or a power cycle restarts the system timestamp, so once the FPGA is reloaded its
+ * uptime no longer matches the host's, even after it has grown past the timestamp of the load
+ * (the cache file outlives an FPGA reload when the host isn't rebooted).  Loads that bypass this
+ * file are not noticed, force a reload in that case.
+ *
+ * The FIFO select bits of the loop size register are shared by all FIFOs, so FIFOs of a card are
+ * loaded one after the other; loading them concurrently would interleave their words.
+ */
+
+#ifndef __TX_RAM_LOADER_H__
+#define __TX_RAM_LOADER_H__
+
+/***** INCLUDES *****/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include <sidekiq_api.h>
+
+/***** DEFINES *****/
+
+#ifndef TX_RAM_CACHE_DIR
+#   define TX_RAM_CACHE_DIR             "/dev/shm"
+#endif
+
+/* number of FIFOs selectable in the loop size register */
+#define TX_RAM_NR_FIFOS                 (16)
+
+#define TX_RAM_CACHE_MAGIC              (0x54585232)    /* "TXR2" */
+
+/* largest difference between the FPGA and host time elapsed since a load for the entry to be
+   trusted: timestamp read latency plus the drift between the two clocks */
+#define TX_RAM_CACHE_TOLERANCE_NS       (20 * 1000 * 1000)
+#define TX_RAM_CACHE_TOLERANCE_PPM      (1000)
+
+/* host clock that keeps counting while the host is suspended, as the FPGA does */
+#if (defined CLOCK_BOOTTIME)
+#   define TX_RAM_HOST_CLOCK            CLOCK_BOOTTIME
+#else
+#   define TX_RAM_HOST_CLOCK            CLOCK_MONOTONIC
+#endif
+
+/***** TYPEDEFS *****/
+
+struct tx_ram_cache_entry
+{
+    uint32_t loop_size;                 /* as written to the loop size register, 0 if unknown */
+    uint32_t checksum;
+    uint64_t sys_ts;                    /* FPGA system timestamp after the load */
+    int64_t host_ns;                    /* host time (TX_RAM_HOST_CLOCK) of that read */
+};
+
+/* contents of the cache file */
+struct tx_ram_cache
+{
+    uint32_t magic;
+    uint32_t git_hash;
+    uint32_t build_date;
+    uint32_t nr_fifos;
+    struct tx_ram_cache_entry fifo[TX_RAM_NR_FIFOS];
+};
+
+struct tx_ram_loader
+{
+    uint8_t card;
+    bool burst;                         /* my_xport_fpga_reg_write_burst() is available */
+    bool force;                         /* ignore the cache */
+    char path[128];
+    uint64_t sys_ts_freq;               /* FPGA system timestamp frequency */
+    struct tx_ram_cache cache;
+
+    /* statistics */
+    uint32_t nr_loaded;
+    uint32_t nr_skipped;
+    uint64_t nr_words;
+};
+
+#define TX_RAM_LOADER_INITIALIZER                       \
+    (struct tx_ram_loader){                             \
+        .card = 0,                                      \
+        .burst = false,                                 \
+        .force = false,                                 \
+        .path = { 0 },                                  \
+        .sys_ts_freq = 0,                               \
+        .nr_loaded = 0,                                 \
+        .nr_skipped = 0,                                \
+        .nr_words = 0,                                  \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+#if (!defined __MINGW32__)
+/* defined by custom_xport_bare/src/my_custom_xport.c when the application is linked with it */
+extern int32_t my_xport_fpga_reg_write_burst( uint64_t xport_uid,
+                                              uint32_t addr,
+                                              const uint32_t *p_data,
+                                              uint32_t nr_words ) __attribute__((weak));
+#endif
+
+/*****************************************************************************/
+/** Compute the checksum of a waveform (32-bit FNV-1a over the words and their number).
+
+    @param[in] p_words      words of the waveform
+    @param[in] nr_words     number of words
+
+    @return the checksum
+*/
+static inline uint32_t tx_ram_checksum( const uint32_t *p_words,
+                                        uint32_t nr_words )
+{
+    uint32_t hash = 2166136261u;
+    uint32_t i, b;
+
+    for ( i = 0; i <= nr_words; i++ )
+    {
+        uint32_t word = ( i < nr_words ) ? p_words[i] : nr_words;
+
+        for ( b = 0; b < 4; b++ )
+        {
+            hash ^= ( word >> ( 8 * b ) ) & 0xff;
+            hash *= 16777619u;
+        }
+    }
+
+    return hash;
+}
+
+static inline int64_t _tx_ram_host_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime( TX_RAM_HOST_CLOCK, &ts );
+    return ( (int64_t)ts.tv_sec * 1000000000LL ) + ts.tv_nsec;
+}
+
+/* read the FPGA system timestamp and the host time half way through the read */
+static inline int32_t _tx_ram_read_sys_ts( struct tx_ram_loader *p,
+                                           uint64_t *p_sys_ts,
+                                           int64_t *p_host_ns )
+{
+    int64_t before_ns = _tx_ram_host_ns();
+    int32_t status = skiq_read_curr_sys_timestamp( p->card, p_sys_ts );
+
+    *p_host_ns = before_ns + ( ( _tx_ram_host_ns() - before_ns ) / 2 );
+
+    return status;
+}
+
+/* the FPGA has kept running since the entry was stored: its system timestamp advanced by the host
+   time elapsed since then */
+static inline bool _tx_ram_entry_current( const struct tx_ram_loader *p,
+                                          const struct tx_ram_cache_entry *e,
+                                          uint64_t sys_ts,
+                                          int64_t host_ns )
+{
+    int64_t host_elapsed_ns = host_ns - e->host_ns;
+    int64_t fpga_elapsed_ns, error_ns, tolerance_ns;
+
+    if ( ( e->sys_ts == 0 ) || ( p->sys_ts_freq == 0 ) || ( sys_ts < e->sys_ts ) ||
+         ( host_elapsed_ns < 0 ) )
+    {
+        return false;
+    }
+
+    fpga_elapsed_ns = (int64_t)( (double)( sys_ts - e->sys_ts ) * 1e9 /
+                                 (double)p->sys_ts_freq );
+    error_ns = fpga_elapsed_ns - host_elapsed_ns;
+    if ( error_ns < 0 )
+    {
+        error_ns = -error_ns;
+    }
+    tolerance_ns = TX_RAM_CACHE_TOLERANCE_NS +
+        ( host_elapsed_ns / 1000000 ) * TX_RAM_CACHE_TOLERANCE_PPM;
+
+    return ( error_ns <= tolerance_ns );
+}
+
+/*****************************************************************************/
+/** Prepare a loader for a card: find out whether bulk writes are available and read the cache
+    file, discarding it if it was written for another bitstream.  A missing or unreadable cache
+    file is not an error, every FIFO is then loaded.
+
+    @param[out] p           loader to initialize
+    @param[in]  card        card
+    @param[in]  force       load every waveform even if the cache says it is loaded
+
+    @return 0 on success, else the status of skiq_read_parameters() or
+    skiq_read_sys_timestamp_freq()
+*/
+static inline int32_t tx_ram_loader_init( struct tx_ram_loader *p,
+                                          uint8_t card,
+                                          bool force )
+{
+    static skiq_param_t params;
+    FILE *fp;
+    int32_t status;
+
+    *p = TX_RAM_LOADER_INITIALIZER;
+    p->card = card;
+    p->force = force;
+
+    status = skiq_read_parameters( card, &params );
+    if ( status != 0 )
+    {
+        return status;
+    }
+    status = skiq_read_sys_timestamp_freq( card, &(p->sys_ts_freq) );
+    if ( status != 0 )
+    {
+        return status;
+    }
+
+#if (!defined __MINGW32__)
+    p->burst = ( params.card_param.xport == skiq_xport_type_custom ) &&
+        ( my_xport_fpga_reg_write_burst != NULL );
+#endif
+
+    snprintf( p->path, sizeof(p->path), "%s/skiq_tx_ram.%s", TX_RAM_CACHE_DIR,
+              params.card_param.serial_string );
+    fp = fopen( p->path, "rb" );
+    if ( fp != NULL )
+    {
+        if ( fread( &(p->cache), sizeof(p->cache), 1, fp ) != 1 )
+        {
+            memset( &(p->cache), 0, sizeof(p->cache) );
+        }
+        fclose( fp );
+    }
+
+    if ( ( p->cache.magic != TX_RAM_CACHE_MAGIC ) || ( p->cache.nr_fifos != TX_RAM_NR_FIFOS ) ||
+         ( p->cache.git_hash != params.fpga_param.git_hash ) ||
+         ( p->cache.build_date != params.fpga_param.build_date ) )
+    {
+        memset( &(p->cache), 0, sizeof(p->cache) );
+        p->cache.magic = TX_RAM_CACHE_MAGIC;
+        p->cache.nr_fifos = TX_RAM_NR_FIFOS;
+        p->cache.git_hash = params.fpga_param.git_hash;
+        p->cache.build_date = params.fpga_param.build_date;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/** Write a run of words to one user FPGA register, in bulk when possible.
+
+    @param[in] p            loader
+    @param[in] addr         user register
+    @param[in] p_words      words to write
+    @param[in] nr_words     number of words
+
+    @return 0 on success, else the status of the failing write
+*/
+static inline int32_t tx_ram_write_burst( struct tx_ram_loader *p,
+                                          uint32_t addr,
+                                          const uint32_t *p_words,
+                                          uint32_t nr_words )
+{
+    int32_t status = 0;
+    uint32_t i;
+
+#if (!defined __MINGW32__)
+    if ( p->burst )
+    {
+        /* the reference transport probes its cards with UIDs equal to their index */
+        return my_xport_fpga_reg_write_burst( p->card, addr, p_words, nr_words );
+    }
+#endif
+
+    for ( i = 0; ( i < nr_words ) && ( status == 0 ); i++ )
+    {
+        status = skiq_write_user_fpga_reg( p->card, addr, p_words[i] );
+    }
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Load a waveform into one FIFO of the transmit RAM unless the cache shows that the FIFO
+    already holds it.  After a load the cache file is rewritten.
+
+    @param[in] p            loader
+    @param[in] fifo         index of the FIFO, less than TX_RAM_NR_FIFOS
+    @param[in] loop_addr    loop size register
+    @param[in] loop_size    value of the loop size register, FIFO select bits included
+    @param[in] data_addr    data register
+    @param[in] p_words      words of the waveform
+    @param[in] nr_words     number of words
+
+    @return 0 on success (loaded or skipped), else a negative errno or the status of the failing
+    register access
+*/
+static inline int32_t tx_ram_loader_load( struct tx_ram_loader *p,
+                                          uint32_t fifo,
+                                          uint32_t loop_addr,
+                                          uint32_t loop_size,
+                                          uint32_t data_addr,
+                                          const uint32_t *p_words,
+                                          uint32_t nr_words )
+{
+    struct tx_ram_cache_entry *e;
+    uint32_t checksum = tx_ram_checksum( p_words, nr_words );
+    uint64_t sys_ts = 0;
+    int64_t host_ns = 0;
+    int32_t status;
+    FILE *fp;
+
+    if ( fifo >= TX_RAM_NR_FIFOS )
+    {
+        return -EINVAL;
+    }
+    e = &(p->cache.fifo[fifo]);
+
+    status = _tx_ram_read_sys_ts( p, &sys_ts, &host_ns );
+    if ( status != 0 )
+    {
+        return status;
+    }
+
+    if ( !p->force && _tx_ram_entry_current( p, e, sys_ts, host_ns ) &&
+         ( e->loop_size == loop_size ) && ( e->checksum == checksum ) )
+    {
+        p->nr_skipped++;
+        return 0;
+    }
+
+    /* forget the FIFO first, a failed load leaves it in an unknown state */
+    e->sys_ts = 0;
+
+    status = skiq_write_user_fpga_reg( p->card, loop_addr, loop_size );
+    if ( status == 0 )
+    {
+        status = tx_ram_write_burst( p, data_addr, p_words, nr_words );
+    }
+    if ( status == 0 )
+    {
+        status = _tx_ram_read_sys_ts( p, &sys_ts, &host_ns );
+    }
+    if ( status == 0 )
+    {
+        e->loop_size = loop_size;
+        e->checksum = checksum;
+        e->sys_ts = ( sys_ts != 0 ) ? sys_ts : 1;
+        e->host_ns = host_ns;
+        p->nr_loaded++;
+        p->nr_words += nr_words;
+    }
+
+    /* the cache is only an optimization, failing to store it just means reloading next time */
+    fp = fopen( p->path, "wb" );
+    if ( fp != NULL )
+    {
+        (void)fwrite( &(p->cache), sizeof(p->cache), 1, fp );
+        fclose( fp );
+    }
+
+    return status;
+}
+
+#endif  /* __TX_RAM_LOADER_H__ */
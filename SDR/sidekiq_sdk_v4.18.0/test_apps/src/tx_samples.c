@@ -22,6 +22,10 @@
 #include <sidekiq_api.h>
 #include <arg_parser.h>
 
+#include "tx_file_source.h"
+#include "tx_waveform.h"
+#include "rf_scheduler.h"
+
 /* https://gcc.gnu.org/onlinedocs/gcc-4.8.5/cpp/Stringification.html */
 #define xstr(s)                         str(s)
 #define str(s)                          #s
@@ -38,6 +42,10 @@
 #   define DEFAULT_TIMESTAMP_VALUE  (100000)
 #endif
 
+#ifndef DEFAULT_READAHEAD_MB
+#   define DEFAULT_READAHEAD_MB     (16)
+#endif
+
 /* these are used to provide help strings for the application when running it
    with either the "-h" or "--help" flags */
 static const char* p_help_short = "- transmit I/Q data";
@@ -63,6 +71,28 @@ The '--late' option can be used to enable support for transmitting data with\n\
 late timestamps (when using bitfiles that support this feature); this feature\n\
 can be enabled standalone or with the '--timestamp' option.\n\
 \n\
+Instead of a file, '--waveform' synthesizes the samples of each block just\n\
+before it is transmitted, for '--duration' seconds (then '--repeat' more\n\
+times, without a phase discontinuity):\n\
+\n\
+    tone   a tone '--wave-frequency' Hz from the LO\n\
+    chirp  a sweep from '--wave-frequency' to '--stop-frequency' Hz every\n\
+           '--sweep-period' seconds\n\
+    pn     a BPSK modulated PN sequence of order '--pn-order' at\n\
+           '--symbol-rate', '--wave-frequency' Hz from the LO\n\
+    bpsk   BPSK frames: a 1010 preamble, the sync word 0x1ACFFC1D and\n\
+           '--frame-bytes' bytes of the PN sequence, then '--frame-gap'\n\
+           samples of silence\n\
+    gfsk   the same frames with GFSK (BT 0.5), '--deviation' Hz peak\n\
+           deviation (a quarter of the symbol rate by default)\n\
+\n\
+All waveforms are scaled to '--amplitude' of full scale.  See tx_waveform.h.\n\
+\n\
+A capture recorded with a block index (rx_samples --index) can be replayed\n\
+from the sample received at an RF timestamp with '--start-at'; a timestamp\n\
+in a gap of the capture starts after the gap.  Only captures of plain 16-bit\n\
+samples (without --meta, --packed or --compress) can be replayed.\n\
+\n\
 Defaults:\n\
   --attenuation=100\n\
   --block-size=1020\n\
@@ -72,6 +102,11 @@ Defaults:\n\
   --rate=1000000\n\
   --timestamp-base=" xstr(DEFAULT_CARD_NUMBER) "\n\
   --repeat=0\n\
+  --readahead=" xstr(DEFAULT_READAHEAD_MB) "\n\
+  --duration=10\n\
+  --amplitude=" xstr(TX_WAVEFORM_DEFAULT_AMPLITUDE) "\n\
+  --pn-order=" xstr(TX_WAVEFORM_DEFAULT_PN_ORDER) "\n\
+  --frame-bytes=" xstr(TX_WAVEFORM_DEFAULT_FRAME_BYTES) "\n\
   --cal-mode=auto\n\
   --force-cal=false";
 
@@ -85,7 +120,19 @@ static uint32_t sample_rate = 1000000;
 static uint32_t bandwidth = 0;
 static uint64_t timestamp = 0;
 static int32_t repeat = 0;
+static uint32_t readahead_mb = DEFAULT_READAHEAD_MB;
+static uint64_t start_rf_ts = 0;
+static bool start_rf_ts_present = false;
 static char* p_file_path = NULL;
+static char* p_waveform = NULL;
+static double duration = 10.0;
+static struct tx_waveform_config wave_config =
+{
+    .amplitude = TX_WAVEFORM_DEFAULT_AMPLITUDE,
+    .pn_order = TX_WAVEFORM_DEFAULT_PN_ORDER,
+    .frame_bytes = TX_WAVEFORM_DEFAULT_FRAME_BYTES,
+    .bt = TX_WAVEFORM_DEFAULT_BT,
+};
 static char* p_hdl = "A1";
 static char* p_timestamp_base = DEFAULT_TIMESTAMP_BASE;
 static bool immediate_mode = false;
@@ -97,8 +144,10 @@ static skiq_iq_order_t  iq_order_mode = skiq_iq_order_qi;
 static skiq_chan_mode_t chan_mode = skiq_chan_mode_single;
 static skiq_tx_hdl_t hdl = skiq_tx_hdl_A1;
 static skiq_tx_timestamp_base_t timestamp_base = skiq_tx_rf_timestamp;
-static FILE *input_fp = NULL;
-static skiq_tx_block_t **p_tx_blocks = NULL; /* reference to an array of transmit block references */
+static struct tx_file_source tx_source = TX_FILE_SOURCE_INITIALIZER;
+static struct tx_file_reader tx_reader;
+static struct tx_waveform tx_wave = TX_WAVEFORM_INITIALIZER;
+static skiq_tx_block_t *p_tx_block = NULL; /* refilled from the input file for every block */
 static uint8_t mult_factor = 1;
 static uint32_t num_blocks = 0;
 static bool running = true;
@@ -165,12 +214,91 @@ static struct application_argument p_args[] =
                 "N",
                 &repeat,
                 INT32_VAR_TYPE),
-    APP_ARG_REQ("source",
+    APP_ARG_OPT("readahead",
+                0,
+                "Amount of the input file to prefetch ahead of transmission",
+                "MB",
+                &readahead_mb,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT_PRESENT("start-at",
+                        0,
+                        "Replay an indexed --source from the sample received at an RF timestamp",
+                        "TS",
+                        &start_rf_ts,
+                        UINT64_VAR_TYPE,
+                        &start_rf_ts_present),
+    APP_ARG_OPT("source",
                 's',
                 "Input file to source for I/Q data",
                 "PATH",
                 &p_file_path,
                 STRING_VAR_TYPE),
+    APP_ARG_OPT("waveform",
+                'w',
+                "Generate tone, chirp, pn, bpsk or gfsk instead of reading --source",
+                "TYPE",
+                &p_waveform,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("duration",
+                0,
+                "Seconds of --waveform to transmit",
+                "SECONDS",
+                &duration,
+                DOUBLE_VAR_TYPE),
+    APP_ARG_OPT("wave-frequency",
+                0,
+                "Tone, chirp start or carrier offset from the LO",
+                "Hz",
+                &(wave_config.frequency),
+                DOUBLE_VAR_TYPE),
+    APP_ARG_OPT("stop-frequency",
+                0,
+                "Chirp end offset from the LO",
+                "Hz",
+                &(wave_config.stop_frequency),
+                DOUBLE_VAR_TYPE),
+    APP_ARG_OPT("sweep-period",
+                0,
+                "Duration of each chirp sweep",
+                "SECONDS",
+                &(wave_config.sweep_period),
+                DOUBLE_VAR_TYPE),
+    APP_ARG_OPT("symbol-rate",
+                0,
+                "Symbol rate of pn, bpsk and gfsk",
+                "Hz",
+                &(wave_config.symbol_rate),
+                DOUBLE_VAR_TYPE),
+    APP_ARG_OPT("deviation",
+                0,
+                "Peak frequency deviation of gfsk",
+                "Hz",
+                &(wave_config.deviation),
+                DOUBLE_VAR_TYPE),
+    APP_ARG_OPT("pn-order",
+                0,
+                "PN sequence order (7, 9, 15, 23 or 31)",
+                "N",
+                &(wave_config.pn_order),
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("frame-bytes",
+                0,
+                "Payload bytes of each bpsk or gfsk frame",
+                "N",
+                &(wave_config.frame_bytes),
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("frame-gap",
+                0,
+                "Samples of silence after each bpsk or gfsk frame",
+                "N",
+                &(wave_config.frame_gap),
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("amplitude",
+                0,
+                "Amplitude of --waveform as a fraction of full scale",
+                "FRACTION",
+                &(wave_config.amplitude),
+                DOUBLE_VAR_TYPE),
     APP_ARG_OPT("serial",
                 'S',
                 "Specify Sidekiq by serial number",
@@ -231,6 +359,7 @@ static struct application_argument p_args[] =
 
 /* local functions */
 static int32_t init_tx_buffer(void);
+static int32_t init_tx_waveform( uint32_t samples_per_block );
 static int32_t stop_tx_streaming_after_rf_ts( uint8_t card_,
                                               skiq_tx_hdl_t hdl_,
                                               uint64_t rf_ts_ );
@@ -269,7 +398,6 @@ int main( int argc, char *argv[])
     double actual_sample_rate;
     uint64_t min_lo_freq, max_lo_freq;
     uint32_t timestamp_increment=0;
-    uint32_t j = 0;
     pid_t owner = 0;
     bool skiq_initialized = false;
     FILE *p_rfic_file = NULL;
@@ -287,6 +415,20 @@ int main( int argc, char *argv[])
         goto cleanup;
     }
 
+    if( (NULL == p_file_path) == (NULL == p_waveform) )
+    {
+        fprintf(stderr, "Error: specify EITHER --source or --waveform\n");
+        status = -1;
+        goto cleanup;
+    }
+    if( (NULL != p_waveform) &&
+        (tx_waveform_parse(p_waveform, &(wave_config.type)) != 0) )
+    {
+        fprintf(stderr, "Error: invalid waveform '%s'\n", p_waveform);
+        status = -1;
+        goto cleanup;
+    }
+
     if ( (0 != timestamp) && (false != immediate_mode) )
     {
         fprintf(stderr, "Error: cannot set both timestamp and immediate"
@@ -420,15 +562,7 @@ int main( int argc, char *argv[])
         bandwidth = sample_rate;
     }
 
-    input_fp = fopen(p_file_path, "rb");
-    if( input_fp == NULL )
-    {
-        fprintf(stderr, "Error: unable to open input file %s\n", p_file_path);
-        status = -1;
-        goto cleanup;
-    }
-
-    // initialize the transmit buffer
+    // map the input file and initialize the transmit buffer
     status = init_tx_buffer();
     if (0 != status)
     {
@@ -459,7 +593,8 @@ int main( int argc, char *argv[])
             fprintf(stderr, "Error: unable to initialize libsidekiq with"
                     " status %" PRIi32 "\n", status);
         }
-        fclose(input_fp);
+        tx_file_source_close(&tx_source);
+        skiq_tx_block_free(p_tx_block);
         return (-1);
     }
     skiq_initialized = true;
@@ -720,6 +855,15 @@ int main( int argc, char *argv[])
         timestamp_increment = block_size_in_words;
     }
 
+    if( p_waveform != NULL )
+    {
+        status = init_tx_waveform( timestamp_increment );
+        if( status != 0 )
+        {
+            goto cleanup;
+        }
+    }
+
     if(( tx_mode == skiq_tx_with_timestamps_data_flow_mode ) ||
        ( tx_mode == skiq_tx_with_timestamps_allow_late_data_flow_mode ))
     {
@@ -764,10 +908,27 @@ int main( int argc, char *argv[])
         // transmit a block at a time
         while( (curr_block < num_blocks) && (running==true) )
         {
-            skiq_tx_set_block_timestamp( p_tx_blocks[curr_block], timestamp );
+            /* the transmit is synchronous, so the block may be refilled as
+               soon as skiq_transmit() returns */
+            if( p_waveform != NULL )
+            {
+                tx_waveform_fill( &tx_wave, (uint32_t *)p_tx_block->data, block_size_in_words );
+            }
+            else
+            {
+                tx_file_reader_fill( &tx_reader, curr_block, p_tx_block->data );
+            }
+            if ( chan_mode == skiq_chan_mode_dual )
+            {
+                /* duplicate the block of samples into the second half of the
+                 * transmit block's data array */
+                memcpy( &(p_tx_block->data[block_size_in_words*2]),
+                        p_tx_block->data, block_size_in_words * 4 );
+            }
+            skiq_tx_set_block_timestamp( p_tx_block, timestamp );
 
             // transmit the data
-            status = skiq_transmit(card, hdl, p_tx_blocks[curr_block], NULL );
+            status = skiq_transmit(card, hdl, p_tx_block, NULL );
             if (0 != status)
             {
                 fprintf(stderr, "Error: failed to transmit data (result code %"
@@ -781,7 +942,8 @@ int main( int argc, char *argv[])
 
         if( repeat > 0 )
         {
-            printf("Info: transmitting the file %u more times\n", repeat);
+            printf("Info: transmitting the %s %u more times\n",
+                   (p_waveform != NULL) ? "waveform" : "file", repeat);
         }
         else
         {
@@ -827,140 +989,136 @@ cleanup:
     // disable streaming, cleanup and shutdown
     if (skiq_initialized)
     {
-        if (NULL != p_tx_blocks)
-        {
-            for (j = 0; j < num_blocks; j++)
-            {
-                skiq_tx_block_free(p_tx_blocks[j]);
-            }
-
-            free(p_tx_blocks);
-            p_tx_blocks = NULL;
-        }
-
         skiq_exit();
         skiq_initialized = false;
     }
 
-    if (NULL != input_fp)
+    if (NULL != p_tx_block)
     {
-        fclose(input_fp);
-        input_fp = NULL;
+        skiq_tx_block_free(p_tx_block);
+        p_tx_block = NULL;
     }
+    tx_file_source_close(&tx_source);
+    tx_waveform_free(&tx_wave);
 
     return status;
 }
 
 
 /*****************************************************************************/
-/** This function reads the contents of the file into p_tx_blocks.
+/** This function maps the input file and allocates the transmit block that is
+    filled from it (or from the waveform generator).  Blocks are copied out of
+    the mapping as they are transmitted, so transmission can start without
+    reading the whole file.
 
     @param none
-    @return: void
+    @return: int32_t-indicating status
 */
 static int32_t init_tx_buffer(void)
 {
     int32_t status = 0;
-    uint32_t num_bytes_in_file=0;
-    int32_t bytes_read=1;
-    uint32_t i = 0;
-    uint32_t j = 0;
-    int result = 0;
-
-    // determine how large the file is and how many blocks we'll need to send
-    fseek(input_fp, 0, SEEK_END);
-    num_bytes_in_file = ftell(input_fp);
-    rewind(input_fp);
-    num_blocks = (num_bytes_in_file / (block_size_in_words*4));
 
-    // if we don't end on an even block boundary, we need an extra block
-    if ( (num_bytes_in_file % (block_size_in_words * 4)) != 0 )
+    /* generated blocks are filled as they are sent, see init_tx_waveform() */
+    if ( p_waveform == NULL )
     {
-        num_blocks++;
+        status = tx_file_source_open( &tx_source, p_file_path, block_size_in_words * 4,
+                                      (uint64_t)readahead_mb * 1024 * 1024 );
+        if ( 0 != status )
+        {
+            fprintf(stderr, "Error: unable to open input file %s (result code %"
+                    PRIi32 ")\n", p_file_path, status);
+            return -1;
+        }
+        if ( start_rf_ts_present )
+        {
+#if (!defined __MINGW32__)
+            status = tx_file_source_seek_rf( &tx_source, p_file_path, start_rf_ts );
+#else
+            status = -ENOTSUP;
+#endif
+            if ( 0 != status )
+            {
+                fprintf(stderr, "Error: unable to start input file %s at RF timestamp %" PRIu64
+                        " (result code %" PRIi32 ")\n", p_file_path, start_rf_ts, status);
+                tx_file_source_close( &tx_source );
+                return -1;
+            }
+            printf("Info: starting at byte %" PRIu64 " of the file\n", tx_source.start);
+        }
+        tx_file_reader_init( &tx_reader, &tx_source );
+        num_blocks = tx_source.nr_blocks;
+        printf("Info: %u blocks contained in the file\n", num_blocks);
     }
-    printf("Info: %u blocks contained in the file\n", num_blocks);
 
-    // allocate the buffer
-    p_tx_blocks = calloc( num_blocks, sizeof( skiq_tx_block_t* ) );
-    if( p_tx_blocks == NULL )
+    if ( chan_mode == skiq_chan_mode_dual )
     {
-        fprintf(stderr, "Error: unable to allocate %u bytes to hold transmit"
-                " block descriptors\n",
-                (uint32_t)(num_blocks * sizeof( skiq_tx_block_t* )));
-        status = -1;
-        goto finished;
+        /* for a dual channel mode, allocate a transmit block by
+         * doubling the number of words */
+        p_tx_block = skiq_tx_block_allocate( 2 * block_size_in_words );
+    }
+    else
+    {
+        /* allocate a transmit block by number of words */
+        p_tx_block = skiq_tx_block_allocate( block_size_in_words );
     }
 
-    // read in the contents of the file, one block at a time
-    for (i = 0; i < num_blocks; i++)
+    if ( p_tx_block == NULL )
     {
-        if ( !feof(input_fp) && (bytes_read > 0) )
-        {
-            if ( chan_mode == skiq_chan_mode_dual )
-            {
-                /* for a dual channel mode, allocate a transmit block by
-                 * doubling the number of words */
-                p_tx_blocks[i] = \
-                    skiq_tx_block_allocate( 2 * block_size_in_words );
-            }
-            else
-            {
-                /* allocate a transmit block by number of words */
-                p_tx_blocks[i] = skiq_tx_block_allocate( block_size_in_words );
-            }
+        fprintf(stderr, "Error: unable to allocate transmit block data\n");
+        tx_file_source_close( &tx_source );
+        status = -2;
+    }
 
-            if ( p_tx_blocks[i] == NULL )
-            {
-                fprintf(stderr,
-                    "Error: unable to allocate transmit block data\n");
-                status = -2;
-                goto finished;
-            }
+    return status;
+}
 
-            // read a block of samples
-            bytes_read = fread( p_tx_blocks[i]->data, sizeof(int32_t),
-                                block_size_in_words, input_fp );
-            result = ferror(input_fp);
-            if ( 0 != result )
-            {
-                fprintf(stderr,
-                    "Error: unable to read from file (result code %d)\n",
-                    result);
-                status = -3;
-                goto finished;
-            }
-            if ( chan_mode == skiq_chan_mode_dual )
-            {
-                /* duplicate the block of samples into the second half of the
-                 * transmit block's data array */
-                memcpy( &(p_tx_blocks[i]->data[block_size_in_words*2]),
-                        p_tx_blocks[i]->data, block_size_in_words * 4 );
-            }
-        }
-    }
+/*****************************************************************************/
+/** This function sets up the waveform generator once the card is configured,
+    and sets the number of blocks that make up '--duration' seconds.
 
-finished:
-    if (0 != status)
+    @param samples_per_block: the number of samples in each transmit block
+    @return: 0 on success, else a negative errno
+*/
+static int32_t init_tx_waveform( uint32_t samples_per_block )
+{
+    const char *p_kernel = NULL;
+    uint8_t resolution = 0;
+    double nr_blocks;
+    int32_t status;
+
+    status = skiq_read_tx_iq_resolution( card, &resolution );
+    if ( status != 0 )
     {
-        if (NULL != p_tx_blocks)
-        {
-            for (j = 0; j < i; j++)
-            {
-                skiq_tx_block_free(p_tx_blocks[j]);
-            }
+        fprintf(stderr, "Error: unable to read the Tx resolution (result code %" PRIi32 ")\n",
+                status);
+        return status;
+    }
 
-            free(p_tx_blocks);
-            p_tx_blocks = NULL;
-        }
+    wave_config.sample_rate = sample_rate;
+    wave_config.resolution = resolution;
+    wave_config.q_first = ( iq_order_mode == skiq_iq_order_qi );
+    wave_config.packed = packed;
+    status = tx_waveform_init( &tx_wave, &wave_config );
+    if ( status != 0 )
+    {
+        fprintf(stderr, "Error: invalid %s waveform parameters for a sample rate of %" PRIu32
+                " Hz (result code %" PRIi32 ")\n", p_waveform, sample_rate, status);
+        return status;
+    }
 
-        if (NULL != input_fp)
-        {
-            fclose(input_fp);
-            input_fp = NULL;
-        }
+    nr_blocks = ceil( ( duration * sample_rate ) / samples_per_block );
+    if ( ( nr_blocks < 1.0 ) || ( nr_blocks > UINT32_MAX ) )
+    {
+        fprintf(stderr, "Error: invalid waveform duration %f seconds\n", duration);
+        return -EINVAL;
     }
+    num_blocks = (uint32_t)nr_blocks;
 
-    return status;
+    (void)tx_waveform_select( NULL, &p_kernel );
+    printf("Info: generating %u blocks of %s waveform at %u-bit resolution (%s)\n", num_blocks,
+           p_waveform, resolution, p_kernel);
+
+    return 0;
 }
 
 /*****************************************************************************/
@@ -976,46 +1134,19 @@ int32_t stop_tx_streaming_after_rf_ts( uint8_t card_,
                                        skiq_tx_hdl_t hdl_,
                                        uint64_t rf_ts_ )
 {
+    struct rf_clock clock;
     int32_t status=0;
-    uint64_t curr_ts=0;
-    struct timespec ts;
-    uint64_t num_nanosecs=0;
-    uint32_t num_secs=0;
 
-    if( (status=skiq_read_curr_tx_timestamp(card_, hdl_, &curr_ts)) == 0 )
+    // nothing to schedule, so wait on the clock model directly; if our current
+    // timestamp is already larger than what was requested, the wait returns
+    // immediately and the stream is disabled right away
+    rf_clock_init( &clock, card_, skiq_rx_hdl_A1, sample_rate );
+    clock.use_tx = true;
+    clock.tx_hdl = hdl_;
+    if( (status=rf_clock_sync( &clock )) == 0 )
     {
-        // if our current timestamp is already larger than what was requested,
-        // just disable the stream immediately
-        if( curr_ts < rf_ts_ )
-        {
-            // calculate how long to sleep for before checking our timestamp
-            num_nanosecs = ceil((double)((double)(rf_ts_ - curr_ts) / (double)(sample_rate)) * 1000000000);
-            while (num_nanosecs >= 1000000000)
-            {
-                num_nanosecs -= 1000000000;
-                num_secs++;
-            }
-            ts.tv_sec = num_secs;
-            ts.tv_nsec = (uint32_t)(num_nanosecs);
-            while( (nanosleep(&ts, &ts) == -1) && (running==true) )
-            {
-                if ( (errno == ENOSYS) || (errno == EINVAL) ||
-                     (errno == EFAULT) )
-                {
-                    fprintf(stderr, "Error: catastrophic timer failure (errno"
-                        " %d)!\n", errno);
-                    break;
-                }
-            }
+        (void)rf_clock_wait_until( &clock, rf_ts_, &running );
 
-            skiq_read_curr_tx_timestamp(card_, hdl_, &curr_ts);
-            while( (curr_ts < rf_ts_) && (running==true) )
-            {
-                // just sleep 1 uS and read the timestamp again...we should be close based on the initial sleep calculation
-                usleep(1);
-                skiq_read_curr_tx_timestamp(card_, hdl_, &curr_ts);
-            }
-        }
         printf("Info: Stopping TX streaming\n");
         status = skiq_stop_tx_streaming( card_, hdl_ );
     }
@@ -23,6 +23,9 @@
 #include <sidekiq_api.h>
 #include <arg_parser.h>
 
+#include "tx_block_pool.h"
+#include "tx_waveform.h"
+
 /* https://gcc.gnu.org/onlinedocs/gcc-4.8.5/cpp/Stringification.html */
 #define xstr(s)                         str(s)
 #define str(s)                          #s
@@ -39,6 +42,10 @@
 #   define DEFAULT_TIMESTAMP_VALUE  (100000)
 #endif
 
+#ifndef DEFAULT_POOL_BLOCKS
+#   define DEFAULT_POOL_BLOCKS  (64)
+#endif
+
 #ifndef PYTEST_EVENT
 #   define PYTEST_EVENT  "test Tx handles"
 #endif
@@ -67,6 +74,28 @@ The '--late' option can be used to enable support for transmitting data with\n\
 late timestamps (when using bitfiles that support this feature); this feature\n\
 can be enabled standalone or with the '--timestamp' option.\n\
 \n\
+The file is read into memory once and transmitted through a pool of\n\
+'--pool-blocks' pre-allocated transmit blocks that are recycled as soon as\n\
+their transfer completes.  When every block is in flight, the application\n\
+polls up to '--spin' times for a completion before it sleeps.\n\
+\n\
+Instead of a file, '--waveform' synthesizes the samples of each block just\n\
+before it is queued, for '--duration' seconds (then '--repeat' more\n\
+times, without a phase discontinuity):\n\
+\n\
+    tone   a tone '--wave-frequency' Hz from the LO\n\
+    chirp  a sweep from '--wave-frequency' to '--stop-frequency' Hz every\n\
+           '--sweep-period' seconds\n\
+    pn     a BPSK modulated PN sequence of order '--pn-order' at\n\
+           '--symbol-rate', '--wave-frequency' Hz from the LO\n\
+    bpsk   BPSK frames: a 1010 preamble, the sync word 0x1ACFFC1D and\n\
+           '--frame-bytes' bytes of the PN sequence, then '--frame-gap'\n\
+           samples of silence\n\
+    gfsk   the same frames with GFSK (BT 0.5), '--deviation' Hz peak\n\
+           deviation (a quarter of the symbol rate by default)\n\
+\n\
+All waveforms are scaled to '--amplitude' of full scale.  See tx_waveform.h.\n\
+\n\
 Defaults:\n\
   --attenuation=100\n\
   --block-size=1020\n\
@@ -79,7 +108,13 @@ Defaults:\n\
   --cal-mode=auto\n\
   --force-cal=false\n\
   --threads=4\n\
-  --priority=-1";
+  --priority=-1\n\
+  --pool-blocks=" xstr(DEFAULT_POOL_BLOCKS) "\n\
+  --spin=" xstr(TX_BLOCK_POOL_DEFAULT_SPIN) "\n\
+  --duration=10\n\
+  --amplitude=" xstr(TX_WAVEFORM_DEFAULT_AMPLITUDE) "\n\
+  --pn-order=" xstr(TX_WAVEFORM_DEFAULT_PN_ORDER) "\n\
+  --frame-bytes=" xstr(TX_WAVEFORM_DEFAULT_FRAME_BYTES);
 
 /* variables used for all command line arguments */
 static uint8_t card = UINT8_MAX;
@@ -94,6 +129,15 @@ static bool bandwidth_present = 0;
 static uint64_t timestamp = 0;
 static int32_t repeat = 0;
 static char* p_file_path = NULL;
+static char* p_waveform = NULL;
+static double duration = 10.0;
+static struct tx_waveform_config wave_config =
+{
+    .amplitude = TX_WAVEFORM_DEFAULT_AMPLITUDE,
+    .pn_order = TX_WAVEFORM_DEFAULT_PN_ORDER,
+    .frame_bytes = TX_WAVEFORM_DEFAULT_FRAME_BYTES,
+    .bt = TX_WAVEFORM_DEFAULT_BT,
+};
 static char* p_hdl = "A1";
 static char* p_timestamp_base = DEFAULT_TIMESTAMP_BASE;
 static bool immediate_mode = false;
@@ -108,7 +152,11 @@ static skiq_chan_mode_t chan_mode = skiq_chan_mode_single;
 static skiq_tx_hdl_t hdl = skiq_tx_hdl_A1;
 static skiq_tx_timestamp_base_t timestamp_base = skiq_tx_rf_timestamp;
 static FILE *input_fp = NULL;
-static skiq_tx_block_t **p_tx_blocks = NULL; /* reference to an array of transmit block references */
+static uint32_t *p_file_data = NULL; /* contents of the file, padded to a whole number of blocks */
+static struct tx_block_pool tx_pool; /* transmit blocks recycled by the completion callback */
+static struct tx_waveform tx_wave = TX_WAVEFORM_INITIALIZER; /* fills the blocks with --waveform */
+static uint32_t pool_blocks = DEFAULT_POOL_BLOCKS;
+static uint32_t spin_count = TX_BLOCK_POOL_DEFAULT_SPIN;
 static uint8_t mult_factor = 1;
 static uint32_t num_blocks = 0;
 static bool running = true;
@@ -118,14 +166,6 @@ static char *p_cal_mode = "auto";
 static skiq_tx_quadcal_mode_t cal_mode = skiq_tx_quadcal_mode_auto;
 static bool force_cal = false;
 static char* p_rfic_file_path = NULL;
-static uint32_t complete_count=0;    // counter for number of packets completed
-int32_t *p_tx_status = NULL;
-
-// mutex to protect updates to the tx buffer
-pthread_mutex_t tx_buf_mutex = PTHREAD_MUTEX_INITIALIZER;
-// mutex and condition variable to signal when the tx queue may have room available
-pthread_mutex_t space_avail_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t space_avail_cond = PTHREAD_COND_INITIALIZER;
 
 
 /* the command line arguments available to this application */
@@ -186,12 +226,78 @@ static struct application_argument p_args[] =
                 "N",
                 &repeat,
                 INT32_VAR_TYPE),
-    APP_ARG_REQ("source",
+    APP_ARG_OPT("source",
                 's',
                 "Input file to source for I/Q data",
                 "PATH",
                 &p_file_path,
                 STRING_VAR_TYPE),
+    APP_ARG_OPT("waveform",
+                'w',
+                "Generate tone, chirp, pn, bpsk or gfsk instead of reading --source",
+                "TYPE",
+                &p_waveform,
+                STRING_VAR_TYPE),
+    APP_ARG_OPT("duration",
+                0,
+                "Seconds of --waveform to transmit",
+                "SECONDS",
+                &duration,
+                DOUBLE_VAR_TYPE),
+    APP_ARG_OPT("wave-frequency",
+                0,
+                "Tone, chirp start or carrier offset from the LO",
+                "Hz",
+                &(wave_config.frequency),
+                DOUBLE_VAR_TYPE),
+    APP_ARG_OPT("stop-frequency",
+                0,
+                "Chirp end offset from the LO",
+                "Hz",
+                &(wave_config.stop_frequency),
+                DOUBLE_VAR_TYPE),
+    APP_ARG_OPT("sweep-period",
+                0,
+                "Duration of each chirp sweep",
+                "SECONDS",
+                &(wave_config.sweep_period),
+                DOUBLE_VAR_TYPE),
+    APP_ARG_OPT("symbol-rate",
+                0,
+                "Symbol rate of pn, bpsk and gfsk",
+                "Hz",
+                &(wave_config.symbol_rate),
+                DOUBLE_VAR_TYPE),
+    APP_ARG_OPT("deviation",
+                0,
+                "Peak frequency deviation of gfsk",
+                "Hz",
+                &(wave_config.deviation),
+                DOUBLE_VAR_TYPE),
+    APP_ARG_OPT("pn-order",
+                0,
+                "PN sequence order (7, 9, 15, 23 or 31)",
+                "N",
+                &(wave_config.pn_order),
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("frame-bytes",
+                0,
+                "Payload bytes of each bpsk or gfsk frame",
+                "N",
+                &(wave_config.frame_bytes),
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("frame-gap",
+                0,
+                "Samples of silence after each bpsk or gfsk frame",
+                "N",
+                &(wave_config.frame_gap),
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("amplitude",
+                0,
+                "Amplitude of --waveform as a fraction of full scale",
+                "FRACTION",
+                &(wave_config.amplitude),
+                DOUBLE_VAR_TYPE),
     APP_ARG_OPT("serial",
                 'S',
                 "Specify Sidekiq by serial number",
@@ -258,6 +364,18 @@ static struct application_argument p_args[] =
                 "p",
                 &priority,
                 INT32_VAR_TYPE),
+    APP_ARG_OPT("pool-blocks",
+                0,
+                "Number of transmit blocks to recycle",
+                "N",
+                &pool_blocks,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("spin",
+                0,
+                "Number of polls for a completed block before sleeping",
+                "N",
+                &spin_count,
+                UINT32_VAR_TYPE),
     APP_ARG_OPT("pytest",
                 0,
                 "Pytest Tx handles",
@@ -270,6 +388,8 @@ static struct application_argument p_args[] =
 
 /* local functions */
 static int32_t init_tx_buffer(void);
+static void fill_tx_block( skiq_tx_block_t *p_block, uint32_t block_num );
+static int32_t init_tx_waveform( uint32_t samples_per_block );
 
 /*****************************************************************************/
 /** This is the cleanup handler to ensure that the app properly exits and
@@ -287,39 +407,29 @@ void app_cleanup(int signum)
 /*****************************************************************************/
 /** This is the callback function for once the data has completed being sent.
     There is no guarantee that the complete callback will be in the order that
-    the data was sent, this function just increments the completion count and
-    signals the main thread that there is space available to send more packets.
+    the data was sent, this function just returns the block to the pool, which
+    also counts the completion and wakes the main thread if it is waiting for a
+    free block.  No locks are taken unless the main thread is asleep.
 
     @param status status of the transmit packet completed
     @param p_block reference to the completed transmit block
-    @param p_user reference to the user data
+    @param p_user reference to the pool entry of the block
     @return void
 */
 void tx_complete( int32_t status, skiq_tx_block_t *p_data, void *p_user )
 {
+    (void)p_data;
+
     if( status != 0 )
     {
-        fprintf(stderr, "Error: packet %" PRIu32 " failed with status %d\n",
-                complete_count, status);
+        fprintf(stderr, "Error: packet %" PRIu64 " failed with status %d\n",
+                tx_block_pool_completed( &tx_pool ), status);
     }
 
-    // increment the packet completed count
-    complete_count++;
-
-    pthread_mutex_lock( &tx_buf_mutex );
-    // update the in use status of the packet just completed
     if (p_user)
     {
-        *(int32_t*)p_user = 0;
+        tx_block_pool_put( &tx_pool, (struct tx_pool_entry *)p_user );
     }
-     pthread_mutex_unlock( &tx_buf_mutex );
-
-    // signal to the other thread that there may be space available now that a
-    // packet send has completed
-    pthread_mutex_lock( &space_avail_mutex );
-    pthread_cond_signal(&space_avail_cond);
-    pthread_mutex_unlock( &space_avail_mutex );
-
 }
 
 
@@ -347,7 +457,10 @@ int main( int argc, char *argv[])
     pid_t owner = 0;
     bool skiq_initialized = false;
     FILE *p_rfic_file = NULL;
-    uint32_t send_count = 0;
+    uint64_t send_count = 0;
+    struct tx_pool_entry *p_entry = NULL;
+
+    tx_pool = TX_BLOCK_POOL_INITIALIZER;
 
     /* always install a handler for proper cleanup */
     signal(SIGINT, app_cleanup);
@@ -369,6 +482,20 @@ int main( int argc, char *argv[])
                 "use tx_samples if skiq_tx_transfer_mode_sync is desired.\n");
     }
 
+    if( (NULL == p_file_path) == (NULL == p_waveform) )
+    {
+        fprintf(stderr, "Error: specify EITHER --source or --waveform\n");
+        status = -1;
+        goto cleanup;
+    }
+    if( (NULL != p_waveform) &&
+        (tx_waveform_parse(p_waveform, &(wave_config.type)) != 0) )
+    {
+        fprintf(stderr, "Error: invalid waveform '%s'\n", p_waveform);
+        status = -1;
+        goto cleanup;
+    }
+
     if ( (0 != timestamp) && (false != immediate_mode) )
     {
         fprintf(stderr, "Error: cannot set both timestamp and immediate"
@@ -503,13 +630,17 @@ int main( int argc, char *argv[])
         bandwidth = sample_rate;
     }
 
-    errno = 0;
-    input_fp = fopen(p_file_path, "rb");
-    if( input_fp == NULL )
+    if( p_file_path != NULL )
     {
-        fprintf(stderr, "Error: unable to open input file %s, errno %d\n", p_file_path, errno);
-        status = errno;
-        goto cleanup;
+        errno = 0;
+        input_fp = fopen(p_file_path, "rb");
+        if( input_fp == NULL )
+        {
+            fprintf(stderr, "Error: unable to open input file %s, errno %d\n", p_file_path,
+                    errno);
+            status = errno;
+            goto cleanup;
+        }
     }
 
     // initialize the transmit buffer
@@ -825,6 +956,15 @@ int main( int argc, char *argv[])
         timestamp_increment = block_size_in_words;
     }
 
+    if( p_waveform != NULL )
+    {
+        status = init_tx_waveform( timestamp_increment );
+        if( status != 0 )
+        {
+            goto cleanup;
+        }
+    }
+
     if(( tx_mode == skiq_tx_with_timestamps_data_flow_mode ) ||
        ( tx_mode == skiq_tx_with_timestamps_allow_late_data_flow_mode ))
     {
@@ -911,51 +1051,45 @@ int main( int argc, char *argv[])
         // transmit a block at a time
         while( (curr_block < num_blocks) && (running==true) )
         {
-            // need to make sure that we don't update the timestamp of a packet
-            // that is already in use
-            pthread_mutex_lock( &tx_buf_mutex );
-            if( p_tx_status[curr_block] == 0 )
-            {
-                p_tx_status[curr_block] = 1;
-            }
-            else
+            // read the completion count first so that a block freed after the
+            // attempts below is never missed by the wait
+            uint64_t completed = tx_block_pool_completed( &tx_pool );
+
+            // take a free block from the pool (unless one is still held from a
+            // previous attempt that found the send queue full) and fill it
+            if( p_entry == NULL )
             {
-                pthread_mutex_unlock( &tx_buf_mutex );
-                pthread_mutex_lock( &space_avail_mutex );
-                // wait for a packet to complete
-                pthread_cond_wait( &space_avail_cond, &space_avail_mutex );
-                pthread_mutex_unlock( &space_avail_mutex );
-                continue;
+                p_entry = tx_block_pool_get( &tx_pool );
+                if( p_entry == NULL )
+                {
+                    // every block is in flight, wait for one to complete
+                    tx_block_pool_wait( &tx_pool, completed, &running );
+                    continue;
+                }
+                fill_tx_block( p_entry->p_block, curr_block );
+                skiq_tx_set_block_timestamp( p_entry->p_block, timestamp );
             }
-            pthread_mutex_unlock( &tx_buf_mutex );
-
-            skiq_tx_set_block_timestamp( p_tx_blocks[curr_block], timestamp );
 
             // transmit the data
-            status = skiq_transmit(card, hdl, p_tx_blocks[curr_block], &(p_tx_status[curr_block]));
+            status = skiq_transmit(card, hdl, p_entry->p_block, p_entry);
             if( status == SKIQ_TX_ASYNC_SEND_QUEUE_FULL )
             {
-                // update the in use status since we didn't actually send it yet
-                pthread_mutex_lock( &tx_buf_mutex );
-                p_tx_status[curr_block] = 0;
-                pthread_mutex_unlock( &tx_buf_mutex );
-
-                // if there's no space left to send, wait until there should be space available
-                if( running == true )
-                {
-                    pthread_mutex_lock( &space_avail_mutex );
-                    pthread_cond_wait( &space_avail_cond, &space_avail_mutex );    
-                        pthread_mutex_unlock( &space_avail_mutex );
-                }
+                // if there's no space left to send, hold on to the block and
+                // wait until there should be space available
+                status = 0;
+                tx_block_pool_wait( &tx_pool, completed, &running );
             }
             else if ( status != 0 )
             {
                 fprintf(stderr, "Error: skiq_transmit encountered an error."
                 " (status = %" PRIi32 ")\n", status);
+                tx_block_pool_unget( &tx_pool, p_entry );
+                p_entry = NULL;
                 goto cleanup;
             }
             else
             {
+                p_entry = NULL;
                 curr_block++;
                 // update the timestamp
                 timestamp += timestamp_increment;
@@ -965,7 +1099,8 @@ int main( int argc, char *argv[])
 
         if( repeat > 0 )
         {
-            printf("Info: transmitting the file %u more times\n", repeat);
+            printf("Info: transmitting the %s %u more times\n",
+                   (p_waveform != NULL) ? "waveform" : "file", repeat);
         }
         else
         {
@@ -989,13 +1124,20 @@ int main( int argc, char *argv[])
 
     // wait until we've finished transmitting
     printf("waiting for done...");
-    while( (send_count != complete_count) && (running==true) )
+    while( running==true )
     {
-        pthread_mutex_lock( &space_avail_mutex );
-        pthread_cond_wait( &space_avail_cond, &space_avail_mutex );
-        pthread_mutex_unlock( &space_avail_mutex );
+        uint64_t completed = tx_block_pool_completed( &tx_pool );
+        if( completed == send_count )
+        {
+            break;
+        }
+        tx_block_pool_wait( &tx_pool, completed, &running );
     }
     printf("done\n");
+    printf("Info: at most %" PRIu32 " of %" PRIu32 " blocks in flight, waited for a free"
+           " block %" PRIu64 " time(s) while polling and %" PRIu64 " time(s) asleep\n",
+           tx_pool.max_in_flight, tx_pool.nr_blocks, tx_pool.nr_spin_waits,
+           tx_pool.nr_parks);
     
 cleanup:
     // disable streaming, cleanup and shutdown
@@ -1003,50 +1145,48 @@ cleanup:
     {
         skiq_stop_tx_streaming(card, hdl);
 
-        if (NULL != p_tx_blocks)
-        {
-            /* cleanup the memory alloc'ed */
-            for( curr_block=0; curr_block<num_blocks; curr_block++ )
-            {
-                skiq_tx_block_free( p_tx_blocks[curr_block] );
-            }
-            free( p_tx_blocks );
-            p_tx_blocks = NULL;
-        }
-
         skiq_exit();
         skiq_initialized = false;
     }
 
+    /* the transmit threads have stopped, so no block can still be in flight */
+    tx_block_pool_free( &tx_pool );
+    tx_waveform_free( &tx_wave );
+
     if (NULL != input_fp)
     {
         fclose(input_fp);
         input_fp = NULL;
     }
 
-    if (NULL != p_tx_status)
+    if (NULL != p_file_data)
     {
-        free(p_tx_status);
-        p_tx_status = NULL;
+        free(p_file_data);
+        p_file_data = NULL;
     }
 
     return (int) status;
 }
 
 /*****************************************************************************/
-/** This function reads the contents of the file into p_tx_buf
+/** This function reads the contents of the file into p_file_data (unless
+    the blocks are generated with --waveform) and allocates the pool of
+    transmit blocks used to send it
 
     @param none
-    @return: void
+    @return: 0 on success, else -1
 */
 static int32_t init_tx_buffer(void)
 {
     int32_t status = 0;
     uint32_t num_bytes_in_file=0;
-    // we need enough room for # blocks + header + 1 word for status info
-    int32_t num_bytes_read=1;
-    uint32_t i=0;
-    uint32_t j = 0;
+    uint32_t block_size_in_bytes = block_size_in_words * 4;
+
+    if( p_waveform != NULL )
+    {
+        /* the blocks are generated as they are queued, see init_tx_waveform() */
+        goto allocate_pool;
+    }
 
     // determine how large the file is and how many blocks we'll need to send
     fseek(input_fp, 0, SEEK_END);
@@ -1060,87 +1200,58 @@ static int32_t init_tx_buffer(void)
     }
     printf("Info: %u blocks contained in the file\n", num_blocks);
 
-    // allocate for # blocks
-    p_tx_blocks = calloc( num_blocks, sizeof( skiq_tx_block_t * ));
-    if( p_tx_blocks == NULL )
+    // allocate for # blocks, the last block is zero padded
+    p_file_data = calloc( num_blocks, block_size_in_bytes );
+    if( p_file_data == NULL )
     {
-        fprintf(stderr, "Error: failed to allocate memory for TX blocks.\n");
+        fprintf(stderr, "Error: failed to allocate memory for the file contents.\n");
         status = -1;
         goto finished;
     }
 
-    // allocate for # blocks
-    p_tx_status = calloc( num_blocks, sizeof(*p_tx_status) );
-    if( p_tx_status == NULL )
+    // read in the contents of the file
+    if( fread( p_file_data, 1, num_bytes_in_file, input_fp ) != num_bytes_in_file )
     {
-        fprintf(stderr, "Error: failed to allocate memory for TX status.\n");
+        fprintf(stderr, "Error: unable to read the contents of the input file\n");
         status = -1;
         goto finished;
     }
 
-    // read in the contents of the file
-    for (i = 0; i < num_blocks; i++)
+    // there is no need for more transmit blocks than there are blocks in the file
+    if( pool_blocks > num_blocks )
     {
-        if ( !feof(input_fp) && (num_bytes_read>0) )
-        {
-            // allocate the memory for this block
-            if ( chan_mode == skiq_chan_mode_dual )
-            {
-                /* for a dual channel mode, allocate a transmit block by doubling
-                 * the number of words */
-                p_tx_blocks[i] = skiq_tx_block_allocate( 2 * block_size_in_words );
-            }
-            else
-            {
-                /* allocate a transmit block by number of words */
-                p_tx_blocks[i] = skiq_tx_block_allocate( block_size_in_words );
-            }
-
-            if( p_tx_blocks[i] == NULL )
-            {
-                fprintf(stderr, "Error: unable to allocate a transmit block\n");
-                status = -1;
-                goto finished;
-            }
+        pool_blocks = num_blocks;
+    }
 
-            // read another block of samples
-            num_bytes_read=fread( p_tx_blocks[i]->data, sizeof(int32_t), block_size_in_words, input_fp );
-            if ( chan_mode == skiq_chan_mode_dual )
-            {
-                /* duplicate the block of samples into the second half of the
-                 * transmit block's data array */
-                memcpy( &(p_tx_blocks[i]->data[block_size_in_words*2]),
-                        p_tx_blocks[i]->data, block_size_in_words * 4 );
-                /* populate zeros into A1 buffer on dual-channel mode for pytest: test tx handles */
-                if( test_tx_handles )
-                {
-                    memset( &(p_tx_blocks[i]->data), 0, block_size_in_words * 4 );
-                }
-            }
+allocate_pool:
+    if( pool_blocks < 1 )
+    {
+        pool_blocks = 1;
+    }
 
-            // mark packet as not in use
-            p_tx_status[i] = 0;
-        }
+    /* for a dual channel mode, each transmit block holds the samples twice */
+    if ( chan_mode == skiq_chan_mode_dual )
+    {
+        block_size_in_bytes *= 2;
+    }
+    if( tx_block_pool_init( &tx_pool, pool_blocks, block_size_in_bytes, spin_count ) != 0 )
+    {
+        fprintf(stderr, "Error: unable to allocate %" PRIu32 " transmit blocks\n",
+                pool_blocks);
+        status = -1;
+        goto finished;
     }
+    printf("Info: transmitting through a pool of %" PRIu32 " blocks\n", pool_blocks);
 
 finished:
     if (0 != status)
     {
-        if (NULL != p_tx_blocks)
-        {
-            for (j = 0; j < i; j++)
-            {
-                skiq_tx_block_free(p_tx_blocks[j]);
-            }
+        tx_block_pool_free( &tx_pool );
 
-            free(p_tx_blocks);
-            p_tx_blocks = NULL;
-        }
-
-        if (NULL != p_tx_status)
+        if (NULL != p_file_data)
         {
-            free(p_tx_status);
-            p_tx_status = NULL;
+            free(p_file_data);
+            p_file_data = NULL;
         }
 
         if (NULL != input_fp)
@@ -1151,3 +1262,86 @@ finished:
     }
     return status;
 }
+
+/*****************************************************************************/
+/** This function copies a block of the file, or the next block of the
+    waveform, into a transmit block taken from the pool
+
+    @param p_block: the transmit block to fill
+    @param block_num: the index of the block within the file
+    @return: void
+*/
+static void fill_tx_block( skiq_tx_block_t *p_block, uint32_t block_num )
+{
+    const uint32_t *p_src = (const uint32_t *)p_block->data;
+
+    if ( p_waveform != NULL )
+    {
+        tx_waveform_fill( &tx_wave, (uint32_t *)p_block->data, block_size_in_words );
+    }
+    else
+    {
+        p_src = &(p_file_data[(size_t)block_num * block_size_in_words]);
+        memcpy( p_block->data, p_src, block_size_in_words * 4 );
+    }
+    if ( chan_mode == skiq_chan_mode_dual )
+    {
+        /* duplicate the block of samples into the second half of the
+         * transmit block's data array */
+        memcpy( &(p_block->data[block_size_in_words*2]), p_src, block_size_in_words * 4 );
+        /* populate zeros into A1 buffer on dual-channel mode for pytest: test tx handles */
+        if( test_tx_handles )
+        {
+            memset( p_block->data, 0, block_size_in_words * 4 );
+        }
+    }
+}
+
+/*****************************************************************************/
+/** This function sets up the waveform generator once the card is configured,
+    and sets the number of blocks that make up '--duration' seconds.
+
+    @param samples_per_block: the number of samples in each transmit block
+    @return: 0 on success, else a negative errno
+*/
+static int32_t init_tx_waveform( uint32_t samples_per_block )
+{
+    const char *p_kernel = NULL;
+    uint8_t resolution = 0;
+    double nr_blocks;
+    int32_t status;
+
+    status = skiq_read_tx_iq_resolution( card, &resolution );
+    if ( status != 0 )
+    {
+        fprintf(stderr, "Error: unable to read the Tx resolution (result code %" PRIi32 ")\n",
+                status);
+        return status;
+    }
+
+    wave_config.sample_rate = sample_rate;
+    wave_config.resolution = resolution;
+    wave_config.q_first = ( iq_order_mode == skiq_iq_order_qi );
+    wave_config.packed = packed;
+    status = tx_waveform_init( &tx_wave, &wave_config );
+    if ( status != 0 )
+    {
+        fprintf(stderr, "Error: invalid %s waveform parameters for a sample rate of %" PRIu32
+                " Hz (result code %" PRIi32 ")\n", p_waveform, sample_rate, status);
+        return status;
+    }
+
+    nr_blocks = ceil( ( duration * sample_rate ) / samples_per_block );
+    if ( ( nr_blocks < 1.0 ) || ( nr_blocks > UINT32_MAX ) )
+    {
+        fprintf(stderr, "Error: invalid waveform duration %f seconds\n", duration);
+        return -EINVAL;
+    }
+    num_blocks = (uint32_t)nr_blocks;
+
+    (void)tx_waveform_select( NULL, &p_kernel );
+    printf("Info: generating %u blocks of %s waveform at %u-bit resolution (%s)\n", num_blocks,
+           p_waveform, resolution, p_kernel);
+
+    return 0;
+}
@@ -43,6 +43,8 @@
 #include "sidekiq_api.h"
 #include "arg_parser.h"
 
+#include "tx_ram_loader.h"
+
 /* The user register addresses in the FPGA design for the TX RAM block and its size.  It is not
  * always available depending on whether or not the user built the design with the feature
  * enabled. */
@@ -103,6 +105,10 @@ signed twos-complement little-endian I/Q samples formatted as follows:\n\
 \n\
     <16-bit Q0> <16-bit I0> <16-bit Q1> <16-bit I1> ... etc\n\
 \n\
+A transmit RAM that already holds the same samples from an earlier run (with\n\
+the same FPGA bitstream and without a reprogramming since) is not loaded\n\
+again unless --force-load is given.\n\
+\n\
 Defaults:\n\
   --attenuation=" xstr(DEFAULT_ATTENUATION) "\n\
   --card=" xstr(DEFAULT_CARD_NUMBER) "\n\
@@ -111,7 +117,8 @@ Defaults:\n\
   --rate=" xstr(DEFAULT_SAMPLE_RATE) "\n\
   --time=" xstr(DEFAULT_DURATION) "\n\
   --cal-mode=auto\n\
-  --force-cal=false";
+  --force-cal=false\n\
+  --force-load=false";
 
 /* variables used for all command line arguments */
 static uint8_t card = UINT8_MAX;
@@ -132,6 +139,8 @@ static uint32_t sample_buffer[skiq_tx_hdl_end][MAX_TX_RAM_NUM_SAMPLES];
 static char *p_cal_mode = "auto";
 static skiq_tx_quadcal_mode_t cal_mode = skiq_tx_quadcal_mode_auto;
 static bool force_cal = false;
+static bool force_load = false;
+static struct tx_ram_loader tx_ram = TX_RAM_LOADER_INITIALIZER;
 static char* p_rfic_file_path = NULL;
 
 /* the command line arguments available to this application */
@@ -209,6 +218,12 @@ static struct application_argument p_args[] =
                 NULL,
                 &force_cal,
                 BOOL_VAR_TYPE),
+    APP_ARG_OPT("force-load",
+                0,
+                "Load the transmit RAM even if it already holds the samples",
+                NULL,
+                &force_load,
+                BOOL_VAR_TYPE),
     APP_ARG_OPT("rfic-config",
                 0,
                 "Input filename of RFIC configuration",
@@ -302,16 +317,13 @@ write_tx_ram_block( skiq_tx_hdl_t tx_hdl,
 
     if ( status == 0 )
     {
-        uint32_t i, loop_size = (uint32_t)nr_samples - 1;
+        uint32_t loop_size = (uint32_t)nr_samples - 1;
 
         /* specify with MACRO which TX FIFO to populate */
         loop_size |= FPGA_USER_REG_TX_MEM_LOOP_SIZE_FIFO_(fifo_index);
 
-        status = skiq_write_user_fpga_reg( card, FPGA_USER_REG_TX_MEM_LOOP_SIZE, loop_size );
-        for ( i = 0; ( i < nr_samples ) && ( status == 0 ); i++ )
-        {
-            status = skiq_write_user_fpga_reg( card, FPGA_USER_REG_TX_MEM_DATA, samples[i] );
-        }
+        status = tx_ram_loader_load( &tx_ram, fifo_index, FPGA_USER_REG_TX_MEM_LOOP_SIZE,
+                                     loop_size, FPGA_USER_REG_TX_MEM_DATA, samples, nr_samples );
     }
 
     return status;
@@ -358,47 +370,35 @@ write_tx_ram_block_dual_lane( skiq_tx_hdl_t tx_hdl,
 
     if ( status == 0 )
     {
-        uint32_t k, loop_size;
-
-        /* first the I part of the sample */
-        loop_size = ((uint32_t)nr_samples) / 2 - 1;
-        loop_size |= FPGA_USER_REG_TX_MEM_LOOP_SIZE_FIFO_(i_fifo_index);
+        static uint32_t i_words[MAX_TX_RAM_NUM_SAMPLES / 2], q_words[MAX_TX_RAM_NUM_SAMPLES / 2];
+        uint32_t k, nr_words = ((uint32_t)nr_samples) / 2;
 
-        status = skiq_write_user_fpga_reg( card, FPGA_USER_REG_TX_MEM_LOOP_SIZE, loop_size );
-        for ( k = 0; ( k < nr_samples ) && ( status == 0 ); k += 2 )
+        /* split the samples up front so that each FIFO is loaded in one burst */
+        for ( k = 0; k + 1 < nr_samples; k += 2 )
         {
-            uint32_t i_sample = 0;
-            uint16_t i_0, i_1;
+            uint16_t i_0, i_1, q_0, q_1;
 
-            /* take two 16-bit I parts and write them to the memory */
+            /* take two 16-bit I parts and two 16-bit Q parts */
             i_0 = ((samples[k]   >> 16) & 0xFFFF);
             i_1 = ((samples[k+1] >> 16) & 0xFFFF);
+            q_0 = ((samples[k]   >> 0) & 0xFFFF);
+            q_1 = ((samples[k+1] >> 0) & 0xFFFF);
 
-            i_sample = (i_0 << 16) | i_1;
-            status = skiq_write_user_fpga_reg( card, FPGA_USER_REG_TX_MEM_DATA, i_sample );
+            i_words[k / 2] = ((uint32_t)i_0 << 16) | i_1;
+            q_words[k / 2] = ((uint32_t)q_0 << 16) | q_1;
         }
-    }
 
-    if ( status == 0 )
-    {
-        uint32_t k, loop_size;
-
-        /* then the Q part of the sample */
-        loop_size = ((uint32_t)nr_samples) / 2 - 1;
-        loop_size |= FPGA_USER_REG_TX_MEM_LOOP_SIZE_FIFO_(q_fifo_index);
-
-        status = skiq_write_user_fpga_reg( card, FPGA_USER_REG_TX_MEM_LOOP_SIZE, loop_size );
-        for ( k = 0; ( k < nr_samples ) && ( status == 0 ); k += 2 )
+        /* first the I part of the sample, then the Q part */
+        status = tx_ram_loader_load( &tx_ram, i_fifo_index, FPGA_USER_REG_TX_MEM_LOOP_SIZE,
+                                     ( nr_words - 1 ) |
+                                     FPGA_USER_REG_TX_MEM_LOOP_SIZE_FIFO_(i_fifo_index),
+                                     FPGA_USER_REG_TX_MEM_DATA, i_words, nr_words );
+        if ( status == 0 )
         {
-            uint32_t q_sample = 0;
-            uint16_t q_0, q_1;
-
-            /* take two 16-bit Q parts and write them to the memory */
-            q_0 = ((samples[k]   >> 0) & 0xFFFF);
-            q_1 = ((samples[k+1] >> 0) & 0xFFFF);
-
-            q_sample = (q_0 << 16) | q_1;
-            status = skiq_write_user_fpga_reg( card, FPGA_USER_REG_TX_MEM_DATA, q_sample );
+            status = tx_ram_loader_load( &tx_ram, q_fifo_index, FPGA_USER_REG_TX_MEM_LOOP_SIZE,
+                                         ( nr_words - 1 ) |
+                                         FPGA_USER_REG_TX_MEM_LOOP_SIZE_FIFO_(q_fifo_index),
+                                         FPGA_USER_REG_TX_MEM_DATA, q_words, nr_words );
         }
     }
 
@@ -1015,13 +1015,20 @@ int main( int argc, char *argv[])
     printf("Info: block size set to %u words\n", block_size_in_words);
 
     // initialize the transmit buffer
-    status = init_tx_buffers( handles, nr_handles, input_fp );
+    status = tx_ram_loader_init( &tx_ram, card, force_load );
+    if ( 0 == status )
+    {
+        status = init_tx_buffers( handles, nr_handles, input_fp );
+    }
     if ( 0 != status )
     {
         fprintf(stderr, "Error: initializing the transmit RAM failed\n");
         status = -1;
         goto cleanup;
     }
+    printf("Info: loaded %" PRIu32 " transmit RAM(s) (%" PRIu64 " words%s), %" PRIu32
+           " already held the samples\n", tx_ram.nr_loaded, tx_ram.nr_words,
+           tx_ram.burst ? " in bursts" : "", tx_ram.nr_skipped);
 
     status = enable_stream_from_tx_ram_block();
     if ( 0 != status )
@@ -21,6 +21,8 @@
 #include <inttypes.h>
 
 #include "arg_parser.h"
+#include "rf_scheduler.h"
+#include "tx_burst_queue.h"
 
 pthread_t ctrl_thread[SKIQ_MAX_NUM_CARDS];     // thread responsible for starting/stopping on 1PPS
 pthread_t transmit_thread[SKIQ_MAX_NUM_CARDS]; // thread responsible for transmitting data
@@ -52,6 +54,7 @@ static uint32_t sample_rate = 1000000;
 static uint32_t bandwidth = 0;
 static uint32_t block_size_in_words = 1020;
 static uint32_t duration = 5;
+static uint32_t lead_time = 0;
 static bool packed = false;
 static char* p_pps_source = NULL;
 static skiq_1pps_source_t pps_source = skiq_1pps_source_unavailable;
@@ -71,6 +74,7 @@ static void tx_enabled_callback(uint8_t card, int32_t status);
 static int32_t init_tx_buffer(void);
 
 static void* transmit_card( void *data );
+static void* transmit_card_timed( uint8_t card, uint32_t timestamp_increment );
 void* ctrl_card( void *data );
 
 /* these are used to provide help strings for the application when running it
@@ -99,11 +103,18 @@ static const char* p_help_long =
            ------------------------------------------------------------\n\n\
    Each I/Q sample is little-endian, twos-complement, signed, and sign-extended\n\
    from 12-bits to 16-bits.\n\n\
+   By default the blocks are transmitted as soon as the FPGA accepts them.  With\n\
+   --lead-time each pass through the file is instead queued as a burst at the\n\
+   timestamp following the previous one, and handed to the radio that many\n\
+   milliseconds ahead of its timestamp.  Passes that can no longer make their\n\
+   slot are dropped instead of being sent late, and the late timestamps and\n\
+   underruns of every pass are reported when the cards stop.\n\
 \n\
 Defaults:\n\
   --attenuation=100\n\
   --block-size=1020\n\
   --frequency=850000000\n\
+  --lead-time=0 (immediate)\n\
   --rate=1000000\n\
   --time=5";
 
@@ -140,6 +151,12 @@ static struct application_argument p_args[] =
                 "Hz",
                 &freq_offset,
                 UINT64_VAR_TYPE),
+    APP_ARG_OPT("lead-time",
+                0,
+                "Transmit timestamped bursts this far ahead of their timestamp",
+                "MS",
+                &lead_time,
+                UINT32_VAR_TYPE),
     APP_ARG_OPT("rate",
                 'r',
                 "Sample rate in Hertz",
@@ -325,6 +342,10 @@ void* transmit_card( void *data )
     }
     printf("Timestamp increment is %u\n", timestamp_increment);
 
+    if( lead_time > 0 )
+    {
+        return transmit_card_timed( card, timestamp_increment );
+    }
 
     // replay the file until the stream is completed
     while( (stream_complete[card] == false) && (running==true) )
@@ -356,6 +377,95 @@ void* transmit_card( void *data )
     return (NULL);
 }
 
+/*****************************************************************************/
+/** Transmit the file for a specific card as back to back timestamped bursts, one per pass
+    through the file, queued ahead of time and submitted lead_time ms before their timestamp.
+
+    @param card Sidekiq card this thread is using
+    @param timestamp_increment timestamp increment between blocks
+    @return void*-indicating status
+*/
+static void* transmit_card_timed( uint8_t card, uint32_t timestamp_increment )
+{
+    struct rf_sched sched = RF_SCHED_INITIALIZER;
+    struct tx_burst_queue queue = TX_BURST_QUEUE_INITIALIZER;
+    struct tx_burst bursts[2];
+    uint64_t next_timestamp = 0;
+    uint64_t nr_bursts = 0;
+    int32_t status = 0;
+
+    // wait for TX to be enabled
+    printf("Waiting for TX to be enabled for card %u\n", card);
+    pthread_mutex_lock( &tx_enabled_mutex[card] );
+    pthread_cond_wait( &tx_enabled[card], &tx_enabled_mutex[card] );
+    pthread_mutex_unlock( &tx_enabled_mutex[card] );
+
+    status = rf_sched_init_tx( &sched, card, skiq_tx_hdl_A1, sample_rate );
+    if( status == 0 )
+    {
+        status = tx_burst_queue_start( &queue, card, skiq_tx_hdl_A1, &sched,
+                                       (int64_t)lead_time * 1000 * 1000, 0 );
+    }
+    if( status != 0 )
+    {
+        fprintf(stderr, "Error: unable to start the burst queue for card %u (result code %"
+                PRIi32 ")\n", card, status);
+        tx_burst_queue_stop( &queue );
+        rf_sched_exit( &sched );
+        return (NULL);
+    }
+
+    // the first pass starts one lead time from now, the following ones right after it; two
+    // passes are kept queued, the blocks are only restamped once the earlier pass was submitted
+    next_timestamp = rf_sched_rf_now( &sched ) +
+        ( ( (uint64_t)lead_time * sample_rate ) / 1000 );
+    printf("Info: transmitting the file for card %u from timestamp %" PRIu64 "\n", card,
+           next_timestamp);
+    while( (stream_complete[card] == false) && (running==true) && (status == 0) )
+    {
+        struct tx_burst *p_burst = &(bursts[nr_bursts % 2]);
+
+        if( nr_bursts >= 2 )
+        {
+            enum tx_burst_state state = tx_burst_queue_wait( &queue, p_burst );
+
+            if( state == tx_burst_failed )
+            {
+                fprintf(stderr, "Error: failed to transmit on card %u (result code %"
+                        PRIi32 ")\n", card, p_burst->result);
+                break;
+            }
+            else if( state != tx_burst_sent )
+            {
+                fprintf(stderr, "Warning: pass %" PRIu64 " %s on card %u (margin %" PRIi64
+                        " samples)\n", p_burst->id, tx_burst_state_cstr(state), card,
+                        p_burst->margin);
+            }
+            else if( (p_burst->nr_late > 0) || (p_burst->nr_underruns > 0) )
+            {
+                fprintf(stderr, "Warning: pass %" PRIu64 " on card %u had %" PRIu32
+                        " late timestamps and %" PRIu32 " underruns\n", p_burst->id, card,
+                        p_burst->nr_late, p_burst->nr_underruns);
+            }
+        }
+
+        *p_burst = TX_BURST_INITIALIZER;
+        p_burst->rf_ts = next_timestamp;
+        p_burst->pp_blocks = p_tx_blocks;
+        p_burst->nr_blocks = num_blocks;
+        p_burst->samples_per_block = timestamp_increment;
+        status = tx_burst_queue_submit( &queue, p_burst );
+        next_timestamp += (uint64_t)num_blocks * timestamp_increment;
+        nr_bursts++;
+    }
+
+    tx_burst_queue_stop( &queue );
+    tx_burst_queue_print_stats( &queue, stdout );
+    rf_sched_exit( &sched );
+
+    return (NULL);
+}
+
 /*****************************************************************************/
 /** This is the main funciton for the thread responsible for starting and
     stopping streaming on the 1PPS edge.
@@ -586,6 +696,7 @@ int main( int argc, char *argv[])
             goto cleanup;
         }
         status = skiq_write_tx_data_flow_mode(card, skiq_tx_hdl_A1,
+                    (lead_time > 0) ? skiq_tx_with_timestamps_data_flow_mode :
                     skiq_tx_immediate_data_flow_mode);
         if ( 0 != status )
         {
@@ -730,6 +841,17 @@ static int32_t process_cmd_line_args(int argc, char* argv[])
     printf("Info: Requested Tx channel bandwidth is %" PRIu32 "\n", bandwidth);
     printf("Info: Requested block size in words is %" PRIu32 "\n",
             block_size_in_words);
+    if( lead_time > 0 )
+    {
+        if( ((int64_t)lead_time * 1000 * 1000) <= TX_BURST_DEFAULT_MIN_MARGIN_NS )
+        {
+            fprintf(stderr, "Error: the lead time must exceed %" PRIi64 " ms\n",
+                    (int64_t)(TX_BURST_DEFAULT_MIN_MARGIN_NS / (1000 * 1000)));
+            status = -1;
+            goto finished;
+        }
+        printf("Info: Requested Tx lead time is %" PRIu32 " ms\n", lead_time);
+    }
 
 finished:
     if (0 != status)
@@ -0,0 +1,682 @@
+/**
+ * @file   tx_waveform.h
+ *
+ * @brief  Transmit waveform generator that synthesizes samples directly into transmit blocks, as
+ *         an alternative to replaying a sample file.
+ *
+ * The generator is filled one block at a time, just before the block is transmitted, and keeps
+ * its phase, symbol clock and sequence state from one block to the next, so transmissions can
+ * run for any length of time with no input file and no load time.  Waveforms:
+ *
+ * - tx_waveform_tone:  a complex tone at an offset from the LO.
+ * - tx_waveform_chirp: a linear frequency sweep from one offset to another, restarting every
+ *   sweep period.
+ * - tx_waveform_pn:    a continuous BPSK modulated PN sequence (PN7, PN9, PN15, PN23 or PN31,
+ *   the ITU-T O.150 polynomials) at the symbol rate.
+ * - tx_waveform_bpsk:  BPSK frames: 32 bits of 1010 preamble, the 32-bit CCSDS attached sync
+ *   marker 0x1ACFFC1D, frame_bytes bytes of the PN sequence, then frame_gap samples of silence.
+ * - tx_waveform_gfsk:  the same frames with Gaussian frequency shift keying (bandwidth-time
+ *   product bt, peak deviation deviation).
+ *
+ * Every waveform drives a numerically controlled oscillator: a 32-bit phase accumulator whose
+ * upper TX_WAVEFORM_TABLE_BITS bits index a table of ready to transmit samples (amplitude,
+ * I/Q order and the DAC resolution applied once, when the table is built), so each sample is a
+ * phase update and one table load.  BPSK adds half a cycle to the phase for a 1 bit, GFSK
+ * shapes the frequency step of every sample.  With AVX2 the table loads are done 8 at a time
+ * with gathers, and the tone and chirp phases are computed 8 at a time as well.  The table
+ * resolution bounds the phase quantization spurs to about 6 dB per table bit below the carrier
+ * (-72 dBc).  The symbol clock is a 32-bit accumulator too, so the symbol rate need not divide
+ * the sample rate.
+ *
+ * Samples are written as 16-bit I/Q in either order, or packed 4 samples to 3 words when the
+ * transmit path is in packed mode (the inverse of iq_unpack.h).
+ */
+
+#ifndef __TX_WAVEFORM_H__
+#define __TX_WAVEFORM_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <math.h>
+
+#if (defined __x86_64__ || defined __i386__) && (defined __GNUC__) && \
+    ( (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)) || (defined __clang__) )
+#   define TX_WAVEFORM_HAVE_AVX2
+#   include <immintrin.h>
+#endif
+
+/***** DEFINES *****/
+
+/* NCO table of 2^TX_WAVEFORM_TABLE_BITS samples */
+#define TX_WAVEFORM_TABLE_BITS          (12)
+#define TX_WAVEFORM_TABLE_SIZE          (1 << TX_WAVEFORM_TABLE_BITS)
+
+/* samples generated per pass */
+#define TX_WAVEFORM_CHUNK               (4096)
+
+/* resolution of the GFSK frequency pulse per symbol, and its length in symbols */
+#define TX_WAVEFORM_PULSE_BITS          (6)
+#define TX_WAVEFORM_PULSE_STEPS         (1 << TX_WAVEFORM_PULSE_BITS)
+#define TX_WAVEFORM_PULSE_SPAN          (3)
+
+/* frame layout of tx_waveform_bpsk and tx_waveform_gfsk */
+#define TX_WAVEFORM_PREAMBLE            (0xAAAAAAAA)
+#define TX_WAVEFORM_SYNC_WORD           (0x1ACFFC1D)
+#define TX_WAVEFORM_FRAME_HEADER_BITS   (64)
+
+#define TX_WAVEFORM_DEFAULT_AMPLITUDE   (0.7)
+#define TX_WAVEFORM_DEFAULT_PN_ORDER    (9)
+#define TX_WAVEFORM_DEFAULT_BT          (0.5)
+#define TX_WAVEFORM_DEFAULT_FRAME_BYTES (64)
+
+/***** TYPEDEFS *****/
+
+enum tx_waveform_type
+{
+    tx_waveform_tone = 0,
+    tx_waveform_chirp,
+    tx_waveform_pn,
+    tx_waveform_bpsk,
+    tx_waveform_gfsk,
+};
+
+struct tx_waveform_config
+{
+    enum tx_waveform_type type;
+    double sample_rate;
+    double frequency;                   /* tone, start of the chirp or carrier, Hz from the LO */
+    double stop_frequency;              /* end of the chirp */
+    double sweep_period;                /* seconds per chirp sweep */
+    double symbol_rate;                 /* pn, bpsk and gfsk */
+    double deviation;                   /* gfsk peak deviation in Hz, 0 for a quarter of the
+                                           symbol rate (modulation index 0.5) */
+    double bt;                          /* gfsk bandwidth-time product */
+    uint32_t pn_order;
+    uint32_t frame_bytes;               /* bpsk and gfsk payload per frame */
+    uint32_t frame_gap;                 /* samples of silence after each frame */
+    double amplitude;                   /* fraction of full scale */
+    uint8_t resolution;                 /* DAC resolution in bits */
+    bool q_first;                       /* samples are ordered Q then I */
+    bool packed;                        /* write packed blocks */
+};
+
+/* NCO samples from a linearly changing phase (step += rate after each sample) */
+typedef void (*tx_waveform_nco_fn)( const uint32_t *p_table,
+                                    uint32_t *p_phase,
+                                    uint32_t *p_step,
+                                    uint32_t rate,
+                                    uint32_t nr_samples,
+                                    uint32_t *p_out );
+
+/* NCO samples from a phase per sample */
+typedef void (*tx_waveform_lookup_fn)( const uint32_t *p_table,
+                                       const uint32_t *p_phases,
+                                       uint32_t nr_samples,
+                                       uint32_t *p_out );
+
+struct tx_waveform
+{
+    struct tx_waveform_config config;
+    uint32_t *p_table;                  /* ready to transmit samples, indexed by phase */
+    uint32_t *p_phases;                 /* one chunk of modulated phases */
+    uint32_t *p_samples;                /* one chunk of samples when packing */
+
+    /* carrier */
+    uint32_t phase;
+    uint32_t step;
+    uint32_t start_step;                /* chirp */
+    uint32_t rate;
+    uint64_t sweep_len;
+    uint64_t sweep_pos;
+
+    /* symbols */
+    uint32_t symbol_phase;
+    uint32_t symbol_step;
+    int8_t symbols[3];                  /* previous, current and next, +1/-1, 0 past a frame */
+    uint32_t lfsr;
+    uint32_t lfsr_mask;
+    uint8_t lfsr_order;
+    uint8_t lfsr_tap;
+    uint32_t frame_bit;                 /* next bit of the frame */
+    uint32_t frame_bits;
+    uint32_t gap_left;                  /* samples of silence still to send */
+    float pulse[TX_WAVEFORM_PULSE_SPAN * TX_WAVEFORM_PULSE_STEPS];
+    double deviation_step;              /* phase step of the peak deviation */
+
+    /* statistics */
+    uint64_t nr_samples;
+    uint64_t nr_symbols;
+    uint64_t nr_frames;
+};
+
+#define TX_WAVEFORM_INITIALIZER         \
+    (struct tx_waveform){               \
+        .p_table = NULL,                \
+        .p_phases = NULL,               \
+        .p_samples = NULL,              \
+    }
+
+/***** INLINE FUNCTIONS  *****/
+
+/*****************************************************************************/
+/** Parse a waveform name.
+
+    @param[in]  p_name      "tone", "chirp", "pn", "bpsk" or "gfsk"
+    @param[out] p_type      waveform
+
+    @return 0 on success, -EINVAL for an unknown name
+*/
+static inline int32_t tx_waveform_parse( const char *p_name,
+                                         enum tx_waveform_type *p_type )
+{
+    static const char *p_names[] = { "tone", "chirp", "pn", "bpsk", "gfsk" };
+    uint32_t i;
+
+    for ( i = 0; i < sizeof(p_names) / sizeof(p_names[0]); i++ )
+    {
+        if ( strcasecmp( p_name, p_names[i] ) == 0 )
+        {
+            *p_type = (enum tx_waveform_type)i;
+            return 0;
+        }
+    }
+
+    return -EINVAL;
+}
+
+static inline void _tx_waveform_nco_scalar( const uint32_t *p_table,
+                                            uint32_t *p_phase,
+                                            uint32_t *p_step,
+                                            uint32_t rate,
+                                            uint32_t nr_samples,
+                                            uint32_t *p_out )
+{
+    uint32_t phase = *p_phase, step = *p_step, i;
+
+    for ( i = 0; i < nr_samples; i++ )
+    {
+        p_out[i] = p_table[phase >> ( 32 - TX_WAVEFORM_TABLE_BITS )];
+        phase += step;
+        step += rate;
+    }
+    *p_phase = phase;
+    *p_step = step;
+}
+
+static inline void _tx_waveform_lookup_scalar( const uint32_t *p_table,
+                                               const uint32_t *p_phases,
+                                               uint32_t nr_samples,
+                                               uint32_t *p_out )
+{
+    uint32_t i;
+
+    for ( i = 0; i < nr_samples; i++ )
+    {
+        p_out[i] = p_table[p_phases[i] >> ( 32 - TX_WAVEFORM_TABLE_BITS )];
+    }
+}
+
+#if (defined TX_WAVEFORM_HAVE_AVX2)
+/*
+  Lane k of the AVX2 NCO holds the phase and step of sample n + k.  Advancing every lane by 8
+  samples adds 8 steps and 0 + 1 + ... + 7 = 28 rates to the phase and 8 rates to the step, all
+  modulo 2^32, so the vector loop produces exactly the samples of the scalar one.
+*/
+__attribute__((target("avx2")))
+static inline void _tx_waveform_nco_avx2( const uint32_t *p_table,
+                                          uint32_t *p_phase,
+                                          uint32_t *p_step,
+                                          uint32_t rate,
+                                          uint32_t nr_samples,
+                                          uint32_t *p_out )
+{
+    uint32_t phase = *p_phase, step = *p_step, i = 0;
+
+    if ( nr_samples >= 8 )
+    {
+        const __m256i lane = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+        const __m256i tri = _mm256_setr_epi32( 0, 0, 1, 3, 6, 10, 15, 21 );
+        const __m256i v_rate = _mm256_set1_epi32( (int32_t)rate );
+        const __m256i v_rate8 = _mm256_set1_epi32( (int32_t)( 8 * rate ) );
+        const __m256i v_rate28 = _mm256_set1_epi32( (int32_t)( 28 * rate ) );
+        __m256i v_step = _mm256_add_epi32( _mm256_set1_epi32( (int32_t)step ),
+                                           _mm256_mullo_epi32( lane, v_rate ) );
+        __m256i v_phase = _mm256_add_epi32( _mm256_set1_epi32( (int32_t)phase ),
+                                            _mm256_add_epi32(
+                                                _mm256_mullo_epi32( lane,
+                                                    _mm256_set1_epi32( (int32_t)step ) ),
+                                                _mm256_mullo_epi32( tri, v_rate ) ) );
+
+        for ( ; i + 8 <= nr_samples; i += 8 )
+        {
+            const __m256i idx = _mm256_srli_epi32( v_phase, 32 - TX_WAVEFORM_TABLE_BITS );
+
+            _mm256_storeu_si256( (__m256i *)(p_out + i),
+                                 _mm256_i32gather_epi32( (const int *)p_table, idx, 4 ) );
+            v_phase = _mm256_add_epi32( v_phase, _mm256_add_epi32( _mm256_slli_epi32( v_step, 3 ),
+                                                                   v_rate28 ) );
+            v_step = _mm256_add_epi32( v_step, v_rate8 );
+        }
+        phase = (uint32_t)_mm256_extract_epi32( v_phase, 0 );
+        step = (uint32_t)_mm256_extract_epi32( v_step, 0 );
+    }
+
+    *p_phase = phase;
+    *p_step = step;
+    _tx_waveform_nco_scalar( p_table, p_phase, p_step, rate, nr_samples - i, p_out + i );
+}
+
+__attribute__((target("avx2")))
+static inline void _tx_waveform_lookup_avx2( const uint32_t *p_table,
+                                             const uint32_t *p_phases,
+                                             uint32_t nr_samples,
+                                             uint32_t *p_out )
+{
+    uint32_t i = 0;
+
+    for ( ; i + 8 <= nr_samples; i += 8 )
+    {
+        const __m256i idx = _mm256_srli_epi32( _mm256_loadu_si256( (const __m256i *)(p_phases + i) ),
+                                               32 - TX_WAVEFORM_TABLE_BITS );
+
+        _mm256_storeu_si256( (__m256i *)(p_out + i),
+                             _mm256_i32gather_epi32( (const int *)p_table, idx, 4 ) );
+    }
+    _tx_waveform_lookup_scalar( p_table, p_phases + i, nr_samples - i, p_out + i );
+}
+#endif
+
+/*****************************************************************************/
+/** Select the NCO kernels for this CPU.  The selection is made once.
+
+    @param[out] p_lookup    optional, the kernel for a phase per sample
+    @param[out] pp_name     optional, name of the kernels ("scalar" or "avx2")
+
+    @return the kernel for a linearly changing phase
+*/
+static inline tx_waveform_nco_fn tx_waveform_select( tx_waveform_lookup_fn *p_lookup,
+                                                     const char **pp_name )
+{
+    static tx_waveform_nco_fn p_nco = NULL;
+    static tx_waveform_lookup_fn p_lut = NULL;
+    static const char *p_name = NULL;
+
+    if ( p_nco == NULL )
+    {
+        p_nco = _tx_waveform_nco_scalar;
+        p_lut = _tx_waveform_lookup_scalar;
+        p_name = "scalar";
+#if (defined TX_WAVEFORM_HAVE_AVX2)
+        __builtin_cpu_init();
+        if ( __builtin_cpu_supports("avx2") )
+        {
+            p_nco = _tx_waveform_nco_avx2;
+            p_lut = _tx_waveform_lookup_avx2;
+            p_name = "avx2";
+        }
+#endif
+    }
+
+    if ( p_lookup != NULL )
+    {
+        *p_lookup = p_lut;
+    }
+    if ( pp_name != NULL )
+    {
+        *pp_name = p_name;
+    }
+
+    return p_nco;
+}
+
+/*****************************************************************************/
+/** Release a generator.  Safe to call on a generator that failed to initialize.
+
+    @param[in] g            generator
+
+    @return void
+*/
+static inline void tx_waveform_free( struct tx_waveform *g )
+{
+    free( g->p_table );
+    g->p_table = NULL;
+    free( g->p_phases );
+    g->p_phases = NULL;
+    free( g->p_samples );
+    g->p_samples = NULL;
+}
+
+/* phase step of a frequency, 2^32 is one cycle per sample */
+static inline uint32_t _tx_waveform_step( double frequency,
+                                          double sample_rate )
+{
+    return (uint32_t)(int64_t)llround( ( frequency / sample_rate ) * 4294967296.0 );
+}
+
+/* next bit of the PN sequence */
+static inline uint32_t _tx_waveform_pn_bit( struct tx_waveform *g )
+{
+    const uint32_t bit = ( ( g->lfsr >> ( g->lfsr_order - 1 ) ) ^
+                           ( g->lfsr >> ( g->lfsr_tap - 1 ) ) ) & 1;
+
+    g->lfsr = ( ( g->lfsr << 1 ) | bit ) & g->lfsr_mask;
+
+    return bit;
+}
+
+/* next symbol, +1 for a 0 bit and -1 for a 1 bit, 0 past the end of a frame */
+static inline int8_t _tx_waveform_next_symbol( struct tx_waveform *g )
+{
+    uint32_t bit;
+
+    if ( g->config.type == tx_waveform_pn )
+    {
+        bit = _tx_waveform_pn_bit( g );
+    }
+    else if ( g->frame_bit >= g->frame_bits )
+    {
+        return 0;
+    }
+    else if ( g->frame_bit < TX_WAVEFORM_FRAME_HEADER_BITS )
+    {
+        const uint32_t word = ( g->frame_bit < 32 ) ? TX_WAVEFORM_PREAMBLE : TX_WAVEFORM_SYNC_WORD;
+
+        bit = ( word >> ( 31 - ( g->frame_bit % 32 ) ) ) & 1;
+        g->frame_bit++;
+    }
+    else
+    {
+        bit = _tx_waveform_pn_bit( g );
+        g->frame_bit++;
+    }
+
+    return bit ? -1 : 1;
+}
+
+/* start a frame: the symbol window holds nothing, the first and the second symbol */
+static inline void _tx_waveform_start_frame( struct tx_waveform *g )
+{
+    g->frame_bit = 0;
+    g->symbol_phase = 0;
+    g->symbols[0] = 0;
+    g->symbols[1] = _tx_waveform_next_symbol( g );
+    g->symbols[2] = _tx_waveform_next_symbol( g );
+}
+
+/*****************************************************************************/
+/** Initialize a generator.
+
+    @param[out] g           generator
+    @param[in]  p_config    waveform, copied
+
+    @return 0 on success, -EINVAL for an invalid configuration, -ENOMEM
+*/
+static inline int32_t tx_waveform_init( struct tx_waveform *g,
+                                        const struct tx_waveform_config *p_config )
+{
+    /* ITU-T O.150 feedback taps */
+    static const uint8_t pn_taps[][2] = { { 7, 6 }, { 9, 5 }, { 15, 14 }, { 23, 18 }, { 31, 28 } };
+    const struct tx_waveform_config *c = p_config;
+    const bool symbols = ( c->type == tx_waveform_pn ) || ( c->type == tx_waveform_bpsk ) ||
+                         ( c->type == tx_waveform_gfsk );
+    double full_scale;
+    uint32_t i;
+
+    memset( g, 0, sizeof(*g) );
+    g->config = *c;
+    if ( ( c->sample_rate <= 0.0 ) || ( c->amplitude <= 0.0 ) || ( c->amplitude > 1.0 ) ||
+         ( c->resolution < 2 ) || ( c->resolution > 16 ) ||
+         ( fabs( c->frequency ) >= c->sample_rate / 2 ) ||
+         ( ( c->type == tx_waveform_chirp ) &&
+           ( ( fabs( c->stop_frequency ) >= c->sample_rate / 2 ) ||
+             ( c->sweep_period * c->sample_rate < 1.0 ) ) ) ||
+         ( symbols && ( ( c->symbol_rate <= 0.0 ) || ( c->symbol_rate >= c->sample_rate ) ) ) ||
+         ( ( c->type == tx_waveform_gfsk ) && ( c->bt <= 0.0 ) ) )
+    {
+        return -EINVAL;
+    }
+    for ( i = 0; i < sizeof(pn_taps) / sizeof(pn_taps[0]); i++ )
+    {
+        if ( pn_taps[i][0] == c->pn_order )
+        {
+            g->lfsr_order = pn_taps[i][0];
+            g->lfsr_tap = pn_taps[i][1];
+        }
+    }
+    if ( symbols && ( g->lfsr_order == 0 ) )
+    {
+        return -EINVAL;
+    }
+
+    g->p_table = malloc( TX_WAVEFORM_TABLE_SIZE * sizeof(uint32_t) );
+    g->p_phases = malloc( TX_WAVEFORM_CHUNK * sizeof(uint32_t) );
+    if ( c->packed )
+    {
+        g->p_samples = malloc( TX_WAVEFORM_CHUNK * sizeof(uint32_t) );
+    }
+    if ( ( g->p_table == NULL ) || ( g->p_phases == NULL ) ||
+         ( c->packed && ( g->p_samples == NULL ) ) )
+    {
+        tx_waveform_free( g );
+        return -ENOMEM;
+    }
+
+    /* the samples at the center of each phase interval */
+    full_scale = c->amplitude * (double)( ( 1 << ( c->resolution - 1 ) ) - 1 );
+    for ( i = 0; i < TX_WAVEFORM_TABLE_SIZE; i++ )
+    {
+        const double angle = 2.0 * M_PI * ( i + 0.5 ) / TX_WAVEFORM_TABLE_SIZE;
+        const uint16_t re = (uint16_t)(int16_t)lrint( full_scale * cos( angle ) );
+        const uint16_t im = (uint16_t)(int16_t)lrint( full_scale * sin( angle ) );
+
+        g->p_table[i] = c->q_first ? ( ( (uint32_t)re << 16 ) | im ) :
+                                     ( ( (uint32_t)im << 16 ) | re );
+    }
+
+    g->step = _tx_waveform_step( c->frequency, c->sample_rate );
+    if ( c->type == tx_waveform_chirp )
+    {
+        const uint32_t stop_step = _tx_waveform_step( c->stop_frequency, c->sample_rate );
+
+        g->start_step = g->step;
+        g->sweep_len = (uint64_t)llround( c->sweep_period * c->sample_rate );
+        g->rate = (uint32_t)(int32_t)lrint( (double)(int32_t)( stop_step - g->start_step ) /
+                                            (double)g->sweep_len );
+    }
+
+    if ( symbols )
+    {
+        g->lfsr_mask = (uint32_t)( ( 1ULL << g->lfsr_order ) - 1 );
+        g->lfsr = g->lfsr_mask;
+        g->symbol_step = (uint32_t)llround( ( c->symbol_rate / c->sample_rate ) * 4294967296.0 );
+        g->frame_bits = TX_WAVEFORM_FRAME_HEADER_BITS + 8 * c->frame_bytes;
+        _tx_waveform_start_frame( g );
+    }
+    if ( c->type == tx_waveform_gfsk )
+    {
+        /* rectangular symbol through a Gaussian filter, sampled over 3 symbols around its
+           center, see the GFSK case of _tx_waveform_modulate() */
+        const double k = M_PI * c->bt * sqrt( 2.0 / log( 2.0 ) );
+        const double deviation = ( c->deviation > 0.0 ) ? c->deviation : c->symbol_rate / 4;
+
+        for ( i = 0; i < TX_WAVEFORM_PULSE_SPAN * TX_WAVEFORM_PULSE_STEPS; i++ )
+        {
+            const double t = ( (double)i / TX_WAVEFORM_PULSE_STEPS ) - 1.5;
+
+            g->pulse[i] = (float)( 0.5 * ( erf( k * ( t + 0.5 ) ) - erf( k * ( t - 0.5 ) ) ) );
+        }
+        g->deviation_step = ( deviation / c->sample_rate ) * 4294967296.0;
+    }
+
+    return 0;
+}
+
+/* phases of up to nr modulated samples, stops early at the end of a frame */
+static inline uint32_t _tx_waveform_modulate( struct tx_waveform *g,
+                                              uint32_t nr )
+{
+    const bool gfsk = ( g->config.type == tx_waveform_gfsk );
+    uint32_t phase = g->phase, i;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        if ( g->symbols[1] == 0 )
+        {
+            /* the frame is over */
+            g->gap_left = g->config.frame_gap;
+            g->nr_frames++;
+            _tx_waveform_start_frame( g );
+            if ( g->gap_left > 0 )
+            {
+                break;
+            }
+        }
+
+        if ( gfsk )
+        {
+            /* position in the current symbol selects the pulse of each symbol of the window */
+            const uint32_t f = g->symbol_phase >> ( 32 - TX_WAVEFORM_PULSE_BITS );
+            const float shape = g->symbols[0] * g->pulse[2 * TX_WAVEFORM_PULSE_STEPS + f] +
+                                g->symbols[1] * g->pulse[TX_WAVEFORM_PULSE_STEPS + f] +
+                                g->symbols[2] * g->pulse[f];
+
+            g->p_phases[i] = phase;
+            phase += g->step + (uint32_t)(int32_t)lrint( g->deviation_step * shape );
+        }
+        else
+        {
+            g->p_phases[i] = phase + ( ( g->symbols[1] < 0 ) ? 0x80000000u : 0 );
+            phase += g->step;
+        }
+
+        if ( g->symbol_phase + g->symbol_step < g->symbol_phase )
+        {
+            g->symbols[0] = g->symbols[1];
+            g->symbols[1] = g->symbols[2];
+            g->symbols[2] = _tx_waveform_next_symbol( g );
+            g->nr_symbols++;
+        }
+        g->symbol_phase += g->symbol_step;
+    }
+    g->phase = phase;
+
+    return i;
+}
+
+/* generate nr ready to transmit 16-bit samples */
+static inline void _tx_waveform_generate( struct tx_waveform *g,
+                                          uint32_t *p_out,
+                                          uint32_t nr )
+{
+    tx_waveform_lookup_fn p_lookup;
+    const tx_waveform_nco_fn p_nco = tx_waveform_select( &p_lookup, NULL );
+
+    g->nr_samples += nr;
+    while ( nr > 0 )
+    {
+        uint32_t n = ( nr < TX_WAVEFORM_CHUNK ) ? nr : TX_WAVEFORM_CHUNK;
+
+        switch ( g->config.type )
+        {
+            case tx_waveform_tone:
+                p_nco( g->p_table, &(g->phase), &(g->step), 0, n, p_out );
+                break;
+
+            case tx_waveform_chirp:
+                if ( g->sweep_pos == g->sweep_len )
+                {
+                    g->sweep_pos = 0;
+                    g->step = g->start_step;
+                }
+                if ( g->sweep_len - g->sweep_pos < n )
+                {
+                    n = (uint32_t)( g->sweep_len - g->sweep_pos );
+                }
+                p_nco( g->p_table, &(g->phase), &(g->step), g->rate, n, p_out );
+                g->sweep_pos += n;
+                break;
+
+            default:
+                if ( g->gap_left > 0 )
+                {
+                    n = ( g->gap_left < n ) ? g->gap_left : n;
+                    memset( p_out, 0, n * sizeof(uint32_t) );
+                    g->gap_left -= n;
+                }
+                else
+                {
+                    n = _tx_waveform_modulate( g, n );
+                    p_lookup( g->p_table, g->p_phases, n, p_out );
+                }
+                break;
+        }
+        p_out += n;
+        nr -= n;
+    }
+}
+
+/* pack groups of 4 samples into 3 words, the layout iq_unpack.h reads */
+static inline void _tx_waveform_pack( const uint32_t *p_samples,
+                                      uint32_t nr_groups,
+                                      uint32_t *p_packed )
+{
+    uint32_t g;
+
+    for ( g = 0; g < nr_groups; g++ )
+    {
+        const uint16_t *p = (const uint16_t *)(p_samples + 4 * g);
+        const uint32_t a0 = p[0] & 0xFFF, b0 = p[1] & 0xFFF;
+        const uint32_t a1 = p[2] & 0xFFF, b1 = p[3] & 0xFFF;
+        const uint32_t a2 = p[4] & 0xFFF, b2 = p[5] & 0xFFF;
+        const uint32_t a3 = p[6] & 0xFFF, b3 = p[7] & 0xFFF;
+
+        p_packed[0] = ( b0 << 20 ) | ( a0 << 8 ) | ( b1 >> 4 );
+        p_packed[1] = ( b1 << 28 ) | ( a1 << 16 ) | ( b2 << 4 ) | ( a2 >> 8 );
+        p_packed[2] = ( a2 << 24 ) | ( b3 << 12 ) | a3;
+        p_packed += 3;
+    }
+}
+
+/*****************************************************************************/
+/** Fill the sample data of a transmit block with the next samples of the waveform.
+
+    @param[in]  g           generator
+    @param[out] p_data      sample data of the block
+    @param[in]  nr_words    block size in words; a multiple of 3 when packed
+
+    @return the number of samples written
+*/
+static inline uint32_t tx_waveform_fill( struct tx_waveform *g,
+                                         uint32_t *p_data,
+                                         uint32_t nr_words )
+{
+    const uint32_t nr_groups_chunk = TX_WAVEFORM_CHUNK / 4;
+    uint32_t nr_groups, done = 0;
+
+    if ( !g->config.packed )
+    {
+        _tx_waveform_generate( g, p_data, nr_words );
+        return nr_words;
+    }
+
+    nr_groups = nr_words / 3;
+    while ( done < nr_groups )
+    {
+        const uint32_t n = ( nr_groups - done < nr_groups_chunk ) ? nr_groups - done :
+            nr_groups_chunk;
+
+        _tx_waveform_generate( g, g->p_samples, 4 * n );
+        _tx_waveform_pack( g->p_samples, n, p_data + 3 * done );
+        done += n;
+    }
+
+    return 4 * nr_groups;
+}
+
+#endif  /* __TX_WAVEFORM_H__ */
@@ -0,0 +1,659 @@
+/**
+ * @file   work_pool.h
+ *
+ * @brief  Work-stealing thread pool with ordered strands.
+ *
+ * Each worker owns a queue of work items.  Items submitted to the pool are placed on the queue of
+ * a preferred worker; a worker that runs out of work steals from the other queues, so a burst of
+ * work for a single handle still spreads across all of the cores.
+ *
+ * A strand is a FIFO of work items that are guaranteed to run one at a time and in submission
+ * order, regardless of which worker picks them up.  Strands are used to keep the per-handle
+ * processing ordered (e.g. file output) while independent handles run in parallel.
+ *
+ * A group counts the items submitted through it, so a caller can wait for its own items to
+ * complete without waiting for everything else that shares the pool.
+ */
+
+#ifndef __WORK_POOL_H__
+#define __WORK_POOL_H__
+
+/***** INCLUDES *****/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/***** DEFINES *****/
+
+/* initial number of items each worker queue / strand can hold, queues grow on demand */
+#define WORK_QUEUE_INITIAL_DEPTH        (64)
+
+/* upper bound on the number of workers */
+#define WORK_POOL_MAX_NR_WORKERS        (64)
+
+/***** TYPEDEFS *****/
+
+typedef void (*work_fn)( void *p_arg );
+
+/* set of items that can be waited on apart from the rest of the pool */
+struct work_group
+{
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    uint32_t nr_pending;                /* items submitted through the group and not completed */
+};
+
+struct work_item
+{
+    work_fn fn;
+    void *p_arg;
+    struct work_group *p_group;         /* completed on the group, or NULL */
+};
+
+/* ring of work items, protected by its own lock */
+struct work_queue
+{
+    pthread_mutex_t lock;
+    struct work_item *p_items;
+    uint32_t head;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+struct work_pool;
+
+struct work_worker
+{
+    struct work_pool *p_pool;
+    uint32_t index;
+    pthread_t thread;
+};
+
+struct work_pool
+{
+    struct work_queue *p_queues;        /* one queue per worker */
+    struct work_worker *p_workers;
+    uint32_t nr_workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t idle;
+    uint32_t nr_queued;                 /* items waiting in the queues */
+    uint32_t nr_pending;                /* items queued or running */
+    uint32_t next_queue;                /* round-robin target when no worker is preferred */
+    bool stopping;
+
+    /* statistics */
+    uint64_t nr_executed;
+    uint64_t nr_stolen;
+};
+
+/* sequence of work items that execute one at a time, in order */
+struct work_strand
+{
+    struct work_pool *p_pool;
+    uint32_t home;                      /* preferred worker */
+
+    pthread_mutex_t lock;
+    pthread_cond_t drained;
+    struct work_queue fifo;
+    bool scheduled;                     /* strand is queued on, or running in, the pool */
+};
+
+/* pass as the preferred worker to distribute items round-robin */
+#define WORK_POOL_ANY_WORKER            (UINT32_MAX)
+
+/***** INLINE FUNCTIONS  *****/
+
+static inline int32_t _work_queue_init( struct work_queue *q )
+{
+    q->head = 0;
+    q->count = 0;
+    q->capacity = WORK_QUEUE_INITIAL_DEPTH;
+    q->p_items = calloc( q->capacity, sizeof(struct work_item) );
+    if ( q->p_items == NULL )
+    {
+        return -ENOMEM;
+    }
+    pthread_mutex_init( &(q->lock), NULL );
+
+    return 0;
+}
+
+static inline void _work_queue_free( struct work_queue *q )
+{
+    pthread_mutex_destroy( &(q->lock) );
+    free( q->p_items );
+    q->p_items = NULL;
+}
+
+/* caller holds the queue lock */
+static inline int32_t _work_queue_push( struct work_queue *q,
+                                        work_fn fn,
+                                        void *p_arg,
+                                        struct work_group *p_group )
+{
+    if ( q->count == q->capacity )
+    {
+        struct work_item *p_items;
+        uint32_t i;
+
+        p_items = calloc( (size_t)q->capacity * 2, sizeof(struct work_item) );
+        if ( p_items == NULL )
+        {
+            return -ENOMEM;
+        }
+        for ( i = 0; i < q->count; i++ )
+        {
+            p_items[i] = q->p_items[( q->head + i ) % q->capacity];
+        }
+        free( q->p_items );
+        q->p_items = p_items;
+        q->head = 0;
+        q->capacity *= 2;
+    }
+
+    q->p_items[( q->head + q->count ) % q->capacity].fn = fn;
+    q->p_items[( q->head + q->count ) % q->capacity].p_arg = p_arg;
+    q->p_items[( q->head + q->count ) % q->capacity].p_group = p_group;
+    q->count++;
+
+    return 0;
+}
+
+/* caller holds the queue lock */
+static inline bool _work_queue_pop( struct work_queue *q,
+                                    struct work_item *p_item )
+{
+    if ( q->count == 0 )
+    {
+        return false;
+    }
+
+    *p_item = q->p_items[q->head];
+    q->head = ( q->head + 1 ) % q->capacity;
+    q->count--;
+
+    return true;
+}
+
+/* an item of the group completed, or failed to be queued */
+static inline void _work_group_done( struct work_group *g )
+{
+    pthread_mutex_lock( &(g->lock) );
+    g->nr_pending--;
+    if ( g->nr_pending == 0 )
+    {
+        pthread_cond_broadcast( &(g->done) );
+    }
+    pthread_mutex_unlock( &(g->lock) );
+}
+
+static inline void *_work_pool_worker( void *p_arg )
+{
+    struct work_worker *p_worker = (struct work_worker *)p_arg;
+    struct work_pool *p = p_worker->p_pool;
+
+    while ( true )
+    {
+        struct work_item item;
+        bool found = false;
+        uint32_t i;
+
+        /* reserve an item so that the scan below is guaranteed to find one */
+        pthread_mutex_lock( &(p->lock) );
+        while ( ( p->nr_queued == 0 ) && !p->stopping )
+        {
+            pthread_cond_wait( &(p->work_ready), &(p->lock) );
+        }
+        if ( p->nr_queued == 0 )
+        {
+            pthread_mutex_unlock( &(p->lock) );
+            break;
+        }
+        p->nr_queued--;
+        pthread_mutex_unlock( &(p->lock) );
+
+        /* own queue first, then steal from the others */
+        while ( !found )
+        {
+            for ( i = 0; ( i < p->nr_workers ) && !found; i++ )
+            {
+                struct work_queue *q = &(p->p_queues[( p_worker->index + i ) % p->nr_workers]);
+
+                pthread_mutex_lock( &(q->lock) );
+                found = _work_queue_pop( q, &item );
+                pthread_mutex_unlock( &(q->lock) );
+
+                if ( found && ( i != 0 ) )
+                {
+                    __atomic_add_fetch( &(p->nr_stolen), 1, __ATOMIC_RELAXED );
+                }
+            }
+        }
+
+        item.fn( item.p_arg );
+        if ( item.p_group != NULL )
+        {
+            _work_group_done( item.p_group );
+        }
+
+        pthread_mutex_lock( &(p->lock) );
+        p->nr_executed++;
+        p->nr_pending--;
+        if ( p->nr_pending == 0 )
+        {
+            pthread_cond_broadcast( &(p->idle) );
+        }
+        pthread_mutex_unlock( &(p->lock) );
+    }
+
+    return NULL;
+}
+
+/*****************************************************************************/
+/** Number of online CPUs, used as the default pool size.
+
+    @return number of online CPUs (at least 1)
+*/
+static inline uint32_t work_pool_nr_cpus( void )
+{
+    long nr_cpus = sysconf( _SC_NPROCESSORS_ONLN );
+
+    return ( nr_cpus > 0 ) ? (uint32_t)nr_cpus : 1;
+}
+
+/*****************************************************************************/
+/** Start a pool of worker threads.
+
+    @param[out] p           pool to initialize
+    @param[in]  nr_workers  number of workers, 0 for one per online CPU
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t work_pool_init( struct work_pool *p,
+                                      uint32_t nr_workers )
+{
+    uint32_t i;
+    int32_t status = 0;
+
+    if ( nr_workers == 0 )
+    {
+        nr_workers = work_pool_nr_cpus();
+    }
+    if ( nr_workers > WORK_POOL_MAX_NR_WORKERS )
+    {
+        nr_workers = WORK_POOL_MAX_NR_WORKERS;
+    }
+
+    pthread_mutex_init( &(p->lock), NULL );
+    pthread_cond_init( &(p->work_ready), NULL );
+    pthread_cond_init( &(p->idle), NULL );
+    p->nr_queued = 0;
+    p->nr_pending = 0;
+    p->next_queue = 0;
+    p->stopping = false;
+    p->nr_executed = 0;
+    p->nr_stolen = 0;
+    p->nr_workers = 0;
+
+    p->p_queues = calloc( nr_workers, sizeof(struct work_queue) );
+    p->p_workers = calloc( nr_workers, sizeof(struct work_worker) );
+    if ( ( p->p_queues == NULL ) || ( p->p_workers == NULL ) )
+    {
+        free( p->p_queues );
+        free( p->p_workers );
+        return -ENOMEM;
+    }
+
+    for ( i = 0; i < nr_workers; i++ )
+    {
+        status = _work_queue_init( &(p->p_queues[i]) );
+        if ( status != 0 )
+        {
+            break;
+        }
+    }
+    if ( status != 0 )
+    {
+        while ( i-- > 0 )
+        {
+            _work_queue_free( &(p->p_queues[i]) );
+        }
+        free( p->p_queues );
+        free( p->p_workers );
+        return status;
+    }
+    /* workers may scan every queue as soon as they start */
+    p->nr_workers = nr_workers;
+
+    for ( i = 0; i < nr_workers; i++ )
+    {
+        p->p_workers[i].p_pool = p;
+        p->p_workers[i].index = i;
+        if ( pthread_create( &(p->p_workers[i].thread), NULL, _work_pool_worker,
+                             &(p->p_workers[i]) ) != 0 )
+        {
+            status = -EAGAIN;
+            break;
+        }
+    }
+    if ( status != 0 )
+    {
+        uint32_t nr_started = i;
+
+        pthread_mutex_lock( &(p->lock) );
+        p->stopping = true;
+        pthread_cond_broadcast( &(p->work_ready) );
+        pthread_mutex_unlock( &(p->lock) );
+        for ( i = 0; i < nr_started; i++ )
+        {
+            pthread_join( p->p_workers[i].thread, NULL );
+        }
+        for ( i = 0; i < nr_workers; i++ )
+        {
+            _work_queue_free( &(p->p_queues[i]) );
+        }
+        free( p->p_queues );
+        free( p->p_workers );
+        p->nr_workers = 0;
+    }
+
+    return status;
+}
+
+static inline int32_t _work_pool_submit( struct work_pool *p,
+                                         work_fn fn,
+                                         void *p_arg,
+                                         uint32_t worker,
+                                         struct work_group *p_group )
+{
+    struct work_queue *q;
+    int32_t status;
+
+    if ( worker == WORK_POOL_ANY_WORKER )
+    {
+        worker = __atomic_fetch_add( &(p->next_queue), 1, __ATOMIC_RELAXED );
+    }
+    q = &(p->p_queues[worker % p->nr_workers]);
+
+    /* account for the item first so a waiter never sees the pool idle while it is queued */
+    pthread_mutex_lock( &(p->lock) );
+    p->nr_pending++;
+    pthread_mutex_unlock( &(p->lock) );
+
+    pthread_mutex_lock( &(q->lock) );
+    status = _work_queue_push( q, fn, p_arg, p_group );
+    pthread_mutex_unlock( &(q->lock) );
+
+    pthread_mutex_lock( &(p->lock) );
+    if ( status == 0 )
+    {
+        p->nr_queued++;
+        pthread_cond_signal( &(p->work_ready) );
+    }
+    else
+    {
+        p->nr_pending--;
+        if ( p->nr_pending == 0 )
+        {
+            pthread_cond_broadcast( &(p->idle) );
+        }
+    }
+    pthread_mutex_unlock( &(p->lock) );
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Queue a work item.
+
+    @param[in] p            pool
+    @param[in] fn           function to run
+    @param[in] p_arg        argument passed to fn
+    @param[in] worker       preferred worker or WORK_POOL_ANY_WORKER
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t work_pool_submit( struct work_pool *p,
+                                        work_fn fn,
+                                        void *p_arg,
+                                        uint32_t worker )
+{
+    return _work_pool_submit( p, fn, p_arg, worker, NULL );
+}
+
+/*****************************************************************************/
+/** Wait until every submitted item (including items submitted by running items) has completed.
+
+    @param[in] p            pool
+*/
+static inline void work_pool_wait( struct work_pool *p )
+{
+    pthread_mutex_lock( &(p->lock) );
+    while ( p->nr_pending > 0 )
+    {
+        pthread_cond_wait( &(p->idle), &(p->lock) );
+    }
+    pthread_mutex_unlock( &(p->lock) );
+}
+
+/*****************************************************************************/
+/** Run any outstanding work, stop the workers and release the pool.  Safe to call on a pool
+    that failed to initialize.
+
+    @param[in] p            pool
+*/
+static inline void work_pool_destroy( struct work_pool *p )
+{
+    uint32_t i;
+
+    if ( p->nr_workers == 0 )
+    {
+        return;
+    }
+
+    work_pool_wait( p );
+
+    pthread_mutex_lock( &(p->lock) );
+    p->stopping = true;
+    pthread_cond_broadcast( &(p->work_ready) );
+    pthread_mutex_unlock( &(p->lock) );
+
+    for ( i = 0; i < p->nr_workers; i++ )
+    {
+        pthread_join( p->p_workers[i].thread, NULL );
+        _work_queue_free( &(p->p_queues[i]) );
+    }
+    free( p->p_queues );
+    p->p_queues = NULL;
+    free( p->p_workers );
+    p->p_workers = NULL;
+    p->nr_workers = 0;
+}
+
+/* execute the items of a strand in order, then release it */
+static inline void _work_strand_run( void *p_arg )
+{
+    struct work_strand *s = (struct work_strand *)p_arg;
+    struct work_item item;
+
+    pthread_mutex_lock( &(s->lock) );
+    while ( _work_queue_pop( &(s->fifo), &item ) )
+    {
+        pthread_mutex_unlock( &(s->lock) );
+        item.fn( item.p_arg );
+        pthread_mutex_lock( &(s->lock) );
+    }
+    s->scheduled = false;
+    pthread_cond_broadcast( &(s->drained) );
+    pthread_mutex_unlock( &(s->lock) );
+}
+
+/*****************************************************************************/
+/** Initialize a strand.
+
+    @param[out] s           strand to initialize
+    @param[in]  p           pool that runs the strand
+    @param[in]  home        preferred worker or WORK_POOL_ANY_WORKER
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t work_strand_init( struct work_strand *s,
+                                        struct work_pool *p,
+                                        uint32_t home )
+{
+    s->p_pool = p;
+    s->home = home;
+    s->scheduled = false;
+    pthread_mutex_init( &(s->lock), NULL );
+    pthread_cond_init( &(s->drained), NULL );
+
+    return _work_queue_init( &(s->fifo) );
+}
+
+/*****************************************************************************/
+/** Queue a work item on a strand.  Items on the same strand never run concurrently and run in
+    the order they were submitted.
+
+    @param[in] s            strand
+    @param[in] fn           function to run
+    @param[in] p_arg        argument passed to fn
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t work_strand_submit( struct work_strand *s,
+                                          work_fn fn,
+                                          void *p_arg )
+{
+    int32_t status;
+
+    /* the pool never takes the strand lock while holding its own, so the strand is scheduled
+       under it; an idle strand has an empty FIFO, so on failure the item pushed here is the
+       only one and is taken back out for work_strand_wait() */
+    pthread_mutex_lock( &(s->lock) );
+    status = _work_queue_push( &(s->fifo), fn, p_arg, NULL );
+    if ( ( status == 0 ) && !s->scheduled )
+    {
+        status = work_pool_submit( s->p_pool, _work_strand_run, s, s->home );
+        if ( status == 0 )
+        {
+            s->scheduled = true;
+        }
+        else
+        {
+            s->fifo.count--;
+            pthread_cond_broadcast( &(s->drained) );
+        }
+    }
+    pthread_mutex_unlock( &(s->lock) );
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Wait until every item submitted to a strand has completed.  Other strands sharing the pool
+    are not waited on.
+
+    @param[in] s            strand
+*/
+static inline void work_strand_wait( struct work_strand *s )
+{
+    pthread_mutex_lock( &(s->lock) );
+    while ( s->scheduled || ( s->fifo.count > 0 ) )
+    {
+        pthread_cond_wait( &(s->drained), &(s->lock) );
+    }
+    pthread_mutex_unlock( &(s->lock) );
+}
+
+/*****************************************************************************/
+/** Release a strand.  The caller must make sure the strand is idle (see work_strand_wait()).
+
+    @param[in] s            strand
+*/
+static inline void work_strand_destroy( struct work_strand *s )
+{
+    _work_queue_free( &(s->fifo) );
+    pthread_cond_destroy( &(s->drained) );
+    pthread_mutex_destroy( &(s->lock) );
+}
+
+/*****************************************************************************/
+/** Initialize a group.
+
+    @param[out] g           group to initialize
+
+    @return void
+*/
+static inline void work_group_init( struct work_group *g )
+{
+    pthread_mutex_init( &(g->lock), NULL );
+    pthread_cond_init( &(g->done), NULL );
+    g->nr_pending = 0;
+}
+
+/*****************************************************************************/
+/** Queue a work item on a pool as part of a group.
+
+    @param[in] g            group
+    @param[in] p            pool
+    @param[in] fn           function to run
+    @param[in] p_arg        argument passed to fn
+    @param[in] worker       preferred worker or WORK_POOL_ANY_WORKER
+
+    @return 0 on success, else a negative errno
+*/
+static inline int32_t work_group_submit( struct work_group *g,
+                                         struct work_pool *p,
+                                         work_fn fn,
+                                         void *p_arg,
+                                         uint32_t worker )
+{
+    int32_t status;
+
+    pthread_mutex_lock( &(g->lock) );
+    g->nr_pending++;
+    pthread_mutex_unlock( &(g->lock) );
+
+    status = _work_pool_submit( p, fn, p_arg, worker, g );
+    if ( status != 0 )
+    {
+        _work_group_done( g );
+    }
+
+    return status;
+}
+
+/*****************************************************************************/
+/** Wait until every item submitted through a group has completed.  Other items sharing the
+    pool are not waited on.
+
+    @param[in] g            group
+*/
+static inline void work_group_wait( struct work_group *g )
+{
+    pthread_mutex_lock( &(g->lock) );
+    while ( g->nr_pending > 0 )
+    {
+        pthread_cond_wait( &(g->done), &(g->lock) );
+    }
+    pthread_mutex_unlock( &(g->lock) );
+}
+
+/*****************************************************************************/
+/** Release a group.  The caller must make sure the group is idle (see work_group_wait()).
+
+    @param[in] g            group
+*/
+static inline void work_group_destroy( struct work_group *g )
+{
+    pthread_cond_destroy( &(g->done) );
+    pthread_mutex_destroy( &(g->lock) );
+}
+
+#endif  /* __WORK_POOL_H__ */
@@ -7,6 +7,10 @@
  * </pre>
  */
 
+#if (!defined _GNU_SOURCE)
+#define _GNU_SOURCE         /* for pthread_setaffinity_np, see feature_test_macros(7) */
+#endif
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -20,6 +24,9 @@
 #include <sidekiq_api.h>
 #include <arg_parser.h>
 
+#include "rt_thread.h"
+#include "tx_block_pool.h"
+
 /* https://gcc.gnu.org/onlinedocs/gcc-4.8.5/cpp/Stringification.html */
 #define xstr(s)                         str(s)
 #define str(s)                          #s
@@ -28,6 +35,10 @@
 #   define DEFAULT_CARD_NUMBER  0
 #endif
 
+#ifndef DEFAULT_IN_FLIGHT
+#   define DEFAULT_IN_FLIGHT    32
+#endif
+
 /* these are used to provide help strings for the application when running it
    with either the "-h" or "--help" flags */
 static const char* p_help_short = "- get Rx and Tx metrics";
@@ -37,11 +48,22 @@ Collects benchmark metrics of running Rx and Tx simultaneously. Note that\n\
 transmit will default to synchronous mode unless threads is specified to be\n\
 greater than one.\n\
 \n\
+Asynchronous transmit keeps at most '--in-flight' blocks queued: a block is\n\
+only sent again once its completion callback returned it, and while every\n\
+block is in flight (or the send queue is full) the transmit thread polls for\n\
+a completion '--spin' times before it sleeps until one arrives.\n\
+\n\
 Defaults:\n\
   --block-size=1020\n\
   --card=" xstr(DEFAULT_CARD_NUMBER) "\n\
   --rate=1000000\n\
-  --threads=1";
+  --threads=1\n\
+  --in-flight=" xstr(DEFAULT_IN_FLIGHT) "\n\
+  --spin=" xstr(TX_BLOCK_POOL_DEFAULT_SPIN) "\n\
+" RT_THREAD_HELP_DEFAULTS "\
+\n\
+The receive loop is thread 0, the transmit thread is thread 1 and the monitor\n\
+thread is thread 2 for --cpus, the monitor thread does not run with --rt-priority.";
 
 /* command line argument variables */
 static uint8_t card = UINT8_MAX;
@@ -49,9 +71,12 @@ static char* p_serial = NULL;
 static uint32_t sample_rate = 1000000;
 static uint8_t num_threads = 0;
 static uint16_t pkt_size_in_words = 1020;
+static uint32_t in_flight = DEFAULT_IN_FLIGHT;
+static uint32_t spin_count = TX_BLOCK_POOL_DEFAULT_SPIN;
 static bool blocking_rx = false;
 static char* p_temp_log_name = NULL;
 static bool temp_log_is_set = false;
+static struct rt_thread_config rt_cfg = RT_THREAD_CONFIG_INITIALIZER;
 
 /* pthread related variables */
 static pthread_t monitor_thread;
@@ -72,10 +97,10 @@ static uint32_t threshold=0; // max number of errors/underruns before failure
 static uint64_t num_bytes_in_tx_pkt=0;
 static skiq_tx_transfer_mode_t transfer_mode = skiq_tx_transfer_mode_sync;
 
-static uint64_t num_tx_pkts_complete = 0;
 static uint64_t num_tx_pkts = 0;
 
 static skiq_tx_block_t *p_tx_block = NULL;
+static struct tx_block_pool tx_pool; /* transmit blocks recycled by the completion callback */
 
 static FILE *p_temp_log=NULL;
 
@@ -118,6 +143,18 @@ static struct application_argument p_args[] =
                 "N",
                 &num_threads,
                 UINT8_VAR_TYPE),
+    APP_ARG_OPT("in-flight",
+                0,
+                "Maximum number of blocks queued for asynchronous transmit",
+                "N",
+                &in_flight,
+                UINT32_VAR_TYPE),
+    APP_ARG_OPT("spin",
+                0,
+                "Number of polls for a completion before the transmit thread sleeps",
+                "COUNT",
+                &spin_count,
+                UINT32_VAR_TYPE),
     APP_ARG_OPT("threshold",
                 0,
                 "Number of timestamp gaps or underrun occurrences before considering test a failure",
@@ -143,6 +180,7 @@ static struct application_argument p_args[] =
                         &p_temp_log_name,
                         STRING_VAR_TYPE,
                         &temp_log_is_set),    
+    RT_THREAD_APP_ARGS(&rt_cfg),
 
     APP_ARG_TERMINATOR,
 };
@@ -164,22 +202,28 @@ void app_cleanup(int signum)
 /** This is the callback function that is called when running in async mode
     when a packet has completed processing.  There is no guarantee that the
     complete callback will be in the order that the data was sent, this
-    function just increments the completion count and signals the main thread
-    that there is space available to send more packets.
+    function just returns the block to the pool, which counts the completion
+    and wakes the transmit thread if it is waiting for a block.
 
     @param status status of the transmit packet completed
     @param p_block reference to the completed transmit block
-    @param p_user reference to the user data
+    @param p_user reference to the pool entry of the block
     @return void
 */
 void tx_complete_callback( int32_t status, skiq_tx_block_t *p_block, void *p_user )
 {
+    (void)p_block;
+
     if( status != 0 )
     {
-        printf("Error: packet %" PRIu64 " failed with status %d\n", num_tx_pkts_complete, status);
+        printf("Error: packet %" PRIu64 " failed with status %d\n",
+               tx_block_pool_completed( &tx_pool ), status);
     }
 
-    num_tx_pkts_complete++;
+    if( p_user != NULL )
+    {
+        tx_block_pool_put( &tx_pool, (struct tx_pool_entry *)p_user );
+    }
 }
 
 /*****************************************************************************/
@@ -258,7 +302,26 @@ void* monitor_performance(void *ptr)
 }
 
 /*****************************************************************************/
-/** This is a separate thread that sends packets to the DMA engine.
+/** This function fills a transmit block with a counting pattern.
+
+    @param p_block the transmit block
+    @return void
+*/
+static void fill_tx_block( skiq_tx_block_t *p_block )
+{
+    uint32_t i;
+
+    for( i=0; i<pkt_size_in_words; i++ )
+    {
+        p_block->data[i] = i;
+    }
+}
+
+/*****************************************************************************/
+/** This is a separate thread that sends packets to the DMA engine.  In async
+    mode the packets are taken from the pool of transmit blocks, so at most
+    --in-flight of them are queued, and the thread waits for a completion when
+    the pool is empty or the send queue is full.
 
     @param none
     @return none
@@ -266,28 +329,29 @@ void* monitor_performance(void *ptr)
 void* send_pkts(void *ptr)
 {
     uint32_t i=0;
-    uint32_t curr_count=0;
     int32_t status=0;
     uint64_t num_pkts=0;
-    uint32_t usleep_period;
+    struct tx_pool_entry *p_entry = NULL;
 
-    /* allocate the memory for the transmit block by number of bytes */
-    p_tx_block = skiq_tx_block_allocate_by_bytes( num_bytes_in_tx_pkt );
-    if( p_tx_block == NULL )
+    if( transfer_mode == skiq_tx_transfer_mode_async )
     {
-        printf("Error: unable to allocate a transmit block\n");
-        return (NULL);
+        for( i=0; i<tx_pool.nr_blocks; i++ )
+        {
+            fill_tx_block( tx_pool.p_entries[i].p_block );
+        }
     }
-    /* initialize the packet of data */
-    for( i=0; i<pkt_size_in_words; i++ )
+    else
     {
-        p_tx_block->data[i] = curr_count;
-        curr_count++;
+        /* allocate the memory for the transmit block by number of bytes */
+        p_tx_block = skiq_tx_block_allocate_by_bytes( num_bytes_in_tx_pkt );
+        if( p_tx_block == NULL )
+        {
+            printf("Error: unable to allocate a transmit block\n");
+            return (NULL);
+        }
+        fill_tx_block( p_tx_block );
     }
 
-    // the sleep period should be a factor of the sample rate and pkt size
-    usleep_period = (1.0/((float)(sample_rate)/1000000.0))*num_bytes_in_tx_pkt;
-
     // initialize the interface
     skiq_write_tx_data_flow_mode(card, skiq_tx_hdl_A1, skiq_tx_immediate_data_flow_mode);
     skiq_write_tx_block_size(card, skiq_tx_hdl_A1, (num_bytes_in_tx_pkt-SKIQ_TX_HEADER_SIZE_IN_BYTES)/4);
@@ -302,21 +366,47 @@ void* send_pkts(void *ptr)
     /* run forever and ever and ever (or until Ctrl-C) */
     while( running )
     {
-        /* send the data */
-        status=skiq_transmit(card, skiq_tx_hdl_A1, p_tx_block, NULL);
-        if( status != 0 )
+        if( transfer_mode == skiq_tx_transfer_mode_async )
         {
-            // if we're running async and we got a queue full indication,
-            // we should wait for a bit and then try to transmit again
-            if( (transfer_mode == skiq_tx_transfer_mode_async) &&
-                (status == SKIQ_TX_ASYNC_SEND_QUEUE_FULL) )
+            // read the completion count first so that a block freed after the
+            // attempts below is never missed by the wait
+            uint64_t completed = tx_block_pool_completed( &tx_pool );
+
+            // take a free block (unless one is still held from a previous
+            // attempt that found the send queue full)
+            if( p_entry == NULL )
             {
-                usleep(usleep_period);
+                p_entry = tx_block_pool_get( &tx_pool );
+                if( p_entry == NULL )
+                {
+                    // every block is in flight, wait for one to complete
+                    tx_block_pool_wait( &tx_pool, completed, &running );
+                    continue;
+                }
             }
-            else
+
+            status=skiq_transmit(card, skiq_tx_hdl_A1, p_entry->p_block, p_entry);
+            if( status == SKIQ_TX_ASYNC_SEND_QUEUE_FULL )
+            {
+                // hold on to the block until a completion makes room
+                tx_block_pool_wait( &tx_pool, completed, &running );
+                continue;
+            }
+            else if( status != 0 )
             {
-                printf("packet %" PRIu64 " sent failed with error %d\n", num_pkts, status);
+                tx_block_pool_unget( &tx_pool, p_entry );
             }
+            p_entry = NULL;
+        }
+        else
+        {
+            /* send the data */
+            status=skiq_transmit(card, skiq_tx_hdl_A1, p_tx_block, NULL);
+        }
+
+        if( status != 0 )
+        {
+            printf("packet %" PRIu64 " sent failed with error %d\n", num_pkts, status);
         }
         else
         {
@@ -327,19 +417,33 @@ void* send_pkts(void *ptr)
         }
     }
 
+    if( p_entry != NULL )
+    {
+        tx_block_pool_unget( &tx_pool, p_entry );
+    }
+
     if( transfer_mode == skiq_tx_transfer_mode_async )
     {
+        bool draining = true;
+
         printf("Waiting for packets to complete transfer, num_pkts %" PRIu64 ", num_complete %" PRIu64 "\n",
-               num_tx_pkts, num_tx_pkts_complete);
-        while( num_tx_pkts_complete < num_tx_pkts )
+               num_tx_pkts, tx_block_pool_completed( &tx_pool ));
+        while( tx_block_pool_completed( &tx_pool ) < num_tx_pkts )
         {
-            usleep(usleep_period);
+            tx_block_pool_wait( &tx_pool, tx_block_pool_completed( &tx_pool ), &draining );
         }
+        printf("Info: at most %" PRIu32 " of %" PRIu32 " blocks in flight, waited for a"
+               " completion %" PRIu64 " time(s) while polling and %" PRIu64 " time(s) asleep\n",
+               tx_pool.max_in_flight, tx_pool.nr_blocks, tx_pool.nr_spin_waits,
+               tx_pool.nr_parks);
     }
     printf("Packet send completed!\n");
 
     skiq_stop_tx_streaming(card, skiq_tx_hdl_A1);
-    skiq_tx_block_free(p_tx_block);
+    if( p_tx_block != NULL )
+    {
+        skiq_tx_block_free(p_tx_block);
+    }
 
     return (NULL);
 }
@@ -360,6 +464,8 @@ int main( int argc, char *argv[] )
     /* always install a handler for proper cleanup */
     signal(SIGINT, app_cleanup);
 
+    tx_pool = TX_BLOCK_POOL_INITIALIZER;
+
     if( 0 != arg_parser(argc, argv, p_help_short, p_help_long, p_args) )
     {
         perror("Command Line");
@@ -367,6 +473,11 @@ int main( int argc, char *argv[] )
         return (-1);
     }
 
+    if( rt_thread_config_init( &rt_cfg ) != 0 )
+    {
+        return (-1);
+    }
+
     if( (UINT8_MAX != card) && (NULL != p_serial) )
     {
         printf("Error: must specify EITHER card ID or serial number, not"
@@ -499,6 +610,20 @@ int main( int argc, char *argv[] )
             }
             _exit(-1);
         }
+        if( tx_block_pool_init( &tx_pool, (in_flight > 0) ? in_flight : 1,
+                                num_bytes_in_tx_pkt - SKIQ_TX_HEADER_SIZE_IN_BYTES,
+                                spin_count ) != 0 )
+        {
+            printf("Error: unable to allocate %" PRIu32 " transmit blocks\n", in_flight);
+            skiq_exit();
+            if( p_temp_log != NULL )
+            {
+                fclose( p_temp_log );
+            }
+            _exit(-1);
+        }
+        printf("Info: transmitting with at most %" PRIu32 " blocks in flight\n",
+               tx_pool.nr_blocks);
     }
 
     // the sleep period should be a factor of the sample rate and pkt size
@@ -506,9 +631,14 @@ int main( int argc, char *argv[] )
 
     /* initialize a thread to monitor our performance */
     pthread_create( &monitor_thread, NULL, monitor_performance, NULL );
+    (void)rt_thread_apply( &rt_cfg, monitor_thread, 2, false, "monitor" );
 
     /* intialize a thread to continuously transmit */
     pthread_create( &tx_thread, NULL, send_pkts, NULL );
+    (void)rt_thread_apply( &rt_cfg, tx_thread, 1, true, "Tx" );
+
+    /* the other threads are started first so they don't inherit the receive settings */
+    (void)rt_thread_apply( &rt_cfg, pthread_self(), 0, true, "Rx" );
 
     //  start streaming
     skiq_start_rx_streaming(card, skiq_rx_hdl_A1);
@@ -554,6 +684,9 @@ int main( int argc, char *argv[] )
 
     skiq_exit();
 
+    /* the transmit threads have stopped, so no block can still be in flight */
+    tx_block_pool_free( &tx_pool );
+
     if( p_temp_log != NULL )
     {
         fclose( p_temp_log );